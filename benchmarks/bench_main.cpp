@@ -0,0 +1,23 @@
+/**
+ * @file benchmarks/bench_main.cpp
+ * @brief Entry point definition.
+ */
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/logging.h"
+
+int main(int argc, char **argv) {
+  // Only errors are logged, so logging doesn't skew the results
+  auto deinit_log = logging::init(4, "sunshine_bench.log");
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,419 @@
+/**
+ * @file benchmarks/bench_stream.cpp
+ * @brief Benchmarks of the packetization, FEC and encryption of the video and audio streams.
+ * @details The frames and audio packets go through the same steps as in src/stream.cpp,
+ *          and are sent to a sink that copies the datagrams out like the kernel would
+ *          instead of to a socket. The frames of a stream recorded with the packet_capture
+ *          option are replayed when SUNSHINE_BENCH_PACKETS names the capture file.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+extern "C" {
+// clang-format off
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include "src/rswrapper.h"
+// clang-format on
+}
+
+// local includes
+#include "src/crypto.h"
+#include "src/packet_capture.h"
+#include "src/platform/common.h"
+#include "src/utility.h"
+
+namespace stream {
+  size_t gather_slices(std::span<const std::string_view> segments, size_t slice_size, size_t first_slice, size_t slice_count, uint8_t **slices, uint8_t *scratch);
+}
+
+namespace {
+  // The packet size most clients ask for
+  constexpr std::size_t PACKET_SIZE = 1392;
+
+  // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+  constexpr std::size_t MAX_FEC_BLOCKS = 4;
+
+  // The headers of a video packet, as laid out by video_packet_raw_t
+  constexpr std::size_t VIDEO_HEADER_SIZE = sizeof(RTP_PACKET) + 4 + sizeof(NV_VIDEO_PACKET);
+
+  // The IV, frame number and GCM tag in front of an encrypted video packet, as laid out by video_packet_enc_prefix_t
+  constexpr std::size_t VIDEO_PREFIX_SIZE = 12 + sizeof(std::uint32_t) + crypto::cipher::tag_size;
+
+  // The largest audio packet, the audio shards are sized for it
+  constexpr std::size_t MAX_AUDIO_PACKET_SIZE = 1400;
+
+  using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
+    reed_solomon_release(rs);
+  }>;
+
+  /**
+   * @brief Stands in for platf::send_batch(), copying each datagram into a buffer.
+   */
+  class loopback_sink_t {
+  public:
+    void send(platf::batched_send_info_t &send_info) {
+      for (auto x = send_info.block_offset; x < send_info.block_offset + send_info.block_count; ++x) {
+        std::memcpy(_datagram.data(), send_info.headers + x * send_info.header_size, send_info.header_size);
+
+        auto payload = send_info.buffer_for_payload_offset(x * send_info.payload_size);
+        std::memcpy(_datagram.data() + send_info.header_size, payload.buffer, send_info.payload_size);
+
+        benchmark::DoNotOptimize(_datagram.data());
+        ++packets;
+      }
+
+      bytes += send_info.block_count * (send_info.header_size + send_info.payload_size);
+    }
+
+    void send(const char *data, std::size_t size) {
+      std::memcpy(_datagram.data(), data, size);
+      benchmark::DoNotOptimize(_datagram.data());
+
+      ++packets;
+      bytes += size;
+    }
+
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+
+  private:
+    std::array<char, 4096> _datagram;
+  };
+
+  void report(benchmark::State &state, const loopback_sink_t &sink, std::uint64_t input_bytes) {
+    state.SetBytesProcessed((std::int64_t) input_bytes);
+    state.counters["packets_per_second"] = benchmark::Counter((double) sink.packets, benchmark::Counter::kIsRate);
+    state.counters["ns_per_byte"] = benchmark::Counter((double) input_bytes / 1e9, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  }
+
+  crypto::aes_t bench_key() {
+    crypto::aes_t key(16);
+    for (std::size_t x = 0; x < key.size(); ++x) {
+      key[x] = (std::uint8_t) (x * 7);
+    }
+    return key;
+  }
+
+  /**
+   * @brief The storage of the video stream of a session, reused across frames.
+   */
+  class video_pipeline_t {
+  public:
+    video_pipeline_t(std::size_t fec_percentage, bool encrypted):
+        _fec_percentage {fec_percentage},
+        _prefixsize {encrypted ? VIDEO_PREFIX_SIZE : 0} {
+      if (encrypted) {
+        _cipher.emplace(bench_key(), false);
+      }
+    }
+
+    /**
+     * @brief Split a frame into FEC blocks, protect and encrypt them, then send them.
+     */
+    void send_frame(std::string_view frame, loopback_sink_t &sink) {
+      const std::array<std::string_view, 1> segments {frame};
+      send_frame(segments, frame.size(), sink);
+    }
+
+    /**
+     * @brief Send a frame made of several segments, like a keyframe with rewritten parameter sets.
+     */
+    void send_frame(std::span<const std::string_view> segments, std::size_t frame_size, loopback_sink_t &sink) {
+      auto frame_shards = (frame_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+      auto fec_percentage = _fec_percentage;
+      auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fec_percentage);
+      auto fec_blocks_needed = (frame_shards + (max_data_shards_per_fec_block - 1)) / max_data_shards_per_fec_block;
+      if (fec_blocks_needed > MAX_FEC_BLOCKS) {
+        fec_percentage = 0;
+        fec_blocks_needed = MAX_FEC_BLOCKS;
+      }
+
+      auto shards_per_fec_block = (frame_shards + (fec_blocks_needed - 1)) / fec_blocks_needed;
+
+      for (std::size_t first_shard = 0; first_shard < frame_shards; first_shard += shards_per_fec_block) {
+        auto data_shards = std::min(shards_per_fec_block, frame_shards - first_shard);
+        send_block(segments, first_shard, data_shards, fec_percentage, sink);
+      }
+    }
+
+  private:
+    static constexpr std::size_t BLOCK_SIZE = PACKET_SIZE + MAX_RTP_HEADER_SIZE - VIDEO_HEADER_SIZE;
+
+    std::size_t recordsize() const {
+      return _prefixsize + VIDEO_HEADER_SIZE;
+    }
+
+    reed_solomon *rs(std::size_t data_shards, std::size_t parity_shards) {
+      auto &rs = _rs[{data_shards, parity_shards}];
+      if (!rs) {
+        rs.reset(reed_solomon_new((int) data_shards, (int) parity_shards));
+      }
+      return rs.get();
+    }
+
+    void send_block(std::span<const std::string_view> segments, std::size_t first_shard, std::size_t data_shards, std::size_t fec_percentage, loopback_sink_t &sink) {
+      auto parity_shards = (data_shards * fec_percentage + 99) / 100;
+      auto nr_shards = data_shards + parity_shards;
+
+      // Like fec::context_t, the buffers only ever grow
+      auto max_copied_shards = std::min(data_shards, segments.size());
+      grow(_shards, (max_copied_shards + parity_shards) * BLOCK_SIZE);
+      grow(_headers, nr_shards * recordsize());
+      grow(_ciphertext, _cipher ? nr_shards * BLOCK_SIZE : 0);
+      grow(_shards_p, nr_shards * 2);
+
+      auto shards_p = _shards_p.data();
+      auto copied_shards = stream::gather_slices(segments, BLOCK_SIZE, first_shard, data_shards, shards_p, _shards.data());
+      for (std::size_t x = 0; x < parity_shards; ++x) {
+        shards_p[data_shards + x] = &_shards[(copied_shards + x) * BLOCK_SIZE];
+      }
+
+      std::memset(_headers.data(), 0, nr_shards * recordsize());
+      for (std::size_t x = 0; x < data_shards; ++x) {
+        auto header = (NV_VIDEO_PACKET *) (header_of(x) + sizeof(RTP_PACKET) + 4);
+        header->streamPacketIndex = (std::uint32_t) ((first_shard + x) << 8);
+      }
+
+      if (parity_shards) {
+        auto rs = this->rs(data_shards, parity_shards);
+
+        auto headers_p = shards_p + nr_shards;
+        for (std::size_t x = 0; x < nr_shards; ++x) {
+          headers_p[x] = header_of(x);
+        }
+
+        reed_solomon_encode(rs, headers_p, (int) nr_shards, (int) VIDEO_HEADER_SIZE);
+        reed_solomon_encode(rs, shards_p, (int) nr_shards, (int) BLOCK_SIZE);
+      }
+
+      _payload_buffers.clear();
+      if (_cipher) {
+        encrypt_block(nr_shards);
+        _payload_buffers.emplace_back((const char *) _ciphertext.data(), nr_shards * BLOCK_SIZE);
+      } else {
+        // Merge the runs of shards that are contiguous in memory
+        for (std::size_t x = 0; x < nr_shards; ++x) {
+          auto payload = (const char *) shards_p[x];
+          if (!_payload_buffers.empty() && _payload_buffers.back().buffer + _payload_buffers.back().size == payload) {
+            _payload_buffers.back().size += BLOCK_SIZE;
+          } else {
+            _payload_buffers.emplace_back(payload, BLOCK_SIZE);
+          }
+        }
+      }
+
+      platf::batched_send_info_t send_info {
+        (const char *) _headers.data(),
+        recordsize(),
+        _payload_buffers,
+        BLOCK_SIZE,
+        0,
+        nr_shards,
+        0,
+        _address,
+        0,
+        _address,
+      };
+      sink.send(send_info);
+    }
+
+    void encrypt_block(std::size_t nr_shards) {
+      _batch.clear();
+
+      for (std::size_t x = 0; x < nr_shards; ++x) {
+        auto prefix = &_headers[x * recordsize()];
+        std::memcpy(prefix, &_iv_counter, sizeof(_iv_counter));
+        prefix[11] = 'V';
+        ++_iv_counter;
+
+        _batch.push_back({
+          std::string_view {(char *) header_of(x), VIDEO_HEADER_SIZE},
+          std::string_view {(char *) _shards_p[x], BLOCK_SIZE},
+          header_of(x),
+          &_ciphertext[x * BLOCK_SIZE],
+          prefix + 12 + sizeof(std::uint32_t),
+          prefix,
+        });
+      }
+
+      if (_cipher->encrypt(_batch.data(), _batch.size(), 12)) {
+        throw std::runtime_error("Couldn't encrypt video shards");
+      }
+    }
+
+    template<class T>
+    static void grow(std::vector<T> &buffer, std::size_t size) {
+      if (buffer.size() < size) {
+        buffer.resize(size);
+      }
+    }
+
+    std::uint8_t *header_of(std::size_t x) {
+      return &_headers[x * recordsize() + _prefixsize];
+    }
+
+    std::size_t _fec_percentage;
+    std::size_t _prefixsize;
+
+    std::vector<std::uint8_t> _headers;
+    std::vector<std::uint8_t> _shards;
+    std::vector<std::uint8_t> _ciphertext;
+    std::vector<std::uint8_t *> _shards_p;
+    std::vector<platf::buffer_descriptor_t> _payload_buffers;
+
+    std::map<std::pair<std::size_t, std::size_t>, rs_t> _rs;
+
+    std::optional<crypto::cipher::gcm_t> _cipher;
+    std::vector<crypto::cipher::gcm_t::batch_entry_t> _batch;
+    std::uint64_t _iv_counter = 0;
+
+    boost::asio::ip::address _address;
+  };
+
+  void video_packetization(benchmark::State &state) {
+    reed_solomon_init();
+
+    auto frame_size = (std::size_t) state.range(0);
+    video_pipeline_t pipeline {(std::size_t) state.range(1), state.range(2) != 0};
+
+    std::string frame(frame_size, '\0');
+    for (std::size_t x = 0; x < frame.size(); ++x) {
+      frame[x] = (char) (x * 31 + (x >> 8));
+    }
+
+    loopback_sink_t sink;
+    for (auto _ : state) {
+      pipeline.send_frame(frame, sink);
+    }
+
+    state.counters["frames_per_second"] = benchmark::Counter((double) state.iterations(), benchmark::Counter::kIsRate);
+    report(state, sink, state.iterations() * frame_size);
+  }
+
+  /**
+   * @brief Get the capture named by SUNSHINE_BENCH_PACKETS, loaded the first time it's needed.
+   * @return The capture, or `nullptr` if none was named or it couldn't be loaded.
+   */
+  const packet_capture::capture_t *bench_capture() {
+    static auto capture = []() -> std::optional<packet_capture::capture_t> {
+      auto path = std::getenv("SUNSHINE_BENCH_PACKETS");
+      if (!path) {
+        return std::nullopt;
+      }
+
+      return packet_capture::capture_t::load(path);
+    }();
+
+    return capture && !capture->records().empty() ? &*capture : nullptr;
+  }
+
+  void video_packetization_replay(benchmark::State &state) {
+    auto capture = bench_capture();
+    if (!capture) {
+      state.SkipWithError("SUNSHINE_BENCH_PACKETS doesn't name a packet capture file");
+      return;
+    }
+
+    reed_solomon_init();
+
+    video_pipeline_t pipeline {(std::size_t) state.range(0), state.range(1) != 0};
+
+    // The frames are sent in the order they were recorded, over and over
+    auto &records = capture->records();
+    std::size_t next = 0;
+
+    loopback_sink_t sink;
+    std::uint64_t input_bytes = 0;
+    for (auto _ : state) {
+      auto &record = records[next];
+      next = (next + 1) % records.size();
+
+      // The rewritten parameter sets are sent in place of the start of the frame, as in src/stream.cpp
+      const std::array<std::string_view, 2> segments {record.replaced_head, record.data.substr(record.replaced_size)};
+      auto frame_size = segments[0].size() + segments[1].size();
+      pipeline.send_frame(segments, frame_size, sink);
+
+      input_bytes += frame_size;
+    }
+
+    state.counters["frames_per_second"] = benchmark::Counter((double) state.iterations(), benchmark::Counter::kIsRate);
+    report(state, sink, input_bytes);
+  }
+
+  void audio_packetization(benchmark::State &state) {
+    reed_solomon_init();
+
+    auto packet_size = (std::size_t) state.range(0);
+    bool encrypted = state.range(1) != 0;
+
+    auto shard_size = crypto::cipher::round_to_pkcs7_padded(MAX_AUDIO_PACKET_SIZE);
+    std::vector<std::uint8_t> shards(RTPA_TOTAL_SHARDS * shard_size);
+    std::array<std::uint8_t *, RTPA_TOTAL_SHARDS> shards_p;
+    for (auto x = 0; x < RTPA_TOTAL_SHARDS; ++x) {
+      shards_p[x] = &shards[x * shard_size];
+    }
+
+    rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
+    crypto::cipher::cbc_t cipher {bench_key(), true};
+    crypto::aes_t iv(16);
+
+    std::string packet(packet_size, 'a');
+
+    loopback_sink_t sink;
+    std::uint32_t sequence_number = 0;
+    for (auto _ : state) {
+      auto shard = shards_p[sequence_number % RTPA_DATA_SHARDS];
+
+      int bytes;
+      if (encrypted) {
+        *(std::uint32_t *) iv.data() = sequence_number;
+        bytes = cipher.encrypt(packet, shard, &iv);
+      } else {
+        std::memcpy(shard, packet.data(), packet.size());
+        bytes = (int) packet.size();
+      }
+      sink.send((const char *) shard, bytes);
+
+      // The parity shards are sent after the last data shard of the FEC block
+      if ((sequence_number + 1) % RTPA_DATA_SHARDS == 0) {
+        reed_solomon_encode(rs.get(), shards_p.data(), RTPA_TOTAL_SHARDS, bytes);
+        for (auto x = RTPA_DATA_SHARDS; x < RTPA_TOTAL_SHARDS; ++x) {
+          sink.send((const char *) shards_p[x], bytes);
+        }
+      }
+
+      ++sequence_number;
+    }
+
+    report(state, sink, state.iterations() * packet_size);
+  }
+}  // namespace
+
+// Frame size, FEC percentage, encryption
+BENCHMARK(video_packetization)
+  ->ArgNames({"frame_size", "fec", "encrypted"})
+  ->ArgsProduct({{10 << 10, 100 << 10, 500 << 10, 2 << 20}, {0, 10, 20, 50}, {0, 1}});
+
+// FEC percentage, encryption
+BENCHMARK(video_packetization_replay)
+  ->ArgNames({"fec", "encrypted"})
+  ->ArgsProduct({{0, 20}, {0, 1}});
+
+// Packet size, encryption
+BENCHMARK(audio_packetization)
+  ->ArgNames({"packet_size", "encrypted"})
+  ->ArgsProduct({{120, 400, 1400}, {0, 1}});
@@ -0,0 +1,179 @@
+/**
+ * @file benchmarks/bench_thread_safe.cpp
+ * @brief Benchmarks of the queues and events of src/thread_safe.h under contention.
+ * @details The raise/pop benchmarks run from 1 to 16 threads sharing the same primitive.
+ *          The handoff benchmarks measure the time from raise() in a producer thread to
+ *          pop() returning in the consumer, like between the capture and encode threads.
+ */
+// standard includes
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <benchmark/benchmark.h>
+
+// local includes
+#include "src/stat_trackers.h"
+#include "src/thread_safe.h"
+
+namespace {
+  /**
+   * @brief Report the percentiles of the handoff latencies, in microseconds.
+   */
+  void report_latency(benchmark::State &state, const stat_trackers::histogram_tracker &latency) {
+    state.SetItemsProcessed(state.iterations());
+    state.counters["p50_us"] = latency.percentile(50);
+    state.counters["p99_us"] = latency.percentile(99);
+    state.counters["p999_us"] = latency.percentile(99.9);
+  }
+
+  double elapsed_us(std::chrono::steady_clock::time_point raised) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - raised).count();
+  }
+
+  void queue_raise_pop(benchmark::State &state) {
+    // Each thread pops after raising, so the queue is never empty when popped nor full
+    static safe::queue_t<int> queue {64};
+
+    for (auto _ : state) {
+      queue.raise(1);
+      benchmark::DoNotOptimize(queue.pop());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void event_peek(benchmark::State &state) {
+    static safe::event_t<int> event;
+
+    if (state.thread_index() == 0) {
+      event.raise(1);
+    }
+
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(event.peek());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void event_raise_pop(benchmark::State &state) {
+    safe::event_t<int> event;
+
+    for (auto _ : state) {
+      event.raise(1);
+      benchmark::DoNotOptimize(event.pop());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void spsc_queue_raise_pop(benchmark::State &state) {
+    safe::spsc_queue_t<std::unique_ptr<int>> queue {64};
+
+    for (auto _ : state) {
+      queue.raise(std::make_unique<int>(1));
+      benchmark::DoNotOptimize(queue.try_pop());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  void queue_handoff(benchmark::State &state) {
+    auto producers = (int) state.range(0);
+
+    // The producers raise once the queue is empty, so the latency is the handoff and not the time spent queued
+    safe::queue_t<std::chrono::steady_clock::time_point> queue {(std::uint32_t) producers};
+
+    std::vector<std::thread> threads;
+    for (int x = 0; x < producers; ++x) {
+      threads.emplace_back([&queue]() {
+        while (queue.running()) {
+          if (queue.peek()) {
+            std::this_thread::yield();
+          } else {
+            queue.raise(std::chrono::steady_clock::now());
+          }
+        }
+      });
+    }
+
+    stat_trackers::histogram_tracker latency;
+    for (auto _ : state) {
+      auto raised = queue.pop();
+      latency.collect(elapsed_us(*raised));
+    }
+
+    queue.stop();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    report_latency(state, latency);
+  }
+
+  void event_handoff(benchmark::State &state) {
+    safe::event_t<std::chrono::steady_clock::time_point> event;
+
+    // The next value is raised once the previous one was popped, so none is overwritten
+    std::thread producer {[&event]() {
+      while (event.running()) {
+        if (event.peek()) {
+          std::this_thread::yield();
+        } else {
+          event.raise(std::chrono::steady_clock::now());
+        }
+      }
+    }};
+
+    stat_trackers::histogram_tracker latency;
+    for (auto _ : state) {
+      auto raised = event.pop();
+      latency.collect(elapsed_us(*raised));
+    }
+
+    event.stop();
+    producer.join();
+
+    report_latency(state, latency);
+  }
+
+  void spsc_queue_handoff(benchmark::State &state) {
+    safe::spsc_queue_t<std::unique_ptr<std::chrono::steady_clock::time_point>> queue {1, (std::uint32_t) state.range(0)};
+
+    std::thread producer {[&queue]() {
+      while (queue.running()) {
+        if (queue.peek()) {
+          std::this_thread::yield();
+        } else {
+          queue.raise(std::make_unique<std::chrono::steady_clock::time_point>(std::chrono::steady_clock::now()));
+        }
+      }
+    }};
+
+    stat_trackers::histogram_tracker latency;
+    for (auto _ : state) {
+      auto raised = queue.pop();
+      latency.collect(elapsed_us(*raised));
+    }
+
+    queue.stop();
+    producer.join();
+
+    report_latency(state, latency);
+  }
+}  // namespace
+
+BENCHMARK(queue_raise_pop)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(event_peek)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(event_raise_pop);
+BENCHMARK(spsc_queue_raise_pop);
+
+// The producers, from 1 to 16
+BENCHMARK(queue_handoff)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+BENCHMARK(event_handoff)->UseRealTime();
+
+// The spin count of the consumer, parking it right away or spinning first like the capture thread
+BENCHMARK(spsc_queue_handoff)->Arg(0)->Arg(64)->UseRealTime();
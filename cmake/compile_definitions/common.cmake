@@ -77,6 +77,8 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/logging.h"
         "${CMAKE_SOURCE_DIR}/src/main.cpp"
         "${CMAKE_SOURCE_DIR}/src/main.h"
+        "${CMAKE_SOURCE_DIR}/src/metrics.cpp"
+        "${CMAKE_SOURCE_DIR}/src/metrics.h"
         "${CMAKE_SOURCE_DIR}/src/crypto.cpp"
         "${CMAKE_SOURCE_DIR}/src/crypto.h"
         "${CMAKE_SOURCE_DIR}/src/nvhttp.cpp"
@@ -85,6 +87,8 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/httpcommon.h"
         "${CMAKE_SOURCE_DIR}/src/confighttp.cpp"
         "${CMAKE_SOURCE_DIR}/src/confighttp.h"
+        "${CMAKE_SOURCE_DIR}/src/web_cache.cpp"
+        "${CMAKE_SOURCE_DIR}/src/web_cache.h"
         "${CMAKE_SOURCE_DIR}/src/rtsp.cpp"
         "${CMAKE_SOURCE_DIR}/src/rtsp.h"
         "${CMAKE_SOURCE_DIR}/src/stream.cpp"
@@ -95,19 +99,49 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/video_colorspace.h"
         "${CMAKE_SOURCE_DIR}/src/input.cpp"
         "${CMAKE_SOURCE_DIR}/src/input.h"
+        "${CMAKE_SOURCE_DIR}/src/input_latency.cpp"
+        "${CMAKE_SOURCE_DIR}/src/input_latency.h"
         "${CMAKE_SOURCE_DIR}/src/audio.cpp"
         "${CMAKE_SOURCE_DIR}/src/audio.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/audio_remap.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/audio_remap_kernels.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/blend.cpp"
+        "${CMAKE_SOURCE_DIR}/src/platform/blend_kernels.h"
         "${CMAKE_SOURCE_DIR}/src/platform/common.h"
+        "${CMAKE_SOURCE_DIR}/src/platform/timer.cpp"
         "${CMAKE_SOURCE_DIR}/src/process.cpp"
         "${CMAKE_SOURCE_DIR}/src/process.h"
         "${CMAKE_SOURCE_DIR}/src/network.cpp"
         "${CMAKE_SOURCE_DIR}/src/network.h"
+        "${CMAKE_SOURCE_DIR}/src/pacing.cpp"
+        "${CMAKE_SOURCE_DIR}/src/pacing.h"
+        "${CMAKE_SOURCE_DIR}/src/color_convert.cpp"
+        "${CMAKE_SOURCE_DIR}/src/color_convert.h"
+        "${CMAKE_SOURCE_DIR}/src/color_convert_kernels.h"
+        "${CMAKE_SOURCE_DIR}/src/capture_latency.cpp"
+        "${CMAKE_SOURCE_DIR}/src/capture_latency.h"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.cpp"
+        "${CMAKE_SOURCE_DIR}/src/frame_trace.h"
+        "${CMAKE_SOURCE_DIR}/src/image_pool.cpp"
+        "${CMAKE_SOURCE_DIR}/src/image_pool.h"
+        "${CMAKE_SOURCE_DIR}/src/fec_policy.cpp"
+        "${CMAKE_SOURCE_DIR}/src/fec_policy.h"
+        "${CMAKE_SOURCE_DIR}/src/packet_capture.cpp"
+        "${CMAKE_SOURCE_DIR}/src/packet_capture.h"
+        "${CMAKE_SOURCE_DIR}/src/input_capture.cpp"
+        "${CMAKE_SOURCE_DIR}/src/input_capture.h"
+        "${CMAKE_SOURCE_DIR}/src/bitrate_control.cpp"
+        "${CMAKE_SOURCE_DIR}/src/bitrate_control.h"
         "${CMAKE_SOURCE_DIR}/src/move_by_copy.h"
         "${CMAKE_SOURCE_DIR}/src/system_tray.cpp"
         "${CMAKE_SOURCE_DIR}/src/system_tray.h"
         "${CMAKE_SOURCE_DIR}/src/task_pool.h"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.cpp"
+        "${CMAKE_SOURCE_DIR}/src/thread_affinity.h"
         "${CMAKE_SOURCE_DIR}/src/thread_pool.h"
         "${CMAKE_SOURCE_DIR}/src/thread_safe.h"
+        "${CMAKE_SOURCE_DIR}/src/timeline.cpp"
+        "${CMAKE_SOURCE_DIR}/src/timeline.h"
         "${CMAKE_SOURCE_DIR}/src/sync.h"
         "${CMAKE_SOURCE_DIR}/src/round_robin.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.h"
@@ -122,6 +156,7 @@ endif()
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_ASSETS_DIR="${SUNSHINE_ASSETS_DIR_DEF}")
 
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_TRAY=${SUNSHINE_TRAY})
+list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_MIN_COMPILED_LOG_LEVEL=${SUNSHINE_MIN_COMPILED_LOG_LEVEL})
 
 # Publisher metadata
 list(APPEND SUNSHINE_DEFINITIONS SUNSHINE_PUBLISHER_NAME="${SUNSHINE_PUBLISHER_NAME}")
@@ -153,6 +153,20 @@ if(WAYLAND_FOUND)
             "${CMAKE_SOURCE_DIR}/src/platform/linux/wayland.cpp")
 endif()
 
+# xdg-desktop-portal
+if(${SUNSHINE_ENABLE_PORTAL} AND WAYLAND_FOUND)
+    pkg_check_modules(PORTAL libpipewire-0.3 gio-2.0 gio-unix-2.0)
+else()
+    set(PORTAL_FOUND OFF)
+endif()
+if(PORTAL_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_PORTAL)
+    include_directories(SYSTEM ${PORTAL_INCLUDE_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${PORTAL_LIBRARIES})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/portalgrab.cpp")
+endif()
+
 # x11
 if(${SUNSHINE_ENABLE_X11})
     find_package(X11 REQUIRED)
@@ -169,6 +183,36 @@ if(X11_FOUND)
             "${CMAKE_SOURCE_DIR}/src/platform/linux/x11grab.cpp")
 endif()
 
+# io_uring
+if(${SUNSHINE_ENABLE_IO_URING})
+    pkg_check_modules(LIBURING liburing>=2.3)
+else()
+    set(LIBURING_FOUND OFF)
+endif()
+if(LIBURING_FOUND)
+    add_compile_definitions(SUNSHINE_BUILD_IO_URING)
+    include_directories(SYSTEM ${LIBURING_INCLUDE_DIRS})
+    link_directories(${LIBURING_LIBRARY_DIRS})
+    list(APPEND PLATFORM_LIBRARIES ${LIBURING_LIBRARIES})
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/uring.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/uring.cpp")
+endif()
+
+# AF_XDP
+if(${SUNSHINE_ENABLE_XDP})
+    include(CheckIncludeFile)
+    check_include_file("linux/if_xdp.h" HAVE_LINUX_IF_XDP_H)
+else()
+    set(HAVE_LINUX_IF_XDP_H OFF)
+endif()
+if(HAVE_LINUX_IF_XDP_H)
+    add_compile_definitions(SUNSHINE_BUILD_XDP)
+    list(APPEND PLATFORM_TARGET_FILES
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp.h"
+            "${CMAKE_SOURCE_DIR}/src/platform/linux/xdp.cpp")
+endif()
+
 if(NOT ${CUDA_FOUND}
         AND NOT ${WAYLAND_FOUND}
         AND NOT ${X11_FOUND}
@@ -253,8 +297,7 @@ list(APPEND PLATFORM_TARGET_FILES
 
 list(APPEND PLATFORM_LIBRARIES
         dl
-        pulse
-        pulse-simple)
+        pulse)
 
 include_directories(
         SYSTEM
@@ -96,3 +96,49 @@ if(SUNSHINE_ENABLE_TRAY)
     list(APPEND PLATFORM_TARGET_FILES
             "${CMAKE_SOURCE_DIR}/third-party/tray/src/tray_windows.c")
 endif()
+
+# directx shaders, compiled at build time when fxc from the Windows SDK is available
+if(SUNSHINE_PRECOMPILE_SHADERS)
+    set(PROGRAM_FILES_X86_ENV "ProgramFiles(x86)")
+    file(GLOB FXC_HINTS "$ENV{${PROGRAM_FILES_X86_ENV}}/Windows Kits/10/bin/*/x64")
+    list(REVERSE FXC_HINTS)  # prefer the newest SDK
+    find_program(FXC_EXECUTABLE fxc HINTS ${FXC_HINTS})
+endif()
+if(SUNSHINE_PRECOMPILE_SHADERS AND FXC_EXECUTABLE)
+    set(SUNSHINE_SHADERS_SOURCE_DIR "${SUNSHINE_SOURCE_ASSETS_DIR}/windows/assets/shaders/directx")
+    set(SUNSHINE_SHADERS_OUTPUT_DIR "${CMAKE_BINARY_DIR}/generated/shaders/directx")
+    file(MAKE_DIRECTORY "${SUNSHINE_SHADERS_OUTPUT_DIR}")
+
+    file(GLOB SUNSHINE_SHADER_INCLUDES CONFIGURE_DEPENDS "${SUNSHINE_SHADERS_SOURCE_DIR}/include/*.hlsl")
+    file(GLOB SUNSHINE_SHADERS CONFIGURE_DEPENDS "${SUNSHINE_SHADERS_SOURCE_DIR}/*.hlsl")
+    foreach(shader ${SUNSHINE_SHADERS})
+        get_filename_component(shader_name "${shader}" NAME_WE)
+        if(shader_name MATCHES "_vs$")
+            set(shader_profile vs_5_0)
+            set(shader_entrypoint main_vs)
+        else()
+            set(shader_profile ps_5_0)
+            set(shader_entrypoint main_ps)
+        endif()
+
+        # same flags as the runtime compilation in display_vram.cpp
+        set(shader_header "${SUNSHINE_SHADERS_OUTPUT_DIR}/${shader_name}.h")
+        add_custom_command(OUTPUT "${shader_header}"
+                COMMAND "${FXC_EXECUTABLE}" /nologo /Ges /T ${shader_profile} /E ${shader_entrypoint}
+                        $<$<CONFIG:Debug>:/Zi$<SEMICOLON>/Od>
+                        /Vn ${shader_name}_bytecode /Fh "${shader_header}" "${shader}"
+                DEPENDS "${shader}" ${SUNSHINE_SHADER_INCLUDES}
+                COMMENT "Compiling shader ${shader_name}"
+                COMMAND_EXPAND_LISTS
+                VERBATIM)
+        list(APPEND SUNSHINE_SHADER_HEADERS "${shader_header}")
+    endforeach()
+
+    # a target rather than sources, so the tests in their own directory wait for the headers as well
+    add_custom_target(sunshine_shaders DEPENDS ${SUNSHINE_SHADER_HEADERS})
+    list(APPEND SUNSHINE_TARGET_DEPENDENCIES sunshine_shaders)
+    include_directories("${CMAKE_BINARY_DIR}/generated")
+    add_compile_definitions(SUNSHINE_PRECOMPILED_SHADERS)
+elseif(SUNSHINE_PRECOMPILE_SHADERS)
+    message(STATUS "fxc not found, the DirectX shaders will be compiled at runtime")
+endif()
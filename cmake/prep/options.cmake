@@ -9,10 +9,17 @@ set(SUNSHINE_PUBLISHER_ISSUE_URL "https://app.lizardbyte.dev/support"
 
 option(BUILD_DOCS "Build documentation" ON)
 option(BUILD_TESTS "Build tests" ON)
+set(TESTS_SANITIZER ""
+        CACHE STRING "The sanitizer the tests are built with, like thread to find data races. Clang or GCC only.")
+option(BUILD_BENCHMARKS "Build benchmarks, this requires Google Benchmark to be installed" OFF)
+option(BUILD_LOADGEN "Build the load generator, a client that streams many sessions without a display" OFF)
 option(NPM_OFFLINE "Use offline npm packages. You must ensure packages are in your npm cache." OFF)
 
 option(BUILD_WERROR "Enable -Werror flag." OFF)
 
+set(SUNSHINE_MIN_COMPILED_LOG_LEVEL 0
+        CACHE STRING "The lowest level (0 = verbose to 5 = fatal) of the logs of the hot paths that is compiled in.")
+
 # if this option is set, the build will exit after configuring special package configuration files
 option(SUNSHINE_CONFIGURE_ONLY "Configure special files only, then exit." OFF)
 
@@ -58,10 +65,21 @@ elseif(UNIX)  # Linux
             "Enable cuda specific code." ON)
     option(SUNSHINE_ENABLE_DRM
             "Enable KMS grab if available." ON)
+    option(SUNSHINE_ENABLE_PORTAL
+            "Enable capture through the ScreenCast portal if PipeWire and GIO are available." ON)
+    option(SUNSHINE_ENABLE_IO_URING
+            "Enable the io_uring send backend if liburing is available." ON)
     option(SUNSHINE_ENABLE_VAAPI
             "Enable building vaapi specific code." ON)
+    option(SUNSHINE_ENABLE_XDP
+            "Enable the AF_XDP send backend if the kernel headers support it." ON)
     option(SUNSHINE_ENABLE_WAYLAND
             "Enable building wayland specific code." ON)
     option(SUNSHINE_ENABLE_X11
             "Enable X11 grab if available." ON)
 endif()
+
+if(WIN32)
+    option(SUNSHINE_PRECOMPILE_SHADERS
+            "Compile the DirectX shaders at build time if fxc from the Windows SDK is found." ON)
+endif()
@@ -119,6 +119,7 @@ function add_arch_deps() {
     'numactl'
     'openssl'
     'opus'
+    'pipewire'  # xdg-desktop-portal
     'udev'
     'wayland'
   )
@@ -158,7 +159,9 @@ function add_debian_based_deps() {
     "libminiupnpc-dev"
     "libnotify-dev"
     "libnuma-dev"
+    "libglib2.0-dev"  # xdg-desktop-portal
     "libopus-dev"
+    "libpipewire-0.3-dev"  # xdg-desktop-portal
     "libpulse-dev"
     "libssl-dev"
     "libwayland-dev"  # Wayland
@@ -235,6 +238,8 @@ function add_fedora_deps() {
     "numactl-devel"
     "openssl-devel"
     "opus-devel"
+    "glib2-devel"  # xdg-desktop-portal
+    "pipewire-devel"  # xdg-desktop-portal
     "pulseaudio-libs-devel"
     "rpm-build"  # if you want to build an RPM binary package
     "wget"  # necessary for cuda install with `run` file
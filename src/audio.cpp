@@ -3,6 +3,9 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <algorithm>
+#include <array>
+#include <mutex>
 #include <thread>
 
 // lib includes
@@ -14,13 +17,28 @@
 #include "globals.h"
 #include "logging.h"
 #include "platform/common.h"
+#include "thread_affinity.h"
 #include "thread_safe.h"
 #include "utility.h"
 
 namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+
+  /**
+   * @brief A frame of captured samples.
+   */
+  struct sample_frame_t {
+    std::vector<float> samples;
+
+    // When the first sample was captured
+    std::chrono::steady_clock::time_point timestamp;
+  };
+
+  using sample_queue_t = std::shared_ptr<safe::spsc_queue_t<sample_frame_t>>;
+
+  // The frames of samples in flight between capture and encoding, allocated up front and recycled
+  constexpr auto SAMPLE_FRAMES = 30;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -83,15 +101,52 @@ namespace audio {
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
+  /**
+   * @brief The capture and encoding of a sink, shared by the sessions receiving the same audio.
+   */
+  struct shared_capture_t {
+    std::string sink;
+    opus_stream_config_t stream;
+    int packet_duration;
+
+    // The channel mapping of the stream, which may come from the session that started the capture
+    std::array<std::uint8_t, 8> mapping;
+
+    struct session_t {
+      void *channel_data;
+
+      // The share of the packets the session loses in percent, as estimated by the stream
+      safe::mail_raw_t::event_t<int> loss_events;
+      int loss_percentage;
+    };
+
+    // The sessions the packets are sent to
+    std::vector<session_t> sessions;
+
+    safe::signal_t shutdown_event;
+    std::thread thread;
+  };
+
+  // Guards the shared captures and the sessions of each
+  std::mutex shared_captures_lock;
+  std::vector<std::shared_ptr<shared_capture_t>> shared_captures;
+
+  bool same_stream(const opus_stream_config_t &a, const opus_stream_config_t &b) {
+    return a.sampleRate == b.sampleRate &&
+           a.channelCount == b.channelCount &&
+           a.streams == b.streams &&
+           a.coupledStreams == b.coupledStreams &&
+           a.bitrate == b.bitrate &&
+           std::equal(a.mapping, a.mapping + a.channelCount, b.mapping);
+  }
+
+  void encodeThread(sample_queue_t samples, sample_queue_t free_samples, shared_capture_t &shared) {
     auto packets = mail::man->queue<packet_t>(mail::audio_packets);
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
-    }
+    auto &stream = shared.stream;
 
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::audio);
 
     opus_t opus {opus_multistream_encoder_create(
       stream.sampleRate,
@@ -110,11 +165,17 @@ namespace audio {
                     << stream.channelCount << " channels, "sv
                     << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+    auto packet_pool = std::make_shared<packet_pool_t>();
+
+    // Each frame is encoded once, then copied to a packet of every session
+    buffer_t encoded {packet_pool_t::PACKET_SIZE};
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
+    // The encoder protects its frames for the session losing the most packets
+    int loss_percentage = 0;
+
+    auto frame_size = shared.packet_duration * stream.sampleRate / 1000;
+    while (auto sample = samples->pop()) {
+      int bytes = opus_multistream_encode_float(opus.get(), sample->samples.data(), frame_size, std::begin(encoded), encoded.size());
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
         packets->stop();
@@ -122,9 +183,181 @@ namespace audio {
         return;
       }
 
-      packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+      auto timestamp = sample->timestamp;
+
+      // Hand the frame of samples back to the capture thread
+      free_samples->raise(std::move(*sample));
+
+      std::lock_guard lg {shared_captures_lock};
+
+      int max_loss_percentage = 0;
+      for (auto &session : shared.sessions) {
+        if (session.loss_events->peek()) {
+          if (auto percentage = session.loss_events->pop(0ms)) {
+            session.loss_percentage = *percentage;
+          }
+        }
+        max_loss_percentage = std::max(max_loss_percentage, session.loss_percentage);
+
+        auto packet = packet_pool->acquire();
+        std::copy_n(std::begin(encoded), bytes, std::begin(packet));
+
+        packet.fake_resize(bytes);
+
+        packet_buffer_t packet_buffer {std::move(packet), packet_pool};
+        packet_buffer.timestamp = timestamp;
+        packets->raise(session.channel_data, std::move(packet_buffer));
+      }
+
+      // Opus makes its frames depend less on the previous ones when it expects them to get lost
+      if (max_loss_percentage != loss_percentage) {
+        loss_percentage = max_loss_percentage;
+        opus_multistream_encoder_ctl(opus.get(), OPUS_SET_PACKET_LOSS_PERC(loss_percentage));
+
+        BOOST_LOG(debug) << "Audio packet loss hint: "sv << loss_percentage << '%';
+      }
+    }
+  }
+
+  void captureThread(shared_capture_t &shared, audio_ctx_ref_t ref, std::unique_ptr<platf::mic_t> mic) {
+    auto &control = ref->control;
+    auto &stream = shared.stream;
+    auto frame_size = shared.packet_duration * stream.sampleRate / 1000;
+
+    // Capture takes place on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin(thread_affinity::role_e::audio);
+
+    int samples_per_frame = frame_size * stream.channelCount;
+
+    // Frames of samples are passed to the encoder and back without allocating any on the way
+    auto samples = std::make_shared<sample_queue_t::element_type>(SAMPLE_FRAMES);
+    auto free_samples = std::make_shared<sample_queue_t::element_type>(SAMPLE_FRAMES);
+    for (int x = 0; x < SAMPLE_FRAMES; ++x) {
+      free_samples->raise(sample_frame_t {std::vector<float>(samples_per_frame)});
+    }
+
+    // The frame captured into when the encoder holds all the others, it's dropped
+    std::vector<float> overflow_buffer(samples_per_frame);
+
+    std::thread thread {encodeThread, samples, free_samples, std::ref(shared)};
+
+    auto fg = util::fail_guard([&]() {
+      samples->stop();
+      thread.join();
+    });
+
+    // The frame being captured into, kept until it's filled
+    sample_frame_t sample_buffer;
+
+    // Without timestamps from the backend, a frame is assumed to be captured over the frame before it's returned
+    const auto frame_duration = std::chrono::milliseconds(shared.packet_duration);
+
+    while (!shared.shutdown_event.peek()) {
+      if (sample_buffer.samples.empty()) {
+        if (auto free_buffer = free_samples->try_pop()) {
+          sample_buffer = std::move(*free_buffer);
+        }
+      }
+
+      auto status = mic->sample(sample_buffer.samples.empty() ? overflow_buffer : sample_buffer.samples);
+      switch (status) {
+        case platf::capture_e::ok:
+          break;
+        case platf::capture_e::timeout:
+          continue;
+        case platf::capture_e::reinit:
+          BOOST_LOG(info) << "Reinitializing audio capture"sv;
+          mic.reset();
+          do {
+            mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+            if (!mic) {
+              BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
+            }
+          } while (!mic && !shared.shutdown_event.view(5s));
+          continue;
+        default:
+          return;
+      }
+
+      if (!sample_buffer.samples.empty()) {
+        sample_buffer.timestamp = mic->frame_timestamp().value_or(std::chrono::steady_clock::now() - frame_duration);
+
+        samples->raise(std::move(sample_buffer));
+        sample_buffer.samples.clear();
+      }
+    }
+  }
+
+  /**
+   * @brief Join the running capture of a sink, or start a new one for it.
+   * @param ref The audio context.
+   * @param sink The sink the session receives.
+   * @param stream The stream requested by the session.
+   * @param packet_duration The duration of the packets requested by the session.
+   * @param channel_data The session.
+   * @param loss_events The estimates of the packet loss of the session.
+   * @return The capture, or `nullptr` if it couldn't be started.
+   */
+  std::shared_ptr<shared_capture_t> join_shared_capture(audio_ctx_ref_t &ref, const std::string &sink, const opus_stream_config_t &stream, int packet_duration, void *channel_data, safe::mail_raw_t::event_t<int> loss_events) {
+    {
+      std::lock_guard lg {shared_captures_lock};
+
+      for (auto &shared : shared_captures) {
+        if (shared->sink == sink && shared->packet_duration == packet_duration && same_stream(shared->stream, stream)) {
+          BOOST_LOG(info) << "Sharing the audio capture of ["sv << sink << "] with another session"sv;
+
+          shared->sessions.emplace_back(shared_capture_t::session_t {channel_data, std::move(loss_events), 0});
+          return shared;
+        }
+      }
+    }
+
+    auto frame_size = packet_duration * stream.sampleRate / 1000;
+    auto mic = ref->control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
+    if (!mic) {
+      return nullptr;
+    }
+
+    auto shared = std::make_shared<shared_capture_t>();
+    shared->sink = sink;
+    shared->stream = stream;
+    shared->packet_duration = packet_duration;
+    std::copy_n(stream.mapping, stream.channelCount, std::begin(shared->mapping));
+    shared->stream.mapping = shared->mapping.data();
+    shared->sessions.emplace_back(shared_capture_t::session_t {channel_data, std::move(loss_events), 0});
+
+    shared->thread = std::thread {captureThread, std::ref(*shared), ref, std::move(mic)};
+
+    std::lock_guard lg {shared_captures_lock};
+    shared_captures.emplace_back(shared);
+
+    return shared;
+  }
+
+  /**
+   * @brief Stop sending the packets of a capture to a session, the last session stops the capture.
+   * @param shared The capture.
+   * @param channel_data The session.
+   */
+  void leave_shared_capture(std::shared_ptr<shared_capture_t> shared, void *channel_data) {
+    {
+      std::lock_guard lg {shared_captures_lock};
+
+      auto &sessions = shared->sessions;
+      sessions.erase(std::remove_if(std::begin(sessions), std::end(sessions), [channel_data](const auto &session) {
+                       return session.channel_data == channel_data;
+                     }),
+                     std::end(sessions));
+      if (!sessions.empty()) {
+        return;
+      }
+
+      shared_captures.erase(std::remove(std::begin(shared_captures), std::end(shared_captures), shared), std::end(shared_captures));
     }
+
+    shared->shutdown_event.raise(true);
+    shared->thread.join();
   }
 
   void capture(safe::mail_t mail, config_t config, void *channel_data) {
@@ -192,56 +425,16 @@ namespace audio {
       }
     }
 
-    auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    auto mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
-    if (!mic) {
+    auto shared = join_shared_capture(ref, *sink, stream, config.packetDuration, channel_data, mail->event<int>(mail::audio_loss));
+    if (!shared) {
       return;
     }
 
     // Audio is initialized, so we don't want to print the failure message
     init_failure_fg.disable();
 
-    // Capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::critical);
-
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
-
-    auto fg = util::fail_guard([&]() {
-      samples->stop();
-      thread.join();
-
-      shutdown_event->view();
-    });
-
-    int samples_per_frame = frame_size * stream.channelCount;
-
-    while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
-
-      auto status = mic->sample(sample_buffer);
-      switch (status) {
-        case platf::capture_e::ok:
-          break;
-        case platf::capture_e::timeout:
-          continue;
-        case platf::capture_e::reinit:
-          BOOST_LOG(info) << "Reinitializing audio capture"sv;
-          mic.reset();
-          do {
-            mic = control->microphone(stream.mapping, stream.channelCount, stream.sampleRate, frame_size);
-            if (!mic) {
-              BOOST_LOG(warning) << "Couldn't re-initialize audio input"sv;
-            }
-          } while (!mic && !shutdown_event->view(5s));
-          continue;
-        default:
-          return;
-      }
-
-      samples->raise(std::move(sample_buffer));
-    }
+    shutdown_event->view();
+    leave_shared_capture(std::move(shared), channel_data);
   }
 
   audio_ctx_ref_t get_audio_ctx_ref() {
@@ -10,6 +10,10 @@
 #include "utility.h"
 
 #include <bitset>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace audio {
   enum stream_config_e : int {
@@ -68,7 +72,97 @@ namespace audio {
   };
 
   using buffer_t = util::buffer_t<std::uint8_t>;
-  using packet_t = std::pair<void *, buffer_t>;
+
+  /**
+   * @brief Recycles the buffers that Opus frames are encoded into.
+   * @details The buffers are returned once the frames were sent, so no memory is allocated
+   *          on the audio threads while streaming.
+   */
+  class packet_pool_t {
+  public:
+    /// The size of the buffers, which fits any Opus frame we encode.
+    static constexpr std::size_t PACKET_SIZE = 1400;
+
+    /// The number of free buffers kept, more are freed. This covers the frames queued for sending.
+    static constexpr std::size_t MAX_FREE_BUFFERS = 32;
+
+    /**
+     * @brief Get an empty buffer.
+     * @return A buffer of `PACKET_SIZE` bytes.
+     */
+    buffer_t acquire() {
+      std::lock_guard lg {_lock};
+
+      if (_free.empty()) {
+        return buffer_t {PACKET_SIZE};
+      }
+
+      auto buffer = std::move(_free.back());
+      _free.pop_back();
+
+      return buffer;
+    }
+
+    /**
+     * @brief Return a buffer to the pool.
+     * @param buffer The buffer, which may have been shrunk to the size of a frame.
+     */
+    void release(buffer_t &&buffer) {
+      std::lock_guard lg {_lock};
+
+      if (_free.size() < MAX_FREE_BUFFERS && buffer.begin()) {
+        buffer.fake_resize(PACKET_SIZE);
+        _free.emplace_back(std::move(buffer));
+      }
+    }
+
+  private:
+    std::mutex _lock;
+    std::vector<buffer_t> _free;
+  };
+
+  /**
+   * @brief An encoded Opus frame, its buffer goes back to the pool when the frame is dropped.
+   * @details Copies are plain buffers that don't belong to the pool.
+   */
+  struct packet_buffer_t: buffer_t {
+    packet_buffer_t() = default;
+
+    packet_buffer_t(buffer_t &&buffer, std::shared_ptr<packet_pool_t> pool):
+        buffer_t {std::move(buffer)},
+        pool {std::move(pool)} {
+    }
+
+    packet_buffer_t(const packet_buffer_t &o):
+        buffer_t {o},
+        timestamp {o.timestamp} {
+    }
+
+    packet_buffer_t(packet_buffer_t &&o) noexcept = default;
+
+    // Swapping hands the buffer this held to the moved-from packet, which returns it to its pool
+    packet_buffer_t &operator=(packet_buffer_t &&o) noexcept {
+      buffer_t::operator=(std::move(o));
+      std::swap(pool, o.pool);
+      timestamp = o.timestamp;
+
+      return *this;
+    }
+
+    ~packet_buffer_t() {
+      if (pool) {
+        pool->release(std::move(*this));
+      }
+    }
+
+    // The pool the buffer is returned to, if any
+    std::shared_ptr<packet_pool_t> pool;
+
+    // When the first sample of the frame was captured
+    std::chrono::steady_clock::time_point timestamp;
+  };
+
+  using packet_t = std::pair<void *, packet_buffer_t>;
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
   void capture(safe::mail_t mail, config_t config, void *channel_data);
@@ -0,0 +1,88 @@
+/**
+ * @file src/bitrate_control.cpp
+ * @brief Definitions for the per-session bitrate control of the video stream.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "bitrate_control.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace bitrate_control {
+  controller_t::controller_t() {
+    reset(20000, std::chrono::steady_clock::now());
+  }
+
+  void controller_t::reset(int bitrate, time_point now) {
+    _bitrate = bitrate;
+    _max_bitrate = bitrate;
+    _min_bitrate = std::max(1, bitrate * MIN_PERCENT / 100);
+
+    _min_rtt.reset();
+
+    _congested = false;
+    _last_congestion = now;
+    _last_change = now;
+  }
+
+  void controller_t::report_loss(std::int64_t lost_frames, time_point now) {
+    if (lost_frames >= LOSS_THRESHOLD) {
+      congested(now);
+    }
+  }
+
+  void controller_t::report_invalidation(time_point now) {
+    congested(now);
+  }
+
+  void controller_t::report_rtt(std::chrono::milliseconds rtt, time_point now) {
+    if (!_min_rtt || rtt < *_min_rtt) {
+      _min_rtt = rtt;
+    }
+
+    // Queues building up along the path show in the round trip time before anything is lost
+    if (rtt > *_min_rtt + RTT_THRESHOLD) {
+      congested(now);
+    }
+  }
+
+  std::optional<int> controller_t::update(time_point now) {
+    auto bitrate = _bitrate;
+
+    if (_congested) {
+      _congested = false;
+
+      // The encoder may still be catching up with the last cut
+      if (now - _last_change < HOLD_TIME) {
+        return std::nullopt;
+      }
+
+      bitrate = std::max(_min_bitrate, bitrate * (100 - DECREASE_PERCENT) / 100);
+    } else if (now - _last_congestion >= CLEAN_TIME && now - _last_change >= CLEAN_TIME) {
+      bitrate = std::min(_max_bitrate, bitrate + std::max(1, _max_bitrate * INCREASE_PERCENT / 100));
+    }
+
+    if (bitrate == _bitrate) {
+      return std::nullopt;
+    }
+
+    BOOST_LOG(debug) << (bitrate < _bitrate ? "Lowering"sv : "Raising"sv) << " video bitrate to "sv << bitrate << " Kbps"sv;
+
+    _bitrate = bitrate;
+    _last_change = now;
+
+    return bitrate;
+  }
+
+  int controller_t::bitrate() const {
+    return _bitrate;
+  }
+
+  void controller_t::congested(time_point now) {
+    _congested = true;
+    _last_congestion = now;
+  }
+}  // namespace bitrate_control
@@ -0,0 +1,102 @@
+/**
+ * @file src/bitrate_control.h
+ * @brief Declarations for the per-session bitrate control of the video stream.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace bitrate_control {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /**
+   * @brief The bitrate a session's video is encoded at.
+   * @details Starts at the bitrate the client asked for. Lost frames, requests to invalidate
+   *          reference frames and a round trip time well above the lowest one seen are taken
+   *          as congestion, and cut the bitrate. Once the client went a while without any of
+   *          them, the bitrate is raised again in small steps, up to the requested one.
+   *
+   *          Only used on the control stream thread.
+   */
+  class controller_t {
+  public:
+    /// The percentage a congested bitrate is cut by
+    static constexpr int DECREASE_PERCENT = 20;
+
+    /// The percentage of the requested bitrate a clean link gains per step
+    static constexpr int INCREASE_PERCENT = 5;
+
+    /// The lowest bitrate as a percentage of the requested bitrate
+    static constexpr int MIN_PERCENT = 25;
+
+    /// The number of frames lost in one report that count as congestion, fewer are left to FEC
+    static constexpr std::int64_t LOSS_THRESHOLD = 2;
+
+    /// The round trip time above the lowest one seen that counts as congestion
+    static constexpr std::chrono::milliseconds RTT_THRESHOLD {40};
+
+    /// The time the encoder is given to settle after a cut before it's cut again
+    static constexpr std::chrono::milliseconds HOLD_TIME {1000};
+
+    /// The time without congestion before each raise
+    static constexpr std::chrono::milliseconds CLEAN_TIME {2000};
+
+    controller_t();
+
+    /**
+     * @brief Start controlling from the requested bitrate.
+     * @param bitrate The requested bitrate in Kbps, which is never exceeded.
+     * @param now The current time.
+     */
+    void reset(int bitrate, time_point now);
+
+    /**
+     * @brief Take a loss report from the client into account.
+     * @param lost_frames The number of frames lost since the last report.
+     * @param now The current time.
+     */
+    void report_loss(std::int64_t lost_frames, time_point now);
+
+    /**
+     * @brief Take a request from the client to invalidate reference frames into account.
+     * @param now The current time.
+     */
+    void report_invalidation(time_point now);
+
+    /**
+     * @brief Take the round trip time to the client into account.
+     * @param rtt The smoothed round trip time.
+     * @param now The current time.
+     */
+    void report_rtt(std::chrono::milliseconds rtt, time_point now);
+
+    /**
+     * @brief Adapt the bitrate to the reports since the last update.
+     * @param now The current time.
+     * @return The new bitrate in Kbps, or `std::nullopt` if it didn't change.
+     */
+    std::optional<int> update(time_point now);
+
+    /**
+     * @brief Get the current bitrate.
+     * @return The bitrate in Kbps.
+     */
+    int bitrate() const;
+
+  private:
+    void congested(time_point now);
+
+    int _bitrate;
+    int _max_bitrate;
+    int _min_bitrate;
+
+    std::optional<std::chrono::milliseconds> _min_rtt;
+
+    bool _congested;
+    time_point _last_congestion;
+    time_point _last_change;
+  };
+}  // namespace bitrate_control
@@ -0,0 +1,179 @@
+/**
+ * @file src/capture_latency.cpp
+ * @brief Definitions for measuring the latency of the capture backends.
+ */
+// standard includes
+#include <iomanip>
+#include <iostream>
+
+// local includes
+#include "capture_latency.h"
+#include "config.h"
+#include "display_device.h"
+#include "logging.h"
+#include "video.h"
+
+using namespace std::literals;
+
+namespace capture_latency {
+  namespace {
+    constexpr int PATTERN_BITS = TIMESTAMP_BITS + COUNTER_BITS;
+
+    // A cell is read as set or cleared only this far from the middle gray, scaling blurs the edges of the cells
+    constexpr int MIN_CONTRAST = 64;
+
+    /**
+     * @brief Get the brightness at the center of a cell.
+     */
+    int brightness(const platf::img_t &img, int cell, int row) {
+      auto x = cell * CELL_SIZE + CELL_SIZE / 2;
+      auto y = row * CELL_SIZE + CELL_SIZE / 2;
+
+      auto pixel = img.data + y * img.row_pitch + x * img.pixel_pitch;
+      return (pixel[0] + pixel[1] + pixel[2]) / 3;
+    }
+
+    /**
+     * @brief Get the difference between two timestamps of the pattern, which wrap around.
+     */
+    std::int64_t timestamp_delta(std::int64_t later, std::int64_t earlier) {
+      constexpr std::int64_t range = 1LL << TIMESTAMP_BITS;
+
+      auto delta = (later - earlier) % range;
+      if (delta < 0) {
+        delta += range;
+      }
+
+      // Half the range each way, the clocks may not agree to the millisecond
+      return delta >= range / 2 ? delta - range : delta;
+    }
+  }  // namespace
+
+  std::optional<pattern_t> decode(const platf::img_t &img) {
+    if (!img.data || img.width < PATTERN_BITS * CELL_SIZE || img.height < 2 * CELL_SIZE) {
+      return std::nullopt;
+    }
+
+    std::uint64_t bits = 0;
+    for (int cell = 0; cell < PATTERN_BITS; ++cell) {
+      auto bit = brightness(img, cell, 0);
+      auto complement = brightness(img, cell, 1);
+
+      if (bit - complement >= MIN_CONTRAST) {
+        bits = (bits << 1) | 1;
+      } else if (complement - bit >= MIN_CONTRAST) {
+        bits <<= 1;
+      } else {
+        return std::nullopt;
+      }
+    }
+
+    return pattern_t {
+      (std::int64_t) (bits >> COUNTER_BITS),
+      (std::uint32_t) (bits & ((1 << COUNTER_BITS) - 1)),
+    };
+  }
+
+  void tracker_t::captured(const std::optional<pattern_t> &pattern, std::int64_t captured_ms) {
+    ++frames;
+
+    if (!pattern) {
+      ++undecoded;
+      return;
+    }
+
+    if (last) {
+      auto skipped = (pattern->counter - last->counter) & ((1 << COUNTER_BITS) - 1);
+      if (skipped == 0) {
+        ++duplicates;
+        return;
+      }
+
+      dropped += skipped - 1;
+    }
+    last = pattern;
+
+    // The browser may coarsen its clock, a frame is never captured before it's rendered
+    latency.collect((double) std::max<std::int64_t>(timestamp_delta(captured_ms, pattern->timestamp_ms), 0));
+  }
+
+  int measure(std::chrono::seconds duration, int framerate) {
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+
+    video::config_t config {1920, 1080, framerate, 1000, 1, 0, 1, 0, 0, 0};
+    auto disp = platf::display(platf::mem_type_e::system, output_name, config);
+    if (!disp) {
+      BOOST_LOG(error) << "Couldn't capture the display"sv;
+      return -1;
+    }
+
+    auto backend = disp->capture_backend();
+    BOOST_LOG(info) << "Measuring the capture latency of ["sv << backend.name << "] for "sv << duration.count() << " seconds"sv;
+
+    tracker_t tracker;
+    std::uint64_t timeouts = 0;
+
+    std::shared_ptr<platf::img_t> img;
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+      if (!img) {
+        img = disp->alloc_img();
+      }
+
+      img_out = img;
+      return (bool) img_out;
+    };
+    auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&captured, bool frame_captured) -> bool {
+      auto now = std::chrono::steady_clock::now();
+
+      if (!frame_captured || !captured) {
+        ++timeouts;
+        return now < deadline;
+      }
+
+      // The backends that know when the compositor presented the frame stamp it with that time
+      auto captured_at = std::chrono::system_clock::now() - (now - captured->frame_timestamp.value_or(now));
+      auto captured_ms = std::chrono::duration_cast<std::chrono::milliseconds>(captured_at.time_since_epoch()).count();
+
+      tracker.captured(decode(*captured), captured_ms);
+
+      img = std::move(captured);
+      return now < deadline;
+    };
+
+    // The cursor would only cover the pattern
+    bool cursor = false;
+    auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &cursor);
+    if (status != platf::capture_e::ok) {
+      BOOST_LOG(warning) << "The capture ended early"sv;
+    }
+
+    auto two_digits = [](double value) {
+      return (stat_trackers::two_digits_after_decimal() % value).str();
+    };
+
+    auto &latency = tracker.latency;
+    std::cout
+      << std::endl
+      << "backend     | frames | pattern | duplicates | dropped | timeouts | p50 ms | p95 ms | p99 ms | max ms"sv << std::endl
+      << std::left << std::setw(11) << backend.name << " | "sv
+      << std::right
+      << std::setw(6) << tracker.frames << " | "sv
+      << std::setw(7) << tracker.frames - tracker.undecoded << " | "sv
+      << std::setw(10) << tracker.duplicates << " | "sv
+      << std::setw(7) << tracker.dropped << " | "sv
+      << std::setw(8) << timeouts << " | "sv
+      << std::setw(6) << two_digits(latency.percentile(50)) << " | "sv
+      << std::setw(6) << two_digits(latency.percentile(95)) << " | "sv
+      << std::setw(6) << two_digits(latency.percentile(99)) << " | "sv
+      << std::setw(6) << two_digits(latency.max()) << std::endl
+      << std::endl;
+
+    if (!latency.count()) {
+      BOOST_LOG(error) << "No frame with the pattern was captured, open tools/capture_latency.html in full screen on the display"sv;
+      return -1;
+    }
+
+    return 0;
+  }
+}  // namespace capture_latency
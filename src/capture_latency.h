@@ -0,0 +1,80 @@
+/**
+ * @file src/capture_latency.h
+ * @brief Declarations for measuring the latency of the capture backends.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// local includes
+#include "platform/common.h"
+#include "stat_trackers.h"
+
+/**
+ * @brief Measures how long after a frame is rendered the capture backend delivers it.
+ * @details The frames carry a pattern drawn by tools/capture_latency.html in the top left corner
+ *          of the display: a row of cells with the bits of the time it was rendered and of a frame
+ *          counter, and under it a row with the complements of those bits, which tells a cell that
+ *          was captured while it changed apart from a valid one.
+ */
+namespace capture_latency {
+  /// The side of a cell of the pattern, in pixels
+  constexpr int CELL_SIZE = 16;
+
+  /// The bits of the time the frame was rendered, in milliseconds since the epoch of the system clock
+  constexpr int TIMESTAMP_BITS = 40;
+
+  /// The bits of the counter of the frames rendered
+  constexpr int COUNTER_BITS = 16;
+
+  /**
+   * @brief What a captured pattern tells about its frame.
+   */
+  struct pattern_t {
+    std::int64_t timestamp_ms;  ///< The time the frame was rendered, modulo 2^TIMESTAMP_BITS
+    std::uint32_t counter;  ///< The number of the frame, modulo 2^COUNTER_BITS
+  };
+
+  /**
+   * @brief Read the pattern at the top left corner of a captured image.
+   * @param img The image, in BGRA.
+   * @return The pattern, or `std::nullopt` if none was found or it was captured while it changed.
+   */
+  std::optional<pattern_t> decode(const platf::img_t &img);
+
+  /**
+   * @brief Counts the frames of the pattern as they're captured.
+   */
+  class tracker_t {
+  public:
+    /**
+     * @brief Count a captured image.
+     * @param pattern The pattern read from it.
+     * @param captured_ms The time it was captured, in milliseconds since the epoch of the system clock.
+     */
+    void captured(const std::optional<pattern_t> &pattern, std::int64_t captured_ms);
+
+    /// The milliseconds from rendering a frame to capturing it, for the frames captured for the first time
+    stat_trackers::histogram_tracker latency;
+
+    std::uint64_t frames = 0;  ///< The images captured
+    std::uint64_t undecoded = 0;  ///< The images without a valid pattern
+    std::uint64_t duplicates = 0;  ///< The images of a frame captured before
+    std::uint64_t dropped = 0;  ///< The frames rendered that were never captured
+
+  private:
+    std::optional<pattern_t> last;
+  };
+
+  /**
+   * @brief Capture the display showing the pattern, then print the latency and the frames of the backend.
+   * @details The display and the capture backend are picked from the configuration like for streaming.
+   * @param duration How long to capture.
+   * @param framerate The frame rate the display is captured at.
+   * @return 0 if frames with the pattern were captured, -1 otherwise.
+   */
+  int measure(std::chrono::seconds duration, int framerate);
+}  // namespace capture_latency
@@ -0,0 +1,295 @@
+/**
+ * @file src/color_convert.cpp
+ * @brief Definitions for the conversion of captured images to YUV.
+ */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
+// local includes
+#include "color_convert.h"
+#include "video_colorspace.h"
+
+namespace color_convert {
+  namespace {
+    // The fractional bits of the fixed point coefficients
+    constexpr int COEFFICIENT_BITS = 16;
+  }  // namespace
+
+#define COLOR_CONVERT_ISA generic
+#include "color_convert_kernels.h"
+#undef COLOR_CONVERT_ISA
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define COLOR_CONVERT_X86
+
+  // Compile a variant for AVX2
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx2")
+  #endif
+  #define COLOR_CONVERT_ISA avx2
+  #include "color_convert_kernels.h"
+  #undef COLOR_CONVERT_ISA
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+
+  // Compile a variant for AVX512BW
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx512f,avx512bw")
+  #endif
+  #define COLOR_CONVERT_ISA avx512
+  #include "color_convert_kernels.h"
+  #undef COLOR_CONVERT_ISA
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+#endif
+
+  struct kernels_t {
+    decltype(&generic::plane_row_8) plane_row_8;
+    decltype(&generic::plane_row_16) plane_row_16;
+    decltype(&generic::chroma_row_8) chroma_row_8;
+    decltype(&generic::chroma_row_16) chroma_row_16;
+  };
+
+  namespace {
+#define KERNELS(isa) {isa::plane_row_8, isa::plane_row_16, isa::chroma_row_8, isa::chroma_row_16}
+
+    constexpr kernels_t generic_kernels KERNELS(generic);
+#ifdef COLOR_CONVERT_X86
+    constexpr kernels_t avx2_kernels KERNELS(avx2);
+    constexpr kernels_t avx512_kernels KERNELS(avx512);
+#endif
+
+#undef KERNELS
+
+    const kernels_t *kernels_for(isa_e isa) {
+      switch (isa) {
+#ifdef COLOR_CONVERT_X86
+        case isa_e::avx512:
+          return &avx512_kernels;
+        case isa_e::avx2:
+          return &avx2_kernels;
+#endif
+        default:
+          return &generic_kernels;
+      }
+    }
+
+    bool is_420(format_e format) {
+      return format == format_e::nv12 || format == format_e::p010 || format == format_e::yuv420p || format == format_e::yuv420p10;
+    }
+  }  // namespace
+
+  std::vector<isa_e> supported_isas() {
+    std::vector<isa_e> isas {isa_e::generic};
+
+#ifdef COLOR_CONVERT_X86
+    if (__builtin_cpu_supports("avx2")) {
+      isas.emplace_back(isa_e::avx2);
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+      isas.emplace_back(isa_e::avx512);
+    }
+#endif
+
+    return isas;
+  }
+
+  const char *isa_name(isa_e isa) {
+    switch (isa) {
+      case isa_e::avx2:
+        return "AVX2";
+      case isa_e::avx512:
+        return "AVX-512";
+      default:
+        return "generic";
+    }
+  }
+
+  bool converter_t::supports(format_e format, int width, int height) {
+    if (width <= 0 || height <= 0) {
+      return false;
+    }
+
+    // Odd sizes are left to swscale
+    return !is_420(format) || (width % 2 == 0 && height % 2 == 0);
+  }
+
+  converter_t::converter_t(format_e format, int width, int height, int threads, std::optional<isa_e> isa):
+      _format {format},
+      _width {width},
+      _height {height},
+      _kernels {kernels_for(isa ? *isa : supported_isas().back())} {
+    // Bands of fewer than 64 rows aren't worth the synchronization
+    _bands = std::clamp(std::min(threads, height / 64), 1, 16);
+
+    for (int band = 1; band < _bands; ++band) {
+      _workers.emplace_back(&converter_t::work, this, band);
+    }
+  }
+
+  converter_t::~converter_t() {
+    {
+      std::lock_guard lg {_lock};
+      _stop = true;
+    }
+    _start_cv.notify_all();
+
+    for (auto &worker : _workers) {
+      worker.join();
+    }
+  }
+
+  void converter_t::set_colorspace(const video::color_t &color_vectors) {
+    const float *vectors[] {color_vectors.color_vec_y, color_vectors.color_vec_u, color_vectors.color_vec_v};
+
+    // The vectors take R, G and B in the UNORM range and produce the components in the UINT range
+    constexpr auto one = (double) (1 << COEFFICIENT_BITS);
+    for (int component = 0; component < 3; ++component) {
+      auto vec = vectors[component];
+
+      _coefficients[component][0] = (std::int32_t) std::lround(vec[2] / 255.0 * one);
+      _coefficients[component][1] = (std::int32_t) std::lround(vec[1] / 255.0 * one);
+      _coefficients[component][2] = (std::int32_t) std::lround(vec[0] / 255.0 * one);
+      _coefficients[component][3] = (std::int32_t) std::lround(vec[3] * one);
+    }
+  }
+
+  void converter_t::convert(const std::uint8_t *bgra, int pitch, std::uint8_t *const planes[], const int linesizes[]) {
+    auto planes_count = _format == format_e::nv12 || _format == format_e::p010 ? 2 : 3;
+
+    {
+      std::lock_guard lg {_lock};
+
+      _bgra = bgra;
+      _pitch = pitch;
+      std::copy_n(planes, planes_count, _planes);
+      std::copy_n(linesizes, planes_count, _linesizes);
+
+      _pending = (int) _workers.size();
+      ++_generation;
+    }
+    _start_cv.notify_all();
+
+    convert_rows(0);
+
+    std::unique_lock ul {_lock};
+    _done_cv.wait(ul, [this]() {
+      return _pending == 0;
+    });
+  }
+
+  unsigned converter_t::bit_depth() const {
+    return _format == format_e::nv12 || _format == format_e::yuv420p || _format == format_e::yuv444p ? 8 : 10;
+  }
+
+  void converter_t::convert_rows(int band) {
+    // Bands hold an even number of rows for 4:2:0
+    auto band_rows = (_height / 2 + _bands - 1) / _bands * 2;
+    auto begin = std::min(band * band_rows, _height);
+    auto end = std::min(begin + band_rows, _height);
+
+    auto &ky = _coefficients[0];
+    auto &ku = _coefficients[1];
+    auto &kv = _coefficients[2];
+
+    auto src_row = [this](int y) {
+      return _bgra + (std::ptrdiff_t) y * _pitch;
+    };
+    auto dst_row = [this](int plane, int y) {
+      return _planes[plane] + (std::ptrdiff_t) y * _linesizes[plane];
+    };
+    auto dst_row_16 = [&](int plane, int y) {
+      return (std::uint16_t *) dst_row(plane, y);
+    };
+
+    switch (_format) {
+      case format_e::nv12:
+      case format_e::yuv420p:
+        for (int y = begin; y < end; y += 2) {
+          _kernels->plane_row_8(src_row(y), dst_row(0, y), _width, ky, 255);
+          _kernels->plane_row_8(src_row(y + 1), dst_row(0, y + 1), _width, ky, 255);
+
+          if (_format == format_e::nv12) {
+            auto uv = dst_row(1, y / 2);
+            _kernels->chroma_row_8(src_row(y), src_row(y + 1), uv, uv + 1, 2, _width / 2, ku, kv, 255);
+          } else {
+            _kernels->chroma_row_8(src_row(y), src_row(y + 1), dst_row(1, y / 2), dst_row(2, y / 2), 1, _width / 2, ku, kv, 255);
+          }
+        }
+        break;
+      case format_e::p010:
+      case format_e::yuv420p10:
+        {
+          // P010 keeps the 10 bits in the high bits
+          auto shift = _format == format_e::p010 ? 6 : 0;
+
+          for (int y = begin; y < end; y += 2) {
+            _kernels->plane_row_16(src_row(y), dst_row_16(0, y), _width, ky, 1023, shift);
+            _kernels->plane_row_16(src_row(y + 1), dst_row_16(0, y + 1), _width, ky, 1023, shift);
+
+            if (_format == format_e::p010) {
+              auto uv = dst_row_16(1, y / 2);
+              _kernels->chroma_row_16(src_row(y), src_row(y + 1), uv, uv + 1, 2, _width / 2, ku, kv, 1023, shift);
+            } else {
+              _kernels->chroma_row_16(src_row(y), src_row(y + 1), dst_row_16(1, y / 2), dst_row_16(2, y / 2), 1, _width / 2, ku, kv, 1023, shift);
+            }
+          }
+          break;
+        }
+      case format_e::yuv444p:
+        for (int y = begin; y < end; ++y) {
+          _kernels->plane_row_8(src_row(y), dst_row(0, y), _width, ky, 255);
+          _kernels->plane_row_8(src_row(y), dst_row(1, y), _width, ku, 255);
+          _kernels->plane_row_8(src_row(y), dst_row(2, y), _width, kv, 255);
+        }
+        break;
+      case format_e::yuv444p10:
+        for (int y = begin; y < end; ++y) {
+          _kernels->plane_row_16(src_row(y), dst_row_16(0, y), _width, ky, 1023, 0);
+          _kernels->plane_row_16(src_row(y), dst_row_16(1, y), _width, ku, 1023, 0);
+          _kernels->plane_row_16(src_row(y), dst_row_16(2, y), _width, kv, 1023, 0);
+        }
+        break;
+    }
+  }
+
+  void converter_t::work(int band) {
+    std::uint64_t generation = 0;
+
+    while (true) {
+      {
+        std::unique_lock ul {_lock};
+        _start_cv.wait(ul, [&]() {
+          return _stop || _generation != generation;
+        });
+
+        if (_stop) {
+          return;
+        }
+        generation = _generation;
+      }
+
+      convert_rows(band);
+
+      {
+        std::lock_guard lg {_lock};
+        if (--_pending == 0) {
+          _done_cv.notify_one();
+        }
+      }
+    }
+  }
+}  // namespace color_convert
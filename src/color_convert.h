@@ -0,0 +1,137 @@
+/**
+ * @file src/color_convert.h
+ * @brief Declarations for the conversion of captured images to YUV.
+ */
+#pragma once
+
+// standard includes
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace video {
+  struct color_t;
+}  // namespace video
+
+namespace color_convert {
+  /**
+   * @brief The YUV layouts images are converted to.
+   */
+  enum class format_e {
+    nv12,  ///< 8-bit 4:2:0, Y plane and interleaved UV plane
+    p010,  ///< 10-bit 4:2:0 in the high bits of 16 bits, Y plane and interleaved UV plane
+    yuv420p,  ///< 8-bit 4:2:0, Y, U and V planes
+    yuv420p10,  ///< 10-bit 4:2:0 in the low bits of 16 bits, Y, U and V planes
+    yuv444p,  ///< 8-bit 4:4:4, Y, U and V planes
+    yuv444p10,  ///< 10-bit 4:4:4 in the low bits of 16 bits, Y, U and V planes
+  };
+
+  /**
+   * @brief The instruction sets the conversion is compiled for.
+   */
+  enum class isa_e {
+    generic,  ///< Whatever the compiler targets by default, NEON on ARM64
+    avx2,  ///< AVX2
+    avx512,  ///< AVX-512F and AVX-512BW
+  };
+
+  /**
+   * @brief Get the instruction sets the CPU supports.
+   * @return The instruction sets, the best one last.
+   */
+  std::vector<isa_e> supported_isas();
+
+  /**
+   * @brief Get the name of an instruction set.
+   * @param isa The instruction set.
+   * @return The name.
+   */
+  const char *isa_name(isa_e isa);
+
+  // The kernels compiled for an instruction set
+  struct kernels_t;
+
+  /**
+   * @brief Converts BGRA images of one size to YUV.
+   * @details Chroma of 4:2:0 formats is the average of each 2x2 block of pixels. The rows of an
+   *          image are split in bands that are converted in parallel, the first band on the
+   *          calling thread.
+   */
+  class converter_t {
+  public:
+    /**
+     * @brief Check whether images of a size can be converted to a format.
+     * @param format The format.
+     * @param width The width of the images.
+     * @param height The height of the images.
+     * @return `true` if they can be.
+     */
+    static bool supports(format_e format, int width, int height);
+
+    /**
+     * @param format The format to convert to.
+     * @param width The width of the images, see `supports()`.
+     * @param height The height of the images, see `supports()`.
+     * @param threads The number of threads converting each image.
+     * @param isa The instruction set to use, the best supported one by default.
+     */
+    converter_t(format_e format, int width, int height, int threads, std::optional<isa_e> isa = std::nullopt);
+    ~converter_t();
+
+    converter_t(const converter_t &) = delete;
+    converter_t &operator=(const converter_t &) = delete;
+
+    /**
+     * @brief Set the matrix of the conversion.
+     * @param color_vectors Vectors from `video::new_color_vectors_from_colorspace()` for the bit depth of the format.
+     */
+    void set_colorspace(const video::color_t &color_vectors);
+
+    /**
+     * @brief Convert an image.
+     * @param bgra The image.
+     * @param pitch The size of a row of the image in bytes.
+     * @param planes The planes of the converted image.
+     * @param linesizes The size of a row of each plane in bytes.
+     */
+    void convert(const std::uint8_t *bgra, int pitch, std::uint8_t *const planes[], const int linesizes[]);
+
+    /**
+     * @brief Get the bit depth of the format.
+     * @return 8 or 10.
+     */
+    unsigned bit_depth() const;
+
+  private:
+    void convert_rows(int band);
+    void work(int band);
+
+    format_e _format;
+    int _width;
+    int _height;
+
+    const kernels_t *_kernels;
+
+    // Fixed point B, G and R coefficients and offset of each component
+    std::int32_t _coefficients[3][4] {};
+
+    int _bands;
+    std::vector<std::thread> _workers;
+
+    // The image the workers are converting
+    const std::uint8_t *_bgra {};
+    int _pitch {};
+    std::uint8_t *_planes[3] {};
+    int _linesizes[3] {};
+
+    std::mutex _lock;
+    std::condition_variable _start_cv;
+    std::condition_variable _done_cv;
+    std::uint64_t _generation {};
+    int _pending {};
+    bool _stop {};
+  };
+}  // namespace color_convert
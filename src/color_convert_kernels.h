@@ -0,0 +1,62 @@
+/**
+ * @file src/color_convert_kernels.h
+ * @brief Row kernels of the conversion of captured images to YUV.
+ * @details Included by color_convert.cpp once per instruction set, in a namespace named by
+ *          `COLOR_CONVERT_ISA`. The loops are kept simple enough to vectorize.
+ */
+
+// Each kernel reads BGRA pixels and writes one or two components, each computed from the fixed
+// point coefficients `k` as `(k[0] * B + k[1] * G + k[2] * R + k[3]) >> COEFFICIENT_BITS`.
+
+namespace COLOR_CONVERT_ISA {
+  void plane_row_8(const std::uint8_t *__restrict src, std::uint8_t *__restrict dst, int width, const std::int32_t *k, int max) {
+    const auto kb = k[0], kg = k[1], kr = k[2], offset = k[3];
+
+    for (int x = 0; x < width; ++x) {
+      auto v = (kb * src[x * 4] + kg * src[x * 4 + 1] + kr * src[x * 4 + 2] + offset) >> COEFFICIENT_BITS;
+      dst[x] = (std::uint8_t) std::min(std::max(v, 0), max);
+    }
+  }
+
+  void plane_row_16(const std::uint8_t *__restrict src, std::uint16_t *__restrict dst, int width, const std::int32_t *k, int max, int shift) {
+    const auto kb = k[0], kg = k[1], kr = k[2], offset = k[3];
+
+    for (int x = 0; x < width; ++x) {
+      auto v = (kb * src[x * 4] + kg * src[x * 4 + 1] + kr * src[x * 4 + 2] + offset) >> COEFFICIENT_BITS;
+      dst[x] = (std::uint16_t) (std::min(std::max(v, 0), max) << shift);
+    }
+  }
+
+  // Chroma of 4:2:0 is computed from the sums of 2x2 blocks, `step` is 2 for interleaved U and V
+  void chroma_row_8(const std::uint8_t *__restrict src0, const std::uint8_t *__restrict src1, std::uint8_t *__restrict u, std::uint8_t *__restrict v, int step, int width, const std::int32_t *ku, const std::int32_t *kv, int max) {
+    const auto ub = ku[0], ug = ku[1], ur = ku[2], u_offset = ku[3] * 4;
+    const auto vb = kv[0], vg = kv[1], vr = kv[2], v_offset = kv[3] * 4;
+
+    for (int x = 0; x < width; ++x) {
+      int b = src0[x * 8] + src0[x * 8 + 4] + src1[x * 8] + src1[x * 8 + 4];
+      int g = src0[x * 8 + 1] + src0[x * 8 + 5] + src1[x * 8 + 1] + src1[x * 8 + 5];
+      int r = src0[x * 8 + 2] + src0[x * 8 + 6] + src1[x * 8 + 2] + src1[x * 8 + 6];
+
+      auto u_value = (ub * b + ug * g + ur * r + u_offset) >> (COEFFICIENT_BITS + 2);
+      auto v_value = (vb * b + vg * g + vr * r + v_offset) >> (COEFFICIENT_BITS + 2);
+      u[x * step] = (std::uint8_t) std::min(std::max(u_value, 0), max);
+      v[x * step] = (std::uint8_t) std::min(std::max(v_value, 0), max);
+    }
+  }
+
+  void chroma_row_16(const std::uint8_t *__restrict src0, const std::uint8_t *__restrict src1, std::uint16_t *__restrict u, std::uint16_t *__restrict v, int step, int width, const std::int32_t *ku, const std::int32_t *kv, int max, int shift) {
+    const auto ub = ku[0], ug = ku[1], ur = ku[2], u_offset = ku[3] * 4;
+    const auto vb = kv[0], vg = kv[1], vr = kv[2], v_offset = kv[3] * 4;
+
+    for (int x = 0; x < width; ++x) {
+      int b = src0[x * 8] + src0[x * 8 + 4] + src1[x * 8] + src1[x * 8 + 4];
+      int g = src0[x * 8 + 1] + src0[x * 8 + 5] + src1[x * 8 + 1] + src1[x * 8 + 5];
+      int r = src0[x * 8 + 2] + src0[x * 8 + 6] + src1[x * 8 + 2] + src1[x * 8 + 6];
+
+      auto u_value = (ub * b + ug * g + ur * r + u_offset) >> (COEFFICIENT_BITS + 2);
+      auto v_value = (vb * b + vg * g + vr * r + v_offset) >> (COEFFICIENT_BITS + 2);
+      u[x * step] = (std::uint16_t) (std::min(std::max(u_value, 0), max) << shift);
+      v[x * step] = (std::uint16_t) (std::min(std::max(v_value, 0), max) << shift);
+    }
+  }
+}  // namespace COLOR_CONVERT_ISA
@@ -8,6 +8,7 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -64,6 +65,16 @@ namespace config {
       return nvenc::nvenc_two_pass::quarter_resolution;
     }
 
+    bool intra_refresh_recovery_from_view(const std::string_view &policy) {
+      if (policy == "intra_refresh") {
+        return true;
+      }
+      if (policy != "idr") {
+        BOOST_LOG(warning) << "config: unknown idr_recovery value: " << policy;
+      }
+      return false;
+    }
+
   }  // namespace nv
 
   namespace amd {
@@ -335,6 +346,19 @@ namespace config {
 
   }  // namespace vt
 
+  namespace vaapi {
+    std::optional<int> low_power_from_view(const std::string_view &low_power) {
+      if (low_power == "enabled"sv) {
+        return 1;
+      }
+      if (low_power == "disabled"sv) {
+        return 0;
+      }
+
+      return std::nullopt;
+    }
+  }  // namespace vaapi
+
   namespace sw {
     int svtav1_preset_from_view(const std::string_view &preset) {
 #define _CONVERT_(x, y) \
@@ -354,6 +378,17 @@ namespace config {
     }
   }  // namespace sw
 
+  video_t::scaling_filter_e video_scaling_filter_from_view(const std::string_view value) {
+#define _CONVERT_(x) \
+  if (value == #x##sv) \
+  return video_t::scaling_filter_e::x
+    _CONVERT_(bilinear);
+    _CONVERT_(bicubic);
+    _CONVERT_(lanczos);
+#undef _CONVERT_
+    return video_t::scaling_filter_e::bilinear;  // Default to this if value is invalid
+  }
+
   namespace dd {
     video_t::dd_t::config_option_e config_option_from_view(const std::string_view value) {
 #define _CONVERT_(x) \
@@ -441,10 +476,32 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+    0,  // tile_columns
+    0,  // tile_rows
+
+    false,  // shared_encoding
+    false,  // temporal_layers
+
+    true,  // encoder_probe_cache
+    1,  // encoder_probe_sessions
+    false,  // encoder_prewarm
+    false,  // encoder_pacing
+    0,  // minimum_fps
+    false,  // encoder_session_threads
+    0,  // capture_memory_budget
+    false,  // cursor_out_of_band
+    0,  // roi_qp_delta
+    false,  // kms_vblank
+    false,  // kms_skip_unchanged
+    2,  // wgc_frame_pool_size
+    100,  // idr_debounce
+    {},  // packet_capture
+    video_t::scaling_filter_e::bilinear,  // scaling_filter
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
       11,  // superfast
+      false,  // server_profile
     },  // software
 
     {},  // nv
@@ -484,6 +541,10 @@ namespace config {
 
     {
       false,  // strict_rc_buffer
+      false,  // vpp
+      std::nullopt,  // low_power
+      1,  // async_depth
+      false,  // adapter_balancing
     },  // vaapi
 
     {},  // capture
@@ -521,6 +582,29 @@ namespace config {
 
     20,  // fecPercentage
 
+    false,  // adaptive_fec
+    10,  // min_fec_percentage
+    50,  // max_fec_percentage
+
+    false,  // adaptive_bitrate
+
+    true,  // per_session_video_send
+    false,  // io_uring_send
+    false,  // xdp_send
+    false,  // kernel_pacing
+
+    0,  // frame_deadline
+
+    0,  // pacing_rate
+    {},  // client_pacing_rates
+
+    true,  // thread_affinity
+    {},  // capture_cpus
+    {},  // encode_cpus
+    {},  // video_send_cpus
+    {},  // audio_cpus
+    {},  // control_cpus
+
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
   };
@@ -534,6 +618,8 @@ namespace config {
     platf::get_host_name(),  // sunshine_name,
     "sunshine_state.json"s,  // file_state
     {},  // external_ip
+
+    4,  // threads
   };
 
   input_t input {
@@ -560,6 +646,8 @@ namespace config {
     true,  // always send scancodes
     true,  // high resolution scrolling
     true,  // native pen/touch support
+    0,  // mouse_coalescing
+    {},  // input_capture
   };
 
   sunshine_t sunshine {
@@ -577,8 +665,194 @@ namespace config {
     platf::appdata().string() + "/sunshine.log",  // log file
     false,  // notify_pre_releases
     {},  // prep commands
+    false,  // async_launch
   };
 
+  namespace {
+    /**
+     * @brief The settings of every section, parsed apart from the running ones.
+     */
+    struct settings_t {
+      video_t video;
+      audio_t audio;
+      stream_t stream;
+      nvhttp_t nvhttp;
+      input_t input;
+      sunshine_t sunshine;
+    };
+
+    // The settings before any option is applied, the options removed from the file are reset to them
+    const settings_t default_settings {video, audio, stream, nvhttp, input, sunshine};
+
+    // The options of the command line, they override the file whenever it's applied
+    std::unordered_map<std::string, std::string> command_line_vars;
+
+    // The options the running settings were parsed from
+    std::unordered_map<std::string, std::string> applied_vars;
+
+    /**
+     * @brief An option that takes effect without a restart.
+     * @details Their settings are scalars read when a session starts, an encoder is created or a frame is sent.
+     */
+    struct live_option_t {
+      std::string_view name;
+
+      /// Copy the settings the option sets from the parsed ones to the running ones
+      void (*apply)(const settings_t &from);
+    };
+
+    const live_option_t live_options[] {
+      {"qp"sv, [](const settings_t &from) {
+         video.qp = from.video.qp;
+       }},
+      {"max_bitrate"sv, [](const settings_t &from) {
+         video.max_bitrate = from.video.max_bitrate;
+       }},
+      {"minimum_fps"sv, [](const settings_t &from) {
+         video.minimum_fps = from.video.minimum_fps;
+       }},
+      {"idr_debounce"sv, [](const settings_t &from) {
+         video.idr_debounce = from.video.idr_debounce;
+       }},
+      {"roi_qp_delta"sv, [](const settings_t &from) {
+         video.roi_qp_delta = from.video.roi_qp_delta;
+         video.nv.roi_qp_delta = from.video.nv.roi_qp_delta;
+       }},
+      {"nvenc_preset"sv, [](const settings_t &from) {
+         video.nv.quality_preset = from.video.nv.quality_preset;
+#ifndef __APPLE__
+         video.nv_legacy.preset = from.video.nv_legacy.preset;
+#endif
+       }},
+      {"nvenc_vbv_increase"sv, [](const settings_t &from) {
+         video.nv.vbv_percentage_increase = from.video.nv.vbv_percentage_increase;
+#ifndef __APPLE__
+         video.nv_legacy.vbv_percentage_increase = from.video.nv_legacy.vbv_percentage_increase;
+#endif
+       }},
+      {"nvenc_spatial_aq"sv, [](const settings_t &from) {
+         video.nv.adaptive_quantization = from.video.nv.adaptive_quantization;
+#ifndef __APPLE__
+         video.nv_legacy.aq = from.video.nv_legacy.aq;
+#endif
+       }},
+      {"nvenc_twopass"sv, [](const settings_t &from) {
+         video.nv.two_pass = from.video.nv.two_pass;
+#ifndef __APPLE__
+         video.nv_legacy.multipass = from.video.nv_legacy.multipass;
+#endif
+       }},
+      {"nvenc_h264_cavlc"sv, [](const settings_t &from) {
+         video.nv.h264_cavlc = from.video.nv.h264_cavlc;
+#ifndef __APPLE__
+         video.nv_legacy.h264_coder = from.video.nv_legacy.h264_coder;
+#endif
+       }},
+      {"qsv_preset"sv, [](const settings_t &from) {
+         video.qsv.qsv_preset = from.video.qsv.qsv_preset;
+       }},
+      {"qsv_coder"sv, [](const settings_t &from) {
+         video.qsv.qsv_cavlc = from.video.qsv.qsv_cavlc;
+       }},
+      {"qsv_slow_hevc"sv, [](const settings_t &from) {
+         video.qsv.qsv_slow_hevc = from.video.qsv.qsv_slow_hevc;
+       }},
+      {"amd_quality"sv, [](const settings_t &from) {
+         video.amd.amd_quality_h264 = from.video.amd.amd_quality_h264;
+         video.amd.amd_quality_hevc = from.video.amd.amd_quality_hevc;
+         video.amd.amd_quality_av1 = from.video.amd.amd_quality_av1;
+       }},
+      {"amd_rc"sv, [](const settings_t &from) {
+         video.amd.amd_rc_h264 = from.video.amd.amd_rc_h264;
+         video.amd.amd_rc_hevc = from.video.amd.amd_rc_hevc;
+         video.amd.amd_rc_av1 = from.video.amd.amd_rc_av1;
+       }},
+      {"amd_usage"sv, [](const settings_t &from) {
+         video.amd.amd_usage_h264 = from.video.amd.amd_usage_h264;
+         video.amd.amd_usage_hevc = from.video.amd.amd_usage_hevc;
+         video.amd.amd_usage_av1 = from.video.amd.amd_usage_av1;
+       }},
+      {"amd_coder"sv, [](const settings_t &from) {
+         video.amd.amd_coder = from.video.amd.amd_coder;
+       }},
+      {"amd_preanalysis"sv, [](const settings_t &from) {
+         video.amd.amd_preanalysis = from.video.amd.amd_preanalysis;
+       }},
+      {"amd_vbaq"sv, [](const settings_t &from) {
+         video.amd.amd_vbaq = from.video.amd.amd_vbaq;
+       }},
+      {"amd_enforce_hrd"sv, [](const settings_t &from) {
+         video.amd.amd_enforce_hrd = from.video.amd.amd_enforce_hrd;
+       }},
+      {"vaapi_strict_rc_buffer"sv, [](const settings_t &from) {
+         video.vaapi.strict_rc_buffer = from.video.vaapi.strict_rc_buffer;
+       }},
+      {"stream_audio"sv, [](const settings_t &from) {
+         audio.stream = from.audio.stream;
+       }},
+      {"ping_timeout"sv, [](const settings_t &from) {
+         stream.ping_timeout = from.stream.ping_timeout;
+       }},
+      {"lan_encryption_mode"sv, [](const settings_t &from) {
+         stream.lan_encryption_mode = from.stream.lan_encryption_mode;
+       }},
+      {"wan_encryption_mode"sv, [](const settings_t &from) {
+         stream.wan_encryption_mode = from.stream.wan_encryption_mode;
+       }},
+      {"fec_percentage"sv, [](const settings_t &from) {
+         stream.fec_percentage = from.stream.fec_percentage;
+       }},
+      {"adaptive_fec"sv, [](const settings_t &from) {
+         stream.adaptive_fec = from.stream.adaptive_fec;
+       }},
+      {"min_fec_percentage"sv, [](const settings_t &from) {
+         stream.min_fec_percentage = from.stream.min_fec_percentage;
+       }},
+      {"max_fec_percentage"sv, [](const settings_t &from) {
+         stream.max_fec_percentage = from.stream.max_fec_percentage;
+       }},
+      {"adaptive_bitrate"sv, [](const settings_t &from) {
+         stream.adaptive_bitrate = from.stream.adaptive_bitrate;
+       }},
+      {"frame_deadline"sv, [](const settings_t &from) {
+         stream.frame_deadline = from.stream.frame_deadline;
+       }},
+      {"pacing_rate"sv, [](const settings_t &from) {
+         stream.pacing_rate = from.stream.pacing_rate;
+       }},
+      {"back_button_timeout"sv, [](const settings_t &from) {
+         input.back_button_timeout = from.input.back_button_timeout;
+       }},
+      {"key_repeat_frequency"sv, [](const settings_t &from) {
+         input.key_repeat_period = from.input.key_repeat_period;
+       }},
+      {"key_repeat_delay"sv, [](const settings_t &from) {
+         input.key_repeat_delay = from.input.key_repeat_delay;
+       }},
+      {"ds4_back_as_touchpad_click"sv, [](const settings_t &from) {
+         input.ds4_back_as_touchpad_click = from.input.ds4_back_as_touchpad_click;
+       }},
+      {"motion_as_ds4"sv, [](const settings_t &from) {
+         input.motion_as_ds4 = from.input.motion_as_ds4;
+       }},
+      {"touchpad_as_ds4"sv, [](const settings_t &from) {
+         input.touchpad_as_ds4 = from.input.touchpad_as_ds4;
+       }},
+      {"always_send_scancodes"sv, [](const settings_t &from) {
+         input.always_send_scancodes = from.input.always_send_scancodes;
+       }},
+      {"high_resolution_scrolling"sv, [](const settings_t &from) {
+         input.high_resolution_scrolling = from.input.high_resolution_scrolling;
+       }},
+      {"native_pen_touch"sv, [](const settings_t &from) {
+         input.native_pen_touch = from.input.native_pen_touch;
+       }},
+      {"mouse_coalescing"sv, [](const settings_t &from) {
+         input.mouse_coalescing = from.input.mouse_coalescing;
+       }},
+    };
+  }  // namespace
+
   bool endline(char ch) {
     return ch == '\r' || ch == '\n';
   }
@@ -943,8 +1217,12 @@ namespace config {
       auto do_cmd = prep_cmd.get_optional<std::string>("do"s);
       auto undo_cmd = prep_cmd.get_optional<std::string>("undo"s);
       auto elevated = prep_cmd.get_optional<bool>("elevated"s);
+      auto group = prep_cmd.get_optional<std::string>("group"s);
+      auto timeout = prep_cmd.get_optional<int>("timeout"s);
 
-      input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      auto &cmd = input.emplace_back(do_cmd.value_or(""), undo_cmd.value_or(""), elevated.value_or(false));
+      cmd.group = group.value_or("");
+      cmd.timeout = timeout.value_or(0);
     }
   }
 
@@ -1000,6 +1278,27 @@ namespace config {
     }
   }
 
+  void map_string_int_f(std::unordered_map<std::string, std::string> &vars, const std::string &name, std::unordered_map<std::string, int> &input) {
+    std::vector<std::string> list;
+    list_string_f(vars, name, list);
+
+    // The list needs to be a multiple of 2
+    if (list.size() % 2) {
+      BOOST_LOG(warning) << "config: expected "sv << name << " to have a multiple of two elements --> not "sv << list.size();
+      return;
+    }
+
+    input.clear();
+
+    int x = 0;
+    while (x < list.size()) {
+      auto &key = list[x++];
+      auto &val = list[x++];
+
+      input.insert_or_assign(key, util::from_view(val));
+    }
+  }
+
   int apply_flags(const char *line) {
     int ret = 0;
     while (*line != '\0') {
@@ -1037,7 +1336,12 @@ namespace config {
     return opts;
   }
 
-  void apply_config(std::unordered_map<std::string, std::string> &&vars) {
+  /**
+   * @brief Parse the options into the settings of each section.
+   * @details The settings are passed in, so the options can be parsed apart from the running settings.
+   *          The flags of the `flags` option are always applied to the running settings.
+   */
+  void apply_config(std::unordered_map<std::string, std::string> &&vars, video_t &video, audio_t &audio, stream_t &stream, nvhttp_t &nvhttp, input_t &input, sunshine_t &sunshine) {
     if (!fs::exists(stream.file_apps.c_str())) {
       fs::copy_file(SUNSHINE_ASSETS_DIR "/apps.json", stream.file_apps);
     }
@@ -1051,17 +1355,44 @@ namespace config {
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    int_between_f(vars, "tile_columns", video.tile_columns, {0, 64});
+    int_between_f(vars, "tile_rows", video.tile_rows, {0, 64});
+    video.nv.tile_columns = video.tile_columns;
+    video.nv.tile_rows = video.tile_rows;
+    bool_f(vars, "shared_encoding", video.shared_encoding);
+    bool_f(vars, "temporal_layers", video.temporal_layers);
+    video.nv.temporal_layers = video.temporal_layers;
+    bool_f(vars, "encoder_probe_cache", video.encoder_probe_cache);
+    int_between_f(vars, "encoder_probe_sessions", video.encoder_probe_sessions, {1, 8});
+    bool_f(vars, "encoder_prewarm", video.encoder_prewarm);
+    bool_f(vars, "encoder_pacing", video.encoder_pacing);
+    int_between_f(vars, "minimum_fps", video.minimum_fps, {0, 240});
+    bool_f(vars, "encoder_session_threads", video.encoder_session_threads);
+    generic_f(vars, "idr_recovery", video.nv.intra_refresh_recovery, nv::intra_refresh_recovery_from_view);
+    int_between_f(vars, "intra_refresh_frames", video.nv.intra_refresh_frames, {2, 60});
+    int_between_f(vars, "idr_debounce", video.idr_debounce, {0, 1000});
+    string_f(vars, "packet_capture", video.packet_capture);
+    int_between_f(vars, "capture_memory_budget", video.capture_memory_budget, {0, 65536});
+    bool_f(vars, "cursor_out_of_band", video.cursor_out_of_band);
+    int_between_f(vars, "roi_qp_delta", video.roi_qp_delta, {0, 12});
+    video.nv.roi_qp_delta = video.roi_qp_delta;
+    bool_f(vars, "kms_vblank", video.kms_vblank);
+    bool_f(vars, "kms_skip_unchanged", video.kms_skip_unchanged);
+    int_between_f(vars, "wgc_frame_pool_size", video.wgc_frame_pool_size, {2, 8});
+    generic_f(vars, "scaling_filter", video.scaling_filter, video_scaling_filter_from_view);
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
     }
     string_f(vars, "sw_tune", video.sw.sw_tune);
+    bool_f(vars, "sw_server_profile", video.sw.server_profile);
 
     int_between_f(vars, "nvenc_preset", video.nv.quality_preset, {1, 7});
     int_between_f(vars, "nvenc_vbv_increase", video.nv.vbv_percentage_increase, {0, 400});
     bool_f(vars, "nvenc_spatial_aq", video.nv.adaptive_quantization);
     generic_f(vars, "nvenc_twopass", video.nv.two_pass, nv::twopass_from_view);
     bool_f(vars, "nvenc_h264_cavlc", video.nv.h264_cavlc);
+    int_between_f(vars, "nvenc_output_buffers", video.nv.output_buffers, {1, 4});
     bool_f(vars, "nvenc_realtime_hags", video.nv_realtime_hags);
     bool_f(vars, "nvenc_opengl_vulkan_on_dxgi", video.nv_opengl_vulkan_on_dxgi);
     bool_f(vars, "nvenc_latency_over_power", video.nv_sunshine_high_power_mode);
@@ -1115,6 +1446,10 @@ namespace config {
     int_f(vars, "vt_realtime", video.vt.vt_realtime, vt::rt_from_view);
 
     bool_f(vars, "vaapi_strict_rc_buffer", video.vaapi.strict_rc_buffer);
+    bool_f(vars, "vaapi_vpp", video.vaapi.vpp);
+    int_f(vars, "vaapi_low_power", video.vaapi.low_power, vaapi::low_power_from_view);
+    int_between_f(vars, "vaapi_async_depth", video.vaapi.async_depth, {1, 8});
+    bool_f(vars, "vaapi_adapter_balancing", video.vaapi.adapter_balancing);
 
     string_f(vars, "capture", video.capture);
     string_f(vars, "encoder", video.encoder);
@@ -1147,15 +1482,16 @@ namespace config {
     path_f(vars, "pkey", nvhttp.pkey);
     path_f(vars, "cert", nvhttp.cert);
     string_f(vars, "sunshine_name", nvhttp.sunshine_name);
-    path_f(vars, "log_path", config::sunshine.log_file);
+    path_f(vars, "log_path", sunshine.log_file);
     path_f(vars, "file_state", nvhttp.file_state);
 
     // Must be run after "file_state"
-    config::sunshine.credentials_file = config::nvhttp.file_state;
-    path_f(vars, "credentials_file", config::sunshine.credentials_file);
+    sunshine.credentials_file = nvhttp.file_state;
+    path_f(vars, "credentials_file", sunshine.credentials_file);
 
     string_f(vars, "external_ip", nvhttp.external_ip);
-    list_prep_cmd_f(vars, "global_prep_cmd", config::sunshine.prep_cmds);
+    int_between_f(vars, "http_threads", nvhttp.threads, {1, 16});
+    list_prep_cmd_f(vars, "global_prep_cmd", sunshine.prep_cmds);
 
     string_f(vars, "audio_sink", audio.sink);
     string_f(vars, "virtual_sink", audio.virtual_sink);
@@ -1175,6 +1511,23 @@ namespace config {
 
     path_f(vars, "file_apps", stream.file_apps);
     int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_fec", stream.adaptive_fec);
+    int_between_f(vars, "min_fec_percentage", stream.min_fec_percentage, {1, 255});
+    int_between_f(vars, "max_fec_percentage", stream.max_fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_bitrate", stream.adaptive_bitrate);
+    bool_f(vars, "per_session_video_send", stream.per_session_video_send);
+    bool_f(vars, "io_uring_send", stream.io_uring_send);
+    bool_f(vars, "xdp_send", stream.xdp_send);
+    bool_f(vars, "kernel_pacing", stream.kernel_pacing);
+    int_between_f(vars, "frame_deadline", stream.frame_deadline, {0, 10});
+    int_between_f(vars, "pacing_rate", stream.pacing_rate, {0, 400000});
+    map_string_int_f(vars, "client_pacing_rates", stream.client_pacing_rates);
+    bool_f(vars, "thread_affinity", stream.thread_affinity);
+    string_f(vars, "capture_cpus", stream.capture_cpus);
+    string_f(vars, "encode_cpus", stream.encode_cpus);
+    string_f(vars, "video_send_cpus", stream.video_send_cpus);
+    string_f(vars, "audio_cpus", stream.audio_cpus);
+    string_f(vars, "control_cpus", stream.control_cpus);
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1198,7 +1551,7 @@ namespace config {
     double_between_f(vars, "key_repeat_frequency", repeat_frequency, {0, std::numeric_limits<double>::max()});
 
     if (repeat_frequency > 0) {
-      config::input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
+      input.key_repeat_period = std::chrono::duration<double> {1 / repeat_frequency};
     }
 
     to = -1;
@@ -1220,8 +1573,11 @@ namespace config {
 
     bool_f(vars, "high_resolution_scrolling", input.high_resolution_scrolling);
     bool_f(vars, "native_pen_touch", input.native_pen_touch);
+    int_between_f(vars, "mouse_coalescing", input.mouse_coalescing, {0, 8});
+    string_f(vars, "input_capture", input.input_capture);
 
     bool_f(vars, "notify_pre_releases", sunshine.notify_pre_releases);
+    bool_f(vars, "async_launch", sunshine.async_launch);
 
     int port = sunshine.port;
     int_between_f(vars, "port"s, port, {1024 + nvhttp::PORT_HTTPS, 65535 - rtsp_stream::RTSP_SETUP_PORT});
@@ -1233,10 +1589,10 @@ namespace config {
     bool_f(vars, "upnp"s, upnp);
 
     if (upnp) {
-      config::sunshine.flags[config::flag::UPNP].flip();
+      sunshine.flags[config::flag::UPNP].flip();
     }
 
-    string_restricted_f(vars, "locale", config::sunshine.locale, {
+    string_restricted_f(vars, "locale", sunshine.locale, {
                                                                    "bg"sv,  // Bulgarian
                                                                    "cs"sv,  // Czech
                                                                    "de"sv,  // German
@@ -1372,13 +1728,15 @@ namespace config {
       auto vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
 
       for (auto &[name, value] : cmd_vars) {
-        vars.insert_or_assign(std::move(name), std::move(value));
+        vars.insert_or_assign(name, value);
       }
+      command_line_vars = std::move(cmd_vars);
+      applied_vars = vars;
 
       // Apply the config. Note: This will try to create any paths
       // referenced in the config, so we may receive exceptions if
       // the path is incorrect or inaccessible.
-      apply_config(std::move(vars));
+      apply_config(std::move(vars), video, audio, stream, nvhttp, input, sunshine);
       config_loaded = true;
     } catch (const std::filesystem::filesystem_error &err) {
       BOOST_LOG(fatal) << "Failed to apply config: "sv << err.what();
@@ -1449,4 +1807,64 @@ namespace config {
 
     return 0;
   }
+
+  std::vector<std::string> reload() {
+    static std::mutex reload_lock;
+    std::lock_guard lg {reload_lock};
+
+    auto vars = parse_config(file_handler::read_file(sunshine.config_file.c_str()));
+    for (auto &[name, value] : command_line_vars) {
+      vars.insert_or_assign(name, value);
+    }
+
+    std::vector<std::string> changed;
+    for (auto &[name, value] : vars) {
+      auto it = applied_vars.find(name);
+      if (it == std::end(applied_vars) || it->second != value) {
+        changed.emplace_back(name);
+      }
+    }
+    for (auto &[name, _] : applied_vars) {
+      if (!vars.contains(name)) {
+        changed.emplace_back(name);
+      }
+    }
+
+    if (changed.empty()) {
+      return {};
+    }
+
+    // Parse from the defaults, so the options removed from the file are reset.
+    // The flags would be applied to the running settings, they only change with a restart.
+    auto parsed = default_settings;
+    auto parsed_vars = vars;
+    parsed_vars.erase("flags"s);
+    apply_config(std::move(parsed_vars), parsed.video, parsed.audio, parsed.stream, parsed.nvhttp, parsed.input, parsed.sunshine);
+    modified_config_settings.clear();
+
+    std::vector<std::string> restart_options;
+    for (auto &name : changed) {
+      auto option = std::find_if(std::begin(live_options), std::end(live_options), [&name](const live_option_t &option) {
+        return option.name == name;
+      });
+
+      // The options that aren't applied keep their previous value, so they're reported again until the restart
+      if (option == std::end(live_options)) {
+        restart_options.emplace_back(name);
+        continue;
+      }
+
+      option->apply(parsed);
+
+      if (auto it = vars.find(name); it != std::end(vars)) {
+        applied_vars.insert_or_assign(name, it->second);
+      } else {
+        applied_vars.erase(name);
+      }
+    }
+
+    BOOST_LOG(info) << "config: Applied "sv << changed.size() - restart_options.size() << " changed options, "sv << restart_options.size() << " apply after a restart"sv;
+
+    return restart_options;
+  }
 }  // namespace config
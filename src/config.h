@@ -27,11 +27,39 @@ namespace config {
     int av1_mode;
 
     int min_threads;  // Minimum number of threads/slices for CPU encoding
+    int tile_columns;  // Tile columns of HEVC and AV1 frames, 0 to pick them from the slices the client asked for
+    int tile_rows;  // Tile rows of HEVC and AV1 frames, 0 to pick them from the slices the client asked for
+
+    bool shared_encoding;  // Clients requesting identical streams share one encoder
+    bool temporal_layers;  // Shared encoders encode a base layer at half their frame rate, for the clients streaming at it
+
+    bool encoder_probe_cache;  // Reuse the last encoder probe while the GPUs, drivers and displays are unchanged
+    int encoder_probe_sessions;  // Number of encoders validated at the same time
+    bool encoder_prewarm;  // Build the encode session at launch, before the client starts its stream
+    bool encoder_pacing;  // Encode on a fixed schedule at the client's frame rate instead of whenever a frame is captured
+    int minimum_fps;  // Frames per second encoded while the captured image is unchanged, 0 for the client's frame rate
+    bool encoder_session_threads;  // Encode the sessions sharing a synchronous capture on a thread each
+    int capture_memory_budget;  // MiB the captured images may take, 0 for no limit
+    bool cursor_out_of_band;  // Leave the cursor out of the video and send it over the control stream
+    int roi_qp_delta;  // Lower QP of the foreground window and the cursor surroundings, 0 to encode the frame alike
+    bool kms_vblank;  // Capture KMS displays after their vertical blanks instead of on a timer
+    bool kms_skip_unchanged;  // Only capture KMS displays when a new framebuffer is flipped or the cursor changes
+    int wgc_frame_pool_size;  // Buffers of the Windows.Graphics.Capture frame pool
+    int idr_debounce;  // Milliseconds after a recovery frame during which the client's requests for another are ignored
+    std::string packet_capture;  // File the encoded video packets are recorded to, for replaying them in benchmarks
+
+    enum class scaling_filter_e {
+      bilinear,  ///< Sample the captured image bilinearly while converting it
+      bicubic,  ///< Scale the captured image with a Catmull-Rom filter before converting it
+      lanczos,  ///< Scale the captured image with a 3-lobe Lanczos filter before converting it
+    };
+    scaling_filter_e scaling_filter;  // Filter of the GPU scaling when the client's resolution differs from the display's
 
     struct {
       std::string sw_preset;
       std::string sw_tune;
       std::optional<int> svtav1_preset;
+      bool server_profile;  // Match the slices and presets to the CPUs available to the encoder
     } sw;
 
     nvenc::nvenc_config nv;
@@ -78,6 +106,10 @@ namespace config {
 
     struct {
       bool strict_rc_buffer;
+      bool vpp;  // Convert captured frames with the video processor instead of shaders
+      std::optional<int> low_power;  // Encode with the low-power entrypoint, when unset it's used if the GPU can
+      int async_depth;  // Frames the encoder works on at once, more raise the throughput at the cost of latency
+      bool adapter_balancing;  // Encode each stream on the render node with the fewest streams
     } vaapi;
 
     std::string capture;
@@ -161,6 +193,43 @@ namespace config {
 
     int fec_percentage;
 
+    // Adapt the FEC percentage of each session to the loss it reports, between these bounds
+    bool adaptive_fec;
+    int min_fec_percentage;
+    int max_fec_percentage;
+
+    // Lower the bitrate of a session while its link is congested
+    bool adaptive_bitrate;
+
+    // Send each session's video from its own thread instead of the shared broadcast thread
+    bool per_session_video_send;
+
+    // Send video through io_uring on Linux
+    bool io_uring_send;
+
+    // Send video through AF_XDP on Linux, skipping the network stack for clients on the link
+    bool xdp_send;
+
+    // Let the kernel send video packets at their pacing time on Linux, instead of sleeping until then
+    bool kernel_pacing;
+
+    // Frame intervals after its capture past which a frame is dropped instead of sent, 0 to send every frame
+    int frame_deadline;
+
+    // Video pacing rate in Mbps, 0 to derive it from the link speed
+    int pacing_rate;
+    // Pacing rates overriding pacing_rate for specific client addresses
+    std::unordered_map<std::string, int> client_pacing_rates;
+
+    // Pin the streaming threads to CPUs
+    bool thread_affinity;
+    // CPUs of each kind of streaming thread, empty for the default
+    std::string capture_cpus;
+    std::string encode_cpus;
+    std::string video_send_cpus;
+    std::string audio_cpus;
+    std::string control_cpus;
+
     // Video encryption settings for LAN and WAN streams
     int lan_encryption_mode;
     int wan_encryption_mode;
@@ -179,6 +248,8 @@ namespace config {
     std::string file_state;
 
     std::string external_ip;
+
+    int threads;  ///< Number of threads serving each of the HTTP, HTTPS and web UI servers.
   };
 
   struct input_t {
@@ -201,6 +272,10 @@ namespace config {
 
     bool high_resolution_scrolling;
     bool native_pen_touch;
+
+    int mouse_coalescing;  ///< Flushes of the relative mouse motion per frame, 0 to send it as it arrives
+
+    std::string input_capture;  ///< File the input messages of the clients are recorded to, for replaying them
   };
 
   namespace flag {
@@ -229,6 +304,12 @@ namespace config {
     std::string do_cmd;
     std::string undo_cmd;
     bool elevated;
+
+    // Consecutive commands of the same group run concurrently, a command without one runs alone
+    std::string group;
+
+    // Seconds the command may run before it's terminated and fails, 0 waits for as long as it runs
+    int timeout {};
   };
 
   struct sunshine_t {
@@ -255,6 +336,9 @@ namespace config {
     std::string log_file;
     bool notify_pre_releases;
     std::vector<prep_cmd_t> prep_cmds;
+
+    // Start the apps while the client sets up its stream, the stream only begins once they're started
+    bool async_launch;
   };
 
   extern video_t video;
@@ -264,6 +348,30 @@ namespace config {
   extern input_t input;
   extern sunshine_t sunshine;
 
+  /**
+   * @brief Parse the command line and the configuration file into the settings above.
+   * @details This only runs once, at startup: the settings saved from the Web UI are applied by reload(),
+   *          and editing the apps only reloads the apps file with proc::refresh().
+   * @param argc The number of arguments.
+   * @param argv The arguments.
+   * @return 0 to continue, 1 to exit with success, -1 to exit with an error.
+   */
   int parse(int argc, char *argv[]);
+
+  /**
+   * @brief Parse the options of a configuration file.
+   * @param file_content The contents of the file.
+   * @return The value of each option, as written in the file.
+   */
   std::unordered_map<std::string, std::string> parse_config(const std::string_view &file_content);
+
+  /**
+   * @brief Apply the options of the configuration file that changed since they were last applied.
+   * @details The options read when a session starts, an encoder is created or a frame is sent take effect at once:
+   *          the running sessions pick them up from their next frame or their next encoder, the next sessions use them.
+   *          The other options, like the ports, the capture and encoder backends or anything read at startup,
+   *          keep their value until Sunshine restarts.
+   * @return The options that changed but only apply after a restart.
+   */
+  std::vector<std::string> reload();
 }  // namespace config
@@ -7,8 +7,12 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <atomic>
+#include <charconv>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <set>
 
 // lib includes
@@ -25,15 +29,21 @@
 #include "crypto.h"
 #include "display_device.h"
 #include "file_handler.h"
+#include "frame_trace.h"
 #include "globals.h"
 #include "httpcommon.h"
+#include "input_latency.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "timeline.h"
 #include "utility.h"
 #include "uuid.h"
+#include "video.h"
+#include "web_cache.h"
 
 using namespace std::literals;
 
@@ -51,6 +61,16 @@ namespace confighttp {
     REMOVE  ///< Remove client
   };
 
+  // The files of the Web UI, read when the server starts
+  web_cache::cache_t web_assets {WEB_DIR};
+
+  // The server handles requests on several threads, the apps file is read, changed and written back
+  std::mutex apps_file_lock;
+
+  // The pages are checked with the server on every load, the bundles have the hash of their contents in their names
+  constexpr auto page_cache_control = "no-cache";
+  constexpr auto asset_cache_control = "public, max-age=31536000, immutable";
+
   /**
    * @brief Log the request details.
    * @param request The HTTP request object.
@@ -254,6 +274,55 @@ namespace confighttp {
     return true;
   }
 
+  /**
+   * @brief Send a file of the Web UI from the cache.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param path The path of the file, relative to the web directory.
+   * @param content_type The content type of the file.
+   * @param cache_control The Cache-Control header.
+   * @param headers Additional headers.
+   */
+  void send_asset(resp_https_t response, req_https_t request, const fs::path &path, const std::string &content_type, const char *cache_control, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+    auto asset = web_assets.get(path);
+    if (!asset) {
+      not_found(response, request);
+      return;
+    }
+
+    headers.emplace("ETag", asset->etag);
+    headers.emplace("Cache-Control", cache_control);
+    headers.emplace("Vary", "Accept-Encoding");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+
+    auto if_none_match = request->header.find("if-none-match");
+    if (if_none_match != request->header.end() && web_cache::matches(if_none_match->second, asset->etag)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
+    auto accept_encoding = request->header.find("accept-encoding");
+    auto encoding = asset->negotiate(accept_encoding == request->header.end() ? std::string_view {} : std::string_view {accept_encoding->second});
+    if (encoding != web_cache::encoding_e::identity) {
+      headers.emplace("Content-Encoding", web_cache::encoding_name(encoding));
+    }
+
+    headers.emplace("Content-Type", content_type);
+    response->write(asset->body(encoding), headers);
+  }
+
+  /**
+   * @brief Send a page of the Web UI.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * @param page The file name of the page.
+   * @param headers Additional headers.
+   */
+  void send_page(resp_https_t response, req_https_t request, const char *page, SimpleWeb::CaseInsensitiveMultimap headers = {}) {
+    send_asset(std::move(response), std::move(request), page, "text/html; charset=utf-8", page_cache_control, std::move(headers));
+  }
+
   /**
    * @brief Get the index page.
    * @param response The HTTP response object.
@@ -267,12 +336,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "index.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "index.html");
   }
 
   /**
@@ -287,12 +351,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "pin.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "pin.html");
   }
 
   /**
@@ -307,13 +366,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "apps.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    headers.emplace("Access-Control-Allow-Origin", "https://images.igdb.com/");
-    response->write(content, headers);
+    send_page(response, request, "apps.html", {{"Access-Control-Allow-Origin", "https://images.igdb.com/"}});
   }
 
   /**
@@ -328,12 +381,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "clients.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "clients.html");
   }
 
   /**
@@ -348,12 +396,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "config.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "config.html");
   }
 
   /**
@@ -368,12 +411,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "password.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "password.html");
   }
 
   /**
@@ -387,12 +425,7 @@ namespace confighttp {
       send_redirect(response, request, "/");
       return;
     }
-    std::string content = file_handler::read_file(WEB_DIR "welcome.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "welcome.html");
   }
 
   /**
@@ -407,12 +440,7 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(WEB_DIR "troubleshooting.html");
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "text/html; charset=utf-8");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(content, headers);
+    send_page(response, request, "troubleshooting.html");
   }
 
   /**
@@ -425,12 +453,7 @@ namespace confighttp {
   void getFaviconImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/sunshine.ico", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/x-icon");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, "images/sunshine.ico", "image/x-icon", page_cache_control);
   }
 
   /**
@@ -443,12 +466,7 @@ namespace confighttp {
   void getSunshineLogoImage(resp_https_t response, req_https_t request) {
     print_req(request);
 
-    std::ifstream in(WEB_DIR "images/logo-sunshine-45.png", std::ios::binary);
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", "image/png");
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    send_asset(response, request, "images/logo-sunshine-45.png", "image/png", page_cache_control);
   }
 
   /**
@@ -481,11 +499,6 @@ namespace confighttp {
       bad_request(response, request);
       return;
     }
-    if (!fs::exists(filePath)) {
-      not_found(response, request);
-      return;
-    }
-
     auto relPath = fs::relative(filePath, webDirPath);
     // get the mime type from the file extension mime_types map
     // remove the leading period from the extension
@@ -496,13 +509,8 @@ namespace confighttp {
       return;
     }
 
-    // if it is, set the content type to the mime type
-    SimpleWeb::CaseInsensitiveMultimap headers;
-    headers.emplace("Content-Type", mimeType->second);
-    headers.emplace("X-Frame-Options", "DENY");
-    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    std::ifstream in(filePath.string(), std::ios::binary);
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
+    // if it is, set the content type to the mime type, a missing file is answered with not found
+    send_asset(response, request, relPath, mimeType->second, asset_cache_control);
   }
 
   /**
@@ -613,6 +621,8 @@ namespace confighttp {
       // TODO: Input Validation
       nlohmann::json output_tree;
       nlohmann::json input_tree = nlohmann::json::parse(ss);
+
+      std::lock_guard lg {apps_file_lock};
       std::string file = file_handler::read_file(config::stream.file_apps.c_str());
       BOOST_LOG(info) << file;
       nlohmann::json file_tree = nlohmann::json::parse(file);
@@ -704,6 +714,8 @@ namespace confighttp {
     try {
       nlohmann::json output_tree;
       nlohmann::json new_apps = nlohmann::json::array();
+
+      std::lock_guard lg {apps_file_lock};
       std::string file = file_handler::read_file(config::stream.file_apps.c_str());
       nlohmann::json file_tree = nlohmann::json::parse(file);
       auto &apps_node = file_tree["apps"];
@@ -884,6 +896,16 @@ namespace confighttp {
    *
    * @attention{It is recommended to ONLY save the config settings that differ from the default behavior.}
    *
+   * The settings that can change while Sunshine runs are applied at once. The response lists the others,
+   * which only apply after a restart:
+   * @code{.json}
+   * {
+   *   "status": true,
+   *   "restart_required": true,
+   *   "restart_options": ["port"]
+   * }
+   * @endcode
+   *
    * @api_examples{/api/config| POST| {"key":"value"}}
    */
   void saveConfig(resp_https_t response, req_https_t request) {
@@ -913,7 +935,11 @@ namespace confighttp {
         config_stream << k << " = " << (v.is_string() ? v.get<std::string>() : v.dump()) << std::endl;
       }
       file_handler::write_file(config::sunshine.config_file.c_str(), config_stream.str());
+
+      auto restart_options = config::reload();
       output_tree["status"] = true;
+      output_tree["restart_required"] = !restart_options.empty();
+      output_tree["restart_options"] = restart_options;
       send_response(response, output_tree);
     } catch (std::exception &e) {
       BOOST_LOG(warning) << "SaveConfig: "sv << e.what();
@@ -988,6 +1014,8 @@ namespace confighttp {
    * @brief Get the logs from the log file.
    * @param response The HTTP response object.
    * @param request The HTTP request object.
+   * A Range header with a single byte range only reads that part of the file, like `bytes=-65536`
+   * for its end or `bytes=1048576-` for what was written since the file had that size.
    *
    * @api_examples{/api/logs| GET| null}
    */
@@ -998,12 +1026,663 @@ namespace confighttp {
 
     print_req(request);
 
-    std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
     SimpleWeb::CaseInsensitiveMultimap headers;
     headers.emplace("Content-Type", "text/plain");
     headers.emplace("X-Frame-Options", "DENY");
     headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
-    response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+    headers.emplace("Accept-Ranges", "bytes");
+
+    auto range_header = request->header.find("Range");
+    if (range_header == request->header.end()) {
+      std::string content = file_handler::read_file(config::sunshine.log_file.c_str());
+      response->write(SimpleWeb::StatusCode::success_ok, content, headers);
+      return;
+    }
+
+    std::error_code ec;
+    std::uint64_t size = fs::file_size(config::sunshine.log_file, ec);
+    if (ec) {
+      size = 0;
+    }
+
+    auto range = http::parse_byte_range(range_header->second, size);
+    if (!range) {
+      headers.emplace("Content-Range", "bytes */" + std::to_string(size));
+      response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+      return;
+    }
+
+    auto content = file_handler::read_file_range(config::sunshine.log_file.c_str(), range->first, range->second);
+    if (content.empty()) {
+      headers.emplace("Content-Range", "bytes */" + std::to_string(size));
+      response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable, headers);
+      return;
+    }
+
+    headers.emplace("Content-Range", "bytes " + std::to_string(range->first) + '-' + std::to_string(range->first + content.size() - 1) + '/' + std::to_string(size));
+    response->write(SimpleWeb::StatusCode::success_partial_content, content, headers);
+  }
+
+  // The lines written meanwhile are sent this often, an idle stream gets a comment every so often to keep it open
+  constexpr auto log_stream_interval = 250ms;
+  constexpr auto log_stream_keepalive = 15s;
+
+  // Each stream holds a connection of the server open
+  constexpr int max_log_streams = 4;
+  std::atomic<int> log_streams {0};
+
+  /**
+   * @brief A client following the log, fed from the lines kept in memory.
+   */
+  class log_stream_t: public std::enable_shared_from_this<log_stream_t> {
+  public:
+    log_stream_t(SimpleWeb::io_context &io_context, resp_https_t response, std::uint64_t last_sequence):
+        timer {io_context},
+        response {std::move(response)},
+        last_sequence {last_sequence} {
+    }
+
+    ~log_stream_t() {
+      --log_streams;
+    }
+
+    /**
+     * @brief Send the lines written since the last ones sent, then wait for more.
+     * @details The stream ends when sending fails, once the client is gone or the server stops.
+     */
+    void send_lines() {
+      auto now = std::chrono::steady_clock::now();
+
+      auto lines = logging::recent_log_lines(last_sequence);
+      if (!lines.empty()) {
+        for (auto &line : lines) {
+          std::string_view text = line.text;
+          if (text.ends_with('\r')) {
+            text.remove_suffix(1);
+          }
+          *response << "id: "sv << line.sequence << "\ndata: "sv << text << "\n\n"sv;
+        }
+        last_sequence = lines.back().sequence;
+      } else if (now - last_sent < log_stream_keepalive) {
+        wait();
+        return;
+      } else {
+        *response << ": keepalive\n\n"sv;
+      }
+
+      last_sent = now;
+      response->send([self = shared_from_this()](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          self->wait();
+        }
+      });
+    }
+
+  private:
+    void wait() {
+      timer.expires_after(log_stream_interval);
+      timer.async_wait([self = shared_from_this()](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          self->send_lines();
+        }
+      });
+    }
+
+    SimpleWeb::asio::steady_timer timer;
+    resp_https_t response;
+    std::uint64_t last_sequence;
+    std::chrono::steady_clock::time_point last_sent {};
+  };
+
+  /**
+   * @brief Stream the lines of the log as they're written, as server-sent events.
+   * @param io_context The context of the server, the stream runs on it.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * Each event holds a line, with its sequence number as the event ID. The lines kept in memory
+   * are sent first, or only those after the `Last-Event-ID` a reconnecting client sends.
+   * @code{.txt}
+   * id: 42
+   * data: [2024-01-01 12:00:00.000]: Info: Sunshine version: 0.0.0
+   * @endcode
+   *
+   * @api_examples{/api/logs/stream| GET| null}
+   */
+  void getLogStream(const std::shared_ptr<SimpleWeb::io_context> &io_context, resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    if (++log_streams > max_log_streams) {
+      --log_streams;
+      response->write(SimpleWeb::StatusCode::server_error_service_unavailable, "Too many log streams");
+      return;
+    }
+
+    std::uint64_t last_sequence = 0;
+    if (auto last_event_id = request->header.find("Last-Event-ID"); last_event_id != request->header.end()) {
+      auto &id = last_event_id->second;
+      std::from_chars(id.data(), id.data() + id.size(), last_sequence);
+    }
+
+    *response << "HTTP/1.1 200 OK\r\n"
+              << "Content-Type: text/event-stream\r\n"
+              << "Cache-Control: no-cache\r\n"
+              << "X-Frame-Options: DENY\r\n"
+              << "Content-Security-Policy: frame-ancestors 'none';\r\n"
+              << "\r\n";
+
+    auto stream = std::make_shared<log_stream_t>(*io_context, std::move(response), last_sequence);
+    stream->send_lines();
+  }
+
+  // The stats are sent at a fixed rate, the rates and averages are over the time since the previous event
+  constexpr auto stats_stream_interval = 1s;
+
+  constexpr int max_stats_streams = 4;
+  std::atomic<int> stats_streams {0};
+
+  /**
+   * @brief A client watching the stats of the streaming sessions, read from the metrics.
+   */
+  class stats_stream_t: public std::enable_shared_from_this<stats_stream_t> {
+  public:
+    stats_stream_t(SimpleWeb::io_context &io_context, resp_https_t response):
+        timer {io_context},
+        response {std::move(response)} {
+    }
+
+    ~stats_stream_t() {
+      --stats_streams;
+    }
+
+    /**
+     * @brief Send the stats since the previous event, then wait for the next one.
+     * @details The stream ends when sending fails, once the client is gone or the server stops.
+     */
+    void send_stats() {
+      auto now = std::chrono::steady_clock::now();
+      auto seconds = std::chrono::duration<double>(now - last_read).count();
+
+      nlohmann::json sessions = nlohmann::json::object();
+      nlohmann::json pipeline = nlohmann::json::object();
+
+      // Only the series of a session, and the ones without labels, have a place in the event
+      std::map<std::string, metrics::sample_t> samples;
+      for (auto &sample : metrics::snapshot()) {
+        const std::string *session = nullptr;
+        if (sample.labels.size() == 1 && sample.labels.front().first == "session"sv) {
+          session = &sample.labels.front().second;
+        } else if (!sample.labels.empty()) {
+          continue;
+        }
+
+        auto key = sample.name + ' ' + (session ? *session : ""s);
+
+        // The counters and the averages need a previous read, they are null in the first event
+        nlohmann::json value;
+        auto previous = last_samples.find(key);
+        if (sample.type == metrics::type_e::gauge) {
+          value = sample.value;
+        } else if (previous != std::end(last_samples)) {
+          auto &last = previous->second;
+          if (sample.type == metrics::type_e::counter) {
+            value = (sample.value - last.value) / seconds;
+          } else if (sample.count > last.count) {
+            value = (sample.value - last.value) / (double) (sample.count - last.count);
+          }
+        }
+
+        (session ? sessions[*session] : pipeline)[stat_name(sample)] = std::move(value);
+        samples.emplace(std::move(key), std::move(sample));
+      }
+      last_samples = std::move(samples);
+      last_read = now;
+
+      for (auto &snapshot : input_latency::snapshot()) {
+        auto &stats = sessions[std::to_string(snapshot.session_id)];
+        for (std::size_t type = 0; type < snapshot.histograms.size(); ++type) {
+          auto &histogram = snapshot.histograms[type];
+          if (!histogram.count()) {
+            continue;
+          }
+
+          nlohmann::json type_tree;
+          type_tree["p50_us"] = histogram.percentile(50);
+          type_tree["p99_us"] = histogram.percentile(99);
+          stats["input_latency"][input_latency::type_name((input_latency::type_e) type)] = type_tree;
+        }
+      }
+
+      nlohmann::json session_list = nlohmann::json::array();
+      for (auto &[id, stats] : sessions.items()) {
+        std::uint32_t session_id;
+        if (std::from_chars(id.data(), id.data() + id.size(), session_id).ec != std::errc {}) {
+          continue;
+        }
+
+        stats["session_id"] = session_id;
+        session_list.push_back(std::move(stats));
+      }
+
+      nlohmann::json event;
+      event["sessions"] = std::move(session_list);
+      event["pipeline"] = std::move(pipeline);
+      *response << "data: "sv << event.dump() << "\n\n"sv;
+
+      response->send([self = shared_from_this()](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          self->wait();
+        }
+      });
+    }
+
+  private:
+    /**
+     * @brief Name a stat after its metric, without the prefix, and after what is sent of it.
+     * @details `sunshine_video_frames_sent_total` becomes `video_frames_sent_per_second`,
+     *          `sunshine_video_encode_seconds` becomes `video_encode_seconds_mean`.
+     */
+    static std::string stat_name(const metrics::sample_t &sample) {
+      std::string_view name = sample.name;
+      if (name.starts_with("sunshine_"sv)) {
+        name.remove_prefix("sunshine_"sv.size());
+      }
+
+      switch (sample.type) {
+        case metrics::type_e::counter:
+          if (name.ends_with("_total"sv)) {
+            name.remove_suffix("_total"sv.size());
+          }
+          return std::string {name} + "_per_second";
+        case metrics::type_e::histogram:
+        case metrics::type_e::summary:
+          return std::string {name} + "_mean";
+        default:
+          return std::string {name};
+      }
+    }
+
+    void wait() {
+      timer.expires_after(stats_stream_interval);
+      timer.async_wait([self = shared_from_this()](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+          self->send_stats();
+        }
+      });
+    }
+
+    SimpleWeb::asio::steady_timer timer;
+    resp_https_t response;
+    std::map<std::string, metrics::sample_t> last_samples;
+    std::chrono::steady_clock::time_point last_read {};
+  };
+
+  /**
+   * @brief Stream the stats of the streaming sessions once a second, as server-sent events.
+   * @param io_context The context of the server, the stream runs on it.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The stats come from the metrics of the sessions and of the parts of the pipeline they share,
+   * named without their `sunshine_` prefix. The counters are sent as a rate per second and the
+   * summaries as the average of their values, over the second since the previous event.
+   * The input latency in microseconds is over the whole session, like in `/api/input-latency`.
+   * @code{.txt}
+   * data: {"sessions":[{"session_id":1,"video_frames_sent_per_second":60.0,"video_bytes_sent_per_second":2500000.0,"video_frames_lost_per_second":0.0,"video_fec_percentage":20.0,"input_latency":{"mouse":{"p50_us":60,"p99_us":480}}}],"pipeline":{"video_encode_seconds_mean":0.0032,"video_fec_block_seconds_mean":0.0002,"video_frame_send_seconds_mean":0.0011}}
+   * @endcode
+   *
+   * @api_examples{/api/stats/stream| GET| null}
+   */
+  void getStatsStream(const std::shared_ptr<SimpleWeb::io_context> &io_context, resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    if (++stats_streams > max_stats_streams) {
+      --stats_streams;
+      response->write(SimpleWeb::StatusCode::server_error_service_unavailable, "Too many stats streams");
+      return;
+    }
+
+    *response << "HTTP/1.1 200 OK\r\n"
+              << "Content-Type: text/event-stream\r\n"
+              << "Cache-Control: no-cache\r\n"
+              << "X-Frame-Options: DENY\r\n"
+              << "Content-Security-Policy: frame-ancestors 'none';\r\n"
+              << "\r\n";
+
+    auto stream = std::make_shared<stats_stream_t>(*io_context, std::move(response));
+    stream->send_stats();
+  }
+
+  /**
+   * @brief Get the latency trace of the most recently streamed video frames.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * Each trace holds the time in microseconds from the capture of the frame until the end of
+   * each stage, or null if it's unknown. `tx_timestamp` is true if `last_sent_us` was reported
+   * by the kernel when the packet left the host, rather than when sending it returned.
+   * The frame size, type, average QP and the time the encoder spent on it are reported by the
+   * encoder, the QP and encode duration are null if it doesn't tell.
+   * @code{.json}
+   * {
+   *   "traces": [
+   *     {
+   *       "session_id": 1,
+   *       "frame_index": 42,
+   *       "convert_us": 850,
+   *       "encode_us": 3200,
+   *       "fec_us": 3450,
+   *       "first_sent_us": 3500,
+   *       "last_sent_us": 4100,
+   *       "tx_timestamp": true,
+   *       "frame_bytes": 41250,
+   *       "frame_type": "p",
+   *       "qp": 24,
+   *       "encode_duration_us": 2100
+   *     }
+   *   ],
+   *   "status": true
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/frame-traces| GET| null}
+   */
+  void getFrameTraces(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    nlohmann::json traces = nlohmann::json::array();
+    for (auto &trace : frame_trace::snapshot()) {
+      auto since_capture = [&trace](const std::optional<frame_trace::time_point> &time) -> nlohmann::json {
+        if (!trace.capture || !time) {
+          return nullptr;
+        }
+
+        return std::chrono::duration_cast<std::chrono::microseconds>(*time - *trace.capture).count();
+      };
+
+      nlohmann::json trace_tree;
+      trace_tree["session_id"] = trace.session_id;
+      trace_tree["frame_index"] = trace.frame_index;
+      trace_tree["convert_us"] = since_capture(trace.convert);
+      trace_tree["encode_us"] = since_capture(trace.encode);
+      trace_tree["fec_us"] = since_capture(trace.fec);
+      trace_tree["first_sent_us"] = since_capture(trace.first_sent);
+      trace_tree["last_sent_us"] = since_capture(trace.last_sent);
+      trace_tree["tx_timestamp"] = trace.tx_timestamp;
+      trace_tree["frame_bytes"] = trace.frame_bytes;
+      trace_tree["frame_type"] = trace.frame_type;
+      trace_tree["qp"] = trace.qp ? nlohmann::json(*trace.qp) : nlohmann::json(nullptr);
+      trace_tree["encode_duration_us"] = trace.encode_duration ? nlohmann::json(std::chrono::duration_cast<std::chrono::microseconds>(*trace.encode_duration).count()) : nlohmann::json(nullptr);
+      traces.push_back(trace_tree);
+    }
+
+    nlohmann::json output_tree;
+    output_tree["traces"] = traces;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the utilization of the images the display is captured into.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * `in_use` counts the images held by the capture backend or the encoders, `limit` is the most
+   * images allocated at once. All values are zero while nothing is captured.
+   * @code{.json}
+   * {
+   *   "allocated": 5,
+   *   "in_use": 3,
+   *   "limit": 5,
+   *   "image_bytes": 33177600,
+   *   "status": true
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/capture-pool| GET| null}
+   */
+  void getCapturePool(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto stats = video::capture_pool_stats();
+
+    nlohmann::json output_tree;
+    output_tree["allocated"] = stats.allocated;
+    output_tree["in_use"] = stats.in_use;
+    output_tree["limit"] = stats.limit;
+    output_tree["image_bytes"] = stats.image_bytes;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the counters of the queues the encoded packets wait in before they're sent.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * `dropped` counts the packets lost because the sending thread fell behind, `size` is the number
+   * of packets waiting. A queue is missing while nothing is streamed.
+   * @code{.json}
+   * {
+   *   "queues": {
+   *     "video": {"max_elements": 8, "overflow": "clear", "dropped": 0, "size": 1},
+   *     "audio": {"max_elements": 16, "overflow": "drop_oldest", "dropped": 3, "size": 0}
+   *   },
+   *   "status": true
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/packet-queues| GET| null}
+   */
+  void getPacketQueues(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    auto overflow_name = [](safe::overflow_e overflow) {
+      switch (overflow) {
+        case safe::overflow_e::clear:
+          return "clear";
+        case safe::overflow_e::drop_oldest:
+          return "drop_oldest";
+        case safe::overflow_e::drop_newest:
+          return "drop_newest";
+        case safe::overflow_e::block:
+          return "block";
+      }
+
+      return "unknown";
+    };
+
+    nlohmann::json queues = nlohmann::json::object();
+    for (auto [name, id] : {std::pair {"video", mail::video_packets}, std::pair {"audio", mail::audio_packets}}) {
+      if (auto stats = mail::man->queue_stats(id)) {
+        queues[name] = {
+          {"max_elements", stats->options.max_elements},
+          {"overflow", overflow_name(stats->options.overflow)},
+          {"dropped", stats->dropped},
+          {"size", stats->size},
+        };
+      }
+    }
+
+    nlohmann::json output_tree;
+    output_tree["queues"] = std::move(queues);
+    output_tree["status"] = true;
+    send_response(response, output_tree);
+  }
+
+  /**
+   * @brief Get the metrics of the streaming pipeline in the Prometheus text format.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The series of a session carry its id in the `session` label and disappear when it ends.
+   * The scraper has to use the credentials of the Web UI.
+   * @code{.txt}
+   * # HELP sunshine_video_frames_sent_total Video frames sent
+   * # TYPE sunshine_video_frames_sent_total counter
+   * sunshine_video_frames_sent_total{session="1"} 3600
+   * @endcode
+   *
+   * @api_examples{/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, metrics::render(), headers);
+  }
+
+  /**
+   * @brief Get the timeline of the pipeline stages recorded since the recording started.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The timeline is in the Chrome trace event format, it can be opened in Perfetto or `chrome://tracing`.
+   * Each thread keeps its most recent events. The events about a frame carry its index.
+   * @code{.json}
+   * {
+   *   "traceEvents": [
+   *     {"name": "thread_name", "ph": "M", "pid": 1, "tid": 3, "args": {"name": "video_send"}},
+   *     {"name": "send_batch", "cat": "pipeline", "ph": "X", "pid": 1, "tid": 3, "ts": 5843210.5, "dur": 41.2, "args": {"frame": 42}}
+   *   ],
+   *   "displayTimeUnit": "ms"
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/timeline| GET| null}
+   */
+  void getTimeline(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "application/json");
+    headers.emplace("Content-Disposition", "attachment; filename=\"sunshine_timeline.json\"");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, timeline::dump(), headers);
+  }
+
+  /**
+   * @brief Start or stop recording the timeline of the pipeline stages.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * Starting drops the events recorded before. The body for the post request should be JSON serialized in the following format:
+   * @code{.json}
+   * {
+   *   "recording": true
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/timeline| POST| {"recording":true}}
+   */
+  void saveTimeline(resp_https_t response, req_https_t request) {
+    if (!check_content_type(response, request, "application/json")) {
+      return;
+    }
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    std::stringstream ss;
+    ss << request->content.rdbuf();
+    try {
+      nlohmann::json input_tree = nlohmann::json::parse(ss);
+      timeline::set_recording(input_tree.at("recording").get<bool>());
+
+      nlohmann::json output_tree;
+      output_tree["recording"] = timeline::is_recording();
+      output_tree["status"] = true;
+      send_response(response, output_tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "SaveTimeline: "sv << e.what();
+      bad_request(response, request, e.what());
+    }
+  }
+
+  /**
+   * @brief Get the input latency of the active streaming sessions.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The latency is the time in microseconds from the receipt of an input message on the control
+   * stream until it's sent to the OS, for each type of input. Percentiles are the highest value
+   * of the histogram bucket they fall in, within 12.5% of the recorded latency.
+   * @code{.json}
+   * {
+   *   "sessions": [
+   *     {
+   *       "session_id": 1,
+   *       "types": {
+   *         "mouse": {"count": 5200, "p50_us": 60, "p90_us": 120, "p99_us": 480, "max_us": 950}
+   *       }
+   *     }
+   *   ],
+   *   "status": true
+   * }
+   * @endcode
+   *
+   * @api_examples{/api/input-latency| GET| null}
+   */
+  void getInputLatency(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    nlohmann::json sessions = nlohmann::json::array();
+    for (auto &snapshot : input_latency::snapshot()) {
+      nlohmann::json types = nlohmann::json::object();
+      for (std::size_t type = 0; type < snapshot.histograms.size(); ++type) {
+        auto &histogram = snapshot.histograms[type];
+        if (!histogram.count()) {
+          continue;
+        }
+
+        nlohmann::json type_tree;
+        type_tree["count"] = histogram.count();
+        type_tree["p50_us"] = histogram.percentile(50);
+        type_tree["p90_us"] = histogram.percentile(90);
+        type_tree["p99_us"] = histogram.percentile(99);
+        type_tree["max_us"] = histogram.max();
+        types[input_latency::type_name((input_latency::type_e) type)] = type_tree;
+      }
+
+      nlohmann::json session_tree;
+      session_tree["session_id"] = snapshot.session_id;
+      session_tree["types"] = types;
+      sessions.push_back(session_tree);
+    }
+
+    nlohmann::json output_tree;
+    output_tree["sessions"] = sessions;
+    output_tree["status"] = true;
+    send_response(response, output_tree);
   }
 
   /**
@@ -1177,6 +1856,23 @@ namespace confighttp {
     auto port_https = net::map_port(PORT_HTTPS);
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
+    // The packet queues are only read when the metrics are scraped
+    std::vector<std::shared_ptr<void>> queue_metrics;
+    for (auto [name, id] : {std::pair {"video", mail::video_packets}, std::pair {"audio", mail::audio_packets}}) {
+      metrics::labels_t labels {{"queue", name}};
+      queue_metrics.emplace_back(metrics::gauge_probe("sunshine_packet_queue_size", "Packets waiting to be sent", labels, [id]() {
+        auto stats = mail::man->queue_stats(id);
+        return stats ? (double) stats->size : 0.;
+      }));
+      queue_metrics.emplace_back(metrics::counter_probe("sunshine_packet_queue_dropped_total", "Packets dropped because the sending thread fell behind", labels, [id]() {
+        auto stats = mail::man->queue_stats(id);
+        return stats ? (double) stats->dropped : 0.;
+      }));
+    }
+    queue_metrics.emplace_back(metrics::counter_probe("sunshine_log_records_dropped_total", "Log records dropped because the log fell behind", {}, []() {
+      return (double) logging::dropped_records.load(std::memory_order_relaxed);
+    }));
+
     https_server_t server {config::nvhttp.cert, config::nvhttp.pkey};
     server.default_resource["DELETE"] = [](resp_https_t response, req_https_t request) {
       bad_request(response, request);
@@ -1202,6 +1898,19 @@ namespace confighttp {
     server.resource["^/api/pin$"]["POST"] = savePin;
     server.resource["^/api/apps$"]["GET"] = getApps;
     server.resource["^/api/logs$"]["GET"] = getLogs;
+    server.resource["^/api/logs/stream$"]["GET"] = [&server](resp_https_t response, req_https_t request) {
+      getLogStream(server.io_service, std::move(response), std::move(request));
+    };
+    server.resource["^/api/stats/stream$"]["GET"] = [&server](resp_https_t response, req_https_t request) {
+      getStatsStream(server.io_service, std::move(response), std::move(request));
+    };
+    server.resource["^/api/frame-traces$"]["GET"] = getFrameTraces;
+    server.resource["^/api/capture-pool$"]["GET"] = getCapturePool;
+    server.resource["^/api/input-latency$"]["GET"] = getInputLatency;
+    server.resource["^/api/packet-queues$"]["GET"] = getPacketQueues;
+    server.resource["^/api/timeline$"]["GET"] = getTimeline;
+    server.resource["^/api/timeline$"]["POST"] = saveTimeline;
+    server.resource["^/metrics$"]["GET"] = getMetrics;
     server.resource["^/api/apps$"]["POST"] = saveApp;
     server.resource["^/api/config$"]["GET"] = getConfig;
     server.resource["^/api/config$"]["POST"] = saveConfig;
@@ -1218,9 +1927,13 @@ namespace confighttp {
     server.resource["^/images/sunshine.ico$"]["GET"] = getFaviconImage;
     server.resource["^/images/logo-sunshine-45.png$"]["GET"] = getSunshineLogoImage;
     server.resource["^/assets\\/.+$"]["GET"] = getNodeModules;
+    auto assets = web_assets.load();
+    BOOST_LOG(debug) << "Loaded "sv << assets << " Web UI assets"sv;
+
     server.config.reuse_address = true;
     server.config.address = net::af_to_any_address_string(address_family);
     server.config.port = port_https;
+    server.config.thread_pool_size = config::nvhttp.threads;
 
     auto accept_and_run = [&](auto *server) {
       try {
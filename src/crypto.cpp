@@ -17,15 +17,57 @@ namespace crypto {
       _cert_ctx {X509_STORE_CTX_new()} {
   }
 
+  static std::string fingerprint(X509 *cert) {
+    if (!cert) {
+      return {};
+    }
+
+    std::string digest(EVP_MAX_MD_SIZE, '\0');
+
+    unsigned int size = 0;
+    if (!X509_digest(cert, EVP_sha256(), (unsigned char *) digest.data(), &size)) {
+      return {};
+    }
+
+    digest.resize(size);
+    return digest;
+  }
+
   void cert_chain_t::add(x509_t &&cert) {
+    if (auto digest = fingerprint(cert.get()); !digest.empty()) {
+      // A certificate is only stored once, however many times it's added
+      if (!_fingerprints.emplace(std::move(digest), _certs.size()).second) {
+        return;
+      }
+    }
+
     x509_store_t x509_store {X509_STORE_new()};
 
     X509_STORE_add_cert(x509_store.get(), cert.get());
     _certs.emplace_back(std::make_pair(std::move(cert), std::move(x509_store)));
   }
 
+  bool cert_chain_t::remove(x509_t::element_type *cert) {
+    auto it = _fingerprints.find(fingerprint(cert));
+    if (it == std::end(_fingerprints)) {
+      return false;
+    }
+
+    // The last certificate takes the place of the removed one
+    auto index = it->second;
+    _fingerprints.erase(it);
+    if (index != _certs.size() - 1) {
+      std::swap(_certs[index], _certs.back());
+      _fingerprints.insert_or_assign(fingerprint(_certs[index].first.get()), index);
+    }
+    _certs.pop_back();
+
+    return true;
+  }
+
   void cert_chain_t::clear() {
     _certs.clear();
+    _fingerprints.clear();
   }
 
   static int openssl_verify_cb(int ok, X509_STORE_CTX *ctx) {
@@ -57,28 +99,21 @@ namespace crypto {
    * @return nullptr if the certificate is valid, otherwise an error string.
    */
   const char *cert_chain_t::verify(x509_t::element_type *cert) {
-    int err_code = 0;
-    for (auto &[_, x509_store] : _certs) {
-      auto fg = util::fail_guard([this]() {
-        X509_STORE_CTX_cleanup(_cert_ctx.get());
-      });
+    // A paired client presents the certificate it was paired with, which only needs to be checked against its own store
+    if (auto it = _fingerprints.find(fingerprint(cert)); it != std::end(_fingerprints)) {
+      auto err_code = verify(_certs[it->second].second.get(), cert);
 
-      X509_STORE_CTX_init(_cert_ctx.get(), x509_store.get(), cert, nullptr);
-      X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
-
-      // We don't care to validate the entire chain for the purposes of client auth.
-      // Some versions of clients forked from Moonlight Embedded produce client certs
-      // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
-      X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
+      return err_code == X509_V_OK ? nullptr : X509_verify_cert_error_string(err_code);
+    }
 
-      auto err = X509_verify_cert(_cert_ctx.get());
+    int err_code = 0;
+    for (auto &[_, x509_store] : _certs) {
+      err_code = verify(x509_store.get(), cert);
 
-      if (err == 1) {
+      if (err_code == X509_V_OK) {
         return nullptr;
       }
 
-      err_code = X509_STORE_CTX_get_error(_cert_ctx.get());
-
       if (err_code != X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT && err_code != X509_V_ERR_INVALID_CA) {
         return X509_verify_cert_error_string(err_code);
       }
@@ -87,6 +122,33 @@ namespace crypto {
     return X509_verify_cert_error_string(err_code);
   }
 
+  /**
+   * @brief Verify a certificate against the store of a single paired certificate.
+   * @param x509_store The store.
+   * @param cert The certificate to verify.
+   * @return X509_V_OK if the certificate is valid, otherwise the error code.
+   */
+  int cert_chain_t::verify(X509_STORE *x509_store, x509_t::element_type *cert) {
+    auto fg = util::fail_guard([this]() {
+      X509_STORE_CTX_cleanup(_cert_ctx.get());
+    });
+
+    X509_STORE_CTX_init(_cert_ctx.get(), x509_store, cert, nullptr);
+    X509_STORE_CTX_set_verify_cb(_cert_ctx.get(), openssl_verify_cb);
+
+    // We don't care to validate the entire chain for the purposes of client auth.
+    // Some versions of clients forked from Moonlight Embedded produce client certs
+    // that OpenSSL doesn't detect as self-signed due to some X509v3 extensions.
+    X509_STORE_CTX_set_flags(_cert_ctx.get(), X509_V_FLAG_PARTIAL_CHAIN);
+
+    if (X509_verify_cert(_cert_ctx.get()) == 1) {
+      return X509_V_OK;
+    }
+
+    auto err_code = X509_STORE_CTX_get_error(_cert_ctx.get());
+    return err_code == X509_V_OK ? X509_V_ERR_UNSPECIFIED : err_code;
+  }
+
   namespace cipher {
 
     static int init_decrypt_gcm(cipher_ctx_t &ctx, aes_t *key, aes_t *iv, bool padding) {
@@ -146,6 +208,26 @@ namespace crypto {
     }
 
     int gcm_t::decrypt(const std::string_view &tagged_cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv) {
+      if (tagged_cipher.size() < tag_size) {
+        return -1;
+      }
+
+      plaintext.resize(round_to_pkcs7_padded(tagged_cipher.size() - tag_size));
+
+      auto plaintext_size = decrypt(tagged_cipher, plaintext.data(), iv);
+      if (plaintext_size < 0) {
+        return -1;
+      }
+
+      plaintext.resize(plaintext_size);
+      return 0;
+    }
+
+    int gcm_t::decrypt(const std::string_view &tagged_cipher, std::uint8_t *plaintext, aes_t *iv) {
+      if (tagged_cipher.size() < tag_size) {
+        return -1;
+      }
+
       if (!decrypt_ctx && init_decrypt_gcm(decrypt_ctx, &key, iv, padding)) {
         return -1;
       }
@@ -153,17 +235,15 @@ namespace crypto {
       // Calling with cipher == nullptr results in a parameter change
       // without requiring a reallocation of the internal cipher ctx.
       if (EVP_DecryptInit_ex(decrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
-        return false;
+        return -1;
       }
 
       auto cipher = tagged_cipher.substr(tag_size);
       auto tag = tagged_cipher.substr(0, tag_size);
 
-      plaintext.resize(round_to_pkcs7_padded(cipher.size()));
-
       int update_outlen, final_outlen;
 
-      if (EVP_DecryptUpdate(decrypt_ctx.get(), plaintext.data(), &update_outlen, (const std::uint8_t *) cipher.data(), cipher.size()) != 1) {
+      if (EVP_DecryptUpdate(decrypt_ctx.get(), plaintext, &update_outlen, (const std::uint8_t *) cipher.data(), cipher.size()) != 1) {
         return -1;
       }
 
@@ -171,12 +251,11 @@ namespace crypto {
         return -1;
       }
 
-      if (EVP_DecryptFinal_ex(decrypt_ctx.get(), plaintext.data() + update_outlen, &final_outlen) != 1) {
+      if (EVP_DecryptFinal_ex(decrypt_ctx.get(), plaintext + update_outlen, &final_outlen) != 1) {
         return -1;
       }
 
-      plaintext.resize(update_outlen + final_outlen);
-      return 0;
+      return update_outlen + final_outlen;
     }
 
     /**
@@ -185,33 +264,61 @@ namespace crypto {
      * The resulting ciphertext and the GCM tag are written into the tagged_cipher buffer.
      */
     int gcm_t::encrypt(const std::string_view &plaintext, std::uint8_t *tag, std::uint8_t *ciphertext, aes_t *iv) {
-      if (!encrypt_ctx && init_encrypt_gcm(encrypt_ctx, &key, iv, padding)) {
-        return -1;
-      }
+      return encrypt(plaintext, std::string_view {}, tag, ciphertext, nullptr, iv);
+    }
 
-      // Calling with cipher == nullptr results in a parameter change
-      // without requiring a reallocation of the internal cipher ctx.
-      if (EVP_EncryptInit_ex(encrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
+    int gcm_t::encrypt(const std::string_view &plaintext_1, const std::string_view &plaintext_2, std::uint8_t *tag, std::uint8_t *ciphertext_1, std::uint8_t *ciphertext_2, aes_t *iv) {
+      batch_entry_t entry {plaintext_1, plaintext_2, ciphertext_1, ciphertext_2, tag, iv->data()};
+      if (encrypt(&entry, 1, iv->size())) {
         return -1;
       }
 
-      int update_outlen, final_outlen;
+      // GCM is a stream mode, so the ciphertext is exactly as long as the plaintext
+      return plaintext_1.size() + plaintext_2.size();
+    }
 
-      // Encrypt into the caller's buffer
-      if (EVP_EncryptUpdate(encrypt_ctx.get(), ciphertext, &update_outlen, (const std::uint8_t *) plaintext.data(), plaintext.size()) != 1) {
-        return -1;
+    int gcm_t::encrypt(const batch_entry_t *entries, std::size_t count, std::size_t iv_size) {
+      if (!count) {
+        return 0;
       }
 
-      // GCM encryption won't ever fill ciphertext here but we have to call it anyway
-      if (EVP_EncryptFinal_ex(encrypt_ctx.get(), ciphertext + update_outlen, &final_outlen) != 1) {
-        return -1;
+      if (!encrypt_ctx) {
+        aes_t iv {entries[0].iv, entries[0].iv + iv_size};
+        if (init_encrypt_gcm(encrypt_ctx, &key, &iv, padding)) {
+          return -1;
+        }
       }
 
-      if (EVP_CIPHER_CTX_ctrl(encrypt_ctx.get(), EVP_CTRL_GCM_GET_TAG, tag_size, tag) != 1) {
-        return -1;
+      auto ctx = encrypt_ctx.get();
+      for (std::size_t x = 0; x < count; ++x) {
+        auto &entry = entries[x];
+
+        // Only the IV changes, so the key schedule is kept
+        if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, entry.iv) != 1) {
+          return -1;
+        }
+
+        int update_outlen_1, update_outlen_2, final_outlen;
+        if (EVP_EncryptUpdate(ctx, entry.ciphertext_1, &update_outlen_1, (const std::uint8_t *) entry.plaintext_1.data(), entry.plaintext_1.size()) != 1) {
+          return -1;
+        }
+
+        if (!entry.plaintext_2.empty() &&
+            EVP_EncryptUpdate(ctx, entry.ciphertext_2, &update_outlen_2, (const std::uint8_t *) entry.plaintext_2.data(), entry.plaintext_2.size()) != 1) {
+          return -1;
+        }
+
+        // GCM encryption won't ever fill ciphertext here but we have to call it anyway
+        if (EVP_EncryptFinal_ex(ctx, entry.ciphertext_1 + update_outlen_1, &final_outlen) != 1) {
+          return -1;
+        }
+
+        if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag_size, entry.tag) != 1) {
+          return -1;
+        }
       }
 
-      return update_outlen + final_outlen;
+      return 0;
     }
 
     int gcm_t::encrypt(const std::string_view &plaintext, std::uint8_t *tagged_cipher, aes_t *iv) {
@@ -280,14 +387,19 @@ namespace crypto {
      * The resulting ciphertext is written into the cipher buffer.
      */
     int cbc_t::encrypt(const std::string_view &plaintext, std::uint8_t *cipher, aes_t *iv) {
-      if (!encrypt_ctx && init_encrypt_cbc(encrypt_ctx, &key, iv, padding)) {
-        return -1;
-      }
-
-      // Calling with cipher == nullptr results in a parameter change
-      // without requiring a reallocation of the internal cipher ctx.
-      if (EVP_EncryptInit_ex(encrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
-        return false;
+      if (!encrypt_ctx) {
+        // The context is set up with the IV of the first message
+        if (init_encrypt_cbc(encrypt_ctx, &key, iv, padding)) {
+          encrypt_ctx.reset();
+          return -1;
+        }
+      } else {
+        // Calling with cipher == nullptr results in a parameter change
+        // without requiring a reallocation of the internal cipher ctx.
+        // The key schedule is kept, only the IV of the message is set.
+        if (EVP_EncryptInit_ex(encrypt_ctx.get(), nullptr, nullptr, nullptr, iv->data()) != 1) {
+          return -1;
+        }
       }
 
       int update_outlen, final_outlen;
@@ -6,6 +6,7 @@
 
 // standard includes
 #include <array>
+#include <unordered_map>
 
 // lib includes
 #include <openssl/evp.h>
@@ -66,20 +67,33 @@ namespace crypto {
 
     void add(x509_t &&cert);
 
+    /**
+     * @brief Remove a certificate.
+     * @param cert The certificate, compared by its fingerprint.
+     * @return `true` if it was in the chain.
+     */
+    bool remove(x509_t::element_type *cert);
+
     void clear();
 
     const char *verify(x509_t::element_type *cert);
 
   private:
+    int verify(X509_STORE *x509_store, x509_t::element_type *cert);
+
     std::vector<std::pair<x509_t, x509_store_t>> _certs;
+
+    // The index in _certs of each certificate, by the SHA-256 of its DER encoding
+    std::unordered_map<std::string, std::size_t> _fingerprints;
     x509_store_ctx_t _cert_ctx;
   };
 
   namespace cipher {
     constexpr std::size_t tag_size = 16;
 
+    // PKCS #7 always pads, a whole block is added to a plaintext that is a multiple of the block size
     constexpr std::size_t round_to_pkcs7_padded(std::size_t size) {
-      return ((size + 15) / 16) * 16;
+      return (size / 16 + 1) * 16;
     }
 
     class cipher_t {
@@ -122,6 +136,43 @@ namespace crypto {
        */
       int encrypt(const std::string_view &plaintext, std::uint8_t *tag, std::uint8_t *ciphertext, aes_t *iv);
 
+      /**
+       * @brief Encrypts a plaintext split across two buffers using AES GCM mode.
+       * @details The result is the same as encrypting the concatenation of both parts,
+       *          without having to gather them into a single buffer first.
+       * @param plaintext_1 The first part of the plaintext.
+       * @param plaintext_2 The second part of the plaintext.
+       * @param tag The buffer where the GCM tag will be written.
+       * @param ciphertext_1 The buffer where the ciphertext of the first part will be written.
+       * @param ciphertext_2 The buffer where the ciphertext of the second part will be written.
+       * @param iv The initialization vector to be used for the encryption.
+       * @return The total length of the ciphertext. Returns -1 in case of an error.
+       */
+      int encrypt(const std::string_view &plaintext_1, const std::string_view &plaintext_2, std::uint8_t *tag, std::uint8_t *ciphertext_1, std::uint8_t *ciphertext_2, aes_t *iv);
+
+      /**
+       * @brief A plaintext of a batch, split across two buffers like above.
+       */
+      struct batch_entry_t {
+        std::string_view plaintext_1;
+        std::string_view plaintext_2;
+        std::uint8_t *ciphertext_1;
+        std::uint8_t *ciphertext_2;
+        std::uint8_t *tag;
+        const std::uint8_t *iv;  ///< The IV, which must be as long as the IVs used before with this cipher
+      };
+
+      /**
+       * @brief Encrypts a batch of plaintexts using AES GCM mode, each with its own IV.
+       * @details The cipher context and its key schedule are set up once for the batch,
+       *          only the IV is changed between the entries.
+       * @param entries The entries to encrypt.
+       * @param count The number of entries.
+       * @param iv_size The size of each IV.
+       * @return 0 on success. Returns -1 in case of an error.
+       */
+      int encrypt(const batch_entry_t *entries, std::size_t count, std::size_t iv_size);
+
       /**
        * @brief Encrypts the plaintext using AES GCM mode.
        * length of cipher must be at least: round_to_pkcs7_padded(plaintext.size()) + crypto::cipher::tag_size
@@ -133,6 +184,16 @@ namespace crypto {
       int encrypt(const std::string_view &plaintext, std::uint8_t *tagged_cipher, aes_t *iv);
 
       int decrypt(const std::string_view &cipher, std::vector<std::uint8_t> &plaintext, aes_t *iv);
+
+      /**
+       * @brief Decrypts the ciphertext using AES GCM mode, into a buffer of the caller.
+       * length of plaintext must be at least: round_to_pkcs7_padded(tagged_cipher.size() - crypto::cipher::tag_size)
+       * @param tagged_cipher The GCM tag followed by the ciphertext.
+       * @param plaintext The buffer where the resulting plaintext will be written.
+       * @param iv The initialization vector to be used for the decryption.
+       * @return The length of the plaintext written into plaintext. Returns -1 in case of an error.
+       */
+      int decrypt(const std::string_view &tagged_cipher, std::uint8_t *plaintext, aes_t *iv);
     };
 
     class cbc_t: public cipher_t {
@@ -12,13 +12,17 @@
 #include <display_device/json.h>
 #include <display_device/retry_scheduler.h>
 #include <display_device/settings_manager_interface.h>
+#include <atomic>
+#include <map>
 #include <mutex>
+#include <optional>
 #include <regex>
 
 // local includes
 #include "audio.h"
 #include "platform/common.h"
 #include "rtsp.h"
+#include "utility.h"
 
 // platform-specific includes
 #ifdef _WIN32
@@ -38,8 +42,29 @@ namespace display_device {
       std::mutex mutex {};
       std::chrono::milliseconds config_revert_delay {0};
       std::unique_ptr<RetryScheduler<SettingsManagerInterface>> sm_instance {nullptr};
+
+      // Bumped whenever the topology may have changed, the scheduled tasks bump it without taking the mutex
+      std::atomic<std::uint64_t> topology_generation {0};
+
+      // The topology as of topology_cache_generation, enumerating it is slow enough to matter on the launch path
+      std::uint64_t topology_cache_generation {0};
+      std::optional<EnumeratedDeviceList> devices {};
+      std::map<std::string, std::string> display_names {};
     } DD_DATA;
 
+    /**
+     * @brief Drop the cached topology if it may have changed since it was cached.
+     * @note This is function does not lock mutex.
+     */
+    void validate_topology_cache_unlocked() {
+      const auto generation {DD_DATA.topology_generation.load(std::memory_order_acquire)};
+      if (generation != DD_DATA.topology_cache_generation) {
+        DD_DATA.devices.reset();
+        DD_DATA.display_names.clear();
+        DD_DATA.topology_cache_generation = generation;
+      }
+    }
+
     /**
      * @brief Helper class for capturing audio context when the API demands it.
      *
@@ -649,13 +674,22 @@ namespace display_device {
       }
 
       // Note: by default the executor function is immediately executed in the calling thread. With delay, we want to avoid that.
+      // The revert at the end of a session always runs in the background, even without a delay,
+      // so the session doesn't wait on it and a new launch replaces it if it didn't run yet.
       SchedulerOptions scheduler_option {.m_sleep_durations = {DEFAULT_RETRY_INTERVAL}};
-      if (option == revert_option_e::try_indefinitely_with_delay && DD_DATA.config_revert_delay > std::chrono::milliseconds::zero()) {
-        scheduler_option.m_sleep_durations = {DD_DATA.config_revert_delay, DEFAULT_RETRY_INTERVAL};
+      if (option == revert_option_e::try_indefinitely_with_delay) {
+        // The scheduler doesn't accept a zero duration
+        const auto delay {std::max(DD_DATA.config_revert_delay, std::chrono::milliseconds {1})};
+        scheduler_option.m_sleep_durations = {delay, DEFAULT_RETRY_INTERVAL};
         scheduler_option.m_execution = SchedulerOptions::Execution::ScheduledOnly;
       }
 
       DD_DATA.sm_instance->schedule([try_once = (option == revert_option_e::try_once), tried_out_devices = std::set<std::string> {}](auto &settings_iface, auto &stop_token) mutable {
+        // Whatever the outcome, the displays may have changed
+        auto invalidate_guard = util::fail_guard([]() {
+          invalidate_topology();
+        });
+
         if (try_once) {
           std::ignore = settings_iface.revertSettings();
           stop_token.requestStop();
@@ -752,9 +786,17 @@ namespace display_device {
       return output_name;
     }
 
-    return DD_DATA.sm_instance->execute([&output_name](auto &settings_iface) {
+    validate_topology_cache_unlocked();
+    if (const auto it {DD_DATA.display_names.find(output_name)}; it != std::end(DD_DATA.display_names)) {
+      return it->second;
+    }
+
+    auto display_name {DD_DATA.sm_instance->execute([&output_name](auto &settings_iface) {
       return settings_iface.getDisplayName(output_name);
-    });
+    })};
+    DD_DATA.display_names.emplace(output_name, display_name);
+
+    return display_name;
   }
 
   void configure_display(const config::video_t &video_config, const rtsp_stream::launch_session_t &session) {
@@ -781,6 +823,10 @@ namespace display_device {
     }
 
     DD_DATA.sm_instance->schedule([config](auto &settings_iface, auto &stop_token) {
+      auto invalidate_guard = util::fail_guard([]() {
+        invalidate_topology();
+      });
+
       // We only want to keep retrying in case of a transient errors.
       // In other cases, when we either fail or succeed we just want to stop...
       if (settings_iface.applySettings(config) != SettingsManagerInterface::ApplyResult::ApiTemporarilyUnavailable) {
@@ -806,6 +852,7 @@ namespace display_device {
       // Whatever the outcome is we want to stop interfering with the user,
       // so any schedulers need to be stopped.
       stop_token.requestStop();
+      invalidate_topology();
       return settings_iface.resetPersistence();
     });
   }
@@ -817,9 +864,18 @@ namespace display_device {
       return {};
     }
 
-    return DD_DATA.sm_instance->execute([](auto &settings_iface) {
-      return settings_iface.enumAvailableDevices();
-    });
+    validate_topology_cache_unlocked();
+    if (!DD_DATA.devices) {
+      DD_DATA.devices = DD_DATA.sm_instance->execute([](auto &settings_iface) {
+        return settings_iface.enumAvailableDevices();
+      });
+    }
+
+    return *DD_DATA.devices;
+  }
+
+  void invalidate_topology() {
+    DD_DATA.topology_generation.fetch_add(1, std::memory_order_release);
   }
 
   std::variant<failed_to_parse_tag_t, configuration_disabled_tag_t, SingleDisplayConfiguration> parse_configuration(const config::video_t &video_config, const rtsp_stream::launch_session_t &session) {
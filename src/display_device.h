@@ -130,6 +130,19 @@ namespace display_device {
    */
   [[nodiscard]] EnumeratedDeviceList enumerate_devices();
 
+  /**
+   * @brief Drop the cached display topology, so it's enumerated again when next needed.
+   *
+   * The topology is cached from the first enumeration, and dropped whenever a configuration
+   * is applied or reverted. This is called when the OS notifies of a display change.
+   * It doesn't lock anything, so it may be called from any thread.
+   *
+   * @examples
+   * invalidate_topology();
+   * @examples_end
+   */
+  void invalidate_topology();
+
   /**
    * @brief A tag structure indicating that configuration parsing has failed.
    */
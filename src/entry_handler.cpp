@@ -3,19 +3,27 @@
  * @brief Definitions for entry handling functions.
  */
 // standard includes
+#include <algorithm>
+#include <charconv>
 #include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <thread>
 
 // local includes
+#include "capture_latency.h"
 #include "config.h"
 #include "confighttp.h"
 #include "entry_handler.h"
 #include "globals.h"
 #include "httpcommon.h"
+#include "input.h"
+#include "input_capture.h"
 #include "logging.h"
 #include "network.h"
 #include "platform/common.h"
+#include "video.h"
 
 extern "C" {
 #ifdef _WIN32
@@ -36,6 +44,85 @@ void launch_ui_with_path(std::string path) {
 }
 
 namespace args {
+  int benchmark_encoders(const char *name, int argc, char *argv[]) {
+    int frames = 300;
+    if (argc > 0) {
+      if (argv[0] == "help"sv) {
+        return help(name);
+      }
+
+      auto end = argv[0] + std::strlen(argv[0]);
+      auto [ptr, ec] = std::from_chars(argv[0], end, frames);
+      if (ec != std::errc {} || ptr != end || frames <= 0) {
+        BOOST_LOG(fatal) << "Invalid number of frames: "sv << argv[0];
+        return 1;
+      }
+    }
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(fatal) << "Platform failed to initialize"sv;
+      return 1;
+    }
+
+    return video::benchmark_encoders(frames) ? 1 : 0;
+  }
+
+  int capture_latency(const char *name, int argc, char *argv[]) {
+    int values[] {10, 60};
+    for (int x = 0; x < std::min(argc, 2); ++x) {
+      if (argv[x] == "help"sv) {
+        return help(name);
+      }
+
+      auto end = argv[x] + std::strlen(argv[x]);
+      auto [ptr, ec] = std::from_chars(argv[x], end, values[x]);
+      if (ec != std::errc {} || ptr != end || values[x] <= 0) {
+        BOOST_LOG(fatal) << "Invalid "sv << (x == 0 ? "duration"sv : "frame rate"sv) << ": "sv << argv[x];
+        return 1;
+      }
+    }
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(fatal) << "Platform failed to initialize"sv;
+      return 1;
+    }
+
+    return capture_latency::measure(std::chrono::seconds {values[0]}, values[1]) ? 1 : 0;
+  }
+
+  int replay_input(const char *name, int argc, char *argv[]) {
+    if (argc < 1 || argv[0] == "help"sv) {
+      return help(name);
+    }
+
+    double speed = 1.0;
+    if (argc > 1) {
+      // std::from_chars() has no overload for floating point numbers in every standard library yet
+      char *end;
+      speed = std::strtod(argv[1], &end);
+      if (end == argv[1] || *end || !(speed >= 0 && speed <= 10)) {
+        BOOST_LOG(fatal) << "Invalid speed: "sv << argv[1];
+        return 1;
+      }
+    }
+
+    auto platf_deinit_guard = platf::init();
+    if (!platf_deinit_guard) {
+      BOOST_LOG(fatal) << "Platform failed to initialize"sv;
+      return 1;
+    }
+
+    auto input_deinit_guard = input::init();
+    if (!input_deinit_guard) {
+      BOOST_LOG(fatal) << "Input failed to initialize"sv;
+      return 1;
+    }
+
+    return input_capture::measure(argv[0], speed) ? 1 : 0;
+  }
+
   int creds(const char *name, int argc, char *argv[]) {
     if (argc < 2 || argv[0] == "help"sv || argv[1] == "help"sv) {
       help(name);
@@ -32,6 +32,40 @@ void launch_ui_with_path(std::string path);
  * @brief Functions for handling command line arguments.
  */
 namespace args {
+  /**
+   * @brief Measure the encode latency and throughput of the available encoders, then exit.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments, optionally the number of frames encoded by each run.
+   * @examples
+   * benchmark_encoders("sunshine", 1, {"600"});
+   * @examples_end
+   */
+  int benchmark_encoders(const char *name, int argc, char *argv[]);
+
+  /**
+   * @brief Measure the latency of capturing the display showing the test pattern, then exit.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments, optionally the seconds to capture for and the frame rate to capture at.
+   * @examples
+   * capture_latency("sunshine", 2, {"30", "120"});
+   * @examples_end
+   */
+  int capture_latency(const char *name, int argc, char *argv[]);
+
+  /**
+   * @brief Replay the input messages recorded by the `input_capture` option into the OS, measure their injection, then exit.
+   * @param name The name of the program.
+   * @param argc The number of arguments.
+   * @param argv The arguments, the capture file and optionally the factor the original timing is sped up by,
+   *             up to 10, 0 to send the messages without waiting.
+   * @examples
+   * replay_input("sunshine", 2, {"/tmp/sunshine-input.bin", "4"});
+   * @examples_end
+   */
+  int replay_input(const char *name, int argc, char *argv[]);
+
   /**
    * @brief Reset the user credentials.
    * @param name The name of the program.
@@ -0,0 +1,64 @@
+/**
+ * @file src/fec_policy.cpp
+ * @brief Definitions for the per-session FEC policy of the video stream.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "fec_policy.h"
+#include "logging.h"
+
+using namespace std::literals;
+
+namespace fec_policy {
+  controller_t::controller_t() {
+    reset(20, 20, 20);
+  }
+
+  void controller_t::reset(int initial, int min, int max) {
+    _min = min;
+    _max = std::max(min, max);
+    _clean_reports = 0;
+
+    _percentage.store(std::clamp(initial, _min, _max), std::memory_order_relaxed);
+  }
+
+  void controller_t::report_loss(std::int64_t lost_frames) {
+    if (lost_frames > 0) {
+      raise_by(LOSS_INCREASE);
+
+      return;
+    }
+
+    if (++_clean_reports < CLEAN_REPORTS_BEFORE_DECREASE) {
+      return;
+    }
+    _clean_reports = 0;
+
+    auto percentage = _percentage.load(std::memory_order_relaxed);
+    _percentage.store(std::max(percentage - DECREASE, _min), std::memory_order_relaxed);
+  }
+
+  void controller_t::report_invalidation() {
+    raise_by(INVALIDATION_INCREASE);
+  }
+
+  int controller_t::percentage() const {
+    return _percentage.load(std::memory_order_relaxed);
+  }
+
+  void controller_t::raise_by(int points) {
+    _clean_reports = 0;
+
+    auto percentage = _percentage.load(std::memory_order_relaxed);
+    auto new_percentage = std::min(percentage + points, _max);
+    if (new_percentage == percentage) {
+      return;
+    }
+
+    _percentage.store(new_percentage, std::memory_order_relaxed);
+
+    BOOST_LOG(debug) << "Raising FEC percentage to "sv << new_percentage << '%';
+  }
+}  // namespace fec_policy
@@ -0,0 +1,72 @@
+/**
+ * @file src/fec_policy.h
+ * @brief Declarations for the per-session FEC policy of the video stream.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+
+namespace fec_policy {
+  /**
+   * @brief The percentage of parity shards sent with each video frame of a session.
+   * @details The percentage is kept between configured bounds. It's raised when the client
+   *          reports lost frames or has to ask for reference frames to be invalidated, and
+   *          lowered again after the client went a while without reporting any loss.
+   *
+   *          Reports arrive on the control stream thread and the percentage is read by the
+   *          thread sending the video, so it's kept in an atomic.
+   */
+  class controller_t {
+  public:
+    /// The points the percentage is raised by after a report of lost frames
+    static constexpr int LOSS_INCREASE = 10;
+
+    /// The points the percentage is raised by after a request to invalidate reference frames
+    static constexpr int INVALIDATION_INCREASE = 5;
+
+    /// The number of consecutive reports without lost frames before the percentage is lowered
+    static constexpr int CLEAN_REPORTS_BEFORE_DECREASE = 20;
+
+    /// The points the percentage is lowered by after enough reports without lost frames
+    static constexpr int DECREASE = 1;
+
+    controller_t();
+
+    /**
+     * @brief Set the bounds of the percentage and start adapting from an initial one.
+     * @param initial The percentage to start from, clamped to the bounds.
+     * @param min The lowest percentage.
+     * @param max The highest percentage, the percentage stays fixed when it's not above `min`.
+     */
+    void reset(int initial, int min, int max);
+
+    /**
+     * @brief Adapt the percentage to a loss report from the client.
+     * @param lost_frames The number of frames lost since the last report.
+     */
+    void report_loss(std::int64_t lost_frames);
+
+    /**
+     * @brief Adapt the percentage to a request from the client to invalidate reference frames.
+     */
+    void report_invalidation();
+
+    /**
+     * @brief Get the current percentage.
+     * @return The percentage of parity shards per data shard.
+     */
+    int percentage() const;
+
+  private:
+    void raise_by(int points);
+
+    std::atomic<int> _percentage;
+    int _min;
+    int _max;
+
+    // Only accessed on the control stream thread
+    int _clean_reports;
+  };
+}  // namespace fec_policy
@@ -12,6 +12,8 @@
 #include "logging.h"
 
 namespace file_handler {
+  using namespace std::literals;
+
   std::string get_parent_directory(const std::string &path) {
     // remove any trailing path separators
     std::string trimmed_path = path;
@@ -42,6 +44,24 @@ namespace file_handler {
     return std::string {(std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()};
   }
 
+  std::string read_file_range(const char *path, std::uint64_t offset, std::uint64_t length) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+      BOOST_LOG(debug) << "Missing file: " << path;
+      return {};
+    }
+
+    in.seekg((std::streamoff) offset);
+    if (!in) {
+      return {};
+    }
+
+    std::string contents(length, '\0');
+    in.read(contents.data(), (std::streamsize) length);
+    contents.resize(in.gcount());
+    return contents;
+  }
+
   int write_file(const char *path, const std::string_view &contents) {
     std::ofstream out(path);
 
@@ -53,4 +73,34 @@ namespace file_handler {
 
     return 0;
   }
+
+  int write_file_atomic(const char *path, const std::string_view &contents) {
+    auto temp_path = std::string {path} + ".tmp";
+
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      if (!out.is_open()) {
+        return -1;
+      }
+
+      out << contents;
+      out.close();
+
+      if (out.fail()) {
+        BOOST_LOG(error) << "Couldn't write "sv << temp_path;
+        std::filesystem::remove(temp_path);
+        return -1;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+      BOOST_LOG(error) << "Couldn't replace "sv << path << ": "sv << ec.message();
+      std::filesystem::remove(temp_path, ec);
+      return -1;
+    }
+
+    return 0;
+  }
 }  // namespace file_handler
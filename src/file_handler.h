@@ -5,6 +5,7 @@
 #pragma once
 
 // standard includes
+#include <cstdint>
 #include <string>
 
 /**
@@ -41,6 +42,18 @@ namespace file_handler {
    */
   std::string read_file(const char *path);
 
+  /**
+   * @brief Read a part of a file to string.
+   * @param path The path of the file.
+   * @param offset The first byte to read.
+   * @param length The number of bytes to read at most.
+   * @return The bytes read, fewer if the file ends before.
+   * @examples
+   * std::string tail = read_file_range("path/to/file", 4096, 1024);
+   * @examples_end
+   */
+  std::string read_file_range(const char *path, std::uint64_t offset, std::uint64_t length);
+
   /**
    * @brief Writes a file.
    * @param path The path of the file.
@@ -51,4 +64,16 @@ namespace file_handler {
    * @examples_end
    */
   int write_file(const char *path, const std::string_view &contents);
+
+  /**
+   * @brief Replace a file in one step, so it's never left partially written.
+   * @details The contents are written to a temporary file next to it, which is then renamed over the file.
+   * @param path The path of the file.
+   * @param contents The contents to write.
+   * @return ``0`` on success, ``-1`` on failure.
+   * @examples
+   * int write_status = write_file_atomic("path/to/file", "file contents");
+   * @examples_end
+   */
+  int write_file_atomic(const char *path, const std::string_view &contents);
 }  // namespace file_handler
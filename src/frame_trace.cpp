@@ -0,0 +1,96 @@
+/**
+ * @file src/frame_trace.cpp
+ * @brief Definitions for the per-frame latency trace.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <utility>
+
+// local includes
+#include "frame_trace.h"
+
+namespace frame_trace {
+  namespace {
+    std::mutex traces_lock;
+    std::array<trace_t, MAX_TRACES> traces;
+
+    // The total number of traces recorded, the next one goes to traces[count % MAX_TRACES]
+    std::size_t count = 0;
+
+    // Transmit timestamps reported before the trace of their frame was recorded
+    std::array<std::optional<std::pair<std::uint32_t, time_point>>, 16> early_tx;
+    std::size_t early_tx_count = 0;
+  }  // namespace
+
+  void record(const trace_t &trace) {
+    std::lock_guard lg {traces_lock};
+
+    auto &recorded = traces[count++ % MAX_TRACES];
+    recorded = trace;
+
+    if (!recorded.tx_id) {
+      return;
+    }
+
+    for (auto &tx : early_tx) {
+      if (tx && tx->first == *recorded.tx_id) {
+        recorded.last_sent = tx->second;
+        recorded.tx_timestamp = true;
+        tx.reset();
+
+        return;
+      }
+    }
+  }
+
+  std::vector<trace_t> snapshot() {
+    std::lock_guard lg {traces_lock};
+
+    auto size = std::min(count, MAX_TRACES);
+
+    std::vector<trace_t> result;
+    result.reserve(size);
+    for (auto x = count - size; x < count; ++x) {
+      result.push_back(traces[x % MAX_TRACES]);
+    }
+
+    return result;
+  }
+
+  tx_ids_t::tx_ids_t(std::uint32_t base):
+      _base {base} {
+  }
+
+  std::optional<std::uint32_t> tx_ids_t::send(const std::function<bool()> &send) {
+    std::lock_guard lg {_lock};
+
+    if (!send()) {
+      return std::nullopt;
+    }
+
+    return _base + _next_id++;
+  }
+
+  std::uint32_t tx_ids_t::base() const {
+    return _base;
+  }
+
+  void tx_complete(std::uint32_t tx_id, time_point sent) {
+    std::lock_guard lg {traces_lock};
+
+    // The timestamp arrives shortly after the frame was sent, so look at the newest traces first
+    auto size = std::min(count, MAX_TRACES);
+    for (auto x = count; x > count - size; --x) {
+      auto &trace = traces[(x - 1) % MAX_TRACES];
+      if (trace.tx_id == tx_id) {
+        trace.last_sent = sent;
+        trace.tx_timestamp = true;
+
+        return;
+      }
+    }
+
+    early_tx[early_tx_count++ % early_tx.size()] = std::make_pair(tx_id, sent);
+  }
+}  // namespace frame_trace
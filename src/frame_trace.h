@@ -0,0 +1,98 @@
+/**
+ * @file src/frame_trace.h
+ * @brief Declarations for the per-frame latency trace.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace frame_trace {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /// The number of most recent frames kept
+  constexpr std::size_t MAX_TRACES = 512;
+
+  /**
+   * @brief The time each stage of the pipeline finished with a video frame.
+   */
+  struct trace_t {
+    std::uint32_t session_id;
+    std::int64_t frame_index;
+
+    std::optional<time_point> capture;
+    std::optional<time_point> convert;
+    std::optional<time_point> encode;
+    std::optional<time_point> fec;
+    std::optional<time_point> first_sent;
+    std::optional<time_point> last_sent;
+
+    /// last_sent was reported by the kernel when the packet left the host
+    bool tx_timestamp;
+
+    /// The transmit timestamp id of the last packet, if one was requested
+    std::optional<std::uint32_t> tx_id;
+
+    /// What the encoder produced, to tell the frames that stalled the sending apart
+    std::size_t frame_bytes;
+    std::string_view frame_type;
+    std::optional<int> qp;
+    std::optional<std::chrono::steady_clock::duration> encode_duration;
+  };
+
+  /**
+   * @brief Add the trace of a frame, replacing the oldest one once the ring is full.
+   * @param trace The trace.
+   */
+  void record(const trace_t &trace);
+
+  /**
+   * @brief Get the traces of the most recent frames, oldest first.
+   * @return The traces.
+   */
+  std::vector<trace_t> snapshot();
+
+  /**
+   * @brief Assigns ids to the packets transmit timestamps are requested for.
+   * @details The kernel numbers the timestamped packets of a socket in the order they're
+   *          sent, so sending such a packet and taking its id happen under one lock.
+   */
+  class tx_ids_t {
+  public:
+    /**
+     * @param base Added to the ids the kernel gives the packets, so those of several sockets don't collide.
+     */
+    explicit tx_ids_t(std::uint32_t base = 0);
+
+    /**
+     * @brief Send a timestamped packet and take its id.
+     * @param send Sends the packet, returns `true` on success.
+     * @return The id of the packet, or `std::nullopt` if it couldn't be sent.
+     */
+    std::optional<std::uint32_t> send(const std::function<bool()> &send);
+
+    /**
+     * @return The base added to the ids the kernel gives the packets.
+     */
+    std::uint32_t base() const;
+
+  private:
+    std::mutex _lock;
+    std::uint32_t _base;
+    std::uint32_t _next_id {0};
+  };
+
+  /**
+   * @brief Record the time the kernel reported for a timestamped packet.
+   * @param tx_id The id of the packet.
+   * @param sent The time the packet left the host.
+   */
+  void tx_complete(std::uint32_t tx_id, time_point sent);
+}  // namespace frame_trace
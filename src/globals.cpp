@@ -7,8 +7,20 @@
 
 safe::mail_t mail::man;
 thread_pool_util::ThreadPool task_pool;
+thread_pool_util::ThreadPool input_pool;
+thread_pool_util::ThreadPool background_pool;
 bool display_cursor = true;
 
 #ifdef _WIN32
 nvprefs::nvprefs_interface nvprefs_instance;
 #endif
+
+safe::mail_raw_t::options_t mail::queue_options() {
+  safe::mail_raw_t::options_t options {};
+
+  // A lost video frame breaks the ones after it until the client recovers, so all stale frames go at once
+  options[video_packets] = {8, safe::overflow_e::clear};
+  options[audio_packets] = {16, safe::overflow_e::drop_oldest};
+
+  return options;
+}
@@ -9,10 +9,22 @@
 #include "thread_pool.h"
 
 /**
- * @brief A thread pool for processing tasks.
+ * @brief The thread of the timers, like the key repeats and the watchdogs of the shutdown.
+ * @details Its tasks should be short, the next timer waits for them.
  */
 extern thread_pool_util::ThreadPool task_pool;
 
+/**
+ * @brief The thread sending input to the OS outside of the input threads of the sessions.
+ * @details A single thread, so the input is sent in the order it was posted.
+ */
+extern thread_pool_util::ThreadPool input_pool;
+
+/**
+ * @brief The threads of the tasks that may block for a while, so they hold up neither the input nor the timers.
+ */
+extern thread_pool_util::ThreadPool background_pool;
+
 /**
  * @brief A boolean flag to indicate whether the cursor should be displayed.
  */
@@ -32,29 +44,43 @@ extern nvprefs::nvprefs_interface nvprefs_instance;
  * @brief Handles process-wide communication.
  */
 namespace mail {
-#define MAIL(x) \
-  constexpr auto x = std::string_view { \
-    #x \
-  }
-
   /**
    * @brief A process-wide communication mechanism.
    */
   extern safe::mail_t man;
 
-  // Global mail
-  MAIL(shutdown);
-  MAIL(broadcast_shutdown);
-  MAIL(video_packets);
-  MAIL(audio_packets);
-  MAIL(switch_display);
-
-  // Local mail
-  MAIL(touch_port);
-  MAIL(idr);
-  MAIL(invalidate_ref_frames);
-  MAIL(gamepad_feedback);
-  MAIL(hdr);
-#undef MAIL
+  /**
+   * @brief The ids of the posts of a mail.
+   */
+  enum id_e : std::size_t {
+    // Global mail
+    shutdown,
+    broadcast_shutdown,
+    video_packets,
+    audio_packets,
+
+    // Local mail
+    touch_port,
+    idr,
+    invalidate_ref_frames,
+    bitrate,
+    audio_loss,
+    gamepad_feedback,
+    hdr,
+    switch_display,
+    capture_display,
+
+    MAX_IDS  ///< The number of ids
+  };
+
+  static_assert(MAX_IDS <= safe::mail_raw_t::MAX_POSTS, "mail posts are indexed by their id");
+
+  /**
+   * @brief Get the options of the queues of the process-wide mail.
+   * @details The packet queues stay short, so a consumer that falls behind loses its oldest
+   *          packets rather than adding latency.
+   * @return The options, indexed by the id of the queue.
+   */
+  safe::mail_raw_t::options_t queue_options();
 
 }  // namespace mail
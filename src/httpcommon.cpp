@@ -5,7 +5,9 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <charconv>
 #include <filesystem>
+#include <sstream>
 #include <utility>
 
 // lib includes
@@ -43,21 +45,31 @@ namespace http {
   std::string unique_id;
   net::net_e origin_web_ui_allowed;
 
-  int init() {
-    bool clean_slate = config::sunshine.flags[config::flag::FRESH_STATE];
-    origin_web_ui_allowed = net::from_enum_string(config::nvhttp.origin_web_ui_allowed);
-
-    if (clean_slate) {
+  int init_creds() {
+    if (config::sunshine.flags[config::flag::FRESH_STATE]) {
       unique_id = uuid_util::uuid_t::generate().string();
-      auto dir = std::filesystem::temp_directory_path() / "Sunshine"sv;
-      config::nvhttp.cert = (dir / ("cert-"s + unique_id)).string();
-      config::nvhttp.pkey = (dir / ("pkey-"s + unique_id)).string();
+
+      // Credentials provisioned beforehand, like through a mounted secret, spare generating new ones on every start
+      if (fs::exists(config::nvhttp.pkey) && fs::exists(config::nvhttp.cert)) {
+        BOOST_LOG(info) << "Using the provisioned credentials ["sv << config::nvhttp.cert << ']';
+      } else {
+        auto dir = std::filesystem::temp_directory_path() / "Sunshine"sv;
+        config::nvhttp.cert = (dir / ("cert-"s + unique_id)).string();
+        config::nvhttp.pkey = (dir / ("pkey-"s + unique_id)).string();
+      }
     }
 
     if ((!fs::exists(config::nvhttp.pkey) || !fs::exists(config::nvhttp.cert)) &&
         create_creds(config::nvhttp.pkey, config::nvhttp.cert)) {
       return -1;
     }
+
+    return 0;
+  }
+
+  int init() {
+    origin_web_ui_allowed = net::from_enum_string(config::nvhttp.origin_web_ui_allowed);
+
     if (!user_creds_exist(config::sunshine.credentials_file)) {
       BOOST_LOG(info) << "Open the Web UI to set your new username and password and getting started";
     } else if (reload_user_creds(config::sunshine.credentials_file)) {
@@ -82,13 +94,20 @@ namespace http {
     outputTree.put("username", username);
     outputTree.put("salt", salt);
     outputTree.put("password", util::hex(crypto::hash(password + salt)).to_string());
+    // The credentials may share their file with the paired devices, so it's replaced in one step
+    std::ostringstream out;
     try {
-      pt::write_json(file, outputTree);
+      pt::write_json(out, outputTree);
     } catch (std::exception &e) {
       BOOST_LOG(error) << "error writing to the credentials file, perhaps try this again as an administrator? Details: "sv << e.what();
       return -1;
     }
 
+    if (file_handler::write_file_atomic(file.c_str(), out.str())) {
+      BOOST_LOG(error) << "error writing to the credentials file, perhaps try this again as an administrator?"sv;
+      return -1;
+    }
+
     BOOST_LOG(info) << "New credentials have been created"sv;
     return 0;
   }
@@ -232,4 +251,55 @@ namespace http {
     curl_url_cleanup(curlu);
     return result;
   }
+
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> parse_byte_range(std::string_view range, std::uint64_t size) {
+    constexpr auto unit = "bytes="sv;
+    if (!range.starts_with(unit)) {
+      return std::nullopt;
+    }
+    range.remove_prefix(unit.size());
+
+    auto dash = range.find('-');
+    if (dash == std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    auto parse = [](std::string_view digits) -> std::optional<std::uint64_t> {
+      std::uint64_t value;
+      auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+      if (digits.empty() || ec != std::errc {} || end != digits.data() + digits.size()) {
+        return std::nullopt;
+      }
+      return value;
+    };
+
+    auto first_digits = range.substr(0, dash);
+    auto last_digits = range.substr(dash + 1);
+    if (first_digits.empty()) {
+      // The last bytes of the resource
+      auto suffix = parse(last_digits);
+      if (!suffix || !*suffix || !size) {
+        return std::nullopt;
+      }
+
+      auto length = std::min(*suffix, size);
+      return std::pair {size - length, length};
+    }
+
+    auto first = parse(first_digits);
+    if (!first || *first >= size) {
+      return std::nullopt;
+    }
+
+    auto last = size - 1;
+    if (!last_digits.empty()) {
+      auto requested_last = parse(last_digits);
+      if (!requested_last || *requested_last < *first) {
+        return std::nullopt;
+      }
+      last = std::min(*requested_last, last);
+    }
+
+    return std::pair {*first, last - *first + 1};
+  }
 }  // namespace http
@@ -4,6 +4,12 @@
  */
 #pragma once
 
+// standard includes
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
 // lib includes
 #include <curl/curl.h>
 
@@ -13,6 +19,13 @@
 
 namespace http {
 
+  /**
+   * @brief Create the credentials of the host if they don't exist yet.
+   * @details Generating a key takes a while, so this may run while the rest of Sunshine starts.
+   *          With a fresh state, the configured credentials are still used if they were provisioned beforehand.
+   * @return `0` on success, `-1` on failure.
+   */
+  int init_creds();
   int init();
   int create_creds(const std::string &pkey, const std::string &cert);
   int save_user_creds(
@@ -27,6 +40,15 @@ namespace http {
   std::string url_escape(const std::string &url);
   std::string url_get_host(const std::string &url);
 
+  /**
+   * @brief Parse the value of a Range header naming a single byte range.
+   * @param range The value, like `bytes=0-499`, `bytes=500-` or `bytes=-500` for the last 500 bytes.
+   * @param size The size of the resource.
+   * @return The first byte and the number of bytes clipped to the resource,
+   *         std::nullopt if the value is malformed, names several ranges or none within the resource.
+   */
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> parse_byte_range(std::string_view range, std::uint64_t size);
+
   extern std::string unique_id;
   extern net::net_e origin_web_ui_allowed;
 
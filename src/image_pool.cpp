@@ -0,0 +1,126 @@
+/**
+ * @file src/image_pool.cpp
+ * @brief Definitions for the pool of captured images.
+ */
+// standard includes
+#include <algorithm>
+#include <vector>
+
+// local includes
+#include "image_pool.h"
+#include "platform/common.h"
+
+namespace image_pool {
+  std::size_t pool_t::state_t::limit() const {
+    auto limit = std::min(BACKEND_IMAGES + IMAGES_PER_CONSUMER * std::max<std::size_t>(consumers, 1), MAX_IMAGES);
+    if (budget_bytes && image_bytes) {
+      limit = std::min(limit, budget_bytes / image_bytes);
+    }
+
+    // Capturing needs an image besides the backend's, whatever the budget
+    return std::max(limit, BACKEND_IMAGES + 1);
+  }
+
+  pool_t::pool_t():
+      _state {std::make_shared<state_t>()} {
+  }
+
+  void pool_t::reset(alloc_t alloc, std::size_t image_bytes, std::size_t budget_bytes) {
+    std::deque<std::pair<std::shared_ptr<platf::img_t>, time_point>> unused;
+    {
+      std::lock_guard lg {_state->lock};
+
+      unused = std::move(_state->free);
+      _state->free.clear();
+
+      ++_state->generation;
+      _state->alloc = std::move(alloc);
+      _state->allocated = 0;
+      _state->image_bytes = image_bytes;
+      _state->budget_bytes = budget_bytes;
+    }
+  }
+
+  void pool_t::clear() {
+    reset(nullptr, 0, 0);
+  }
+
+  void pool_t::set_consumers(std::size_t consumers) {
+    std::lock_guard lg {_state->lock};
+
+    _state->consumers = consumers;
+  }
+
+  std::shared_ptr<platf::img_t> pool_t::acquire() {
+    std::shared_ptr<platf::img_t> img;
+    std::uint64_t generation;
+    alloc_t alloc;
+    {
+      std::lock_guard lg {_state->lock};
+
+      generation = _state->generation;
+      if (!_state->free.empty()) {
+        img = std::move(_state->free.back().first);
+        _state->free.pop_back();
+      } else if (!_state->alloc || _state->allocated >= _state->limit()) {
+        return nullptr;
+      } else {
+        alloc = _state->alloc;
+        ++_state->allocated;
+      }
+    }
+
+    if (!img) {
+      img = alloc();
+
+      if (!img) {
+        std::lock_guard lg {_state->lock};
+        if (_state->generation == generation) {
+          --_state->allocated;
+        }
+
+        return nullptr;
+      }
+    }
+
+    // The image returns to the pool when the last reference to it is dropped
+    auto img_p = img.get();
+    return std::shared_ptr<platf::img_t>(img_p, [state_wp = std::weak_ptr<state_t>(_state), img = std::move(img), generation](platf::img_t *) mutable {
+      auto state = state_wp.lock();
+      if (!state) {
+        return;
+      }
+
+      std::lock_guard lg {state->lock};
+      if (state->generation == generation) {
+        state->free.emplace_back(std::move(img), std::chrono::steady_clock::now());
+      }
+    });
+  }
+
+  void pool_t::trim(time_point now) {
+    std::vector<std::shared_ptr<platf::img_t>> unused;
+    {
+      std::lock_guard lg {_state->lock};
+
+      auto limit = _state->limit();
+      auto &free = _state->free;
+      while (!free.empty() && (now - free.front().second >= TRIM_TIMEOUT || _state->allocated > limit)) {
+        unused.emplace_back(std::move(free.front().first));
+        free.pop_front();
+        --_state->allocated;
+      }
+    }
+  }
+
+  stats_t pool_t::stats() const {
+    std::lock_guard lg {_state->lock};
+
+    return stats_t {
+      _state->allocated,
+      _state->allocated - _state->free.size(),
+      _state->limit(),
+      _state->image_bytes,
+    };
+  }
+}  // namespace image_pool
@@ -0,0 +1,127 @@
+/**
+ * @file src/image_pool.h
+ * @brief Declarations for the pool of captured images.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace platf {
+  struct img_t;
+}  // namespace platf
+
+namespace image_pool {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /**
+   * @brief The utilization of a pool.
+   */
+  struct stats_t {
+    /// The images allocated for the current display
+    std::size_t allocated;
+
+    /// The images held by the capture backend or the encoders
+    std::size_t in_use;
+
+    /// The most images the pool allocates at once
+    std::size_t limit;
+
+    /// The estimated size of each image
+    std::size_t image_bytes;
+  };
+
+  /**
+   * @brief Hands out the images the display is captured into.
+   * @details Images go back to the pool as soon as the last reference to them is dropped, so
+   *          taking and returning an image doesn't search the pool. The most recently returned
+   *          image is handed out first, images that stay unused for a while are freed.
+   *
+   *          The pool allocates enough images for the capture backend and each consumer of the
+   *          captured images, within the memory budget.
+   */
+  class pool_t {
+  public:
+    /// The most images a pool allocates
+    static constexpr std::size_t MAX_IMAGES = 12;
+
+    /// The images the capture backend holds: the one it captures into and the last one it captured
+    static constexpr std::size_t BACKEND_IMAGES = 2;
+
+    /// The images each consumer holds: the one waiting for it, the one it converts and a spare
+    static constexpr std::size_t IMAGES_PER_CONSUMER = 3;
+
+    /// The time an image stays unused before it's freed
+    static constexpr std::chrono::seconds TRIM_TIMEOUT {3};
+
+    using alloc_t = std::function<std::shared_ptr<platf::img_t>()>;
+
+    pool_t();
+
+    /**
+     * @brief Start handing out images of another display.
+     * @details Unused images are freed right away, the ones in use once they're returned.
+     * @param alloc Allocates an image of the display.
+     * @param image_bytes The estimated size of each image.
+     * @param budget_bytes The memory the images may take, 0 for no limit.
+     */
+    void reset(alloc_t alloc, std::size_t image_bytes, std::size_t budget_bytes);
+
+    /**
+     * @brief Free every unused image and stop allocating new ones.
+     */
+    void clear();
+
+    /**
+     * @brief Size the pool for a number of consumers of the captured images.
+     * @param consumers The number of consumers.
+     */
+    void set_consumers(std::size_t consumers);
+
+    /**
+     * @brief Take an image.
+     * @return The image, or `nullptr` if every image is in use or it couldn't be allocated.
+     */
+    std::shared_ptr<platf::img_t> acquire();
+
+    /**
+     * @brief Free the images that stayed unused for too long.
+     * @param now The current time.
+     */
+    void trim(time_point now = std::chrono::steady_clock::now());
+
+    /**
+     * @brief Get the utilization of the pool.
+     * @return The utilization.
+     */
+    stats_t stats() const;
+
+  private:
+    struct state_t {
+      mutable std::mutex lock;
+
+      // Unused images with the time they were returned, the least recently returned first
+      std::deque<std::pair<std::shared_ptr<platf::img_t>, time_point>> free;
+
+      // Images of older displays aren't returned to the pool
+      std::uint64_t generation {};
+
+      alloc_t alloc;
+      std::size_t allocated {};
+      std::size_t image_bytes {};
+      std::size_t budget_bytes {};
+      std::size_t consumers {1};
+
+      std::size_t limit() const;
+    };
+
+    std::shared_ptr<state_t> _state;
+  };
+}  // namespace image_pool
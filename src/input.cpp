@@ -9,11 +9,17 @@ extern "C" {
 }
 
 // standard includes
+#include <algorithm>
+#include <array>
 #include <bitset>
 #include <chrono>
 #include <cmath>
-#include <list>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 
 // lib includes
@@ -23,9 +29,12 @@ extern "C" {
 #include "config.h"
 #include "globals.h"
 #include "input.h"
+#include "input_latency.h"
 #include "logging.h"
 #include "platform/common.h"
+#include "thread_affinity.h"
 #include "thread_pool.h"
+#include "timeline.h"
 #include "utility.h"
 
 // Win32 WHEEL_DELTA constant
@@ -38,8 +47,6 @@ using namespace std::literals;
 namespace input {
 
   constexpr auto MAX_GAMEPADS = std::min((std::size_t) platf::MAX_GAMEPADS, sizeof(std::int16_t) * 8);
-#define DISABLE_LEFT_BUTTON_DELAY ((thread_pool_util::ThreadPool::task_id_t) 0x01)
-#define ENABLE_LEFT_BUTTON_DELAY nullptr
 
   constexpr auto VKEY_SHIFT = 0x10;
   constexpr auto VKEY_LSHIFT = 0xA0;
@@ -108,13 +115,28 @@ namespace input {
     return std::clamp(from_netfloat(f), min, max);
   }
 
-  static task_pool_util::TaskPool::task_id_t key_press_repeat_id {};
+  /**
+   * @brief The key being repeated, by the input thread of the session that pressed it.
+   */
+  struct key_repeat_t {
+    const void *owner;
+    std::chrono::steady_clock::time_point deadline;
+    std::uint16_t key_code;
+    std::uint8_t flags;
+    std::uint8_t synthetic_modifiers;
+  };
+
+  static std::optional<key_repeat_t> key_repeat;
   static std::unordered_map<key_press_id_t, bool> key_press {};
   static std::array<std::uint8_t, 5> mouse_press {};
 
   static platf::input_t platf_input;
   static std::bitset<platf::MAX_GAMEPADS> gamepadMask {};
 
+  // Serializes the input threads of the sessions, the input tasks of input_pool and the timers of task_pool,
+  // which share platf_input and the state of the keys, buttons and gamepads
+  static std::mutex dispatch_lock;
+
   void free_gamepad(platf::input_t &platf_input, int id) {
     platf::gamepad_update(platf_input, id, platf::gamepad_state_t {});
     platf::free_gamepad(platf_input, id);
@@ -122,6 +144,9 @@ namespace input {
     free_id(gamepadMask, id);
   }
 
+  // The motion of a gamepad is sent at most at 250 Hz, the report rate of the emulated DualShock 4 and DualSense
+  constexpr auto MOTION_REPORT_INTERVAL = 4ms;
+
   struct gamepad_t {
     gamepad_t():
         gamepad_state {},
@@ -132,7 +157,8 @@ namespace input {
 
     ~gamepad_t() {
       if (id >= 0) {
-        task_pool.push([id = this->id]() {
+        input_pool.post([id = this->id]() {
+          std::lock_guard lg {dispatch_lock};
           free_gamepad(platf_input, id);
         });
       }
@@ -150,6 +176,73 @@ namespace input {
     // Sunshine forces the button to be in a specific state until the gamepad state matches that of
     // Moonlight once more.
     button_state_e back_button_state;
+
+    // The latest accelerometer and gyroscope samples that aren't sent yet
+    std::optional<platf::gamepad_motion_t> pending_motion[2];
+    std::chrono::steady_clock::time_point next_motion_report;
+  };
+
+  // The input messages from the client are all small, so the queued ones are stored inline
+  constexpr std::size_t INPUT_RECORD_SIZE = 128;
+  constexpr std::size_t INPUT_QUEUE_CAPACITY = 512;
+
+  // Pasted text arrives in many small messages, the ones batched together are typed at once
+  constexpr std::size_t INPUT_BATCH_SIZE = 4096;
+
+  struct message_type_t;
+
+  /**
+   * @brief An input message waiting in the queue of a client.
+   */
+  struct input_record_t {
+    std::uint32_t size;
+
+    // Looked up once when the message is queued
+    const message_type_t *type;
+
+    // Set when the message was batched into an earlier one, it's skipped then
+    bool batched;
+
+    // When the control stream received the message
+    std::chrono::steady_clock::time_point received;
+
+    alignas(8) std::uint8_t data[INPUT_RECORD_SIZE];
+  };
+
+  /**
+   * @brief An input message taken off the queue, with the later messages batched into it.
+   */
+  struct input_batch_t {
+    const message_type_t *type;
+
+    // When the control stream received the oldest message
+    std::chrono::steady_clock::time_point received;
+
+    // Batched text grows past the size of a queued message
+    alignas(8) std::uint8_t data[INPUT_BATCH_SIZE];
+  };
+
+  /**
+   * @brief The conversion of touch and pen contacts to the touch port, computed when the touch port changes.
+   */
+  struct contact_transform_t {
+    // Per axis, normalized client coordinates are scaled, clamped to [min, max] and renormalized by factor
+    float scale[2];
+    float min[2];
+    float max[2];
+    float factor[2];
+
+    // The scale of an axis of the contact area at each angle in degrees
+    std::array<float, 360> area_scale;
+  };
+
+  /**
+   * @brief Whether the release of the left mouse button is delayed, see passthrough(PNV_MOUSE_BUTTON_PACKET).
+   */
+  enum class left_button_delay_e {
+    enabled,  ///< The last mouse coordinates were absolute
+    disabled,  ///< The last mouse coordinates were relative
+    pending,  ///< A release is delayed
   };
 
   struct input_t {
@@ -162,19 +255,36 @@ namespace input {
 
     input_t(
       safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event,
+      safe::mail_raw_t::event_t<int> switch_display_event,
       platf::feedback_queue_t feedback_queue
     ):
         shortcutFlags {},
         gamepads(MAX_GAMEPADS),
         client_context {platf::allocate_client_input_context(platf_input)},
         touch_port_event {std::move(touch_port_event)},
+        switch_display_event {std::move(switch_display_event)},
         feedback_queue {std::move(feedback_queue)},
-        mouse_left_button_timeout {},
+        input_queue(INPUT_QUEUE_CAPACITY),
+        dispatch_event {std::make_shared<safe::signal_t>()},
+        left_button_delay {left_button_delay_e::enabled},
         touch_port {{0, 0, 0, 0}, 0, 0, 1.0f},
         accumulated_vscroll_delta {},
         accumulated_hscroll_delta {} {
     }
 
+    ~input_t() {
+      dispatch_event->stop();
+
+      if (dispatch_thread.joinable()) {
+        // The input thread may hold the last reference
+        if (dispatch_thread.get_id() == std::this_thread::get_id()) {
+          dispatch_thread.detach();
+        } else {
+          dispatch_thread.join();
+        }
+      }
+    }
+
     // Keep track of alt+ctrl+shift key combo
     int shortcutFlags;
 
@@ -182,14 +292,37 @@ namespace input {
     std::unique_ptr<platf::client_input_t> client_context;
 
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_event;
+
+    // Switches the display the client's stream captures, leaving the other clients' streams alone
+    safe::mail_raw_t::event_t<int> switch_display_event;
+
     platf::feedback_queue_t feedback_queue;
 
-    std::list<std::vector<uint8_t>> input_queue;
+    // A ring of the messages waiting for the input thread, starting at input_queue_head
+    std::vector<input_record_t> input_queue;
+    std::size_t input_queue_head {};
+    std::size_t input_queue_count {};
     std::mutex input_queue_lock;
 
-    thread_pool_util::ThreadPool::task_id_t mouse_left_button_timeout;
+    // Wakes the thread sending the queued messages to the OS, shared with the thread
+    std::shared_ptr<safe::signal_t> dispatch_event;
+    std::thread dispatch_thread;
+
+    // Relative mouse motion that isn't sent to the OS yet, when it's coalesced
+    std::chrono::steady_clock::duration mouse_flush_interval {};
+    std::optional<std::chrono::steady_clock::time_point> mouse_flush_deadline;
+    int pending_mouse_x {};
+    int pending_mouse_y {};
+
+    // The time from the receipt of the messages to their injection in the OS
+    std::shared_ptr<input_latency::session_t> latency;
+    logging::min_max_avg_periodic_logger<double> latency_logger {debug, "Input latency", "ms"};
+
+    left_button_delay_e left_button_delay;
+    std::chrono::steady_clock::time_point left_button_release;
 
     input::touch_port_t touch_port;
+    contact_transform_t contact_transform {};
 
     int32_t accumulated_vscroll_delta;
     int32_t accumulated_hscroll_delta;
@@ -197,17 +330,18 @@ namespace input {
 
   /**
    * @brief Apply shortcut based on VKEY
+   * @param input The input context of the client.
    * @param keyCode The VKEY code
    * @return 0 if no shortcut applied, > 0 if shortcut applied.
    */
-  inline int apply_shortcut(short keyCode) {
+  inline int apply_shortcut(input_t &input, short keyCode) {
     constexpr auto VK_F1 = 0x70;
     constexpr auto VK_F13 = 0x7C;
 
     BOOST_LOG(debug) << "Apply Shortcut: 0x"sv << util::hex((std::uint8_t) keyCode).to_string_view();
 
     if (keyCode >= VK_F1 && keyCode <= VK_F13) {
-      mail::man->event<int>(mail::switch_display)->raise(keyCode - VK_F1);
+      input.switch_display_event->raise(keyCode - VK_F1);
       return 1;
     }
 
@@ -221,7 +355,7 @@ namespace input {
   }
 
   void print(PNV_REL_MOUSE_MOVE_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin relative mouse move packet--"sv << std::endl
       << "deltaX ["sv << util::endian::big(packet->deltaX) << ']' << std::endl
       << "deltaY ["sv << util::endian::big(packet->deltaY) << ']' << std::endl
@@ -229,7 +363,7 @@ namespace input {
   }
 
   void print(PNV_ABS_MOUSE_MOVE_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin absolute mouse move packet--"sv << std::endl
       << "x      ["sv << util::endian::big(packet->x) << ']' << std::endl
       << "y      ["sv << util::endian::big(packet->y) << ']' << std::endl
@@ -239,7 +373,7 @@ namespace input {
   }
 
   void print(PNV_MOUSE_BUTTON_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin mouse button packet--"sv << std::endl
       << "action ["sv << util::hex(packet->header.magic).to_string_view() << ']' << std::endl
       << "button ["sv << util::hex(packet->button).to_string_view() << ']' << std::endl
@@ -247,21 +381,21 @@ namespace input {
   }
 
   void print(PNV_SCROLL_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin mouse scroll packet--"sv << std::endl
       << "scrollAmt1 ["sv << util::endian::big(packet->scrollAmt1) << ']' << std::endl
       << "--end mouse scroll packet--"sv;
   }
 
   void print(PSS_HSCROLL_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin mouse hscroll packet--"sv << std::endl
       << "scrollAmount ["sv << util::endian::big(packet->scrollAmount) << ']' << std::endl
       << "--end mouse hscroll packet--"sv;
   }
 
   void print(PNV_KEYBOARD_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin keyboard packet--"sv << std::endl
       << "keyAction ["sv << util::hex(packet->header.magic).to_string_view() << ']' << std::endl
       << "keyCode ["sv << util::hex(packet->keyCode).to_string_view() << ']' << std::endl
@@ -272,7 +406,7 @@ namespace input {
 
   void print(PNV_UNICODE_PACKET packet) {
     std::string text(packet->text, util::endian::big(packet->header.size) - sizeof(packet->header.magic));
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin unicode packet--"sv << std::endl
       << "text ["sv << text << ']' << std::endl
       << "--end unicode packet--"sv;
@@ -280,7 +414,7 @@ namespace input {
 
   void print(PNV_MULTI_CONTROLLER_PACKET packet) {
     // Moonlight spams controller packet even when not necessary
-    BOOST_LOG(verbose)
+    SUNSHINE_HOT_LOG(verbose)
       << "--begin controller packet--"sv << std::endl
       << "controllerNumber ["sv << packet->controllerNumber << ']' << std::endl
       << "activeGamepadMask ["sv << util::hex(packet->activeGamepadMask).to_string_view() << ']' << std::endl
@@ -299,7 +433,7 @@ namespace input {
    * @param packet The touch packet.
    */
   void print(PSS_TOUCH_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin touch packet--"sv << std::endl
       << "eventType ["sv << util::hex(packet->eventType).to_string_view() << ']' << std::endl
       << "pointerId ["sv << util::hex(packet->pointerId).to_string_view() << ']' << std::endl
@@ -317,7 +451,7 @@ namespace input {
    * @param packet The pen packet.
    */
   void print(PSS_PEN_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin pen packet--"sv << std::endl
       << "eventType ["sv << util::hex(packet->eventType).to_string_view() << ']' << std::endl
       << "toolType ["sv << util::hex(packet->toolType).to_string_view() << ']' << std::endl
@@ -337,7 +471,7 @@ namespace input {
    * @param packet The controller arrival packet.
    */
   void print(PSS_CONTROLLER_ARRIVAL_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin controller arrival packet--"sv << std::endl
       << "controllerNumber ["sv << (uint32_t) packet->controllerNumber << ']' << std::endl
       << "type ["sv << util::hex(packet->type).to_string_view() << ']' << std::endl
@@ -351,7 +485,7 @@ namespace input {
    * @param packet The controller touch packet.
    */
   void print(PSS_CONTROLLER_TOUCH_PACKET packet) {
-    BOOST_LOG(debug)
+    SUNSHINE_HOT_LOG(debug)
       << "--begin controller touch packet--"sv << std::endl
       << "controllerNumber ["sv << (uint32_t) packet->controllerNumber << ']' << std::endl
       << "eventType ["sv << util::hex(packet->eventType).to_string_view() << ']' << std::endl
@@ -367,7 +501,7 @@ namespace input {
    * @param packet The controller motion packet.
    */
   void print(PSS_CONTROLLER_MOTION_PACKET packet) {
-    BOOST_LOG(verbose)
+    SUNSHINE_HOT_LOG(verbose)
       << "--begin controller motion packet--"sv << std::endl
       << "controllerNumber ["sv << util::hex(packet->controllerNumber).to_string_view() << ']' << std::endl
       << "motionType ["sv << util::hex(packet->motionType).to_string_view() << ']' << std::endl
@@ -382,7 +516,7 @@ namespace input {
    * @param packet The controller battery packet.
    */
   void print(PSS_CONTROLLER_BATTERY_PACKET packet) {
-    BOOST_LOG(verbose)
+    SUNSHINE_HOT_LOG(verbose)
       << "--begin controller battery packet--"sv << std::endl
       << "controllerNumber ["sv << util::hex(packet->controllerNumber).to_string_view() << ']' << std::endl
       << "batteryState ["sv << util::hex(packet->batteryState).to_string_view() << ']' << std::endl
@@ -390,64 +524,96 @@ namespace input {
       << "--end controller battery packet--"sv;
   }
 
-  void print(void *payload) {
-    auto header = (PNV_INPUT_HEADER) payload;
+  void passthrough(std::shared_ptr<input_t> &input, PNV_REL_MOUSE_MOVE_PACKET packet) {
+    if (!config::input.mouse) {
+      return;
+    }
 
-    switch (util::endian::little(header->magic)) {
-      case MOUSE_MOVE_REL_MAGIC_GEN5:
-        print((PNV_REL_MOUSE_MOVE_PACKET) payload);
-        break;
-      case MOUSE_MOVE_ABS_MAGIC:
-        print((PNV_ABS_MOUSE_MOVE_PACKET) payload);
-        break;
-      case MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5:
-      case MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5:
-        print((PNV_MOUSE_BUTTON_PACKET) payload);
-        break;
-      case SCROLL_MAGIC_GEN5:
-        print((PNV_SCROLL_PACKET) payload);
-        break;
-      case SS_HSCROLL_MAGIC:
-        print((PSS_HSCROLL_PACKET) payload);
-        break;
-      case KEY_DOWN_EVENT_MAGIC:
-      case KEY_UP_EVENT_MAGIC:
-        print((PNV_KEYBOARD_PACKET) payload);
-        break;
-      case UTF8_TEXT_EVENT_MAGIC:
-        print((PNV_UNICODE_PACKET) payload);
-        break;
-      case MULTI_CONTROLLER_MAGIC_GEN5:
-        print((PNV_MULTI_CONTROLLER_PACKET) payload);
-        break;
-      case SS_TOUCH_MAGIC:
-        print((PSS_TOUCH_PACKET) payload);
-        break;
-      case SS_PEN_MAGIC:
-        print((PSS_PEN_PACKET) payload);
-        break;
-      case SS_CONTROLLER_ARRIVAL_MAGIC:
-        print((PSS_CONTROLLER_ARRIVAL_PACKET) payload);
-        break;
-      case SS_CONTROLLER_TOUCH_MAGIC:
-        print((PSS_CONTROLLER_TOUCH_PACKET) payload);
-        break;
-      case SS_CONTROLLER_MOTION_MAGIC:
-        print((PSS_CONTROLLER_MOTION_PACKET) payload);
-        break;
-      case SS_CONTROLLER_BATTERY_MAGIC:
-        print((PSS_CONTROLLER_BATTERY_PACKET) payload);
-        break;
+    input->left_button_delay = left_button_delay_e::disabled;
+
+    if (input->mouse_flush_interval == std::chrono::steady_clock::duration::zero()) {
+      platf::move_mouse(platf_input, util::endian::big(packet->deltaX), util::endian::big(packet->deltaY));
+      return;
+    }
+
+    // The motion is sent when the next flush is due
+    input->pending_mouse_x += util::endian::big(packet->deltaX);
+    input->pending_mouse_y += util::endian::big(packet->deltaY);
+    if (!input->mouse_flush_deadline) {
+      input->mouse_flush_deadline = std::chrono::steady_clock::now() + input->mouse_flush_interval;
     }
   }
 
-  void passthrough(std::shared_ptr<input_t> &input, PNV_REL_MOUSE_MOVE_PACKET packet) {
-    if (!config::input.mouse) {
+  /**
+   * @brief Send the coalesced relative mouse motion to the OS.
+   * @param input The input context.
+   */
+  void flush_mouse_motion(std::shared_ptr<input_t> &input) {
+    if (!input->mouse_flush_deadline) {
       return;
     }
 
-    input->mouse_left_button_timeout = DISABLE_LEFT_BUTTON_DELAY;
-    platf::move_mouse(platf_input, util::endian::big(packet->deltaX), util::endian::big(packet->deltaY));
+    // What doesn't fit in a single move is left for the next flush
+    auto x = std::clamp<int>(input->pending_mouse_x, std::numeric_limits<short>::min(), std::numeric_limits<short>::max());
+    auto y = std::clamp<int>(input->pending_mouse_y, std::numeric_limits<short>::min(), std::numeric_limits<short>::max());
+    if (x || y) {
+      platf::move_mouse(platf_input, x, y);
+    }
+
+    input->pending_mouse_x -= x;
+    input->pending_mouse_y -= y;
+    if (input->pending_mouse_x || input->pending_mouse_y) {
+      input->mouse_flush_deadline = std::chrono::steady_clock::now() + input->mouse_flush_interval;
+    } else {
+      input->mouse_flush_deadline = std::nullopt;
+    }
+  }
+
+  /**
+   * @brief Compute the conversion of touch and pen contacts for the current touch port.
+   * @param input The input context.
+   */
+  void update_contact_transform(std::shared_ptr<input_t> &input) {
+    auto &touch_port = input->touch_port;
+    auto &transform = input->contact_transform;
+
+    float size[] {(float) touch_port.width, (float) touch_port.height};
+    float offset[] {touch_port.client_offsetX, touch_port.client_offsetY};
+    float env_size[] {(float) touch_port.env_width, (float) touch_port.env_height};
+
+    for (int axis = 0; axis < 2; ++axis) {
+      transform.scale[axis] = size[axis];
+      transform.min[axis] = offset[axis];
+      transform.max[axis] = size[axis] - offset[axis];
+      transform.factor[axis] = touch_port.scalar_inv / env_size[axis];
+    }
+
+    // See multiply_polar_by_cartesian_scalar(), the contact area is normalized to the environment
+    for (int degrees = 0; degrees < 360; ++degrees) {
+      auto angle = degrees * (M_PI / 180);
+      transform.area_scale[degrees] = (float) std::hypot(std::cos(angle) * env_size[0], std::sin(angle) * env_size[1]);
+    }
+  }
+
+  /**
+   * @brief Take the latest touch port of the client.
+   * @param input The input context.
+   * @return `true` if a touch port is available.
+   */
+  bool refresh_touch_port(std::shared_ptr<input_t> &input) {
+    auto &touch_port_event = input->touch_port_event;
+    if (touch_port_event->peek()) {
+      input->touch_port = *touch_port_event->pop();
+      if (input->touch_port) {
+        update_contact_transform(input);
+      }
+    }
+    if (!input->touch_port) {
+      BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
+      return false;
+    }
+
+    return true;
   }
 
   /**
@@ -458,16 +624,12 @@ namespace input {
    * @return The host-relative coordinate pair if a touchport is available.
    */
   std::optional<std::pair<float, float>> client_to_touchport(std::shared_ptr<input_t> &input, const std::pair<float, float> &val, const std::pair<float, float> &size) {
-    auto &touch_port_event = input->touch_port_event;
-    auto &touch_port = input->touch_port;
-    if (touch_port_event->peek()) {
-      touch_port = *touch_port_event->pop();
-    }
-    if (!touch_port) {
-      BOOST_LOG(verbose) << "Ignoring early absolute input without a touch port"sv;
+    if (!refresh_touch_port(input)) {
       return std::nullopt;
     }
 
+    auto &touch_port = input->touch_port;
+
     auto scalarX = touch_port.width / size.first;
     auto scalarY = touch_port.height / size.second;
 
@@ -516,13 +678,45 @@ namespace input {
     return {multiply_polar_by_cartesian_scalar(major, angle, scalar), multiply_polar_by_cartesian_scalar(minor, angle + (M_PI / 2), scalar)};
   }
 
+  /**
+   * @brief Converts normalized client coordinates of a contact into renormalized touch port coordinates.
+   * @param transform The transform of the current touch port.
+   * @param x The normalized X coordinate.
+   * @param y The normalized Y coordinate.
+   * @return The coordinate pair, relative to the environment.
+   */
+  std::pair<float, float> contact_to_touchport(const contact_transform_t &transform, float x, float y) {
+    return {
+      (std::clamp(x * transform.scale[0], transform.min[0], transform.max[0]) - transform.min[0]) * transform.factor[0],
+      (std::clamp(y * transform.scale[1], transform.min[1], transform.max[1]) - transform.min[1]) * transform.factor[1],
+    };
+  }
+
+  /**
+   * @brief Scale the normalized ellipse axes of a contact to the environment, like `scale_client_contact_area()`.
+   * @param transform The transform of the current touch port.
+   * @param major The normalized major axis.
+   * @param minor The normalized minor axis.
+   * @param rotation The rotation in the 0-359 degree range, or `LI_ROT_UNKNOWN`.
+   * @return The major and minor axis pair.
+   */
+  std::pair<float, float> scale_contact_area(const contact_transform_t &transform, float major, float minor, uint16_t rotation) {
+    // Unknown rotations are scaled at 45 degrees, and a contact without a minor axis is circular
+    int angle = rotation == LI_ROT_UNKNOWN ? 45 : rotation;
+    if (minor == 0.0f) {
+      minor = major;
+    }
+
+    return {major * transform.area_scale[angle], minor * transform.area_scale[(angle + 90) % 360]};
+  }
+
   void passthrough(std::shared_ptr<input_t> &input, PNV_ABS_MOUSE_MOVE_PACKET packet) {
     if (!config::input.mouse) {
       return;
     }
 
-    if (input->mouse_left_button_timeout == DISABLE_LEFT_BUTTON_DELAY) {
-      input->mouse_left_button_timeout = ENABLE_LEFT_BUTTON_DELAY;
+    if (input->left_button_delay == left_button_delay_e::disabled) {
+      input->left_button_delay = left_button_delay_e::enabled;
     }
 
     float x = util::endian::big(packet->x);
@@ -581,29 +775,19 @@ namespace input {
      *
      * Try to make sure BUTTON_RIGHT gets called before BUTTON_LEFT is released.
      *
-     * input->mouse_left_button_timeout can only be nullptr
+     * input->left_button_delay can only be enabled
      * when the last mouse coordinates were absolute
      */
-    if (button == BUTTON_LEFT && release && !input->mouse_left_button_timeout) {
-      auto f = [=]() {
-        auto left_released = mouse_press[BUTTON_LEFT];
-        if (left_released) {
-          // Already released left button
-          return;
-        }
-        platf::button_mouse(platf_input, BUTTON_LEFT, release);
-
-        mouse_press[BUTTON_LEFT] = false;
-        input->mouse_left_button_timeout = nullptr;
-      };
-
-      input->mouse_left_button_timeout = task_pool.pushDelayed(std::move(f), 10ms).task_id;
+    if (button == BUTTON_LEFT && release && input->left_button_delay == left_button_delay_e::enabled) {
+      // The input thread of the session releases it, see release_left_button()
+      input->left_button_delay = left_button_delay_e::pending;
+      input->left_button_release = std::chrono::steady_clock::now() + 10ms;
 
       return;
     }
     if (
       button == BUTTON_RIGHT && !release &&
-      input->mouse_left_button_timeout > DISABLE_LEFT_BUTTON_DELAY
+      input->left_button_delay == left_button_delay_e::pending
     ) {
       platf::button_mouse(platf_input, BUTTON_RIGHT, false);
       platf::button_mouse(platf_input, BUTTON_RIGHT, true);
@@ -707,16 +891,42 @@ namespace input {
     }
   }
 
-  void repeat_key(uint16_t key_code, uint8_t flags, uint8_t synthetic_modifiers) {
+  /**
+   * @brief Send the delayed release of the left mouse button.
+   * @param input The input context.
+   */
+  void release_left_button(std::shared_ptr<input_t> &input) {
+    input->left_button_delay = left_button_delay_e::enabled;
+
+    auto left_released = mouse_press[BUTTON_LEFT];
+    if (left_released) {
+      // Already released left button
+      return;
+    }
+    platf::button_mouse(platf_input, BUTTON_LEFT, true);
+
+    mouse_press[BUTTON_LEFT] = false;
+  }
+
+  /**
+   * @brief Repeat the pressed key, when it's the one of the session and the repeat is due.
+   * @param input The input context.
+   * @param now The current time.
+   */
+  void repeat_key(std::shared_ptr<input_t> &input, std::chrono::steady_clock::time_point now) {
+    if (!key_repeat || key_repeat->owner != input.get() || key_repeat->deadline > now) {
+      return;
+    }
+
     // If key no longer pressed, stop repeating
-    if (!key_press[make_kpid(key_code, flags)]) {
-      key_press_repeat_id = nullptr;
+    if (!key_press[make_kpid(key_repeat->key_code, key_repeat->flags)]) {
+      key_repeat.reset();
       return;
     }
 
-    send_key_and_modifiers(key_code, false, flags, synthetic_modifiers);
+    send_key_and_modifiers(key_repeat->key_code, false, key_repeat->flags, key_repeat->synthetic_modifiers);
 
-    key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_period, key_code, flags, synthetic_modifiers).task_id;
+    key_repeat->deadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(config::input.key_repeat_period);
   }
 
   void passthrough(std::shared_ptr<input_t> &input, PNV_KEYBOARD_PACKET packet) {
@@ -747,16 +957,21 @@ namespace input {
       if (!release) {
         // A new key has been pressed down, we need to check for key combo's
         // If a key-combo has been pressed down, don't pass it through
-        if (input->shortcutFlags == input_t::SHORTCUT && apply_shortcut(keyCode) > 0) {
+        if (input->shortcutFlags == input_t::SHORTCUT && apply_shortcut(*input, keyCode) > 0) {
           return;
         }
 
-        if (key_press_repeat_id) {
-          task_pool.cancel(key_press_repeat_id);
-        }
+        key_repeat.reset();
 
         if (config::input.key_repeat_delay.count() > 0) {
-          key_press_repeat_id = task_pool.pushDelayed(repeat_key, config::input.key_repeat_delay, keyCode, packet->flags, synthetic_modifiers).task_id;
+          // The input thread of the session repeats it
+          key_repeat = key_repeat_t {
+            input.get(),
+            std::chrono::steady_clock::now() + config::input.key_repeat_delay,
+            (std::uint16_t) keyCode,
+            packet->flags,
+            synthetic_modifiers,
+          };
         }
       } else {
         // Already released
@@ -879,9 +1094,7 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!refresh_touch_port(input)) {
       return;
     }
 
@@ -893,9 +1106,9 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
+    // Convert the client normalized coordinates to renormalized touchport coordinates
+    auto &transform = input->contact_transform;
+    auto coords = contact_to_touchport(transform, from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f));
 
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
@@ -904,19 +1117,19 @@ namespace input {
     }
 
     // Normalize the contact area based on the touchport
-    auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
-      rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
+    auto contact_area = scale_contact_area(
+      transform,
+      from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f),
+      from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f),
+      rotation
     );
 
     platf::touch_input_t touch {
       packet->eventType,
       rotation,
       util::endian::little(packet->pointerId),
-      coords->first,
-      coords->second,
+      coords.first,
+      coords.second,
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
       contact_area.first,
       contact_area.second,
@@ -935,9 +1148,7 @@ namespace input {
       return;
     }
 
-    // Convert the client normalized coordinates to touchport coordinates
-    auto coords = client_to_touchport(input, {from_clamped_netfloat(packet->x, 0.0f, 1.0f) * 65535.f, from_clamped_netfloat(packet->y, 0.0f, 1.0f) * 65535.f}, {65535.f, 65535.f});
-    if (!coords) {
+    if (!refresh_touch_port(input)) {
       return;
     }
 
@@ -949,9 +1160,9 @@ namespace input {
       touch_port.env_height
     };
 
-    // Renormalize the coordinates
-    coords->first /= abs_port.width;
-    coords->second /= abs_port.height;
+    // Convert the client normalized coordinates to renormalized touchport coordinates
+    auto &transform = input->contact_transform;
+    auto coords = contact_to_touchport(transform, from_clamped_netfloat(packet->x, 0.0f, 1.0f), from_clamped_netfloat(packet->y, 0.0f, 1.0f));
 
     // Normalize rotation value to 0-359 degree range
     auto rotation = util::endian::little(packet->rotation);
@@ -960,11 +1171,11 @@ namespace input {
     }
 
     // Normalize the contact area based on the touchport
-    auto contact_area = scale_client_contact_area(
-      {from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f) * 65535.f,
-       from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f) * 65535.f},
-      rotation,
-      {abs_port.width / 65535.f, abs_port.height / 65535.f}
+    auto contact_area = scale_contact_area(
+      transform,
+      from_clamped_netfloat(packet->contactAreaMajor, 0.0f, 1.0f),
+      from_clamped_netfloat(packet->contactAreaMinor, 0.0f, 1.0f),
+      rotation
     );
 
     platf::pen_input_t pen {
@@ -973,8 +1184,8 @@ namespace input {
       packet->penButtons,
       packet->tilt,
       rotation,
-      coords->first,
-      coords->second,
+      coords.first,
+      coords.second,
       from_clamped_netfloat(packet->pressureOrDistance, 0.0f, 1.0f),
       contact_area.first,
       contact_area.second,
@@ -1016,6 +1227,23 @@ namespace input {
     platf::gamepad_touch(platf_input, touch);
   }
 
+  /**
+   * @brief Send the pending motion of a gamepad to the platform backend.
+   * @param gamepad The gamepad.
+   * @param now The current time.
+   */
+  void send_motion(gamepad_t &gamepad, std::chrono::steady_clock::time_point now) {
+    for (auto &motion : gamepad.pending_motion) {
+      // The gamepad may have been removed and allocated again since the sample arrived
+      if (motion && motion->id.globalIndex == gamepad.id) {
+        platf::gamepad_motion(platf_input, *motion);
+      }
+      motion.reset();
+    }
+
+    gamepad.next_motion_report = now + MOTION_REPORT_INTERVAL;
+  }
+
   /**
    * @brief Called to pass a controller motion message to the platform backend.
    * @param input The input context pointer.
@@ -1037,7 +1265,14 @@ namespace input {
       return;
     }
 
-    platf::gamepad_motion_t motion {
+    if (packet->motionType != LI_MOTION_TYPE_ACCEL && packet->motionType != LI_MOTION_TYPE_GYRO) {
+      BOOST_LOG(warning) << "Unknown motion type ["sv << (int) packet->motionType << ']';
+      return;
+    }
+
+    // Each full report of the virtual device carries both sensors, so the samples arriving faster
+    // than the device reports are replaced by the latest one
+    gamepad.pending_motion[packet->motionType - LI_MOTION_TYPE_ACCEL] = platf::gamepad_motion_t {
       {gamepad.id, packet->controllerNumber},
       packet->motionType,
       from_netfloat(packet->x),
@@ -1045,7 +1280,10 @@ namespace input {
       from_netfloat(packet->z),
     };
 
-    platf::gamepad_motion(platf_input, motion);
+    auto now = std::chrono::steady_clock::now();
+    if (now >= gamepad.next_motion_report) {
+      send_motion(gamepad, now);
+    }
   }
 
   /**
@@ -1161,18 +1399,24 @@ namespace input {
 
             auto &state = gamepad.gamepad_state;
 
-            // Force the back button up
-            gamepad.back_button_state = button_state_e::UP;
-            state.buttonFlags &= ~platf::BACK;
-            platf::gamepad_update(platf_input, gamepad.id, state);
+            {
+              std::lock_guard lg {dispatch_lock};
 
-            // Press Home button
-            state.buttonFlags |= platf::HOME;
-            platf::gamepad_update(platf_input, gamepad.id, state);
+              // Force the back button up
+              gamepad.back_button_state = button_state_e::UP;
+              state.buttonFlags &= ~platf::BACK;
+              platf::gamepad_update(platf_input, gamepad.id, state);
+
+              // Press Home button
+              state.buttonFlags |= platf::HOME;
+              platf::gamepad_update(platf_input, gamepad.id, state);
+            }
 
             // Sleep for a short time to allow the input to be detected
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
+            std::lock_guard lg {dispatch_lock};
+
             // Release Home button
             state.buttonFlags &= ~platf::HOME;
             platf::gamepad_update(platf_input, gamepad.id, state);
@@ -1437,51 +1681,134 @@ namespace input {
   }
 
   /**
-   * @brief Batch two input messages.
-   * @param dest The original packet to batch into.
+   * @brief Batch two text messages.
+   * @param dest The original packet to batch into, backed by the data of an `input_batch_t`.
    * @param src A later packet to attempt to batch.
    * @return The status of the batching operation.
    */
-  batch_result_e batch(PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src) {
-    // We can only batch if the packet types are the same
-    if (dest->magic != src->magic) {
+  batch_result_e batch(PNV_UNICODE_PACKET dest, PNV_UNICODE_PACKET src) {
+    auto dest_size = (std::size_t) util::endian::big(dest->header.size);
+    auto src_text_size = (std::size_t) util::endian::big(src->header.size) - sizeof(src->header.magic);
+
+    // The text of both must fit the batch
+    if (sizeof(dest->header.size) + dest_size + src_text_size > INPUT_BATCH_SIZE) {
       return batch_result_e::terminate_batch;
     }
 
-    // We can only batch certain message types
-    switch (util::endian::little(dest->magic)) {
-      case MOUSE_MOVE_REL_MAGIC_GEN5:
-        return batch((PNV_REL_MOUSE_MOVE_PACKET) dest, (PNV_REL_MOUSE_MOVE_PACKET) src);
-      case MOUSE_MOVE_ABS_MAGIC:
-        return batch((PNV_ABS_MOUSE_MOVE_PACKET) dest, (PNV_ABS_MOUSE_MOVE_PACKET) src);
-      case SCROLL_MAGIC_GEN5:
-        return batch((PNV_SCROLL_PACKET) dest, (PNV_SCROLL_PACKET) src);
-      case SS_HSCROLL_MAGIC:
-        return batch((PSS_HSCROLL_PACKET) dest, (PSS_HSCROLL_PACKET) src);
-      case MULTI_CONTROLLER_MAGIC_GEN5:
-        return batch((PNV_MULTI_CONTROLLER_PACKET) dest, (PNV_MULTI_CONTROLLER_PACKET) src);
-      case SS_TOUCH_MAGIC:
-        return batch((PSS_TOUCH_PACKET) dest, (PSS_TOUCH_PACKET) src);
-      case SS_PEN_MAGIC:
-        return batch((PSS_PEN_PACKET) dest, (PSS_PEN_PACKET) src);
-      case SS_CONTROLLER_TOUCH_MAGIC:
-        return batch((PSS_CONTROLLER_TOUCH_PACKET) dest, (PSS_CONTROLLER_TOUCH_PACKET) src);
-      case SS_CONTROLLER_MOTION_MAGIC:
-        return batch((PSS_CONTROLLER_MOTION_PACKET) dest, (PSS_CONTROLLER_MOTION_PACKET) src);
-      default:
-        // Not a batchable message type
-        return batch_result_e::terminate_batch;
+    // Append the text, each message holds whole characters
+    std::memcpy(dest->text + dest_size - sizeof(dest->header.magic), src->text, src_text_size);
+    dest->header.size = util::endian::big<std::uint32_t>(dest_size + src_text_size);
+    return batch_result_e::batched;
+  }
+
+  /**
+   * @brief How an input message of a given type is validated, printed, batched and sent to the OS.
+   */
+  struct message_type_t {
+    std::uint32_t magic;
+
+    // The smallest valid message
+    std::size_t min_size;
+
+    // The text of the message follows the header, and its length is the one of the header
+    bool sized_by_header;
+
+    // The type the message counts as for its latency, `std::nullopt` for messages that aren't input
+    std::optional<input_latency::type_e> latency;
+
+    void (*print)(void *payload);
+    void (*passthrough)(std::shared_ptr<input_t> &input, void *payload);
+
+    // nullptr when messages of the type can't be batched
+    batch_result_e (*batch)(PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src);
+  };
+
+  /**
+   * @brief Bind the handlers of a packet type.
+   * @tparam P The pointer type of the packet.
+   * @param magic The magic of the packet.
+   * @param latency The type the packet counts as for its latency.
+   * @return The message type.
+   */
+  template<class P>
+  constexpr message_type_t make_message_type(std::uint32_t magic, std::optional<input_latency::type_e> latency) {
+    constexpr bool sized_by_header = std::is_same_v<P, PNV_UNICODE_PACKET>;
+
+    message_type_t type {
+      magic,
+      sized_by_header ? sizeof(NV_INPUT_HEADER) : sizeof(std::remove_pointer_t<P>),
+      sized_by_header,
+      latency,
+    };
+
+    type.print = [](void *payload) {
+      print((P) payload);
+    };
+    type.passthrough = [](std::shared_ptr<input_t> &input, void *payload) {
+      if constexpr (sized_by_header) {
+        passthrough((P) payload);
+      } else {
+        passthrough(input, (P) payload);
+      }
+    };
+    if constexpr (requires(P dest, P src) { batch(dest, src); }) {
+      type.batch = [](PNV_INPUT_HEADER dest, PNV_INPUT_HEADER src) {
+        return batch((P) dest, (P) src);
+      };
+    } else {
+      type.batch = nullptr;
     }
+
+    return type;
   }
 
+  constexpr std::array message_types {
+    make_message_type<PNV_REL_MOUSE_MOVE_PACKET>(MOUSE_MOVE_REL_MAGIC_GEN5, input_latency::type_e::mouse),
+    make_message_type<PNV_ABS_MOUSE_MOVE_PACKET>(MOUSE_MOVE_ABS_MAGIC, input_latency::type_e::mouse),
+    make_message_type<PNV_MOUSE_BUTTON_PACKET>(MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5, input_latency::type_e::mouse),
+    make_message_type<PNV_MOUSE_BUTTON_PACKET>(MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5, input_latency::type_e::mouse),
+    make_message_type<PNV_SCROLL_PACKET>(SCROLL_MAGIC_GEN5, input_latency::type_e::mouse),
+    make_message_type<PSS_HSCROLL_PACKET>(SS_HSCROLL_MAGIC, input_latency::type_e::mouse),
+    make_message_type<PNV_KEYBOARD_PACKET>(KEY_DOWN_EVENT_MAGIC, input_latency::type_e::keyboard),
+    make_message_type<PNV_KEYBOARD_PACKET>(KEY_UP_EVENT_MAGIC, input_latency::type_e::keyboard),
+    make_message_type<PNV_UNICODE_PACKET>(UTF8_TEXT_EVENT_MAGIC, input_latency::type_e::keyboard),
+    make_message_type<PNV_MULTI_CONTROLLER_PACKET>(MULTI_CONTROLLER_MAGIC_GEN5, input_latency::type_e::gamepad),
+    make_message_type<PSS_TOUCH_PACKET>(SS_TOUCH_MAGIC, input_latency::type_e::touch),
+    make_message_type<PSS_PEN_PACKET>(SS_PEN_MAGIC, input_latency::type_e::pen),
+    make_message_type<PSS_CONTROLLER_ARRIVAL_PACKET>(SS_CONTROLLER_ARRIVAL_MAGIC, std::nullopt),
+    make_message_type<PSS_CONTROLLER_TOUCH_PACKET>(SS_CONTROLLER_TOUCH_MAGIC, input_latency::type_e::gamepad),
+    make_message_type<PSS_CONTROLLER_MOTION_PACKET>(SS_CONTROLLER_MOTION_MAGIC, input_latency::type_e::gamepad),
+    make_message_type<PSS_CONTROLLER_BATTERY_PACKET>(SS_CONTROLLER_BATTERY_MAGIC, std::nullopt),
+  };
+
   /**
-   * @brief Called on a thread pool thread to process an input message.
+   * @brief Find the type of an input message.
+   * @param magic The magic of the message, in host byte order.
+   * @return The type, or nullptr for unknown messages.
+   */
+  const message_type_t *find_message_type(std::uint32_t magic) {
+    auto type = std::find_if(std::begin(message_types), std::end(message_types), [magic](const message_type_t &type) {
+      return type.magic == magic;
+    });
+
+    return type == std::end(message_types) ? nullptr : &*type;
+  }
+
+  void print(void *payload) {
+    if (auto type = find_message_type(util::endian::little(((PNV_INPUT_HEADER) payload)->magic))) {
+      type->print(payload);
+    }
+  }
+
+  /**
+   * @brief Called on the input thread of a session to process an input message.
    * @param input The input context pointer.
+   * @return `false` if the queue was empty.
    */
-  void passthrough_next_message(std::shared_ptr<input_t> input) {
+  bool passthrough_next_message(std::shared_ptr<input_t> &input) {
     // 'entry' backs the 'payload' pointer, so they must remain in scope together
-    std::vector<uint8_t> entry;
-    PNV_INPUT_HEADER payload;
+    input_batch_t entry;
+    auto payload = (PNV_INPUT_HEADER) entry.data;
 
     // Lock the input queue while batching, but release it before sending
     // the input to the OS. This avoids potentially lengthy lock contention
@@ -1489,85 +1816,162 @@ namespace input {
     {
       std::lock_guard<std::mutex> lg(input->input_queue_lock);
 
+      auto &queue = input->input_queue;
+      auto &head = input->input_queue_head;
+      auto &count = input->input_queue_count;
+
+      auto pop_front = [&]() {
+        head = (head + 1) % queue.size();
+        --count;
+      };
+
+      // Drop the entries that were batched into earlier ones
+      while (count && queue[head].batched) {
+        pop_front();
+      }
+
       // If all entries have already been processed, nothing to do
-      if (input->input_queue.empty()) {
-        return;
+      if (!count) {
+        return false;
       }
 
       // Pop off the first entry, which we will send
-      entry = input->input_queue.front();
-      payload = (PNV_INPUT_HEADER) entry.data();
-      input->input_queue.pop_front();
+      auto &front = queue[head];
+      entry.type = front.type;
+      entry.received = front.received;
+      std::memcpy(entry.data, front.data, front.size);
+      pop_front();
+
+      // Try to batch with remaining items on the queue, the batched ones are left in place and skipped later
+      for (std::size_t x = 0; entry.type->batch && x < count; ++x) {
+        auto &record = queue[(head + x) % queue.size()];
+        if (record.batched) {
+          continue;
+        }
 
-      // Try to batch with remaining items on the queue
-      auto i = input->input_queue.begin();
-      while (i != input->input_queue.end()) {
-        auto batchable_entry = *i;
-        auto batchable_payload = (PNV_INPUT_HEADER) batchable_entry.data();
+        // We can only batch if the packet types are the same
+        if (record.type != entry.type) {
+          break;
+        }
 
-        auto batch_result = batch(payload, batchable_payload);
+        auto batch_result = entry.type->batch(payload, (PNV_INPUT_HEADER) record.data);
         if (batch_result == batch_result_e::terminate_batch) {
           // Stop batching
           break;
         } else if (batch_result == batch_result_e::batched) {
-          // Erase this entry since it was batched
-          i = input->input_queue.erase(i);
-        } else {
-          // We couldn't batch this entry, but try to batch later entries.
-          i++;
+          record.batched = true;
         }
       }
     }
 
     // Print the final input packet
-    input::print((void *) payload);
+    entry.type->print(payload);
+
+    std::lock_guard lg {dispatch_lock};
+
+    // The coalesced motion comes before any other input, so it isn't reordered with the buttons
+    if (entry.type->magic != MOUSE_MOVE_REL_MAGIC_GEN5) {
+      flush_mouse_motion(input);
+    }
 
     // Send the batched input to the OS
-    switch (util::endian::little(payload->magic)) {
-      case MOUSE_MOVE_REL_MAGIC_GEN5:
-        passthrough(input, (PNV_REL_MOUSE_MOVE_PACKET) payload);
-        break;
-      case MOUSE_MOVE_ABS_MAGIC:
-        passthrough(input, (PNV_ABS_MOUSE_MOVE_PACKET) payload);
-        break;
-      case MOUSE_BUTTON_DOWN_EVENT_MAGIC_GEN5:
-      case MOUSE_BUTTON_UP_EVENT_MAGIC_GEN5:
-        passthrough(input, (PNV_MOUSE_BUTTON_PACKET) payload);
-        break;
-      case SCROLL_MAGIC_GEN5:
-        passthrough(input, (PNV_SCROLL_PACKET) payload);
-        break;
-      case SS_HSCROLL_MAGIC:
-        passthrough(input, (PSS_HSCROLL_PACKET) payload);
-        break;
-      case KEY_DOWN_EVENT_MAGIC:
-      case KEY_UP_EVENT_MAGIC:
-        passthrough(input, (PNV_KEYBOARD_PACKET) payload);
-        break;
-      case UTF8_TEXT_EVENT_MAGIC:
-        passthrough((PNV_UNICODE_PACKET) payload);
-        break;
-      case MULTI_CONTROLLER_MAGIC_GEN5:
-        passthrough(input, (PNV_MULTI_CONTROLLER_PACKET) payload);
-        break;
-      case SS_TOUCH_MAGIC:
-        passthrough(input, (PSS_TOUCH_PACKET) payload);
-        break;
-      case SS_PEN_MAGIC:
-        passthrough(input, (PSS_PEN_PACKET) payload);
-        break;
-      case SS_CONTROLLER_ARRIVAL_MAGIC:
-        passthrough(input, (PSS_CONTROLLER_ARRIVAL_PACKET) payload);
-        break;
-      case SS_CONTROLLER_TOUCH_MAGIC:
-        passthrough(input, (PSS_CONTROLLER_TOUCH_PACKET) payload);
-        break;
-      case SS_CONTROLLER_MOTION_MAGIC:
-        passthrough(input, (PSS_CONTROLLER_MOTION_PACKET) payload);
-        break;
-      case SS_CONTROLLER_BATTERY_MAGIC:
-        passthrough(input, (PSS_CONTROLLER_BATTERY_PACKET) payload);
-        break;
+    entry.type->passthrough(input, payload);
+
+    // Batched messages count from the receipt of the oldest one
+    if (entry.type->latency) {
+      auto latency = std::chrono::steady_clock::now() - entry.received;
+      input->latency->record(*entry.type->latency, latency);
+      input->latency_logger.collect_and_log(std::chrono::duration<double, std::milli>(latency).count());
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Send the coalesced input, the key repeat and the delayed release of the left button that are due to the OS.
+   * @param input The input context.
+   * @return When the next of them is due, if any is left.
+   */
+  std::optional<std::chrono::steady_clock::time_point> run_timers(std::shared_ptr<input_t> &input) {
+    std::lock_guard lg {dispatch_lock};
+
+    auto now = std::chrono::steady_clock::now();
+    if (input->mouse_flush_deadline && *input->mouse_flush_deadline <= now) {
+      flush_mouse_motion(input);
+    }
+    auto deadline = input->mouse_flush_deadline;
+
+    auto earliest = [&deadline](std::chrono::steady_clock::time_point time) {
+      if (!deadline || time < *deadline) {
+        deadline = time;
+      }
+    };
+
+    repeat_key(input, now);
+    if (key_repeat && key_repeat->owner == input.get()) {
+      earliest(key_repeat->deadline);
+    }
+
+    if (input->left_button_delay == left_button_delay_e::pending) {
+      if (input->left_button_release <= now) {
+        release_left_button(input);
+      } else {
+        earliest(input->left_button_release);
+      }
+    }
+
+    for (auto &gamepad : input->gamepads) {
+      if (!gamepad.pending_motion[0] && !gamepad.pending_motion[1]) {
+        continue;
+      }
+
+      if (now >= gamepad.next_motion_report) {
+        send_motion(gamepad, now);
+      } else {
+        earliest(gamepad.next_motion_report);
+      }
+    }
+
+    return deadline;
+  }
+
+  /**
+   * @brief The input thread of a session, it sends the queued messages to the OS when woken.
+   * @param weak_input The input context, the thread stops when it's gone.
+   * @param dispatch_event The event waking the thread.
+   */
+  void dispatch_messages(std::weak_ptr<input_t> weak_input, std::shared_ptr<safe::signal_t> dispatch_event) {
+    // Input is latency sensitive, and it shouldn't wait behind the tasks of the pools
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::control);
+    timeline::set_thread_name("input");
+
+    while (true) {
+      std::optional<std::chrono::steady_clock::time_point> flush_deadline;
+      {
+        auto input = weak_input.lock();
+        if (!input) {
+          return;
+        }
+
+        timeline::scope_t scope {"input_dispatch"};
+
+        // What's queued together reaches the OS together, on backends that can batch it
+        platf::begin_input_batch(platf_input);
+        while (passthrough_next_message(input)) {}
+        flush_deadline = run_timers(input);
+        platf::end_input_batch(platf_input);
+      }
+
+      if (flush_deadline) {
+        dispatch_event->pop(*flush_deadline - std::chrono::steady_clock::now());
+      } else {
+        dispatch_event->pop();
+      }
+
+      if (!dispatch_event->running()) {
+        return;
+      }
     }
   }
 
@@ -1576,20 +1980,80 @@ namespace input {
    * @param input The input context pointer.
    * @param input_data The input message.
    */
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data) {
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data) {
+    if (input_data.size() > INPUT_RECORD_SIZE) {
+      BOOST_LOG(warning) << "Dropping input message of "sv << input_data.size() << " bytes"sv;
+      return;
+    }
+
+    // Validate the message once, the input thread trusts its size afterwards
+    NV_INPUT_HEADER header {};
+    if (input_data.size() < sizeof(header)) {
+      BOOST_LOG(warning) << "Dropping truncated input message"sv;
+      return;
+    }
+    std::memcpy(&header, input_data.data(), sizeof(header));
+
+    auto type = find_message_type(util::endian::little(header.magic));
+    if (!type) {
+      BOOST_LOG(debug) << "Dropping unknown input message ["sv << util::hex(util::endian::little(header.magic)).to_string_view() << ']';
+      return;
+    }
+
+    auto header_size = (std::size_t) util::endian::big(header.size);
+    if (
+      input_data.size() < type->min_size ||
+      (type->sized_by_header && (header_size < sizeof(header.magic) || sizeof(header.size) + header_size > input_data.size()))
+    ) {
+      BOOST_LOG(warning) << "Dropping malformed input message ["sv << util::hex(type->magic).to_string_view() << ']';
+      return;
+    }
+
+    auto received = std::chrono::steady_clock::now();
+
     {
       std::lock_guard<std::mutex> lg(input->input_queue_lock);
-      input->input_queue.push_back(std::move(input_data));
+
+      auto &queue = input->input_queue;
+      if (input->input_queue_count == queue.size()) {
+        BOOST_LOG(warning) << "Input queue is full, dropping input message"sv;
+        return;
+      }
+
+      auto &record = queue[(input->input_queue_head + input->input_queue_count) % queue.size()];
+      record.size = (std::uint32_t) input_data.size();
+      record.type = type;
+      record.batched = false;
+      record.received = received;
+      std::memcpy(record.data, input_data.data(), input_data.size());
+
+      ++input->input_queue_count;
     }
-    task_pool.push(passthrough_next_message, input);
+    input->dispatch_event->raise(true);
+  }
+
+  std::size_t queue_depth(const std::shared_ptr<input_t> &input) {
+    std::lock_guard<std::mutex> lg(input->input_queue_lock);
+
+    return input->input_queue_count;
   }
 
   void reset(std::shared_ptr<input_t> &input) {
-    task_pool.cancel(key_press_repeat_id);
-    task_pool.cancel(input->mouse_left_button_timeout);
+    // No more messages are sent for the session once the input is reset
+    input->dispatch_event->stop();
+    if (input->dispatch_thread.joinable()) {
+      input->dispatch_thread.join();
+    }
+
+    {
+      std::lock_guard lg {dispatch_lock};
+      key_repeat.reset();
+    }
+
+    // Ensure input is synchronous, by using the input_pool
+    input_pool.post([]() {
+      std::lock_guard lg {dispatch_lock};
 
-    // Ensure input is synchronous, by using the task_pool
-    task_pool.push([]() {
       for (int x = 0; x < mouse_press.size(); ++x) {
         if (mouse_press[x]) {
           platf::button_mouse(platf_input, x, true);
@@ -1632,18 +2096,29 @@ namespace input {
     return true;
   }
 
-  std::shared_ptr<input_t> alloc(safe::mail_t mail) {
+  std::shared_ptr<input_t> alloc(safe::mail_t mail, int framerate, std::uint32_t session_id) {
     auto input = std::make_shared<input_t>(
       mail->event<input::touch_port_t>(mail::touch_port),
+      mail->event<int>(mail::switch_display),
       mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback)
     );
 
+    input->latency = input_latency::start_session(session_id);
+
+    if (config::input.mouse_coalescing > 0) {
+      input->mouse_flush_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(1s) / (std::max(framerate, 1) * config::input.mouse_coalescing);
+    }
+
+    input->dispatch_thread = std::thread {dispatch_messages, std::weak_ptr {input}, input->dispatch_event};
+
     // Workaround to ensure new frames will be captured when a client connects
-    task_pool.pushDelayed([]() {
+    input_pool.pushDelayed([]() {
+      std::lock_guard lg {dispatch_lock};
+
       platf::move_mouse(platf_input, 1, 1);
       platf::move_mouse(platf_input, -1, -1);
     },
-                          100ms);
+                           100ms);
 
     return input;
   }
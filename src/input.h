@@ -6,6 +6,7 @@
 
 // standard includes
 #include <functional>
+#include <span>
 
 // local includes
 #include "platform/common.h"
@@ -16,13 +17,20 @@ namespace input {
 
   void print(void *input);
   void reset(std::shared_ptr<input_t> &input);
-  void passthrough(std::shared_ptr<input_t> &input, std::vector<std::uint8_t> &&input_data);
+  void passthrough(std::shared_ptr<input_t> &input, std::span<const std::uint8_t> input_data);
+
+  /**
+   * @brief Get the number of input messages waiting in the queue of a client.
+   * @param input The input context.
+   * @return The messages not yet taken off the queue, the ones batched into others included.
+   */
+  std::size_t queue_depth(const std::shared_ptr<input_t> &input);
 
   [[nodiscard]] std::unique_ptr<platf::deinit_t> init();
 
   bool probe_gamepads();
 
-  std::shared_ptr<input_t> alloc(safe::mail_t mail);
+  std::shared_ptr<input_t> alloc(safe::mail_t mail, int framerate, std::uint32_t session_id);
 
   struct touch_port_t: public platf::touch_port_t {
     int env_width, env_height;
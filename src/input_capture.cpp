@@ -0,0 +1,267 @@
+/**
+ * @file src/input_capture.cpp
+ * @brief Definitions for recording and replaying the input messages of the clients.
+ */
+// standard includes
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+// local includes
+#include "config.h"
+#include "display_device.h"
+#include "globals.h"
+#include "input_capture.h"
+#include "input_latency.h"
+#include "logging.h"
+#include "platform/common.h"
+#include "video.h"
+
+using namespace std::literals;
+
+namespace input_capture {
+  namespace {
+    // The input_latency session the replayed messages are counted in
+    constexpr std::uint32_t REPLAY_SESSION_ID = 0;
+
+    /**
+     * @brief The header of a capture file, after the magic.
+     */
+    struct file_header_t {
+      std::uint32_t version;
+      std::uint32_t reserved;
+    };
+
+    /**
+     * @brief The header of a record, followed by the message.
+     * @details The fields are written in the byte order of the host, captures are meant to be replayed where they're taken.
+     */
+    struct record_header_t {
+      std::int64_t timestamp;  ///< Nanoseconds from the receipt of the first message
+      std::uint32_t size;
+      std::uint16_t width;
+      std::uint16_t height;
+    };
+
+    static_assert(sizeof(file_header_t) == 8 && sizeof(record_header_t) == 16, "The layout of the file must not depend on the compiler");
+  }  // namespace
+
+  writer_t::writer_t(const std::filesystem::path &path):
+      _file {path, std::ios::binary | std::ios::trunc} {
+    if (!_file) {
+      BOOST_LOG(error) << "Couldn't open input capture file ["sv << path.string() << ']';
+      return;
+    }
+
+    file_header_t header {VERSION, 0};
+    _file.write(MAGIC.data(), MAGIC.size());
+    _file.write((const char *) &header, sizeof(header));
+  }
+
+  bool writer_t::write(std::span<const std::uint8_t> message, int width, int height, std::chrono::steady_clock::time_point received) {
+    if (!_file) {
+      return false;
+    }
+
+    if (!_epoch) {
+      _epoch = received;
+    }
+
+    record_header_t header {};
+    header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(received - *_epoch).count();
+    header.size = (std::uint32_t) message.size();
+    header.width = (std::uint16_t) width;
+    header.height = (std::uint16_t) height;
+
+    _file.write((const char *) &header, sizeof(header));
+    _file.write((const char *) message.data(), message.size());
+
+    // Recordings are short and taken while streaming, so a crash doesn't lose the messages leading to it
+    _file.flush();
+
+    return (bool) _file;
+  }
+
+  std::optional<capture_t> capture_t::load(const std::filesystem::path &path) {
+    std::ifstream file {path, std::ios::binary | std::ios::ate};
+    if (!file) {
+      BOOST_LOG(error) << "Couldn't open input capture file ["sv << path.string() << ']';
+      return std::nullopt;
+    }
+
+    capture_t capture;
+    capture._contents.resize((std::size_t) file.tellg());
+    file.seekg(0);
+    if (!file.read(capture._contents.data(), capture._contents.size())) {
+      BOOST_LOG(error) << "Couldn't read input capture file ["sv << path.string() << ']';
+      return std::nullopt;
+    }
+
+    std::string_view contents {capture._contents.data(), capture._contents.size()};
+
+    file_header_t file_header;
+    if (contents.size() < MAGIC.size() + sizeof(file_header) || contents.substr(0, MAGIC.size()) != MAGIC) {
+      BOOST_LOG(error) << '[' << path.string() << "] isn't an input capture file"sv;
+      return std::nullopt;
+    }
+    std::memcpy(&file_header, contents.data() + MAGIC.size(), sizeof(file_header));
+    if (file_header.version != VERSION) {
+      BOOST_LOG(error) << "Input capture file ["sv << path.string() << "] has version "sv << file_header.version << ", expected "sv << VERSION;
+      return std::nullopt;
+    }
+    contents.remove_prefix(MAGIC.size() + sizeof(file_header));
+
+    while (contents.size() >= sizeof(record_header_t)) {
+      record_header_t header;
+      std::memcpy(&header, contents.data(), sizeof(header));
+      contents.remove_prefix(sizeof(header));
+
+      // The recording may have been cut short
+      if (contents.size() < header.size) {
+        break;
+      }
+
+      capture._records.emplace_back(record_t {
+        std::chrono::nanoseconds {header.timestamp},
+        header.width,
+        header.height,
+        contents.substr(0, header.size),
+      });
+      contents.remove_prefix(header.size);
+    }
+
+    if (!contents.empty()) {
+      BOOST_LOG(warning) << "Input capture file ["sv << path.string() << "] ends with a truncated message"sv;
+    }
+
+    return capture;
+  }
+
+  replay_result_t replay(const capture_t &capture, std::shared_ptr<input::input_t> &input, const std::function<void(int width, int height)> &resolution_changed, double speed) {
+    replay_result_t result;
+
+    auto &records = capture.records();
+    if (records.empty()) {
+      return result;
+    }
+
+    // The touch port of the first message is raised before the timing starts
+    std::pair resolution {records.front().width, records.front().height};
+    resolution_changed(resolution.first, resolution.second);
+
+    auto timer = platf::create_high_precision_timer();
+
+    double depth_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &record : records) {
+      if (speed > 0) {
+        auto due = start + std::chrono::duration_cast<std::chrono::nanoseconds>(record.timestamp / speed);
+        auto now = std::chrono::steady_clock::now();
+        if (due > now) {
+          if (timer && *timer) {
+            timer->sleep_for(due - now);
+          } else {
+            std::this_thread::sleep_until(due);
+          }
+        }
+      }
+
+      if (resolution != std::pair {record.width, record.height}) {
+        resolution = {record.width, record.height};
+        resolution_changed(resolution.first, resolution.second);
+      }
+
+      input::passthrough(input, std::span {(const std::uint8_t *) record.data.data(), record.data.size()});
+
+      auto depth = input::queue_depth(input);
+      result.max_queue_depth = std::max(result.max_queue_depth, depth);
+      depth_sum += (double) depth;
+      ++result.messages;
+    }
+
+    // The throughput counts until the dispatch thread took the last message
+    while (input::queue_depth(input)) {
+      std::this_thread::sleep_for(100us);
+    }
+
+    result.duration = std::chrono::steady_clock::now() - start;
+    result.mean_queue_depth = depth_sum / (double) result.messages;
+
+    return result;
+  }
+
+  int measure(const std::filesystem::path &path, double speed) {
+    auto capture = capture_t::load(path);
+    if (!capture) {
+      return -1;
+    }
+    if (capture->records().empty()) {
+      BOOST_LOG(error) << "Input capture file ["sv << path.string() << "] holds no message"sv;
+      return -1;
+    }
+
+    BOOST_LOG(info) << "Replaying "sv << capture->records().size() << " input messages at "sv << (speed > 0 ? std::to_string(speed) + "x"s : "full speed"s);
+
+    auto mail = std::make_shared<safe::mail_raw_t>();
+    auto touch_port_events = mail->event<input::touch_port_t>(mail::touch_port);
+    auto input = input::alloc(mail, 60, REPLAY_SESSION_ID);
+
+    // The absolute positions are relative to the display, like while streaming
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+    auto resolution_changed = [&](int width, int height) {
+      video::config_t config {width, height, 60, 1000, 1, 0, 1, 0, 0, 0};
+      auto disp = platf::display(platf::mem_type_e::system, output_name, config);
+      if (!disp) {
+        BOOST_LOG(warning) << "Couldn't open the display, the absolute mouse, touch and pen messages are dropped"sv;
+        return;
+      }
+
+      touch_port_events->raise(video::make_port(disp.get(), config));
+    };
+
+    auto result = replay(*capture, input, resolution_changed, speed);
+
+    // Wait for the last message to be injected, and release the keys and buttons left pressed
+    input::reset(input);
+
+    auto seconds = std::chrono::duration<double>(result.duration).count();
+    std::cout
+      << std::endl
+      << "messages | seconds | messages/s | max queue | mean queue"sv << std::endl
+      << std::fixed << std::setprecision(2)
+      << std::setw(8) << result.messages << " | "sv
+      << std::setw(7) << seconds << " | "sv
+      << std::setw(10) << (double) result.messages / seconds << " | "sv
+      << std::setw(9) << result.max_queue_depth << " | "sv
+      << std::setw(10) << result.mean_queue_depth << std::endl
+      << std::endl
+      << "input    | injections | p50 us | p95 us | p99 us | max us"sv << std::endl;
+
+    for (auto &session : input_latency::snapshot()) {
+      if (session.session_id != REPLAY_SESSION_ID) {
+        continue;
+      }
+
+      for (std::size_t type = 0; type < session.histograms.size(); ++type) {
+        auto &histogram = session.histograms[type];
+        if (!histogram.count()) {
+          continue;
+        }
+
+        std::cout
+          << std::left << std::setw(8) << input_latency::type_name((input_latency::type_e) type) << " | "sv
+          << std::right
+          << std::setw(10) << histogram.count() << " | "sv
+          << std::setw(6) << histogram.percentile(50) << " | "sv
+          << std::setw(6) << histogram.percentile(95) << " | "sv
+          << std::setw(6) << histogram.percentile(99) << " | "sv
+          << std::setw(6) << histogram.max() << std::endl;
+      }
+    }
+    std::cout << std::endl;
+
+    return 0;
+  }
+}  // namespace input_capture
@@ -0,0 +1,133 @@
+/**
+ * @file src/input_capture.h
+ * @brief Declarations for recording and replaying the input messages of the clients.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "input.h"
+
+namespace input_capture {
+  /// The first bytes of a capture file
+  constexpr std::string_view MAGIC {"SUNINPT", 8};
+
+  /// The version of the layout of the records, files of another version aren't read
+  constexpr std::uint32_t VERSION = 1;
+
+  /**
+   * @brief An input message read from a capture file.
+   * @details The messages point into the file loaded by capture_t, they live as long as it does.
+   */
+  struct record_t {
+    /// When the message was received, from the receipt of the first message of the file
+    std::chrono::nanoseconds timestamp;
+
+    /// The resolution of the client's stream, the touch port the absolute positions are relative to
+    int width;
+    int height;
+
+    /// The decrypted message, starting with its NV_INPUT_HEADER
+    std::string_view data;
+  };
+
+  /**
+   * @brief Appends the input messages of the clients to a capture file.
+   * @details The file is replaced when the writer is opened.
+   * @warning The file holds everything the clients typed, passwords included.
+   */
+  class writer_t {
+  public:
+    /**
+     * @param path The capture file.
+     */
+    explicit writer_t(const std::filesystem::path &path);
+
+    /**
+     * @brief Check whether the file could be opened and all the messages were written so far.
+     */
+    explicit operator bool() const {
+      return (bool) _file;
+    }
+
+    /**
+     * @brief Append a message.
+     * @param message The decrypted message, as it's handed to input::passthrough().
+     * @param width The width of the client's stream.
+     * @param height The height of the client's stream.
+     * @param received When the message was received.
+     * @return `false` if it couldn't be written.
+     */
+    bool write(std::span<const std::uint8_t> message, int width, int height, std::chrono::steady_clock::time_point received);
+
+  private:
+    std::ofstream _file;
+
+    // The receipt of the first message, the timestamps of the file count from it
+    std::optional<std::chrono::steady_clock::time_point> _epoch;
+  };
+
+  /**
+   * @brief A capture file loaded in memory.
+   */
+  class capture_t {
+  public:
+    /**
+     * @brief Load a capture file.
+     * @param path The file.
+     * @return The capture, or `std::nullopt` if the file couldn't be read or isn't a capture file.
+     */
+    static std::optional<capture_t> load(const std::filesystem::path &path);
+
+    [[nodiscard]] const std::vector<record_t> &records() const {
+      return _records;
+    }
+
+  private:
+    // The records point into it, it's never resized after they're parsed
+    std::vector<char> _contents;
+    std::vector<record_t> _records;
+  };
+
+  /**
+   * @brief What the replay of a capture measured.
+   */
+  struct replay_result_t {
+    std::size_t messages = 0;  ///< The messages queued
+    std::chrono::steady_clock::duration duration {};  ///< From queueing the first message until the queue drained
+    std::size_t max_queue_depth = 0;  ///< The most messages waiting in the queue after queueing one
+    double mean_queue_depth = 0;  ///< The average of the messages waiting in the queue after queueing one
+  };
+
+  /**
+   * @brief Queue the messages of a capture to an input context, at their original timing sped up by a factor.
+   * @details The messages go through the same batching and dispatch as the ones of a client, to the platform backends.
+   *          The latency of their injection is counted in the input_latency session of the context.
+   * @param capture The capture.
+   * @param input The input context.
+   * @param resolution_changed Called before the first message and whenever the resolution of the messages changes,
+   *                           to raise the matching touch port.
+   * @param speed The factor the original timing is sped up by, 0 to queue the messages without waiting.
+   * @return The measures, once every message was taken off the queue.
+   */
+  replay_result_t replay(const capture_t &capture, std::shared_ptr<input::input_t> &input, const std::function<void(int width, int height)> &resolution_changed, double speed);
+
+  /**
+   * @brief Replay a capture file into the platform backends, then print the throughput, queue depth and latency.
+   * @details The input backends must be initialized.
+   * @param path The capture file.
+   * @param speed The factor the original timing is sped up by, 0 to queue the messages without waiting.
+   * @return 0 if the capture was replayed, -1 otherwise.
+   */
+  int measure(const std::filesystem::path &path, double speed);
+}  // namespace input_capture
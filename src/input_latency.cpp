@@ -0,0 +1,139 @@
+/**
+ * @file src/input_latency.cpp
+ * @brief Definitions for the latency of the input of the clients.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+// local includes
+#include "input_latency.h"
+
+namespace input_latency {
+  namespace {
+    std::mutex sessions_lock;
+    std::vector<std::weak_ptr<session_t>> sessions;
+
+    std::size_t bucket_of(std::uint32_t us) {
+      if (us < 16) {
+        return us;
+      }
+
+      // The 3 bits after the most significant one pick the bucket within its power of two
+      auto msb = (unsigned) std::bit_width(us) - 1;
+      auto shift = msb - 3;
+      return 16 + (msb - 4) * 8 + ((us >> shift) - 8);
+    }
+
+    std::uint32_t highest_of(std::size_t bucket) {
+      if (bucket < 16) {
+        return (std::uint32_t) bucket;
+      }
+
+      auto msb = (bucket - 16) / 8 + 4;
+      auto sub = (bucket - 16) % 8;
+      return (std::uint32_t) ((((std::uint64_t) 9 + sub) << (msb - 3)) - 1);
+    }
+  }  // namespace
+
+  const char *type_name(type_e type) {
+    switch (type) {
+      case type_e::mouse:
+        return "mouse";
+      case type_e::keyboard:
+        return "keyboard";
+      case type_e::gamepad:
+        return "gamepad";
+      case type_e::touch:
+        return "touch";
+      case type_e::pen:
+        return "pen";
+      default:
+        return "unknown";
+    }
+  }
+
+  void histogram_t::record(std::uint32_t us) {
+    ++_buckets[bucket_of(us)];
+    ++_count;
+    _max = std::max(_max, us);
+  }
+
+  std::uint32_t histogram_t::percentile(double percentile) const {
+    if (!_count) {
+      return 0;
+    }
+
+    auto rank = std::max<std::uint64_t>((std::uint64_t) std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * (double) _count), 1);
+
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+      seen += _buckets[bucket];
+      if (seen >= rank) {
+        // The bucket of the largest value doesn't go past it
+        return std::min(highest_of(bucket), _max);
+      }
+    }
+
+    return _max;
+  }
+
+  std::uint64_t histogram_t::count() const {
+    return _count;
+  }
+
+  std::uint32_t histogram_t::max() const {
+    return _max;
+  }
+
+  session_t::session_t(std::uint32_t session_id):
+      _session_id {session_id} {
+  }
+
+  void session_t::record(type_e type, std::chrono::steady_clock::duration latency) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+    std::lock_guard lg {_lock};
+    _histograms[(std::size_t) type].record((std::uint32_t) std::clamp<std::int64_t>(us, 0, UINT32_MAX));
+  }
+
+  session_t::snapshot_t session_t::snapshot() {
+    std::lock_guard lg {_lock};
+    return {_session_id, _histograms};
+  }
+
+  std::shared_ptr<session_t> start_session(std::uint32_t session_id) {
+    auto session = std::make_shared<session_t>(session_id);
+
+    std::lock_guard lg {sessions_lock};
+
+    // Forget the sessions that ended
+    std::erase_if(sessions, [](const auto &session) {
+      return session.expired();
+    });
+    sessions.emplace_back(session);
+
+    return session;
+  }
+
+  std::vector<session_t::snapshot_t> snapshot() {
+    std::vector<std::shared_ptr<session_t>> alive;
+    {
+      std::lock_guard lg {sessions_lock};
+      for (auto &weak_session : sessions) {
+        if (auto session = weak_session.lock()) {
+          alive.emplace_back(std::move(session));
+        }
+      }
+    }
+
+    std::vector<session_t::snapshot_t> result;
+    result.reserve(alive.size());
+    for (auto &session : alive) {
+      result.emplace_back(session->snapshot());
+    }
+
+    return result;
+  }
+}  // namespace input_latency
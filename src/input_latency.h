@@ -0,0 +1,127 @@
+/**
+ * @file src/input_latency.h
+ * @brief Declarations for the latency of the input of the clients.
+ */
+#pragma once
+
+// standard includes
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace input_latency {
+  /**
+   * @brief The kinds of input messages the latency is tracked for.
+   */
+  enum class type_e : std::size_t {
+    mouse,  ///< Mouse moves, buttons and scrolling
+    keyboard,  ///< Keys and text
+    gamepad,  ///< Gamepad state, touch, motion and battery
+    touch,  ///< Touch contacts
+    pen,  ///< Pen contacts
+    MAX_TYPES  ///< The number of types
+  };
+
+  /**
+   * @brief Get the name of a type of input.
+   * @param type The type.
+   * @return The name.
+   */
+  const char *type_name(type_e type);
+
+  /**
+   * @brief A histogram of latencies in microseconds with log-linear buckets.
+   * @details Like an HDR histogram, values up to 16us have a bucket each, and each power of two above
+   *          is split in 8 buckets, so a percentile is within 12.5% of the recorded values.
+   */
+  class histogram_t {
+  public:
+    /// The number of buckets, enough for values of 32 bits
+    static constexpr std::size_t BUCKETS = 16 + 28 * 8;
+
+    /**
+     * @brief Record a value.
+     * @param us The value in microseconds.
+     */
+    void record(std::uint32_t us);
+
+    /**
+     * @brief Get a percentile of the recorded values.
+     * @param percentile The percentile, from 0 to 100.
+     * @return The highest value of the bucket the percentile falls in, 0 if nothing was recorded.
+     */
+    std::uint32_t percentile(double percentile) const;
+
+    /**
+     * @brief Get the number of recorded values.
+     * @return The count.
+     */
+    std::uint64_t count() const;
+
+    /**
+     * @brief Get the largest recorded value.
+     * @return The value in microseconds.
+     */
+    std::uint32_t max() const;
+
+  private:
+    std::array<std::uint32_t, BUCKETS> _buckets {};
+    std::uint64_t _count {};
+    std::uint32_t _max {};
+  };
+
+  /**
+   * @brief The latency of a session, from the receipt of its input messages to their injection in the OS.
+   */
+  class session_t {
+  public:
+    /**
+     * @param session_id The launch session id, the same as the one of the frame traces.
+     */
+    explicit session_t(std::uint32_t session_id);
+
+    /**
+     * @brief Record the latency of an input message.
+     * @param type The type of the message.
+     * @param latency The time from the receipt of the message to its injection.
+     */
+    void record(type_e type, std::chrono::steady_clock::duration latency);
+
+    /**
+     * @brief A copy of the histograms of a session.
+     */
+    struct snapshot_t {
+      std::uint32_t session_id;
+      std::array<histogram_t, (std::size_t) type_e::MAX_TYPES> histograms;
+    };
+
+    /**
+     * @brief Get a copy of the histograms.
+     * @return The copy.
+     */
+    snapshot_t snapshot();
+
+  private:
+    std::uint32_t _session_id;
+
+    std::mutex _lock;
+    std::array<histogram_t, (std::size_t) type_e::MAX_TYPES> _histograms;
+  };
+
+  /**
+   * @brief Start tracking the latency of a session.
+   * @param session_id The launch session id.
+   * @return The latency of the session, it's no longer listed once it's destroyed.
+   */
+  std::shared_ptr<session_t> start_session(std::uint32_t session_id);
+
+  /**
+   * @brief Get the histograms of the sessions being tracked.
+   * @return The histograms.
+   */
+  std::vector<session_t::snapshot_t> snapshot();
+}  // namespace input_latency
@@ -3,9 +3,15 @@
  * @brief Definitions for logging related functions.
  */
 // standard includes
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string_view>
+#include <thread>
 
 // lib includes
 #include <boost/core/null_deleter.hpp>
@@ -15,6 +21,7 @@
 #include <boost/log/expressions.hpp>
 #include <boost/log/sinks.hpp>
 #include <boost/log/sources/severity_logger.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
 #include <display_device/logging.h>
 
 // local includes
@@ -28,7 +35,7 @@ using namespace std::literals;
 
 namespace bl = boost::log;
 
-boost::shared_ptr<boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>> sink;
+boost::shared_ptr<text_sink> sink;
 
 bl::sources::severity_logger<int> verbose(0);  // Dominating output
 bl::sources::severity_logger<int> debug(1);  // Follow what is happening
@@ -43,11 +50,141 @@ bl::sources::severity_logger<int> tests(10);  // Automatic tests output
 BOOST_LOG_ATTRIBUTE_KEYWORD(severity, "Severity", int)
 
 namespace logging {
+  std::atomic<int> min_level {0};
+  std::atomic<std::uint64_t> dropped_records {0};
+
+  void text_backend_t::consume(const boost::log::record_view &rec, const string_type &formatted_message) {
+    bl::sinks::text_ostream_backend::consume(rec, formatted_message);
+
+    // The process may not live to the next batch
+    auto log_level = rec.attribute_values()["Severity"].extract<int>();
+    if (log_level && *log_level >= level::error && *log_level <= level::fatal) {
+      flush();
+    }
+  }
+
+  namespace {
+    // The other records reach the log file this late at most, each flush is a write of its own
+    constexpr auto LOG_FLUSH_INTERVAL = 250ms;
+
+    // Flushes the log streams in batches, and reports the records that were dropped meanwhile
+    std::thread flush_thread;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    bool flush_stop = false;
+
+    void start_flush_thread(boost::shared_ptr<text_sink> flushed_sink) {
+      flush_stop = false;
+      flush_thread = std::thread {[flushed_sink = std::move(flushed_sink)]() {
+        std::uint64_t reported_drops = 0;
+
+        std::unique_lock lock {flush_mutex};
+        while (!flush_cv.wait_for(lock, LOG_FLUSH_INTERVAL, []() {
+          return flush_stop;
+        })) {
+          lock.unlock();
+          flushed_sink->locked_backend()->flush();
+
+          if (auto drops = dropped_records.load(std::memory_order_relaxed); drops != reported_drops) {
+            BOOST_LOG(warning) << "Dropped "sv << drops - reported_drops << " log records, logging fell behind"sv;
+            reported_drops = drops;
+          }
+          lock.lock();
+        }
+      }};
+    }
+
+    void stop_flush_thread() {
+      if (!flush_thread.joinable()) {
+        return;
+      }
+
+      {
+        std::lock_guard lock {flush_mutex};
+        flush_stop = true;
+      }
+      flush_cv.notify_all();
+      flush_thread.join();
+    }
+
+    // Enough for the troubleshooting page to show what led up to an error
+    constexpr std::size_t RECENT_LOG_LINES = 2000;
+
+    /**
+     * @brief Keeps the last lines written to it, the sink writes to it like to the log file.
+     */
+    class recent_lines_buf_t: public std::streambuf {
+    public:
+      std::vector<log_line_t> lines_after(std::uint64_t after) {
+        std::lock_guard lock {lines_mutex};
+
+        std::vector<log_line_t> result;
+        for (auto &line : lines) {
+          if (line.sequence > after) {
+            result.emplace_back(line);
+          }
+        }
+
+        return result;
+      }
+
+      void reset() {
+        std::lock_guard lock {lines_mutex};
+        lines.clear();
+        partial_line.clear();
+        sequence = 0;
+      }
+
+    protected:
+      int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+          auto ch = traits_type::to_char_type(c);
+          xsputn(&ch, 1);
+        }
+
+        return traits_type::not_eof(c);
+      }
+
+      std::streamsize xsputn(const char *s, std::streamsize n) override {
+        std::string_view text {s, (std::size_t) n};
+
+        std::lock_guard lock {lines_mutex};
+        while (!text.empty()) {
+          auto end = text.find('\n');
+          if (end == std::string_view::npos) {
+            partial_line += text;
+            break;
+          }
+
+          partial_line += text.substr(0, end);
+          lines.push_back({++sequence, std::move(partial_line)});
+          partial_line.clear();
+          if (lines.size() > RECENT_LOG_LINES) {
+            lines.pop_front();
+          }
+
+          text.remove_prefix(end + 1);
+        }
+
+        return n;
+      }
+
+    private:
+      std::mutex lines_mutex;
+      std::deque<log_line_t> lines;
+      std::string partial_line;
+      std::uint64_t sequence = 0;
+    };
+
+    recent_lines_buf_t recent_lines_buf;
+  }  // namespace
+
   deinit_t::~deinit_t() {
     deinit();
   }
 
   void deinit() {
+    stop_flush_thread();
     log_flush();
     bl::core::get()->remove_sink(sink);
     sink.reset();
@@ -114,14 +251,19 @@ namespace logging {
     sink->locked_backend()->add_stream(stream);
 #endif
     sink->locked_backend()->add_stream(boost::make_shared<std::ofstream>(log_file));
+    recent_lines_buf.reset();
+    sink->locked_backend()->add_stream(boost::make_shared<std::ostream>(&recent_lines_buf));
     sink->set_filter(severity >= min_log_level);
+    min_level.store(min_log_level, std::memory_order_relaxed);
     sink->set_formatter(&formatter);
 
-    // Flush after each log record to ensure log file contents on disk isn't stale.
-    // This is particularly important when running from a Windows service.
-    sink->locked_backend()->auto_flush(true);
+    // Flushing each record would cost a write on the sink's thread per line, so they're flushed in batches.
+    // The log file on disk still stays recent, which matters when running from a Windows service.
+    sink->locked_backend()->auto_flush(false);
+    dropped_records.store(0, std::memory_order_relaxed);
 
     bl::core::get()->add_sink(sink);
+    start_flush_thread(sink);
     return std::make_unique<deinit_t>();
   }
 
@@ -189,6 +331,10 @@ namespace logging {
     }
   }
 
+  std::vector<log_line_t> recent_log_lines(std::uint64_t after) {
+    return recent_lines_buf.lines_after(after);
+  }
+
   void print_help(const char *name) {
     std::cout
       << "Usage: "sv << name << " [options] [/path/to/configuration_file] [--cmd]"sv << std::endl
@@ -197,7 +343,10 @@ namespace logging {
       << "    Note: The configuration will be created if it doesn't exist."sv << std::endl
       << std::endl
       << "    --help                    | print help"sv << std::endl
+      << "    --benchmark-encoders [n]  | measure the encoders with n frames per run, 300 by default"sv << std::endl
+      << "    --capture-latency [s] [f] | measure the capture latency for s seconds at f fps, 10 and 60 by default"sv << std::endl
       << "    --creds username password | set user credentials for the Web manager"sv << std::endl
+      << "    --replay-input file [x]   | replay the recorded input at x times its speed, 1 by default, 0 without waiting"sv << std::endl
       << "    --version                 | print the version of sunshine"sv << std::endl
       << std::endl
       << "    flags"sv << std::endl
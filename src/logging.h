@@ -4,11 +4,58 @@
  */
 #pragma once
 
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
 // lib includes
 #include <boost/log/common.hpp>
 #include <boost/log/sinks.hpp>
+#include <boost/log/sinks/bounded_fifo_queue.hpp>
+
+namespace logging {
+  /**
+   * @brief The records dropped since init() because the queue of the sink was full.
+   */
+  extern std::atomic<std::uint64_t> dropped_records;
+
+  /**
+   * @brief Writes the records to the log streams, only flushing them right away for errors.
+   * @details The other records are flushed in batches by a thread of the logging system,
+   *          or once the buffer of the log file fills up.
+   */
+  class text_backend_t: public boost::log::sinks::text_ostream_backend {
+  public:
+    void consume(const boost::log::record_view &rec, const string_type &formatted_message);
+  };
 
-using text_sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>;
+  /**
+   * @brief Drops and counts the records that don't fit the queue of the sink, so logging never blocks the thread.
+   */
+  class count_dropped_on_overflow_t {
+  public:
+    template<typename LockT>
+    static bool on_overflow(const boost::log::record_view &, LockT &) {
+      dropped_records.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    static void on_queue_space_available() {
+    }
+
+    static void interrupt() {
+    }
+  };
+
+  /**
+   * @brief The records waiting for the sink before the next ones are dropped.
+   */
+  constexpr std::size_t MAX_QUEUED_RECORDS = 16384;
+}  // namespace logging
+
+using text_sink = boost::log::sinks::asynchronous_sink<logging::text_backend_t, boost::log::sinks::bounded_fifo_queue<logging::MAX_QUEUED_RECORDS, logging::count_dropped_on_overflow_t>>;
 
 extern boost::log::sources::severity_logger<int> verbose;
 extern boost::log::sources::severity_logger<int> debug;
@@ -21,12 +68,59 @@ extern boost::log::sources::severity_logger<int> tests;
 #endif
 
 #include "config.h"
+#include "metrics.h"
 #include "stat_trackers.h"
 
+#ifndef SUNSHINE_MIN_COMPILED_LOG_LEVEL
+  /**
+   * @brief The records of SUNSHINE_HOT_LOG below this level are left out of the build.
+   */
+  #define SUNSHINE_MIN_COMPILED_LOG_LEVEL 0
+#endif
+
+/**
+ * @brief Log from a hot path, like the loops sending each packet.
+ * @details The record is compiled out when its level is below SUNSHINE_MIN_COMPILED_LOG_LEVEL. Otherwise a
+ *          relaxed load of the level of the log skips it, before Boost.Log looks up any attribute or filter.
+ * @param severity The name of the severity logger: verbose, debug, info, warning, error or fatal.
+ * @examples
+ * SUNSHINE_HOT_LOG(verbose) << "Sent packet "sv << sequence_number;
+ * @examples_end
+ */
+#define SUNSHINE_HOT_LOG(severity) \
+  for (bool sunshine_hot_log_once = logging::level::severity >= SUNSHINE_MIN_COMPILED_LOG_LEVEL && logging::is_logged(logging::level::severity); sunshine_hot_log_once; sunshine_hot_log_once = false) \
+  BOOST_LOG(severity)
+
 /**
  * @brief Handles the initialization and deinitialization of the logging system.
  */
 namespace logging {
+  /**
+   * @brief The levels of the severity loggers.
+   */
+  namespace level {
+    constexpr int verbose = 0;
+    constexpr int debug = 1;
+    constexpr int info = 2;
+    constexpr int warning = 3;
+    constexpr int error = 4;
+    constexpr int fatal = 5;
+  }  // namespace level
+
+  /**
+   * @brief The lowest level written to the log, set by init().
+   */
+  extern std::atomic<int> min_level;
+
+  /**
+   * @brief Check whether records of a level are written to the log.
+   * @param level The level of the records.
+   * @return `true` if the records are written.
+   */
+  inline bool is_logged(int level) {
+    return level >= min_level.load(std::memory_order_relaxed);
+  }
+
   class deinit_t {
   public:
     /**
@@ -70,12 +164,32 @@ namespace logging {
 
   /**
    * @brief Flush the log.
+   * @details Writes the queued records and flushes the streams, call it before the process may end.
    * @examples
    * log_flush();
    * @examples_end
    */
   void log_flush();
 
+  /**
+   * @brief A line of the log, kept in memory with the other recent ones.
+   */
+  struct log_line_t {
+    std::uint64_t sequence;  ///< Counts the lines written since init(), from 1
+    std::string text;
+  };
+
+  /**
+   * @brief Get the most recent lines of the log.
+   * @details The lines are kept as they're written to the log file, only the last ones stay in memory.
+   * @param after The sequence number of the last line the caller already has, 0 for all the lines kept.
+   * @return The lines written after it, oldest first.
+   * @examples
+   * auto lines = recent_log_lines(last_sequence);
+   * @examples_end
+   */
+  std::vector<log_line_t> recent_log_lines(std::uint64_t after = 0);
+
   /**
    * @brief Print help to stdout.
    * @param name The name of the program.
@@ -95,7 +209,7 @@ namespace logging {
    * // after 5 seconds
    * logger.collect_and_log(3);
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test time value (min/max/avg): 1ms/3ms/2.00ms
+   * // [2024:01:01:12:00:00]: Debug: Test time value (min/max/avg): 1ms/3ms/2.00ms (p50/p95/p99/p99.9): 2.00ms/3.00ms/3.00ms/3.00ms
    * @examples_end
    */
   template<typename T>
@@ -110,28 +224,51 @@ namespace logging {
     }
 
     void collect_and_log(const T &value) {
+      if (summary) {
+        summary->observe(value * summary_scale);
+      }
+
       if (enabled) {
         auto print_info = [&](const T &min_value, const T &max_value, double avg_value) {
           auto f = stat_trackers::two_digits_after_decimal();
+          auto p = [&](double percent) {
+            return stat_trackers::two_digits_after_decimal() % percentiles.percentile(percent);
+          };
+
           if constexpr (std::is_floating_point_v<T>) {
-            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << f % min_value << units << "/" << f % max_value << units << "/" << f % avg_value << units;
+            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << f % min_value << units << "/" << f % max_value << units << "/" << f % avg_value << units
+                                      << " (p50/p95/p99/p99.9): " << p(50) << units << "/" << p(95) << units << "/" << p(99) << units << "/" << p(99.9) << units;
           } else {
-            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << min_value << units << "/" << max_value << units << "/" << f % avg_value << units;
+            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << min_value << units << "/" << max_value << units << "/" << f % avg_value << units
+                                      << " (p50/p95/p99/p99.9): " << p(50) << units << "/" << p(95) << units << "/" << p(99) << units << "/" << p(99.9) << units;
           }
+          percentiles.reset();
         };
         tracker.collect_and_callback_on_interval(value, print_info, interval);
+        percentiles.collect(value);
       }
     }
 
     void collect_and_log(std::function<T()> func) {
-      if (enabled) {
+      if (is_collecting()) {
         collect_and_log(func());
       }
     }
 
+    /**
+     * @brief Also record every value in a summary, whether the logger is enabled or not.
+     * @param summary The summary to record the values in.
+     * @param scale The factor converting the units of the logger to the ones of the summary.
+     */
+    void export_to(std::shared_ptr<metrics::summary_t> summary, double scale = 1) {
+      this->summary = std::move(summary);
+      summary_scale = scale;
+    }
+
     void reset() {
       if (enabled) {
         tracker.reset();
+        percentiles.reset();
       }
     }
 
@@ -139,6 +276,14 @@ namespace logging {
       return enabled;
     }
 
+    /**
+     * @brief Check whether the values are used, by the log or by a summary.
+     * @return `true` if the values should be collected.
+     */
+    bool is_collecting() const {
+      return enabled || summary;
+    }
+
   private:
     std::reference_wrapper<boost::log::sources::severity_logger<int>> severity;
     std::string message;
@@ -146,6 +291,9 @@ namespace logging {
     std::chrono::seconds interval;
     bool enabled;
     stat_trackers::min_max_avg_tracker<T> tracker;
+    stat_trackers::histogram_tracker percentiles;
+    std::shared_ptr<metrics::summary_t> summary;
+    double summary_scale = 1;
   };
 
   /**
@@ -160,7 +308,7 @@ namespace logging {
    * // ...
    * logger.second_point_now_and_log();
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms
+   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms (p50/p95/p99/p99.9): 2.29ms/3.19ms/3.19ms/3.19ms
    * @examples_end
    */
   class time_delta_periodic_logger {
@@ -170,25 +318,25 @@ namespace logging {
     }
 
     void first_point(const std::chrono::steady_clock::time_point &point) {
-      if (logger.is_enabled()) {
+      if (logger.is_collecting()) {
         point1 = point;
       }
     }
 
     void first_point_now() {
-      if (logger.is_enabled()) {
+      if (logger.is_collecting()) {
         first_point(std::chrono::steady_clock::now());
       }
     }
 
     void second_point_and_log(const std::chrono::steady_clock::time_point &point) {
-      if (logger.is_enabled()) {
+      if (logger.is_collecting()) {
         logger.collect_and_log(std::chrono::duration<double, std::milli>(point - point1).count());
       }
     }
 
     void second_point_now_and_log() {
-      if (logger.is_enabled()) {
+      if (logger.is_collecting()) {
         second_point_and_log(std::chrono::steady_clock::now());
       }
     }
@@ -203,6 +351,14 @@ namespace logging {
       return logger.is_enabled();
     }
 
+    /**
+     * @brief Also record every duration in a summary, in seconds.
+     * @param summary The summary to record the durations in.
+     */
+    void export_to(std::shared_ptr<metrics::summary_t> summary) {
+      logger.export_to(std::move(summary), 1. / 1000);
+    }
+
   private:
     std::chrono::steady_clock::time_point point1 = std::chrono::steady_clock::now();
     min_max_avg_periodic_logger<double> logger;
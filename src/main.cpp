@@ -6,6 +6,7 @@
 #include <codecvt>
 #include <csignal>
 #include <fstream>
+#include <future>
 #include <iostream>
 
 // local includes
@@ -42,12 +43,21 @@ void on_signal(int sig, FN &&fn) {
 }
 
 std::map<std::string_view, std::function<int(const char *name, int argc, char **argv)>> cmd_to_func {
+  {"benchmark-encoders"sv, [](const char *name, int argc, char **argv) {
+     return args::benchmark_encoders(name, argc, argv);
+   }},
+  {"capture-latency"sv, [](const char *name, int argc, char **argv) {
+     return args::capture_latency(name, argc, argv);
+   }},
   {"creds"sv, [](const char *name, int argc, char **argv) {
      return args::creds(name, argc, argv);
    }},
   {"help"sv, [](const char *name, int argc, char **argv) {
      return args::help(name);
    }},
+  {"replay-input"sv, [](const char *name, int argc, char **argv) {
+     return args::replay_input(name, argc, argv);
+   }},
   {"version"sv, [](const char *name, int argc, char **argv) {
      return args::version();
    }},
@@ -67,6 +77,10 @@ LRESULT CALLBACK SessionMonitorWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, L
     case WM_DESTROY:
       PostQuitMessage(0);
       return 0;
+    case WM_DISPLAYCHANGE:
+      // The displays were added, removed or changed modes
+      display_device::invalidate_topology();
+      return 0;
     case WM_ENDSESSION:
       {
         // Terminate ourselves with a blocking exit call
@@ -107,7 +121,7 @@ int main(int argc, char *argv[]) {
   std::locale::global(std::locale(std::locale(), new std::codecvt_utf8<wchar_t>));
 #pragma GCC diagnostic pop
 
-  mail::man = std::make_shared<safe::mail_raw_t>();
+  mail::man = std::make_shared<safe::mail_raw_t>(mail::queue_options());
 
   // parse config file
   if (config::parse(argc, argv)) {
@@ -244,7 +258,17 @@ int main(int argc, char *argv[]) {
 
 #endif
 
+  // Each lane has threads of its own, so a slow background task can't hold up the input or the timers
   task_pool.start(1);
+  input_pool.start(1);
+  background_pool.start(2);
+
+  // The timers and the input are latency sensitive
+  for (auto pool : {&task_pool, &input_pool}) {
+    pool->post([]() {
+      platf::adjust_thread_priority(platf::thread_priority_e::high);
+    });
+  }
 
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
   // create tray thread and detach it
@@ -286,6 +310,9 @@ int main(int argc, char *argv[]) {
   SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
 #endif
 
+  // Generating the credentials of a new host takes a while, the rest starts meanwhile
+  auto sync_creds = std::async(std::launch::async, http::init_creds);
+
   proc::refresh(config::stream.file_apps);
 
   // If any of the following fail, we log an error and continue event though sunshine will not function correctly.
@@ -308,20 +335,12 @@ int main(int argc, char *argv[]) {
     BOOST_LOG(warning) << "No gamepad input is available"sv;
   }
 
-  if (video::probe_encoders()) {
-    BOOST_LOG(error) << "Video failed to find working encoder"sv;
-  }
-
-  if (http::init()) {
-    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
-
-#ifdef _WIN32
-    BOOST_LOG(fatal) << "To relaunch Sunshine successfully, use the shortcut in the Start Menu. Do not run Sunshine.exe manually."sv;
-    std::this_thread::sleep_for(10s);
-#endif
-
-    return -1;
-  }
+  // Probing the encoders takes the longest, the servers start meanwhile and tell clients to retry until it's done
+  auto sync_encoders = std::async(std::launch::async, []() {
+    if (video::probe_encoders()) {
+      BOOST_LOG(error) << "Video failed to find working encoder"sv;
+    }
+  });
 
   std::unique_ptr<platf::deinit_t> mDNS;
   auto sync_mDNS = std::async(std::launch::async, [&mDNS]() {
@@ -333,6 +352,17 @@ int main(int argc, char *argv[]) {
     upnp_unmap = upnp::start();
   });
 
+  if (sync_creds.get() || http::init()) {
+    BOOST_LOG(fatal) << "HTTP interface failed to initialize"sv;
+
+#ifdef _WIN32
+    BOOST_LOG(fatal) << "To relaunch Sunshine successfully, use the shortcut in the Start Menu. Do not run Sunshine.exe manually."sv;
+    std::this_thread::sleep_for(10s);
+#endif
+
+    return -1;
+  }
+
   // FIXME: Temporary workaround: Simple-Web_server needs to be updated or replaced
   if (shutdown_event->peek()) {
     return lifetime::desired_exit_code;
@@ -354,8 +384,12 @@ int main(int argc, char *argv[]) {
   httpThread.join();
   configThread.join();
 
-  task_pool.stop();
-  task_pool.join();
+  for (auto pool : {&task_pool, &input_pool, &background_pool}) {
+    pool->stop();
+  }
+  for (auto pool : {&task_pool, &input_pool, &background_pool}) {
+    pool->join();
+  }
 
   // stop system tray
 #if defined SUNSHINE_TRAY && SUNSHINE_TRAY >= 1
@@ -0,0 +1,400 @@
+/**
+ * @file src/metrics.cpp
+ * @brief Definitions for the metrics exported in the Prometheus text format.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <variant>
+
+// local includes
+#include "metrics.h"
+
+namespace metrics {
+  namespace {
+    struct probe_t {
+      std::function<double()> read;
+    };
+
+    using metric_t = std::variant<std::weak_ptr<counter_t>, std::weak_ptr<gauge_t>, std::weak_ptr<histogram_t>, std::weak_ptr<summary_t>, std::weak_ptr<probe_t>>;
+    using live_metric_t = std::variant<std::shared_ptr<counter_t>, std::shared_ptr<gauge_t>, std::shared_ptr<histogram_t>, std::shared_ptr<summary_t>, std::shared_ptr<probe_t>>;
+
+    /// The quantiles of the summaries
+    constexpr std::array QUANTILES {0.5, 0.95, 0.99, 0.999};
+
+    struct series_t {
+      labels_t labels;
+      metric_t metric;
+    };
+
+    struct family_t {
+      std::string help;
+      type_e type;
+      std::vector<series_t> series;
+    };
+
+    // Only taken to add a series and to render them, never to update one
+    std::mutex registry_lock;
+    std::map<std::string, family_t, std::less<>> families;
+
+    template<class T, class... Args>
+    std::shared_ptr<T> find_or_add(std::string_view name, std::string_view help, type_e type, labels_t labels, Args &&...args) {
+      std::lock_guard lg {registry_lock};
+
+      auto family_it = families.find(name);
+      if (family_it == std::end(families)) {
+        family_it = families.emplace(std::string {name}, family_t {std::string {help}, type, {}}).first;
+      }
+      auto &series = family_it->second.series;
+
+      // Forget the series nobody updates anymore, like the ones of the sessions that ended
+      std::erase_if(series, [](const series_t &series) {
+        return std::visit([](auto &weak) {
+          return weak.expired();
+        },
+                          series.metric);
+      });
+
+      if constexpr (!std::is_same_v<T, probe_t>) {
+        for (auto &existing : series) {
+          if (existing.labels != labels) {
+            continue;
+          }
+
+          if (auto weak = std::get_if<std::weak_ptr<T>>(&existing.metric)) {
+            if (auto metric = weak->lock()) {
+              return metric;
+            }
+          }
+        }
+      }
+
+      auto metric = std::make_shared<T>(std::forward<Args>(args)...);
+      series.push_back({std::move(labels), std::weak_ptr<T> {metric}});
+
+      return metric;
+    }
+
+    std::string escape_label_value(const std::string &value) {
+      std::string escaped;
+      escaped.reserve(value.size());
+
+      for (auto ch : value) {
+        switch (ch) {
+          case '\\':
+            escaped += "\\\\";
+            break;
+          case '"':
+            escaped += "\\\"";
+            break;
+          case '\n':
+            escaped += "\\n";
+            break;
+          default:
+            escaped += ch;
+        }
+      }
+
+      return escaped;
+    }
+
+    std::string escape_help(const std::string &help) {
+      std::string escaped;
+      escaped.reserve(help.size());
+
+      for (auto ch : help) {
+        if (ch == '\\') {
+          escaped += "\\\\";
+        } else if (ch == '\n') {
+          escaped += "\\n";
+        } else {
+          escaped += ch;
+        }
+      }
+
+      return escaped;
+    }
+
+    void write_value(std::ostream &out, double value) {
+      if (std::isnan(value)) {
+        out << "NaN";
+      } else if (std::isinf(value)) {
+        out << (value > 0 ? "+Inf" : "-Inf");
+      } else {
+        out << value;
+      }
+    }
+
+    void write_labels(std::ostream &out, const labels_t &labels, const char *extra_name = nullptr, double extra_value = 0) {
+      if (labels.empty() && !extra_name) {
+        return;
+      }
+
+      out << '{';
+
+      bool first = true;
+      for (auto &[name, value] : labels) {
+        if (!first) {
+          out << ',';
+        }
+        first = false;
+
+        out << name << "=\"" << escape_label_value(value) << '"';
+      }
+
+      if (extra_name) {
+        if (!first) {
+          out << ',';
+        }
+
+        out << extra_name << "=\"";
+        write_value(out, extra_value);
+        out << '"';
+      }
+
+      out << '}';
+    }
+
+    struct live_series_t {
+      labels_t labels;
+      live_metric_t metric;
+    };
+
+    struct live_family_t {
+      std::string name;
+      std::string help;
+      type_e type;
+      std::vector<live_series_t> series;
+    };
+
+    /**
+     * @brief Hold the series still updated, forgetting the others.
+     * @details The probes may take locks of their own, so they are read after releasing the registry.
+     */
+    std::vector<live_family_t> live_families() {
+      std::vector<live_family_t> live_families;
+
+      std::lock_guard lg {registry_lock};
+
+      for (auto it = std::begin(families); it != std::end(families);) {
+        auto &[name, family] = *it;
+
+        live_family_t live {name, family.help, family.type, {}};
+        std::erase_if(family.series, [&live](const series_t &series) {
+          return std::visit([&](auto &weak) {
+            auto metric = weak.lock();
+            if (!metric) {
+              return true;
+            }
+
+            live.series.push_back({series.labels, live_metric_t {std::move(metric)}});
+            return false;
+          },
+                            series.metric);
+        });
+
+        if (family.series.empty()) {
+          it = families.erase(it);
+          continue;
+        }
+
+        live_families.emplace_back(std::move(live));
+        ++it;
+      }
+
+      return live_families;
+    }
+
+    const char *type_name(type_e type) {
+      switch (type) {
+        case type_e::counter:
+          return "counter";
+        case type_e::gauge:
+          return "gauge";
+        case type_e::histogram:
+          return "histogram";
+        case type_e::summary:
+          return "summary";
+      }
+
+      return "untyped";
+    }
+  }  // namespace
+
+  histogram_t::histogram_t(std::vector<double> bounds):
+      _bounds {std::move(bounds)},
+      _counts {std::make_unique<std::atomic<std::uint64_t>[]>(_bounds.size() + 1)} {
+  }
+
+  void histogram_t::observe(double value) {
+    // The bounds are inclusive, a value equal to a bound falls in its bucket
+    auto bucket = std::lower_bound(std::begin(_bounds), std::end(_bounds), value) - std::begin(_bounds);
+    _counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    auto sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+  }
+
+  std::vector<std::uint64_t> histogram_t::counts() const {
+    std::vector<std::uint64_t> counts(_bounds.size() + 1);
+    for (std::size_t x = 0; x < counts.size(); ++x) {
+      counts[x] = _counts[x].load(std::memory_order_relaxed);
+    }
+
+    return counts;
+  }
+
+  std::vector<double> exponential_buckets(double start, double factor, int count) {
+    std::vector<double> bounds;
+    bounds.reserve(count);
+
+    for (int x = 0; x < count; ++x) {
+      bounds.push_back(start);
+      start *= factor;
+    }
+
+    return bounds;
+  }
+
+  std::shared_ptr<counter_t> counter(std::string_view name, std::string_view help, labels_t labels) {
+    return find_or_add<counter_t>(name, help, type_e::counter, std::move(labels));
+  }
+
+  std::shared_ptr<gauge_t> gauge(std::string_view name, std::string_view help, labels_t labels) {
+    return find_or_add<gauge_t>(name, help, type_e::gauge, std::move(labels));
+  }
+
+  std::shared_ptr<histogram_t> histogram(std::string_view name, std::string_view help, std::vector<double> bounds, labels_t labels) {
+    return find_or_add<histogram_t>(name, help, type_e::histogram, std::move(labels), std::move(bounds));
+  }
+
+  std::shared_ptr<summary_t> summary(std::string_view name, std::string_view help, labels_t labels) {
+    return find_or_add<summary_t>(name, help, type_e::summary, std::move(labels));
+  }
+
+  std::shared_ptr<void> gauge_probe(std::string_view name, std::string_view help, labels_t labels, std::function<double()> read) {
+    return find_or_add<probe_t>(name, help, type_e::gauge, std::move(labels), std::move(read));
+  }
+
+  std::shared_ptr<void> counter_probe(std::string_view name, std::string_view help, labels_t labels, std::function<double()> read) {
+    return find_or_add<probe_t>(name, help, type_e::counter, std::move(labels), std::move(read));
+  }
+
+  std::string render() {
+    auto families = live_families();
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out << std::setprecision(std::numeric_limits<double>::digits10);
+
+    for (auto &family : families) {
+      out << "# HELP " << family.name << ' ' << escape_help(family.help) << '\n';
+      out << "# TYPE " << family.name << ' ' << type_name(family.type) << '\n';
+
+      for (auto &series : family.series) {
+        if (auto metric = std::get_if<std::shared_ptr<counter_t>>(&series.metric)) {
+          out << family.name;
+          write_labels(out, series.labels);
+          out << ' ' << (*metric)->value() << '\n';
+        } else if (auto metric = std::get_if<std::shared_ptr<gauge_t>>(&series.metric)) {
+          out << family.name;
+          write_labels(out, series.labels);
+          out << ' ';
+          write_value(out, (*metric)->value());
+          out << '\n';
+        } else if (auto metric = std::get_if<std::shared_ptr<probe_t>>(&series.metric)) {
+          out << family.name;
+          write_labels(out, series.labels);
+          out << ' ';
+          write_value(out, (*metric)->read());
+          out << '\n';
+        } else if (auto metric = std::get_if<std::shared_ptr<histogram_t>>(&series.metric)) {
+          auto &histogram = **metric;
+
+          // The count is the total of the buckets, so it always matches the last one
+          auto counts = histogram.counts();
+          std::uint64_t cumulative = 0;
+          for (std::size_t x = 0; x < counts.size(); ++x) {
+            cumulative += counts[x];
+
+            out << family.name << "_bucket";
+            write_labels(out, series.labels, "le", x < histogram.bounds().size() ? histogram.bounds()[x] : std::numeric_limits<double>::infinity());
+            out << ' ' << cumulative << '\n';
+          }
+
+          out << family.name << "_sum";
+          write_labels(out, series.labels);
+          out << ' ';
+          write_value(out, histogram.sum());
+          out << '\n';
+
+          out << family.name << "_count";
+          write_labels(out, series.labels);
+          out << ' ' << cumulative << '\n';
+        } else if (auto metric = std::get_if<std::shared_ptr<summary_t>>(&series.metric)) {
+          auto &tracker = (*metric)->tracker();
+
+          for (auto quantile : QUANTILES) {
+            out << family.name;
+            write_labels(out, series.labels, "quantile", quantile);
+            out << ' ';
+            write_value(out, tracker.percentile(quantile * 100));
+            out << '\n';
+          }
+
+          out << family.name << "_sum";
+          write_labels(out, series.labels);
+          out << ' ';
+          write_value(out, tracker.sum());
+          out << '\n';
+
+          out << family.name << "_count";
+          write_labels(out, series.labels);
+          out << ' ' << tracker.count() << '\n';
+        }
+      }
+    }
+
+    return out.str();
+  }
+
+  std::vector<sample_t> snapshot() {
+    std::vector<sample_t> samples;
+
+    for (auto &family : live_families()) {
+      for (auto &series : family.series) {
+        sample_t sample {family.name, series.labels, family.type, 0, 0};
+
+        if (auto metric = std::get_if<std::shared_ptr<counter_t>>(&series.metric)) {
+          sample.value = (double) (*metric)->value();
+        } else if (auto metric = std::get_if<std::shared_ptr<gauge_t>>(&series.metric)) {
+          sample.value = (*metric)->value();
+        } else if (auto metric = std::get_if<std::shared_ptr<probe_t>>(&series.metric)) {
+          sample.value = (*metric)->read();
+        } else if (auto metric = std::get_if<std::shared_ptr<histogram_t>>(&series.metric)) {
+          auto counts = (*metric)->counts();
+
+          sample.value = (*metric)->sum();
+          sample.count = std::accumulate(std::begin(counts), std::end(counts), std::uint64_t {});
+        } else if (auto metric = std::get_if<std::shared_ptr<summary_t>>(&series.metric)) {
+          auto &tracker = (*metric)->tracker();
+
+          sample.value = tracker.sum();
+          sample.count = tracker.count();
+        }
+
+        samples.emplace_back(std::move(sample));
+      }
+    }
+
+    return samples;
+  }
+}  // namespace metrics
@@ -0,0 +1,216 @@
+/**
+ * @file src/metrics.h
+ * @brief Declarations for the metrics exported in the Prometheus text format.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// local includes
+#include "stat_trackers.h"
+
+namespace metrics {
+  /**
+   * @brief The labels of a series, as name and value pairs.
+   */
+  using labels_t = std::vector<std::pair<std::string, std::string>>;
+
+  /**
+   * @brief The type of a metric, as exported.
+   */
+  enum class type_e {
+    counter,
+    gauge,
+    histogram,
+    summary,
+  };
+
+  /**
+   * @brief A value that only goes up.
+   */
+  class counter_t {
+  public:
+    void increment(std::uint64_t amount = 1) {
+      count.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t value() const {
+      return count.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::uint64_t> count {};
+  };
+
+  /**
+   * @brief A value that can go up and down.
+   */
+  class gauge_t {
+  public:
+    void set(double value) {
+      current.store(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] double value() const {
+      return current.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<double> current {};
+  };
+
+  /**
+   * @brief Counts the values falling in each of a fixed set of buckets.
+   */
+  class histogram_t {
+  public:
+    /**
+     * @param bounds The upper bounds of the buckets, in increasing order.
+     *               The bucket of the values above the last bound is implied.
+     */
+    explicit histogram_t(std::vector<double> bounds);
+
+    void observe(double value);
+
+    [[nodiscard]] const std::vector<double> &bounds() const {
+      return _bounds;
+    }
+
+    /**
+     * @brief Get the number of values in each bucket, the implied one being last.
+     * @return The counts, not cumulative.
+     */
+    [[nodiscard]] std::vector<std::uint64_t> counts() const;
+
+    [[nodiscard]] double sum() const {
+      return _sum.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<double> _bounds;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> _counts;
+    std::atomic<double> _sum {};
+  };
+
+  /**
+   * @brief Tracks the quantiles of values since it was created.
+   * @details The values are counted in log-linear buckets, so the quantiles are within 1/64 of the exact
+   *          ones whatever the range of the values. It's exported with the 0.5, 0.95, 0.99 and 0.999 quantiles.
+   */
+  class summary_t {
+  public:
+    void observe(double value) {
+      values.collect(value);
+    }
+
+    [[nodiscard]] const stat_trackers::histogram_tracker &tracker() const {
+      return values;
+    }
+
+  private:
+    stat_trackers::histogram_tracker values;
+  };
+
+  /**
+   * @brief The bucket bounds of a histogram growing by a factor.
+   * @param start The first bound.
+   * @param factor The factor between two bounds.
+   * @param count The number of bounds.
+   * @return The bounds.
+   */
+  std::vector<double> exponential_buckets(double start, double factor, int count);
+
+  /**
+   * @brief Get the counter with this name and labels, creating it if needed.
+   * @details The series is exported while a pointer to it is held. Updating it doesn't take any lock.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param labels The labels of the series.
+   * @return The counter.
+   * @examples
+   * auto frames = metrics::counter("sunshine_video_frames_sent_total", "Video frames sent", {{"session", "1"}});
+   * frames->increment();
+   * @examples_end
+   */
+  std::shared_ptr<counter_t> counter(std::string_view name, std::string_view help, labels_t labels = {});
+
+  /**
+   * @brief Get the gauge with this name and labels, creating it if needed.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param labels The labels of the series.
+   * @return The gauge.
+   */
+  std::shared_ptr<gauge_t> gauge(std::string_view name, std::string_view help, labels_t labels = {});
+
+  /**
+   * @brief Get the histogram with this name and labels, creating it if needed.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param bounds The upper bounds of the buckets, only used when the histogram is created.
+   * @param labels The labels of the series.
+   * @return The histogram.
+   */
+  std::shared_ptr<histogram_t> histogram(std::string_view name, std::string_view help, std::vector<double> bounds, labels_t labels = {});
+
+  /**
+   * @brief Get the summary with this name and labels, creating it if needed.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param labels The labels of the series.
+   * @return The summary.
+   */
+  std::shared_ptr<summary_t> summary(std::string_view name, std::string_view help, labels_t labels = {});
+
+  /**
+   * @brief Export a gauge read from elsewhere when the metrics are rendered.
+   * @details Meant for values already tracked by other parts of Sunshine, like the size of a queue.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param labels The labels of the series.
+   * @param read Returns the current value, called from the thread rendering the metrics.
+   * @return The series is exported while this is held.
+   */
+  std::shared_ptr<void> gauge_probe(std::string_view name, std::string_view help, labels_t labels, std::function<double()> read);
+
+  /**
+   * @brief Export a counter read from elsewhere when the metrics are rendered.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   * @param labels The labels of the series.
+   * @param read Returns the current value, called from the thread rendering the metrics.
+   * @return The series is exported while this is held.
+   */
+  std::shared_ptr<void> counter_probe(std::string_view name, std::string_view help, labels_t labels, std::function<double()> read);
+
+  /**
+   * @brief The value of a series when it was read.
+   */
+  struct sample_t {
+    std::string name;
+    labels_t labels;
+    type_e type;
+    double value;  ///< The value of a counter or a gauge, the sum of the values of a histogram or a summary.
+    std::uint64_t count;  ///< The number of values of a histogram or a summary, 0 for the others.
+  };
+
+  /**
+   * @brief Render all the live series in the Prometheus text format, version 0.0.4.
+   * @return The metrics.
+   */
+  std::string render();
+
+  /**
+   * @brief Read all the live series, for the consumers that compute rates or averages from them.
+   * @return The samples, grouped by metric.
+   */
+  std::vector<sample_t> snapshot();
+}  // namespace metrics
@@ -5,6 +5,10 @@
 // this include
 #include "nvenc_base.h"
 
+// standard includes
+#include <algorithm>
+#include <chrono>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
@@ -21,6 +25,11 @@
   #error Check and update NVENC code for backwards compatibility!
 #endif
 
+// Splitting frames across the NVENC engines of a GPU (NV_ENC_INITIALIZE_PARAMS::splitEncodeMode)
+// needs Video Codec SDK 12.1 and a matching driver, so it waits for the next SDK bump.
+// Stitching tiles from separate sessions isn't an option: each session pads its tile edges in its
+// own reference frames, so motion vectors pointing across a tile boundary wouldn't decode alike.
+
 namespace {
 
   GUID quality_preset_guid_from_number(unsigned number) {
@@ -209,6 +218,7 @@ namespace nvenc {
     }
 
     encoder_params.rfi = get_encoder_cap(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
+    encoder_params.dynamic_bitrate = get_encoder_cap(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE);
 
     init_params.presetGUID = quality_preset_guid_from_number(config.quality_preset);
     init_params.tuningInfo = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY;
@@ -249,6 +259,10 @@ namespace nvenc {
       if (config.vbv_percentage_increase > 0) {
         enc_config.rcParams.vbvBufferSize += enc_config.rcParams.vbvBufferSize * config.vbv_percentage_increase / 100;
       }
+
+      // A frame larger than the link delivers within a frame interval reaches the client late
+      encoder_params.max_frame_size = client_config.maxFrameSize;
+      enc_config.rcParams.vbvBufferSize = (uint32_t) video::cap_frame_size(enc_config.rcParams.vbvBufferSize, client_config.bitrate * 1000 / client_config.framerate, encoder_params.max_frame_size);
     }
 
     auto set_h264_hevc_common_format_config = [&](auto &format_config) {
@@ -285,6 +299,25 @@ namespace nvenc {
       }
     };
 
+    auto set_intra_refresh_recovery = [&](auto &format_config) {
+      if (!config.intra_refresh_recovery) {
+        return;
+      }
+      if (!get_encoder_cap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH)) {
+        BOOST_LOG(warning) << "NvEnc: intra refresh not supported, IDR requests will be satisfied with IDR frames";
+        return;
+      }
+
+      // No periodic wave, they're only forced when the client asks for an IDR frame
+      encoder_params.intra_refresh_frames = std::clamp(config.intra_refresh_frames, 2, 60);
+      format_config.enableIntraRefresh = 1;
+      format_config.intraRefreshPeriod = NVENC_INFINITE_GOPLENGTH;
+      format_config.intraRefreshCnt = encoder_params.intra_refresh_frames;
+      if (get_encoder_cap(NV_ENC_CAPS_SINGLE_SLICE_INTRA_REFRESH)) {
+        format_config.singleSliceIntraRefresh = 1;
+      }
+    };
+
     auto fill_h264_hevc_vui = [&](auto &vui_config) {
       vui_config.videoSignalTypePresentFlag = 1;
       vui_config.videoFormat = NV_ENC_VUI_VIDEO_FORMAT_UNSPECIFIED;
@@ -313,6 +346,17 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFrames, format_config.numRefL0, 5);
           set_minqp_if_enabled(config.min_qp_h264);
           fill_h264_hevc_vui(format_config.h264VUIParameters);
+          set_intra_refresh_recovery(format_config);
+          if (config.temporal_layers) {
+            if (get_encoder_cap(NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC) && get_encoder_cap(NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS) >= 2) {
+              // Every other frame is left out of the references, its slices are marked as such
+              format_config.enableTemporalSVC = 1;
+              format_config.maxTemporalLayers = 2;
+              format_config.h264Extension.svcTemporalConfig.numTemporalLayers = 2;
+            } else {
+              BOOST_LOG(warning) << "NvEnc: temporal layers not supported";
+            }
+          }
           break;
         }
 
@@ -340,6 +384,8 @@ namespace nvenc {
             } else {
               BOOST_LOG(error) << "NvEnc: Client asked for intra-refresh but the encoder does not support intra-refresh";
             }
+          } else {
+            set_intra_refresh_recovery(format_config);
           }
           break;
         }
@@ -366,16 +412,26 @@ namespace nvenc {
           set_ref_frames(format_config.maxNumRefFramesInDPB, format_config.numFwdRefs, 8);
           set_minqp_if_enabled(config.min_qp_av1);
 
-          if (client_config.slicesPerFrame > 1) {
-            // NVENC only supports slice counts that are powers of two, so we'll pick powers of two
-            // with bias to rows due to hopefully more similar macroblocks with a row vs a column.
-            format_config.numTileRows = std::pow(2, std::ceil(std::log2(client_config.slicesPerFrame) / 2));
-            format_config.numTileColumns = std::pow(2, std::floor(std::log2(client_config.slicesPerFrame) / 2));
+          if (auto tiles = video::tile_layout(client_config, config.tile_columns, config.tile_rows); tiles.columns * tiles.rows > 1) {
+            format_config.numTileColumns = tiles.columns;
+            format_config.numTileRows = tiles.rows;
           }
           break;
         }
     }
 
+    if (config.roi_qp_delta > 0) {
+      // The map holds a delta per macroblock for H.264, per CTB for HEVC and per superblock for AV1
+      if (client_config.videoFormat == 1) {
+        enc_config.encodeCodecConfig.hevcConfig.maxCUSize = NV_ENC_HEVC_CUSIZE_32x32;
+      }
+      enc_config.rcParams.qpMapMode = NV_ENC_QP_MAP_DELTA;
+      encoder_params.qp_map_block_size = client_config.videoFormat == 0 ? 16 :
+                                         client_config.videoFormat == 1 ? 32 :
+                                                                          64;
+      encoder_params.roi_qp_delta = std::min(config.roi_qp_delta, 51);
+    }
+
     init_params.encodeConfig = &enc_config;
 
     if (nvenc_failed(nvenc->nvEncInitializeEncoder(encoder, &init_params))) {
@@ -383,6 +439,10 @@ namespace nvenc {
       return false;
     }
 
+    current_init_params = init_params;
+    current_config = enc_config;
+    current_init_params.encodeConfig = &current_config;
+
     if (async_event_handle) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
       event_params.completionEvent = async_event_handle;
@@ -392,12 +452,17 @@ namespace nvenc {
       }
     }
 
-    NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
-    if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_bitstream_buffer))) {
-      BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
-      return false;
+    // Without async mode, the encoder can't tell when the input surface is free before the frame is locked
+    auto output_buffers = async_event_handle ? std::clamp(config.output_buffers, 1, 4) : 1;
+    for (int x = 0; x < output_buffers; ++x) {
+      NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream_buffer = {min_struct_version(NV_ENC_CREATE_BITSTREAM_BUFFER_VER)};
+      if (nvenc_failed(nvenc->nvEncCreateBitstreamBuffer(encoder, &create_bitstream_buffer))) {
+        BOOST_LOG(error) << "NvEnc: NvEncCreateBitstreamBuffer() failed: " << last_nvenc_error_string;
+        return false;
+      }
+      output_bitstreams.push_back(create_bitstream_buffer.bitstreamBuffer);
     }
-    output_bitstream = create_bitstream_buffer.bitstreamBuffer;
+    next_output_bitstream = 0;
 
     if (!create_and_register_input_buffer()) {
       return false;
@@ -417,6 +482,9 @@ namespace nvenc {
       if (init_params.enableEncodeAsync) {
         extra += " async";
       }
+      if (output_bitstreams.size() > 1) {
+        extra += " pipelined";
+      }
       if (buffer_is_yuv444()) {
         extra += " yuv444";
       }
@@ -432,6 +500,9 @@ namespace nvenc {
       if (encoder_params.rfi) {
         extra += " rfi";
       }
+      if (encoder_params.intra_refresh_frames) {
+        extra += " intra-refresh-recovery=" + std::to_string(encoder_params.intra_refresh_frames);
+      }
       if (init_params.enableWeightedPrediction) {
         extra += " weighted-prediction";
       }
@@ -444,6 +515,9 @@ namespace nvenc {
       if (config.insert_filler_data) {
         extra += " filler-data";
       }
+      if (encoder_params.qp_map_block_size) {
+        extra += " roi-qp-delta=" + std::to_string(encoder_params.roi_qp_delta);
+      }
 
       BOOST_LOG(info) << "NvEnc: created encoder " << video_format_string << quality_preset_string_from_guid(init_params.presetGUID) << extra;
     }
@@ -454,12 +528,18 @@ namespace nvenc {
   }
 
   void nvenc_base::destroy_encoder() {
-    if (output_bitstream) {
+    for (auto &pending : pending_frames) {
+      if (pending.mapped_input && nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, pending.mapped_input))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+    }
+    pending_frames.clear();
+    for (auto output_bitstream : output_bitstreams) {
       if (nvenc_failed(nvenc->nvEncDestroyBitstreamBuffer(encoder, output_bitstream))) {
         BOOST_LOG(error) << "NvEnc: NvEncDestroyBitstreamBuffer() failed: " << last_nvenc_error_string;
       }
-      output_bitstream = nullptr;
     }
+    output_bitstreams.clear();
     if (encoder && async_event_handle) {
       NV_ENC_EVENT_PARAMS event_params = {min_struct_version(NV_ENC_EVENT_PARAMS_VER)};
       event_params.completionEvent = async_event_handle;
@@ -482,19 +562,42 @@ namespace nvenc {
 
     encoder_state = {};
     encoder_params = {};
+    qp_delta_map.clear();
   }
 
-  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr) {
-    if (!encoder) {
+  nvenc_encoded_frame nvenc_base::encode_frame(uint64_t frame_index, bool force_idr, std::vector<uint8_t> &&buffer) {
+    if (!submit_frame(frame_index, force_idr)) {
       return {};
     }
 
+    return retrieve_frame(std::move(buffer));
+  }
+
+  bool nvenc_base::submit_frame(uint64_t frame_index, bool force_idr) {
+    if (!encoder) {
+      return false;
+    }
+
     assert(registered_input_buffer);
-    assert(output_bitstream);
+    assert(!output_bitstreams.empty());
+
+    NV_ENC_OUTPUT_PTR output_bitstream;
+    {
+      std::unique_lock lock {pending_frames_lock};
+      if (!pending_frames_cv.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+            return pending_frames.size() < output_bitstreams.size();
+          })) {
+        BOOST_LOG(error) << "NvEnc: frame " << frame_index << " output buffer wait timeout";
+        return false;
+      }
+
+      output_bitstream = output_bitstreams[next_output_bitstream];
+      next_output_bitstream = (next_output_bitstream + 1) % output_bitstreams.size();
+    }
 
     if (!synchronize_input_buffer()) {
       BOOST_LOG(error) << "NvEnc: failed to synchronize input buffer";
-      return {};
+      return false;
     }
 
     NV_ENC_MAP_INPUT_RESOURCE mapped_input_buffer = {min_struct_version(NV_ENC_MAP_INPUT_RESOURCE_VER)};
@@ -502,7 +605,7 @@ namespace nvenc {
 
     if (nvenc_failed(nvenc->nvEncMapInputResource(encoder, &mapped_input_buffer))) {
       BOOST_LOG(error) << "NvEnc: NvEncMapInputResource() failed: " << last_nvenc_error_string;
-      return {};
+      return false;
     }
     auto unmap_guard = util::fail_guard([&] {
       if (nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, mapped_input_buffer.mappedResource))) {
@@ -520,41 +623,107 @@ namespace nvenc {
     pic_params.bufferFmt = mapped_input_buffer.mappedBufferFmt;
     pic_params.outputBitstream = output_bitstream;
     pic_params.completionEvent = async_event_handle;
+    if (!qp_delta_map.empty()) {
+      pic_params.qpDeltaMap = qp_delta_map.data();
+      pic_params.qpDeltaMapSize = qp_delta_map.size();
+    }
+
+    // An IDR frame makes the pending wave unnecessary
+    bool intra_refresh = encoder_state.intra_refresh_needed && !force_idr;
+    if (intra_refresh) {
+      if (equal_guids(current_init_params.encodeGUID, NV_ENC_CODEC_H264_GUID)) {
+        pic_params.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      } else {
+        pic_params.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = encoder_params.intra_refresh_frames;
+      }
+    }
 
+    auto submitted = std::chrono::steady_clock::now();
     if (nvenc_failed(nvenc->nvEncEncodePicture(encoder, &pic_params))) {
       BOOST_LOG(error) << "NvEnc: NvEncEncodePicture() failed: " << last_nvenc_error_string;
-      return {};
+      return false;
     }
 
-    NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
-    lock_bitstream.outputBitstream = output_bitstream;
-    lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
-
     if (async_event_handle && !wait_for_async_event(100)) {
       BOOST_LOG(error) << "NvEnc: frame " << frame_index << " encode wait timeout";
-      return {};
+      return false;
+    }
+
+    pending_frame_t pending {output_bitstream, nullptr, encoder_state.rfi_needs_confirmation || intra_refresh, submitted};
+    if (!async_event_handle) {
+      // The encoder may read the input surface until the frame is locked
+      pending.mapped_input = mapped_input_buffer.mappedResource;
+      unmap_guard.disable();
+    }
+
+    if (encoder_state.rfi_needs_confirmation) {
+      // Invalidation request has been fulfilled, and video network packet will be marked as such
+      encoder_state.rfi_needs_confirmation = false;
+    }
+
+    if (intra_refresh) {
+      BOOST_LOG(debug) << "NvEnc: intra refresh wave from frame " << frame_index;
+      encoder_state.intra_refresh_end = frame_index + encoder_params.intra_refresh_frames;
+    }
+    encoder_state.intra_refresh_needed = false;
+
+    encoder_state.last_encoded_frame_index = frame_index;
+    encoder_state.frame_encoded = true;
+
+    {
+      std::lock_guard lock {pending_frames_lock};
+      pending_frames.push_back(pending);
+    }
+
+    return true;
+  }
+
+  nvenc_encoded_frame nvenc_base::retrieve_frame(std::vector<uint8_t> &&buffer) {
+    pending_frame_t pending;
+    {
+      std::lock_guard lock {pending_frames_lock};
+      if (pending_frames.empty()) {
+        return {};
+      }
+
+      // The frame stays queued until it's retrieved, so its buffer isn't handed out again before
+      pending = pending_frames.front();
     }
+    auto pop_guard = util::fail_guard([&] {
+      if (pending.mapped_input && nvenc_failed(nvenc->nvEncUnmapInputResource(encoder, pending.mapped_input))) {
+        BOOST_LOG(error) << "NvEnc: NvEncUnmapInputResource() failed: " << last_nvenc_error_string;
+      }
+
+      {
+        std::lock_guard lock {pending_frames_lock};
+        pending_frames.pop_front();
+      }
+      pending_frames_cv.notify_one();
+    });
+
+    NV_ENC_LOCK_BITSTREAM lock_bitstream = {min_struct_version(NV_ENC_LOCK_BITSTREAM_VER, 1, 2)};
+    lock_bitstream.outputBitstream = pending.output_bitstream;
+    lock_bitstream.doNotWait = async_event_handle ? 1 : 0;
 
     if (nvenc_failed(nvenc->nvEncLockBitstream(encoder, &lock_bitstream))) {
       BOOST_LOG(error) << "NvEnc: NvEncLockBitstream() failed: " << last_nvenc_error_string;
       return {};
     }
 
+    // The only copy of the frame, the stream sends it from this buffer
     auto data_pointer = (uint8_t *) lock_bitstream.bitstreamBufferPtr;
+    buffer.assign(data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes);
+
     nvenc_encoded_frame encoded_frame {
-      {data_pointer, data_pointer + lock_bitstream.bitstreamSizeInBytes},
+      std::move(buffer),
       lock_bitstream.outputTimeStamp,
       lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR,
-      encoder_state.rfi_needs_confirmation,
+      pending.after_ref_frame_invalidation,
+      lock_bitstream.pictureType == NV_ENC_PIC_TYPE_IDR || lock_bitstream.pictureType == NV_ENC_PIC_TYPE_I,
+      lock_bitstream.averageQP,
+      std::chrono::steady_clock::now() - pending.submitted,
     };
 
-    if (encoder_state.rfi_needs_confirmation) {
-      // Invalidation request has been fulfilled, and video network packet will be marked as such
-      encoder_state.rfi_needs_confirmation = false;
-    }
-
-    encoder_state.last_encoded_frame_index = frame_index;
-
     if (encoded_frame.idr) {
       BOOST_LOG(debug) << "NvEnc: idr frame " << encoded_frame.frame_index;
     }
@@ -568,6 +737,10 @@ namespace nvenc {
     return encoded_frame;
   }
 
+  bool nvenc_base::can_pipeline() const {
+    return async_event_handle && output_bitstreams.size() > 1;
+  }
+
   bool nvenc_base::invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame) {
     if (!encoder || !encoder_params.rfi) {
       return false;
@@ -606,6 +779,124 @@ namespace nvenc {
     return true;
   }
 
+  bool nvenc_base::start_intra_refresh() {
+    if (!encoder || !encoder_params.intra_refresh_frames || !encoder_state.frame_encoded) {
+      return false;
+    }
+
+    if (encoder_state.intra_refresh_needed) {
+      return true;
+    }
+
+    if (encoder_state.last_encoded_frame_index + 1 < encoder_state.intra_refresh_end) {
+      BOOST_LOG(debug) << "NvEnc: IDR request during intra refresh wave, generating IDR";
+      return false;
+    }
+
+    encoder_state.intra_refresh_needed = true;
+    return true;
+  }
+
+  bool nvenc_base::set_bitrate(uint32_t bitrate) {
+    if (!encoder || !encoder_params.dynamic_bitrate) {
+      return false;
+    }
+
+    auto config = current_config;
+    auto &rc_params = config.rcParams;
+    auto old_bitrate = rc_params.averageBitRate;
+    rc_params.averageBitRate = bitrate * 1000;
+
+    // Keep the buffer the same number of frames long, within what the link delivers in a frame interval
+    if (rc_params.vbvBufferSize && old_bitrate) {
+      rc_params.vbvBufferSize = (uint32_t) ((uint64_t) rc_params.vbvBufferSize * rc_params.averageBitRate / old_bitrate);
+
+      auto framerate = current_init_params.frameRateNum / std::max(current_init_params.frameRateDen, 1U);
+      if (framerate) {
+        rc_params.vbvBufferSize = (uint32_t) video::cap_frame_size(rc_params.vbvBufferSize, rc_params.averageBitRate / framerate, encoder_params.max_frame_size);
+      }
+    }
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER)};
+    reconfigure_params.reInitEncodeParams = current_init_params;
+    reconfigure_params.reInitEncodeParams.encodeConfig = &config;
+
+    if (nvenc_failed(nvenc->nvEncReconfigureEncoder(encoder, &reconfigure_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncReconfigureEncoder() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    current_config = config;
+
+    return true;
+  }
+
+  bool nvenc_base::set_framerate(uint32_t framerate) {
+    if (!encoder || !framerate) {
+      return false;
+    }
+
+    auto config = current_config;
+    auto &rc_params = config.rcParams;
+    auto old_framerate = current_init_params.frameRateNum / std::max(current_init_params.frameRateDen, 1U);
+
+    // Keep the buffer the same number of frames long, the link delivers less within the shorter interval
+    if (rc_params.vbvBufferSize && old_framerate) {
+      rc_params.vbvBufferSize = (uint32_t) ((uint64_t) rc_params.vbvBufferSize * old_framerate / framerate);
+      if (encoder_params.max_frame_size) {
+        encoder_params.max_frame_size = encoder_params.max_frame_size * old_framerate / framerate;
+      }
+    }
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {min_struct_version(NV_ENC_RECONFIGURE_PARAMS_VER)};
+    reconfigure_params.reInitEncodeParams = current_init_params;
+    reconfigure_params.reInitEncodeParams.encodeConfig = &config;
+    reconfigure_params.reInitEncodeParams.frameRateNum = framerate;
+    reconfigure_params.reInitEncodeParams.frameRateDen = 1;
+
+    if (nvenc_failed(nvenc->nvEncReconfigureEncoder(encoder, &reconfigure_params))) {
+      BOOST_LOG(error) << "NvEnc: NvEncReconfigureEncoder() failed: " << last_nvenc_error_string;
+      return false;
+    }
+
+    current_config = config;
+    current_init_params.frameRateNum = framerate;
+    current_init_params.frameRateDen = 1;
+
+    return true;
+  }
+
+  bool nvenc_base::set_regions_of_interest(const std::vector<platf::damage_rect_t> &regions) {
+    if (!encoder || !encoder_params.qp_map_block_size) {
+      return false;
+    }
+
+    if (regions.empty()) {
+      qp_delta_map.clear();
+      return true;
+    }
+
+    const auto block_size = (int) encoder_params.qp_map_block_size;
+    const auto columns = ((int) encoder_params.width + block_size - 1) / block_size;
+    const auto rows = ((int) encoder_params.height + block_size - 1) / block_size;
+    qp_delta_map.assign(columns * rows, 0);
+
+    for (auto &region : regions) {
+      // Every block the region touches is encoded at the lower QP
+      auto left = std::clamp(region.x / block_size, 0, columns);
+      auto top = std::clamp(region.y / block_size, 0, rows);
+      auto right = std::clamp((region.x + region.width + block_size - 1) / block_size, 0, columns);
+      auto bottom = std::clamp((region.y + region.height + block_size - 1) / block_size, 0, rows);
+      for (auto y = top; y < bottom; ++y) {
+        std::fill_n(qp_delta_map.begin() + y * columns + left, std::max(right - left, 0), (int8_t) -encoder_params.roi_qp_delta);
+      }
+    }
+
+    return true;
+  }
+
+  thread_local std::string nvenc_base::last_nvenc_error_string;
+
   bool nvenc_base::nvenc_failed(NVENCSTATUS status) {
     auto status_string = [](NVENCSTATUS status) -> std::string {
       switch (status) {
@@ -4,6 +4,13 @@
  */
 #pragma once
 
+// standard includes
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
 // lib includes
 #include <ffnvcodec/nvEncodeAPI.h>
 
@@ -56,9 +63,34 @@ namespace nvenc {
      *        Afterwards serves as parameter for `invalidate_ref_frames()`.
      *        No restrictions on the first frame index, but later frame indexes must be subsequent.
      * @param force_idr Whether to encode frame as forced IDR.
+     * @param buffer The buffer the frame is copied into, its capacity is reused.
      * @return Encoded frame.
      */
-    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr);
+    nvenc_encoded_frame encode_frame(uint64_t frame_index, bool force_idr, std::vector<uint8_t> &&buffer = {});
+
+    /**
+     * @brief Submit the next frame using platform-specific input surface, without retrieving it.
+     * @details In async mode this returns once the frame is encoded, so the input surface may be written again.
+     *          The frame stays in its output bitstream buffer until `retrieve_frame()`, which may then be called on another thread.
+     *          Blocks while every output bitstream buffer holds a frame that wasn't retrieved yet.
+     * @param frame_index Frame index that uniquely identifies the frame, see `encode_frame()`.
+     * @param force_idr Whether to encode frame as forced IDR.
+     * @return `true` on success, `false` on error.
+     */
+    bool submit_frame(uint64_t frame_index, bool force_idr);
+
+    /**
+     * @brief Retrieve the oldest submitted frame.
+     * @param buffer The buffer the frame is copied into, its capacity is reused.
+     * @return Encoded frame, empty on error or if no frame was submitted.
+     */
+    nvenc_encoded_frame retrieve_frame(std::vector<uint8_t> &&buffer = {});
+
+    /**
+     * @brief Check whether frames can be retrieved while the next ones are submitted.
+     * @return `true` if the encoder runs in async mode with more than one output bitstream buffer.
+     */
+    bool can_pipeline() const;
 
     /**
      * @brief Perform reference frame invalidation (RFI) procedure.
@@ -69,6 +101,36 @@ namespace nvenc {
      */
     bool invalidate_ref_frames(uint64_t first_frame, uint64_t last_frame);
 
+    /**
+     * @brief Refresh the picture gradually from the next frame on, instead of with an IDR frame.
+     * @details The first frame of the wave is marked as after reference frame invalidation, so the client resumes decoding with it.
+     * @return `true` if the wave starts with the next frame, `false` if it must be encoded with `force_idr = true` instead.
+     *         That's the case when intra refresh recovery isn't enabled or supported, before the first frame and during a wave,
+     *         since another request then means the client didn't recover.
+     */
+    bool start_intra_refresh();
+
+    /**
+     * @brief Change the bitrate of the following frames without resetting the encoder.
+     * @param bitrate The bitrate in Kbps.
+     * @return `true` on success, `false` if the encoder can't change its bitrate or on error.
+     */
+    bool set_bitrate(uint32_t bitrate);
+
+    /**
+     * @brief Change the frame rate of the following frames without resetting the encoder.
+     * @param framerate The frame rate the rate control budgets for.
+     * @return `true` on success, `false` on error.
+     */
+    bool set_framerate(uint32_t framerate);
+
+    /**
+     * @brief Encode the regions the user works in at a lower QP from the next frame on.
+     * @param regions The regions in the coordinates of the encoded frame, none to encode the frame alike.
+     * @return `true` on success, `false` if the encoder wasn't created with a QP delta map.
+     */
+    bool set_regions_of_interest(const std::vector<platf::damage_rect_t> &regions);
+
   protected:
     /**
      * @brief Required. Used for loading NvEnc library and setting `nvenc` variable with `NvEncodeAPICreateInstance()`.
@@ -126,9 +188,15 @@ namespace nvenc {
       NV_ENC_BUFFER_FORMAT buffer_format = NV_ENC_BUFFER_FORMAT_UNDEFINED;
       uint32_t ref_frames_in_dpb = 0;
       bool rfi = false;
+      bool dynamic_bitrate = false;
+      uint32_t intra_refresh_frames = 0;  ///< Length of the intra refresh waves, 0 if IDR requests can't be satisfied with one
+      uint32_t qp_map_block_size = 0;  ///< Size of the blocks of the QP delta map, 0 if the encoder has none
+      int roi_qp_delta = 0;
+      int64_t max_frame_size = 0;  ///< Bits the link delivers within a frame interval, the VBV buffer is capped to it, 0 for no cap
     } encoder_params;
 
-    std::string last_nvenc_error_string;
+    // Per thread, since frames may be retrieved on another thread than they're submitted on
+    static thread_local std::string last_nvenc_error_string;
 
     // Derived classes set these variables
     void *device = nullptr;  ///< Platform-specific handle of encoding device.
@@ -141,13 +209,38 @@ namespace nvenc {
                                          ///< Can be set in constructor or `init_library()`, must override `wait_for_async_event()`.
 
   private:
-    NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
+    struct pending_frame_t {
+      NV_ENC_OUTPUT_PTR output_bitstream = nullptr;
+      NV_ENC_INPUT_PTR mapped_input = nullptr;  ///< Set in sync mode, where the input surface stays mapped until the frame is retrieved
+      bool after_ref_frame_invalidation = false;
+      std::chrono::steady_clock::time_point submitted;
+    };
+
+    // Used in turn, a buffer is reused once the frame in it was retrieved
+    std::vector<NV_ENC_OUTPUT_PTR> output_bitstreams;
+    std::size_t next_output_bitstream = 0;
+
+    std::deque<pending_frame_t> pending_frames;
+    std::mutex pending_frames_lock;
+    std::condition_variable pending_frames_cv;
+
     uint32_t minimum_api_version = 0;
 
+    // One QP delta per block in raster order, empty while no region of interest is set.
+    // The previous frame is always done encoding when it changes, so it's shared by the frames.
+    std::vector<int8_t> qp_delta_map;
+
+    // The parameters the encoder runs with, kept for reconfiguring it
+    NV_ENC_INITIALIZE_PARAMS current_init_params = {};
+    NV_ENC_CONFIG current_config = {};
+
     struct {
       uint64_t last_encoded_frame_index = 0;
       bool rfi_needs_confirmation = false;
       std::pair<uint64_t, uint64_t> last_rfi_range;
+      bool frame_encoded = false;
+      bool intra_refresh_needed = false;
+      uint64_t intra_refresh_end = 0;  ///< Frame index after the last intra refresh wave
       logging::min_max_avg_periodic_logger<double> frame_size_logger = {debug, "NvEnc: encoded frame sizes in kB", ""};
     } encoder_state;
   };
@@ -48,6 +48,25 @@ namespace nvenc {
 
     // Add filler data to encoded frames to stay at target bitrate, mainly for testing
     bool insert_filler_data = false;
+
+    // Satisfy the IDR requests of the client with a wave of intra refresh instead when possible, H.264 and HEVC only
+    bool intra_refresh_recovery = false;
+
+    // Frames over which an intra refresh wave is spread, the more the smaller each of them
+    int intra_refresh_frames = 10;
+
+    // Output bitstream buffers, more than one lets a frame be retrieved while the next one is encoded in async mode
+    int output_buffers = 1;
+
+    // Encode H.264 in two temporal layers, so the clients at half the frame rate of a shared encoder can skip the upper one
+    bool temporal_layers = false;
+
+    // Lower the QP of the regions the user works in by this much with a QP delta map, 0 to encode the frame alike
+    int roi_qp_delta = 0;
+
+    // Tiles of AV1 frames, 0 to pick them from the slices the client asked for
+    int tile_columns = 0;
+    int tile_rows = 0;
   };
 
 }  // namespace nvenc
@@ -5,6 +5,7 @@
 #pragma once
 
 // standard includes
+#include <chrono>
 #include <cstdint>
 #include <vector>
 
@@ -18,6 +19,9 @@ namespace nvenc {
     uint64_t frame_index = 0;
     bool idr = false;
     bool after_ref_frame_invalidation = false;
+    bool intra = false;  ///< An I or IDR frame
+    uint32_t average_qp = 0;  ///< The average QP of the frame, as reported by the encoder
+    std::chrono::steady_clock::duration encode_duration {};  ///< From submitting the frame to locking its bitstream
   };
 
 }  // namespace nvenc
@@ -6,8 +6,17 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 // lib includes
@@ -34,6 +43,7 @@
 #include "utility.h"
 #include "uuid.h"
 #include "video.h"
+#include "web_cache.h"
 
 using namespace std::literals;
 
@@ -42,6 +52,8 @@ namespace nvhttp {
   namespace fs = std::filesystem;
   namespace pt = boost::property_tree;
 
+  // The certificates of the paired clients, verified by the HTTPS server and changed from the Web UI
+  std::mutex cert_chain_lock;
   crypto::cert_chain_t cert_chain;
 
   class SunshineHTTPSServer: public SimpleWeb::ServerBase<SunshineHTTPS> {
@@ -54,6 +66,13 @@ namespace nvhttp {
       context.set_options(boost::asio::ssl::context::no_tlsv1_1);
       context.use_certificate_chain_file(certification_file);
       context.use_private_key_file(private_key_file, boost::asio::ssl::context::pem);
+
+      // Let the clients resume their sessions, with a session ID or a ticket, instead of doing a full handshake
+      // for every connection. The certificate of a resumed session is still verified against the paired clients.
+      static constexpr unsigned char session_id_context[] = "sunshine-nvhttp";
+      SSL_CTX_set_session_id_context(context.native_handle(), session_id_context, sizeof(session_id_context) - 1);
+      SSL_CTX_set_session_cache_mode(context.native_handle(), SSL_SESS_CACHE_SERVER);
+      SSL_CTX_set_timeout(context.native_handle(), 24 * 60 * 60);
     }
 
     std::function<int(SSL *)> verify;
@@ -135,6 +154,8 @@ namespace nvhttp {
     std::vector<named_cert_t> named_devices;
   };
 
+  // The servers handle requests on several threads, the web UI enters the pin from its own
+  std::mutex pair_lock;  ///< Guards map_id_sess and client_root.
   // uniqueID, session
   std::unordered_map<std::string, pair_session_t> map_id_sess;
   client_t client_root;
@@ -191,12 +212,18 @@ namespace nvhttp {
     }
     root.add_child("root.named_devices"s, named_cert_nodes);
 
+    // A crash while writing must not lose the paired devices, so the file is replaced in one step
+    std::ostringstream out;
     try {
-      pt::write_json(config::nvhttp.file_state, root);
+      pt::write_json(out, root);
     } catch (std::exception &e) {
       BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state << ": "sv << e.what();
       return;
     }
+
+    if (file_handler::write_file_atomic(config::nvhttp.file_state.c_str(), out.str())) {
+      BOOST_LOG(error) << "Couldn't write "sv << config::nvhttp.file_state;
+    }
   }
 
   void load_state() {
@@ -255,6 +282,7 @@ namespace nvhttp {
     }
 
     // Empty certificate chain and import certs from file
+    std::lock_guard lg {cert_chain_lock};
     cert_chain.clear();
     for (auto &named_cert : client.named_devices) {
       cert_chain.add(crypto::x509(named_cert.cert));
@@ -566,6 +594,8 @@ namespace nvhttp {
 
     auto uniqID {get_arg(args, "uniqueid")};
 
+    std::lock_guard lg {pair_lock};
+
     args_t::const_iterator it;
     if (it = args.find("phrase"); it != std::end(args)) {
       if (it->second == "getservercert"sv) {
@@ -625,6 +655,8 @@ namespace nvhttp {
   }
 
   bool pin(std::string pin, std::string name) {
+    std::lock_guard lg {pair_lock};
+
     pt::ptree tree;
     if (map_id_sess.empty()) {
       return false;
@@ -672,57 +704,11 @@ namespace nvhttp {
     return true;
   }
 
-  template<class T>
-  void serverinfo(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
-    print_req<T>(request);
-
-    int pair_status = 0;
-    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      auto args = request->parse_query_string();
-      auto clientID = args.find("uniqueid"s);
-
-      if (clientID != std::end(args)) {
-        pair_status = 1;
-      }
-    }
-
-    auto local_endpoint = request->local_endpoint();
-
-    pt::ptree tree;
-
-    tree.put("root.<xmlattr>.status_code", 200);
-    tree.put("root.hostname", config::nvhttp.sunshine_name);
-
-    tree.put("root.appversion", VERSION);
-    tree.put("root.GfeVersion", GFE_VERSION);
-    tree.put("root.uniqueid", http::unique_id);
-    tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
-    tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
-    tree.put("root.MaxLumaPixelsHEVC", video::active_hevc_mode > 1 ? "1869449984" : "0");
-
-    // Only include the MAC address for requests sent from paired clients over HTTPS.
-    // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
-    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
-      tree.put("root.mac", platf::get_mac_address(net::addr_to_normalized_string(local_endpoint.address())));
-    } else {
-      tree.put("root.mac", "00:00:00:00:00:00");
-    }
-
-    // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
-    // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
-    // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
-    // when we get a request over IPv6.
-    //
-    // HACK: We should return the IPv4 address of local interface here, but we don't currently
-    // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
-    // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
-    // support know to ignore this bogus address.
-    if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
-      tree.put("root.LocalIP", "127.0.0.1");
-    } else {
-      tree.put("root.LocalIP", net::addr_to_normalized_string(local_endpoint.address()));
-    }
-
+  /**
+   * @brief Get the codecs the encoders support, as sent in the server info.
+   * @return The SCM_* flags of the codecs.
+   */
+  uint32_t server_codec_mode_support() {
     uint32_t codec_mode_flags = SCM_H264;
     if (video::last_encoder_probe_supported_yuv444_for_codec[0]) {
       codec_mode_flags |= SCM_H264_HIGH8_444;
@@ -751,22 +737,140 @@ namespace nvhttp {
         codec_mode_flags |= SCM_AV1_HIGH10_444;
       }
     }
-    tree.put("root.ServerCodecModeSupport", codec_mode_flags);
 
-    auto current_appid = proc::proc.running();
-    tree.put("root.PairStatus", pair_status);
-    tree.put("root.currentgame", current_appid);
-    tree.put("root.state", current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
+    return codec_mode_flags;
+  }
 
-    std::ostringstream data;
+  /**
+   * @brief What the server info sent to a local address is built from.
+   * @details The response is only built again when one of these changes, clients poll it continuously.
+   */
+  struct serverinfo_state_t {
+    std::string hostname;
+    std::string unique_id;
+    int hevc_mode;
+    uint32_t codec_mode_flags;
+    int current_appid;
+
+    bool operator==(const serverinfo_state_t &) const = default;
+  };
 
-    pt::write_xml(data, tree);
-    response->write(data.str());
-    response->close_connection_after_response = true;
+  /**
+   * @brief A response built once, and sent as is until the state it was built from changes.
+   */
+  template<class State>
+  struct cached_response_t {
+    State state;
+    std::string data;
+  };
+
+  template<class T>
+  void serverinfo(std::shared_ptr<typename SimpleWeb::ServerBase<T>::Response> response, std::shared_ptr<typename SimpleWeb::ServerBase<T>::Request> request) {
+    print_req<T>(request);
+
+    int pair_status = 0;
+    if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+      auto args = request->parse_query_string();
+      auto clientID = args.find("uniqueid"s);
+
+      if (clientID != std::end(args)) {
+        pair_status = 1;
+      }
+    }
+
+    // The codecs can't be advertised before the encoders are probed, the clients poll again
+    if (!video::encoders_ready()) {
+      pt::ptree tree;
+      tree.put("root.<xmlattr>.status_code", 503);
+      tree.put("root.<xmlattr>.status_message", "The host is starting");
+
+      std::ostringstream data;
+      pt::write_xml(data, tree);
+      response->write(data.str());
+      response->close_connection_after_response = true;
+
+      return;
+    }
+
+    auto local_endpoint = request->local_endpoint();
+    auto local_address = net::addr_to_normalized_string(local_endpoint.address());
+
+    // The app is looked up on every request, which also reaps it once it exited
+    serverinfo_state_t state {
+      config::nvhttp.sunshine_name,
+      http::unique_id,
+      video::active_hevc_mode,
+      server_codec_mode_support(),
+      proc::proc.running(),
+    };
+
+    // The MAC address and the local IP depend on the address the request was received on
+    static std::mutex cache_lock;
+    static std::map<std::pair<std::string, int>, cached_response_t<serverinfo_state_t>> cache;
+
+    std::lock_guard lg {cache_lock};
+
+    auto &cached = cache[{local_address, pair_status}];
+    if (cached.data.empty() || cached.state != state) {
+      pt::ptree tree;
+
+      tree.put("root.<xmlattr>.status_code", 200);
+      tree.put("root.hostname", state.hostname);
+
+      tree.put("root.appversion", VERSION);
+      tree.put("root.GfeVersion", GFE_VERSION);
+      tree.put("root.uniqueid", state.unique_id);
+      tree.put("root.HttpsPort", net::map_port(PORT_HTTPS));
+      tree.put("root.ExternalPort", net::map_port(PORT_HTTP));
+      tree.put("root.MaxLumaPixelsHEVC", state.hevc_mode > 1 ? "1869449984" : "0");
+
+      // Only include the MAC address for requests sent from paired clients over HTTPS.
+      // For HTTP requests, use a placeholder MAC address that Moonlight knows to ignore.
+      if constexpr (std::is_same_v<SunshineHTTPS, T>) {
+        tree.put("root.mac", platf::get_mac_address(local_address));
+      } else {
+        tree.put("root.mac", "00:00:00:00:00:00");
+      }
+
+      // Moonlight clients track LAN IPv6 addresses separately from LocalIP which is expected to
+      // always be an IPv4 address. If we return that same IPv6 address here, it will clobber the
+      // stored LAN IPv4 address. To avoid this, we need to return an IPv4 address in this field
+      // when we get a request over IPv6.
+      //
+      // HACK: We should return the IPv4 address of local interface here, but we don't currently
+      // have that implemented. For now, we will emulate the behavior of GFE+GS-IPv6-Forwarder,
+      // which returns 127.0.0.1 as LocalIP for IPv6 connections. Moonlight clients with IPv6
+      // support know to ignore this bogus address.
+      if (local_endpoint.address().is_v6() && !local_endpoint.address().to_v6().is_v4_mapped()) {
+        tree.put("root.LocalIP", "127.0.0.1");
+      } else {
+        tree.put("root.LocalIP", local_address);
+      }
+
+      tree.put("root.ServerCodecModeSupport", state.codec_mode_flags);
+
+      tree.put("root.PairStatus", pair_status);
+      tree.put("root.currentgame", state.current_appid);
+      tree.put("root.state", state.current_appid > 0 ? "SUNSHINE_SERVER_BUSY" : "SUNSHINE_SERVER_FREE");
+
+      std::ostringstream data;
+
+      pt::write_xml(data, tree);
+      cached = {std::move(state), data.str()};
+    }
+
+    response->write(cached.data);
+
+    // The connections of the paired clients are kept open, a new one costs a TLS handshake
+    if constexpr (!std::is_same_v<SunshineHTTPS, T>) {
+      response->close_connection_after_response = true;
+    }
   }
 
   nlohmann::json get_all_clients() {
     nlohmann::json named_cert_nodes = nlohmann::json::array();
+
+    std::lock_guard lg {pair_lock};
     client_t &client = client_root;
     for (auto &named_cert : client.named_devices) {
       nlohmann::json named_cert_node;
@@ -781,29 +885,38 @@ namespace nvhttp {
   void applist(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
-    pt::ptree tree;
+    // The apps and whether they can be streamed in HDR
+    std::pair<std::uint64_t, bool> state {proc::apps_version(), video::active_hevc_mode == 3};
 
-    auto g = util::fail_guard([&]() {
-      std::ostringstream data;
+    static std::mutex cache_lock;
+    static cached_response_t<std::pair<std::uint64_t, bool>> cached;
 
-      pt::write_xml(data, tree);
-      response->write(data.str());
-      response->close_connection_after_response = true;
-    });
+    std::lock_guard lg {cache_lock};
+
+    if (cached.data.empty() || cached.state != state) {
+      pt::ptree tree;
 
-    auto &apps = tree.add_child("root", pt::ptree {});
+      auto &apps = tree.add_child("root", pt::ptree {});
 
-    apps.put("<xmlattr>.status_code", 200);
+      apps.put("<xmlattr>.status_code", 200);
 
-    for (auto &proc : proc::proc.get_apps()) {
-      pt::ptree app;
+      for (auto &proc : proc::proc.get_apps()) {
+        pt::ptree app;
 
-      app.put("IsHdrSupported"s, video::active_hevc_mode == 3 ? 1 : 0);
-      app.put("AppTitle"s, proc.name);
-      app.put("ID", proc.id);
+        app.put("IsHdrSupported"s, state.second ? 1 : 0);
+        app.put("AppTitle"s, proc.name);
+        app.put("ID", proc.id);
 
-      apps.push_back(std::make_pair("App", std::move(app)));
+        apps.push_back(std::make_pair("App", std::move(app)));
+      }
+
+      std::ostringstream data;
+
+      pt::write_xml(data, tree);
+      cached = {state, data.str()};
     }
+
+    response->write(cached.data);
   }
 
   void launch(bool &host_audio, resp_https_t response, req_https_t request) {
@@ -816,7 +929,6 @@ namespace nvhttp {
 
       pt::write_xml(data, tree);
       response->write(data.str());
-      response->close_connection_after_response = true;
 
       if (revert_display_configuration) {
         display_device::revert_configuration();
@@ -884,7 +996,16 @@ namespace nvhttp {
       return;
     }
 
-    if (appid > 0) {
+    if (appid > 0 && config::sunshine.async_launch) {
+      // The client sets up its stream while the app starts, PLAY waits for it. The thread holds
+      // the only reference to the promise, so the launch session doesn't keep itself alive.
+      std::promise<int> app_started;
+      launch_session->app_started = app_started.get_future().share();
+
+      std::thread {[appid, launch_session, app_started = std::move(app_started)]() mutable {
+        app_started.set_value(proc::proc.execute(appid, launch_session));
+      }}.detach();
+    } else if (appid > 0) {
       auto err = proc::proc.execute(appid, launch_session);
       if (err) {
         tree.put("root.<xmlattr>.status_code", err);
@@ -899,6 +1020,11 @@ namespace nvhttp {
     tree.put("root.sessionUrl0", launch_session->rtsp_url_scheme + net::addr_to_url_escaped_string(request->local_endpoint().address()) + ':' + std::to_string(net::map_port(rtsp_stream::RTSP_SETUP_PORT)));
     tree.put("root.gamesession", 1);
 
+    // The session is prewarmed while the client sets up its stream
+    if (rtsp_stream::session_count() == 0) {
+      video::prewarm(launch_session->width, launch_session->height, launch_session->fps, launch_session->enable_hdr);
+    }
+
     rtsp_stream::launch_session_raise(launch_session);
 
     // Stream was started successfully, we will revert the config when the app or session terminates
@@ -914,7 +1040,6 @@ namespace nvhttp {
 
       pt::write_xml(data, tree);
       response->write(data.str());
-      response->close_connection_after_response = true;
     });
 
     auto current_appid = proc::proc.running();
@@ -981,6 +1106,11 @@ namespace nvhttp {
     tree.put("root.sessionUrl0", launch_session->rtsp_url_scheme + net::addr_to_url_escaped_string(request->local_endpoint().address()) + ':' + std::to_string(net::map_port(rtsp_stream::RTSP_SETUP_PORT)));
     tree.put("root.resume", 1);
 
+    // The session is prewarmed while the client sets up its stream
+    if (rtsp_stream::session_count() == 0) {
+      video::prewarm(launch_session->width, launch_session->height, launch_session->fps, launch_session->enable_hdr);
+    }
+
     rtsp_stream::launch_session_raise(launch_session);
   }
 
@@ -993,7 +1123,6 @@ namespace nvhttp {
 
       pt::write_xml(data, tree);
       response->write(data.str());
-      response->close_connection_after_response = true;
     });
 
     tree.put("root.cancel", 1);
@@ -1009,17 +1138,112 @@ namespace nvhttp {
     display_device::revert_configuration();
   }
 
+  /**
+   * @brief The images of the apps last requested, clients fetch all of them every time they list the apps.
+   */
+  class app_image_cache_t {
+  public:
+    struct image_t {
+      std::string etag;
+      std::string data;
+
+      // An image is read again when its file changed
+      fs::file_time_type write_time;
+      std::uintmax_t size;
+    };
+
+    explicit app_image_cache_t(std::size_t capacity):
+        _capacity {capacity} {
+    }
+
+    /**
+     * @brief Get an image.
+     * @param path The path of the image.
+     * @return The image, nullptr if it can't be read.
+     */
+    std::shared_ptr<const image_t> get(const std::string &path) {
+      std::error_code ec;
+      auto write_time = fs::last_write_time(path, ec);
+      auto size = ec ? 0 : fs::file_size(path, ec);
+      if (ec) {
+        BOOST_LOG(warning) << "Couldn't read app image ["sv << path << "]: "sv << ec.message();
+        return nullptr;
+      }
+
+      std::lock_guard lg {_lock};
+
+      auto it = _index.find(path);
+      if (it != std::end(_index)) {
+        auto &image = it->second->second;
+        if (image->write_time == write_time && image->size == size) {
+          // Move it to the front, the least recently used image is at the back
+          _images.splice(std::begin(_images), _images, it->second);
+          return image;
+        }
+
+        _images.erase(it->second);
+        _index.erase(it);
+      }
+
+      auto hash = proc::calculate_sha256(path);
+      if (!hash) {
+        return nullptr;
+      }
+
+      auto image = std::make_shared<image_t>();
+      image->etag = '"' + *hash + '"';
+      image->write_time = write_time;
+      image->size = size;
+
+      std::ifstream in(path, std::ios::binary);
+      image->data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+      _images.emplace_front(path, image);
+      _index.emplace(path, std::begin(_images));
+
+      if (_images.size() > _capacity) {
+        _index.erase(_images.back().first);
+        _images.pop_back();
+      }
+
+      return image;
+    }
+
+  private:
+    std::size_t _capacity;
+
+    std::mutex _lock;
+    std::list<std::pair<std::string, std::shared_ptr<const image_t>>> _images;
+    std::unordered_map<std::string, decltype(_images)::iterator> _index;
+  };
+
+  app_image_cache_t app_images {32};
+
   void appasset(resp_https_t response, req_https_t request) {
     print_req<SunshineHTTPS>(request);
 
     auto args = request->parse_query_string();
     auto app_image = proc::proc.get_app_image(util::from_view(get_arg(args, "appid")));
 
-    std::ifstream in(app_image, std::ios::binary);
+    auto image = app_images.get(app_image);
+    if (!image) {
+      response->write(SimpleWeb::StatusCode::client_error_not_found);
+      return;
+    }
+
+    // The connection is kept open, the images of all the apps are requested one after the other
     SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("ETag", image->etag);
+    headers.emplace("Cache-Control", "no-cache");
+
+    auto if_none_match = request->header.find("if-none-match");
+    if (if_none_match != request->header.end() && web_cache::matches(if_none_match->second, image->etag)) {
+      response->write(SimpleWeb::StatusCode::redirection_not_modified, headers);
+      return;
+    }
+
     headers.emplace("Content-Type", "image/png");
-    response->write(SimpleWeb::StatusCode::success_ok, in, headers);
-    response->close_connection_after_response = true;
+    response->write(image->data, headers);
   }
 
   void setup(const std::string &pkey, const std::string &cert) {
@@ -1050,6 +1274,10 @@ namespace nvhttp {
     // launch will store it in host_audio
     bool host_audio {};
 
+    // Launching, resuming and cancelling wait on the app and the display configuration,
+    // they run one at a time on a worker to keep the server threads free for the other requests
+    thread_pool_util::ThreadPool launch_worker {1};
+
     https_server_t https_server {config::nvhttp.cert, config::nvhttp.pkey};
     http_server_t http_server;
 
@@ -1077,6 +1305,7 @@ namespace nvhttp {
         BOOST_LOG(debug) << subject_name << " -- "sv << (verified ? "verified"sv : "denied"sv);
       });
 
+      std::lock_guard lg {cert_chain_lock};
       while (add_cert->peek()) {
         char subject_name[256];
 
@@ -1121,17 +1350,26 @@ namespace nvhttp {
     };
     https_server.resource["^/applist$"]["GET"] = applist;
     https_server.resource["^/appasset$"]["GET"] = appasset;
-    https_server.resource["^/launch$"]["GET"] = [&host_audio](auto resp, auto req) {
-      launch(host_audio, resp, req);
+    https_server.resource["^/launch$"]["GET"] = [&host_audio, &launch_worker](auto resp, auto req) {
+      launch_worker.post([&host_audio, resp, req]() {
+        launch(host_audio, resp, req);
+      });
     };
-    https_server.resource["^/resume$"]["GET"] = [&host_audio](auto resp, auto req) {
-      resume(host_audio, resp, req);
+    https_server.resource["^/resume$"]["GET"] = [&host_audio, &launch_worker](auto resp, auto req) {
+      launch_worker.post([&host_audio, resp, req]() {
+        resume(host_audio, resp, req);
+      });
+    };
+    https_server.resource["^/cancel$"]["GET"] = [&launch_worker](auto resp, auto req) {
+      launch_worker.post([resp, req]() {
+        cancel(resp, req);
+      });
     };
-    https_server.resource["^/cancel$"]["GET"] = cancel;
 
     https_server.config.reuse_address = true;
     https_server.config.address = net::af_to_any_address_string(address_family);
     https_server.config.port = port_https;
+    https_server.config.thread_pool_size = config::nvhttp.threads;
 
     http_server.default_resource["GET"] = not_found<SimpleWeb::HTTP>;
     http_server.resource["^/serverinfo$"]["GET"] = serverinfo<SimpleWeb::HTTP>;
@@ -1142,6 +1380,7 @@ namespace nvhttp {
     http_server.config.reuse_address = true;
     http_server.config.address = net::af_to_any_address_string(address_family);
     http_server.config.port = port_http;
+    http_server.config.thread_pool_size = config::nvhttp.threads;
 
     auto accept_and_run = [&](auto *http_server) {
       try {
@@ -1163,6 +1402,10 @@ namespace nvhttp {
     // Wait for any event
     shutdown_event->view();
 
+    // The pending launches answer through the servers, finish them while they still run
+    launch_worker.stop();
+    launch_worker.join();
+
     https_server.stop();
     http_server.stop();
 
@@ -1171,26 +1414,51 @@ namespace nvhttp {
   }
 
   void erase_all_clients() {
+    std::lock_guard lg {pair_lock};
+
     client_t client;
     client_root = client;
-    cert_chain.clear();
+    {
+      std::lock_guard lg {cert_chain_lock};
+      cert_chain.clear();
+    }
     save_state();
   }
 
   bool unpair_client(const std::string_view uuid) {
-    bool removed = false;
+    std::lock_guard lg {pair_lock};
+
     client_t &client = client_root;
-    for (auto it = client.named_devices.begin(); it != client.named_devices.end();) {
-      if ((*it).uuid == uuid) {
-        it = client.named_devices.erase(it);
-        removed = true;
-      } else {
-        ++it;
+
+    std::vector<std::string> certs;
+    std::erase_if(client.named_devices, [&](named_cert_t &named_cert) {
+      if (named_cert.uuid != uuid) {
+        return false;
+      }
+
+      certs.emplace_back(std::move(named_cert.cert));
+      return true;
+    });
+
+    if (certs.empty()) {
+      return false;
+    }
+
+    // Only the certificates of the unpaired device are taken out of the chain, unless another device was paired with the same one
+    {
+      std::lock_guard lg {cert_chain_lock};
+      for (auto &cert : certs) {
+        auto paired_elsewhere = std::any_of(std::begin(client.named_devices), std::end(client.named_devices), [&](const named_cert_t &named_cert) {
+          return named_cert.cert == cert;
+        });
+
+        if (!paired_elsewhere) {
+          cert_chain.remove(crypto::x509(cert).get());
+        }
       }
     }
 
     save_state();
-    load_state();
-    return removed;
+    return true;
   }
 }  // namespace nvhttp
@@ -0,0 +1,103 @@
+/**
+ * @file src/pacing.cpp
+ * @brief Definitions for pacing of the video stream.
+ */
+// standard includes
+#include <algorithm>
+
+// local includes
+#include "logging.h"
+#include "pacing.h"
+
+using namespace std::literals;
+
+namespace pacing {
+  pacer_t::pacer_t() {
+    reset(0, 0);
+  }
+
+  void pacer_t::reset(std::uint64_t link_speed, std::uint64_t rate_override) {
+    auto ceiling = rate_override;
+    if (!ceiling) {
+      ceiling = (link_speed ? link_speed : DEFAULT_LINK_SPEED) / 100 * LINK_UTILIZATION_PERCENT;
+    }
+
+    _ceiling.store(ceiling, std::memory_order_relaxed);
+    _rate.store(ceiling, std::memory_order_relaxed);
+  }
+
+  void pacer_t::report_loss(std::int64_t lost_frames) {
+    auto ceiling = _ceiling.load(std::memory_order_relaxed);
+    auto rate = _rate.load(std::memory_order_relaxed);
+
+    std::uint64_t new_rate;
+    if (lost_frames > 0) {
+      new_rate = std::max(rate / 100 * DECREASE_PERCENT, ceiling / 100 * MIN_RATE_PERCENT);
+    } else {
+      new_rate = std::min(rate + ceiling / 100 * INCREASE_PERCENT, ceiling);
+    }
+
+    if (new_rate == rate) {
+      return;
+    }
+
+    _rate.store(new_rate, std::memory_order_relaxed);
+
+    if (lost_frames > 0) {
+      BOOST_LOG(debug) << "Reducing video pacing rate to "sv << new_rate / 1000 / 1000 << " Mbps after "sv << lost_frames << " lost frames"sv;
+    }
+  }
+
+  std::uint64_t pacer_t::rate() const {
+    return _rate.load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t pacer_t::ceiling() const {
+    return _ceiling.load(std::memory_order_relaxed);
+  }
+
+  std::size_t pacer_t::packets_per_ms(std::size_t packet_size, bool burst) const {
+    auto rate = this->rate();
+    if (burst) {
+      rate = rate / 100 * BURST_PERCENT;
+    }
+
+    //              ms     byte
+    auto packets = rate / 1000 / 8 / packet_size;
+    return std::max<std::size_t>(1, packets);
+  }
+
+  void deadline_t::reset(std::chrono::nanoseconds budget) {
+    _budget = budget;
+    _first_dropped.reset();
+    _dependent_drops = 0;
+  }
+
+  bool deadline_t::admit(std::int64_t frame_index, std::optional<std::chrono::nanoseconds> age, bool idr, bool after_invalidation) {
+    if (_budget == std::chrono::nanoseconds::zero() || idr) {
+      _first_dropped.reset();
+      return true;
+    }
+
+    if (_first_dropped) {
+      // Like the client, the first frame encoded after an invalidation is trusted not to reference the dropped ones
+      if (after_invalidation || _dependent_drops >= MAX_DEPENDENT_DROPS) {
+        _first_dropped.reset();
+        return true;
+      }
+
+      ++_dependent_drops;
+      _last_dropped = frame_index;
+      return false;
+    }
+
+    if (!age || *age <= _budget) {
+      return true;
+    }
+
+    _first_dropped = frame_index;
+    _last_dropped = frame_index;
+    _dependent_drops = 0;
+    return false;
+  }
+}  // namespace pacing
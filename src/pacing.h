@@ -0,0 +1,128 @@
+/**
+ * @file src/pacing.h
+ * @brief Declarations for pacing of the video stream.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace pacing {
+  /**
+   * @brief The rate at which the video packets of a session are sent.
+   * @details The rate is capped by a ceiling derived from the speed of the link the session
+   *          is streamed over, or by an explicit override. Within that ceiling, it backs off
+   *          multiplicatively when the client reports lost frames and recovers additively
+   *          while the client reports none.
+   *
+   *          The rate is adapted on the control stream thread and read by the thread sending
+   *          the video, so it's kept in atomics.
+   */
+  class pacer_t {
+  public:
+    /// The link speed assumed when it can't be determined
+    static constexpr std::uint64_t DEFAULT_LINK_SPEED = 1'000'000'000;
+
+    /// The share of the link speed used for video
+    static constexpr std::uint64_t LINK_UTILIZATION_PERCENT = 80;
+
+    /// The lowest rate the loss feedback can back off to, as a share of the ceiling
+    static constexpr std::uint64_t MIN_RATE_PERCENT = 10;
+
+    /// The share of the rate kept after a report of lost frames
+    static constexpr std::uint64_t DECREASE_PERCENT = 85;
+
+    /// The share of the ceiling regained after each report without lost frames
+    static constexpr std::uint64_t INCREASE_PERCENT = 2;
+
+    /// The share of the rate IDR and recovery frames are sent at, so the client recovers sooner
+    static constexpr std::uint64_t BURST_PERCENT = 125;
+
+    pacer_t();
+
+    /**
+     * @brief Set the ceiling of the rate and start adapting from it.
+     * @param link_speed The link speed in bits per second, or 0 if it's unknown.
+     * @param rate_override A rate in bits per second to use as the ceiling instead of the one derived from the link speed, or 0.
+     */
+    void reset(std::uint64_t link_speed, std::uint64_t rate_override);
+
+    /**
+     * @brief Adapt the rate to a loss report from the client.
+     * @param lost_frames The number of frames lost since the last report.
+     */
+    void report_loss(std::int64_t lost_frames);
+
+    /**
+     * @brief Get the current rate.
+     * @return The rate in bits per second.
+     */
+    std::uint64_t rate() const;
+
+    /**
+     * @brief Get the ceiling of the rate.
+     * @return The ceiling in bits per second.
+     */
+    std::uint64_t ceiling() const;
+
+    /**
+     * @brief Get the number of packets that may be sent each millisecond at the current rate.
+     * @param packet_size The size of each packet in bytes.
+     * @param burst Whether the packets belong to a frame sent at the burst rate.
+     * @return The number of packets, at least 1.
+     */
+    std::size_t packets_per_ms(std::size_t packet_size, bool burst = false) const;
+
+  private:
+    std::atomic<std::uint64_t> _ceiling;
+    std::atomic<std::uint64_t> _rate;
+  };
+
+  /**
+   * @brief Drops the frames that are too late to be worth sending.
+   * @details After a stall, sending every queued frame only has the client display a cascade of late frames.
+   *          A frame older than the latency budget is dropped, and so are the frames after it, which reference
+   *          it and which the client would discard anyway, until an IDR frame or a frame encoded after the
+   *          dropped ones were invalidated. It's only used by the thread sending the video of the session.
+   */
+  class deadline_t {
+  public:
+    /// The dependent frames dropped at most while waiting for a recovery frame, the client recovers by itself afterwards
+    static constexpr int MAX_DEPENDENT_DROPS = 8;
+
+    /**
+     * @brief Set the latency budget and forget the frames dropped so far.
+     * @param budget The time from the capture of a frame past which it's dropped, 0 to send every frame.
+     */
+    void reset(std::chrono::nanoseconds budget);
+
+    /**
+     * @brief Decide whether to send a frame.
+     * @param frame_index The index of the frame.
+     * @param age The time since the frame was captured, nothing for the frames repeating the previous image.
+     * @param idr Whether the frame is an IDR frame, those are always sent.
+     * @param after_invalidation Whether the frame was encoded after reference frames were invalidated.
+     * @return `false` if the frame is dropped, the range of frames to invalidate includes it then.
+     */
+    bool admit(std::int64_t frame_index, std::optional<std::chrono::nanoseconds> age, bool idr, bool after_invalidation);
+
+    /**
+     * @brief Get the frames dropped since the last one sent.
+     * @return The first and last of them.
+     */
+    std::pair<std::int64_t, std::int64_t> dropped_frames() const {
+      return {_first_dropped.value_or(0), _last_dropped};
+    }
+
+  private:
+    std::chrono::nanoseconds _budget {};
+    std::optional<std::int64_t> _first_dropped;
+    std::int64_t _last_dropped {};
+    int _dependent_drops {};
+  };
+}  // namespace pacing
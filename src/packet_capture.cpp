@@ -0,0 +1,204 @@
+/**
+ * @file src/packet_capture.cpp
+ * @brief Definitions for recording and replaying the encoded video packets.
+ */
+// standard includes
+#include <cstring>
+#include <thread>
+
+// local includes
+#include "logging.h"
+#include "packet_capture.h"
+#include "platform/common.h"
+
+using namespace std::literals;
+
+namespace packet_capture {
+  namespace {
+    enum flags_e : std::uint8_t {
+      IDR = 1 << 0,
+      AFTER_REF_FRAME_INVALIDATION = 1 << 1,
+    };
+
+    /**
+     * @brief The header of a capture file, after the magic.
+     */
+    struct file_header_t {
+      std::uint32_t version;
+      std::uint32_t reserved;
+    };
+
+    /**
+     * @brief The header of a record, followed by the data of the frame and the replaced head.
+     * @details The fields are written in the byte order of the host, captures are meant to be replayed where they're taken.
+     */
+    struct record_header_t {
+      std::int64_t frame_index;
+      std::int64_t frame_timestamp;  ///< Nanoseconds from the first packet, -1 if the packet had no timestamp
+      std::uint32_t data_size;
+      std::uint32_t replaced_head_size;
+      std::uint32_t replaced_size;
+      std::uint8_t flags;
+      std::uint8_t frame_type;
+      std::uint16_t reserved;
+    };
+
+    static_assert(sizeof(file_header_t) == 8 && sizeof(record_header_t) == 32, "The layout of the file must not depend on the compiler");
+  }  // namespace
+
+  writer_t::writer_t(const std::filesystem::path &path):
+      _file {path, std::ios::binary | std::ios::trunc} {
+    if (!_file) {
+      BOOST_LOG(error) << "Couldn't open packet capture file ["sv << path.string() << ']';
+      return;
+    }
+
+    file_header_t header {VERSION, 0};
+    _file.write(MAGIC.data(), MAGIC.size());
+    _file.write((const char *) &header, sizeof(header));
+  }
+
+  bool writer_t::write(video::packet_raw_t &packet) {
+    if (!_file) {
+      return false;
+    }
+
+    record_header_t header {};
+    header.frame_index = packet.frame_index();
+    header.frame_timestamp = -1;
+    header.data_size = (std::uint32_t) packet.data_size();
+    header.replaced_head_size = (std::uint32_t) packet.replaced_head.size();
+    header.replaced_size = (std::uint32_t) packet.replaced_size;
+    header.flags = (packet.is_idr() ? IDR : 0) | (packet.after_ref_frame_invalidation ? AFTER_REF_FRAME_INVALIDATION : 0);
+    header.frame_type = (std::uint8_t) packet.frame_type;
+
+    if (packet.frame_timestamp) {
+      if (!_epoch) {
+        _epoch = packet.frame_timestamp;
+      }
+
+      header.frame_timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(*packet.frame_timestamp - *_epoch).count();
+    }
+
+    _file.write((const char *) &header, sizeof(header));
+    _file.write((const char *) packet.data(), packet.data_size());
+    _file.write((const char *) packet.replaced_head.data(), packet.replaced_head.size());
+
+    return (bool) _file;
+  }
+
+  std::optional<capture_t> capture_t::load(const std::filesystem::path &path) {
+    std::ifstream file {path, std::ios::binary | std::ios::ate};
+    if (!file) {
+      BOOST_LOG(error) << "Couldn't open packet capture file ["sv << path.string() << ']';
+      return std::nullopt;
+    }
+
+    capture_t capture;
+    capture._contents.resize((std::size_t) file.tellg());
+    file.seekg(0);
+    if (!file.read(capture._contents.data(), capture._contents.size())) {
+      BOOST_LOG(error) << "Couldn't read packet capture file ["sv << path.string() << ']';
+      return std::nullopt;
+    }
+
+    std::string_view contents {capture._contents.data(), capture._contents.size()};
+
+    file_header_t file_header;
+    if (contents.size() < MAGIC.size() + sizeof(file_header) || contents.substr(0, MAGIC.size()) != MAGIC) {
+      BOOST_LOG(error) << '[' << path.string() << "] isn't a packet capture file"sv;
+      return std::nullopt;
+    }
+    std::memcpy(&file_header, contents.data() + MAGIC.size(), sizeof(file_header));
+    if (file_header.version != VERSION) {
+      BOOST_LOG(error) << "Packet capture file ["sv << path.string() << "] has version "sv << file_header.version << ", expected "sv << VERSION;
+      return std::nullopt;
+    }
+    contents.remove_prefix(MAGIC.size() + sizeof(file_header));
+
+    while (contents.size() >= sizeof(record_header_t)) {
+      record_header_t header;
+      std::memcpy(&header, contents.data(), sizeof(header));
+      contents.remove_prefix(sizeof(header));
+
+      // The recording may have been cut short
+      if (contents.size() < (std::size_t) header.data_size + header.replaced_head_size) {
+        break;
+      }
+
+      record_t record;
+      record.frame_index = header.frame_index;
+      record.idr = header.flags & IDR;
+      record.after_ref_frame_invalidation = header.flags & AFTER_REF_FRAME_INVALIDATION;
+      record.frame_type = (video::frame_type_e) header.frame_type;
+      if (header.frame_timestamp >= 0) {
+        record.frame_timestamp = std::chrono::nanoseconds {header.frame_timestamp};
+      }
+      record.data = contents.substr(0, header.data_size);
+      record.replaced_head = contents.substr(header.data_size, header.replaced_head_size);
+      record.replaced_size = header.replaced_size;
+
+      capture._records.emplace_back(record);
+      contents.remove_prefix(header.data_size + header.replaced_head_size);
+    }
+
+    if (!contents.empty()) {
+      BOOST_LOG(warning) << "Packet capture file ["sv << path.string() << "] ends with a truncated packet"sv;
+    }
+
+    return capture;
+  }
+
+  std::uint64_t capture_t::payload_bytes() const {
+    std::uint64_t bytes = 0;
+    for (auto &record : _records) {
+      bytes += record.data.size();
+    }
+
+    return bytes;
+  }
+
+  video::packet_t make_packet(const record_t &record) {
+    auto packet = std::make_unique<video::packet_raw_generic>(std::vector<uint8_t>(std::begin(record.data), std::end(record.data)), record.frame_index, record.idr);
+
+    packet->after_ref_frame_invalidation = record.after_ref_frame_invalidation;
+    packet->frame_type = record.frame_type;
+    packet->replaced_head.assign(std::begin(record.replaced_head), std::end(record.replaced_head));
+    packet->replaced_size = record.replaced_size;
+
+    return packet;
+  }
+
+  std::size_t replay(const capture_t &capture, safe::mail_raw_t::queue_t<video::packet_t> &packets, double speed, void *channel_data) {
+    auto timer = platf::create_high_precision_timer();
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t raised = 0;
+    for (auto &record : capture.records()) {
+      if (!packets->running()) {
+        break;
+      }
+
+      if (speed > 0 && record.frame_timestamp) {
+        auto due = start + std::chrono::duration_cast<std::chrono::nanoseconds>(*record.frame_timestamp / speed);
+        auto now = std::chrono::steady_clock::now();
+        if (due > now) {
+          if (timer && *timer) {
+            timer->sleep_for(due - now);
+          } else {
+            std::this_thread::sleep_until(due);
+          }
+        }
+      }
+
+      auto packet = make_packet(record);
+      packet->channel_data = channel_data;
+      packet->frame_timestamp = std::chrono::steady_clock::now();
+
+      packets->raise(std::move(packet));
+      ++raised;
+    }
+
+    return raised;
+  }
+}  // namespace packet_capture
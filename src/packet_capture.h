@@ -0,0 +1,125 @@
+/**
+ * @file src/packet_capture.h
+ * @brief Declarations for recording and replaying the encoded video packets.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// local includes
+#include "thread_safe.h"
+#include "video.h"
+
+namespace packet_capture {
+  /// The first bytes of a capture file
+  constexpr std::string_view MAGIC {"SUNPKTS", 8};
+
+  /// The version of the layout of the records, files of another version aren't read
+  constexpr std::uint32_t VERSION = 1;
+
+  /**
+   * @brief A packet read from a capture file.
+   * @details The payloads point into the file loaded by capture_t, they live as long as it does.
+   */
+  struct record_t {
+    std::int64_t frame_index;
+    bool idr;
+    bool after_ref_frame_invalidation;
+    video::frame_type_e frame_type;
+
+    /// When the frame was captured, from the capture of the first packet of the file
+    std::optional<std::chrono::nanoseconds> frame_timestamp;
+
+    std::string_view data;
+
+    /// The parameter sets sent in place of the first replaced_size bytes of data
+    std::string_view replaced_head;
+    std::size_t replaced_size;
+  };
+
+  /**
+   * @brief Appends the packets sent to the clients to a capture file.
+   * @details The packets are written through the buffer of the stream, so recording a frame
+   *          mostly costs copying it. The file is replaced when the writer is opened.
+   */
+  class writer_t {
+  public:
+    /**
+     * @param path The capture file.
+     */
+    explicit writer_t(const std::filesystem::path &path);
+
+    /**
+     * @brief Check whether the file could be opened and all the packets were written so far.
+     */
+    explicit operator bool() const {
+      return (bool) _file;
+    }
+
+    /**
+     * @brief Append a packet.
+     * @param packet The packet, as it's popped from mail::video_packets.
+     * @return `false` if it couldn't be written.
+     */
+    bool write(video::packet_raw_t &packet);
+
+  private:
+    std::ofstream _file;
+
+    // The capture time of the first packet, the timestamps of the file count from it
+    std::optional<std::chrono::steady_clock::time_point> _epoch;
+  };
+
+  /**
+   * @brief A capture file loaded in memory.
+   */
+  class capture_t {
+  public:
+    /**
+     * @brief Load a capture file.
+     * @param path The file.
+     * @return The capture, or `std::nullopt` if the file couldn't be read or isn't a capture file.
+     */
+    static std::optional<capture_t> load(const std::filesystem::path &path);
+
+    [[nodiscard]] const std::vector<record_t> &records() const {
+      return _records;
+    }
+
+    /**
+     * @brief Get the number of bytes of all the frames, as the encoder produced them.
+     */
+    [[nodiscard]] std::uint64_t payload_bytes() const;
+
+  private:
+    // The records point into it, it's never resized after they're parsed
+    std::vector<char> _contents;
+    std::vector<record_t> _records;
+  };
+
+  /**
+   * @brief Make a packet out of a record, as the encoder would have produced it.
+   * @param record The record.
+   * @return The packet, holding a copy of the payload.
+   */
+  video::packet_t make_packet(const record_t &record);
+
+  /**
+   * @brief Raise the packets of a capture on a queue, as an encoder would.
+   * @details The frame timestamps of the packets are set to when they're raised, so the sending thread
+   *          handles them as fresh frames.
+   * @param capture The capture.
+   * @param packets The queue, usually mail::video_packets.
+   * @param speed The factor the original timing is sped up by, 0 to raise the packets without waiting.
+   * @param channel_data The session the packets are meant for.
+   * @return The number of packets raised, fewer than recorded if the queue was stopped.
+   */
+  std::size_t replay(const capture_t &capture, safe::mail_raw_t::queue_t<video::packet_t> &packets, double speed, void *channel_data);
+}  // namespace packet_capture
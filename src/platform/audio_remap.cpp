@@ -0,0 +1,189 @@
+/**
+ * @file src/platform/audio_remap.cpp
+ * @brief Definitions for the conversion and channel mixing of captured audio.
+ */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+// local includes
+#include "common.h"
+
+namespace platf {
+  namespace {
+    constexpr int sample_size(audio_sample_format_e format) {
+      switch (format) {
+        case audio_sample_format_e::f32:
+        case audio_sample_format_e::s32:
+          return 4;
+        case audio_sample_format_e::s24:
+          return 3;
+        case audio_sample_format_e::s16:
+          return 2;
+      }
+
+      return 0;
+    }
+  }  // namespace
+
+#define AUDIO_REMAP_ISA audio_remap_generic
+#include "audio_remap_kernels.h"
+#undef AUDIO_REMAP_ISA
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define AUDIO_REMAP_X86
+
+  // Compile a variant for AVX2
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx2,fma")
+  #endif
+  #define AUDIO_REMAP_ISA audio_remap_avx2
+  #include "audio_remap_kernels.h"
+  #undef AUDIO_REMAP_ISA
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+#endif
+
+  namespace {
+    using remap_audio_frames_t = decltype(&audio_remap_generic::remap_audio_frames);
+
+    remap_audio_frames_t select_remap_audio_frames() {
+#ifdef AUDIO_REMAP_X86
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return audio_remap_avx2::remap_audio_frames;
+      }
+#endif
+
+      return audio_remap_generic::remap_audio_frames;
+    }
+
+    // The speaker positions, in the order of the bits of a channel mask
+    enum speaker_e : std::uint32_t {
+      FL = 1 << 0,  ///< Front left
+      FR = 1 << 1,  ///< Front right
+      FC = 1 << 2,  ///< Front center
+      LFE = 1 << 3,  ///< Low frequency
+      BL = 1 << 4,  ///< Back left
+      BR = 1 << 5,  ///< Back right
+      FLC = 1 << 6,  ///< Front left of center
+      FRC = 1 << 7,  ///< Front right of center
+      BC = 1 << 8,  ///< Back center
+      SL = 1 << 9,  ///< Side left
+      SR = 1 << 10,  ///< Side right
+      TC = 1 << 11,  ///< Top center
+      TFL = 1 << 12,  ///< Top front left
+      TFC = 1 << 13,  ///< Top front center
+      TFR = 1 << 14,  ///< Top front right
+      TBL = 1 << 15,  ///< Top back left
+      TBC = 1 << 16,  ///< Top back center
+      TBR = 1 << 17,  ///< Top back right
+    };
+
+    /**
+     * @brief Where the sound of a speaker goes when the destination has all of the speakers.
+     */
+    struct fold_t {
+      std::uint32_t speakers;
+      float gain;
+    };
+
+    constexpr float MINUS_3DB = 0.7071f;
+    constexpr float MINUS_6DB = 0.5f;
+    constexpr float MINUS_9DB = 0.3536f;
+
+    // For each speaker, the first fold the destination has speakers for is used, the low frequency is dropped otherwise
+    const std::vector<fold_t> folds[MAX_AUDIO_CHANNELS] {
+      {{FL, 1.0f}},
+      {{FR, 1.0f}},
+      {{FC, 1.0f}, {FL | FR, MINUS_3DB}},
+      {{LFE, 1.0f}},
+      {{BL, 1.0f}, {SL, 1.0f}, {FL, MINUS_3DB}},
+      {{BR, 1.0f}, {SR, 1.0f}, {FR, MINUS_3DB}},
+      {{FLC, 1.0f}, {FL, 1.0f}},
+      {{FRC, 1.0f}, {FR, 1.0f}},
+      {{BC, 1.0f}, {BL | BR, MINUS_3DB}, {SL | SR, MINUS_3DB}, {FL | FR, MINUS_6DB}},
+      {{SL, 1.0f}, {BL, 1.0f}, {FL, MINUS_3DB}},
+      {{SR, 1.0f}, {BR, 1.0f}, {FR, MINUS_3DB}},
+      {{TC, 1.0f}, {FL | FR, MINUS_6DB}},
+      {{TFL, 1.0f}, {FL, MINUS_3DB}},
+      {{TFC, 1.0f}, {FC, MINUS_3DB}, {FL | FR, MINUS_6DB}},
+      {{TFR, 1.0f}, {FR, MINUS_3DB}},
+      {{TBL, 1.0f}, {BL, MINUS_3DB}, {SL, MINUS_3DB}, {FL, MINUS_6DB}},
+      {{TBC, 1.0f}, {BC, MINUS_3DB}, {BL | BR, MINUS_6DB}, {SL | SR, MINUS_6DB}, {FL | FR, MINUS_9DB}},
+      {{TBR, 1.0f}, {BR, MINUS_3DB}, {SR, MINUS_3DB}, {FR, MINUS_6DB}},
+    };
+
+    int channel_index(std::uint32_t mask, std::uint32_t speaker) {
+      return std::popcount(mask & (speaker - 1));
+    }
+  }  // namespace
+
+  std::vector<float> audio_mix_matrix(std::uint32_t src_mask, std::uint32_t dst_mask) {
+    auto src_channels = std::popcount(src_mask);
+    auto dst_channels = std::popcount(dst_mask);
+
+    std::vector<float> matrix(src_channels * dst_channels);
+    for (int speaker_index = 0; speaker_index < MAX_AUDIO_CHANNELS; ++speaker_index) {
+      std::uint32_t speaker = 1 << speaker_index;
+      if (!(src_mask & speaker)) {
+        continue;
+      }
+
+      auto src_channel = channel_index(src_mask, speaker);
+      for (auto &fold : folds[speaker_index]) {
+        if ((fold.speakers & dst_mask) != fold.speakers) {
+          continue;
+        }
+
+        for (auto speakers = fold.speakers; speakers; speakers &= speakers - 1) {
+          auto dst_channel = channel_index(dst_mask, speakers & -speakers);
+          matrix[dst_channel * src_channels + src_channel] += fold.gain;
+        }
+        break;
+      }
+    }
+
+    // Each channel landing on its own is only a copy, like the back speakers of 5.1 played on the side ones
+    if (src_channels == dst_channels) {
+      bool copy = true;
+      for (int y = 0; y < dst_channels; ++y) {
+        for (int x = 0; x < src_channels; ++x) {
+          copy = copy && matrix[y * src_channels + x] == (x == y ? 1.0f : 0.0f);
+        }
+      }
+
+      if (copy) {
+        return {};
+      }
+    }
+
+    // Scale the mix down so the loudest channel can't clip
+    float max_gain = 1.0f;
+    for (int y = 0; y < dst_channels; ++y) {
+      auto row = std::begin(matrix) + y * src_channels;
+      max_gain = std::max(max_gain, std::accumulate(row, row + src_channels, 0.0f));
+    }
+
+    for (auto &gain : matrix) {
+      gain /= max_gain;
+    }
+
+    return matrix;
+  }
+
+  void remap_audio_frames(audio_sample_format_e format, const std::uint8_t *src, int src_channels, float *dst, int dst_channels, const float *matrix, int frames) {
+    static const auto remap_audio_frames_fn = select_remap_audio_frames();
+
+    remap_audio_frames_fn(format, src, src_channels, dst, dst_channels, matrix, frames);
+  }
+}  // namespace platf
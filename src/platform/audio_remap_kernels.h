@@ -0,0 +1,86 @@
+/**
+ * @file src/platform/audio_remap_kernels.h
+ * @brief Kernels of the conversion and channel mixing of captured audio.
+ * @details Included by audio_remap.cpp once per instruction set, in a namespace named by
+ *          `AUDIO_REMAP_ISA`. The loops are kept simple enough to vectorize.
+ */
+
+namespace AUDIO_REMAP_ISA {
+  template<audio_sample_format_e FORMAT>
+  float load_sample(const std::uint8_t *src) {
+    if constexpr (FORMAT == audio_sample_format_e::f32) {
+      float sample;
+      std::memcpy(&sample, src, sizeof(sample));
+      return sample;
+    } else if constexpr (FORMAT == audio_sample_format_e::s32) {
+      std::int32_t sample;
+      std::memcpy(&sample, src, sizeof(sample));
+      return (float) sample * (1.0f / 2147483648.0f);
+    } else if constexpr (FORMAT == audio_sample_format_e::s24) {
+      // Shifted into the high bits, so the sign is kept
+      auto sample = (std::int32_t) ((std::uint32_t) src[0] << 8 | (std::uint32_t) src[1] << 16 | (std::uint32_t) src[2] << 24);
+      return (float) sample * (1.0f / 2147483648.0f);
+    } else {
+      std::int16_t sample;
+      std::memcpy(&sample, src, sizeof(sample));
+      return (float) sample * (1.0f / 32768.0f);
+    }
+  }
+
+  template<audio_sample_format_e FORMAT>
+  void convert(const std::uint8_t *__restrict src, float *__restrict dst, int samples) {
+    constexpr int size = sample_size(FORMAT);
+
+    for (int x = 0; x < samples; ++x) {
+      dst[x] = load_sample<FORMAT>(src + x * size);
+    }
+  }
+
+  template<audio_sample_format_e FORMAT>
+  void mix(const std::uint8_t *__restrict src, int src_channels, float *__restrict dst, int dst_channels, const float *__restrict matrix, int frames) {
+    constexpr int size = sample_size(FORMAT);
+
+    float frame[MAX_AUDIO_CHANNELS];
+    for (int x = 0; x < frames; ++x) {
+      for (int channel = 0; channel < src_channels; ++channel) {
+        frame[channel] = load_sample<FORMAT>(src + (x * src_channels + channel) * size);
+      }
+
+      for (int channel = 0; channel < dst_channels; ++channel) {
+        auto row = matrix + channel * src_channels;
+
+        float sample = 0.0f;
+        for (int y = 0; y < src_channels; ++y) {
+          sample += row[y] * frame[y];
+        }
+        dst[x * dst_channels + channel] = sample;
+      }
+    }
+  }
+
+  template<audio_sample_format_e FORMAT>
+  void remap(const std::uint8_t *src, int src_channels, float *dst, int dst_channels, const float *matrix, int frames) {
+    if (matrix) {
+      mix<FORMAT>(src, src_channels, dst, dst_channels, matrix, frames);
+    } else {
+      convert<FORMAT>(src, dst, frames * dst_channels);
+    }
+  }
+
+  void remap_audio_frames(audio_sample_format_e format, const std::uint8_t *src, int src_channels, float *dst, int dst_channels, const float *matrix, int frames) {
+    switch (format) {
+      case audio_sample_format_e::f32:
+        remap<audio_sample_format_e::f32>(src, src_channels, dst, dst_channels, matrix, frames);
+        break;
+      case audio_sample_format_e::s32:
+        remap<audio_sample_format_e::s32>(src, src_channels, dst, dst_channels, matrix, frames);
+        break;
+      case audio_sample_format_e::s24:
+        remap<audio_sample_format_e::s24>(src, src_channels, dst, dst_channels, matrix, frames);
+        break;
+      case audio_sample_format_e::s16:
+        remap<audio_sample_format_e::s16>(src, src_channels, dst, dst_channels, matrix, frames);
+        break;
+    }
+  }
+}  // namespace AUDIO_REMAP_ISA
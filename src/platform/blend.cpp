@@ -0,0 +1,74 @@
+/**
+ * @file src/platform/blend.cpp
+ * @brief Definitions for the cursor blending of the RAM capture paths.
+ */
+// standard includes
+#include <cstdint>
+
+// local includes
+#include "common.h"
+
+namespace platf {
+#define BLEND_ISA blend_generic
+#include "blend_kernels.h"
+#undef BLEND_ISA
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64)
+  #define BLEND_X86
+
+  // Compile a variant for AVX2
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx2")
+  #endif
+  #define BLEND_ISA blend_avx2
+  #include "blend_kernels.h"
+  #undef BLEND_ISA
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+
+  // Compile a variant for AVX512BW
+  #if defined(__clang__)
+    #pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+  #else
+    #pragma GCC push_options
+    #pragma GCC target("avx512f,avx512bw")
+  #endif
+  #define BLEND_ISA blend_avx512
+  #include "blend_kernels.h"
+  #undef BLEND_ISA
+  #if defined(__clang__)
+    #pragma clang attribute pop
+  #else
+    #pragma GCC pop_options
+  #endif
+#endif
+
+  namespace {
+    using blend_cursor_row_t = decltype(&blend_generic::blend_cursor_row);
+
+    blend_cursor_row_t select_blend_cursor_row() {
+#ifdef BLEND_X86
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return blend_avx512::blend_cursor_row;
+      }
+      if (__builtin_cpu_supports("avx2")) {
+        return blend_avx2::blend_cursor_row;
+      }
+#endif
+
+      return blend_generic::blend_cursor_row;
+    }
+  }  // namespace
+
+  void blend_cursor_row(std::uint32_t *pixels, const std::uint32_t *cursor, int width) {
+    static const auto blend_cursor_row_fn = select_blend_cursor_row();
+
+    blend_cursor_row_fn(pixels, cursor, width);
+  }
+}  // namespace platf
@@ -0,0 +1,31 @@
+/**
+ * @file src/platform/blend_kernels.h
+ * @brief Kernel of the cursor blending of the RAM capture paths.
+ * @details Included by blend.cpp once per instruction set, in a namespace named by
+ *          `BLEND_ISA`. The loop is kept branchless so it vectorizes.
+ */
+
+namespace BLEND_ISA {
+  void blend_cursor_row(std::uint32_t *__restrict pixels, const std::uint32_t *__restrict cursor, int width) {
+    for (int x = 0; x < width; ++x) {
+      auto cursor_pixel = cursor[x];
+      auto pixel = pixels[x];
+
+      auto alpha = cursor_pixel >> 24;
+      auto inverse_alpha = 255 - alpha;
+
+      // (color * (255 - alpha) + 255 / 2) / 255 without dividing
+      auto blend = [&](int shift) {
+        auto value = ((pixel >> shift) & 0xFF) * inverse_alpha + 128;
+        value = (value + (value >> 8)) >> 8;
+
+        return ((((cursor_pixel >> shift) & 0xFF) + value) & 0xFF) << shift;
+      };
+
+      // Opaque cursor pixels replace the image's alpha too
+      auto alpha_out = alpha == 255 ? 0xFF000000u : pixel & 0xFF000000u;
+
+      pixels[x] = blend(0) | blend(8) | blend(16) | alpha_out;
+    }
+  }
+}  // namespace BLEND_ISA
@@ -5,11 +5,18 @@
 #pragma once
 
 // standard includes
+#include <array>
 #include <bitset>
+#include <chrono>
 #include <filesystem>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 // lib includes
 #include <boost/core/noncopyable.hpp>
@@ -278,6 +285,7 @@ namespace platf {
 
     constexpr caps_t pen_touch = 0x01;  // Pen and touch events
     constexpr caps_t controller_touch = 0x02;  // Controller touch events
+    constexpr caps_t cursor_out_of_band = 0x04;  // Cursor shape and position sent over the control stream
   };  // namespace platform_caps
 
   struct gamepad_state_t {
@@ -288,6 +296,8 @@ namespace platf {
     std::int16_t lsY;
     std::int16_t rsX;
     std::int16_t rsY;
+
+    bool operator==(const gamepad_state_t &) const = default;
   };
 
   struct gamepad_id_t {
@@ -362,6 +372,44 @@ namespace platf {
     virtual ~deinit_t() = default;
   };
 
+  /**
+   * @brief A region of an image that changed.
+   */
+  struct damage_rect_t {
+    int x, y;
+    int width, height;
+
+    bool operator==(const damage_rect_t &) const = default;
+  };
+
+  /**
+   * @brief The image of a cursor.
+   */
+  struct cursor_shape_t {
+    // Tells shapes apart, a new shape gets a new serial
+    std::uint32_t serial;
+
+    int width, height;
+
+    // The point of the cursor that's at its position
+    int hot_x, hot_y;
+
+    // BGRA with colors premultiplied by alpha, width * 4 bytes per row
+    std::vector<std::uint8_t> pixels;
+  };
+
+  /**
+   * @brief The cursor of a display.
+   */
+  struct cursor_state_t {
+    bool visible;
+
+    // The top left corner of the cursor shape in the captured image
+    int x, y;
+
+    std::shared_ptr<const cursor_shape_t> shape;
+  };
+
   struct img_t: std::enable_shared_from_this<img_t> {
   public:
     img_t() = default;
@@ -379,9 +427,69 @@ namespace platf {
 
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
 
+    // Counts the captured images, tells whether any were missed since the last one
+    std::uint64_t capture_sequence {};
+
+    // The regions that changed since the image captured before this one, or std::nullopt if unknown.
+    // The image is the same as the one before if this is empty.
+    std::optional<std::vector<damage_rect_t>> damage;
+
+    // The cursor when it's left out of the image, std::nullopt if it's blended in or unknown
+    std::optional<cursor_state_t> cursor;
+
+    // The regions the user works in, like the foreground window and the cursor, empty if unknown
+    std::vector<damage_rect_t> focus;
+
     virtual ~img_t() = default;
   };
 
+  /**
+   * @brief Blend a row of a cursor over a row of a BGRA image.
+   * @details The cursor's colors are premultiplied by its alpha. Uses the best vectorized variant the CPU supports.
+   * @param pixels The row of the image.
+   * @param cursor The row of the cursor.
+   * @param width The number of pixels to blend.
+   */
+  void blend_cursor_row(std::uint32_t *pixels, const std::uint32_t *cursor, int width);
+
+  /**
+   * @brief The formats of the samples audio devices mix in.
+   */
+  enum class audio_sample_format_e {
+    f32,  ///< 32-bit float
+    s32,  ///< 32-bit signed integer, also used for 24 valid bits in 32
+    s24,  ///< Packed 24-bit signed integer
+    s16,  ///< 16-bit signed integer
+  };
+
+  /// The most channels a layout of speaker positions can have
+  constexpr int MAX_AUDIO_CHANNELS = 18;
+
+  /**
+   * @brief Get the matrix that mixes the channels of one speaker layout into another.
+   * @details The layouts are masks of speaker positions like `WAVEFORMATEXTENSIBLE::dwChannelMask`,
+   *          their channels are ordered like the bits of the mask. Speakers missing from the destination
+   *          are folded into their nearest ones, the destination must have front left and right speakers.
+   * @param src_mask The layout of the source.
+   * @param dst_mask The layout of the destination.
+   * @return The coefficients, a row of source channels for each destination channel, or an empty
+   *         vector if the source channels only need to be copied as they are.
+   */
+  std::vector<float> audio_mix_matrix(std::uint32_t src_mask, std::uint32_t dst_mask);
+
+  /**
+   * @brief Convert interleaved audio frames to float and mix them into another layout, in one pass.
+   * @details Uses the best vectorized variant the CPU supports.
+   * @param format The format of the source samples.
+   * @param src The source frames.
+   * @param src_channels The channels of a source frame, at most `MAX_AUDIO_CHANNELS`.
+   * @param dst The destination frames.
+   * @param dst_channels The channels of a destination frame.
+   * @param matrix The matrix from `audio_mix_matrix()`, `nullptr` if the channels are only copied.
+   * @param frames The number of frames.
+   */
+  void remap_audio_frames(audio_sample_format_e format, const std::uint8_t *src, int src_channels, float *dst, int dst_channels, const float *matrix, int frames);
+
   struct sink_t {
     // Play on host PC
     std::string host;
@@ -460,6 +568,149 @@ namespace platf {
     error  ///< Error
   };
 
+  /**
+   * @brief The performance counters every capture backend keeps the same way, to compare them across platforms.
+   * @details They're exported in the metrics labeled with the backend, the displays of a backend share the series.
+   */
+  class capture_stats_t {
+  public:
+    /**
+     * @param backend The name of the backend, like "kms" or "wgc".
+     * @param present_timestamps Whether the backend stamps its images with the time the compositor presented them.
+     *                           Otherwise they're stamped when captured, and the time from present to capture is unknown.
+     */
+    capture_stats_t(std::string_view backend, bool present_timestamps):
+        present_timestamps {present_timestamps} {
+      metrics::labels_t labels {{"backend", std::string {backend}}};
+
+      frames = metrics::counter("sunshine_capture_frames_total", "Frames captured, the duplicates included", labels);
+      duplicates = metrics::counter("sunshine_capture_duplicate_frames_total", "Frames captured that didn't change since the previous one", labels);
+      timeouts = metrics::counter("sunshine_capture_timeouts_total", "Snapshots that timed out without a new frame", labels);
+      snapshot_duration = metrics::summary("sunshine_capture_snapshot_seconds", "Time to take each snapshot of a frame", labels);
+      convert_duration = metrics::summary("sunshine_capture_convert_seconds", "Time to convert each captured frame for the encoder", labels);
+      present_to_capture = metrics::summary("sunshine_capture_present_to_capture_seconds", "Time from the compositor presenting a frame to its capture", labels);
+    }
+
+    /**
+     * @brief Count the outcome of a snapshot, called by the backends.
+     * @param status What the snapshot returned.
+     * @param begin When the snapshot started.
+     * @param img The image it captured into, if any.
+     */
+    void snapshot(capture_e status, std::chrono::steady_clock::time_point begin, const img_t *img) {
+      auto now = std::chrono::steady_clock::now();
+
+      if (status == capture_e::timeout) {
+        timeouts->increment();
+        return;
+      }
+      if (status != capture_e::ok || !img) {
+        return;
+      }
+
+      frames->increment();
+      if (img->damage && img->damage->empty()) {
+        duplicates->increment();
+      }
+
+      auto snapshot_seconds = std::chrono::duration<double>(now - begin).count();
+      snapshot_duration->observe(snapshot_seconds);
+      _totals.frames += 1;
+      _totals.snapshot_seconds += snapshot_seconds;
+
+      if (present_timestamps && img->frame_timestamp) {
+        auto present_to_capture_seconds = std::chrono::duration<double>(now - *img->frame_timestamp).count();
+        present_to_capture->observe(present_to_capture_seconds);
+        _totals.present_frames += 1;
+        _totals.present_to_capture_seconds += present_to_capture_seconds;
+      }
+    }
+
+    /**
+     * @brief Count the conversion of a captured image, called by the encoders.
+     * @param duration The time it took.
+     */
+    void converted(std::chrono::steady_clock::duration duration) {
+      convert_duration->observe(std::chrono::duration<double>(duration).count());
+    }
+
+    /**
+     * @brief The counts of this display alone, the metrics add up every display of the backend.
+     */
+    struct totals_t {
+      std::uint64_t frames = 0;  ///< Frames captured
+      std::uint64_t present_frames = 0;  ///< Frames captured with the time the compositor presented them
+      double snapshot_seconds = 0;  ///< Time spent taking the snapshots of the frames
+      double present_to_capture_seconds = 0;  ///< Time from present to capture of the frames with a present time
+
+      /**
+       * @brief The average cost of a frame: the time to take its snapshot, plus its wait from present to capture when known.
+       * @return The cost in seconds, or infinity without any frame.
+       */
+      double frame_cost() const {
+        if (!frames) {
+          return std::numeric_limits<double>::infinity();
+        }
+
+        auto cost = snapshot_seconds / frames;
+        if (present_frames) {
+          cost += present_to_capture_seconds / present_frames;
+        }
+
+        return cost;
+      }
+    };
+
+    /**
+     * @brief Get the counts of the snapshots of this display.
+     * @return The counts.
+     */
+    const totals_t &totals() const {
+      return _totals;
+    }
+
+  private:
+    bool present_timestamps;
+    totals_t _totals;
+
+    std::shared_ptr<metrics::counter_t> frames;
+    std::shared_ptr<metrics::counter_t> duplicates;
+    std::shared_ptr<metrics::counter_t> timeouts;
+    std::shared_ptr<metrics::summary_t> snapshot_duration;
+    std::shared_ptr<metrics::summary_t> convert_duration;
+    std::shared_ptr<metrics::summary_t> present_to_capture;
+  };
+
+  /**
+   * @brief Pick the backend with the cheapest frames from the counts of their calibration.
+   * @param candidates The counts of each backend, captured for the same time.
+   * @param min_frames The frames a backend must have captured to be compared.
+   * @return The index of the fastest candidate, or nothing when none captured enough frames to tell.
+   */
+  inline std::optional<std::size_t> fastest_capture(const std::vector<capture_stats_t::totals_t> &candidates, std::uint64_t min_frames) {
+    std::optional<std::size_t> fastest;
+    for (std::size_t x = 0; x < candidates.size(); ++x) {
+      if (candidates[x].frames < min_frames) {
+        continue;
+      }
+
+      if (!fastest || candidates[x].frame_cost() < candidates[*fastest].frame_cost()) {
+        fastest = x;
+      }
+    }
+
+    return fastest;
+  }
+
+  /**
+   * @brief The HDR state of a display.
+   */
+  struct hdr_state_t {
+    bool enabled;  ///< The display is in HDR mode
+    bool has_metadata;  ///< The display reported its metadata
+    SS_HDR_METADATA metadata;
+  };
+
   class display_t {
   public:
     /**
@@ -511,13 +762,32 @@ namespace platf {
       return nullptr;
     }
 
-    virtual bool is_hdr() {
-      return false;
+    /**
+     * @brief Check whether the display is in HDR mode.
+     * @details Reads the cached HDR state, so any thread can call it without querying the OS.
+     */
+    bool is_hdr() const {
+      return hdr_state().enabled;
+    }
+
+    /**
+     * @brief Get the HDR metadata of the display from the cached HDR state.
+     * @param metadata The metadata, zeroed if the display didn't report any.
+     * @return `true` if the display reported its metadata.
+     */
+    bool get_hdr_metadata(SS_HDR_METADATA &metadata) const {
+      auto state = hdr_state();
+      metadata = state.metadata;
+
+      return state.has_metadata;
     }
 
-    virtual bool get_hdr_metadata(SS_HDR_METADATA &metadata) {
-      std::memset(&metadata, 0, sizeof(metadata));
-      return false;
+    /**
+     * @brief Get the cached HDR state of the display.
+     * @return The state as of the last refresh_hdr_state().
+     */
+    hdr_state_t hdr_state() const {
+      return _hdr_state.load();
     }
 
     /**
@@ -530,6 +800,36 @@ namespace platf {
       return true;
     }
 
+    /**
+     * @brief Describes a capture backend in its capture stats.
+     */
+    struct capture_backend_t {
+      std::string_view name;  ///< Like "kms" or "wgc"
+      bool present_timestamps;  ///< The images are stamped with the time the compositor presented them
+    };
+
+    /**
+     * @brief Get the backend capturing this display.
+     * @return The backend.
+     */
+    virtual capture_backend_t capture_backend() const {
+      return {"unknown"sv, false};
+    }
+
+    /**
+     * @brief Get the performance counters of the capture, created on first use.
+     * @details The backends count their snapshots in them and the encoders count their conversions.
+     * @return The counters.
+     */
+    capture_stats_t &capture_stats() {
+      std::call_once(capture_stats_once, [this]() {
+        auto backend = capture_backend();
+        _capture_stats.emplace(backend.name, backend.present_timestamps);
+      });
+
+      return *_capture_stats;
+    }
+
     virtual ~display_t() = default;
 
     // Offsets for when streaming a specific monitor. By default, they are 0.
@@ -539,14 +839,46 @@ namespace platf {
     int width, height;
 
   protected:
+    /**
+     * @brief Query the HDR state of the display from the OS.
+     * @details Only called through refresh_hdr_state(), the default is an SDR display.
+     * @return The state.
+     */
+    virtual hdr_state_t query_hdr_state() {
+      return {};
+    }
+
+    /**
+     * @brief Query the HDR state and publish it to the readers of the cached state.
+     * @details The backends call it once initialized. A change of HDR state makes them
+     *          reinitialize, so the cached state is refreshed with the new display.
+     */
+    void refresh_hdr_state() {
+      _hdr_state.store(query_hdr_state());
+    }
+
     // collect capture timing data (at loglevel debug)
     logging::time_delta_periodic_logger sleep_overshoot_logger = {debug, "Frame capture sleep overshoot"};
+
+  private:
+    std::once_flag capture_stats_once;
+    std::optional<capture_stats_t> _capture_stats;
+
+    safe::snapshot_t<hdr_state_t> _hdr_state;
   };
 
   class mic_t {
   public:
     virtual capture_e sample(std::vector<float> &frame_buffer) = 0;
 
+    /**
+     * @brief Get when the first sample of the frame sample() returned last was captured.
+     * @return The time, or `std::nullopt` if the backend doesn't know it.
+     */
+    virtual std::optional<std::chrono::steady_clock::time_point> frame_timestamp() {
+      return std::nullopt;
+    }
+
     virtual ~mic_t() = default;
   };
 
@@ -576,6 +908,13 @@ namespace platf {
 
   std::string get_mac_address(const std::string_view &address);
 
+  /**
+   * @brief Get the speed of the network link an address is assigned to.
+   * @param address The local address.
+   * @return The link speed in bits per second, or 0 if it's unknown.
+   */
+  std::uint64_t get_link_speed(const std::string_view &address);
+
   std::string from_sockaddr(const sockaddr *const);
   std::pair<std::uint16_t, std::string> from_sockaddr_ex(const sockaddr *const);
 
@@ -600,6 +939,13 @@ namespace platf {
    */
   bool needs_encoder_reenumeration();
 
+  /**
+   * @brief Describe the GPUs, their drivers and the connected displays.
+   * @details Encoder probe results remain valid as long as this doesn't change.
+   * @return The description, or an empty string if the platform can't tell.
+   */
+  std::string gpu_fingerprint();
+
   boost::process::v1::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const boost::process::v1::environment &env, FILE *file, std::error_code &ec, boost::process::v1::group *group);
 
   enum class thread_priority_e : int {
@@ -610,6 +956,44 @@ namespace platf {
   };
   void adjust_thread_priority(thread_priority_e priority);
 
+  /**
+   * @brief Pin the calling thread to a set of CPUs.
+   * @param cpus The CPUs, numbered as the OS numbers them.
+   * @return `true` on success.
+   */
+  bool set_thread_affinity(const std::vector<int> &cpus);
+
+  /**
+   * @brief Get the CPUs of a NUMA node.
+   * @param node The NUMA node.
+   * @return The CPUs, or an empty list if there's no such node.
+   */
+  std::vector<int> numa_node_cpus(int node);
+
+  /**
+   * @brief Get the CPUs closest to the GPU used for encoding.
+   * @details These are the CPUs attached to the NUMA node of the GPU that share a last level cache,
+   *          such as a single CCD of a chiplet based CPU.
+   * @return The CPUs, or an empty list if they can't be determined.
+   */
+  std::vector<int> gpu_local_cpus();
+
+  /**
+   * @brief Allocate the pixels of an image captured to system memory.
+   * @details The memory is backed by huge pages where the OS permits it, and placed on the
+   *          NUMA node of the CPUs the encode threads run on. Otherwise it's regular memory.
+   * @param size The size in bytes.
+   * @return The memory, or `nullptr` on failure.
+   */
+  std::uint8_t *alloc_frame_data(std::size_t size);
+
+  /**
+   * @brief Free the pixels allocated by `alloc_frame_data()`.
+   * @param data The memory, or `nullptr`.
+   * @param size The size it was allocated with.
+   */
+  void free_frame_data(std::uint8_t *data, std::size_t size);
+
   // Allow OS-specific actions to be taken to prepare for streaming
   void streaming_will_start();
   void streaming_will_stop();
@@ -670,6 +1054,18 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // DSCP value to mark these packets with instead of the one of the socket, or 0.
+    // Only honored where the OS allows marking individual packets.
+    std::uint8_t dscp = 0;
+
+    // Time the kernel sends these packets at instead of right away, see enable_tx_launch_time().
+    // Left at the epoch to send them right away.
+    std::chrono::steady_clock::time_point launch_time {};
+
+    // The socket is connected to the target, which is then left out of the messages
+    // so the kernel reuses the route it looked up on connect()
+    bool connected = false;
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -702,10 +1098,70 @@ namespace platf {
     boost::asio::ip::address &target_address;
     uint16_t target_port;
     boost::asio::ip::address &source_address;
+
+    // Ask for a transmit timestamp, see enable_tx_timestamps()
+    bool tx_timestamp = false;
+
+    // DSCP value to mark this packet with instead of the one of the socket, or 0,
+    // see batched_send_info_t::dscp
+    std::uint8_t dscp = 0;
+
+    // Time the kernel sends this packet at, see batched_send_info_t::launch_time
+    std::chrono::steady_clock::time_point launch_time {};
+
+    // The socket is connected to the target, see batched_send_info_t::connected
+    bool connected = false;
   };
 
   bool send(send_info_t &send_info);
 
+  /**
+   * @brief Let the kernel report when packets sent on a UDP socket leave the host.
+   * @details Only packets sent with `send_info_t::tx_timestamp` set are timestamped. They're
+   *          numbered from 0 in the order they're sent, and their timestamps are collected
+   *          with read_tx_timestamps().
+   * @param native_socket The native socket handle.
+   * @return `true` if transmit timestamps are supported and were enabled.
+   */
+  bool enable_tx_timestamps(std::uintptr_t native_socket);
+
+  /**
+   * @brief Let packets sent on a UDP socket be held by the kernel until their launch time.
+   * @details The packets sent with `launch_time` set then leave the host at that time, if the
+   *          queueing discipline of the interface honors it. Others send them right away.
+   * @param native_socket The native socket handle.
+   * @return `true` if launch times are supported and were enabled.
+   */
+  bool enable_tx_launch_time(std::uintptr_t native_socket);
+
+  /**
+   * @brief Collect the transmit timestamps reported on a socket without blocking.
+   * @param native_socket The native socket handle.
+   * @param callback Called with the id and the send time of each timestamped packet.
+   */
+  void read_tx_timestamps(std::uintptr_t native_socket, const std::function<void(std::uint32_t, std::chrono::steady_clock::time_point)> &callback);
+
+  struct recv_datagram_t {
+    // Caller-provided storage for the payload
+    char *buffer;
+    size_t size;
+
+    // The native socket address of the sender
+    alignas(8) std::array<char, 128> address;
+    size_t address_size;
+  };
+
+  /**
+   * @brief Receive the datagrams waiting on a UDP socket with as few system calls as possible.
+   * @details This never blocks, it returns once no more datagrams are queued on the socket.
+   * @param native_socket The native socket handle.
+   * @param datagrams The datagrams to receive into.
+   * @param count The number of datagrams.
+   * @param buffer_size The size of the buffer of each datagram.
+   * @return The number of datagrams received, or -1 if batched receive isn't supported on this platform.
+   */
+  int recv_batch(std::uintptr_t native_socket, recv_datagram_t *datagrams, size_t count, size_t buffer_size);
+
   enum class qos_data_type_e : int {
     audio,  ///< Audio
     video  ///< Video
@@ -741,6 +1197,16 @@ namespace platf {
    */
   bool process_group_running(std::uintptr_t native_handle);
 
+  /**
+   * @brief Get notified by the OS when an app exits, instead of polling its processes.
+   * @param process_handle The native handle of the initial process of the app.
+   * @param group_handle The native handle of the process group of the app.
+   * @param wait_all Wait for all the processes of the group instead of only the initial one.
+   * @param on_exit Called once from the thread of the watch when the app exited, it must not block.
+   * @return The watch, stopped when destroyed. `nullptr` if the app can't be watched and must be polled.
+   */
+  std::unique_ptr<deinit_t> watch_process_exit(std::uintptr_t process_handle, std::uintptr_t group_handle, bool wait_all, std::function<void()> on_exit);
+
   input_t input();
   /**
    * @brief Get the current mouse position on screen
@@ -806,6 +1272,19 @@ namespace platf {
    */
   void gamepad_battery(input_t &input, const gamepad_battery_t &battery);
 
+  /**
+   * @brief Start collecting the input the calling thread sends to the OS.
+   * @details Backends that can inject several events at once hold them back until `end_input_batch()`.
+   * @param input The global input context.
+   */
+  void begin_input_batch(input_t &input);
+
+  /**
+   * @brief Send the input collected since `begin_input_batch()` to the OS.
+   * @param input The global input context.
+   */
+  void end_input_batch(input_t &input);
+
   /**
    * @brief Create a new virtual gamepad.
    * @param input The global input context.
@@ -868,4 +1347,60 @@ namespace platf {
    */
   std::unique_ptr<high_precision_timer> create_high_precision_timer();
 
+  /**
+   * @brief Learns how late a timer wakes up, so a hybrid timer can wake up that much early.
+   * @details The margin jumps to any overshoot larger than it, since waking up late is what
+   *          it's there to prevent, and decays slowly towards smaller ones.
+   */
+  class spin_calibration_t {
+  public:
+    /// The margin used before any overshoot is measured
+    static constexpr std::chrono::nanoseconds INITIAL_MARGIN = std::chrono::microseconds(500);
+
+    /// The smallest margin, since even a quiet system wakes up a little late
+    static constexpr std::chrono::nanoseconds MIN_MARGIN = std::chrono::microseconds(50);
+
+    /// The largest margin, so a single stall doesn't make the timer spin for long
+    static constexpr std::chrono::nanoseconds MAX_MARGIN = std::chrono::milliseconds(4);
+
+    /// The margin decays by this fraction of its difference to a smaller overshoot
+    static constexpr int DECAY_DIVISOR = 64;
+
+    /**
+     * @param spin_budget_percent The largest share of each sleep that may be spent spinning.
+     */
+    explicit spin_calibration_t(int spin_budget_percent);
+
+    /**
+     * @brief Get how long to sleep before spinning.
+     * @param duration The whole duration to wait.
+     * @return The duration to sleep, which is 0 if the whole duration should be spun.
+     */
+    std::chrono::nanoseconds sleep_duration(std::chrono::nanoseconds duration) const;
+
+    /**
+     * @brief Learn from how late a sleep woke up.
+     * @param overshoot The time between the end of the requested sleep and the wake up.
+     */
+    void record(std::chrono::nanoseconds overshoot);
+
+    /**
+     * @return The current margin.
+     */
+    std::chrono::nanoseconds margin() const;
+
+  private:
+    int _spin_budget_percent;
+    std::chrono::nanoseconds _margin;
+  };
+
+  /**
+   * @brief Create a timer that sleeps until shortly before the deadline and spins the rest.
+   * @details The platform timer does the sleeping. How early it has to wake up is calibrated
+   *          from its measured overshoot.
+   * @param spin_budget_percent The largest share of each sleep that may be spent spinning.
+   * @return A unique pointer to the timer.
+   */
+  std::unique_ptr<high_precision_timer> create_hybrid_timer(int spin_budget_percent = 10);
+
 }  // namespace platf
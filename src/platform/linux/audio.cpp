@@ -3,7 +3,12 @@
  * @brief Definitions for audio control on Linux.
  */
 // standard includes
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <thread>
 
@@ -11,13 +16,13 @@
 #include <boost/regex.hpp>
 #include <pulse/error.h>
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
 
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
 #include "src/thread_safe.h"
+#include "src/utility.h"
 
 namespace platf {
   using namespace std::literals;
@@ -50,27 +55,226 @@ namespace platf {
     return result;
   }
 
+  /**
+   * @brief Records a source with an asynchronous stream on its own main loop thread.
+   * @details The server delivers fragments of one frame to the read callback, which queues them
+   *          until sample() takes them. Unlike pa_simple, the stream asks the server to adjust its
+   *          latency to the fragment size, so PipeWire runs the source at the quantum of a frame.
+   */
   struct mic_attr_t: public mic_t {
-    util::safe_ptr<pa_simple, pa_simple_free> mic;
+    // The frames queued before the oldest are dropped, this bounds the latency when the clock of
+    // the source runs ahead of the encoder
+    static constexpr std::size_t MAX_QUEUED_FRAMES = 2;
+
+    // A source that delivers nothing for this long has stalled
+    static constexpr auto SAMPLE_TIMEOUT = 100ms;
+
+    util::safe_ptr<pa_threaded_mainloop, pa_threaded_mainloop_free> loop;
+    util::safe_ptr<pa_context, pa_context_unref> ctx;
+    util::safe_ptr<pa_stream, pa_stream_unref> stream;
+
+    std::uint32_t sample_rate;
+    int channels;
+
+    // The samples received and not taken yet, a ring of `MAX_QUEUED_FRAMES + 1` frames
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<float> ring;
+    std::size_t ring_head {};
+    std::size_t ring_count {};
+    bool stream_failed {};
+
+    // When the sample after the newest one in the ring will be captured, and the first sample of the frame sample() returned last
+    std::chrono::steady_clock::time_point ring_tail_timestamp;
+    std::optional<std::chrono::steady_clock::time_point> last_frame_timestamp;
+
+    // The latency the server reports for the samples it delivered last
+    std::atomic<pa_usec_t> stream_latency {};
+
+    std::uint64_t dropped_samples {};
+
+    // Accessed from the thread of the main loop only
+    bool loop_priority_set {};
+    logging::min_max_avg_periodic_logger<double> latency_logger {debug, "Audio capture latency", "ms"};
+
+    ~mic_attr_t() override {
+      // The callbacks refer to this, stop the loop before anything is torn down
+      if (loop) {
+        pa_threaded_mainloop_stop(loop.get());
+      }
+
+      if (stream) {
+        pa_stream_disconnect(stream.get());
+      }
+      if (ctx) {
+        pa_context_disconnect(ctx.get());
+      }
+
+      if (dropped_samples) {
+        BOOST_LOG(debug) << "Dropped "sv << dropped_samples / channels << " audio samples to correct clock drift"sv;
+      }
+    }
 
     capture_e sample(std::vector<float> &sample_buf) override {
       auto sample_size = sample_buf.size();
 
-      auto buf = sample_buf.data();
-      int status;
-      if (pa_simple_read(mic.get(), buf, sample_size * sizeof(float), &status)) {
-        BOOST_LOG(error) << "pa_simple_read() failed: "sv << pa_strerror(status);
+      std::unique_lock ul {lock};
+      cv.wait_for(ul, SAMPLE_TIMEOUT, [&]() {
+        return stream_failed || ring_count >= sample_size;
+      });
 
-        return capture_e::error;
+      if (stream_failed) {
+        return capture_e::reinit;
+      }
+      if (ring_count < sample_size) {
+        return capture_e::timeout;
       }
 
+      // Skip ahead when more than the frames we allow for were queued
+      auto max_samples = sample_size * MAX_QUEUED_FRAMES;
+      if (ring_count > max_samples) {
+        auto excess = ring_count - max_samples;
+
+        ring_head = (ring_head + excess) % ring.size();
+        ring_count -= excess;
+        dropped_samples += excess;
+      }
+
+      latency_logger.collect_and_log([&]() {
+        auto queued_ms = (double) ring_count / channels * 1000 / sample_rate;
+        return (double) stream_latency.load(std::memory_order_relaxed) / 1000 + queued_ms;
+      });
+
+      last_frame_timestamp = ring_tail_timestamp - samples_duration(ring_count);
+
+      auto first = std::min(sample_size, ring.size() - ring_head);
+      std::copy_n(ring.data() + ring_head, first, sample_buf.data());
+      std::copy_n(ring.data(), sample_size - first, sample_buf.data() + first);
+
+      ring_head = (ring_head + sample_size) % ring.size();
+      ring_count -= sample_size;
+
       return capture_e::ok;
     }
+
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp() override {
+      return last_frame_timestamp;
+    }
+
+    std::chrono::nanoseconds samples_duration(std::size_t samples) const {
+      return std::chrono::nanoseconds(samples / channels * std::nano::den / sample_rate);
+    }
+
+    /**
+     * @brief Queue samples, the oldest are overwritten when the ring is full.
+     * @param samples The samples, or `nullptr` for a hole in the recording.
+     * @param count The number of samples.
+     * @param captured When the sample after the last one was captured.
+     */
+    void push(const float *samples, std::size_t count, std::chrono::steady_clock::time_point captured) {
+      {
+        std::lock_guard lg {lock};
+
+        ring_tail_timestamp = captured;
+
+        for (std::size_t x = 0; x < count; ++x) {
+          auto tail = (ring_head + ring_count) % ring.size();
+          ring[tail] = samples ? samples[x] : 0.0f;
+
+          if (ring_count == ring.size()) {
+            ring_head = (ring_head + 1) % ring.size();
+            ++dropped_samples;
+          } else {
+            ++ring_count;
+          }
+        }
+      }
+
+      cv.notify_one();
+    }
+
+    void fail() {
+      {
+        std::lock_guard lg {lock};
+        stream_failed = true;
+      }
+
+      cv.notify_one();
+    }
+
+    static void ctx_state_cb(pa_context *ctx, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      pa_threaded_mainloop_signal(mic->loop.get(), 0);
+    }
+
+    static void stream_state_cb(pa_stream *stream, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      auto state = pa_stream_get_state(stream);
+      if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+        mic->fail();
+      }
+
+      pa_threaded_mainloop_signal(mic->loop.get(), 0);
+    }
+
+    static void read_cb(pa_stream *stream, std::size_t, void *userdata) {
+      auto mic = (mic_attr_t *) userdata;
+
+      // The samples arrive on the thread of the main loop, treat it like the capture thread
+      if (!mic->loop_priority_set) {
+        adjust_thread_priority(thread_priority_e::critical);
+        mic->loop_priority_set = true;
+      }
+
+      // The latency of a record stream is the age of the oldest sample waiting to be read
+      auto readable = pa_stream_readable_size(stream);
+      if (readable == (std::size_t) -1) {
+        readable = 0;
+      }
+      auto read_at = std::chrono::steady_clock::now();
+
+      pa_usec_t latency;
+      int negative;
+      if (pa_stream_get_latency(stream, &latency, &negative) || negative) {
+        latency = 0;
+      }
+
+      // So the newest sample is younger by the duration of the samples waiting
+      auto newest_age = std::max<std::chrono::nanoseconds>(std::chrono::microseconds(latency) - mic->samples_duration(readable / sizeof(float)), 0ns);
+      auto newest_captured = read_at - newest_age;
+      mic->stream_latency.store(newest_age / 1us, std::memory_order_relaxed);
+
+      while (pa_stream_readable_size(stream) > 0) {
+        const void *data;
+        std::size_t bytes;
+        if (pa_stream_peek(stream, &data, &bytes) < 0) {
+          BOOST_LOG(error) << "pa_stream_peek() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+          mic->fail();
+
+          return;
+        }
+
+        if (!bytes) {
+          break;
+        }
+
+        // The samples that arrived after this fragment are newer
+        readable = readable > bytes ? readable - bytes : 0;
+        mic->push((const float *) data, bytes / sizeof(float), newest_captured - mic->samples_duration(readable / sizeof(float)));
+        pa_stream_drop(stream);
+      }
+    }
   };
 
   std::unique_ptr<mic_t> microphone(const std::uint8_t *mapping, int channels, std::uint32_t sample_rate, std::uint32_t frame_size, std::string source_name) {
     auto mic = std::make_unique<mic_attr_t>();
 
+    mic->sample_rate = sample_rate;
+    mic->channels = channels;
+    mic->ring.resize((mic_attr_t::MAX_QUEUED_FRAMES + 1) * frame_size * channels);
+
     pa_sample_spec ss {PA_SAMPLE_FLOAT32, sample_rate, (std::uint8_t) channels};
     pa_channel_map pa_map;
 
@@ -87,18 +291,70 @@ namespace platf {
       .fragsize = uint32_t(frame_size * channels * sizeof(float))
     };
 
-    int status;
+    mic->loop.reset(pa_threaded_mainloop_new());
+    if (!mic->loop) {
+      BOOST_LOG(error) << "pa_threaded_mainloop_new() failed"sv;
+      return nullptr;
+    }
+    pa_threaded_mainloop_set_name(mic->loop.get(), "sunshine-record");
+
+    mic->ctx.reset(pa_context_new(pa_threaded_mainloop_get_api(mic->loop.get()), "sunshine"));
+    pa_context_set_state_callback(mic->ctx.get(), mic_attr_t::ctx_state_cb, mic.get());
+
+    auto loop = mic->loop.get();
+    pa_threaded_mainloop_lock(loop);
+    auto unlock = util::fail_guard([loop]() {
+      pa_threaded_mainloop_unlock(loop);
+    });
+
+    if (pa_context_connect(mic->ctx.get(), nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+      BOOST_LOG(error) << "pa_context_connect() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
+
+    if (pa_threaded_mainloop_start(mic->loop.get()) < 0) {
+      BOOST_LOG(error) << "pa_threaded_mainloop_start() failed"sv;
+      return nullptr;
+    }
+
+    for (auto state = pa_context_get_state(mic->ctx.get()); state != PA_CONTEXT_READY; state = pa_context_get_state(mic->ctx.get())) {
+      if (!PA_CONTEXT_IS_GOOD(state)) {
+        BOOST_LOG(error) << "Couldn't connect to pulseaudio: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
+    mic->stream.reset(pa_stream_new(mic->ctx.get(), "sunshine-record", &ss, &pa_map));
+    if (!mic->stream) {
+      BOOST_LOG(error) << "pa_stream_new() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+      return nullptr;
+    }
 
-    mic->mic.reset(
-      pa_simple_new(nullptr, "sunshine", pa_stream_direction_t::PA_STREAM_RECORD, source_name.c_str(), "sunshine-record", &ss, &pa_map, &pa_attr, &status)
-    );
+    pa_stream_set_state_callback(mic->stream.get(), mic_attr_t::stream_state_cb, mic.get());
+    pa_stream_set_read_callback(mic->stream.get(), mic_attr_t::read_cb, mic.get());
 
-    if (!mic->mic) {
-      auto err_str = pa_strerror(status);
-      BOOST_LOG(error) << "pa_simple_new() failed: "sv << err_str;
+    // The timing updates let the read callback measure the latency of the source
+    auto flags = (pa_stream_flags_t) (PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+    if (pa_stream_connect_record(mic->stream.get(), source_name.empty() ? nullptr : source_name.c_str(), &pa_attr, flags) < 0) {
+      BOOST_LOG(error) << "pa_stream_connect_record() failed: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
       return nullptr;
     }
 
+    for (auto state = pa_stream_get_state(mic->stream.get()); state != PA_STREAM_READY; state = pa_stream_get_state(mic->stream.get())) {
+      if (!PA_STREAM_IS_GOOD(state)) {
+        BOOST_LOG(error) << "Couldn't record ["sv << source_name << "]: "sv << pa_strerror(pa_context_errno(mic->ctx.get()));
+        return nullptr;
+      }
+
+      pa_threaded_mainloop_wait(mic->loop.get());
+    }
+
+    if (auto attr = pa_stream_get_buffer_attr(mic->stream.get())) {
+      BOOST_LOG(info) << "Audio capture fragment size: "sv << attr->fragsize / (channels * sizeof(float)) * 1000 / sample_rate << "ms"sv;
+    }
+
     return mic;
   }
 
@@ -3,6 +3,7 @@
  * @brief Definitions for CUDA encoding.
  */
 // standard includes
+#include <array>
 #include <bitset>
 #include <fcntl.h>
 #include <filesystem>
@@ -21,6 +22,7 @@ extern "C" {
 // local includes
 #include "cuda.h"
 #include "graphics.h"
+#include "src/config.h"
 #include "src/logging.h"
 #include "src/utility.h"
 #include "src/video.h"
@@ -87,6 +89,10 @@ namespace cuda {
   };
 
   int init() {
+    if (cdf) {
+      return 0;
+    }
+
     auto status = cuda_load_functions(&cdf, nullptr);
     if (status) {
       BOOST_LOG(error) << "Couldn't load cuda: "sv << status;
@@ -102,8 +108,7 @@ namespace cuda {
   class cuda_t: public platf::avcodec_encode_device_t {
   public:
     int init(int in_width, int in_height) {
-      if (!cdf) {
-        BOOST_LOG(warning) << "cuda not initialized"sv;
+      if (cuda::init()) {
         return -1;
       }
 
@@ -120,11 +125,13 @@ namespace cuda {
       this->frame = frame;
 
       auto hwframe_ctx = (AVHWFramesContext *) hw_frames_ctx->data;
-      if (hwframe_ctx->sw_format != AV_PIX_FMT_NV12) {
-        BOOST_LOG(error) << "cuda::cuda_t doesn't support any format other than AV_PIX_FMT_NV12"sv;
+      if (hwframe_ctx->sw_format != AV_PIX_FMT_NV12 && hwframe_ctx->sw_format != AV_PIX_FMT_YUV444P) {
+        BOOST_LOG(error) << "cuda::cuda_t doesn't support any format other than AV_PIX_FMT_NV12 and AV_PIX_FMT_YUV444P"sv;
         return -1;
       }
 
+      yuv444 = hwframe_ctx->sw_format == AV_PIX_FMT_YUV444P;
+
       if (!frame->buf[0]) {
         if (av_hwframe_get_buffer(hw_frames_ctx, frame, 0)) {
           BOOST_LOG(error) << "Couldn't get hwframe for NVENC"sv;
@@ -141,7 +148,8 @@ namespace cuda {
 
       cuda_ctx->stream = stream.get();
 
-      auto sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4);
+      // The filters are numbered in the order of config::video_t::scaling_filter_e
+      auto sws_opt = sws_t::make(width, height, frame->width, frame->height, width * 4, (int) config::video.scaling_filter);
       if (!sws_opt) {
         return -1;
       }
@@ -178,13 +186,26 @@ namespace cuda {
         return;
       }
 
-      sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex->texture.linear, stream.get(), {frame->width, frame->height, 0, 0});
+      convert_frame(tex->texture.linear, {frame->width, frame->height, 0, 0});
     }
 
     cudaTextureObject_t tex_obj(const tex_t &tex) const {
       return linear_interpolation ? tex.texture.linear : tex.texture.point;
     }
 
+    int convert_frame(cudaTextureObject_t texture) {
+      return convert_frame(texture, sws.viewport);
+    }
+
+    int convert_frame(cudaTextureObject_t texture, const viewport_t &viewport) {
+      if (yuv444) {
+        // The planes of YUV444P share the same pitch
+        return sws.convert_yuv444(frame->data[0], frame->data[1], frame->data[2], frame->linesize[0], texture, stream.get(), viewport);
+      }
+
+      return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], texture, stream.get(), viewport);
+    }
+
     stream_t stream;
     frame_t hwframe;
 
@@ -193,13 +214,16 @@ namespace cuda {
     // When height and width don't change, it's not necessary to use linear interpolation
     bool linear_interpolation;
 
+    // Convert to YUV444P instead of NV12
+    bool yuv444;
+
     sws_t sws;
   };
 
   class cuda_ram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
-      return sws.load_ram(img, tex.array) || sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(tex), stream.get());
+      return upload.upload(img, tex.array, stream.get()) || convert_frame(tex_obj(tex));
     }
 
     int set_frame(AVFrame *frame, AVBufferRef *hw_frames_ctx) {
@@ -214,16 +238,24 @@ namespace cuda {
 
       tex = std::move(*tex_opt);
 
+      auto upload_opt = upload_t::make(height, width * 4);
+      if (!upload_opt) {
+        return -1;
+      }
+
+      upload = std::move(*upload_opt);
+
       return 0;
     }
 
     tex_t tex;
+    upload_t upload;
   };
 
   class cuda_vram_t: public cuda_t {
   public:
     int convert(platf::img_t &img) override {
-      return sws.convert(frame->data[0], frame->data[1], frame->linesize[0], frame->linesize[1], tex_obj(((img_t *) &img)->tex), stream.get());
+      return convert_frame(tex_obj(((img_t *) &img)->tex));
     }
   };
 
@@ -287,6 +319,15 @@ namespace cuda {
       // This must be non-zero to tell the video core that it's a hardware encoding device.
       data = (void *) 0x1;
 
+      if (cuda::init()) {
+        return -1;
+      }
+
+      if (gbm::init()) {
+        BOOST_LOG(warning) << "Couldn't load libgbm"sv;
+        return -1;
+      }
+
       // TODO: Support more than one CUDA device
       file = std::move(open_drm_fd_for_cuda_device(0));
       if (file.el < 0) {
@@ -366,8 +407,11 @@ namespace cuda {
 
       cuda_ctx->stream = stream.get();
 
-      CU_CHECK(cdf->cuGraphicsGLRegisterImage(&y_res, nv12->tex[0], GL_TEXTURE_2D, CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY), "Couldn't register Y plane texture");
-      CU_CHECK(cdf->cuGraphicsGLRegisterImage(&uv_res, nv12->tex[1], GL_TEXTURE_2D, CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY), "Couldn't register UV plane texture");
+      // Two planes for NV12 and P010, three for planar YUV 4:4:4
+      planes = av_pix_fmt_count_planes(sw_format);
+      for (int i = 0; i < planes; i++) {
+        CU_CHECK(cdf->cuGraphicsGLRegisterImage(&plane_res[i], nv12->tex[i], GL_TEXTURE_2D, CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY), "Couldn't register plane texture");
+      }
 
       return 0;
     }
@@ -382,33 +426,30 @@ namespace cuda {
 
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
+        rgb = imports.import(display.get(), descriptor.sd);
 
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
       // Perform the color conversion and scaling in GL
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0]);
       sws.convert(nv12->buf);
 
       auto fmt_desc = av_pix_fmt_desc_get(sw_format);
 
       // Map the GL textures to read for CUDA
-      CUgraphicsResource resources[2] = {y_res.get(), uv_res.get()};
-      CU_CHECK(cdf->cuGraphicsMapResources(2, resources, stream.get()), "Couldn't map GL textures in CUDA");
+      CUgraphicsResource resources[3] = {plane_res[0].get(), plane_res[1].get(), plane_res[2].get()};
+      CU_CHECK(cdf->cuGraphicsMapResources(planes, resources, stream.get()), "Couldn't map GL textures in CUDA");
 
       // Copy from the GL textures to the target CUDA frame
-      for (int i = 0; i < 2; i++) {
+      for (int i = 0; i < planes; i++) {
         CUDA_MEMCPY2D cpy = {};
         cpy.srcMemoryType = CU_MEMORYTYPE_ARRAY;
         CU_CHECK(cdf->cuGraphicsSubResourceGetMappedArray(&cpy.srcArray, resources[i], 0, 0), "Couldn't get mapped plane array");
@@ -423,7 +464,7 @@ namespace cuda {
       }
 
       // Unmap the textures to allow modification from GL again
-      CU_CHECK(cdf->cuGraphicsUnmapResources(2, resources, stream.get()), "Couldn't unmap GL textures from CUDA");
+      CU_CHECK(cdf->cuGraphicsUnmapResources(planes, resources, stream.get()), "Couldn't unmap GL textures from CUDA");
       return 0;
     }
 
@@ -450,10 +491,12 @@ namespace cuda {
     int width, height;
 
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_t blank;
+    egl::import_cache_t imports;
+    egl::rgb_t *rgb {};
 
-    registered_resource_t y_res;
-    registered_resource_t uv_res;
+    std::array<registered_resource_t, 3> plane_res;
+    int planes;
 
     int offset_x, offset_y;
   };
@@ -700,6 +743,10 @@ namespace cuda {
 
     class display_t: public platf::display_t {
     public:
+      capture_backend_t capture_backend() const override {
+        return {"nvfbc"sv, false};
+      }
+
       int init(const std::string_view &display_name, const ::video::config_t &config) {
         auto handle = handle_t::make();
         if (!handle) {
@@ -762,6 +809,7 @@ namespace cuda {
       }
 
       platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+        // The earliest a frame may be grabbed, so frames aren't captured faster than the configured framerate
         auto next_frame = std::chrono::steady_clock::now();
 
         {
@@ -789,13 +837,16 @@ namespace cuda {
             sleep_overshoot_logger.second_point_now_and_log();
           }
 
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
-
+          // The grab blocks until NvFBC has a new frame, so the frames drive the capture rather than the timer
           std::shared_ptr<platf::img_t> img_out;
+          auto snapshot_begin = std::chrono::steady_clock::now();
           auto status = snapshot(pull_free_image_cb, img_out, 150ms, *cursor);
+          capture_stats().snapshot(status, snapshot_begin, img_out.get());
+
+          // A frame that arrives before the next one may be grabbed is picked up right away then
+          if (status == platf::capture_e::ok) {
+            next_frame = *img_out->frame_timestamp + delay;
+          }
           switch (status) {
             case platf::capture_e::reinit:
             case platf::capture_e::error:
@@ -827,6 +878,9 @@ namespace cuda {
         }
 
         cursor_visible = cursor;
+        frame_grabbed = false;
+
+        // Without the cursor in the frames, the X server sends a frame as soon as it's damaged
         if (cursor) {
           capture_params.bPushModel = nv_bool(false);
           capture_params.bWithCursor = nv_bool(true);
@@ -900,9 +954,10 @@ namespace cuda {
         CUdeviceptr device_ptr;
         NVFBC_FRAME_GRAB_INFO info;
 
+        // Wait for a new frame, unless one came while the last one was being copied
         NVFBC_TOCUDA_GRAB_FRAME_PARAMS grab {
           NVFBC_TOCUDA_GRAB_FRAME_PARAMS_VER,
-          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT,
+          NVFBC_TOCUDA_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY,
           &device_ptr,
           &info,
           (std::uint32_t) timeout.count(),
@@ -917,6 +972,15 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        // The last frame is returned again when the wait timed out, the encoder already has it
+        if (!info.bIsNewFrame && frame_grabbed) {
+          return platf::capture_e::timeout;
+        }
+        frame_grabbed = true;
+
+        auto frame_timestamp = std::chrono::steady_clock::now();
+
+        // The buffer of NvFBC is only valid until the next grab, so it's copied into an image of the pool
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
@@ -926,6 +990,8 @@ namespace cuda {
           return platf::capture_e::error;
         }
 
+        img->frame_timestamp = frame_timestamp;
+
         return platf::capture_e::ok;
       }
 
@@ -959,6 +1025,10 @@ namespace cuda {
       std::chrono::nanoseconds delay;
 
       bool cursor_visible;
+
+      // Whether a frame was grabbed since the capture session was created
+      bool frame_grabbed;
+
       handle_t handle;
 
       NVFBC_CREATE_CAPTURE_SESSION_PARAMS capture_params;
@@ -4,6 +4,7 @@
  */
 // standard includes
 #include <chrono>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <optional>
@@ -116,6 +117,14 @@ namespace cuda {
     CU_CHECK_IGNORE(cudaStreamDestroy(ptr), "Couldn't free cuda stream");
   }
 
+  void freeCudaHostPtr_t::operator()(void *ptr) {
+    CU_CHECK_IGNORE(cudaFreeHost(ptr), "Couldn't free cuda host pointer");
+  }
+
+  void freeCudaEvent_t::operator()(cudaEvent_t ptr) {
+    CU_CHECK_IGNORE(cudaEventDestroy(ptr), "Couldn't free cuda event");
+  }
+
   stream_t make_stream(int flags) {
     cudaStream_t stream;
 
@@ -205,6 +214,112 @@ namespace cuda {
     dstY1[1] = calcY(rgb_rb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
   }
 
+  __global__ void RGBA_to_YUV444P(
+    cudaTextureObject_t srcImage,
+    std::uint8_t *dstY,
+    std::uint8_t *dstU,
+    std::uint8_t *dstV,
+    std::uint32_t dstPitch,
+    float scale,
+    const viewport_t viewport,
+    const cuda_color_t *const color_matrix
+  ) {
+    int idX = threadIdx.x + blockDim.x * blockIdx.x;
+    int idY = threadIdx.y + blockDim.y * blockIdx.y;
+
+    if (idX >= viewport.width) {
+      return;
+    }
+    if (idY >= viewport.height) {
+      return;
+    }
+
+    float x = idX * scale;
+    float y = idY * scale;
+
+    idX += viewport.offsetX;
+    idY += viewport.offsetY;
+
+    // Without subsampling, every pixel gets its own chroma sample
+    auto offset = idX + idY * dstPitch;
+
+    float3 rgb = bgra_to_rgb(tex2D<float4>(srcImage, x, y));
+    float2 uv = calcUV(rgb, color_matrix) * 256.0f;
+
+    dstY[offset] = calcY(rgb, color_matrix) * 245.0f;  // 245.0f is a magic number to ensure slight changes in luminosity are more visible
+    dstU[offset] = uv.x;
+    dstV[offset] = uv.y;
+  }
+
+  inline __device__ float scale_weight(float x, int filter) {
+    x = fabsf(x);
+
+    if (filter == 1) {
+      // Catmull-Rom
+      if (x < 1.0f) {
+        return (1.5f * x - 2.5f) * x * x + 1.0f;
+      }
+      if (x < 2.0f) {
+        return ((-0.5f * x + 2.5f) * x - 4.0f) * x + 2.0f;
+      }
+      return 0.0f;
+    }
+
+    // Lanczos with 3 lobes
+    if (x < 0.00001f) {
+      return 1.0f;
+    }
+    if (x < 3.0f) {
+      float px = 3.14159265f * x;
+      return 3.0f * __sinf(px) * __sinf(px / 3.0f) / (px * px);
+    }
+    return 0.0f;
+  }
+
+  // One pass of a separable filter, the other axis is copied as is
+  __global__ void scale_BGRA(
+    cudaTextureObject_t srcImage,
+    uchar4 *dst,
+    std::size_t dstPitch,
+    int width,
+    int height,
+    int srcSize,
+    float ratio,
+    int axis,
+    int filter
+  ) {
+    int idX = threadIdx.x + blockDim.x * blockIdx.x;
+    int idY = threadIdx.y + blockDim.y * blockIdx.y;
+
+    if (idX >= width) {
+      return;
+    }
+    if (idY >= height) {
+      return;
+    }
+
+    // When shrinking the image, the filter stretches to cover every texel of a pixel
+    float stretch = fmaxf(ratio, 1.0f);
+    float radius = (filter == 1 ? 2.0f : 3.0f) * stretch;
+    float center = ((axis ? idY : idX) + 0.5f) * ratio - 0.5f;
+
+    float4 sum = make_float4(0.0f);
+    float total = 0.0f;
+    for (int x = (int) ceilf(center - radius); x <= (int) floorf(center + radius); ++x) {
+      float w = scale_weight((x - center) / stretch, filter);
+
+      // The centers of the texels, those outside the image repeat its edge
+      float texel = min(max(x, 0), srcSize - 1) + 0.5f;
+      sum += w * (axis ? tex2D<float4>(srcImage, idX + 0.5f, texel) : tex2D<float4>(srcImage, texel, idY + 0.5f));
+      total += w;
+    }
+
+    float4 color = clamp(sum / total, 0.0f, 1.0f) * 255.0f + 0.5f;
+
+    dst = (uchar4 *) ((std::uint8_t *) dst + idY * dstPitch);
+    dst[idX] = make_uchar4(color.x, color.y, color.z, color.w);
+  }
+
   int tex_t::copy(std::uint8_t *src, int height, int pitch) {
     CU_CHECK(cudaMemcpy2DToArray(array, 0, 0, src, pitch, pitch, height, cudaMemcpyDeviceToDevice), "Couldn't copy to cuda array from deviceptr");
 
@@ -278,9 +393,77 @@ namespace cuda {
     }
   }
 
+  std::optional<pitched_tex_t> pitched_tex_t::make(int width, int height) {
+    pitched_tex_t tex;
+    tex.width = width;
+    tex.height = height;
+
+    void *data;
+    CU_CHECK_OPT(cudaMallocPitch(&data, &tex.pitch, width * sizeof(uchar4), height), "Couldn't allocate pitched cuda memory");
+    tex.data.reset(data);
+
+    cudaResourceDesc res {};
+    res.resType = cudaResourceTypePitch2D;
+    res.res.pitch2D.devPtr = data;
+    res.res.pitch2D.desc = cudaCreateChannelDesc<uchar4>();
+    res.res.pitch2D.width = width;
+    res.res.pitch2D.height = height;
+    res.res.pitch2D.pitchInBytes = tex.pitch;
+
+    cudaTextureDesc desc {};
+
+    desc.readMode = cudaReadModeNormalizedFloat;
+    desc.filterMode = cudaFilterModePoint;
+    desc.normalizedCoords = false;
+
+    std::fill_n(std::begin(desc.addressMode), 2, cudaAddressModeClamp);
+
+    CU_CHECK_OPT(cudaCreateTextureObject(&tex.texture, &res, &desc, nullptr), "Couldn't create cuda texture of pitched memory");
+
+    return tex;
+  }
+
+  pitched_tex_t::pitched_tex_t():
+      pitch {},
+      width {},
+      height {},
+      texture {INVALID_TEXTURE} {
+  }
+
+  pitched_tex_t::pitched_tex_t(pitched_tex_t &&other):
+      data {std::move(other.data)},
+      pitch {other.pitch},
+      width {other.width},
+      height {other.height},
+      texture {other.texture} {
+    other.texture = INVALID_TEXTURE;
+  }
+
+  pitched_tex_t &pitched_tex_t::operator=(pitched_tex_t &&other) {
+    std::swap(data, other.data);
+    std::swap(pitch, other.pitch);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(texture, other.texture);
+
+    return *this;
+  }
+
+  pitched_tex_t::~pitched_tex_t() {
+    // The texture reads the memory, so it goes first
+    if (texture != INVALID_TEXTURE) {
+      CU_CHECK_IGNORE(cudaDestroyTextureObject(texture), "Couldn't deallocate cuda texture of pitched memory");
+
+      texture = INVALID_TEXTURE;
+    }
+  }
+
   sws_t::sws_t(int in_width, int in_height, int out_width, int out_height, int pitch, int threadsPerBlock, ptr_t &&color_matrix):
       threadsPerBlock {threadsPerBlock},
-      color_matrix {std::move(color_matrix)} {
+      color_matrix {std::move(color_matrix)},
+      in_width {in_width},
+      in_height {in_height},
+      scale_filter {} {
     // Ensure aspect ratio is maintained
     auto scalar = std::fminf(out_width / (float) in_width, out_height / (float) in_height);
     auto out_width_f = in_width * scalar;
@@ -299,7 +482,7 @@ namespace cuda {
     scale = 1.0f / scalar;
   }
 
-  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, int pitch) {
+  std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, int pitch, int scale_filter) {
     cudaDeviceProp props;
     int device;
     CU_CHECK_OPT(cudaGetDevice(&device), "Couldn't get cuda device");
@@ -310,14 +493,74 @@ namespace cuda {
       return std::nullopt;
     }
 
-    return std::make_optional<sws_t>(in_width, in_height, out_width, out_height, pitch, props.maxThreadsPerMultiProcessor / props.maxBlocksPerMultiProcessor, std::move(ptr));
+    auto sws = std::make_optional<sws_t>(in_width, in_height, out_width, out_height, pitch, props.maxThreadsPerMultiProcessor / props.maxBlocksPerMultiProcessor, std::move(ptr));
+
+    // The sampling of the conversion is all the scaling needed then
+    if (!scale_filter || (sws->viewport.width == in_width && sws->viewport.height == in_height)) {
+      return sws;
+    }
+
+    // The width is scaled first, then the height, the conversion reads the result texel for texel
+    auto width_pass = pitched_tex_t::make(sws->viewport.width, in_height);
+    auto height_pass = pitched_tex_t::make(sws->viewport.width, sws->viewport.height);
+    if (!width_pass || !height_pass) {
+      return std::nullopt;
+    }
+
+    sws->scaled = {std::move(*width_pass), std::move(*height_pass)};
+    sws->scale_filter = scale_filter;
+
+    return sws;
+  }
+
+  int sws_t::scale_to_viewport(cudaTextureObject_t texture, stream_t::pointer stream) {
+    dim3 block(threadsPerBlock);
+
+    for (int x = 0; x < 2; ++x) {
+      auto &dst = scaled[x];
+
+      dim3 grid(div_align(dst.width, threadsPerBlock), dst.height);
+
+      // The height pass reads the result of the width pass
+      scale_BGRA<<<grid, block, 0, stream>>>(x ? scaled[0].texture : texture, (uchar4 *) dst.data.get(), dst.pitch, dst.width, dst.height, x ? in_height : in_width, scale, x, scale_filter);
+    }
+
+    return CU_CHECK_IGNORE(cudaGetLastError(), "scale_BGRA failed");
   }
 
   int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream) {
-    return convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
+    if (!scale_filter) {
+      return convert(Y, UV, pitchY, pitchUV, texture, stream, viewport);
+    }
+
+    if (scale_to_viewport(texture, stream)) {
+      return -1;
+    }
+
+    return launch_nv12(Y, UV, pitchY, pitchUV, scaled[1].texture, 1.0f, stream, viewport);
   }
 
   int sws_t::convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+    return launch_nv12(Y, UV, pitchY, pitchUV, texture, scale, stream, viewport);
+  }
+
+  int sws_t::convert_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, stream_t::pointer stream) {
+    if (!scale_filter) {
+      return convert_yuv444(Y, U, V, pitch, texture, stream, viewport);
+    }
+
+    if (scale_to_viewport(texture, stream)) {
+      return -1;
+    }
+
+    return launch_yuv444(Y, U, V, pitch, scaled[1].texture, 1.0f, stream, viewport);
+  }
+
+  int sws_t::convert_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport) {
+    return launch_yuv444(Y, U, V, pitch, texture, scale, stream, viewport);
+  }
+
+  int sws_t::launch_nv12(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, float scale, stream_t::pointer stream, const viewport_t &viewport) {
     int threadsX = viewport.width / 2;
     int threadsY = viewport.height / 2;
 
@@ -329,11 +572,62 @@ namespace cuda {
     return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_NV12 failed");
   }
 
+  int sws_t::launch_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, float scale, stream_t::pointer stream, const viewport_t &viewport) {
+    dim3 block(threadsPerBlock);
+    dim3 grid(div_align(viewport.width, threadsPerBlock), viewport.height);
+
+    RGBA_to_YUV444P<<<grid, block, 0, stream>>>(texture, Y, U, V, pitch, scale, viewport, (cuda_color_t *) color_matrix.get());
+
+    return CU_CHECK_IGNORE(cudaGetLastError(), "RGBA_to_YUV444P failed");
+  }
+
   void sws_t::apply_colorspace(const video::sunshine_colorspace_t &colorspace) {
     auto color_p = video::color_vectors_from_colorspace(colorspace);
     CU_CHECK_IGNORE(cudaMemcpy(color_matrix.get(), color_p, sizeof(video::color_t), cudaMemcpyHostToDevice), "Couldn't copy color matrix to cuda");
   }
 
+  std::optional<upload_t> upload_t::make(int height, int pitch) {
+    upload_t upload;
+    upload.height = height;
+    upload.pitch = pitch;
+
+    for (auto &buffer : upload.buffers) {
+      void *host;
+      CU_CHECK_OPT(cudaMallocHost(&host, (std::size_t) height * pitch), "Couldn't allocate pinned memory");
+      buffer.host.reset(host);
+
+      cudaEvent_t uploaded;
+      CU_CHECK_OPT(cudaEventCreateWithFlags(&uploaded, cudaEventDisableTiming), "Couldn't create cuda event");
+      buffer.uploaded.reset(uploaded);
+    }
+
+    return upload;
+  }
+
+  int upload_t::upload(platf::img_t &img, cudaArray_t array, stream_t::pointer stream) {
+    auto row_size = img.width * img.pixel_pitch;
+    if (img.height > height || row_size > pitch) {
+      pass_error("Couldn't upload image: "sv, "size", "larger than the upload buffers");
+      return -1;
+    }
+
+    auto &buffer = buffers[next];
+    next = (next + 1) % buffers.size();
+
+    // The upload from this buffer was queued before the previous image, it's long done
+    CU_CHECK(cudaEventSynchronize(buffer.uploaded.get()), "Couldn't wait for the upload buffer");
+
+    auto host = (std::uint8_t *) buffer.host.get();
+    for (int y = 0; y < img.height; ++y) {
+      std::memcpy(host + (std::size_t) y * row_size, img.data + (std::size_t) y * img.row_pitch, row_size);
+    }
+
+    CU_CHECK(cudaMemcpy2DToArrayAsync(array, 0, 0, host, row_size, row_size, img.height, cudaMemcpyHostToDevice, stream), "Couldn't upload to cuda array");
+    CU_CHECK(cudaEventRecord(buffer.uploaded.get(), stream), "Couldn't record the upload");
+
+    return 0;
+  }
+
   int sws_t::load_ram(platf::img_t &img, cudaArray_t array) {
     return CU_CHECK_IGNORE(cudaMemcpy2DToArray(array, 0, 0, img.data, img.row_pitch, img.width * img.pixel_pitch, img.height, cudaMemcpyHostToDevice), "Couldn't copy to cuda array");
   }
@@ -6,6 +6,7 @@
 
 #if defined(SUNSHINE_BUILD_CUDA)
   // standard includes
+  #include <array>
   #include <cstdint>
   #include <memory>
   #include <optional>
@@ -45,9 +46,11 @@ typedef struct cudaArray *cudaArray_t;
 
   #if !defined(__CUDACC__)
 typedef struct CUstream_st *cudaStream_t;
+typedef struct CUevent_st *cudaEvent_t;
 typedef unsigned long long cudaTextureObject_t;
   #else /* defined(__CUDACC__) */
 typedef __location__(device_builtin) struct CUstream_st *cudaStream_t;
+typedef __location__(device_builtin) struct CUevent_st *cudaEvent_t;
 typedef __location__(device_builtin) unsigned long long cudaTextureObject_t;
   #endif /* !defined(__CUDACC__) */
 
@@ -63,8 +66,20 @@ namespace cuda {
     void operator()(cudaStream_t ptr);
   };
 
+  class freeCudaHostPtr_t {
+  public:
+    void operator()(void *ptr);
+  };
+
+  class freeCudaEvent_t {
+  public:
+    void operator()(cudaEvent_t ptr);
+  };
+
   using ptr_t = std::unique_ptr<void, freeCudaPtr_t>;
   using stream_t = std::unique_ptr<CUstream_st, freeCudaStream_t>;
+  using host_ptr_t = std::unique_ptr<void, freeCudaHostPtr_t>;
+  using event_t = std::unique_ptr<CUevent_st, freeCudaEvent_t>;
 
   stream_t make_stream(int flags = 0);
 
@@ -94,6 +109,67 @@ namespace cuda {
     } texture;
   };
 
+  /**
+   * @brief A BGRA image in pitched memory, written by a kernel and read by the next through a texture.
+   */
+  class pitched_tex_t {
+  public:
+    static std::optional<pitched_tex_t> make(int width, int height);
+
+    pitched_tex_t();
+    pitched_tex_t(pitched_tex_t &&);
+
+    pitched_tex_t &operator=(pitched_tex_t &&other);
+
+    ~pitched_tex_t();
+
+    ptr_t data;
+    std::size_t pitch;
+
+    int width, height;
+
+    // Uses point interpolation, the image is read texel for texel
+    cudaTextureObject_t texture;
+  };
+
+  /**
+   * @brief Uploads captured images through double buffered pinned memory.
+   * @details An image is copied to the buffer whose previous upload is done, then uploaded
+   *          asynchronously on the stream of the conversion. Neither the copy nor the upload waits
+   *          for the conversion of the previous image.
+   */
+  class upload_t {
+  public:
+    /**
+     * @param height The height of the images in pixels.
+     * @param pitch The size of a row of the images in bytes, without padding.
+     */
+    static std::optional<upload_t> make(int height, int pitch);
+
+    /**
+     * @brief Upload an image.
+     * @param img The image, at most as large as the buffers.
+     * @param array The array to upload to.
+     * @param stream The stream the upload is ordered on.
+     * @return 0 on success, -1 on failure.
+     */
+    int upload(platf::img_t &img, cudaArray_t array, stream_t::pointer stream);
+
+  private:
+    struct buffer_t {
+      host_ptr_t host;
+
+      // Recorded after the upload from the buffer
+      event_t uploaded;
+    };
+
+    std::array<buffer_t, 2> buffers;
+    std::size_t next {};
+
+    int height;
+    int pitch;
+  };
+
   class sws_t {
   public:
     sws_t() = default;
@@ -104,17 +180,29 @@ namespace cuda {
      * out_width, out_height -- the width and height of the NV12 image in pixels
      *
      * pitch -- The size of a single row of pixels in bytes
+     * scale_filter -- 0 to sample the image bilinearly while converting it, 1 to scale it with a bicubic filter first, 2 with a Lanczos filter
      */
-    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, int pitch);
+    static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, int pitch, int scale_filter = 0);
 
     // Converts loaded image into a CUDevicePtr
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream);
     int convert(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport);
 
+    // Converts loaded image into the three full resolution planes of YUV444P
+    int convert_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, stream_t::pointer stream);
+    int convert_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, stream_t::pointer stream, const viewport_t &viewport);
+
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
+    // Scales the image to the viewport in a width pass, then a height pass, when there's a scale filter
+    int scale_to_viewport(cudaTextureObject_t texture, stream_t::pointer stream);
+
     int load_ram(platf::img_t &img, cudaArray_t array);
 
+    // Launch the conversion kernels, reading the texture with this many texels per pixel
+    int launch_nv12(std::uint8_t *Y, std::uint8_t *UV, std::uint32_t pitchY, std::uint32_t pitchUV, cudaTextureObject_t texture, float scale, stream_t::pointer stream, const viewport_t &viewport);
+    int launch_yuv444(std::uint8_t *Y, std::uint8_t *U, std::uint8_t *V, std::uint32_t pitch, cudaTextureObject_t texture, float scale, stream_t::pointer stream, const viewport_t &viewport);
+
     ptr_t color_matrix;
 
     int threadsPerBlock;
@@ -122,6 +210,13 @@ namespace cuda {
     viewport_t viewport;
 
     float scale;
+
+    int in_width, in_height;
+
+    int scale_filter;
+
+    // The image scaled in width, then in height
+    std::array<pitched_tex_t, 2> scaled;
   };
 }  // namespace cuda
 
@@ -3,12 +3,20 @@
  * @brief Definitions for graphics related functions.
  */
 // standard includes
+#include <algorithm>
+#include <cstring>
 #include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <sys/stat.h>
 
 // local includes
 #include "graphics.h"
+#include "src/config.h"
+#include "src/crypto.h"
 #include "src/file_handler.h"
 #include "src/logging.h"
+#include "src/platform/common.h"
 #include "src/video.h"
 
 extern "C" {
@@ -183,6 +191,11 @@ namespace gl {
     ctx.AttachShader(program.handle(), vert.handle());
     ctx.AttachShader(program.handle(), frag.handle());
 
+    // Allow load() to save the binary of the program
+    if (ctx.ProgramParameteri) {
+      ctx.ProgramParameteri(program.handle(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     // p_handle stores a copy of the program handle, since program will be moved before
     // the fail guard function is called.
     auto fg = util::fail_guard([p_handle = program.handle(), &vert, &frag]() {
@@ -202,6 +215,99 @@ namespace gl {
     return program;
   }
 
+  /**
+   * @brief Get the path of the cached binary of a program.
+   * @return The path, or an empty string if the driver can't save program binaries.
+   */
+  static std::string program_binary_path(const std::string_view &vert_source, const std::string_view &frag_source) {
+    GLint formats = 0;
+    if (ctx.GetProgramBinary && ctx.ProgramBinary) {
+      ctx.GetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+
+    if (formats <= 0) {
+      return {};
+    }
+
+    // A binary is only valid for the driver that produced it
+    std::string key;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      auto string = (const char *) ctx.GetString(name);
+      key.append(string ? string : "").push_back('\n');
+    }
+    key.append(vert_source).push_back('\n');
+    key.append(frag_source);
+
+    return (platf::appdata() / "shader_cache" / (util::hex_vec(crypto::hash(key)) + ".bin")).string();
+  }
+
+  util::Either<program_t, std::string> program_t::load(const char *vert_file, const char *frag_file) {
+    auto vert_source = file_handler::read_file(vert_file);
+    auto frag_source = file_handler::read_file(frag_file);
+
+    // The cached binary starts with its format
+    auto binary_path = program_binary_path(vert_source, frag_source);
+    if (!binary_path.empty()) {
+      auto binary = file_handler::read_file(binary_path.c_str());
+      if (binary.size() > sizeof(GLenum)) {
+        GLenum format;
+        std::memcpy(&format, binary.data(), sizeof(format));
+
+        program_t program;
+        program._program.el = ctx.CreateProgram();
+        ctx.ProgramBinary(program.handle(), format, binary.data() + sizeof(format), binary.size() - sizeof(format));
+
+        int status = 0;
+        ctx.GetProgramiv(program.handle(), GL_LINK_STATUS, &status);
+        if (status) {
+          return program;
+        }
+
+        // An unknown format is an error as well, the binary is replaced below
+        while (ctx.GetError() != GL_NO_ERROR) {}
+        BOOST_LOG(debug) << "Driver rejected the cached program binary ["sv << binary_path << ']';
+      }
+    }
+
+    auto vert = shader_t::compile(vert_source, GL_VERTEX_SHADER);
+    if (vert.has_right()) {
+      return std::string {vert_file} + ": " + vert.right();
+    }
+
+    auto frag = shader_t::compile(frag_source, GL_FRAGMENT_SHADER);
+    if (frag.has_right()) {
+      return std::string {frag_file} + ": " + frag.right();
+    }
+
+    auto program = link(vert.left(), frag.left());
+    if (program.has_right() || binary_path.empty()) {
+      return program;
+    }
+
+    auto handle = program.left().handle();
+
+    GLint length = 0;
+    ctx.GetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+      return program;
+    }
+
+    GLenum format;
+    std::string binary(sizeof(format) + length, '\0');
+    ctx.GetProgramBinary(handle, length, &length, &format, binary.data() + sizeof(format));
+    std::memcpy(binary.data(), &format, sizeof(format));
+    binary.resize(sizeof(format) + length);
+
+    // Failing to cache the program only costs the next context the compilation
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path {binary_path}.parent_path(), ec);
+    if (ec || file_handler::write_file_atomic(binary_path.c_str(), binary)) {
+      BOOST_LOG(warning) << "Couldn't save the program binary ["sv << binary_path << ']';
+    }
+
+    return program;
+  }
+
   void program_t::bind(const buffer_t &buffer) {
     ctx.UseProgram(handle());
     auto i = ctx.GetUniformBlockIndex(handle(), buffer.block());
@@ -268,9 +374,12 @@ namespace gbm {
   create_device_fn create_device;
 
   int init() {
+    static std::mutex lock;
     static void *handle {nullptr};
     static bool funcs_loaded = false;
 
+    // Loaded by the first capture or encoding device that needs it, which may run on any thread
+    std::lock_guard lg {lock};
     if (funcs_loaded) {
       return 0;
     }
@@ -324,6 +433,24 @@ namespace egl {
     return eglGetError() != EGL_SUCCESS;
   }
 
+  int init() {
+    static std::mutex lock;
+    static bool loaded = false;
+
+    std::lock_guard lg {lock};
+    if (loaded) {
+      return 0;
+    }
+
+    if (!gladLoaderLoadEGL(EGL_NO_DISPLAY) || !eglGetPlatformDisplay) {
+      BOOST_LOG(warning) << "Couldn't load EGL library"sv;
+      return -1;
+    }
+
+    loaded = true;
+    return 0;
+  }
+
   /**
    * @memberof egl::display_t
    */
@@ -332,6 +459,10 @@ namespace egl {
     constexpr auto EGL_PLATFORM_WAYLAND_KHR = 0x31D8;
     constexpr auto EGL_PLATFORM_X11_KHR = 0x31D5;
 
+    if (init()) {
+      return nullptr;
+    }
+
     int egl_platform;
     void *native_display_p;
 
@@ -559,6 +690,55 @@ namespace egl {
     return rgb;
   }
 
+  rgb_t *import_cache_t::import(display_t::pointer egl_display, const surface_descriptor_t &sd) {
+    key_t key {};
+    for (int x = 0; x < 4; ++x) {
+      if (sd.fds[x] < 0) {
+        continue;
+      }
+
+      struct stat st;
+      if (fstat(sd.fds[x], &st)) {
+        BOOST_LOG(error) << "Couldn't stat DMA-BUF: "sv << strerror(errno);
+        return nullptr;
+      }
+
+      key.inodes[x] = st.st_ino;
+      key.offsets[x] = sd.offsets[x];
+      key.pitches[x] = sd.pitches[x];
+    }
+    key.modifier = sd.modifier;
+    key.fourcc = sd.fourcc;
+    key.width = sd.width;
+    key.height = sd.height;
+
+    auto it = std::find_if(std::begin(imports), std::end(imports), [&key](const auto &import) {
+      return import.first == key;
+    });
+    if (it != std::end(imports)) {
+      std::rotate(it, it + 1, std::end(imports));
+      return &imports.back().second;
+    }
+
+    auto rgb_opt = import_source(egl_display, sd);
+    if (!rgb_opt) {
+      // The buffers may have been replaced without being recognized
+      clear();
+      return nullptr;
+    }
+
+    if (imports.size() >= MAX_IMPORTS) {
+      imports.erase(std::begin(imports));
+    }
+    imports.emplace_back(key, std::move(*rgb_opt));
+
+    return &imports.back().second;
+  }
+
+  void import_cache_t::clear() {
+    imports.clear();
+  }
+
   /**
    * @brief Create a black RGB texture of the specified image size.
    * @param img The image to use for texture sizing.
@@ -637,32 +817,38 @@ namespace egl {
   }
 
   /**
-   * @brief Create biplanar YUV textures to render into.
+   * @brief Create biplanar YUV textures to render into, or a texture per plane for planar YUV 4:4:4.
    * @param width Width of the target frame.
    * @param height Height of the target frame.
    * @param format Format of the target frame.
    * @return The new RGB texture.
    */
   std::optional<nv12_t> create_target(int width, int height, AVPixelFormat format) {
+    auto fmt_desc = av_pix_fmt_desc_get(format);
+    auto planes = av_pix_fmt_count_planes(format);
+    if (planes != 2 && (planes != 3 || fmt_desc->log2_chroma_w || fmt_desc->log2_chroma_h)) {
+      BOOST_LOG(error) << "Unsupported target pixel format: "sv << format;
+      return std::nullopt;
+    }
+
     nv12_t nv12 {
       EGL_NO_DISPLAY,
       EGL_NO_IMAGE,
       EGL_NO_IMAGE,
-      gl::tex_t::make(2),
-      gl::frame_buf_t::make(2),
+      gl::tex_t::make(planes),
+      gl::frame_buf_t::make(planes),
     };
 
     GLint y_format;
     GLint uv_format;
 
-    // Determine the size of each plane element
-    auto fmt_desc = av_pix_fmt_desc_get(format);
+    // Determine the size of each plane element, the chroma planes of planar formats hold a single component
     if (fmt_desc->comp[0].depth <= 8) {
       y_format = GL_R8;
-      uv_format = GL_RG8;
+      uv_format = planes == 3 ? GL_R8 : GL_RG8;
     } else if (fmt_desc->comp[0].depth <= 16) {
       y_format = GL_R16;
-      uv_format = GL_RG16;
+      uv_format = planes == 3 ? GL_R16 : GL_RG16;
     } else {
       BOOST_LOG(error) << "Unsupported target pixel format: "sv << format;
       return std::nullopt;
@@ -671,19 +857,18 @@ namespace egl {
     gl::ctx.BindTexture(GL_TEXTURE_2D, nv12->tex[0]);
     gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, y_format, width, height);
 
-    gl::ctx.BindTexture(GL_TEXTURE_2D, nv12->tex[1]);
-    gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, uv_format, width >> fmt_desc->log2_chroma_w, height >> fmt_desc->log2_chroma_h);
+    for (int x = 1; x < planes; ++x) {
+      gl::ctx.BindTexture(GL_TEXTURE_2D, nv12->tex[x]);
+      gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, uv_format, width >> fmt_desc->log2_chroma_w, height >> fmt_desc->log2_chroma_h);
+    }
 
     nv12->buf.bind(std::begin(nv12->tex), std::end(nv12->tex));
 
-    GLenum attachments[] {
-      GL_COLOR_ATTACHMENT0,
-      GL_COLOR_ATTACHMENT1
-    };
+    for (int x = 0; x < planes; ++x) {
+      GLenum attachment = GL_COLOR_ATTACHMENT0 + x;
 
-    for (int x = 0; x < sizeof(attachments) / sizeof(decltype(attachments[0])); ++x) {
       gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, nv12->buf[x]);
-      gl::ctx.DrawBuffers(1, &attachments[x]);
+      gl::ctx.DrawBuffers(1, &attachment);
 
       const float y_black[] = {0.0f, 0.0f, 0.0f, 0.0f};
       const float uv_black[] = {0.5f, 0.5f, 0.5f, 0.5f};
@@ -712,12 +897,15 @@ namespace egl {
 
     program[0].bind(color_matrix);
     program[1].bind(color_matrix);
+    program[3].bind(color_matrix);
+    program[4].bind(color_matrix);
   }
 
   std::optional<sws_t> sws_t::make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex) {
     sws_t sws;
 
     sws.serial = std::numeric_limits<std::uint64_t>::max();
+    sws.scale_filter = 0;
 
     // Ensure aspect ratio is maintained
     auto scalar = std::fminf(out_width / (float) in_width, out_height / (float) in_height);
@@ -740,66 +928,28 @@ namespace egl {
     auto width_i = 1.0f / sws.out_width;
 
     {
-      const char *sources[] {
-        SUNSHINE_SHADERS_DIR "/ConvertUV.frag",
-        SUNSHINE_SHADERS_DIR "/ConvertUV.vert",
-        SUNSHINE_SHADERS_DIR "/ConvertY.frag",
-        SUNSHINE_SHADERS_DIR "/Scene.vert",
-        SUNSHINE_SHADERS_DIR "/Scene.frag",
+      // The shaders of each program, in the order of sws_t::program
+      const char *sources[][2] {
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/ConvertY.frag"},
+        {SUNSHINE_SHADERS_DIR "/ConvertUV.vert", SUNSHINE_SHADERS_DIR "/ConvertUV.frag"},
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/Scene.frag"},  // Cursor
+        // Full resolution U and V, for planar YUV 4:4:4
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/ConvertU.frag"},
+        {SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/ConvertV.frag"},
       };
+      static_assert(std::size(sources) == sizeof(sws.program) / sizeof(sws.program[0]));
 
-      GLenum shader_type[2] {
-        GL_FRAGMENT_SHADER,
-        GL_VERTEX_SHADER,
-      };
-
-      constexpr auto count = sizeof(sources) / sizeof(const char *);
-
-      util::Either<gl::shader_t, std::string> compiled_sources[count];
-
-      bool error_flag = false;
-      for (int x = 0; x < count; ++x) {
-        auto &compiled_source = compiled_sources[x];
-
-        compiled_source = gl::shader_t::compile(file_handler::read_file(sources[x]), shader_type[x % 2]);
+      for (int x = 0; x < std::size(sources); ++x) {
+        auto program = gl::program_t::load(sources[x][0], sources[x][1]);
         gl_drain_errors;
 
-        if (compiled_source.has_right()) {
-          BOOST_LOG(error) << sources[x] << ": "sv << compiled_source.right();
-          error_flag = true;
+        if (program.has_right()) {
+          BOOST_LOG(error) << "GL: "sv << program.right();
+          return std::nullopt;
         }
-      }
 
-      if (error_flag) {
-        return std::nullopt;
+        sws.program[x] = std::move(program.left());
       }
-
-      auto program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[4].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // Cursor - shader
-      sws.program[2] = std::move(program.left());
-
-      program = gl::program_t::link(compiled_sources[1].left(), compiled_sources[0].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // UV - shader
-      sws.program[1] = std::move(program.left());
-
-      program = gl::program_t::link(compiled_sources[3].left(), compiled_sources[2].left());
-      if (program.has_right()) {
-        BOOST_LOG(error) << "GL linker: "sv << program.right();
-        return std::nullopt;
-      }
-
-      // Y - shader
-      sws.program[0] = std::move(program.left());
     }
 
     auto loc_width_i = gl::ctx.GetUniformLocation(sws.program[1].handle(), "width_i");
@@ -834,6 +984,8 @@ namespace egl {
 
     sws.program[0].bind(sws.color_matrix);
     sws.program[1].bind(sws.color_matrix);
+    sws.program[3].bind(sws.color_matrix);
+    sws.program[4].bind(sws.color_matrix);
 
     gl::ctx.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -887,7 +1039,59 @@ namespace egl {
     gl::ctx.BindTexture(GL_TEXTURE_2D, tex[0]);
     gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, gl_format, in_width, in_height);
 
-    return make(in_width, in_height, out_width, out_height, std::move(tex));
+    auto sws = make(in_width, in_height, out_width, out_height, std::move(tex));
+    if (!sws) {
+      return std::nullopt;
+    }
+
+    // The bilinear sampling of the conversion is all the scaling needed then
+    auto filter = config::video.scaling_filter;
+    if (filter == config::video_t::scaling_filter_e::bilinear || (sws->out_width == in_width && sws->out_height == in_height)) {
+      return sws;
+    }
+
+    auto program = gl::program_t::load(SUNSHINE_SHADERS_DIR "/Scene.vert", SUNSHINE_SHADERS_DIR "/Scale.frag");
+    gl_drain_errors;
+
+    if (program.has_right()) {
+      BOOST_LOG(error) << "GL: "sv << program.right();
+      return std::nullopt;
+    }
+
+    sws->scale_program = std::move(program.left());
+
+    auto handle = sws->scale_program.handle();
+    sws->scale_axis = gl::ctx.GetUniformLocation(handle, "axis");
+    sws->scale_ratio = gl::ctx.GetUniformLocation(handle, "ratio");
+    auto loc_filter_type = gl::ctx.GetUniformLocation(handle, "filter_type");
+    if (sws->scale_axis < 0 || sws->scale_ratio < 0 || loc_filter_type < 0) {
+      BOOST_LOG(error) << "Couldn't find uniforms [axis], [ratio] or [filter_type]"sv;
+      return std::nullopt;
+    }
+
+    sws->scale_filter = filter == config::video_t::scaling_filter_e::bicubic ? 1 : 2;
+
+    gl::ctx.UseProgram(handle);
+    gl::ctx.Uniform1i(loc_filter_type, sws->scale_filter);
+
+    // The width is scaled first, then the height, the conversion reads the result texel for texel
+    sws->scale_tex = gl::tex_t::make(2);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, sws->scale_tex[0]);
+    gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, gl_format, sws->out_width, in_height);
+    gl::ctx.BindTexture(GL_TEXTURE_2D, sws->scale_tex[1]);
+    gl::ctx.TexStorage2D(GL_TEXTURE_2D, 1, gl_format, sws->out_width, sws->out_height);
+
+    sws->scale_framebuffer = gl::frame_buf_t::make(2);
+    sws->scale_framebuffer.bind(&sws->scale_tex[0], &sws->scale_tex[0] + 2);
+
+    gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    gl_drain_errors;
+
+    BOOST_LOG(info) << "Scaling "sv << in_width << 'x' << in_height << " to "sv << sws->out_width << 'x' << sws->out_height << " with the "sv << (sws->scale_filter == 1 ? "bicubic"sv : "Lanczos"sv) << " filter"sv;
+
+    return sws;
   }
 
   void sws_t::load_ram(platf::img_t &img) {
@@ -956,17 +1160,59 @@ namespace egl {
     }
   }
 
+  int sws_t::scale() {
+    if (!scale_filter) {
+      return 0;
+    }
+
+    gl::ctx.UseProgram(scale_program.handle());
+
+    int heights[] {in_height, out_height};
+    float ratios[] {in_width / (float) out_width, in_height / (float) out_height};
+
+    for (int x = 0; x < 2; ++x) {
+      GLenum attachment = GL_COLOR_ATTACHMENT0 + x;
+
+      gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, scale_framebuffer[x]);
+      gl::ctx.DrawBuffers(1, &attachment);
+
+#ifndef NDEBUG
+      auto status = gl::ctx.CheckFramebufferStatus(GL_FRAMEBUFFER);
+      if (status != GL_FRAMEBUFFER_COMPLETE) {
+        BOOST_LOG(error) << "Pass Scale "sv << x << ": CheckFramebufferStatus() --> [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+#endif
+
+      // The height pass reads the result of the width pass
+      gl::ctx.BindTexture(GL_TEXTURE_2D, x ? scale_tex[0] : loaded_texture);
+      gl::ctx.Uniform1i(scale_axis, x);
+      gl::ctx.Uniform1f(scale_ratio, ratios[x]);
+
+      gl::ctx.Viewport(0, 0, out_width, heights[x]);
+      gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return 0;
+  }
+
   int sws_t::convert(gl::frame_buf_t &fb) {
-    gl::ctx.BindTexture(GL_TEXTURE_2D, loaded_texture);
+    if (scale()) {
+      return -1;
+    }
 
-    GLenum attachments[] {
-      GL_COLOR_ATTACHMENT0,
-      GL_COLOR_ATTACHMENT1
-    };
+    gl::ctx.BindTexture(GL_TEXTURE_2D, scale_filter ? scale_tex[1] : loaded_texture);
+
+    // Planar YUV 4:4:4 targets have a full resolution framebuffer per plane
+    bool planar = fb.size() == 3;
+
+    for (int x = 0; x < fb.size(); ++x) {
+      GLenum attachment = GL_COLOR_ATTACHMENT0 + x;
 
-    for (int x = 0; x < sizeof(attachments) / sizeof(decltype(attachments[0])); ++x) {
       gl::ctx.BindFramebuffer(GL_FRAMEBUFFER, fb[x]);
-      gl::ctx.DrawBuffers(1, &attachments[x]);
+      gl::ctx.DrawBuffers(1, &attachment);
 
 #ifndef NDEBUG
       auto status = gl::ctx.CheckFramebufferStatus(GL_FRAMEBUFFER);
@@ -976,8 +1222,13 @@ namespace egl {
       }
 #endif
 
-      gl::ctx.UseProgram(program[x].handle());
-      gl::ctx.Viewport(offsetX / (x + 1), offsetY / (x + 1), out_width / (x + 1), out_height / (x + 1));
+      if (planar) {
+        gl::ctx.UseProgram(program[x ? 2 + x : 0].handle());
+        gl::ctx.Viewport(offsetX, offsetY, out_width, out_height);
+      } else {
+        gl::ctx.UseProgram(program[x].handle());
+        gl::ctx.Viewport(offsetX / (x + 1), offsetY / (x + 1), out_width / (x + 1), out_height / (x + 1));
+      }
       gl::ctx.DrawArrays(GL_TRIANGLES, 0, 3);
     }
 
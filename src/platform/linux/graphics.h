@@ -7,6 +7,8 @@
 // standard includes
 #include <optional>
 #include <string_view>
+#include <sys/types.h>
+#include <vector>
 
 // lib includes
 #include <glad/egl.h>
@@ -154,6 +156,17 @@ namespace gl {
 
     static util::Either<program_t, std::string> link(const shader_t &vert, const shader_t &frag);
 
+    /**
+     * @brief Build a program from the files of its shaders.
+     * @details The linked program is saved to a binary cache in the app data directory, unique to the driver and to
+     *          the sources of the shaders, so later contexts load it without compiling anything. When the driver
+     *          rejects the cached binary, after an update for example, the program is built from the sources again.
+     * @param vert_file The path of the vertex shader.
+     * @param frag_file The path of the fragment shader.
+     * @return The program, or the error of the compiler or of the linker.
+     */
+    static util::Either<program_t, std::string> load(const char *vert_file, const char *frag_file);
+
     void bind(const buffer_t &buffer);
 
     std::optional<buffer_t> uniform(const char *block, std::pair<const char *, std::string_view> *members, std::size_t count);
@@ -175,6 +188,10 @@ namespace gbm {
 
   using gbm_t = util::dyn_safe_ptr<device, &device_destroy>;
 
+  /**
+   * @brief Load libgbm, it's only loaded once the first GBM device is created.
+   * @return 0 on success, -1 if it couldn't be loaded.
+   */
   int init();
 
 }  // namespace gbm
@@ -237,6 +254,12 @@ namespace egl {
     std::uint32_t offsets[4];
   };
 
+  /**
+   * @brief Load the EGL library, it's only loaded once the first EGL display is made.
+   * @return 0 on success, -1 if it couldn't be loaded.
+   */
+  int init();
+
   display_t make_display(std::variant<gbm::gbm_t::pointer, wl_display *, _XDisplay *> native_display);
   std::optional<ctx_t> make_ctx(display_t::pointer display);
 
@@ -248,6 +271,46 @@ namespace egl {
 
   rgb_t create_blank(platf::img_t &img);
 
+  /**
+   * @brief Keeps the imports of the few DMA-BUFs a compositor rotates through.
+   * @details Importing a DMA-BUF creates an EGLImage and may stall the driver, so each buffer is
+   *          imported once and recognized by the inodes of its DMA-BUFs and its layout.
+   */
+  class import_cache_t {
+  public:
+    /**
+     * @brief Get the import of a surface, importing it if it wasn't imported before.
+     * @param egl_display The EGL display.
+     * @param sd The surface.
+     * @return The import, valid until the next call, or `nullptr` if the surface can't be imported.
+     */
+    rgb_t *import(display_t::pointer egl_display, const surface_descriptor_t &sd);
+
+    /**
+     * @brief Drop all imports.
+     */
+    void clear();
+
+  private:
+    struct key_t {
+      ino_t inodes[4];
+      std::uint32_t offsets[4];
+      std::uint32_t pitches[4];
+      std::uint64_t modifier;
+      std::uint32_t fourcc;
+      int width;
+      int height;
+
+      bool operator==(const key_t &) const = default;
+    };
+
+    // Enough for triple buffering and a buffer being replaced
+    static constexpr std::size_t MAX_IMPORTS = 4;
+
+    // The least recently used import first
+    std::vector<std::pair<key_t, rgb_t>> imports;
+  };
+
   std::optional<nv12_t> import_target(
     display_t::pointer egl_display,
     std::array<file_t, nv12_img_t::num_fds> &&fds,
@@ -302,7 +365,7 @@ namespace egl {
     static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, gl::tex_t &&tex);
     static std::optional<sws_t> make(int in_width, int in_height, int out_width, int out_height, AVPixelFormat format);
 
-    // Convert the loaded image into the first two framebuffers
+    // Convert the loaded image into the first two framebuffers, or three for planar YUV 4:4:4
     int convert(gl::frame_buf_t &fb);
 
     // Make an area of the image black
@@ -313,6 +376,9 @@ namespace egl {
 
     void apply_colorspace(const video::sunshine_colorspace_t &colorspace);
 
+    // Scale the loaded image to the output resolution, when a filter sharper than the bilinear sampling of the conversion is configured
+    int scale();
+
     // The first texture is the monitor image.
     // The second texture is the cursor image
     gl::tex_t tex;
@@ -321,14 +387,23 @@ namespace egl {
     gl::frame_buf_t cursor_framebuffer;
     gl::frame_buf_t copy_framebuffer;
 
-    // Y - shader, UV - shader, Cursor - shader
-    gl::program_t program[3];
+    // Y - shader, UV - shader, Cursor - shader, U - shader, V - shader
+    gl::program_t program[5];
     gl::buffer_t color_matrix;
 
     int out_width, out_height;
     int in_width, in_height;
     int offsetX, offsetY;
 
+    // The image scaled in width, then in height, and the passes rendering them
+    gl::tex_t scale_tex;
+    gl::frame_buf_t scale_framebuffer;
+    gl::program_t scale_program;
+    GLint scale_axis, scale_ratio;
+
+    // 0 when the conversion samples the loaded image bilinearly, 1 for bicubic, 2 for Lanczos
+    int scale_filter;
+
     // Pointer to the texture to be converted to nv12
     int loaded_texture;
 
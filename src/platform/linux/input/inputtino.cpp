@@ -109,6 +109,13 @@ namespace platf {
     platf::gamepad::battery(raw, battery);
   }
 
+  void begin_input_batch(input_t &input) {
+    // inputtino writes its events as they're set
+  }
+
+  void end_input_batch(input_t &input) {
+  }
+
   platform_caps::caps_t get_capabilities() {
     platform_caps::caps_t caps = 0;
     // TODO: if has_uinput
@@ -7,6 +7,7 @@
 // lib includes
 #include <boost/locale.hpp>
 #include <cstddef>
+#include <optional>
 #include <inputtino/input.hpp>
 #include <libevdev/libevdev.h>
 
@@ -28,6 +29,9 @@ namespace platf {
     std::unique_ptr<joypads_t> joypad;
     gamepad_feedback_msg_t last_rumble;
     gamepad_feedback_msg_t last_rgb_led;
+
+    // The state last sent to the device, only the parts that change are sent again
+    std::optional<gamepad_state_t> last_state;
   };
 
   struct input_raw_t {
@@ -184,13 +184,26 @@ namespace platf::gamepad {
       return;
     }
 
-    std::visit([gamepad_state](inputtino::Joypad &gc) {
-      gc.set_pressed_buttons(gamepad_state.buttonFlags);
-      gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
-      gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
-      gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
+    // Each part inputtino sets is a write of its events and a SYN_REPORT (or a HID report for the DualSense),
+    // so a packet touching only a stick doesn't resend the buttons, the other stick and the triggers
+    auto &last = gamepad->last_state;
+    std::visit([&gamepad_state, &last](inputtino::Joypad &gc) {
+      if (!last || last->buttonFlags != gamepad_state.buttonFlags) {
+        gc.set_pressed_buttons(gamepad_state.buttonFlags);
+      }
+      if (!last || last->lsX != gamepad_state.lsX || last->lsY != gamepad_state.lsY) {
+        gc.set_stick(inputtino::Joypad::LS, gamepad_state.lsX, gamepad_state.lsY);
+      }
+      if (!last || last->rsX != gamepad_state.rsX || last->rsY != gamepad_state.rsY) {
+        gc.set_stick(inputtino::Joypad::RS, gamepad_state.rsX, gamepad_state.rsY);
+      }
+      if (!last || last->lt != gamepad_state.lt || last->rt != gamepad_state.rt) {
+        gc.set_triggers(gamepad_state.lt, gamepad_state.rt);
+      }
     },
                *gamepad->joypad);
+
+    last = gamepad_state;
   }
 
   void touch(input_raw_t *raw, const gamepad_touch_t &touch) {
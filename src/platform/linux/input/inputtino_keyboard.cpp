@@ -2,6 +2,11 @@
  * @file src/platform/linux/input/inputtino_keyboard.cpp
  * @brief Definitions for inputtino keyboard input handling.
  */
+// standard includes
+#include <array>
+#include <optional>
+#include <string_view>
+
 // lib includes
 #include <boost/locale.hpp>
 #include <inputtino/input.hpp>
@@ -343,38 +348,64 @@ static constexpr auto keycodes = init_keycodes();
     }
   }
 
+  /**
+   * @brief Get the Moonlight keyboard code of a HEX digit, looked up once for all of them.
+   * @param hex The digit, 0-9 or A-F.
+   * @return The code, or nothing if the digit has no key.
+   */
+  std::optional<short> hex_wincode(char hex) {
+    static const auto wincodes = []() {
+      std::array<std::optional<short>, 16> wincodes;
+      for (int digit = 0; digit < 16; ++digit) {
+        auto key_str = "KEY_"s + "0123456789ABCDEF"[digit];
+        auto keycode = libevdev_event_code_from_name(EV_KEY, key_str.c_str());
+        auto wincode = key_mappings.find(keycode);
+        if (keycode != -1 && wincode != key_mappings.end()) {
+          wincodes[digit] = wincode->second;
+        }
+      }
+
+      return wincodes;
+    }();
+
+    auto digit = std::string_view {"0123456789ABCDEF"}.find(hex);
+    return digit == std::string_view::npos ? std::nullopt : wincodes[digit];
+  }
+
   void unicode(input_raw_t *raw, char *utf8, int size) {
     if (raw->keyboard) {
       /* Reading input text as UTF-8 */
       auto utf8_str = boost::locale::conv::to_utf<wchar_t>(utf8, utf8 + size, "UTF-8");
       /* Converting to UTF-32 */
       auto utf32_str = boost::locale::conv::utf_to_utf<char32_t>(utf8_str);
-      /* To HEX string */
-      auto hex_unicode = to_hex(utf32_str);
-      BOOST_LOG(debug) << "Unicode, typing U+"sv << hex_unicode;
 
-      /* pressing <CTRL> + <SHIFT> + U */
-      (*raw->keyboard).press(0xA2);  // LEFTCTRL
-      (*raw->keyboard).press(0xA0);  // LEFTSHIFT
-      (*raw->keyboard).press(0x55);  // U
-      (*raw->keyboard).release(0x55);  // U
+      /* Batched text holds many characters, each of them is typed as its own sequence */
+      for (auto ch : utf32_str) {
+        /* To HEX string */
+        auto hex_unicode = to_hex(std::basic_string<char32_t>(1, ch));
+        BOOST_LOG(debug) << "Unicode, typing U+"sv << hex_unicode;
 
-      /* input each HEX character */
-      for (auto &ch : hex_unicode) {
-        auto key_str = "KEY_"s + ch;
-        auto keycode = libevdev_event_code_from_name(EV_KEY, key_str.c_str());
-        auto wincode = key_mappings.find(keycode);
-        if (keycode == -1 || wincode == key_mappings.end()) {
-          BOOST_LOG(warning) << "Unicode, unable to find keycode for: "sv << ch;
-        } else {
-          (*raw->keyboard).press(wincode->second);
-          (*raw->keyboard).release(wincode->second);
+        /* pressing <CTRL> + <SHIFT> + U */
+        (*raw->keyboard).press(0xA2);  // LEFTCTRL
+        (*raw->keyboard).press(0xA0);  // LEFTSHIFT
+        (*raw->keyboard).press(0x55);  // U
+        (*raw->keyboard).release(0x55);  // U
+
+        /* input each HEX character */
+        for (auto &hex : hex_unicode) {
+          auto wincode = hex_wincode(hex);
+          if (!wincode) {
+            BOOST_LOG(warning) << "Unicode, unable to find keycode for: "sv << hex;
+          } else {
+            (*raw->keyboard).press(*wincode);
+            (*raw->keyboard).release(*wincode);
+          }
         }
-      }
 
-      /* releasing <SHIFT> and <CTRL> */
-      (*raw->keyboard).release(0xA0);  // LEFTSHIFT
-      (*raw->keyboard).release(0xA2);  // LEFTCTRL
+        /* releasing <SHIFT> and <CTRL> */
+        (*raw->keyboard).release(0xA0);  // LEFTSHIFT
+        (*raw->keyboard).release(0xA2);  // LEFTCTRL
+      }
     }
   }
 }  // namespace platf::keyboard
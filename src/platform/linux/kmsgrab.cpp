@@ -3,10 +3,13 @@
  * @brief Definitions for KMS screen capture.
  */
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <errno.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
 
 // platform includes
@@ -14,6 +17,7 @@
 #include <linux/dma-buf.h>
 #include <sys/capability.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -60,7 +64,8 @@ namespace platf {
 
     class wrapper_fb {
     public:
-      wrapper_fb(drmModeFB *fb):
+      wrapper_fb(int card_fd, drmModeFB *fb):
+          card_fd {card_fd},
           fb {fb},
           fb_id {fb->fb_id},
           width {fb->width},
@@ -74,7 +79,8 @@ namespace platf {
         pitches[0] = fb->pitch;
       }
 
-      wrapper_fb(drmModeFB2 *fb2):
+      wrapper_fb(int card_fd, drmModeFB2 *fb2):
+          card_fd {card_fd},
           fb2 {fb2},
           fb_id {fb2->fb_id},
           width {fb2->width},
@@ -88,6 +94,15 @@ namespace platf {
       }
 
       ~wrapper_fb() {
+        // Each lookup of the framebuffer created new GEM handles, planes may share the same one
+        for (int x = 0; x < 4; ++x) {
+          if (handles[x] && std::find(handles, handles + x, handles[x]) == handles + x) {
+            drm_gem_close gem_close {};
+            gem_close.handle = handles[x];
+            drmIoctl(card_fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+          }
+        }
+
         if (fb) {
           drmModeFreeFB(fb);
         } else if (fb2) {
@@ -95,6 +110,7 @@ namespace platf {
         }
       }
 
+      int card_fd;
       drmModeFB *fb = nullptr;
       drmModeFB2 *fb2 = nullptr;
       uint32_t fb_id;
@@ -351,22 +367,26 @@ namespace platf {
         return 0;
       }
 
-      fb_t fb(plane_t::pointer plane) {
+      fb_t fb(std::uint32_t fb_id) {
         cap_sys_admin admin;
 
-        auto fb2 = drmModeGetFB2(fd.el, plane->fb_id);
+        auto fb2 = drmModeGetFB2(fd.el, fb_id);
         if (fb2) {
-          return std::make_unique<wrapper_fb>(fb2);
+          return std::make_unique<wrapper_fb>(fd.el, fb2);
         }
 
-        auto fb = drmModeGetFB(fd.el, plane->fb_id);
+        auto fb = drmModeGetFB(fd.el, fb_id);
         if (fb) {
-          return std::make_unique<wrapper_fb>(fb);
+          return std::make_unique<wrapper_fb>(fd.el, fb);
         }
 
         return nullptr;
       }
 
+      fb_t fb(plane_t::pointer plane) {
+        return fb(plane->fb_id);
+      }
+
       crtc_t crtc(std::uint32_t id) {
         return drmModeGetCrtc(fd.el, id);
       }
@@ -408,6 +428,15 @@ namespace platf {
         return std::nullopt;
       }
 
+      std::optional<std::uint64_t> prop_value_by_name(const std::vector<std::pair<std::string_view, std::uint64_t>> &props, std::string_view name) {
+        for (auto &[prop_name, val] : props) {
+          if (prop_name == name) {
+            return val;
+          }
+        }
+        return std::nullopt;
+      }
+
       std::uint32_t get_panel_orientation(std::uint32_t plane_id) {
         auto props = plane_props(plane_id);
         auto value = prop_value_by_name(props, "rotation"sv);
@@ -494,6 +523,37 @@ namespace platf {
         return props;
       }
 
+      /**
+       * @brief Get the current values of the properties of an object, by name.
+       * @details Unlike `props()`, this doesn't query the properties themselves once their names are known,
+       *          so it costs a single ioctl when reading properties on every frame.
+       */
+      std::vector<std::pair<std::string_view, std::uint64_t>> prop_values(std::uint32_t id, std::uint32_t type) {
+        obj_prop_t obj_prop = drmModeObjectGetProperties(fd.el, id, type);
+        if (!obj_prop) {
+          return {};
+        }
+
+        std::vector<std::pair<std::string_view, std::uint64_t>> values;
+        values.reserve(obj_prop->count_props);
+
+        for (auto x = 0; x < obj_prop->count_props; ++x) {
+          auto name = prop_names.find(obj_prop->props[x]);
+          if (name == std::end(prop_names)) {
+            prop_t prop = drmModeGetProperty(fd.el, obj_prop->props[x]);
+            if (!prop) {
+              continue;
+            }
+
+            name = prop_names.emplace(obj_prop->props[x], prop->name).first;
+          }
+
+          values.emplace_back(name->second, obj_prop->prop_values[x]);
+        }
+
+        return values;
+      }
+
       std::vector<std::pair<prop_t, std::uint64_t>> plane_props(std::uint32_t id) {
         return props(id, DRM_MODE_OBJECT_PLANE);
       }
@@ -525,6 +585,9 @@ namespace platf {
       file_t fd;
       file_t render_fd;
       plane_res_t plane_res;
+
+      // Property ids are unique to the device and their names never change
+      std::map<std::uint32_t, std::string> prop_names;
     };
 
     std::map<std::uint32_t, monitor_t> map_crtc_to_monitor(const std::vector<connector_t> &connectors) {
@@ -542,7 +605,7 @@ namespace platf {
 
     struct kms_img_t: public img_t {
       ~kms_img_t() override {
-        delete[] data;
+        free_frame_data(data, height * row_pitch);
         data = nullptr;
       }
     };
@@ -586,8 +649,14 @@ namespace platf {
           mem_type {mem_type} {
       }
 
+      capture_backend_t capture_backend() const override {
+        return {"kms"sv, false};
+      }
+
       int init(const std::string &display_name, const ::video::config_t &config) {
         delay = std::chrono::nanoseconds {1s} / config.framerate;
+        vblank = config::video.kms_vblank;
+        skip_unchanged = config::video.kms_skip_unchanged;
 
         int monitor_index = util::from_view(display_name);
         int monitor = 0;
@@ -777,69 +846,63 @@ namespace platf {
           BOOST_LOG(warning) << "No KMS cursor plane found. Cursor may not be displayed while streaming!"sv;
         }
 
+        // refresh() reinitializes when the HDR metadata blob changes, so it's only queried again by the next display
+        refresh_hdr_state();
+
         return 0;
       }
 
-      bool is_hdr() {
+      hdr_state_t query_hdr_state() override {
+        hdr_state_t state {};
+
         if (!hdr_metadata_blob_id || *hdr_metadata_blob_id == 0) {
-          return false;
+          return state;
         }
 
         prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, *hdr_metadata_blob_id);
         if (hdr_metadata_blob == nullptr) {
           BOOST_LOG(error) << "Unable to get HDR metadata blob: "sv << strerror(errno);
-          return false;
+          return state;
         }
 
         if (hdr_metadata_blob->length < sizeof(uint32_t) + sizeof(hdr_metadata_infoframe)) {
           BOOST_LOG(error) << "HDR metadata blob is too small: "sv << hdr_metadata_blob->length;
-          return false;
+          return state;
         }
 
         auto raw_metadata = (hdr_output_metadata *) hdr_metadata_blob->data;
         if (raw_metadata->metadata_type != 0) {  // HDMI_STATIC_METADATA_TYPE1
           BOOST_LOG(error) << "Unknown HDMI_STATIC_METADATA_TYPE value: "sv << raw_metadata->metadata_type;
-          return false;
+          return state;
         }
 
         if (raw_metadata->hdmi_metadata_type1.metadata_type != 0) {  // Static Metadata Type 1
           BOOST_LOG(error) << "Unknown secondary metadata type value: "sv << raw_metadata->hdmi_metadata_type1.metadata_type;
-          return false;
+          return state;
         }
 
         // We only support Traditional Gamma SDR or SMPTE 2084 PQ HDR EOTFs.
         // Print a warning if we encounter any others.
         switch (raw_metadata->hdmi_metadata_type1.eotf) {
           case 0:  // HDMI_EOTF_TRADITIONAL_GAMMA_SDR
-            return false;
+            return state;
           case 1:  // HDMI_EOTF_TRADITIONAL_GAMMA_HDR
             BOOST_LOG(warning) << "Unsupported HDR EOTF: Traditional Gamma"sv;
-            return true;
+            break;
           case 2:  // HDMI_EOTF_SMPTE_ST2084
-            return true;
+            break;
           case 3:  // HDMI_EOTF_BT_2100_HLG
             BOOST_LOG(warning) << "Unsupported HDR EOTF: HLG"sv;
-            return true;
+            break;
           default:
             BOOST_LOG(warning) << "Unsupported HDR EOTF: "sv << raw_metadata->hdmi_metadata_type1.eotf;
-            return true;
+            break;
         }
-      }
 
-      bool get_hdr_metadata(SS_HDR_METADATA &metadata) {
-        // This performs all the metadata validation
-        if (!is_hdr()) {
-          return false;
-        }
-
-        prop_blob_t hdr_metadata_blob = drmModeGetPropertyBlob(card.fd.el, *hdr_metadata_blob_id);
-        if (hdr_metadata_blob == nullptr) {
-          BOOST_LOG(error) << "Unable to get HDR metadata blob: "sv << strerror(errno);
-          return false;
-        }
-
-        auto raw_metadata = (hdr_output_metadata *) hdr_metadata_blob->data;
+        state.enabled = true;
+        state.has_metadata = true;
 
+        auto &metadata = state.metadata;
         for (int i = 0; i < 3; i++) {
           metadata.displayPrimaries[i].x = raw_metadata->hdmi_metadata_type1.display_primaries[i].x;
           metadata.displayPrimaries[i].y = raw_metadata->hdmi_metadata_type1.display_primaries[i].y;
@@ -852,7 +915,7 @@ namespace platf {
         metadata.maxContentLightLevel = raw_metadata->hdmi_metadata_type1.max_cll;
         metadata.maxFrameAverageLightLevel = raw_metadata->hdmi_metadata_type1.max_fall;
 
-        return true;
+        return state;
       }
 
       void update_cursor() {
@@ -860,8 +923,7 @@ namespace platf {
           return;
         }
 
-        plane_t plane = drmModeGetPlane(card.fd.el, cursor_plane_id);
-
+        std::optional<std::uint32_t> prop_fb_id;
         std::optional<std::int32_t> prop_crtc_x;
         std::optional<std::int32_t> prop_crtc_y;
         std::optional<std::uint32_t> prop_crtc_w;
@@ -872,28 +934,31 @@ namespace platf {
         std::optional<std::uint64_t> prop_src_w;
         std::optional<std::uint64_t> prop_src_h;
 
-        auto props = card.plane_props(cursor_plane_id);
-        for (auto &[prop, val] : props) {
-          if (prop->name == "CRTC_X"sv) {
+        // The framebuffer of the cursor is a property as well, so a single query covers the whole plane
+        auto props = card.prop_values(cursor_plane_id, DRM_MODE_OBJECT_PLANE);
+        for (auto &[name, val] : props) {
+          if (name == "FB_ID"sv) {
+            prop_fb_id = val;
+          } else if (name == "CRTC_X"sv) {
             prop_crtc_x = val;
-          } else if (prop->name == "CRTC_Y"sv) {
+          } else if (name == "CRTC_Y"sv) {
             prop_crtc_y = val;
-          } else if (prop->name == "CRTC_W"sv) {
+          } else if (name == "CRTC_W"sv) {
             prop_crtc_w = val;
-          } else if (prop->name == "CRTC_H"sv) {
+          } else if (name == "CRTC_H"sv) {
             prop_crtc_h = val;
-          } else if (prop->name == "SRC_X"sv) {
+          } else if (name == "SRC_X"sv) {
             prop_src_x = val;
-          } else if (prop->name == "SRC_Y"sv) {
+          } else if (name == "SRC_Y"sv) {
             prop_src_y = val;
-          } else if (prop->name == "SRC_W"sv) {
+          } else if (name == "SRC_W"sv) {
             prop_src_w = val;
-          } else if (prop->name == "SRC_H"sv) {
+          } else if (name == "SRC_H"sv) {
             prop_src_h = val;
           }
         }
 
-        if (!prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y) {
+        if (!prop_fb_id || !prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y) {
           BOOST_LOG(error) << "Cursor plane is missing required plane CRTC properties!"sv;
           BOOST_LOG(error) << "Atomic mode-setting must be enabled to capture the cursor!"sv;
           cursor_plane_id = -1;
@@ -919,10 +984,10 @@ namespace platf {
         // true, we'll really have to mmap() the dmabuf and draw that every time.
         bool cursor_dirty = false;
 
-        if (!plane->fb_id) {
+        if (!*prop_fb_id) {
           captured_cursor.visible = false;
           captured_cursor.fb_id = 0;
-        } else if (plane->fb_id != captured_cursor.fb_id) {
+        } else if (*prop_fb_id != captured_cursor.fb_id) {
           BOOST_LOG(debug) << "Refreshing cursor image after FB changed"sv;
           cursor_dirty = true;
         } else if (*prop_src_x != captured_cursor.prop_src_x ||
@@ -935,7 +1000,7 @@ namespace platf {
 
         // If the cursor is dirty, map it so we can download the new image
         if (cursor_dirty) {
-          auto fb = card.fb(plane.get());
+          auto fb = card.fb(*prop_fb_id);
           if (!fb || !fb->handles[0]) {
             // This means the cursor is not currently visible
             captured_cursor.visible = false;
@@ -1031,15 +1096,59 @@ namespace platf {
           captured_cursor.prop_src_y = *prop_src_y;
           captured_cursor.prop_src_w = *prop_src_w;
           captured_cursor.prop_src_h = *prop_src_h;
-          captured_cursor.fb_id = plane->fb_id;
+          captured_cursor.fb_id = *prop_fb_id;
           ++captured_cursor.serial;
         }
       }
 
+      /**
+       * @brief Wait until the next frame is due.
+       * @details With `kms_vblank`, the frame is captured right after a vertical blank of the CRTC,
+       *          once the framebuffer flipped by the compositor is being scanned out. The timer is
+       *          used instead if the CRTC can't be waited for.
+       * @param next_frame The time the next frame is due, advanced by one frame.
+       */
+      void wait_for_frame(std::chrono::steady_clock::time_point &next_frame) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (vblank) {
+          // Accept the first vertical blank past half a frame before the deadline, the cadence of the
+          // display and the stream rarely line up
+          auto earliest = next_frame - delay / 2;
+          if (earliest > now) {
+            std::this_thread::sleep_for(earliest - now);
+          }
+
+          drmVBlank vbl {};
+          vbl.request.type = (drmVBlankSeqType) (DRM_VBLANK_RELATIVE | ((crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+          vbl.request.sequence = 1;
+
+          if (drmWaitVBlank(card.fd.el, &vbl)) {
+            BOOST_LOG(warning) << "Couldn't wait for the vertical blank of CRTC ["sv << crtc_id << "], capturing on a timer: "sv << strerror(errno);
+            vblank = false;
+          } else {
+            now = std::chrono::steady_clock::now();
+            next_frame = std::max(next_frame, now) + delay;
+            return;
+          }
+        }
+
+        if (next_frame > now) {
+          timer->sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+      }
+
       inline capture_e refresh(file_t *file, egl::surface_descriptor_t *sd, std::optional<std::chrono::steady_clock::time_point> &frame_timestamp) {
         // Check for a change in HDR metadata
         if (connector_id) {
-          auto connector_props = card.connector_props(*connector_id);
+          auto connector_props = card.prop_values(*connector_id, DRM_MODE_OBJECT_CONNECTOR);
           if (hdr_metadata_blob_id != card.prop_value_by_name(connector_props, "HDR_OUTPUT_METADATA"sv)) {
             BOOST_LOG(info) << "Reinitializing capture after HDR metadata change"sv;
             return capture_e::reinit;
@@ -1083,6 +1192,17 @@ namespace platf {
           sd->pitches[y] = fb->pitches[y];
         }
 
+        // Framebuffer ids are recycled, the dma-buf of the first plane tells reused ids apart
+        struct stat st;
+        if (fstat(file[0].el, &st)) {
+          BOOST_LOG(error) << "Couldn't stat the dma-buf of Framebuffer ["sv << fb->fb_id << "]: "sv << strerror(errno);
+          return capture_e::error;
+        }
+
+        fb_identity_t identity {fb->fb_id, st.st_ino};
+        fb_changed = identity != fb_identity;
+        fb_identity = identity;
+
         sd->width = fb->width;
         sd->height = fb->height;
         sd->modifier = fb->modifier;
@@ -1095,15 +1215,46 @@ namespace platf {
           return capture_e::reinit;
         }
 
+        auto cursor_before = std::make_tuple(captured_cursor.visible, captured_cursor.x, captured_cursor.y, captured_cursor.dst_w, captured_cursor.dst_h, captured_cursor.serial);
         update_cursor();
+        cursor_changed = cursor_before != std::make_tuple(captured_cursor.visible, captured_cursor.x, captured_cursor.y, captured_cursor.dst_w, captured_cursor.dst_h, captured_cursor.serial);
 
         return capture_e::ok;
       }
 
+      /**
+       * @brief Check whether the last refresh found nothing new to capture.
+       * @return `true` if skipping unchanged framebuffers is enabled and neither the framebuffer nor the cursor changed.
+       */
+      bool unchanged() const {
+        return skip_unchanged && !fb_changed && !cursor_changed;
+      }
+
       mem_type_e mem_type;
 
       std::chrono::nanoseconds delay;
 
+      // Paces the frames when the vertical blanks of the CRTC aren't waited for
+      std::unique_ptr<high_precision_timer> timer = create_hybrid_timer();
+
+      // Frames are captured after the vertical blanks of the CRTC
+      bool vblank;
+
+      // Frames are only captured when the compositor flips a new framebuffer or moves the cursor
+      bool skip_unchanged;
+
+      struct fb_identity_t {
+        std::uint32_t fb_id;
+        ino_t dmabuf_inode;
+
+        bool operator==(const fb_identity_t &) const = default;
+      };
+
+      // The framebuffer found by the last refresh
+      fb_identity_t fb_identity {};
+      bool fb_changed {};
+      bool cursor_changed {};
+
       int img_width, img_height;
       int img_offset_x, img_offset_y;
 
@@ -1117,7 +1268,44 @@ namespace platf {
       int cursor_plane_id;
       cursor_t captured_cursor {};
 
+      // The shape sent to the client when the cursor is left out of the images
+      std::shared_ptr<const platf::cursor_shape_t> cursor_shape;
+      unsigned long cursor_shape_serial {};
+
       card_t card;
+
+      /**
+       * @brief Get the cursor that's left out of the images.
+       * @return The cursor, or `std::nullopt` if it was never captured.
+       */
+      std::optional<platf::cursor_state_t> cursor_state() {
+        static std::atomic<std::uint32_t> next_serial;
+
+        if (captured_cursor.pixels.empty()) {
+          return std::nullopt;
+        }
+
+        if (!cursor_shape || cursor_shape_serial != captured_cursor.serial) {
+          // The cursor plane holds premultiplied ARGB, its position is the top left corner
+          auto shape = std::make_shared<platf::cursor_shape_t>();
+          shape->serial = ++next_serial;
+          shape->width = captured_cursor.src_w;
+          shape->height = captured_cursor.src_h;
+          shape->hot_x = 0;
+          shape->hot_y = 0;
+          shape->pixels = captured_cursor.pixels;
+
+          cursor_shape = std::move(shape);
+          cursor_shape_serial = captured_cursor.serial;
+        }
+
+        return platf::cursor_state_t {
+          captured_cursor.visible,
+          captured_cursor.x - img_offset_x,
+          captured_cursor.y - img_offset_y,
+          cursor_shape,
+        };
+      }
     };
 
     class display_ram_t: public display_t {
@@ -1127,8 +1315,8 @@ namespace platf {
       }
 
       int init(const std::string &display_name, const ::video::config_t &config) {
-        if (!gbm::create_device) {
-          BOOST_LOG(warning) << "libgbm not initialized"sv;
+        if (gbm::init()) {
+          BOOST_LOG(warning) << "Couldn't load libgbm"sv;
           return -1;
         }
 
@@ -1163,21 +1351,12 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
+          auto snapshot_begin = std::chrono::steady_clock::now();
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+          capture_stats().snapshot(status, snapshot_begin, img_out.get());
           switch (status) {
             case platf::capture_e::reinit:
             case platf::capture_e::error:
@@ -1249,20 +1428,7 @@ namespace platf {
 
           auto pixels_begin = &pixels[(y + cursor_y) * (img.row_pitch / img.pixel_pitch) + cursor_x];
 
-          std::for_each(cursor_begin, cursor_end, [&](uint32_t cursor_pixel) {
-            auto colors_in = (uint8_t *) pixels_begin;
-
-            auto alpha = (*(uint *) &cursor_pixel) >> 24u;
-            if (alpha == 255) {
-              *pixels_begin = cursor_pixel;
-            } else {
-              auto colors_out = (uint8_t *) &cursor_pixel;
-              colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-              colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-              colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-            }
-            ++pixels_begin;
-          });
+          blend_cursor_row((uint32_t *) pixels_begin, cursor_begin, cursor_end - cursor_begin);
         }
       }
 
@@ -1277,13 +1443,16 @@ namespace platf {
           return status;
         }
 
-        auto rgb_opt = egl::import_source(display.get(), sd);
+        if (unchanged()) {
+          return capture_e::timeout;
+        }
 
-        if (!rgb_opt) {
+        auto rgb_p = imports.import(display.get(), sd);
+        if (!rgb_p) {
           return capture_e::error;
         }
 
-        auto &rgb = *rgb_opt;
+        auto &rgb = *rgb_p;
 
         gl::ctx.BindTexture(GL_TEXTURE_2D, rgb->tex[0]);
 
@@ -1305,6 +1474,12 @@ namespace platf {
           blend_cursor(*img_out);
         }
 
+        if (!cursor) {
+          img_out->cursor = cursor_state();
+        } else {
+          img_out->cursor.reset();
+        }
+
         return capture_e::ok;
       }
 
@@ -1314,7 +1489,10 @@ namespace platf {
         img->height = height;
         img->pixel_pitch = 4;
         img->row_pitch = img->pixel_pitch * width;
-        img->data = new std::uint8_t[height * img->row_pitch];
+        img->data = alloc_frame_data(height * img->row_pitch);
+        if (!img->data) {
+          return nullptr;
+        }
 
         return img;
       }
@@ -1326,6 +1504,8 @@ namespace platf {
       gbm::gbm_t gbm;
       egl::display_t display;
       egl::ctx_t ctx;
+
+      egl::import_cache_t imports;
     };
 
     class display_vram_t: public display_t {
@@ -1377,21 +1557,12 @@ namespace platf {
         sleep_overshoot_logger.reset();
 
         while (true) {
-          auto now = std::chrono::steady_clock::now();
-
-          if (next_frame > now) {
-            std::this_thread::sleep_for(next_frame - now);
-            sleep_overshoot_logger.first_point(next_frame);
-            sleep_overshoot_logger.second_point_now_and_log();
-          }
-
-          next_frame += delay;
-          if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
-            next_frame = now + delay;
-          }
+          wait_for_frame(next_frame);
 
           std::shared_ptr<platf::img_t> img_out;
+          auto snapshot_begin = std::chrono::steady_clock::now();
           auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+          capture_stats().snapshot(status, snapshot_begin, img_out.get());
           switch (status) {
             case platf::capture_e::reinit:
             case platf::capture_e::error:
@@ -1419,18 +1590,32 @@ namespace platf {
       capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds /* timeout */, bool cursor) {
         file_t fb_fd[4];
 
+        egl::surface_descriptor_t sd;
+
+        std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+        auto status = refresh(fb_fd, &sd, frame_timestamp);
+        if (status != capture_e::ok) {
+          return status;
+        }
+
+        if (unchanged()) {
+          return capture_e::timeout;
+        }
+
         if (!pull_free_image_cb(img_out)) {
           return platf::capture_e::interrupted;
         }
         auto img = (egl::img_descriptor_t *) img_out.get();
         img->reset();
 
-        auto status = refresh(fb_fd, &img->sd, img->frame_timestamp);
-        if (status != capture_e::ok) {
-          return status;
-        }
+        img->sd = sd;
+        img->frame_timestamp = frame_timestamp;
 
-        img->sequence = ++sequence;
+        // The encoder keeps its import while the sequence is the same
+        if (fb_changed) {
+          ++sequence;
+        }
+        img->sequence = sequence;
 
         if (cursor && captured_cursor.visible) {
           // Copy new cursor pixel data if it's been updated
@@ -1452,6 +1637,12 @@ namespace platf {
           img->data = nullptr;
         }
 
+        if (!cursor) {
+          img->cursor = cursor_state();
+        } else {
+          img->cursor.reset();
+        }
+
         for (auto x = 0; x < 4; ++x) {
           fb_fd[x].release();
         }
@@ -1577,8 +1768,8 @@ namespace platf {
       return {};
     }
 
-    if (!gbm::create_device) {
-      BOOST_LOG(warning) << "libgbm not initialized"sv;
+    if (gbm::init()) {
+      BOOST_LOG(warning) << "Couldn't load libgbm"sv;
       return {};
     }
 
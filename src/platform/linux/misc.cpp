@@ -9,15 +9,32 @@
 #endif
 
 // standard includes
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 // platform includes
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -32,9 +49,19 @@
 #include "src/config.h"
 #include "src/entry_handler.h"
 #include "src/logging.h"
+#include "src/network.h"
 #include "src/platform/common.h"
+#include "src/thread_affinity.h"
 #include "vaapi.h"
 
+#ifdef SUNSHINE_BUILD_IO_URING
+  #include "uring.h"
+#endif
+
+#ifdef SUNSHINE_BUILD_XDP
+  #include "xdp.h"
+#endif
+
 #ifdef __GNUC__
   #define SUNSHINE_GNUC_EXTENSION __extension__
 #else
@@ -229,6 +256,25 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    auto ifaddrs = get_ifaddrs();
+    for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (pos->ifa_addr && address == from_sockaddr(pos->ifa_addr)) {
+        // Reported in Mbps, or -1 (or an error) for links without a fixed speed like Wi-Fi
+        std::ifstream speed_file("/sys/class/net/"s + pos->ifa_name + "/speed");
+        std::int64_t speed_mbps = -1;
+        if (speed_file >> speed_mbps && speed_mbps > 0) {
+          return speed_mbps * 1000 * 1000;
+        }
+
+        break;
+      }
+    }
+
+    BOOST_LOG(debug) << "Unable to find link speed for "sv << address;
+    return 0;
+  }
+
   bp::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const bp::environment &env, FILE *file, std::error_code &ec, bp::group *group) {
     // clang-format off
     if (!group) {
@@ -274,6 +320,123 @@ namespace platf {
     // Unimplemented
   }
 
+  namespace {
+    /**
+     * @brief Read a list of CPUs in the format of sysfs, such as `0-7,16-23`.
+     * @param path The file holding the list.
+     * @return The CPUs, or an empty list if the file can't be read.
+     */
+    std::vector<int> read_cpu_list(const std::filesystem::path &path) {
+      std::ifstream file {path};
+
+      std::string list;
+      if (!std::getline(file, list)) {
+        return {};
+      }
+
+      return thread_affinity::parse_cpus(list, numa_node_cpus);
+    }
+  }  // namespace
+
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (auto cpu : cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpu_set);
+      }
+    }
+
+    if (auto err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+      BOOST_LOG(warning) << "Unable to set thread affinity: "sv << err;
+      return false;
+    }
+
+    return true;
+  }
+
+  std::vector<int> numa_node_cpus(int node) {
+    return read_cpu_list("/sys/devices/system/node/node"s + std::to_string(node) + "/cpulist"s);
+  }
+
+  std::vector<int> gpu_local_cpus() {
+    // The adapter is given as the path to its render node
+    std::filesystem::path adapter {config::video.adapter_name.empty() ? "/dev/dri/renderD128"s : config::video.adapter_name};
+
+    auto local_cpus = read_cpu_list("/sys/class/drm"s / adapter.filename() / "device/local_cpulist"s);
+    if (local_cpus.empty()) {
+      return {};
+    }
+
+    // Narrow them down to the CPUs sharing the last level cache with the first of them
+    auto llc_cpus = read_cpu_list("/sys/devices/system/cpu/cpu"s + std::to_string(local_cpus.front()) + "/cache/index3/shared_cpu_list"s);
+
+    std::vector<int> cpus;
+    std::set_intersection(std::begin(local_cpus), std::end(local_cpus), std::begin(llc_cpus), std::end(llc_cpus), std::back_inserter(cpus));
+
+    return cpus.empty() ? local_cpus : cpus;
+  }
+
+  namespace {
+    constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /**
+     * @brief Get the NUMA node the encode threads run on.
+     * @return The node, or -1 if it can't be determined.
+     */
+    int encode_numa_node() {
+      auto cpus = thread_affinity::cpus(thread_affinity::role_e::encode);
+      if (cpus.empty()) {
+        cpus = gpu_local_cpus();
+      }
+      if (cpus.empty()) {
+        return -1;
+      }
+
+      std::error_code ec;
+      for (auto &entry : std::filesystem::directory_iterator {"/sys/devices/system/cpu/cpu"s + std::to_string(cpus.front()), ec}) {
+        auto name = entry.path().filename().string();
+        if (name.starts_with("node"sv)) {
+          return std::atoi(name.c_str() + 4);
+        }
+      }
+
+      return -1;
+    }
+  }  // namespace
+
+  std::uint8_t *alloc_frame_data(std::size_t size) {
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    // Reserved huge pages are rarely configured, transparent ones are the usual fallback
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data == MAP_FAILED) {
+      data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (data == MAP_FAILED) {
+        BOOST_LOG(error) << "Couldn't allocate "sv << size << " bytes for a frame: "sv << strerror(errno);
+        return nullptr;
+      }
+
+      madvise(data, size, MADV_HUGEPAGE);
+    }
+
+    // Prefer the node before the pages are first touched, mbind() doesn't move them later
+    static const int node = encode_numa_node();
+    if (node >= 0 && node < (int) sizeof(unsigned long) * 8) {
+      constexpr int MPOL_PREFERRED = 1;
+      unsigned long nodemask = 1UL << node;
+      syscall(SYS_mbind, data, size, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0);
+    }
+
+    return (std::uint8_t *) data;
+  }
+
+  void free_frame_data(std::uint8_t *data, std::size_t size) {
+    if (data) {
+      munmap(data, (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    }
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -332,6 +495,101 @@ namespace platf {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  /**
+   * @brief Waits for the pidfd of the initial process of an app to become readable, which it does once the process exited.
+   * @details The other processes of the group can't be watched through pidfds without knowing them,
+   *          so they're checked once a second after the initial process exited.
+   */
+  class process_watch_t: public deinit_t {
+  public:
+    process_watch_t(int pidfd, int stop_fd, pid_t group, bool wait_all, std::function<void()> on_exit):
+        pidfd {pidfd},
+        stop_fd {stop_fd},
+        thread {&process_watch_t::run, this, group, wait_all, std::move(on_exit)} {
+    }
+
+    ~process_watch_t() override {
+      std::uint64_t stop = 1;
+      if (write(stop_fd, &stop, sizeof(stop)) < 0) {
+        BOOST_LOG(warning) << "Couldn't stop the process watch: "sv << errno;
+      }
+
+      thread.join();
+      close(stop_fd);
+      close(pidfd);
+    }
+
+  private:
+    void run(pid_t group, bool wait_all, std::function<void()> on_exit) {
+      std::array<pollfd, 2> fds {{{pidfd, POLLIN, 0}, {stop_fd, POLLIN, 0}}};
+
+      // No timeout until the initial process exited
+      int timeout = -1;
+      while (true) {
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          BOOST_LOG(warning) << "Couldn't wait for the app to exit: "sv << errno;
+          return;
+        }
+
+        if (fds[1].revents) {
+          return;
+        }
+
+        if (fds[0].revents) {
+          if (!wait_all) {
+            break;
+          }
+
+          // A negative fd is ignored by poll()
+          fds[0].fd = -1;
+          timeout = 1000;
+        }
+
+        if (fds[0].fd < 0) {
+          // Reap the processes that exited, so the initial one doesn't count as running
+          pid_t pid;
+          while ((pid = waitpid(-group, nullptr, WNOHANG)) > 0) {}
+
+          if (pid < 0) {
+            break;
+          }
+        }
+      }
+
+      on_exit();
+    }
+
+    int pidfd;
+    int stop_fd;
+    std::thread thread;
+  };
+
+  std::unique_ptr<deinit_t> watch_process_exit(std::uintptr_t process_handle, std::uintptr_t group_handle, bool wait_all, std::function<void()> on_exit) {
+#ifdef SYS_pidfd_open
+    // pidfd_open() is only wrapped by glibc 2.36 and later
+    int pidfd = (int) syscall(SYS_pidfd_open, (pid_t) process_handle, 0);
+    if (pidfd < 0) {
+      BOOST_LOG(debug) << "Couldn't open a pidfd for ["sv << process_handle << "], polling it instead: "sv << errno;
+      return nullptr;
+    }
+
+    int stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+      BOOST_LOG(warning) << "Couldn't create an eventfd: "sv << errno;
+      close(pidfd);
+      return nullptr;
+    }
+
+    return std::make_unique<process_watch_t>(pidfd, stop_fd, (pid_t) group_handle, wait_all, std::move(on_exit));
+#else
+    return nullptr;
+#endif
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -357,27 +615,129 @@ namespace platf {
     return saddr_v6;
   }
 
+  /**
+   * @brief Append a control message marking the packets of a sendmsg() call with a DSCP value.
+   * @param msg The message, with room for the control message in its control buffer.
+   * @param last_cm The last control message already in the control buffer.
+   * @param target_address The address the packets are sent to.
+   * @param dscp The DSCP value.
+   * @return The appended control message.
+   */
+  struct cmsghdr *append_dscp_cmsg(struct msghdr &msg, struct cmsghdr *last_cm, boost::asio::ip::address &target_address, std::uint8_t dscp) {
+    auto cm = CMSG_NXTHDR(&msg, last_cm);
+
+    // Like enable_socket_qos(), IPv4 traffic on dual-stack sockets uses IP_TOS
+    if (target_address.is_v6() && !target_address.to_v6().is_v4_mapped()) {
+      cm->cmsg_level = SOL_IPV6;
+      cm->cmsg_type = IPV6_TCLASS;
+    } else {
+      cm->cmsg_level = SOL_IP;
+      cm->cmsg_type = IP_TOS;
+    }
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+
+    // Shift to put the DSCP value in the correct position in the TOS field
+    *((int *) CMSG_DATA(cm)) = dscp << 2;
+
+    return cm;
+  }
+
+  /**
+   * @brief Append a control message holding the packets of a sendmsg() call until their launch time.
+   * @param msg The message, with room for the control message in its control buffer.
+   * @param last_cm The last control message already in the control buffer.
+   * @param launch_time The time the packets are sent at.
+   * @return The appended control message.
+   */
+  struct cmsghdr *append_txtime_cmsg(struct msghdr &msg, struct cmsghdr *last_cm, std::chrono::steady_clock::time_point launch_time) {
+    auto cm = CMSG_NXTHDR(&msg, last_cm);
+
+#ifdef SCM_TXTIME
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_TXTIME;
+    cm->cmsg_len = CMSG_LEN(sizeof(std::uint64_t));
+
+    // The epoch of std::chrono::steady_clock is the one of CLOCK_MONOTONIC
+    *((std::uint64_t *) CMSG_DATA(cm)) = std::chrono::duration_cast<std::chrono::nanoseconds>(launch_time.time_since_epoch()).count();
+#endif
+
+    return cm;
+  }
+
+#ifdef SUNSHINE_BUILD_XDP
+  /**
+   * @brief Send the messages of a batch through AF_XDP.
+   * @param send_info The batch.
+   * @return The number of messages sent, from the start of the batch.
+   */
+  size_t send_batch_xdp(batched_send_info_t &send_info) {
+    // Only IPv4 neighbors, dual-stack sockets send to them with mapped addresses
+    auto target_address = net::normalize_address(send_info.target_address);
+    auto source_address = net::normalize_address(send_info.source_address);
+    if (!target_address.is_v4() || !source_address.is_v4()) {
+      return 0;
+    }
+
+    xdp::datagram_t datagrams[send_info.block_count];
+    for (size_t i = 0; i < send_info.block_count; i++) {
+      auto block = send_info.block_offset + i;
+
+      datagrams[i].header = send_info.headers ? &send_info.headers[block * send_info.header_size] : nullptr;
+      datagrams[i].header_size = send_info.headers ? send_info.header_size : 0;
+      datagrams[i].payload = send_info.buffer_for_payload_offset(block * send_info.payload_size).buffer;
+      datagrams[i].payload_size = send_info.payload_size;
+    }
+
+    auto taddr_v4 = to_sockaddr(target_address.to_v4(), send_info.target_port);
+    auto saddr_v4 = to_sockaddr(source_address.to_v4(), 0);
+
+    auto sent = xdp::send((int) send_info.native_socket, saddr_v4.sin_addr, taddr_v4, send_info.dscp, datagrams, (int) send_info.block_count);
+    return std::max(sent, 0);
+  }
+#endif
+
   bool send_batch(batched_send_info_t &send_info) {
+#ifdef SUNSHINE_BUILD_XDP
+    // Whatever isn't sent through AF_XDP goes through the kernel, the caller sees the batch as it was
+    auto restore_batch = util::fail_guard([&send_info, block_offset = send_info.block_offset, block_count = send_info.block_count]() {
+      send_info.block_offset = block_offset;
+      send_info.block_count = block_count;
+    });
+
+    // Packets waiting for their launch time are held by the queueing discipline, which AF_XDP skips
+    if (config::stream.xdp_send && !send_info.launch_time.time_since_epoch().count()) {
+      auto sent = send_batch_xdp(send_info);
+      if (sent == send_info.block_count) {
+        return true;
+      }
+
+      send_info.block_offset += sent;
+      send_info.block_count -= sent;
+    }
+#endif
+
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
 
-    // Convert the target address into a sockaddr
+    // Convert the target address into a sockaddr, connected sockets already know it
     struct sockaddr_in taddr_v4 = {};
     struct sockaddr_in6 taddr_v6 = {};
-    if (send_info.target_address.is_v6()) {
-      taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+    if (!send_info.connected) {
+      if (send_info.target_address.is_v6()) {
+        taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v6;
-      msg.msg_namelen = sizeof(taddr_v6);
-    } else {
-      taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+        msg.msg_name = (struct sockaddr *) &taddr_v6;
+        msg.msg_namelen = sizeof(taddr_v6);
+      } else {
+        taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v4;
-      msg.msg_namelen = sizeof(taddr_v4);
+        msg.msg_name = (struct sockaddr *) &taddr_v4;
+        msg.msg_namelen = sizeof(taddr_v4);
+      }
     }
 
     union {
-      char buf[CMSG_SPACE(sizeof(uint16_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(std::uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
     } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
@@ -387,7 +747,7 @@ namespace platf {
     msg.msg_controllen = sizeof(cmbuf.buf);
 
     // The PKTINFO option will always be first, then we will conditionally
-    // append the UDP_SEGMENT option next if applicable.
+    // append the TOS and UDP_SEGMENT options next if applicable.
     auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
     if (send_info.source_address.is_v6()) {
       struct in6_pktinfo pktInfo;
@@ -417,6 +777,17 @@ namespace platf {
       memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
     }
 
+    auto last_cm = pktinfo_cm;
+    if (send_info.dscp) {
+      last_cm = append_dscp_cmsg(msg, last_cm, send_info.target_address, send_info.dscp);
+      cmbuflen += CMSG_SPACE(sizeof(int));
+    }
+
+    if (send_info.launch_time.time_since_epoch().count()) {
+      last_cm = append_txtime_cmsg(msg, last_cm, send_info.launch_time);
+      cmbuflen += CMSG_SPACE(sizeof(std::uint64_t));
+    }
+
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
 #ifdef UDP_SEGMENT
@@ -424,52 +795,88 @@ namespace platf {
       // UDP GSO on Linux currently only supports sending 64K or 64 segments at a time
       size_t seg_index = 0;
       const size_t seg_max = 65536 / 1500;
-      struct iovec iovs[(send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg];
+      const size_t iovs_per_msg = (send_info.headers ? std::min(seg_max, send_info.block_count) : 1) * max_iovs_per_msg;
+      struct iovec iovs[iovs_per_msg];
       auto msg_size = send_info.header_size + send_info.payload_size;
-      while (seg_index < send_info.block_count) {
+
+      // Describe the segments [first_seg, first_seg + seg_count) of the batch, returns the number of iovs
+      auto fill_iovs = [&](size_t first_seg, size_t seg_count, struct iovec *out) {
         int iovlen = 0;
-        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
         if (send_info.headers) {
           // Interleave iovs for headers and payloads
-          for (auto i = 0; i < segs_in_batch; i++) {
-            iovs[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + seg_index + i) * send_info.header_size];
-            iovs[iovlen].iov_len = send_info.header_size;
+          for (auto i = 0; i < seg_count; i++) {
+            out[iovlen].iov_base = (void *) &send_info.headers[(send_info.block_offset + first_seg + i) * send_info.header_size];
+            out[iovlen].iov_len = send_info.header_size;
             iovlen++;
-            auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + seg_index + i) * send_info.payload_size);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = send_info.payload_size;
+            auto payload_desc = send_info.buffer_for_payload_offset((send_info.block_offset + first_seg + i) * send_info.payload_size);
+            out[iovlen].iov_base = (void *) payload_desc.buffer;
+            out[iovlen].iov_len = send_info.payload_size;
             iovlen++;
           }
         } else {
           // Translate buffer descriptors into iovs
-          auto payload_offset = (send_info.block_offset + seg_index) * send_info.payload_size;
-          auto payload_length = payload_offset + (segs_in_batch * send_info.payload_size);
+          auto payload_offset = (send_info.block_offset + first_seg) * send_info.payload_size;
+          auto payload_length = payload_offset + (seg_count * send_info.payload_size);
           while (payload_offset < payload_length) {
             auto payload_desc = send_info.buffer_for_payload_offset(payload_offset);
-            iovs[iovlen].iov_base = (void *) payload_desc.buffer;
-            iovs[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
-            payload_offset += iovs[iovlen].iov_len;
+            out[iovlen].iov_base = (void *) payload_desc.buffer;
+            out[iovlen].iov_len = std::min(payload_desc.size, payload_length - payload_offset);
+            payload_offset += out[iovlen].iov_len;
             iovlen++;
           }
         }
 
-        msg.msg_iov = iovs;
-        msg.msg_iovlen = iovlen;
+        return iovlen;
+      };
 
+      // Get the control buffer length for sending the given number of segments in one message
+      auto controllen_for = [&](size_t seg_count) {
         // We should not use GSO if the data is <= one full block size
-        if (segs_in_batch > 1) {
-          msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
-
-          // Enable GSO to perform segmentation of our buffer for us
-          auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
-          cm->cmsg_level = SOL_UDP;
-          cm->cmsg_type = UDP_SEGMENT;
-          cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
-          *((uint16_t *) CMSG_DATA(cm)) = msg_size;
-        } else {
-          msg.msg_controllen = cmbuflen;
+        if (seg_count <= 1) {
+          return (size_t) cmbuflen;
+        }
+
+        // Enable GSO to perform segmentation of our buffer for us
+        auto cm = CMSG_NXTHDR(&msg, last_cm);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *((uint16_t *) CMSG_DATA(cm)) = msg_size;
+
+        return (size_t) cmbuflen + CMSG_SPACE(sizeof(uint16_t));
+      };
+
+  #ifdef SUNSHINE_BUILD_IO_URING
+      if (config::stream.io_uring_send) {
+        // Submit all of the batch at once, whatever isn't sent is retried with sendmsg() below
+        auto msg_count = (send_info.block_count + seg_max - 1) / seg_max;
+        struct msghdr msgs[msg_count];
+        struct iovec uring_iovs[msg_count * iovs_per_msg];
+        for (size_t i = 0; i < msg_count; i++) {
+          auto segs_in_msg = std::min(send_info.block_count - i * seg_max, seg_max);
+
+          msgs[i] = msg;
+          msgs[i].msg_iov = &uring_iovs[i * iovs_per_msg];
+          msgs[i].msg_iovlen = fill_iovs(i * seg_max, segs_in_msg, msgs[i].msg_iov);
+
+          // All of them share the control buffer, the GSO segment size is the same for all
+          msgs[i].msg_controllen = controllen_for(segs_in_msg);
         }
 
+        auto msgs_sent = uring::send(sockfd, msgs, (int) msg_count);
+        if (msgs_sent > 0) {
+          seg_index = std::min(msgs_sent * seg_max, send_info.block_count);
+        }
+      }
+  #endif
+
+      while (seg_index < send_info.block_count) {
+        auto segs_in_batch = std::min(send_info.block_count - seg_index, seg_max);
+
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = fill_iovs(seg_index, segs_in_batch, iovs);
+        msg.msg_controllen = controllen_for(segs_in_batch);
+
         // This will fail if GSO is not available, so we will fall back to non-GSO if
         // it's the first sendmsg() call. On subsequent calls, we will treat errors as
         // actual failures and return to the caller.
@@ -564,29 +971,139 @@ namespace platf {
     }
   }
 
+  int recv_batch(std::uintptr_t native_socket, recv_datagram_t *datagrams, size_t count, size_t buffer_size) {
+    struct mmsghdr msgs[count];
+    struct iovec iovs[count];
+    memset(msgs, 0, sizeof(msgs));
+
+    for (size_t i = 0; i < count; i++) {
+      iovs[i].iov_base = datagrams[i].buffer;
+      iovs[i].iov_len = buffer_size;
+
+      msgs[i].msg_hdr.msg_name = datagrams[i].address.data();
+      msgs[i].msg_hdr.msg_namelen = datagrams[i].address.size();
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto received = recvmmsg((int) native_socket, msgs, count, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+      // ICMP errors from earlier sends are reported here as well
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+        BOOST_LOG(warning) << "recvmmsg() failed: "sv << errno;
+      }
+
+      return 0;
+    }
+
+    for (int i = 0; i < received; i++) {
+      datagrams[i].size = msgs[i].msg_len;
+      datagrams[i].address_size = msgs[i].msg_hdr.msg_namelen;
+    }
+
+    return received;
+  }
+
+  bool enable_tx_timestamps(std::uintptr_t native_socket) {
+    // Timestamps are only generated for packets that ask for them, and are numbered
+    // by the kernel so they can be told apart without the original packet
+    std::uint32_t flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+      BOOST_LOG(warning) << "Transmit timestamps are not supported: "sv << errno;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool enable_tx_launch_time(std::uintptr_t native_socket) {
+#ifdef SO_TXTIME
+    // fq only accepts launch times from CLOCK_MONOTONIC, the clock of std::chrono::steady_clock
+    struct sock_txtime txtime {};
+    txtime.clockid = CLOCK_MONOTONIC;
+    if (setsockopt((int) native_socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+      BOOST_LOG(warning) << "Launch times are not supported: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void read_tx_timestamps(std::uintptr_t native_socket, const std::function<void(std::uint32_t, std::chrono::steady_clock::time_point)> &callback) {
+    while (true) {
+      union {
+        char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct cmsghdr alignment;
+      } cmbuf;
+
+      struct msghdr msg = {};
+      msg.msg_control = cmbuf.buf;
+      msg.msg_controllen = sizeof(cmbuf.buf);
+
+      if (recvmsg((int) native_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          BOOST_LOG(warning) << "recvmsg(MSG_ERRQUEUE) failed: "sv << errno;
+        }
+
+        return;
+      }
+
+      std::optional<std::uint32_t> id;
+      std::optional<struct timespec> sent;
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMPING) {
+          // The software timestamp comes first
+          sent = ((struct scm_timestamping *) CMSG_DATA(cm))->ts[0];
+        } else if ((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) ||
+                   (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+          auto err = (struct sock_extended_err *) CMSG_DATA(cm);
+          if (err->ee_errno == ENOMSG && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+            id = err->ee_data;
+          }
+        }
+      }
+
+      if (!id || !sent) {
+        continue;
+      }
+
+      // Software timestamps use the realtime clock
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      auto age = std::chrono::seconds {now.tv_sec - sent->tv_sec} + std::chrono::nanoseconds {now.tv_nsec - sent->tv_nsec};
+
+      callback(*id, std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age));
+    }
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
 
-    // Convert the target address into a sockaddr
+    // Convert the target address into a sockaddr, connected sockets already know it
     struct sockaddr_in taddr_v4 = {};
     struct sockaddr_in6 taddr_v6 = {};
-    if (send_info.target_address.is_v6()) {
-      taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+    if (!send_info.connected) {
+      if (send_info.target_address.is_v6()) {
+        taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v6;
-      msg.msg_namelen = sizeof(taddr_v6);
-    } else {
-      taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+        msg.msg_name = (struct sockaddr *) &taddr_v6;
+        msg.msg_namelen = sizeof(taddr_v6);
+      } else {
+        taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v4;
-      msg.msg_namelen = sizeof(taddr_v4);
+        msg.msg_name = (struct sockaddr *) &taddr_v4;
+        msg.msg_namelen = sizeof(taddr_v4);
+      }
     }
 
     union {
-      char buf[std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(std::uint32_t)) + CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(std::uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
-    } cmbuf;
+    } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
     socklen_t cmbuflen = 0;
 
@@ -636,6 +1153,28 @@ namespace platf {
     msg.msg_iov = iovs;
     msg.msg_iovlen = iovlen;
 
+    auto last_cm = pktinfo_cm;
+    if (send_info.dscp) {
+      last_cm = append_dscp_cmsg(msg, last_cm, send_info.target_address, send_info.dscp);
+      cmbuflen += CMSG_SPACE(sizeof(int));
+    }
+
+    if (send_info.launch_time.time_since_epoch().count()) {
+      last_cm = append_txtime_cmsg(msg, last_cm, send_info.launch_time);
+      cmbuflen += CMSG_SPACE(sizeof(std::uint64_t));
+    }
+
+    if (send_info.tx_timestamp) {
+      // Have the kernel report when this packet is handed to the network device
+      auto cm = CMSG_NXTHDR(&msg, last_cm);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SO_TIMESTAMPING;
+      cm->cmsg_len = CMSG_LEN(sizeof(std::uint32_t));
+      *((std::uint32_t *) CMSG_DATA(cm)) = SOF_TIMESTAMPING_TX_SOFTWARE;
+
+      cmbuflen += CMSG_SPACE(sizeof(std::uint32_t));
+    }
+
     msg.msg_controllen = cmbuflen;
 
     auto bytes_sent = sendmsg(sockfd, &msg, 0);
@@ -784,6 +1323,9 @@ namespace platf {
 #ifdef SUNSHINE_BUILD_DRM
       KMS,  ///< KMS
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+      PORTAL,  ///< ScreenCast portal
+#endif
 #ifdef SUNSHINE_BUILD_X11
       X11,  ///< X11
 #endif
@@ -820,6 +1362,15 @@ namespace platf {
   }
 #endif
 
+#ifdef SUNSHINE_BUILD_PORTAL
+  std::vector<std::string> portal_display_names();
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
+
+  bool verify_portal() {
+    return window_system == window_system_e::WAYLAND && !portal_display_names().empty();
+  }
+#endif
+
 #ifdef SUNSHINE_BUILD_X11
   std::vector<std::string> x11_display_names();
   std::shared_ptr<display_t> x11_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
@@ -846,6 +1397,11 @@ namespace platf {
       return kms_display_names(hwdevice_type);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      return portal_display_names();
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       return x11_display_names();
@@ -863,6 +1419,47 @@ namespace platf {
     return true;
   }
 
+  std::string gpu_fingerprint() {
+    auto read_line = [](const fs::path &path) {
+      std::string line;
+      std::ifstream file {path};
+      std::getline(file, line);
+      return line;
+    };
+
+    std::error_code ec;
+    std::vector<fs::path> entries;
+    for (auto &entry : fs::directory_iterator {"/sys/class/drm", ec}) {
+      if (entry.path().filename().string().starts_with("card")) {
+        entries.push_back(entry.path());
+      }
+    }
+    std::sort(std::begin(entries), std::end(entries));
+
+    // In-tree drivers are versioned with the kernel
+    struct utsname kernel;
+    uname(&kernel);
+
+    std::stringstream fingerprint;
+    fingerprint << "kernel "sv << kernel.release << std::endl;
+
+    for (auto &entry : entries) {
+      auto name = entry.filename().string();
+
+      // Connectors are named after their card, e.g. card0-DP-1
+      if (name.find('-') != std::string::npos) {
+        fingerprint << "  "sv << name << ' ' << read_line(entry / "status") << std::endl;
+        continue;
+      }
+
+      auto driver = fs::read_symlink(entry / "device" / "driver", ec).filename().string();
+      fingerprint << name << ' ' << read_line(entry / "device" / "vendor") << ':' << read_line(entry / "device" / "device")
+                  << ' ' << driver << ' ' << read_line(fs::path {"/sys/module"} / driver / "version") << std::endl;
+    }
+
+    return fingerprint.str();
+  }
+
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -882,6 +1479,12 @@ namespace platf {
       return kms_display(hwdevice_type, display_name, config);
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if (sources[source::PORTAL]) {
+      BOOST_LOG(info) << "Screencasting with the ScreenCast portal"sv;
+      return portal_display(hwdevice_type, display_name, config);
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     if (sources[source::X11]) {
       BOOST_LOG(info) << "Screencasting with X11"sv;
@@ -897,9 +1500,6 @@ namespace platf {
     // https://gitlab.freedesktop.org/mesa/mesa/-/merge_requests/30039
     set_env("AMD_DEBUG", "lowlatencyenc");
 
-    // These are allowed to fail.
-    gbm::init();
-
     window_system = window_system_e::NONE;
 #ifdef SUNSHINE_BUILD_WAYLAND
     if (std::getenv("WAYLAND_DISPLAY")) {
@@ -937,11 +1537,19 @@ namespace platf {
       }
     }
 #endif
+#ifdef SUNSHINE_BUILD_PORTAL
+    if ((config::video.capture.empty() && sources.none()) || config::video.capture == "portal") {
+      if (verify_portal()) {
+        sources[source::PORTAL] = true;
+      }
+    }
+#endif
 #ifdef SUNSHINE_BUILD_X11
     // We enumerate this capture backend regardless of other suitable sources,
     // since it may be needed as a NvFBC fallback for software encoding on X11.
+    // As a fallback, its libraries aren't loaded until it's actually used.
     if (config::video.capture.empty() || config::video.capture == "x11") {
-      if (verify_x11()) {
+      if (sources.any() ? window_system == window_system_e::X11 : verify_x11()) {
         sources[source::X11] = true;
       }
     }
@@ -952,10 +1560,6 @@ namespace platf {
       return nullptr;
     }
 
-    if (!gladLoaderLoadEGL(EGL_NO_DISPLAY) || !eglGetPlatformDisplay) {
-      BOOST_LOG(warning) << "Couldn't load EGL library"sv;
-    }
-
     return std::make_unique<deinit_t>();
   }
 
@@ -0,0 +1,1315 @@
+/**
+ * @file src/platform/linux/portalgrab.cpp
+ * @brief Definitions for capture through the ScreenCast portal and PipeWire.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// lib includes
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <pipewire/pipewire.h>
+#include <spa/param/format-utils.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+
+// local includes
+#include "cuda.h"
+#include "graphics.h"
+#include "src/file_handler.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/utility.h"
+#include "src/video.h"
+#include "vaapi.h"
+#include "wayland.h"
+
+using namespace std::literals;
+
+namespace portal {
+  constexpr auto DESKTOP_BUS_NAME = "org.freedesktop.portal.Desktop";
+  constexpr auto DESKTOP_OBJECT_PATH = "/org/freedesktop/portal/desktop";
+  constexpr auto SCREENCAST_INTERFACE = "org.freedesktop.portal.ScreenCast";
+  constexpr auto REQUEST_INTERFACE = "org.freedesktop.portal.Request";
+  constexpr auto SESSION_INTERFACE = "org.freedesktop.portal.Session";
+
+  // Values of the options of the ScreenCast portal
+  constexpr std::uint32_t SOURCE_TYPE_MONITOR = 1;
+  constexpr std::uint32_t CURSOR_MODE_EMBEDDED = 2;
+  constexpr std::uint32_t CURSOR_MODE_METADATA = 4;
+  constexpr std::uint32_t PERSIST_MODE_UNTIL_REVOKED = 2;
+
+  // The user may take a while to pick the monitor in the dialog of the compositor
+  constexpr auto REQUEST_TIMEOUT_SECONDS = 120;
+
+  // The largest cursor the compositor may attach to the buffers
+  constexpr int MAX_CURSOR_SIZE = 256;
+
+  constexpr std::uint32_t fourcc_code(char a, char b, char c, char d) {
+    return (std::uint32_t) a | ((std::uint32_t) b << 8) | ((std::uint32_t) c << 16) | ((std::uint32_t) d << 24);
+  }
+
+  constexpr std::uint64_t DRM_FORMAT_MOD_INVALID = (1ULL << 56) - 1;
+
+  /**
+   * @brief The 8-bit formats the conversion shaders sample from, and their DRM fourcc.
+   */
+  constexpr std::pair<spa_video_format, std::uint32_t> formats[] {
+    {SPA_VIDEO_FORMAT_BGRx, fourcc_code('X', 'R', '2', '4')},
+    {SPA_VIDEO_FORMAT_BGRA, fourcc_code('A', 'R', '2', '4')},
+    {SPA_VIDEO_FORMAT_RGBx, fourcc_code('X', 'B', '2', '4')},
+    {SPA_VIDEO_FORMAT_RGBA, fourcc_code('A', 'B', '2', '4')},
+  };
+
+  struct img_t: public platf::img_t {
+    ~img_t() override {
+      free_frame_data(data, height * row_pitch);
+      data = nullptr;
+    }
+  };
+
+  template<class T>
+  void object_unref(T *object) {
+    g_object_unref(object);
+  }
+
+  using variant_t = util::safe_ptr<GVariant, g_variant_unref>;
+  using error_t = util::safe_ptr<GError, g_error_free>;
+  using connection_t = util::safe_ptr<GDBusConnection, object_unref<GDBusConnection>>;
+  using fd_list_t = util::safe_ptr<GUnixFDList, object_unref<GUnixFDList>>;
+  using main_context_t = util::safe_ptr<GMainContext, g_main_context_unref>;
+  using source_t = util::safe_ptr<GSource, g_source_unref>;
+
+  /**
+   * @brief Get the path of the file keeping the token that restores the last session without asking the user.
+   */
+  static std::string restore_token_path() {
+    return (platf::appdata() / "portal_restore_token").string();
+  }
+
+  /**
+   * @brief Check whether the desktop provides the ScreenCast portal.
+   */
+  static bool available() {
+    GError *err_p = nullptr;
+    connection_t connection {g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &err_p)};
+    error_t err {err_p};
+    if (!connection) {
+      return false;
+    }
+
+    variant_t reply {g_dbus_connection_call_sync(connection.get(), DESKTOP_BUS_NAME, DESKTOP_OBJECT_PATH, "org.freedesktop.DBus.Properties", "Get", g_variant_new("(ss)", SCREENCAST_INTERFACE, "version"), G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr)};
+
+    return (bool) reply;
+  }
+
+  /**
+   * @brief A session of the ScreenCast portal, sharing a monitor the user picked through PipeWire.
+   */
+  class session_t {
+  public:
+    ~session_t() {
+      if (connection && !session_handle.empty()) {
+        variant_t reply {g_dbus_connection_call_sync(connection.get(), DESKTOP_BUS_NAME, session_handle.c_str(), SESSION_INTERFACE, "Close", nullptr, nullptr, G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr)};
+      }
+    }
+
+    int init() {
+      // Each restore token is used once, so sessions are started one after the other
+      static std::mutex start_mutex;
+      std::lock_guard lg {start_mutex};
+
+      GError *err_p = nullptr;
+      connection.reset(g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &err_p));
+      if (!connection) {
+        error_t err {err_p};
+        BOOST_LOG(error) << "Couldn't connect to the session bus: "sv << err->message;
+        return -1;
+      }
+
+      // The responses of the portal are dispatched to this context while waiting for them
+      context.reset(g_main_context_new());
+      g_main_context_push_thread_default(context.get());
+      auto pop_context = util::fail_guard([this]() {
+        g_main_context_pop_thread_default(context.get());
+      });
+
+      auto version = property_uint32("version");
+      auto cursor_modes = property_uint32("AvailableCursorModes");
+      if (!version) {
+        BOOST_LOG(error) << "The desktop doesn't provide the ScreenCast portal"sv;
+        return -1;
+      }
+
+      // The cursor is blended by the encoder when its image comes with the frames
+      cursor_metadata = cursor_modes && (*cursor_modes & CURSOR_MODE_METADATA);
+
+      auto token = next_token();
+      auto results = request("CreateSession", g_variant_new_parsed("({'handle_token': <%s>, 'session_handle_token': <%s>},)", token.c_str(), token.c_str()), token);
+      const char *handle;
+      if (!results || !g_variant_lookup(results.get(), "session_handle", "&s", &handle)) {
+        BOOST_LOG(error) << "Couldn't create a ScreenCast session"sv;
+        return -1;
+      }
+      session_handle = handle;
+
+      GVariantBuilder options;
+      g_variant_builder_init(&options, G_VARIANT_TYPE_VARDICT);
+      token = next_token();
+      g_variant_builder_add(&options, "{sv}", "handle_token", g_variant_new_string(token.c_str()));
+      g_variant_builder_add(&options, "{sv}", "types", g_variant_new_uint32(SOURCE_TYPE_MONITOR));
+      g_variant_builder_add(&options, "{sv}", "multiple", g_variant_new_boolean(false));
+      g_variant_builder_add(&options, "{sv}", "cursor_mode", g_variant_new_uint32(cursor_metadata ? CURSOR_MODE_METADATA : CURSOR_MODE_EMBEDDED));
+
+      // Sessions are restored without asking the user again since version 4
+      auto restore_token = file_handler::read_file(restore_token_path().c_str());
+      if (*version >= 4) {
+        g_variant_builder_add(&options, "{sv}", "persist_mode", g_variant_new_uint32(PERSIST_MODE_UNTIL_REVOKED));
+        if (!restore_token.empty()) {
+          g_variant_builder_add(&options, "{sv}", "restore_token", g_variant_new_string(restore_token.c_str()));
+        }
+      }
+
+      if (!request("SelectSources", g_variant_new("(oa{sv})", session_handle.c_str(), &options), token)) {
+        BOOST_LOG(error) << "Couldn't select the monitor of the ScreenCast session"sv;
+        return -1;
+      }
+
+      token = next_token();
+      results = request("Start", g_variant_new_parsed("(%o, '', {'handle_token': <%s>})", session_handle.c_str(), token.c_str()), token);
+      if (!results) {
+        BOOST_LOG(error) << "Couldn't start the ScreenCast session"sv;
+        return -1;
+      }
+
+      const char *new_restore_token;
+      if (g_variant_lookup(results.get(), "restore_token", "&s", &new_restore_token) && new_restore_token != restore_token) {
+        if (file_handler::write_file_atomic(restore_token_path().c_str(), new_restore_token)) {
+          BOOST_LOG(warning) << "Couldn't save the restore token of the ScreenCast session"sv;
+        }
+      }
+
+      variant_t streams {g_variant_lookup_value(results.get(), "streams", G_VARIANT_TYPE("a(ua{sv})"))};
+      if (!streams || !g_variant_n_children(streams.get())) {
+        BOOST_LOG(error) << "The ScreenCast session has no stream"sv;
+        return -1;
+      }
+
+      GVariant *stream_properties;
+      g_variant_get_child(streams.get(), 0, "(u@a{sv})", &node_id, &stream_properties);
+      variant_t stream_properties_ptr {stream_properties};
+
+      GUnixFDList *fds_p = nullptr;
+      variant_t reply {g_dbus_connection_call_with_unix_fd_list_sync(connection.get(), DESKTOP_BUS_NAME, DESKTOP_OBJECT_PATH, SCREENCAST_INTERFACE, "OpenPipeWireRemote", g_variant_new_parsed("(%o, @a{sv} {})", session_handle.c_str()), G_VARIANT_TYPE("(h)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &fds_p, nullptr, &err_p)};
+      fd_list_t fds {fds_p};
+      if (!reply) {
+        error_t err {err_p};
+        BOOST_LOG(error) << "Couldn't open the PipeWire remote of the ScreenCast session: "sv << err->message;
+        return -1;
+      }
+
+      gint32 fd_index;
+      g_variant_get(reply.get(), "(h)", &fd_index);
+      pipewire_fd = g_unix_fd_list_get(fds.get(), fd_index, &err_p);
+      if (pipewire_fd < 0) {
+        error_t err {err_p};
+        BOOST_LOG(error) << "Couldn't get the PipeWire remote of the ScreenCast session: "sv << err->message;
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Started ScreenCast session ["sv << session_handle << "] on PipeWire node ["sv << node_id << ']';
+
+      return 0;
+    }
+
+    // The PipeWire node of the stream, and the connection to the PipeWire instance it's on
+    std::uint32_t node_id;
+    int pipewire_fd = -1;
+
+    // The frames come with the image and the position of the cursor, rather than with the cursor in them
+    bool cursor_metadata;
+
+  private:
+    static std::string next_token() {
+      static std::atomic<std::uint32_t> next;
+      return "sunshine"s + std::to_string(next++);
+    }
+
+    std::optional<std::uint32_t> property_uint32(const char *name) {
+      variant_t reply {g_dbus_connection_call_sync(connection.get(), DESKTOP_BUS_NAME, DESKTOP_OBJECT_PATH, "org.freedesktop.DBus.Properties", "Get", g_variant_new("(ss)", SCREENCAST_INTERFACE, name), G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr)};
+      if (!reply) {
+        return std::nullopt;
+      }
+
+      GVariant *value;
+      g_variant_get(reply.get(), "(v)", &value);
+      variant_t value_ptr {value};
+
+      if (!g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) {
+        return std::nullopt;
+      }
+
+      return g_variant_get_uint32(value);
+    }
+
+    /**
+     * @brief Call a method of the ScreenCast portal and wait for its response.
+     * @param method The method.
+     * @param parameters The parameters, with the options including `token` as their `handle_token`.
+     * @param token The token of the request.
+     * @return The results of the request, or `nullptr` if it failed or was cancelled.
+     */
+    variant_t request(const char *method, GVariant *parameters, const std::string &token) {
+      // The portal answers on a request object named after the unique name of the connection and the token
+      std::string sender {g_dbus_connection_get_unique_name(connection.get()) + 1};
+      std::replace(std::begin(sender), std::end(sender), '.', '_');
+      auto request_path = "/org/freedesktop/portal/desktop/request/"s + sender + '/' + token;
+
+      struct response_t {
+        bool done;
+        std::uint32_t code;
+        variant_t results;
+      } response {};
+
+      auto on_response = [](GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *, GVariant *parameters, gpointer user_data) {
+        auto response = (response_t *) user_data;
+
+        GVariant *results;
+        g_variant_get(parameters, "(u@a{sv})", &response->code, &results);
+        response->results.reset(results);
+        response->done = true;
+      };
+
+      // Subscribe before calling, the response may come before the reply
+      auto subscription = g_dbus_connection_signal_subscribe(connection.get(), DESKTOP_BUS_NAME, REQUEST_INTERFACE, "Response", request_path.c_str(), nullptr, G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE, on_response, &response, nullptr);
+      auto unsubscribe = util::fail_guard([&]() {
+        g_dbus_connection_signal_unsubscribe(connection.get(), subscription);
+      });
+
+      GError *err_p = nullptr;
+      variant_t reply {g_dbus_connection_call_sync(connection.get(), DESKTOP_BUS_NAME, DESKTOP_OBJECT_PATH, SCREENCAST_INTERFACE, method, parameters, G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, nullptr, &err_p)};
+      if (!reply) {
+        error_t err {err_p};
+        BOOST_LOG(error) << "ScreenCast."sv << method << ": "sv << err->message;
+        return nullptr;
+      }
+
+      bool timed_out = false;
+      source_t timeout {g_timeout_source_new_seconds(REQUEST_TIMEOUT_SECONDS)};
+      g_source_set_callback(
+        timeout.get(),
+        [](gpointer user_data) -> gboolean {
+          *(bool *) user_data = true;
+          return G_SOURCE_REMOVE;
+        },
+        &timed_out,
+        nullptr
+      );
+      g_source_attach(timeout.get(), context.get());
+
+      while (!response.done && !timed_out) {
+        g_main_context_iteration(context.get(), true);
+      }
+      g_source_destroy(timeout.get());
+
+      if (!response.done) {
+        BOOST_LOG(error) << "ScreenCast."sv << method << ": no response"sv;
+        return nullptr;
+      }
+
+      // 1 when the user cancelled the dialog
+      if (response.code) {
+        BOOST_LOG(error) << "ScreenCast."sv << method << ": request ended with ["sv << response.code << ']';
+        return nullptr;
+      }
+
+      return std::move(response.results);
+    }
+
+    connection_t connection;
+    main_context_t context;
+    std::string session_handle;
+  };
+
+  /**
+   * @brief The cursor of the stream, when the compositor sends it along with the frames.
+   */
+  struct cursor_t {
+    bool visible;
+
+    // The top left corner of the image
+    int x, y;
+    int hot_x, hot_y;
+
+    int width, height;
+    std::vector<std::uint8_t> pixels;
+
+    // Changes along with the image
+    unsigned long serial;
+  };
+
+  /**
+   * @brief The video stream of a ScreenCast session.
+   * @details PipeWire hands the buffers over on a thread of its own. The last frame is kept, with duplicates of the
+   *          file descriptors of its DMA-BUFs, until the capture thread takes it.
+   */
+  class stream_t {
+  public:
+    ~stream_t() {
+      if (loop) {
+        pw_thread_loop_stop(loop);
+      }
+      if (stream) {
+        pw_stream_destroy(stream);
+      }
+      if (core) {
+        pw_core_disconnect(core);
+      }
+      if (context) {
+        pw_context_destroy(context);
+      }
+      if (loop) {
+        pw_thread_loop_destroy(loop);
+      }
+
+      close_frame();
+    }
+
+    /**
+     * @brief Connect to the stream.
+     * @param fd The connection to PipeWire, owned by the stream from now on.
+     * @param node_id The node of the stream.
+     * @param framerate The highest framerate to receive frames at.
+     * @param dmabuf_formats The formats and their modifiers the DMA-BUFs can be imported with.
+     * @return 0 on success, -1 on failure.
+     */
+    int init(int fd, std::uint32_t node_id, int framerate, std::vector<std::pair<spa_video_format, std::vector<std::uint64_t>>> &&dmabuf_formats) {
+      static std::once_flag pw_init_once;
+      std::call_once(pw_init_once, []() {
+        pw_init(nullptr, nullptr);
+      });
+
+      this->framerate = framerate;
+      this->dmabuf_formats = std::move(dmabuf_formats);
+
+      loop = pw_thread_loop_new("portal capture", nullptr);
+      if (!loop) {
+        close(fd);
+        return -1;
+      }
+
+      context = pw_context_new(pw_thread_loop_get_loop(loop), nullptr, 0);
+      if (!context) {
+        close(fd);
+        return -1;
+      }
+
+      if (pw_thread_loop_start(loop)) {
+        close(fd);
+        return -1;
+      }
+
+      pw_thread_loop_lock(loop);
+      auto unlock = util::fail_guard([this]() {
+        pw_thread_loop_unlock(loop);
+      });
+
+      core = pw_context_connect_fd(context, fd, nullptr, 0);
+      if (!core) {
+        BOOST_LOG(error) << "Couldn't connect to PipeWire: "sv << strerror(errno);
+        return -1;
+      }
+
+      stream = pw_stream_new(core, "Sunshine", pw_properties_new(PW_KEY_MEDIA_TYPE, "Video", PW_KEY_MEDIA_CATEGORY, "Capture", PW_KEY_MEDIA_ROLE, "Screen", nullptr));
+      if (!stream) {
+        BOOST_LOG(error) << "Couldn't create PipeWire stream: "sv << strerror(errno);
+        return -1;
+      }
+
+      static const pw_stream_events events {
+        .version = PW_VERSION_STREAM_EVENTS,
+        .state_changed = on_state_changed,
+        .param_changed = on_param_changed,
+        .process = on_process,
+      };
+      pw_stream_add_listener(stream, &listener, &events, this);
+
+      std::vector<const spa_pod *> params;
+      spa_pod_builder builder;
+      spa_pod_builder_init(&builder, params_buffer, sizeof(params_buffer));
+      for (auto &[format, modifiers] : this->dmabuf_formats) {
+        params.emplace_back(build_format(&builder, format, modifiers, framerate));
+      }
+
+      if (params.empty()) {
+        BOOST_LOG(error) << "No DMA-BUF format to capture the ScreenCast session with"sv;
+        return -1;
+      }
+
+      if (pw_stream_connect(stream, PW_DIRECTION_INPUT, node_id, PW_STREAM_FLAG_AUTOCONNECT, params.data(), params.size()) < 0) {
+        BOOST_LOG(error) << "Couldn't connect to PipeWire node ["sv << node_id << ']';
+        return -1;
+      }
+
+      return 0;
+    }
+
+    /**
+     * @brief Wait until the format of the stream is negotiated.
+     * @return The size of the frames, or `std::nullopt` if the stream failed or timed out.
+     */
+    std::optional<std::pair<int, int>> wait_for_format(std::chrono::milliseconds timeout) {
+      std::unique_lock ul {mutex};
+      if (!cv.wait_for(ul, timeout, [this]() {
+            return failed || negotiated;
+          }) ||
+          failed) {
+        return std::nullopt;
+      }
+
+      return std::make_pair((int) format.size.width, (int) format.size.height);
+    }
+
+    void close_frame() {
+      for (auto &fd : frame.fds) {
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // Guarded by the mutex
+    bool negotiated {};
+    bool failed {};
+    spa_video_info_raw format {};
+
+    // The last frame, with file descriptors owned by the stream
+    egl::surface_descriptor_t frame {0, 0, {-1, -1, -1, -1}};
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+    // Counts the frames, and the changes of the cursor
+    std::uint64_t frame_serial {};
+    std::uint64_t update_serial {};
+
+    // The regions that changed since the capture thread took the frame, or std::nullopt if unknown
+    std::optional<std::vector<platf::damage_rect_t>> damage;
+
+    cursor_t cursor {};
+
+  private:
+    static spa_pod *build_format(spa_pod_builder *builder, spa_video_format format, const std::vector<std::uint64_t> &modifiers, int framerate = 0) {
+      spa_rectangle size_default {1920, 1080};
+      spa_rectangle size_min {1, 1};
+      spa_rectangle size_max {16384, 16384};
+      spa_fraction variable_rate {0, 1};
+      spa_fraction rate_default {(std::uint32_t) framerate, 1};
+      spa_fraction rate_min {0, 1};
+      spa_fraction rate_max {(std::uint32_t) std::max(framerate, 1000), 1};
+
+      spa_pod_frame frames[2];
+      spa_pod_builder_push_object(builder, &frames[0], SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat);
+      spa_pod_builder_add(
+        builder,
+        SPA_FORMAT_mediaType,
+        SPA_POD_Id(SPA_MEDIA_TYPE_video),
+        SPA_FORMAT_mediaSubtype,
+        SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+        SPA_FORMAT_VIDEO_format,
+        SPA_POD_Id(format),
+        SPA_FORMAT_VIDEO_size,
+        SPA_POD_CHOICE_RANGE_Rectangle(&size_default, &size_min, &size_max),
+        // The compositor sends a frame when the monitor is damaged, up to the highest framerate
+        SPA_FORMAT_VIDEO_framerate,
+        SPA_POD_Fraction(&variable_rate),
+        SPA_FORMAT_VIDEO_maxFramerate,
+        SPA_POD_CHOICE_RANGE_Fraction(&rate_default, &rate_min, &rate_max),
+        0
+      );
+
+      // A single modifier fixates the format, several of them let the compositor pick
+      spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY | (modifiers.size() > 1 ? SPA_POD_PROP_FLAG_DONT_FIXATE : 0));
+      if (modifiers.size() > 1) {
+        spa_pod_builder_push_choice(builder, &frames[1], SPA_CHOICE_Enum, 0);
+
+        // The first value is the default
+        spa_pod_builder_long(builder, modifiers[0]);
+        for (auto modifier : modifiers) {
+          spa_pod_builder_long(builder, modifier);
+        }
+
+        spa_pod_builder_pop(builder, &frames[1]);
+      } else {
+        spa_pod_builder_long(builder, modifiers[0]);
+      }
+
+      return (spa_pod *) spa_pod_builder_pop(builder, &frames[0]);
+    }
+
+    static void on_state_changed(void *data, pw_stream_state old, pw_stream_state state, const char *error) {
+      auto self = (stream_t *) data;
+
+      BOOST_LOG(debug) << "PipeWire stream: "sv << pw_stream_state_as_string(old) << " -> "sv << pw_stream_state_as_string(state);
+
+      if (state == PW_STREAM_STATE_ERROR || state == PW_STREAM_STATE_UNCONNECTED) {
+        if (error) {
+          BOOST_LOG(error) << "PipeWire stream: "sv << error;
+        }
+
+        std::lock_guard lg {self->mutex};
+        self->failed = true;
+        self->cv.notify_all();
+      }
+    }
+
+    static void on_param_changed(void *data, std::uint32_t id, const spa_pod *param) {
+      auto self = (stream_t *) data;
+
+      if (!param || id != SPA_PARAM_Format) {
+        return;
+      }
+
+      std::uint32_t media_type, media_subtype;
+      if (spa_format_parse(param, &media_type, &media_subtype) < 0 || media_type != SPA_MEDIA_TYPE_video || media_subtype != SPA_MEDIA_SUBTYPE_raw) {
+        return;
+      }
+
+      spa_video_info_raw format {};
+      if (spa_format_video_raw_parse(param, &format) < 0) {
+        return;
+      }
+
+      spa_pod_builder builder;
+      spa_pod_builder_init(&builder, self->params_buffer, sizeof(self->params_buffer));
+
+      // When the compositor left the choice of the modifier, pick its preferred one and fixate the format with it
+      auto modifier_prop = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier);
+      if (modifier_prop && (modifier_prop->flags & SPA_POD_PROP_FLAG_DONT_FIXATE)) {
+        std::uint32_t count, choice;
+        auto values = spa_pod_get_values(&modifier_prop->value, &count, &choice);
+        if (count && SPA_POD_TYPE(values) == SPA_TYPE_Long) {
+          auto modifier = ((const std::uint64_t *) SPA_POD_BODY(values))[0];
+
+          BOOST_LOG(debug) << "Fixating PipeWire stream with modifier ["sv << util::hex(modifier).to_string_view() << ']';
+
+          const spa_pod *params[] {build_format(&builder, (spa_video_format) format.format, {modifier}, self->framerate)};
+          pw_stream_update_params(self->stream, params, 1);
+          return;
+        }
+      }
+
+      if (!modifier_prop) {
+        BOOST_LOG(error) << "The ScreenCast session didn't negotiate DMA-BUFs"sv;
+
+        std::lock_guard lg {self->mutex};
+        self->failed = true;
+        self->cv.notify_all();
+        return;
+      }
+
+      auto cursor_meta_size = [](int size) {
+        return (int) (sizeof(spa_meta_cursor) + sizeof(spa_meta_bitmap) + size * size * 4);
+      };
+
+      const spa_pod *params[] {
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamBuffers,
+          SPA_PARAM_Buffers,
+          SPA_PARAM_BUFFERS_dataType,
+          SPA_POD_CHOICE_FLAGS_Int(1 << SPA_DATA_DmaBuf)
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_Header),
+          SPA_PARAM_META_size,
+          SPA_POD_Int(sizeof(spa_meta_header))
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_VideoDamage),
+          SPA_PARAM_META_size,
+          SPA_POD_CHOICE_RANGE_Int(sizeof(spa_meta_region) * 16, sizeof(spa_meta_region), sizeof(spa_meta_region) * 16)
+        ),
+        (const spa_pod *) spa_pod_builder_add_object(
+          &builder,
+          SPA_TYPE_OBJECT_ParamMeta,
+          SPA_PARAM_Meta,
+          SPA_PARAM_META_type,
+          SPA_POD_Id(SPA_META_Cursor),
+          SPA_PARAM_META_size,
+          SPA_POD_CHOICE_RANGE_Int(cursor_meta_size(64), cursor_meta_size(1), cursor_meta_size(MAX_CURSOR_SIZE))
+        ),
+      };
+      pw_stream_update_params(self->stream, params, std::size(params));
+
+      BOOST_LOG(info) << "PipeWire stream: "sv << format.size.width << 'x' << format.size.height << ", format ["sv << format.format << "], modifier ["sv << util::hex(format.modifier).to_string_view() << ']';
+
+      std::lock_guard lg {self->mutex};
+      self->format = format;
+      self->negotiated = true;
+      self->cv.notify_all();
+    }
+
+    /**
+     * @brief Add the damage of a buffer to the damage since the frame was taken.
+     */
+    void collect_damage(spa_buffer *buffer) {
+      if (!damage) {
+        return;
+      }
+
+      auto damage_meta = spa_buffer_find_meta(buffer, SPA_META_VideoDamage);
+      if (!damage_meta) {
+        damage.reset();
+        return;
+      }
+
+      spa_meta_region *region;
+      spa_meta_for_each(region, damage_meta) {
+        if (!spa_meta_region_is_valid(region)) {
+          break;
+        }
+
+        damage->emplace_back(platf::damage_rect_t {region->region.position.x, region->region.position.y, (int) region->region.size.width, (int) region->region.size.height});
+      }
+    }
+
+    /**
+     * @brief Update the cursor from the metadata of a buffer.
+     * @return `true` if the cursor changed.
+     */
+    bool update_cursor(spa_buffer *buffer) {
+      auto meta = (spa_meta_cursor *) spa_buffer_find_meta_data(buffer, SPA_META_Cursor, sizeof(spa_meta_cursor));
+      if (!meta) {
+        return false;
+      }
+
+      if (!spa_meta_cursor_is_valid(meta)) {
+        auto changed = cursor.visible;
+        cursor.visible = false;
+        return changed;
+      }
+
+      // A bitmap is only attached when the image of the cursor changed
+      bool changed = false;
+      if (meta->bitmap_offset) {
+        auto bitmap = SPA_PTROFF(meta, meta->bitmap_offset, spa_meta_bitmap);
+        auto width = (int) bitmap->size.width;
+        auto height = (int) bitmap->size.height;
+
+        if (bitmap->offset && width > 0 && height > 0 && width <= MAX_CURSOR_SIZE && height <= MAX_CURSOR_SIZE) {
+          auto pixels = SPA_PTROFF(bitmap, bitmap->offset, std::uint8_t);
+          auto swap_red_blue = bitmap->format == SPA_VIDEO_FORMAT_RGBA || bitmap->format == SPA_VIDEO_FORMAT_RGBx;
+
+          // The blending expects premultiplied BGRA, as compositors send it
+          cursor.pixels.resize(width * height * 4);
+          for (int y = 0; y < height; ++y) {
+            auto src = pixels + y * bitmap->stride;
+            auto dst = cursor.pixels.data() + y * width * 4;
+
+            std::copy_n(src, width * 4, dst);
+            if (swap_red_blue) {
+              for (int x = 0; x < width; ++x) {
+                std::swap(dst[x * 4], dst[x * 4 + 2]);
+              }
+            }
+          }
+
+          cursor.width = width;
+          cursor.height = height;
+          ++cursor.serial;
+          changed = true;
+        }
+      }
+
+      auto x = meta->position.x - meta->hotspot.x;
+      auto y = meta->position.y - meta->hotspot.y;
+      changed = changed || !cursor.visible || x != cursor.x || y != cursor.y;
+
+      cursor.visible = !cursor.pixels.empty();
+      cursor.x = x;
+      cursor.y = y;
+      cursor.hot_x = meta->hotspot.x;
+      cursor.hot_y = meta->hotspot.y;
+
+      return changed;
+    }
+
+    static void on_process(void *data) {
+      auto self = (stream_t *) data;
+
+      std::lock_guard lg {self->mutex};
+
+      // Only the last buffer matters, the ones before it still carry damage and cursor updates
+      bool updated = false;
+      pw_buffer *last = nullptr;
+      while (auto buffer = pw_stream_dequeue_buffer(self->stream)) {
+        if (last) {
+          pw_stream_queue_buffer(self->stream, last);
+        }
+        last = buffer;
+
+        auto header = (spa_meta_header *) spa_buffer_find_meta_data(buffer->buffer, SPA_META_Header, sizeof(spa_meta_header));
+        if (header && (header->flags & SPA_META_HEADER_FLAG_CORRUPTED)) {
+          continue;
+        }
+
+        updated = self->update_cursor(buffer->buffer) || updated;
+
+        // Buffers without a frame only move the cursor
+        auto &plane = buffer->buffer->datas[0];
+        if (plane.type != SPA_DATA_DmaBuf || !plane.chunk->size || (plane.chunk->flags & SPA_CHUNK_FLAG_CORRUPTED)) {
+          continue;
+        }
+
+        self->collect_damage(buffer->buffer);
+        self->close_frame();
+
+        auto &info = self->format;
+        self->frame.width = info.size.width;
+        self->frame.height = info.size.height;
+        self->frame.modifier = info.modifier;
+        self->frame.fourcc = 0;
+        for (auto &[spa_format, fourcc] : formats) {
+          if (spa_format == info.format) {
+            self->frame.fourcc = fourcc;
+          }
+        }
+
+        for (std::uint32_t x = 0; x < std::min<std::uint32_t>(buffer->buffer->n_datas, 4); ++x) {
+          auto &plane = buffer->buffer->datas[x];
+
+          self->frame.fds[x] = fcntl(plane.fd, F_DUPFD_CLOEXEC, 0);
+          self->frame.offsets[x] = plane.chunk->offset;
+          self->frame.pitches[x] = plane.chunk->stride;
+        }
+
+        // The compositor stamps the frames with the monotonic clock, that's the steady clock
+        if (header && header->pts > 0) {
+          self->frame_timestamp = std::chrono::steady_clock::time_point {std::chrono::nanoseconds {header->pts}};
+        } else {
+          self->frame_timestamp = std::chrono::steady_clock::now();
+        }
+
+        ++self->frame_serial;
+        updated = true;
+      }
+
+      if (last) {
+        pw_stream_queue_buffer(self->stream, last);
+      }
+
+      if (updated) {
+        ++self->update_serial;
+        self->cv.notify_all();
+      }
+    }
+
+    pw_thread_loop *loop {};
+    pw_context *context {};
+    pw_core *core {};
+    pw_stream *stream {};
+    spa_hook listener {};
+
+    int framerate;
+    std::vector<std::pair<spa_video_format, std::vector<std::uint64_t>>> dmabuf_formats;
+
+    // Only used on the thread of PipeWire, and before it starts
+    std::uint8_t params_buffer[16384];
+  };
+
+  /**
+   * @brief Get the formats and modifiers of the DMA-BUFs EGL can import.
+   */
+  static std::vector<std::pair<spa_video_format, std::vector<std::uint64_t>>> dmabuf_formats(egl::display_t::pointer egl_display) {
+    using query_modifiers_fn = EGLBoolean (*)(EGLDisplay, EGLint, EGLint, EGLuint64KHR *, EGLBoolean *, EGLint *);
+    auto query_modifiers = (query_modifiers_fn) eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+
+    std::vector<std::pair<spa_video_format, std::vector<std::uint64_t>>> dmabuf_formats;
+    for (auto &[spa_format, fourcc] : formats) {
+      std::vector<std::uint64_t> modifiers;
+
+      EGLint count = 0;
+      if (query_modifiers && query_modifiers(egl_display, fourcc, 0, nullptr, nullptr, &count) && count > 0) {
+        modifiers.resize(count);
+
+        std::vector<EGLBoolean> external_only(count);
+        query_modifiers(egl_display, fourcc, count, (EGLuint64KHR *) modifiers.data(), external_only.data(), &count);
+        modifiers.resize(count);
+
+        // The conversion samples 2D textures
+        for (int x = count - 1; x >= 0; --x) {
+          if (external_only[x]) {
+            modifiers.erase(std::begin(modifiers) + x);
+          }
+        }
+      }
+
+      // The driver picks the layout of implicit modifiers
+      modifiers.emplace_back(DRM_FORMAT_MOD_INVALID);
+
+      dmabuf_formats.emplace_back(spa_format, std::move(modifiers));
+    }
+
+    return dmabuf_formats;
+  }
+
+  class portal_t: public platf::display_t {
+  public:
+    capture_backend_t capture_backend() const override {
+      return {"portal"sv, true};
+    }
+
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+      mem_type = hwdevice_type;
+
+      if (session.init()) {
+        return -1;
+      }
+
+      // Only used to find what the DMA-BUFs can be imported with, and to import them in system memory
+      if (wl_display.init()) {
+        return -1;
+      }
+
+      egl_display = egl::make_display(wl_display.get());
+      if (!egl_display) {
+        return -1;
+      }
+
+      auto fd = session.pipewire_fd;
+      session.pipewire_fd = -1;
+      if (stream.init(fd, session.node_id, config.framerate, dmabuf_formats(egl_display.get()))) {
+        return -1;
+      }
+
+      auto size = stream.wait_for_format(5s);
+      if (!size) {
+        BOOST_LOG(error) << "Couldn't negotiate the format of the ScreenCast session"sv;
+        return -1;
+      }
+
+      std::tie(width, height) = *size;
+
+      BOOST_LOG(info) << "Capturing ScreenCast session at "sv << width << 'x' << height;
+
+      return 0;
+    }
+
+    platf::capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        auto snapshot_begin = std::chrono::steady_clock::now();
+        auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        capture_stats().snapshot(status, snapshot_begin, img_out.get());
+        switch (status) {
+          case platf::capture_e::reinit:
+          case platf::capture_e::error:
+          case platf::capture_e::interrupted:
+            return status;
+          case platf::capture_e::timeout:
+            if (!push_captured_image_cb(std::move(img_out), false)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          case platf::capture_e::ok:
+            if (!push_captured_image_cb(std::move(img_out), true)) {
+              return platf::capture_e::ok;
+            }
+            break;
+          default:
+            BOOST_LOG(error) << "Unrecognized capture status ["sv << (int) status << ']';
+            return status;
+        }
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    virtual platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) = 0;
+
+  protected:
+    /**
+     * @brief Wait for the stream to update, and take its frame.
+     * @param sd The frame, with file descriptors owned by the caller.
+     * @return `capture_e::ok` with the frame, `capture_e::timeout` if the stream didn't update in time.
+     */
+    platf::capture_e take_frame(egl::surface_descriptor_t &sd, std::chrono::milliseconds timeout, bool cursor) {
+      std::unique_lock ul {stream.mutex};
+
+      // The cursor only updates the image when it's blended in, it's sent along with the image otherwise
+      auto updated = [&]() {
+        return stream.failed || stream.frame_serial != frame_serial || (cursor && stream.update_serial != update_serial);
+      };
+      if (!stream.cv.wait_for(ul, timeout, updated)) {
+        return platf::capture_e::timeout;
+      }
+
+      if (stream.failed || (int) stream.format.size.width != width || (int) stream.format.size.height != height) {
+        return platf::capture_e::reinit;
+      }
+
+      if (stream.frame.fds[0] < 0) {
+        return platf::capture_e::timeout;
+      }
+
+      sd = stream.frame;
+      for (auto &fd : sd.fds) {
+        if (fd >= 0) {
+          fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        }
+      }
+
+      new_frame = stream.frame_serial != frame_serial;
+      frame_serial = stream.frame_serial;
+      update_serial = stream.update_serial;
+      frame_timestamp = stream.frame_timestamp;
+      captured_cursor = stream.cursor;
+
+      // The damage of the cursor isn't known
+      damage = std::move(stream.damage);
+      stream.damage.emplace();
+      if (cursor && captured_cursor.visible) {
+        damage.reset();
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    /**
+     * @brief Get the cursor that's left out of the images.
+     * @return The cursor, or `std::nullopt` if the compositor doesn't send it with the frames.
+     */
+    std::optional<platf::cursor_state_t> cursor_state() {
+      static std::atomic<std::uint32_t> next_serial;
+
+      if (!session.cursor_metadata || captured_cursor.pixels.empty()) {
+        return std::nullopt;
+      }
+
+      if (!cursor_shape || cursor_shape_serial != captured_cursor.serial) {
+        auto shape = std::make_shared<platf::cursor_shape_t>();
+        shape->serial = ++next_serial;
+        shape->width = captured_cursor.width;
+        shape->height = captured_cursor.height;
+        shape->hot_x = captured_cursor.hot_x;
+        shape->hot_y = captured_cursor.hot_y;
+        shape->pixels = captured_cursor.pixels;
+
+        cursor_shape = std::move(shape);
+        cursor_shape_serial = captured_cursor.serial;
+      }
+
+      return platf::cursor_state_t {
+        captured_cursor.visible,
+        captured_cursor.x,
+        captured_cursor.y,
+        cursor_shape,
+      };
+    }
+
+    platf::mem_type_e mem_type;
+
+    std::chrono::nanoseconds delay;
+
+    session_t session;
+    wl::display_t wl_display;
+    egl::display_t egl_display;
+    stream_t stream;
+
+    // What the last frame taken from the stream came with
+    std::uint64_t frame_serial {};
+    std::uint64_t update_serial {};
+    bool new_frame {};
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+    std::optional<std::vector<platf::damage_rect_t>> damage;
+    cursor_t captured_cursor {};
+
+    std::shared_ptr<const platf::cursor_shape_t> cursor_shape;
+    unsigned long cursor_shape_serial {};
+  };
+
+  class portal_ram_t: public portal_t {
+  public:
+    void blend_cursor(platf::img_t &img) {
+      auto pixels = (std::uint32_t *) img.data;
+
+      auto begin_x = std::max(0, captured_cursor.x);
+      auto begin_y = std::max(0, captured_cursor.y);
+      auto end_x = std::min(img.width, captured_cursor.x + captured_cursor.width);
+      auto end_y = std::min(img.height, captured_cursor.y + captured_cursor.height);
+
+      for (auto y = begin_y; y < end_y; ++y) {
+        auto cursor_row = (const std::uint32_t *) captured_cursor.pixels.data() + (y - captured_cursor.y) * captured_cursor.width;
+
+        platf::blend_cursor_row(&pixels[y * (img.row_pitch / img.pixel_pitch) + begin_x], cursor_row + (begin_x - captured_cursor.x), end_x - begin_x);
+      }
+    }
+
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) override {
+      egl::surface_descriptor_t sd;
+      auto status = take_frame(sd, timeout, cursor && session.cursor_metadata);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      egl::img_descriptor_t owner;
+      owner.sd = sd;
+
+      auto rgb = imports.import(egl_display.get(), sd);
+      if (!rgb) {
+        return platf::capture_e::reinit;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
+
+      // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
+      int w, h;
+      gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+      gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+      BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
+
+      gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
+
+      img_out->frame_timestamp = frame_timestamp;
+      img_out->damage = damage;
+
+      if (cursor && session.cursor_metadata && captured_cursor.visible) {
+        blend_cursor(*img_out);
+      }
+
+      if (!cursor) {
+        img_out->cursor = cursor_state();
+      } else {
+        img_out->cursor.reset();
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+      if (portal_t::init(hwdevice_type, display_name, config)) {
+        return -1;
+      }
+
+      auto ctx_opt = egl::make_ctx(egl_display.get());
+      if (!ctx_opt) {
+        return -1;
+      }
+
+      ctx = std::move(*ctx_opt);
+
+      return 0;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_encode_device(width, height, false);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = alloc_frame_data(height * img->row_pitch);
+      if (!img->data) {
+        return nullptr;
+      }
+
+      return img;
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      return 0;
+    }
+
+    egl::ctx_t ctx;
+
+    egl::import_cache_t imports;
+  };
+
+  class portal_vram_t: public portal_t {
+  public:
+    platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) override {
+      egl::surface_descriptor_t sd;
+      auto status = take_frame(sd, timeout, cursor && session.cursor_metadata);
+      if (status != platf::capture_e::ok) {
+        return status;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        for (auto fd : sd.fds) {
+          if (fd >= 0) {
+            close(fd);
+          }
+        }
+
+        return platf::capture_e::interrupted;
+      }
+      auto img = (egl::img_descriptor_t *) img_out.get();
+      img->reset();
+
+      img->sd = sd;
+      img->frame_timestamp = frame_timestamp;
+      img->damage = damage;
+
+      // The encoder keeps its import while the sequence is the same
+      if (new_frame) {
+        ++sequence;
+      }
+      img->sequence = sequence;
+
+      if (cursor && session.cursor_metadata && captured_cursor.visible) {
+        // Copy new cursor pixel data if it's been updated
+        if (img->serial != captured_cursor.serial) {
+          img->buffer = captured_cursor.pixels;
+          img->serial = captured_cursor.serial;
+        }
+
+        img->x = captured_cursor.x;
+        img->y = captured_cursor.y;
+        img->src_w = captured_cursor.width;
+        img->src_h = captured_cursor.height;
+        img->width = captured_cursor.width;
+        img->height = captured_cursor.height;
+        img->pixel_pitch = 4;
+        img->row_pitch = img->pixel_pitch * img->width;
+        img->data = img->buffer.data();
+      } else {
+        img->data = nullptr;
+      }
+
+      if (!cursor) {
+        img->cursor = cursor_state();
+      } else {
+        img->cursor.reset();
+      }
+
+      return platf::capture_e::ok;
+    }
+
+    std::shared_ptr<platf::img_t> alloc_img() override {
+      auto img = std::make_shared<egl::img_descriptor_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      return img;
+    }
+
+    std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(platf::pix_fmt_e pix_fmt) override {
+#ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == platf::mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+#endif
+
+#ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == platf::mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+#endif
+
+      return std::make_unique<platf::avcodec_encode_device_t>();
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      return 0;
+    }
+
+    std::uint64_t sequence {};
+  };
+}  // namespace portal
+
+namespace platf {
+  std::shared_ptr<display_t> portal_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
+      BOOST_LOG(error) << "Could not initialize display with the given hw device type."sv;
+      return nullptr;
+    }
+
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::cuda) {
+      auto portal = std::make_shared<portal::portal_vram_t>();
+      if (portal->init(hwdevice_type, display_name, config)) {
+        return nullptr;
+      }
+
+      return portal;
+    }
+
+    auto portal = std::make_shared<portal::portal_ram_t>();
+    if (portal->init(hwdevice_type, display_name, config)) {
+      return nullptr;
+    }
+
+    return portal;
+  }
+
+  std::vector<std::string> portal_display_names() {
+    if (!portal::available()) {
+      return {};
+    }
+
+    // The monitor is picked by the user in the dialog of the compositor
+    return {"0"};
+  }
+}  // namespace platf
@@ -0,0 +1,165 @@
+/**
+ * @file src/platform/linux/uring.cpp
+ * @brief Definitions for sending UDP packets through io_uring.
+ */
+// standard includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+
+// lib includes
+#include <liburing.h>
+
+// local includes
+#include "src/logging.h"
+#include "uring.h"
+
+using namespace std::literals;
+
+namespace uring {
+  namespace {
+    // Batches are split into GSO messages of up to 64K each, so only a few are sent at once
+    constexpr unsigned QUEUE_DEPTH = 16;
+
+    // Below this size, copying the payload is cheaper than pinning its pages
+    constexpr std::size_t ZEROCOPY_MIN_BYTES = 16 * 1024;
+
+    std::size_t message_size(const struct msghdr &msg) {
+      std::size_t size = 0;
+      for (std::size_t x = 0; x < msg.msg_iovlen; ++x) {
+        size += msg.msg_iov[x].iov_len;
+      }
+
+      return size;
+    }
+
+    class ring_t {
+    public:
+      ring_t() {
+        auto err = io_uring_queue_init(QUEUE_DEPTH, &_ring, 0);
+        if (err < 0) {
+          BOOST_LOG(warning) << "io_uring is not available, falling back to sendmsg(): "sv << -err;
+          return;
+        }
+        _initialized = true;
+
+        if (auto probe = io_uring_get_probe_ring(&_ring)) {
+          _zerocopy = io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+          io_uring_free_probe(probe);
+        }
+
+        BOOST_LOG(debug) << "Sending through io_uring"sv << (_zerocopy ? " with zero-copy"sv : ""sv);
+      }
+
+      ~ring_t() {
+        if (_initialized) {
+          io_uring_queue_exit(&_ring);
+        }
+      }
+
+      ring_t(const ring_t &) = delete;
+      ring_t &operator=(const ring_t &) = delete;
+
+      int send(int sockfd, const struct msghdr *msgs, int count) {
+        if (!_initialized) {
+          return -1;
+        }
+
+        int sent = 0;
+        while (sent < count) {
+          auto chunk = std::min<int>(count - sent, QUEUE_DEPTH);
+          auto chunk_sent = send_chain(sockfd, msgs + sent, chunk);
+
+          sent += chunk_sent;
+          if (chunk_sent < chunk) {
+            break;
+          }
+        }
+
+        return sent;
+      }
+
+    private:
+      int send_chain(int sockfd, const struct msghdr *msgs, int count) {
+        // The ring is empty between calls and a chain never exceeds its depth,
+        // so there's always a free submission entry
+        for (int x = 0; x < count; ++x) {
+          auto sqe = io_uring_get_sqe(&_ring);
+
+          if (_zerocopy && message_size(msgs[x]) >= ZEROCOPY_MIN_BYTES) {
+            io_uring_prep_sendmsg_zc(sqe, sockfd, &msgs[x], 0);
+          } else {
+            io_uring_prep_sendmsg(sqe, sockfd, &msgs[x], 0);
+          }
+          io_uring_sqe_set_data64(sqe, x);
+
+          // A failed message cancels the ones after it, so nothing is sent out of order
+          if (x + 1 < count) {
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+          }
+        }
+
+        auto err = io_uring_submit(&_ring);
+        if (err < 0) {
+          BOOST_LOG(warning) << "io_uring_submit() failed: "sv << -err;
+          return 0;
+        }
+
+        // Every message completes once, and zero-copy messages once more when the
+        // kernel is done with their buffers
+        int pending = count;
+        int failed = count;
+        int error = 0;
+        while (pending) {
+          struct io_uring_cqe *cqe;
+          err = io_uring_wait_cqe(&_ring, &cqe);
+          if (err == -EINTR) {
+            continue;
+          }
+          if (err < 0) {
+            BOOST_LOG(warning) << "io_uring_wait_cqe() failed: "sv << -err;
+            return 0;
+          }
+
+          if (!(cqe->flags & IORING_CQE_F_NOTIF)) {
+            if (cqe->flags & IORING_CQE_F_MORE) {
+              ++pending;
+            }
+
+            auto x = (int) io_uring_cqe_get_data64(cqe);
+            if (cqe->res < 0 && x < failed) {
+              failed = x;
+              error = -cqe->res;
+            }
+          }
+
+          --pending;
+          io_uring_cqe_seen(&_ring, cqe);
+        }
+
+        if (failed < count) {
+          // Some sockets and devices can't send without copying
+          if (error == EOPNOTSUPP && _zerocopy) {
+            BOOST_LOG(debug) << "Zero-copy send is not supported, copying from now on"sv;
+            _zerocopy = false;
+          } else {
+            BOOST_LOG(verbose) << "io_uring sendmsg() failed: "sv << error;
+          }
+        }
+
+        return failed;
+      }
+
+      struct io_uring _ring {};
+      bool _initialized {false};
+      bool _zerocopy {false};
+    };
+  }  // namespace
+
+  int send(int sockfd, const struct msghdr *msgs, int count) {
+    // Each sending thread has a ring of its own, so no locking is needed
+    thread_local ring_t ring;
+
+    return ring.send(sockfd, msgs, count);
+  }
+}  // namespace uring
@@ -0,0 +1,24 @@
+/**
+ * @file src/platform/linux/uring.h
+ * @brief Declarations for sending UDP packets through io_uring.
+ */
+#pragma once
+
+// platform includes
+#include <sys/socket.h>
+
+namespace uring {
+  /**
+   * @brief Send messages on a socket in order through the io_uring of the calling thread.
+   * @details The messages are submitted as one chain of linked requests, so they take a
+   *          single system call and leave in order. Large messages are sent without copying
+   *          their payload if the kernel supports it. This returns once every buffer the
+   *          messages point to may be reused.
+   * @param sockfd The socket.
+   * @param msgs The messages.
+   * @param count The number of messages.
+   * @return The number of messages sent before the first failure,
+   *         or -1 if io_uring isn't available on this thread.
+   */
+  int send(int sockfd, const struct msghdr *msgs, int count);
+}  // namespace uring
@@ -3,15 +3,26 @@
  * @brief Definitions for VA-API hardware accelerated capture.
  */
 // standard includes
+#include <algorithm>
+#include <cmath>
 #include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <unistd.h>
+#include <utility>
+
+// lib includes
+#include <drm_fourcc.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavutil/pixdesc.h>
 #include <va/va.h>
 #include <va/va_drm.h>
+#include <va/va_vpp.h>
 #if !VA_CHECK_VERSION(1, 9, 0)
   // vaSyncBuffer stub allows Sunshine built against libva <2.9.0 to link against ffmpeg on libva 2.9.0 or later
   VAStatus
@@ -94,13 +105,57 @@ namespace va {
 
   int vaapi_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *encode_device, AVBufferRef **hw_device_buf);
 
+  /**
+   * @brief A render node the streams are spread over with `vaapi_adapter_balancing`.
+   */
+  struct balanced_adapter_t {
+    std::string render_device;
+
+    // The streams encoding on it
+    int sessions;
+
+    // The HEVC mode it was last validated for, and whether it could encode it
+    int validated_hevc_mode;
+    bool capable;
+  };
+
+  // Enumerated once, so indices stay valid
+  static std::mutex balanced_adapters_mutex;
+  static std::vector<balanced_adapter_t> balanced_adapters;
+
+  /**
+   * @brief Counts a stream against the render node it encodes on, until the stream ends.
+   */
+  class adapter_lease_t {
+  public:
+    adapter_lease_t() = default;
+
+    adapter_lease_t(adapter_lease_t &&other) noexcept:
+        index {std::exchange(other.index, std::nullopt)} {
+    }
+
+    adapter_lease_t &operator=(adapter_lease_t &&other) noexcept {
+      std::swap(index, other.index);
+      return *this;
+    }
+
+    ~adapter_lease_t() {
+      if (index) {
+        std::lock_guard lg {balanced_adapters_mutex};
+        --balanced_adapters[*index].sessions;
+      }
+    }
+
+    std::optional<std::size_t> index;
+  };
+
   class va_t: public platf::avcodec_encode_device_t {
   public:
     int init(int in_width, int in_height, file_t &&render_device) {
       file = std::move(render_device);
 
-      if (!gbm::create_device) {
-        BOOST_LOG(warning) << "libgbm not initialized"sv;
+      if (gbm::init()) {
+        BOOST_LOG(warning) << "Couldn't load libgbm"sv;
         return -1;
       }
 
@@ -132,7 +187,10 @@ namespace va {
     }
 
     /**
-     * @brief Finds a supported VA entrypoint for the given VA profile.
+     * @brief Finds a usable VA encoding entrypoint for the given VA profile.
+     * @details The low-power entrypoint is preferred unless vaapi_low_power says otherwise. A listed
+     *          entrypoint isn't always usable, Intel GPUs need the HuC firmware for the low-power one,
+     *          so each is checked by creating a config with it.
      * @param profile The profile to match.
      * @return A valid encoding entrypoint or 0 on failure.
      */
@@ -147,15 +205,33 @@ namespace va {
       entrypoints.resize(num_eps);
 
       // Sorted in order of descending preference
-      VAEntrypoint ep_preferences[] = {
-        VAEntrypointEncSliceLP,
-        VAEntrypointEncSlice,
-        VAEntrypointEncPicture
-      };
+      std::vector<VAEntrypoint> ep_preferences;
+      if (config::video.vaapi.low_power.value_or(1)) {
+        ep_preferences.push_back(VAEntrypointEncSliceLP);
+      }
+      if (!config::video.vaapi.low_power.value_or(0)) {
+        ep_preferences.push_back(VAEntrypointEncSlice);
+        ep_preferences.push_back(VAEntrypointEncPicture);
+      }
+
       for (auto ep_pref : ep_preferences) {
-        if (std::find(entrypoints.begin(), entrypoints.end(), ep_pref) != entrypoints.end()) {
-          return ep_pref;
+        if (std::find(entrypoints.begin(), entrypoints.end(), ep_pref) == entrypoints.end()) {
+          continue;
         }
+
+        VAConfigID config_id;
+        status = vaCreateConfig(va_display, profile, ep_pref, nullptr, 0, &config_id);
+        if (status != VA_STATUS_SUCCESS) {
+          BOOST_LOG(warning) << "Couldn't create a config for VA entrypoint "sv << (int) ep_pref << ": "sv << vaErrorStr(status);
+          continue;
+        }
+        vaDestroyConfig(va_display, config_id);
+
+        return ep_pref;
+      }
+
+      if (config::video.vaapi.low_power.value_or(0)) {
+        BOOST_LOG(error) << "The low-power encoding mode was required, but it isn't available for this codec"sv;
       }
 
       return (VAEntrypoint) 0;
@@ -238,6 +314,10 @@ namespace va {
         BOOST_LOG(info) << "Using normal encoding mode"sv;
       }
 
+      if (config::video.vaapi.async_depth > 1) {
+        BOOST_LOG(info) << "Encoding up to "sv << config::video.vaapi.async_depth << " frames at once"sv;
+      }
+
       VAConfigAttrib rc_attr = {VAConfigAttribRateControl};
       auto status = vaGetConfigAttributes(va_display, va_profile, va_entrypoint, &rc_attr, 1);
       if (status != VA_STATUS_SUCCESS) {
@@ -374,6 +454,9 @@ namespace va {
     va::display_t::pointer va_display;
     file_t file;
 
+    // Released after everything that follows, which uses the render node
+    adapter_lease_t adapter_lease;
+
     gbm::gbm_t gbm;
     egl::display_t display;
     egl::ctx_t ctx;
@@ -400,27 +483,39 @@ namespace va {
 
   class va_vram_t: public va_t {
   public:
+    ~va_vram_t() {
+      destroy_vpp();
+    }
+
     int convert(platf::img_t &img) override {
       auto &descriptor = (egl::img_descriptor_t &) img;
 
+      // The cursor can only be blended by the shaders
+      if (vpp && descriptor.sequence != 0 && !descriptor.data) {
+        if (convert_vpp(descriptor)) {
+          return 0;
+        }
+
+        BOOST_LOG(warning) << "Falling back to shader color conversion"sv;
+        destroy_vpp();
+        vpp = false;
+      }
+
       if (descriptor.sequence == 0) {
         // For dummy images, use a blank RGB texture instead of importing a DMA-BUF
-        rgb = egl::create_blank(img);
+        blank = egl::create_blank(img);
+        rgb = &blank;
       } else if (descriptor.sequence > sequence) {
         sequence = descriptor.sequence;
 
-        rgb = egl::rgb_t {};
+        rgb = imports.import(display.get(), descriptor.sd);
 
-        auto rgb_opt = egl::import_source(display.get(), descriptor.sd);
-
-        if (!rgb_opt) {
+        if (!rgb) {
           return -1;
         }
-
-        rgb = std::move(*rgb_opt);
       }
 
-      sws.load_vram(descriptor, offset_x, offset_y, rgb->tex[0]);
+      sws.load_vram(descriptor, offset_x, offset_y, (*rgb)->tex[0]);
 
       sws.convert(nv12->buf);
       return 0;
@@ -436,13 +531,226 @@ namespace va {
       this->offset_x = offset_x;
       this->offset_y = offset_y;
 
+      vpp = config::video.vaapi.vpp;
+
       return 0;
     }
 
+    /**
+     * @brief Get the VA fourcc of a captured DRM format.
+     * @param drm_format The DRM fourcc.
+     * @return The VA fourcc, or 0 if the format can't be imported.
+     */
+    static std::uint32_t va_fourcc_from_drm(std::uint32_t drm_format) {
+      switch (drm_format) {
+        case DRM_FORMAT_XRGB8888:
+          return VA_FOURCC_BGRX;
+        case DRM_FORMAT_ARGB8888:
+          return VA_FOURCC_BGRA;
+        case DRM_FORMAT_XBGR8888:
+          return VA_FOURCC_RGBX;
+        case DRM_FORMAT_ABGR8888:
+          return VA_FOURCC_RGBA;
+        default:
+          return 0;
+      }
+    }
+
+    /**
+     * @brief Convert a captured frame with the video processor of the encode engine.
+     * @details The DMA-BUF of the frame is imported as a VA surface and scaled and converted
+     *          straight into the frame of the encoder, without a pass through the 3D engine.
+     * @param descriptor The captured frame.
+     * @return `true` on success, `false` if the video processor can't convert the frame.
+     */
+    bool convert_vpp(egl::img_descriptor_t &descriptor) {
+      auto target = (VASurfaceID) (std::uintptr_t) frame->data[3];
+
+      if (vpp_context == VA_INVALID_ID) {
+        // HDR needs tone mapping metadata the video processors don't consistently take
+        if (colorspace.bit_depth != 8 || video::colorspace_is_hdr(colorspace)) {
+          BOOST_LOG(info) << "VA-API video processing only converts 8-bit SDR frames"sv;
+          return false;
+        }
+
+        auto status = vaCreateConfig(va_display, VAProfileNone, VAEntrypointVideoProc, nullptr, 0, &vpp_config);
+        if (status != VA_STATUS_SUCCESS) {
+          BOOST_LOG(warning) << "VA-API video processing is not supported: "sv << vaErrorStr(status);
+          return false;
+        }
+
+        status = vaCreateContext(va_display, vpp_config, frame->width, frame->height, VA_PROGRESSIVE, &target, 1, &vpp_context);
+        if (status != VA_STATUS_SUCCESS) {
+          BOOST_LOG(warning) << "Couldn't create VA-API video processing context: "sv << vaErrorStr(status);
+          return false;
+        }
+
+        BOOST_LOG(info) << "Converting frames with VA-API video processing"sv;
+      }
+
+      if (descriptor.sequence > vpp_sequence || vpp_source == VA_INVALID_SURFACE) {
+        if (!import_vpp_source(descriptor.sd)) {
+          return false;
+        }
+
+        vpp_sequence = descriptor.sequence;
+      }
+
+      // Keep the aspect ratio of the captured area, like the shaders do
+      auto scalar = std::fminf(frame->width / (float) width, frame->height / (float) height);
+      auto out_width = (int) (width * scalar);
+      auto out_height = (int) (height * scalar);
+
+      VARectangle surface_region {(std::int16_t) offset_x, (std::int16_t) offset_y, (std::uint16_t) width, (std::uint16_t) height};
+      VARectangle output_region {
+        (std::int16_t) ((frame->width - out_width) / 2),
+        (std::int16_t) ((frame->height - out_height) / 2),
+        (std::uint16_t) out_width,
+        (std::uint16_t) out_height,
+      };
+
+      VAProcPipelineParameterBuffer params {};
+      params.surface = vpp_source;
+      params.surface_region = &surface_region;
+      params.output_region = &output_region;
+      params.output_background_color = 0xff000000;
+      params.surface_color_standard = VAProcColorStandardSRGB;
+      switch (colorspace.colorspace) {
+        case video::colorspace_e::rec601:
+          params.output_color_standard = VAProcColorStandardBT601;
+          break;
+        case video::colorspace_e::rec709:
+          params.output_color_standard = VAProcColorStandardBT709;
+          break;
+        default:
+          params.output_color_standard = VAProcColorStandardBT2020;
+          break;
+      }
+#if VA_CHECK_VERSION(1, 3, 0)
+      params.input_color_properties.color_range = VA_SOURCE_RANGE_FULL;
+      params.output_color_properties.color_range = colorspace.full_range ? VA_SOURCE_RANGE_FULL : VA_SOURCE_RANGE_REDUCED;
+#endif
+
+      VABufferID params_buffer;
+      auto status = vaCreateBuffer(va_display, vpp_context, VAProcPipelineParameterBufferType, sizeof(params), 1, &params, &params_buffer);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "Couldn't create VA-API video processing parameters: "sv << vaErrorStr(status);
+        return false;
+      }
+
+      status = vaBeginPicture(va_display, vpp_context, target);
+      if (status == VA_STATUS_SUCCESS) {
+        status = vaRenderPicture(va_display, vpp_context, &params_buffer, 1);
+        auto end_status = vaEndPicture(va_display, vpp_context);
+        if (status == VA_STATUS_SUCCESS) {
+          status = end_status;
+        }
+      }
+      vaDestroyBuffer(va_display, params_buffer);
+
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(error) << "VA-API video processing failed: "sv << vaErrorStr(status);
+        return false;
+      }
+
+      return true;
+    }
+
+    /**
+     * @brief Import the DMA-BUF of a captured frame as the source of the video processor.
+     * @param sd The DMA-BUF.
+     * @return `true` on success, `false` if it couldn't be imported.
+     */
+    bool import_vpp_source(const egl::surface_descriptor_t &sd) {
+      if (vpp_source != VA_INVALID_SURFACE) {
+        vaDestroySurfaces(va_display, &vpp_source, 1);
+        vpp_source = VA_INVALID_SURFACE;
+      }
+
+      auto fourcc = va_fourcc_from_drm(sd.fourcc);
+      if (!fourcc) {
+        BOOST_LOG(info) << "VA-API video processing can't import the capture format"sv;
+        return false;
+      }
+
+      va::DRMPRIMESurfaceDescriptor prime {};
+      prime.fourcc = fourcc;
+      prime.width = sd.width;
+      prime.height = sd.height;
+      prime.num_layers = 1;
+
+      auto &layer = prime.layers[0];
+      layer.drm_format = sd.fourcc;
+      for (int x = 0; x < 4 && sd.fds[x] >= 0; ++x) {
+        // The planes of a framebuffer may share one buffer object
+        std::uint32_t object = 0;
+        while (object < prime.num_objects && prime.objects[object].fd != sd.fds[x]) {
+          ++object;
+        }
+
+        if (object == prime.num_objects) {
+          auto size = lseek(sd.fds[x], 0, SEEK_END);
+          prime.objects[object].fd = sd.fds[x];
+          prime.objects[object].size = size > 0 ? (std::uint32_t) size : 0;
+          prime.objects[object].drm_format_modifier = sd.modifier;
+          ++prime.num_objects;
+        }
+
+        layer.object_index[x] = object;
+        layer.offset[x] = sd.offsets[x];
+        layer.pitch[x] = sd.pitches[x];
+        ++layer.num_planes;
+      }
+
+      VASurfaceAttrib attribs[2] {};
+      attribs[0].type = VASurfaceAttribMemoryType;
+      attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+      attribs[0].value.type = VAGenericValueTypeInteger;
+      attribs[0].value.value.i = va::SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2;
+      attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+      attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+      attribs[1].value.type = VAGenericValueTypePointer;
+      attribs[1].value.value.p = &prime;
+
+      // The surface refers to the DMA-BUF, whose file descriptors stay owned by the descriptor
+      auto status = vaCreateSurfaces(va_display, VA_RT_FORMAT_RGB32, sd.width, sd.height, &vpp_source, 1, attribs, 2);
+      if (status != VA_STATUS_SUCCESS) {
+        BOOST_LOG(warning) << "Couldn't import DMA-BUF as VA surface: "sv << vaErrorStr(status);
+        vpp_source = VA_INVALID_SURFACE;
+        return false;
+      }
+
+      return true;
+    }
+
+    void destroy_vpp() {
+      if (vpp_source != VA_INVALID_SURFACE) {
+        vaDestroySurfaces(va_display, &vpp_source, 1);
+        vpp_source = VA_INVALID_SURFACE;
+      }
+      if (vpp_context != VA_INVALID_ID) {
+        vaDestroyContext(va_display, vpp_context);
+        vpp_context = VA_INVALID_ID;
+      }
+      if (vpp_config != VA_INVALID_ID) {
+        vaDestroyConfig(va_display, vpp_config);
+        vpp_config = VA_INVALID_ID;
+      }
+    }
+
     std::uint64_t sequence;
-    egl::rgb_t rgb;
+    egl::rgb_t blank;
+    egl::import_cache_t imports;
+    egl::rgb_t *rgb {};
 
     int offset_x, offset_y;
+
+    // Convert with the video processor of the encode engine instead of the shaders
+    bool vpp = false;
+    VAConfigID vpp_config = VA_INVALID_ID;
+    VAContextID vpp_context = VA_INVALID_ID;
+    VASurfaceID vpp_source = VA_INVALID_SURFACE;
+    std::uint64_t vpp_sequence = 0;
   };
 
   /**
@@ -624,10 +932,73 @@ namespace va {
     }
   }
 
+  /**
+   * @brief Pick the render node to encode a stream on.
+   * @details With `vaapi_adapter_balancing`, that's the render node able to encode the stream with the fewest
+   *          streams on it, the configured one first among equals. Captured frames reach it through PRIME or
+   *          system memory, like with any configured render node.
+   * @param lease Counts the stream against the render node that's picked.
+   * @return The path to the render node.
+   */
+  static std::string pick_render_device(adapter_lease_t &lease) {
+    std::string render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name;
+    if (!config::video.vaapi.adapter_balancing) {
+      return render_device;
+    }
+
+    std::lock_guard lg {balanced_adapters_mutex};
+    if (balanced_adapters.empty()) {
+      std::vector<std::string> render_devices;
+
+      std::error_code ec;
+      for (auto &entry : std::filesystem::directory_iterator {"/dev/dri", ec}) {
+        auto path = entry.path().string();
+        if (entry.path().filename().string().starts_with("renderD") && path != render_device) {
+          render_devices.emplace_back(std::move(path));
+        }
+      }
+      std::sort(std::begin(render_devices), std::end(render_devices));
+      render_devices.insert(std::begin(render_devices), render_device);
+
+      for (auto &path : render_devices) {
+        balanced_adapters.emplace_back(balanced_adapter_t {std::move(path), 0, -1, false});
+      }
+    }
+
+    std::optional<std::size_t> least_loaded;
+    for (std::size_t x = 0; x < balanced_adapters.size(); ++x) {
+      auto &adapter = balanced_adapters[x];
+
+      if (adapter.validated_hevc_mode != video::active_hevc_mode) {
+        file_t file = open(adapter.render_device.c_str(), O_RDWR);
+
+        adapter.capable = file.el >= 0 && validate(file.el);
+        adapter.validated_hevc_mode = video::active_hevc_mode;
+      }
+
+      if (adapter.capable && (!least_loaded || adapter.sessions < balanced_adapters[*least_loaded].sessions)) {
+        least_loaded = x;
+      }
+    }
+
+    if (!least_loaded) {
+      return render_device;
+    }
+
+    auto &adapter = balanced_adapters[*least_loaded];
+    BOOST_LOG(info) << "Encoding on "sv << adapter.render_device << " with "sv << adapter.sessions << " other stream(s)"sv;
+
+    ++adapter.sessions;
+    lease.index = least_loaded;
+
+    return adapter.render_device;
+  }
+
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, int offset_x, int offset_y, bool vram) {
-    auto render_device = config::video.adapter_name.empty() ? "/dev/dri/renderD128" : config::video.adapter_name.c_str();
+    adapter_lease_t lease;
+    auto render_device = pick_render_device(lease);
 
-    file_t file = open(render_device, O_RDWR);
+    file_t file = open(render_device.c_str(), O_RDWR);
     if (file.el < 0) {
       char string[1024];
       BOOST_LOG(error) << "Couldn't open "sv << render_device << ": " << strerror_r(errno, string, sizeof(string));
@@ -635,7 +1006,12 @@ namespace va {
       return nullptr;
     }
 
-    return make_avcodec_encode_device(width, height, std::move(file), offset_x, offset_y, vram);
+    auto encode_device = make_avcodec_encode_device(width, height, std::move(file), offset_x, offset_y, vram);
+    if (encode_device) {
+      static_cast<va_t *>(encode_device.get())->adapter_lease = std::move(lease);
+    }
+
+    return encode_device;
   }
 
   std::unique_ptr<platf::avcodec_encode_device_t> make_avcodec_encode_device(int width, int height, bool vram) {
@@ -258,19 +258,6 @@ namespace wl {
     return true;
   }
 
-  // Cleanup GBM
-  void dmabuf_t::cleanup_gbm() {
-    if (current_bo) {
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
-    }
-
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
-    }
-  }
-
   dmabuf_t::dmabuf_t():
       status {READY},
       frames {},
@@ -293,6 +280,12 @@ namespace wl {
     wl_output *output,
     bool blend_cursor
   ) {
+    // The compositor holds a copy with damage back until the output changes,
+    // the same request is waited for until then
+    if (status == WAITING) {
+      return;
+    }
+
     this->dmabuf_interface = dmabuf_interface;
     // Reset state
     shm_info.supported = false;
@@ -311,11 +304,14 @@ namespace wl {
     // Add listener
     zwlr_screencopy_frame_v1_add_listener(frame, &listener, this);
 
+    pending_frame = frame;
     status = WAITING;
   }
 
   dmabuf_t::~dmabuf_t() {
-    cleanup_gbm();
+    if (pending_frame) {
+      zwlr_screencopy_frame_v1_destroy(pending_frame);
+    }
 
     for (auto &frame : frames) {
       frame.destroy();
@@ -366,40 +362,60 @@ namespace wl {
     BOOST_LOG(debug) << "Frame flags: "sv << flags << (y_invert ? " (y_invert)" : "");
   }
 
+  /**
+   * @brief Copy the output into a buffer, waiting for damage when the compositor supports it.
+   * @param frame The screencopy request.
+   * @param buffer The buffer to copy into.
+   */
+  void dmabuf_t::copy(zwlr_screencopy_frame_v1 *frame, wl_buffer *buffer) {
+    auto next_frame = get_next_frame();
+
+    if (zwlr_screencopy_frame_v1_get_version(frame) >= ZWLR_SCREENCOPY_FRAME_V1_COPY_WITH_DAMAGE_SINCE_VERSION) {
+      next_frame->damage.emplace();
+      zwlr_screencopy_frame_v1_copy_with_damage(frame, buffer);
+    } else {
+      next_frame->damage.reset();
+      zwlr_screencopy_frame_v1_copy(frame, buffer);
+    }
+  }
+
   // DMA-BUF creation helper
   void dmabuf_t::create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame) {
+    auto next_frame = get_next_frame();
+
     if (!init_gbm()) {
       BOOST_LOG(error) << "Failed to initialize GBM"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      pending_frame = nullptr;
       status = REINIT;
       return;
     }
 
     // Create GBM buffer
-    current_bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
-    if (!current_bo) {
+    next_frame->bo = gbm_bo_create(gbm_device, dmabuf_info.width, dmabuf_info.height, dmabuf_info.format, GBM_BO_USE_RENDERING);
+    if (!next_frame->bo) {
       BOOST_LOG(error) << "Failed to create GBM buffer"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      pending_frame = nullptr;
       status = REINIT;
       return;
     }
 
     // Get buffer info
-    int fd = gbm_bo_get_fd(current_bo);
+    int fd = gbm_bo_get_fd(next_frame->bo);
     if (fd < 0) {
       BOOST_LOG(error) << "Failed to get buffer FD"sv;
-      gbm_bo_destroy(current_bo);
-      current_bo = nullptr;
+      next_frame->destroy();
       zwlr_screencopy_frame_v1_destroy(frame);
+      pending_frame = nullptr;
       status = REINIT;
       return;
     }
 
-    uint32_t stride = gbm_bo_get_stride(current_bo);
-    uint64_t modifier = gbm_bo_get_modifier(current_bo);
+    uint32_t stride = gbm_bo_get_stride(next_frame->bo);
+    uint64_t modifier = gbm_bo_get_modifier(next_frame->bo);
 
     // Store in surface descriptor for later use
-    auto next_frame = get_next_frame();
     next_frame->sd.fds[0] = fd;
     next_frame->sd.pitches[0] = stride;
     next_frame->sd.offsets[0] = 0;
@@ -422,6 +438,19 @@ namespace wl {
 
     // Prefer DMA-BUF if supported
     if (dmabuf_info.supported && dmabuf_interface) {
+      // The buffer from an earlier copy is reused while the output keeps its mode
+      if (
+        next_frame->buffer &&
+        next_frame->sd.fourcc == dmabuf_info.format &&
+        next_frame->sd.width == (int) dmabuf_info.width &&
+        next_frame->sd.height == (int) dmabuf_info.height
+      ) {
+        copy(frame, next_frame->buffer);
+        return;
+      }
+
+      next_frame->destroy();
+
       // Store format info first
       next_frame->sd.fourcc = dmabuf_info.format;
       next_frame->sd.width = dmabuf_info.width;
@@ -433,10 +462,12 @@ namespace wl {
       // SHM fallback would go here
       BOOST_LOG(warning) << "SHM capture not implemented"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      pending_frame = nullptr;
       status = REINIT;
     } else {
       BOOST_LOG(error) << "No supported buffer types"sv;
       zwlr_screencopy_frame_v1_destroy(frame);
+      pending_frame = nullptr;
       status = REINIT;
     }
   }
@@ -450,11 +481,13 @@ namespace wl {
     auto frame = static_cast<zwlr_screencopy_frame_v1 *>(data);
     auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
 
-    // Store for cleanup
-    self->current_wl_buffer = buffer;
+    zwp_linux_buffer_params_v1_destroy(params);
+
+    // Kept for the following copies
+    self->get_next_frame()->buffer = buffer;
 
     // Start the actual copy
-    zwlr_screencopy_frame_v1_copy(frame, buffer);
+    self->copy(frame, buffer);
   }
 
   // Buffer params failed callback
@@ -466,9 +499,11 @@ namespace wl {
     auto self = static_cast<dmabuf_t *>(zwlr_screencopy_frame_v1_get_user_data(frame));
 
     BOOST_LOG(error) << "Failed to create buffer from params"sv;
-    self->cleanup_gbm();
+    zwp_linux_buffer_params_v1_destroy(params);
+    self->get_next_frame()->destroy();
 
     zwlr_screencopy_frame_v1_destroy(frame);
+    self->pending_frame = nullptr;
     self->status = REINIT;
   }
 
@@ -481,19 +516,11 @@ namespace wl {
   ) {
     BOOST_LOG(debug) << "Frame ready"sv;
 
-    // Frame is ready for use, GBM buffer now contains screen content
-    current_frame->destroy();
+    // The next buffer now contains the screen content
     current_frame = get_next_frame();
 
-    // Keep the GBM buffer alive but destroy the Wayland objects
-    if (current_wl_buffer) {
-      wl_buffer_destroy(current_wl_buffer);
-      current_wl_buffer = nullptr;
-    }
-
-    cleanup_gbm();
-
     zwlr_screencopy_frame_v1_destroy(frame);
+    pending_frame = nullptr;
     status = READY;
   }
 
@@ -501,12 +528,11 @@ namespace wl {
   void dmabuf_t::failed(zwlr_screencopy_frame_v1 *frame) {
     BOOST_LOG(error) << "Frame capture failed"sv;
 
-    // Clean up resources
-    cleanup_gbm();
-    auto next_frame = get_next_frame();
-    next_frame->destroy();
+    // The buffer may not suit the output anymore
+    get_next_frame()->destroy();
 
     zwlr_screencopy_frame_v1_destroy(frame);
+    pending_frame = nullptr;
     status = REINIT;
   }
 
@@ -516,7 +542,12 @@ namespace wl {
     std::uint32_t y,
     std::uint32_t width,
     std::uint32_t height
-  ) {};
+  ) {
+    auto &damage = get_next_frame()->damage;
+    if (damage) {
+      damage->push_back(platf::damage_rect_t {(int) x, (int) y, (int) width, (int) height});
+    }
+  };
 
   void frame_t::destroy() {
     for (auto x = 0; x < 4; ++x) {
@@ -526,6 +557,18 @@ namespace wl {
         sd.fds[x] = -1;
       }
     }
+
+    if (buffer) {
+      wl_buffer_destroy(buffer);
+      buffer = nullptr;
+    }
+
+    if (bo) {
+      gbm_bo_destroy(bo);
+      bo = nullptr;
+    }
+
+    damage.reset();
   }
 
   frame_t::frame_t() {
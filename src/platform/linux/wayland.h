@@ -6,6 +6,8 @@
 
 // standard includes
 #include <bitset>
+#include <optional>
+#include <vector>
 
 #ifdef SUNSHINE_BUILD_WAYLAND
   #include <linux-dmabuf-unstable-v1.h>
@@ -25,12 +27,21 @@
 namespace wl {
   using display_internal_t = util::safe_ptr<wl_display, wl_display_disconnect>;
 
+  /**
+   * @brief A buffer the compositor copies the output into, kept for the following copies.
+   */
   class frame_t {
   public:
     frame_t();
     void destroy();
 
     egl::surface_descriptor_t sd;
+
+    struct gbm_bo *bo {nullptr};
+    struct wl_buffer *buffer {nullptr};
+
+    // The regions that changed since the previous copy, std::nullopt if the compositor doesn't tell
+    std::optional<std::vector<platf::damage_rect_t>> damage;
   };
 
   class dmabuf_t {
@@ -49,6 +60,9 @@ namespace wl {
     dmabuf_t &operator=(const dmabuf_t &) = delete;
     dmabuf_t &operator=(dmabuf_t &&) = delete;
 
+    /**
+     * @brief Request a copy of the output, unless the last request is still waiting for the compositor.
+     */
     void listen(zwlr_screencopy_manager_v1 *screencopy_manager, zwp_linux_dmabuf_v1 *dmabuf_interface, wl_output *output, bool blend_cursor = false);
     static void buffer_params_created(void *data, struct zwp_linux_buffer_params_v1 *params, struct wl_buffer *wl_buffer);
     static void buffer_params_failed(void *data, struct zwp_linux_buffer_params_v1 *params);
@@ -61,18 +75,20 @@ namespace wl {
     void failed(zwlr_screencopy_frame_v1 *frame);
 
     frame_t *get_next_frame() {
-      return current_frame == &frames[0] ? &frames[1] : &frames[0];
+      return &frames[(current_frame - frames.data() + 1) % frames.size()];
     }
 
     status_e status;
-    std::array<frame_t, 2> frames;
+
+    // The buffers are reused in turn, so the encoder can still read the ones copied before
+    std::array<frame_t, 3> frames;
     frame_t *current_frame;
     zwlr_screencopy_frame_v1_listener listener;
 
   private:
     bool init_gbm();
-    void cleanup_gbm();
     void create_and_copy_dmabuf(zwlr_screencopy_frame_v1 *frame);
+    void copy(zwlr_screencopy_frame_v1 *frame, wl_buffer *buffer);
 
     zwp_linux_dmabuf_v1 *dmabuf_interface {nullptr};
 
@@ -92,8 +108,9 @@ namespace wl {
     } dmabuf_info;
 
     struct gbm_device *gbm_device {nullptr};
-    struct gbm_bo *current_bo {nullptr};
-    struct wl_buffer *current_wl_buffer {nullptr};
+
+    // The request the compositor hasn't answered yet
+    zwlr_screencopy_frame_v1 *pending_frame {nullptr};
     bool y_invert {false};
   };
 
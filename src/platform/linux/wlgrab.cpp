@@ -5,6 +5,9 @@
 // standard includes
 #include <thread>
 
+// platform includes
+#include <unistd.h>
+
 // local includes
 #include "cuda.h"
 #include "src/logging.h"
@@ -21,13 +24,17 @@ namespace wl {
 
   struct img_t: public platf::img_t {
     ~img_t() override {
-      delete[] data;
+      free_frame_data(data, height * row_pitch);
       data = nullptr;
     }
   };
 
   class wlr_t: public platf::display_t {
   public:
+    capture_backend_t capture_backend() const override {
+      return {"wlr"sv, false};
+    }
+
     int init(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
       delay = std::chrono::nanoseconds {1s} / config.framerate;
       mem_type = hwdevice_type;
@@ -89,7 +96,8 @@ namespace wl {
     inline platf::capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       auto to = std::chrono::steady_clock::now() + timeout;
 
-      // Dispatch events until we get a new frame or the timeout expires
+      // Dispatch events until we get a new frame or the timeout expires.
+      // Requests follow the frame rate of the capture loop, the compositor answers them once the output changed.
       dmabuf.listen(interface.screencopy_manager, interface.dmabuf_interface, output, cursor);
       do {
         auto remaining_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(to - std::chrono::steady_clock::now());
@@ -144,7 +152,9 @@ namespace wl {
         }
 
         std::shared_ptr<platf::img_t> img_out;
+        auto snapshot_begin = std::chrono::steady_clock::now();
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        capture_stats().snapshot(status, snapshot_begin, img_out.get());
         switch (status) {
           case platf::capture_e::reinit:
           case platf::capture_e::error:
@@ -177,9 +187,9 @@ namespace wl {
 
       auto current_frame = dmabuf.current_frame;
 
-      auto rgb_opt = egl::import_source(egl_display.get(), current_frame->sd);
+      auto rgb = imports.import(egl_display.get(), current_frame->sd);
 
-      if (!rgb_opt) {
+      if (!rgb) {
         return platf::capture_e::reinit;
       }
 
@@ -187,7 +197,7 @@ namespace wl {
         return platf::capture_e::interrupted;
       }
 
-      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb_opt)->tex[0]);
+      gl::ctx.BindTexture(GL_TEXTURE_2D, (*rgb)->tex[0]);
 
       // Don't remove these lines, see https://github.com/LizardByte/Sunshine/issues/453
       int w, h;
@@ -195,9 +205,11 @@ namespace wl {
       gl::ctx.GetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
       BOOST_LOG(debug) << "width and height: w "sv << w << " h "sv << h;
 
-      gl::ctx.GetTextureSubImage((*rgb_opt)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
+      gl::ctx.GetTextureSubImage((*rgb)->tex[0], 0, 0, 0, 0, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, img_out->height * img_out->row_pitch, img_out->data);
       gl::ctx.BindTexture(GL_TEXTURE_2D, 0);
 
+      img_out->damage = current_frame->damage;
+
       return platf::capture_e::ok;
     }
 
@@ -243,13 +255,18 @@ namespace wl {
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->data = alloc_frame_data(height * img->row_pitch);
+      if (!img->data) {
+        return nullptr;
+      }
 
       return img;
     }
 
     egl::display_t egl_display;
     egl::ctx_t ctx;
+
+    egl::import_cache_t imports;
   };
 
   class wlr_vram_t: public wlr_t {
@@ -274,7 +291,9 @@ namespace wl {
         }
 
         std::shared_ptr<platf::img_t> img_out;
+        auto snapshot_begin = std::chrono::steady_clock::now();
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        capture_stats().snapshot(status, snapshot_begin, img_out.get());
         switch (status) {
           case platf::capture_e::reinit:
           case platf::capture_e::error:
@@ -317,9 +336,14 @@ namespace wl {
       img->sequence = sequence;
 
       img->sd = current_frame->sd;
+      img->damage = current_frame->damage;
 
-      // Prevent dmabuf from closing the file descriptors.
-      std::fill_n(current_frame->sd.fds, 4, -1);
+      // The buffer is copied into again later, the image gets descriptors of its own
+      for (auto &fd : img->sd.fds) {
+        if (fd >= 0) {
+          fd = dup(fd);
+        }
+      }
 
       return platf::capture_e::ok;
     }
@@ -3,12 +3,18 @@
  * @brief Definitions for x11 capture.
  */
 // standard includes
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <limits>
 #include <thread>
+#include <tuple>
+#include <utility>
 
 // plaform includes
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <unistd.h>
 #include <X11/extensions/Xfixes.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/X.h>
@@ -32,6 +38,11 @@
 
 using namespace std::literals;
 
+// Only the formats of screen pixmaps are needed, see graphics.cpp
+#define fourcc_code(a, b, c, d) ((std::uint32_t) (a) | ((std::uint32_t) (b) << 8) | ((std::uint32_t) (c) << 16) | ((std::uint32_t) (d) << 24))
+#define DRM_FORMAT_XRGB8888 fourcc_code('X', 'R', '2', '4')
+#define DRM_FORMAT_XRGB2101010 fourcc_code('X', 'R', '3', '0')
+
 namespace platf {
   int load_xcb();
   int load_x11();
@@ -49,6 +60,9 @@ namespace platf {
     _FN(CloseDisplay, int, (Display * display));
     _FN(Free, int, (void *data));
     _FN(InitThreads, Status, (void) );
+    _FN(Pending, int, (Display * display));
+    _FN(NextEvent, int, (Display * display, XEvent *event_return));
+    _FN(Sync, int, (Display * display, Bool discard));
 
     namespace rr {
       _FN(GetScreenResources, XRRScreenResources *, (Display * dpy, Window window));
@@ -123,6 +137,51 @@ namespace platf {
       }
     }  // namespace fix
 
+    /**
+     * The little of libXdamage that's used, declared here so its headers aren't needed to build.
+     */
+    namespace damage {
+      using Damage = XID;
+
+      constexpr int XDamageNotify = 0;
+      constexpr int XDamageReportNonEmpty = 3;
+
+      _FN(QueryExtension, Bool, (Display * dpy, int *event_base_return, int *error_base_return));
+      _FN(Create, Damage, (Display * dpy, Drawable drawable, int level));
+      _FN(Subtract, void, (Display * dpy, Damage damage, XserverRegion repair, XserverRegion parts));
+      _FN(Destroy, void, (Display * dpy, Damage damage));
+
+      static int init() {
+        static void *handle {nullptr};
+        static bool funcs_loaded = false;
+
+        if (funcs_loaded) {
+          return 0;
+        }
+
+        if (!handle) {
+          handle = dyn::handle({"libXdamage.so.1", "libXdamage.so"});
+          if (!handle) {
+            return -1;
+          }
+        }
+
+        std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+          {(dyn::apiproc *) &QueryExtension, "XDamageQueryExtension"},
+          {(dyn::apiproc *) &Create, "XDamageCreate"},
+          {(dyn::apiproc *) &Subtract, "XDamageSubtract"},
+          {(dyn::apiproc *) &Destroy, "XDamageDestroy"},
+        };
+
+        if (dyn::load(handle, funcs)) {
+          return -1;
+        }
+
+        funcs_loaded = true;
+        return 0;
+      }
+    }  // namespace damage
+
     static int init() {
       static void *handle {nullptr};
       static bool funcs_loaded = false;
@@ -145,6 +204,9 @@ namespace platf {
         {(dyn::apiproc *) &Free, "XFree"},
         {(dyn::apiproc *) &CloseDisplay, "XCloseDisplay"},
         {(dyn::apiproc *) &InitThreads, "XInitThreads"},
+        {(dyn::apiproc *) &Pending, "XPending"},
+        {(dyn::apiproc *) &NextEvent, "XNextEvent"},
+        {(dyn::apiproc *) &Sync, "XSync"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -164,6 +226,7 @@ namespace platf {
     _FN(shm_get_image_unchecked, xcb_shm_get_image_cookie_t, (xcb_connection_t * c, xcb_drawable_t drawable, int16_t x, int16_t y, uint16_t width, uint16_t height, uint32_t plane_mask, uint8_t format, xcb_shm_seg_t shmseg, uint32_t offset));
 
     _FN(shm_attach, xcb_void_cookie_t, (xcb_connection_t * c, xcb_shm_seg_t shmseg, uint32_t shmid, uint8_t read_only));
+    _FN(shm_detach, xcb_void_cookie_t, (xcb_connection_t * c, xcb_shm_seg_t shmseg));
 
     _FN(get_extension_data, xcb_query_extension_reply_t *, (xcb_connection_t * c, xcb_extension_t *ext));
 
@@ -174,6 +237,112 @@ namespace platf {
     _FN(setup_roots_iterator, xcb_screen_iterator_t, (const xcb_setup_t *R));
     _FN(generate_id, std::uint32_t, (xcb_connection_t * c));
 
+    _FN(create_pixmap, xcb_void_cookie_t, (xcb_connection_t * c, uint8_t depth, xcb_pixmap_t pid, xcb_drawable_t drawable, uint16_t width, uint16_t height));
+    _FN(free_pixmap, xcb_void_cookie_t, (xcb_connection_t * c, xcb_pixmap_t pixmap));
+    _FN(create_gc, xcb_void_cookie_t, (xcb_connection_t * c, xcb_gcontext_t cid, xcb_drawable_t drawable, uint32_t value_mask, const void *value_list));
+    _FN(free_gc, xcb_void_cookie_t, (xcb_connection_t * c, xcb_gcontext_t gc));
+    _FN(copy_area, xcb_void_cookie_t, (xcb_connection_t * c, xcb_drawable_t src_drawable, xcb_drawable_t dst_drawable, xcb_gcontext_t gc, int16_t src_x, int16_t src_y, int16_t dst_x, int16_t dst_y, uint16_t width, uint16_t height));
+    _FN(get_input_focus, xcb_get_input_focus_cookie_t, (xcb_connection_t * c));
+    _FN(get_input_focus_reply, xcb_get_input_focus_reply_t *, (xcb_connection_t * c, xcb_get_input_focus_cookie_t cookie, xcb_generic_error_t **e));
+
+    /**
+     * The little of libxcb-dri3 that's used, declared here so its headers aren't needed to build.
+     */
+    namespace dri3 {
+      struct query_version_cookie_t {
+        unsigned int sequence;
+      };
+
+      struct query_version_reply_t {
+        uint8_t response_type;
+        uint8_t pad0;
+        uint16_t sequence;
+        uint32_t length;
+        uint32_t major_version;
+        uint32_t minor_version;
+      };
+
+      struct open_cookie_t {
+        unsigned int sequence;
+      };
+
+      struct open_reply_t {
+        uint8_t response_type;
+        uint8_t nfd;
+        uint16_t sequence;
+        uint32_t length;
+        uint8_t pad0[24];
+      };
+
+      struct buffers_from_pixmap_cookie_t {
+        unsigned int sequence;
+      };
+
+      struct buffers_from_pixmap_reply_t {
+        uint8_t response_type;
+        uint8_t nfd;
+        uint16_t sequence;
+        uint32_t length;
+        uint16_t width;
+        uint16_t height;
+        uint8_t pad0[4];
+        uint64_t modifier;
+        uint8_t depth;
+        uint8_t bpp;
+        uint8_t pad1[6];
+      };
+
+      static xcb_extension_t *id;
+
+      _FN(query_version, query_version_cookie_t, (xcb_connection_t * c, uint32_t major_version, uint32_t minor_version));
+      _FN(query_version_reply, query_version_reply_t *, (xcb_connection_t * c, query_version_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(open, open_cookie_t, (xcb_connection_t * c, xcb_drawable_t drawable, uint32_t provider));
+      _FN(open_reply, open_reply_t *, (xcb_connection_t * c, open_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(open_reply_fds, int *, (xcb_connection_t * c, open_reply_t *reply));
+      _FN(buffers_from_pixmap, buffers_from_pixmap_cookie_t, (xcb_connection_t * c, xcb_pixmap_t pixmap));
+      _FN(buffers_from_pixmap_reply, buffers_from_pixmap_reply_t *, (xcb_connection_t * c, buffers_from_pixmap_cookie_t cookie, xcb_generic_error_t **e));
+      _FN(buffers_from_pixmap_reply_fds, int *, (xcb_connection_t * c, buffers_from_pixmap_reply_t *reply));
+      _FN(buffers_from_pixmap_strides, uint32_t *, (const buffers_from_pixmap_reply_t *R));
+      _FN(buffers_from_pixmap_offsets, uint32_t *, (const buffers_from_pixmap_reply_t *R));
+
+      static int init() {
+        static void *handle {nullptr};
+        static bool funcs_loaded = false;
+
+        if (funcs_loaded) {
+          return 0;
+        }
+
+        if (!handle) {
+          handle = dyn::handle({"libxcb-dri3.so.0", "libxcb-dri3.so"});
+          if (!handle) {
+            return -1;
+          }
+        }
+
+        std::vector<std::tuple<dyn::apiproc *, const char *>> funcs {
+          {(dyn::apiproc *) &id, "xcb_dri3_id"},
+          {(dyn::apiproc *) &query_version, "xcb_dri3_query_version"},
+          {(dyn::apiproc *) &query_version_reply, "xcb_dri3_query_version_reply"},
+          {(dyn::apiproc *) &open, "xcb_dri3_open"},
+          {(dyn::apiproc *) &open_reply, "xcb_dri3_open_reply"},
+          {(dyn::apiproc *) &open_reply_fds, "xcb_dri3_open_reply_fds"},
+          {(dyn::apiproc *) &buffers_from_pixmap, "xcb_dri3_buffers_from_pixmap"},
+          {(dyn::apiproc *) &buffers_from_pixmap_reply, "xcb_dri3_buffers_from_pixmap_reply"},
+          {(dyn::apiproc *) &buffers_from_pixmap_reply_fds, "xcb_dri3_buffers_from_pixmap_reply_fds"},
+          {(dyn::apiproc *) &buffers_from_pixmap_strides, "xcb_dri3_buffers_from_pixmap_strides"},
+          {(dyn::apiproc *) &buffers_from_pixmap_offsets, "xcb_dri3_buffers_from_pixmap_offsets"},
+        };
+
+        if (dyn::load(handle, funcs)) {
+          return -1;
+        }
+
+        funcs_loaded = true;
+        return 0;
+      }
+    }  // namespace dri3
+
     int init_shm() {
       static void *handle {nullptr};
       static bool funcs_loaded = false;
@@ -194,6 +363,7 @@ namespace platf {
         {(dyn::apiproc *) &shm_get_image_reply, "xcb_shm_get_image_reply"},
         {(dyn::apiproc *) &shm_get_image_unchecked, "xcb_shm_get_image_unchecked"},
         {(dyn::apiproc *) &shm_attach, "xcb_shm_attach"},
+        {(dyn::apiproc *) &shm_detach, "xcb_shm_detach"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -227,6 +397,13 @@ namespace platf {
         {(dyn::apiproc *) &connect, "xcb_connect"},
         {(dyn::apiproc *) &setup_roots_iterator, "xcb_setup_roots_iterator"},
         {(dyn::apiproc *) &generate_id, "xcb_generate_id"},
+        {(dyn::apiproc *) &create_pixmap, "xcb_create_pixmap"},
+        {(dyn::apiproc *) &free_pixmap, "xcb_free_pixmap"},
+        {(dyn::apiproc *) &create_gc, "xcb_create_gc"},
+        {(dyn::apiproc *) &free_gc, "xcb_free_gc"},
+        {(dyn::apiproc *) &copy_area, "xcb_copy_area"},
+        {(dyn::apiproc *) &get_input_focus, "xcb_get_input_focus"},
+        {(dyn::apiproc *) &get_input_focus_reply, "xcb_get_input_focus_reply"},
       };
 
       if (dyn::load(handle, funcs)) {
@@ -243,7 +420,6 @@ namespace platf {
   void freeImage(XImage *);
   void freeX(XFixesCursorImage *);
 
-  using xcb_connect_t = util::dyn_safe_ptr<xcb_connection_t, &xcb::disconnect>;
   using xcb_img_t = util::c_ptr<xcb_shm_get_image_reply_t>;
 
   using ximg_t = util::safe_ptr<XImage, freeImage>;
@@ -306,11 +482,21 @@ namespace platf {
     ximg_t img;
   };
 
+  /**
+   * @brief An image captured straight into its own shared memory segment.
+   */
   struct shm_img_t: public img_t {
     ~shm_img_t() override {
-      delete[] data;
+      xcb::shm_detach(xcb.get(), seg);
       data = nullptr;
     }
+
+    // Keeps the connection the segment is attached to alive
+    std::shared_ptr<xcb_connection_t> xcb;
+    std::uint32_t seg;
+
+    shm_id_t shm_id;
+    shm_data_t shm_data;
   };
 
   static void blend_cursor(Display *display, img_t &img, int offsetX, int offsetY) {
@@ -337,29 +523,101 @@ namespace platf {
 
     auto delta_height = std::min<uint16_t>(overlay->height, std::max(0, screen_height - overlay->y));
     auto delta_width = std::min<uint16_t>(overlay->width, std::max(0, screen_width - overlay->x));
+
+    // XFixes hands out the pixels as longs, which are 64 bits on most platforms
+    std::vector<uint32_t> overlay_row(delta_width);
     for (auto y = 0; y < delta_height; ++y) {
       auto overlay_begin = &overlay->pixels[y * overlay->width];
       auto overlay_end = &overlay->pixels[y * overlay->width + delta_width];
+      std::transform(overlay_begin, overlay_end, overlay_row.begin(), [](unsigned long pixel) {
+        return (uint32_t) pixel;
+      });
 
       auto pixels_begin = &pixels[(y + overlay->y) * (img.row_pitch / img.pixel_pitch) + overlay->x];
 
-      std::for_each(overlay_begin, overlay_end, [&](long pixel) {
-        int *pixel_p = (int *) &pixel;
+      blend_cursor_row((uint32_t *) pixels_begin, overlay_row.data(), delta_width);
+    }
+  }
 
-        auto colors_in = (uint8_t *) pixels_begin;
+  /**
+   * @brief Get the cursor that's left out of the images.
+   * @param display The display to get the cursor of.
+   * @param offsetX The X offset of the captured monitor.
+   * @param offsetY The Y offset of the captured monitor.
+   * @param shape The last shape, replaced if the cursor changed.
+   * @param shape_serial The XFixes serial of the last shape.
+   * @return The cursor, or `std::nullopt` if it couldn't be fetched.
+   */
+  static std::optional<cursor_state_t> get_cursor_state(Display *display, int offsetX, int offsetY, std::shared_ptr<const cursor_shape_t> &shape, unsigned long &shape_serial) {
+    static std::atomic<std::uint32_t> next_serial;
 
-        auto alpha = (*(uint *) pixel_p) >> 24u;
-        if (alpha == 255) {
-          *pixels_begin = *pixel_p;
-        } else {
-          auto colors_out = (uint8_t *) pixel_p;
-          colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-          colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-        }
-        ++pixels_begin;
+    xcursor_t overlay {x11::fix::GetCursorImage(display)};
+
+    if (!overlay) {
+      BOOST_LOG(error) << "Couldn't get cursor from XFixesGetCursorImage"sv;
+      return std::nullopt;
+    }
+
+    if (!shape || shape_serial != overlay->cursor_serial) {
+      auto new_shape = std::make_shared<cursor_shape_t>();
+      new_shape->serial = ++next_serial;
+      new_shape->width = overlay->width;
+      new_shape->height = overlay->height;
+      new_shape->hot_x = overlay->xhot;
+      new_shape->hot_y = overlay->yhot;
+
+      // XFixes hands out premultiplied ARGB as longs
+      new_shape->pixels.resize(overlay->width * overlay->height * 4);
+      std::transform(overlay->pixels, overlay->pixels + overlay->width * overlay->height, (uint32_t *) new_shape->pixels.data(), [](unsigned long pixel) {
+        return (uint32_t) pixel;
       });
+
+      shape = std::move(new_shape);
+      shape_serial = overlay->cursor_serial;
     }
+
+    return cursor_state_t {
+      true,
+      overlay->x - overlay->xhot - offsetX,
+      overlay->y - overlay->yhot - offsetY,
+      shape,
+    };
+  }
+
+  /**
+   * @brief Copy the cursor into an image for the shaders to blend.
+   * @param display The display to get the cursor of.
+   * @param img The image to copy the cursor into, its pixels are only copied again when the cursor changed.
+   * @return `false` if the cursor couldn't be retrieved.
+   */
+  static bool capture_cursor(Display *display, egl::cursor_t &img) {
+    xcursor_t xcursor = x11::fix::GetCursorImage(display);
+    if (!xcursor) {
+      return false;
+    }
+
+    if (img.serial != xcursor->cursor_serial) {
+      auto buf_size = xcursor->width * xcursor->height * sizeof(int);
+
+      if (img.buffer.size() < buf_size) {
+        img.buffer.resize(buf_size);
+      }
+
+      std::transform(xcursor->pixels, xcursor->pixels + buf_size / 4, (int *) img.buffer.data(), [](long pixel) -> int {
+        return pixel;
+      });
+    }
+
+    img.data = img.buffer.data();
+    img.width = img.src_w = xcursor->width;
+    img.height = img.src_h = xcursor->height;
+    img.x = xcursor->x - xcursor->xhot;
+    img.y = xcursor->y - xcursor->yhot;
+    img.pixel_pitch = 4;
+    img.row_pitch = img.pixel_pitch * img.width;
+    img.serial = xcursor->cursor_serial;
+
+    return true;
   }
 
   struct x11_attr_t: public display_t {
@@ -371,6 +629,10 @@ namespace platf {
 
     mem_type_e mem_type;
 
+    // The shape sent to the client when the cursor is left out of the images
+    std::shared_ptr<const cursor_shape_t> cursor_shape;
+    unsigned long cursor_shape_serial {};
+
     /**
      * Last X (NOT the streamed monitor!) size.
      * This way we can trigger reinitialization if the dimensions changed while streaming
@@ -385,6 +647,10 @@ namespace platf {
       x11::InitThreads();
     }
 
+    capture_backend_t capture_backend() const override {
+      return {"x11"sv, false};
+    }
+
     int init(const std::string &display_name, const ::video::config_t &config) {
       if (!xdisplay) {
         BOOST_LOG(error) << "Could not open X11 display"sv;
@@ -476,7 +742,9 @@ namespace platf {
         }
 
         std::shared_ptr<platf::img_t> img_out;
+        auto snapshot_begin = std::chrono::steady_clock::now();
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        capture_stats().snapshot(status, snapshot_begin, img_out.get());
         switch (status) {
           case platf::capture_e::reinit:
           case platf::capture_e::error:
@@ -527,6 +795,9 @@ namespace platf {
 
       if (cursor) {
         blend_cursor(xdisplay.get(), *img, offset_x, offset_y);
+        img->cursor.reset();
+      } else {
+        img->cursor = get_cursor_state(xdisplay.get(), offset_x, offset_y, cursor_shape, cursor_shape_serial);
       }
 
       return capture_e::ok;
@@ -569,30 +840,80 @@ namespace platf {
 
   struct shm_attr_t: public x11_attr_t {
     x11::xdisplay_t shm_xdisplay;  // Prevent race condition with x11_attr_t::xdisplay
-    xcb_connect_t xcb;
+    std::shared_ptr<xcb_connection_t> xcb;
     xcb_screen_t *display;
-    std::uint32_t seg;
 
-    shm_id_t shm_id;
+    // Reports when the root window is drawn to, 0 without the XDamage extension
+    x11::damage::Damage damage {};
+    int damage_event_base {};
+    bool damaged {true};
 
-    shm_data_t data;
+    // The cursor in the last captured image
+    std::tuple<short, short, unsigned long> last_cursor {};
 
     task_pool_util::TaskPool::task_id_t refresh_task_id;
 
     void delayed_refresh() {
       refresh();
 
-      refresh_task_id = task_pool.pushDelayed(&shm_attr_t::delayed_refresh, 2s, this).task_id;
+      refresh_task_id = background_pool.pushDelayed(&shm_attr_t::delayed_refresh, 2s, this).task_id;
     }
 
     shm_attr_t(mem_type_e mem_type):
         x11_attr_t(mem_type),
         shm_xdisplay {x11::OpenDisplay(nullptr)} {
-      refresh_task_id = task_pool.pushDelayed(&shm_attr_t::delayed_refresh, 2s, this).task_id;
+      refresh_task_id = background_pool.pushDelayed(&shm_attr_t::delayed_refresh, 2s, this).task_id;
     }
 
     ~shm_attr_t() override {
-      while (!task_pool.cancel(refresh_task_id));
+      while (!background_pool.cancel(refresh_task_id));
+
+      if (damage) {
+        x11::damage::Destroy(shm_xdisplay.get(), damage);
+      }
+    }
+
+    /**
+     * @brief Check whether the root window was drawn to since the last call.
+     * @return `true` if it was, always `true` without the XDamage extension.
+     */
+    bool take_damage() {
+      if (!damage) {
+        return true;
+      }
+
+      auto dpy = shm_xdisplay.get();
+      while (x11::Pending(dpy)) {
+        XEvent event;
+        x11::NextEvent(dpy, &event);
+
+        if (event.type == damage_event_base + x11::damage::XDamageNotify) {
+          damaged = true;
+        }
+      }
+
+      if (damaged) {
+        // The image is fetched through xcb, wait for the server to clear the damage first
+        // so that anything drawn after it reports damage again
+        x11::damage::Subtract(dpy, damage, None, None);
+        x11::Sync(dpy, False);
+      }
+
+      return std::exchange(damaged, false);
+    }
+
+    /**
+     * @brief Check whether the cursor moved or changed shape since the last captured image.
+     * @return `true` if it did.
+     */
+    bool cursor_changed() {
+      xcursor_t overlay {x11::fix::GetCursorImage(shm_xdisplay.get())};
+      if (!overlay) {
+        return true;
+      }
+
+      auto cursor = std::make_tuple(overlay->x, overlay->y, overlay->cursor_serial);
+      return std::exchange(last_cursor, cursor) != cursor;
     }
 
     capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
@@ -615,7 +936,9 @@ namespace platf {
         }
 
         std::shared_ptr<platf::img_t> img_out;
+        auto snapshot_begin = std::chrono::steady_clock::now();
         auto status = snapshot(pull_free_image_cb, img_out, 1000ms, *cursor);
+        capture_stats().snapshot(status, snapshot_begin, img_out.get());
         switch (status) {
           case platf::capture_e::reinit:
           case platf::capture_e::error:
@@ -640,13 +963,25 @@ namespace platf {
       return capture_e::ok;
     }
 
-    capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
+    virtual capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) {
       // The whole X server changed, so we must reinit everything
       if (xattr.width != env_width || xattr.height != env_height) {
         BOOST_LOG(warning) << "X dimensions changed in SHM mode, request reinit"sv;
         return capture_e::reinit;
       } else {
-        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, seg, 0);
+        // Both checks run every frame to keep the damage and the last cursor up to date
+        auto changed = take_damage();
+        if (!cursor_changed() && !changed) {
+          return capture_e::timeout;
+        }
+
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+        auto img = (shm_img_t *) img_out.get();
+
+        // The image is captured into its own segment, so the encoder can keep reading the last one
+        auto img_cookie = xcb::shm_get_image_unchecked(xcb.get(), display->root, offset_x, offset_y, width, height, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, img->seg, 0);
         auto frame_timestamp = std::chrono::steady_clock::now();
 
         xcb_img_t img_reply {xcb::shm_get_image_reply(xcb.get(), img_cookie, nullptr)};
@@ -655,15 +990,13 @@ namespace platf {
           return capture_e::reinit;
         }
 
-        if (!pull_free_image_cb(img_out)) {
-          return platf::capture_e::interrupted;
-        }
-
-        std::copy_n((std::uint8_t *) data.data, frame_size(), img_out->data);
         img_out->frame_timestamp = frame_timestamp;
 
         if (cursor) {
           blend_cursor(shm_xdisplay.get(), *img_out, offset_x, offset_y);
+          img_out->cursor.reset();
+        } else {
+          img_out->cursor = get_cursor_state(shm_xdisplay.get(), offset_x, offset_y, cursor_shape, cursor_shape_serial);
         }
 
         return capture_e::ok;
@@ -672,11 +1005,33 @@ namespace platf {
 
     std::shared_ptr<img_t> alloc_img() override {
       auto img = std::make_shared<shm_img_t>();
+
+      // Huge pages are only there when the system reserved some, regular pages are the fallback
+      constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+      img->shm_id.id = shmget(IPC_PRIVATE, (frame_size() + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, IPC_CREAT | SHM_HUGETLB | 0777);
+      if (img->shm_id.id == -1) {
+        img->shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
+      }
+      if (img->shm_id.id == -1) {
+        BOOST_LOG(error) << "shmget failed"sv;
+        return nullptr;
+      }
+
+      img->shm_data.data = shmat(img->shm_id.id, nullptr, 0);
+      if ((uintptr_t) img->shm_data.data == -1) {
+        BOOST_LOG(error) << "shmat failed"sv;
+        return nullptr;
+      }
+
+      img->xcb = xcb;
+      img->seg = xcb::generate_id(xcb.get());
+      xcb::shm_attach(xcb.get(), img->seg, img->shm_id.id, false);
+
       img->width = width;
       img->height = height;
       img->pixel_pitch = 4;
       img->row_pitch = img->pixel_pitch * width;
-      img->data = new std::uint8_t[height * img->row_pitch];
+      img->data = (std::uint8_t *) img->shm_data.data;
 
       return img;
     }
@@ -691,7 +1046,7 @@ namespace platf {
       }
 
       shm_xdisplay.reset(x11::OpenDisplay(nullptr));
-      xcb.reset(xcb::connect(nullptr, nullptr));
+      xcb.reset(xcb::connect(nullptr, nullptr), xcb::disconnect);
       if (xcb::connection_has_error(xcb.get())) {
         return -1;
       }
@@ -704,21 +1059,17 @@ namespace platf {
 
       auto iter = xcb::setup_roots_iterator(xcb::get_setup(xcb.get()));
       display = iter.data;
-      seg = xcb::generate_id(xcb.get());
 
-      shm_id.id = shmget(IPC_PRIVATE, frame_size(), IPC_CREAT | 0777);
-      if (shm_id.id == -1) {
-        BOOST_LOG(error) << "shmget failed"sv;
+      // Fall back to XGetImage if the segments can't be created
+      if (!shm_attr_t::alloc_img()) {
         return -1;
       }
 
-      xcb::shm_attach(xcb.get(), seg, shm_id.id, false);
-      data.data = shmat(shm_id.id, nullptr, 0);
-
-      if ((uintptr_t) data.data == -1) {
-        BOOST_LOG(error) << "shmat failed"sv;
-
-        return -1;
+      int damage_error_base;
+      if (!x11::damage::init() && x11::damage::QueryExtension(shm_xdisplay.get(), &damage_event_base, &damage_error_base)) {
+        damage = x11::damage::Create(shm_xdisplay.get(), DefaultRootWindow(shm_xdisplay.get()), x11::damage::XDamageReportNonEmpty);
+      } else {
+        BOOST_LOG(info) << "XDamage isn't available, capturing every frame"sv;
       }
 
       return 0;
@@ -729,6 +1080,214 @@ namespace platf {
     }
   };
 
+#if defined(SUNSHINE_BUILD_VAAPI) || defined(SUNSHINE_BUILD_CUDA)
+  /**
+   * @brief An image the X server copies the screen into on the GPU, shared with the encoder as a DMA-BUF.
+   */
+  struct dri3_img_t: public egl::img_descriptor_t {
+    ~dri3_img_t() override {
+      if (pixmap) {
+        xcb::free_pixmap(xcb.get(), pixmap);
+      }
+    }
+
+    // Keeps the connection the pixmap was created on alive
+    std::shared_ptr<xcb_connection_t> xcb;
+    xcb_pixmap_t pixmap {};
+  };
+
+  /**
+   * @brief Captures into pixmaps exported through DRI3, the frames never leave the GPU.
+   * @details The X server doesn't export the screen itself, so every image is a pixmap of its own
+   *          the root window is copied into. The encoder imports each pixmap once.
+   */
+  struct dri3_attr_t: public shm_attr_t {
+    using shm_attr_t::shm_attr_t;
+
+    ~dri3_attr_t() override {
+      if (gc) {
+        xcb::free_gc(xcb.get(), gc);
+      }
+    }
+
+    capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor) override {
+      // The whole X server changed, so we must reinit everything
+      if (xattr.width != env_width || xattr.height != env_height) {
+        BOOST_LOG(warning) << "X dimensions changed in DRI3 mode, request reinit"sv;
+        return capture_e::reinit;
+      }
+
+      // Both checks run every frame to keep the damage and the last cursor up to date
+      auto changed = take_damage();
+      if (!cursor_changed() && !changed) {
+        return capture_e::timeout;
+      }
+
+      if (!pull_free_image_cb(img_out)) {
+        return platf::capture_e::interrupted;
+      }
+      auto img = (dri3_img_t *) img_out.get();
+
+      xcb::copy_area(xcb.get(), display->root, img->pixmap, gc, offset_x, offset_y, 0, 0, width, height);
+      auto frame_timestamp = std::chrono::steady_clock::now();
+
+      // The server flushes the copy to the GPU before it answers, the encoder's
+      // reads of the DMA-BUF are then ordered after it by the implicit fences
+      util::c_ptr<xcb_get_input_focus_reply_t> sync_reply {xcb::get_input_focus_reply(xcb.get(), xcb::get_input_focus(xcb.get()), nullptr)};
+      if (!sync_reply) {
+        BOOST_LOG(error) << "Lost the connection to the X server"sv;
+        return capture_e::reinit;
+      }
+
+      img->frame_timestamp = frame_timestamp;
+
+      // The encoder finds the import of the pixmap again by its DMA-BUFs
+      img->sequence = ++sequence;
+
+      if (cursor && capture_cursor(shm_xdisplay.get(), *img)) {
+        img->x -= offset_x;
+        img->y -= offset_y;
+      } else {
+        img->data = nullptr;
+      }
+
+      if (!cursor) {
+        img->cursor = get_cursor_state(shm_xdisplay.get(), offset_x, offset_y, cursor_shape, cursor_shape_serial);
+      } else {
+        img->cursor.reset();
+      }
+
+      return capture_e::ok;
+    }
+
+    std::shared_ptr<img_t> alloc_img() override {
+      auto img = std::make_shared<dri3_img_t>();
+
+      img->width = width;
+      img->height = height;
+      img->sequence = 0;
+      img->serial = std::numeric_limits<decltype(img->serial)>::max();
+      img->data = nullptr;
+
+      // File descriptors aren't open
+      std::fill_n(img->sd.fds, 4, -1);
+
+      img->xcb = xcb;
+      img->pixmap = xcb::generate_id(xcb.get());
+      xcb::create_pixmap(xcb.get(), display->root_depth, img->pixmap, display->root, width, height);
+
+      util::c_ptr<xcb::dri3::buffers_from_pixmap_reply_t> reply {
+        xcb::dri3::buffers_from_pixmap_reply(xcb.get(), xcb::dri3::buffers_from_pixmap(xcb.get(), img->pixmap), nullptr)
+      };
+      if (!reply) {
+        BOOST_LOG(error) << "Couldn't export the pixmap through DRI3"sv;
+        return nullptr;
+      }
+
+      auto fds = xcb::dri3::buffers_from_pixmap_reply_fds(xcb.get(), reply.get());
+      auto strides = xcb::dri3::buffers_from_pixmap_strides(reply.get());
+      auto offsets = xcb::dri3::buffers_from_pixmap_offsets(reply.get());
+      for (int x = 0; x < reply->nfd; ++x) {
+        if (x >= 4) {
+          close(fds[x]);
+          continue;
+        }
+
+        img->sd.fds[x] = fds[x];
+        img->sd.pitches[x] = strides[x];
+        img->sd.offsets[x] = offsets[x];
+      }
+
+      if (reply->bpp != 32 || (reply->depth != 24 && reply->depth != 30) || reply->nfd > 4) {
+        BOOST_LOG(error) << "Unsupported DRI3 pixmap of depth "sv << (int) reply->depth << " with "sv << (int) reply->nfd << " planes"sv;
+        return nullptr;
+      }
+
+      img->sd.width = reply->width;
+      img->sd.height = reply->height;
+      img->sd.fourcc = reply->depth == 24 ? DRM_FORMAT_XRGB8888 : DRM_FORMAT_XRGB2101010;
+      img->sd.modifier = reply->modifier;
+
+      return img;
+    }
+
+    std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+      // The root window is cropped while it's copied, so the pixmaps hold only the streamed monitor
+  #ifdef SUNSHINE_BUILD_VAAPI
+      if (mem_type == mem_type_e::vaapi) {
+        return va::make_avcodec_encode_device(width, height, 0, 0, true);
+      }
+  #endif
+
+  #ifdef SUNSHINE_BUILD_CUDA
+      if (mem_type == mem_type_e::cuda) {
+        return cuda::make_avcodec_gl_encode_device(width, height, 0, 0);
+      }
+  #endif
+
+      return std::make_unique<avcodec_encode_device_t>();
+    }
+
+    int dummy_img(platf::img_t *img) override {
+      // Empty images are recognized as dummies by the zero sequence number
+      ((egl::img_descriptor_t *) img)->sequence = 0;
+      return 0;
+    }
+
+    int init(const std::string &display_name, const ::video::config_t &config) {
+      if (auto status = shm_attr_t::init(display_name, config)) {
+        return status;
+      }
+
+      if (xcb::dri3::init() || !xcb::get_extension_data(xcb.get(), xcb::dri3::id)->present) {
+        BOOST_LOG(info) << "DRI3 isn't available, capturing through shared memory"sv;
+        return -1;
+      }
+
+      // Buffers with modifiers and multiple planes need DRI3 1.2
+      util::c_ptr<xcb::dri3::query_version_reply_t> version {
+        xcb::dri3::query_version_reply(xcb.get(), xcb::dri3::query_version(xcb.get(), 1, 2), nullptr)
+      };
+      if (!version || (version->major_version == 1 && version->minor_version < 2)) {
+        BOOST_LOG(info) << "DRI3 1.2 isn't available, capturing through shared memory"sv;
+        return -1;
+      }
+
+  #ifdef SUNSHINE_BUILD_VAAPI
+      // The pixmaps live on the GPU of the X server, which must be the one encoding
+      if (mem_type == mem_type_e::vaapi) {
+        util::c_ptr<xcb::dri3::open_reply_t> open_reply {xcb::dri3::open_reply(xcb.get(), xcb::dri3::open(xcb.get(), display->root, 0), nullptr)};
+        if (!open_reply || open_reply->nfd < 1) {
+          return -1;
+        }
+
+        file_t device {*xcb::dri3::open_reply_fds(xcb.get(), open_reply.get())};
+        if (!va::validate(device.el)) {
+          BOOST_LOG(info) << "The X server's GPU doesn't support hardware encoding, capturing through shared memory"sv;
+          return -1;
+        }
+      }
+  #endif
+
+      gc = xcb::generate_id(xcb.get());
+
+      // Windows are part of the screen, the default GC would leave them out of the copy
+      std::uint32_t values[] {XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS, 0};
+      xcb::create_gc(xcb.get(), gc, display->root, XCB_GC_SUBWINDOW_MODE | XCB_GC_GRAPHICS_EXPOSURES, values);
+
+      if (!alloc_img()) {
+        return -1;
+      }
+
+      BOOST_LOG(info) << "Capturing through DRI3"sv;
+      return 0;
+    }
+
+    xcb_gcontext_t gc {};
+    std::uint64_t sequence {};
+  };
+#endif
+
   std::shared_ptr<display_t> x11_display(platf::mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
     if (hwdevice_type != platf::mem_type_e::system && hwdevice_type != platf::mem_type_e::vaapi && hwdevice_type != platf::mem_type_e::cuda) {
       BOOST_LOG(error) << "Could not initialize x11 display with the given hw device type"sv;
@@ -741,6 +1300,23 @@ namespace platf {
       return nullptr;
     }
 
+#if defined(SUNSHINE_BUILD_VAAPI) || defined(SUNSHINE_BUILD_CUDA)
+    // Keep the frames on the GPU when the encoder can import them
+    if (hwdevice_type == platf::mem_type_e::vaapi || hwdevice_type == platf::mem_type_e::cuda) {
+      auto dri3_disp = std::make_shared<dri3_attr_t>(hwdevice_type);
+
+      auto status = dri3_disp->init(display_name, config);
+      if (status > 0) {
+        // x11_attr_t::init() failed, don't bother trying again.
+        return nullptr;
+      }
+
+      if (status == 0) {
+        return dri3_disp;
+      }
+    }
+#endif
+
     // Attempt to use shared memory X11 to avoid copying the frame
     auto shm_disp = std::make_shared<shm_attr_t>(hwdevice_type);
 
@@ -838,30 +1414,7 @@ namespace platf {
     }
 
     void cursor_t::capture(egl::cursor_t &img) {
-      auto display = (xdisplay_t::pointer) ctx.get();
-
-      xcursor_t xcursor = fix::GetCursorImage(display);
-
-      if (img.serial != xcursor->cursor_serial) {
-        auto buf_size = xcursor->width * xcursor->height * sizeof(int);
-
-        if (img.buffer.size() < buf_size) {
-          img.buffer.resize(buf_size);
-        }
-
-        std::transform(xcursor->pixels, xcursor->pixels + buf_size / 4, (int *) img.buffer.data(), [](long pixel) -> int {
-          return pixel;
-        });
-      }
-
-      img.data = img.buffer.data();
-      img.width = img.src_w = xcursor->width;
-      img.height = img.src_h = xcursor->height;
-      img.x = xcursor->x - xcursor->xhot;
-      img.y = xcursor->y - xcursor->yhot;
-      img.pixel_pitch = 4;
-      img.row_pitch = img.pixel_pitch * img.width;
-      img.serial = xcursor->cursor_serial;
+      capture_cursor((xdisplay_t::pointer) ctx.get(), img);
     }
 
     void cursor_t::blend(img_t &img, int offsetX, int offsetY) {
@@ -0,0 +1,591 @@
+/**
+ * @file src/platform/linux/xdp.cpp
+ * @brief Definitions for sending UDP packets through AF_XDP.
+ */
+// standard includes
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// platform includes
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <linux/if_xdp.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netpacket/packet.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// local includes
+#include "src/logging.h"
+#include "xdp.h"
+
+#ifndef SOL_XDP
+  #define SOL_XDP 283
+#endif
+
+using namespace std::literals;
+
+namespace xdp {
+  namespace {
+    // Each frame holds one packet, up to a jumbo frame of 4K
+    constexpr std::uint32_t FRAME_SIZE = 4096;
+    constexpr std::uint32_t FRAME_COUNT = 4096;
+
+    // The completion ring can hold every frame, so the kernel never waits for room in it
+    constexpr std::uint32_t TX_RING_SIZE = 2048;
+    constexpr std::uint32_t COMPLETION_RING_SIZE = FRAME_COUNT;
+
+    // Nothing is received, but the kernel doesn't bind a socket without a fill ring
+    constexpr std::uint32_t FILL_RING_SIZE = 64;
+
+    constexpr std::size_t HEADERS_SIZE = sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr);
+
+    // How long to wait for the kernel to be done with the frames of earlier packets before giving up
+    constexpr auto FRAME_WAIT = 5ms;
+
+    // The neighbor of a session rarely changes, but it's looked up again in case it does
+    constexpr auto ROUTE_LIFETIME = 5s;
+
+    struct route_t {
+      int ifindex;
+      std::uint32_t mtu;
+      struct sockaddr_in source;
+      struct sockaddr_in target;
+      std::uint8_t source_mac[ETH_ALEN];
+      std::uint8_t target_mac[ETH_ALEN];
+    };
+
+    /**
+     * @brief Add data to a one's complement sum of 16 bit words.
+     * @details The words are summed in the byte order of the data, so the folded sum is in that order as well.
+     */
+    std::uint64_t checksum_add(const void *data, std::size_t size, std::uint64_t sum = 0) {
+      auto bytes = (const std::uint8_t *) data;
+
+      for (; size >= 4; bytes += 4, size -= 4) {
+        std::uint32_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        sum += word;
+      }
+
+      if (size >= 2) {
+        std::uint16_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        sum += word;
+
+        bytes += 2;
+        size -= 2;
+      }
+
+      // An odd byte is padded with a zero
+      if (size) {
+        std::uint16_t word = 0;
+        std::memcpy(&word, bytes, 1);
+        sum += word;
+      }
+
+      return sum;
+    }
+
+    std::uint16_t checksum_fold(std::uint64_t sum) {
+      while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+      }
+
+      return (std::uint16_t) ~sum;
+    }
+
+    /**
+     * @brief Find the hardware address of a neighbor in the ARP table of the kernel.
+     * @return true if the neighbor is reachable.
+     */
+    bool find_neighbor(const struct in_addr &address, const std::string &ifname, std::uint8_t *mac) {
+      std::ifstream arp {"/proc/net/arp"};
+
+      // IP address, HW type, Flags, HW address, Mask, Device
+      std::string line;
+      std::getline(arp, line);
+      while (std::getline(arp, line)) {
+        std::istringstream fields {line};
+
+        std::string ip, hw_type, flags, hw_address, mask, device;
+        if (!(fields >> ip >> hw_type >> flags >> hw_address >> mask >> device)) {
+          continue;
+        }
+
+        struct in_addr entry;
+        if (device != ifname || inet_pton(AF_INET, ip.c_str(), &entry) != 1 || entry.s_addr != address.s_addr) {
+          continue;
+        }
+
+        if (!(std::stoul(flags, nullptr, 16) & ATF_COM)) {
+          return false;
+        }
+
+        unsigned int bytes[ETH_ALEN];
+        if (std::sscanf(hw_address.c_str(), "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != ETH_ALEN) {
+          return false;
+        }
+        std::copy(std::begin(bytes), std::end(bytes), mac);
+
+        return true;
+      }
+
+      return false;
+    }
+
+    /**
+     * @brief Find the interface and the hardware addresses to send from a socket to a target.
+     * @return The route, or std::nullopt if the target isn't a neighbor on the link of the source address.
+     */
+    std::optional<route_t> find_route(int sockfd, const struct in_addr &source, const struct sockaddr_in &target) {
+      route_t route {};
+      route.source.sin_family = AF_INET;
+      route.source.sin_addr = source;
+      route.target = target;
+
+      // The socket may be a dual-stack one, the port is at the same place for both families
+      struct sockaddr_storage local {};
+      socklen_t local_size = sizeof(local);
+      if (getsockname(sockfd, (struct sockaddr *) &local, &local_size) < 0) {
+        BOOST_LOG(warning) << "getsockname() failed: "sv << errno;
+        return std::nullopt;
+      }
+      route.source.sin_port = local.ss_family == AF_INET6 ? ((struct sockaddr_in6 *) &local)->sin6_port : ((struct sockaddr_in *) &local)->sin_port;
+
+      struct ifaddrs *ifaddrs;
+      if (getifaddrs(&ifaddrs) < 0) {
+        BOOST_LOG(warning) << "getifaddrs() failed: "sv << errno;
+        return std::nullopt;
+      }
+
+      std::string ifname;
+      for (auto ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET && !(ifa->ifa_flags & IFF_LOOPBACK) &&
+            ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr.s_addr == source.s_addr) {
+          ifname = ifa->ifa_name;
+          break;
+        }
+      }
+
+      bool found = false;
+      for (auto ifa = ifaddrs; ifa && !ifname.empty(); ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_PACKET && ifname == ifa->ifa_name) {
+          auto link = (struct sockaddr_ll *) ifa->ifa_addr;
+          if (link->sll_hatype == ARPHRD_ETHER && link->sll_halen == ETH_ALEN) {
+            route.ifindex = link->sll_ifindex;
+            std::memcpy(route.source_mac, link->sll_addr, ETH_ALEN);
+            found = true;
+          }
+          break;
+        }
+      }
+      freeifaddrs(ifaddrs);
+
+      if (!found) {
+        return std::nullopt;
+      }
+
+      struct ifreq ifr {};
+      std::strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+      if (ioctl(sockfd, SIOCGIFMTU, &ifr) < 0) {
+        BOOST_LOG(warning) << "ioctl(SIOCGIFMTU) failed: "sv << errno;
+        return std::nullopt;
+      }
+      route.mtu = ifr.ifr_mtu;
+
+      // Targets behind a router aren't in the table, their packets keep going through the kernel
+      if (!find_neighbor(target.sin_addr, ifname, route.target_mac)) {
+        return std::nullopt;
+      }
+
+      return route;
+    }
+
+    struct ring_t {
+      std::uint32_t *producer;
+      std::uint32_t *consumer;
+      std::uint32_t *flags;
+      void *entries;
+      std::uint32_t size;
+
+      void *map;
+      std::size_t map_size;
+
+      std::uint32_t load(std::uint32_t *index) const {
+        return std::atomic_ref {*index}.load(std::memory_order_acquire);
+      }
+
+      void store(std::uint32_t *index, std::uint32_t value) {
+        std::atomic_ref {*index}.store(value, std::memory_order_release);
+      }
+    };
+
+    class socket_t {
+    public:
+      socket_t() = default;
+
+      ~socket_t() {
+        for (auto ring : {&_tx, &_completion}) {
+          if (ring->map) {
+            munmap(ring->map, ring->map_size);
+          }
+        }
+
+        if (_fd >= 0) {
+          close(_fd);
+        }
+
+        if (_umem) {
+          munmap(_umem, (std::size_t) FRAME_SIZE * FRAME_COUNT);
+        }
+      }
+
+      socket_t(const socket_t &) = delete;
+      socket_t &operator=(const socket_t &) = delete;
+
+      /**
+       * @brief Bind to the first queue of the interface not used by another AF_XDP socket.
+       * @param ifindex The interface.
+       * @param zerocopy Let the driver send from the frames directly, only some drivers support it.
+       * @return 0 on success, or the error.
+       */
+      int init(int ifindex, bool zerocopy) {
+        _zerocopy = zerocopy;
+
+        _fd = ::socket(AF_XDP, SOCK_RAW, 0);
+        if (_fd < 0) {
+          return errno;
+        }
+
+        auto umem = mmap(nullptr, (std::size_t) FRAME_SIZE * FRAME_COUNT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (umem == MAP_FAILED) {
+          return errno;
+        }
+        _umem = (std::uint8_t *) umem;
+
+        struct xdp_umem_reg reg {};
+        reg.addr = (std::uintptr_t) _umem;
+        reg.len = (std::uint64_t) FRAME_SIZE * FRAME_COUNT;
+        reg.chunk_size = FRAME_SIZE;
+        if (setsockopt(_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+          return errno;
+        }
+
+        auto fill_size = FILL_RING_SIZE;
+        auto completion_size = COMPLETION_RING_SIZE;
+        auto tx_size = TX_RING_SIZE;
+        if (setsockopt(_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) < 0 ||
+            setsockopt(_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_size, sizeof(completion_size)) < 0 ||
+            setsockopt(_fd, SOL_XDP, XDP_TX_RING, &tx_size, sizeof(tx_size)) < 0) {
+          return errno;
+        }
+
+        struct xdp_mmap_offsets offsets {};
+        socklen_t offsets_size = sizeof(offsets);
+        if (getsockopt(_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_size) < 0) {
+          return errno;
+        }
+
+        if (!map_ring(_tx, offsets.tx, TX_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) ||
+            !map_ring(_completion, offsets.cr, COMPLETION_RING_SIZE, sizeof(std::uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)) {
+          return errno;
+        }
+
+        struct sockaddr_xdp address {};
+        address.sxdp_family = AF_XDP;
+        address.sxdp_ifindex = ifindex;
+        address.sxdp_flags = (zerocopy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+
+        // Sending threads of their own take the next queues, the kernel refuses queues past the last one
+        while (bind(_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+          if (errno != EBUSY) {
+            return errno;
+          }
+
+          ++address.sxdp_queue_id;
+        }
+
+        // Some drivers only accept zero-copy sockets while an XDP program is attached, which is found out
+        // when waking them up
+        if (zerocopy && sendto(_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && !retryable(errno)) {
+          return errno;
+        }
+
+        _free_frames.reserve(FRAME_COUNT);
+        for (std::uint32_t x = 0; x < FRAME_COUNT; ++x) {
+          _free_frames.push_back((std::uint64_t) x * FRAME_SIZE);
+        }
+
+        BOOST_LOG(debug) << "Sending through AF_XDP on queue "sv << address.sxdp_queue_id << (zerocopy ? " with zero-copy"sv : ""sv);
+
+        return 0;
+      }
+
+      int send(const route_t &route, std::uint8_t dscp, const datagram_t *datagrams, int count) {
+        int sent = 0;
+
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        while (sent < count) {
+          reclaim();
+
+          auto producer = *_tx.producer;
+          auto tx_free = _tx.size - (producer - _tx.load(_tx.consumer));
+          auto batch = std::min<std::size_t>({(std::size_t) count - sent, _free_frames.size(), tx_free});
+          if (!batch) {
+            // Every frame is still in use by the kernel, which can't take long unless the link is down
+            auto now = std::chrono::steady_clock::now();
+            if (!deadline) {
+              deadline = now + FRAME_WAIT;
+            } else if (now >= *deadline) {
+              BOOST_LOG(verbose) << "Timed out waiting for AF_XDP frames"sv;
+              break;
+            }
+
+            if (!flush()) {
+              break;
+            }
+            continue;
+          }
+          deadline.reset();
+
+          auto descs = (struct xdp_desc *) _tx.entries;
+          for (std::size_t x = 0; x < batch; ++x) {
+            auto frame = _free_frames.back();
+            _free_frames.pop_back();
+
+            auto &desc = descs[(producer + x) & (_tx.size - 1)];
+            desc.addr = frame;
+            desc.len = write_packet(_umem + frame, route, dscp, datagrams[sent + x]);
+            desc.options = 0;
+          }
+          _tx.store(_tx.producer, producer + batch);
+
+          // The packets are in the ring, so they're sent even if the kernel is told about them later
+          sent += batch;
+          if (!flush()) {
+            break;
+          }
+        }
+
+        return sent;
+      }
+
+    private:
+      static bool retryable(int err) {
+        return err == EAGAIN || err == EBUSY || err == ENOBUFS || err == EINTR;
+      }
+
+      bool map_ring(ring_t &ring, const struct xdp_ring_offset &offsets, std::uint32_t size, std::size_t entry_size, off_t pgoff) {
+        ring.map_size = offsets.desc + size * entry_size;
+
+        auto map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, pgoff);
+        if (map == MAP_FAILED) {
+          return false;
+        }
+        ring.map = map;
+
+        auto base = (std::uint8_t *) map;
+        ring.producer = (std::uint32_t *) (base + offsets.producer);
+        ring.consumer = (std::uint32_t *) (base + offsets.consumer);
+        ring.flags = (std::uint32_t *) (base + offsets.flags);
+        ring.entries = base + offsets.desc;
+        ring.size = size;
+
+        return true;
+      }
+
+      /**
+       * @brief Take back the frames of the packets the kernel is done with.
+       */
+      void reclaim() {
+        auto consumer = *_completion.consumer;
+        auto producer = _completion.load(_completion.producer);
+
+        auto frames = (std::uint64_t *) _completion.entries;
+        for (; consumer != producer; ++consumer) {
+          _free_frames.push_back(frames[consumer & (_completion.size - 1)]);
+        }
+
+        _completion.store(_completion.consumer, consumer);
+      }
+
+      /**
+       * @brief Have the kernel send the packets in the ring.
+       * @return false if the socket can't send anymore.
+       */
+      bool flush() {
+        auto deadline = std::chrono::steady_clock::now() + FRAME_WAIT;
+
+        while (true) {
+          if (_zerocopy && !(_tx.load(_tx.flags) & XDP_RING_NEED_WAKEUP)) {
+            return true;
+          }
+
+          if (sendto(_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && !retryable(errno)) {
+            BOOST_LOG(warning) << "AF_XDP sendto() failed: "sv << errno;
+            return false;
+          }
+
+          // Once woken up, the driver sends the packets of zero-copy sockets on its own.
+          // Otherwise, they're sent from sendto() a few at a time.
+          if (_zerocopy || *_tx.producer == _tx.load(_tx.consumer) || std::chrono::steady_clock::now() >= deadline) {
+            return true;
+          }
+        }
+      }
+
+      std::uint32_t write_packet(std::uint8_t *frame, const route_t &route, std::uint8_t dscp, const datagram_t &datagram) {
+        auto eth = (struct ether_header *) frame;
+        auto ip = (struct iphdr *) (eth + 1);
+        auto udp = (struct udphdr *) (ip + 1);
+        auto payload = (std::uint8_t *) (udp + 1);
+
+        if (datagram.header_size) {
+          std::memcpy(payload, datagram.header, datagram.header_size);
+        }
+        std::memcpy(payload + datagram.header_size, datagram.payload, datagram.payload_size);
+        auto udp_size = (std::uint16_t) (sizeof(*udp) + datagram.header_size + datagram.payload_size);
+
+        std::memcpy(eth->ether_dhost, route.target_mac, ETH_ALEN);
+        std::memcpy(eth->ether_shost, route.source_mac, ETH_ALEN);
+        eth->ether_type = htons(ETHERTYPE_IP);
+
+        ip->version = 4;
+        ip->ihl = sizeof(*ip) / 4;
+        ip->tos = dscp << 2;
+        ip->tot_len = htons(sizeof(*ip) + udp_size);
+        ip->id = htons(_ip_id++);
+        ip->frag_off = htons(IP_DF);
+        ip->ttl = IPDEFTTL;
+        ip->protocol = IPPROTO_UDP;
+        ip->check = 0;
+        ip->saddr = route.source.sin_addr.s_addr;
+        ip->daddr = route.target.sin_addr.s_addr;
+        ip->check = checksum_fold(checksum_add(ip, sizeof(*ip)));
+
+        udp->source = route.source.sin_port;
+        udp->dest = route.target.sin_port;
+        udp->len = htons(udp_size);
+        udp->check = 0;
+
+        // The pseudo header is made of the addresses, the protocol and the length
+        auto sum = checksum_add(&ip->saddr, sizeof(ip->saddr) + sizeof(ip->daddr), htons(IPPROTO_UDP) + udp->len);
+        auto check = checksum_fold(checksum_add(udp, udp_size, sum));
+
+        // A checksum of 0 means there's none
+        udp->check = check ? check : 0xFFFF;
+
+        return HEADERS_SIZE + datagram.header_size + datagram.payload_size;
+      }
+
+      int _fd {-1};
+      std::uint8_t *_umem {};
+      ring_t _tx {};
+      ring_t _completion {};
+      bool _zerocopy {false};
+
+      std::vector<std::uint64_t> _free_frames;
+      std::uint16_t _ip_id {};
+    };
+
+    class sender_t {
+    public:
+      int send(int sockfd, const struct in_addr &source, const struct sockaddr_in &target, std::uint8_t dscp, const datagram_t *datagrams, int count) {
+        auto route = get_route(sockfd, source, target);
+        if (!route) {
+          return -1;
+        }
+
+        auto max_size = std::min<std::size_t>(FRAME_SIZE, ETH_HLEN + route->mtu);
+        for (int x = 0; x < count; ++x) {
+          if (HEADERS_SIZE + datagrams[x].header_size + datagrams[x].payload_size > max_size) {
+            return -1;
+          }
+        }
+
+        auto socket = get_socket(route->ifindex);
+        if (!socket) {
+          return -1;
+        }
+
+        return socket->send(*route, dscp, datagrams, count);
+      }
+
+    private:
+      struct cached_route_t {
+        std::optional<route_t> route;
+        std::chrono::steady_clock::time_point expiry;
+      };
+
+      const std::optional<route_t> &get_route(int sockfd, const struct in_addr &source, const struct sockaddr_in &target) {
+        auto now = std::chrono::steady_clock::now();
+
+        // Targets that can't be reached are remembered as well, so they're not looked up for every batch
+        auto &cached = _routes[{sockfd, source.s_addr, target.sin_addr.s_addr, target.sin_port}];
+        if (now >= cached.expiry) {
+          cached.route = find_route(sockfd, source, target);
+          cached.expiry = now + ROUTE_LIFETIME;
+        }
+
+        return cached.route;
+      }
+
+      socket_t *get_socket(int ifindex) {
+        auto it = _sockets.find(ifindex);
+        if (it != std::end(_sockets)) {
+          return it->second.get();
+        }
+
+        // It's only tried once per interface, failing again would only log the same error
+        std::unique_ptr<socket_t> socket;
+        int err = 0;
+        for (auto zerocopy : {true, false}) {
+          socket = std::make_unique<socket_t>();
+          err = socket->init(ifindex, zerocopy);
+          if (!err) {
+            break;
+          }
+
+          socket.reset();
+        }
+
+        if (!socket) {
+          char ifname[IF_NAMESIZE] {};
+          if_indextoname(ifindex, ifname);
+          BOOST_LOG(warning) << "AF_XDP is not available on "sv << ifname << ", falling back to sendmsg(): "sv << err;
+        }
+
+        return _sockets.emplace(ifindex, std::move(socket)).first->second.get();
+      }
+
+      std::map<std::tuple<int, in_addr_t, in_addr_t, in_port_t>, cached_route_t> _routes;
+      std::map<int, std::unique_ptr<socket_t>> _sockets;
+    };
+  }  // namespace
+
+  int send(int sockfd, const struct in_addr &source, const struct sockaddr_in &target, std::uint8_t dscp, const datagram_t *datagrams, int count) {
+    // Each sending thread has sockets of its own, bound to different queues, so no locking is needed
+    thread_local sender_t sender;
+
+    return sender.send(sockfd, source, target, dscp, datagrams, count);
+  }
+}  // namespace xdp
@@ -0,0 +1,42 @@
+/**
+ * @file src/platform/linux/xdp.h
+ * @brief Declarations for sending UDP packets through AF_XDP.
+ */
+#pragma once
+
+// standard includes
+#include <cstddef>
+#include <cstdint>
+
+// platform includes
+#include <netinet/in.h>
+
+namespace xdp {
+  /**
+   * @brief A UDP payload made of an optional header and a payload.
+   */
+  struct datagram_t {
+    const char *header;
+    std::size_t header_size;
+    const char *payload;
+    std::size_t payload_size;
+  };
+
+  /**
+   * @brief Send datagrams on behalf of a UDP socket through an AF_XDP socket of the calling thread.
+   * @details The Ethernet, IPv4 and UDP headers are built here, from the address and port the socket
+   *          is bound to and the hardware addresses of the interface and of the neighbor, so the
+   *          packets skip the network stack of the kernel. Only neighbors on the link of the source
+   *          address can be reached this way. The datagrams are copied into the memory shared with
+   *          the kernel, so their buffers may be reused as soon as this returns.
+   * @param sockfd The UDP socket the datagrams would be sent on otherwise.
+   * @param source The source address.
+   * @param target The target address and port.
+   * @param dscp The DSCP value to mark the packets with.
+   * @param datagrams The datagrams.
+   * @param count The number of datagrams.
+   * @return The number of datagrams sent before the first failure,
+   *         or -1 if AF_XDP can't be used for this target on this thread.
+   */
+  int send(int sockfd, const struct in_addr &source, const struct sockaddr_in &target, std::uint8_t dscp, const datagram_t *datagrams, int count);
+}  // namespace xdp
@@ -4,22 +4,25 @@
  */
 #pragma once
 
+// standard includes
+#include <memory>
+
 // platform includes
 #import <AVFoundation/AVFoundation.h>
 
-// lib includes
-#include "third-party/TPCircularBuffer/TPCircularBuffer.h"
+// local includes
+#include "src/thread_safe.h"
 
 #define kBufferLength 4096
 
 @interface AVAudio: NSObject <AVCaptureAudioDataOutputSampleBufferDelegate> {
 @public
-  TPCircularBuffer audioSampleBuffer;
+  // Filled by the capture callback, emptied by mic_t::sample()
+  std::unique_ptr<safe::spsc_ring_t<float>> audioSampleBuffer;
 }
 
 @property (nonatomic, assign) AVCaptureSession *audioCaptureSession;
 @property (nonatomic, assign) AVCaptureConnection *audioConnection;
-@property (nonatomic, assign) NSCondition *samplesArrivedSignal;
 
 + (NSArray *)microphoneNames;
 + (AVCaptureDevice *)findMicrophone:(NSString *)name;
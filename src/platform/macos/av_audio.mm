@@ -1,5 +1,5 @@
 /**
- * @file src/platform/macos/av_audio.m
+ * @file src/platform/macos/av_audio.mm
  * @brief Definitions for audio capture on macOS.
  */
 // local includes
@@ -56,14 +56,17 @@
 - (void)dealloc {
   // make sure we don't process any further samples
   self.audioConnection = nil;
-  // make sure nothing gets stuck on this signal
-  [self.samplesArrivedSignal signal];
-  [self.samplesArrivedSignal release];
-  TPCircularBufferCleanup(&audioSampleBuffer);
+  // make sure nothing gets stuck waiting for samples
+  if (audioSampleBuffer) {
+    audioSampleBuffer->stop();
+  }
   [super dealloc];
 }
 
 - (int)setupMicrophone:(AVCaptureDevice *)device sampleRate:(UInt32)sampleRate frameSize:(UInt32)frameSize channels:(UInt8)channels {
+  // The callback delivers up to kBufferLength frames at once, leave room for a few packets more
+  audioSampleBuffer = std::make_unique<safe::spsc_ring_t<float>>((kBufferLength + frameSize * 8) * channels);
+
   self.audioCaptureSession = [[AVCaptureSession alloc] init];
 
   NSError *error;
@@ -90,7 +93,8 @@
     (NSString *) AVLinearPCMIsNonInterleaved: @NO
   }];
 
-  dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+  // The ring takes a single producer, so the callbacks must not run concurrently
+  dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
   dispatch_queue_t recordingQueue = dispatch_queue_create("audioSamplingQueue", qos);
 
   [audioOutput setSampleBufferDelegate:self queue:recordingQueue];
@@ -110,9 +114,6 @@
   [audioInput release];
   [audioOutput release];
 
-  self.samplesArrivedSignal = [[NSCondition alloc] init];
-  TPCircularBufferInit(&self->audioSampleBuffer, kBufferLength * channels);
-
   return 0;
 }
 
@@ -131,8 +132,10 @@
     // and we don't want to do sanity checks in a performance critical exec path
     AudioBuffer audioBuffer = audioBufferList.mBuffers[0];
 
-    TPCircularBufferProduceBytes(&self->audioSampleBuffer, audioBuffer.mData, audioBuffer.mDataByteSize);
-    [self.samplesArrivedSignal signal];
+    // Never blocks, the samples are dropped if the capture thread fell behind
+    audioSampleBuffer->write((const float *) audioBuffer.mData, audioBuffer.mDataByteSize / sizeof(float));
+
+    CFRelease(blockBuffer);
   }
 }
 
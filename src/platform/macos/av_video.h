@@ -13,7 +13,23 @@ struct CaptureSession {
   NSCondition *captureStopped;
 };
 
-@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate>
+typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
+
+/**
+ * The interface display.mm captures through, implemented by AVVideo and SCVideo.
+ */
+@protocol VideoCapture <NSObject>
+
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
+
+@interface AVVideo: NSObject <AVCaptureVideoDataOutputSampleBufferDelegate, VideoCapture>
 
 #define kMaxDisplays 32
 
@@ -23,8 +39,6 @@ struct CaptureSession {
 @property (nonatomic, assign) int frameWidth;
 @property (nonatomic, assign) int frameHeight;
 
-typedef bool (^FrameCallbackBlock)(CMSampleBufferRef);
-
 @property (nonatomic, assign) AVCaptureSession *session;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, AVCaptureVideoDataOutput *> *videoOutputs;
 @property (nonatomic, assign) NSMapTable<AVCaptureConnection *, FrameCallbackBlock> *captureCallbacks;
@@ -2,6 +2,9 @@
  * @file src/platform/macos/display.mm
  * @brief Definitions for display capture on macOS.
  */
+// standard includes
+#include <algorithm>
+
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
@@ -10,6 +13,7 @@
 #include "src/platform/macos/av_video.h"
 #include "src/platform/macos/misc.h"
 #include "src/platform/macos/nv12_zero_device.h"
+#include "src/platform/macos/sc_video.h"
 
 // Avoid conflict between AVFoundation and libavutil both defining AVMediaType
 #define AVMediaType AVMediaType_FFmpeg
@@ -21,43 +25,112 @@ namespace fs = std::filesystem;
 namespace platf {
   using namespace std::literals;
 
+  /**
+   * @brief Make an image reference the pixels of a captured sample buffer.
+   * @param img The image, an `av_img_t`.
+   * @param sampleBuffer The sample buffer.
+   */
+  static void set_sample_buffer(img_t *img, CMSampleBufferRef sampleBuffer) {
+    auto new_sample_buffer = std::make_shared<av_sample_buf_t>(sampleBuffer);
+    auto new_pixel_buffer = std::make_shared<av_pixel_buf_t>(new_sample_buffer->buf);
+
+    auto av_img = (av_img_t *) img;
+
+    auto old_data_retainer = std::make_shared<temp_retain_av_img_t>(
+      av_img->sample_buffer,
+      av_img->pixel_buffer,
+      img->data
+    );
+
+    av_img->sample_buffer = new_sample_buffer;
+    av_img->pixel_buffer = new_pixel_buffer;
+    img->data = new_pixel_buffer->data();
+
+    img->width = (int) CVPixelBufferGetWidth(new_pixel_buffer->buf);
+    img->height = (int) CVPixelBufferGetHeight(new_pixel_buffer->buf);
+    img->row_pitch = (int) CVPixelBufferGetBytesPerRow(new_pixel_buffer->buf);
+    img->pixel_pitch = img->row_pitch / img->width;
+
+    old_data_retainer = nullptr;
+  }
+
+  /**
+   * @brief Read the presentation time and the dirty rects ScreenCaptureKit attaches to a frame.
+   * @param img The image captured from the frame.
+   * @param sampleBuffer The frame.
+   */
+  static void set_frame_info(img_t &img, CMSampleBufferRef sampleBuffer) {
+    // The presentation time is on the host clock, carry its age over to the steady clock
+    auto pts = CMSampleBufferGetPresentationTimeStamp(sampleBuffer);
+    if (CMTIME_IS_NUMERIC(pts)) {
+      auto age = CMTimeGetSeconds(CMTimeSubtract(CMClockGetTime(CMClockGetHostTimeClock()), pts));
+      img.frame_timestamp = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(std::max(age, 0.0)));
+    } else {
+      img.frame_timestamp = std::chrono::steady_clock::now();
+    }
+
+    img.damage.reset();
+
+    CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+    if (!attachments || CFArrayGetCount(attachments) == 0) {
+      return;
+    }
+
+    NSDictionary *info = (NSDictionary *) CFArrayGetValueAtIndex(attachments, 0);
+    NSArray *dirty_rects = info[SCStreamFrameInfoDirtyRects];
+
+    // Without dirty rects it's unknown what changed
+    if (!dirty_rects || dirty_rects.count == 0) {
+      return;
+    }
+
+    auto &damage = img.damage.emplace();
+    damage.reserve(dirty_rects.count);
+    for (NSDictionary *dict in dirty_rects) {
+      CGRect rect;
+      if (!CGRectMakeWithDictionaryRepresentation((CFDictionaryRef) dict, &rect)) {
+        img.damage.reset();
+        return;
+      }
+
+      rect = CGRectIntersection(CGRectIntegral(rect), CGRectMake(0, 0, img.width, img.height));
+      if (!CGRectIsEmpty(rect)) {
+        damage.push_back({(int) rect.origin.x, (int) rect.origin.y, (int) rect.size.width, (int) rect.size.height});
+      }
+    }
+  }
+
   struct av_display_t: public display_t {
-    AVVideo *av_capture {};
+    id<VideoCapture> av_capture {};
     CGDirectDisplayID display_id {};
 
+    // Whether av_capture is ScreenCaptureKit rather than AVCaptureScreenInput
+    bool screen_capture_kit {};
+
     ~av_display_t() override {
       [av_capture release];
     }
 
+    capture_backend_t capture_backend() const override {
+      // Only ScreenCaptureKit tells when the frames were presented
+      return screen_capture_kit ? capture_backend_t {"sck"sv, true} : capture_backend_t {"avfoundation"sv, false};
+    }
+
     capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
       auto signal = [av_capture capture:^(CMSampleBufferRef sampleBuffer) {
-        auto new_sample_buffer = std::make_shared<av_sample_buf_t>(sampleBuffer);
-        auto new_pixel_buffer = std::make_shared<av_pixel_buf_t>(new_sample_buffer->buf);
-
+        auto snapshot_begin = std::chrono::steady_clock::now();
         std::shared_ptr<img_t> img_out;
         if (!pull_free_image_cb(img_out)) {
           // got interrupt signal
           // returning false here stops capture backend
           return false;
         }
-        auto av_img = std::static_pointer_cast<av_img_t>(img_out);
-
-        auto old_data_retainer = std::make_shared<temp_retain_av_img_t>(
-          av_img->sample_buffer,
-          av_img->pixel_buffer,
-          img_out->data
-        );
-
-        av_img->sample_buffer = new_sample_buffer;
-        av_img->pixel_buffer = new_pixel_buffer;
-        img_out->data = new_pixel_buffer->data();
-
-        img_out->width = (int) CVPixelBufferGetWidth(new_pixel_buffer->buf);
-        img_out->height = (int) CVPixelBufferGetHeight(new_pixel_buffer->buf);
-        img_out->row_pitch = (int) CVPixelBufferGetBytesPerRow(new_pixel_buffer->buf);
-        img_out->pixel_pitch = img_out->row_pitch / img_out->width;
 
-        old_data_retainer = nullptr;
+        set_sample_buffer(img_out.get(), sampleBuffer);
+        if (screen_capture_kit) {
+          set_frame_info(*img_out, sampleBuffer);
+        }
+        capture_stats().snapshot(capture_e::ok, snapshot_begin, img_out.get());
 
         if (!push_captured_image_cb(std::move(img_out), true)) {
           // got interrupt signal
@@ -68,9 +141,19 @@ namespace platf {
         return true;
       }];
 
+      if (!signal) {
+        BOOST_LOG(error) << "Couldn't start capturing the display"sv;
+        return capture_e::error;
+      }
+
       // FIXME: We should time out if an image isn't returned for a while
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
+      if (screen_capture_kit && ((SCVideo *) av_capture).streamFailed) {
+        BOOST_LOG(warning) << "ScreenCaptureKit stopped capturing the display"sv;
+        return capture_e::reinit;
+      }
+
       return capture_e::ok;
     }
 
@@ -104,32 +187,16 @@ namespace platf {
       }
 
       auto signal = [av_capture capture:^(CMSampleBufferRef sampleBuffer) {
-        auto new_sample_buffer = std::make_shared<av_sample_buf_t>(sampleBuffer);
-        auto new_pixel_buffer = std::make_shared<av_pixel_buf_t>(new_sample_buffer->buf);
-
-        auto av_img = (av_img_t *) img;
-
-        auto old_data_retainer = std::make_shared<temp_retain_av_img_t>(
-          av_img->sample_buffer,
-          av_img->pixel_buffer,
-          img->data
-        );
-
-        av_img->sample_buffer = new_sample_buffer;
-        av_img->pixel_buffer = new_pixel_buffer;
-        img->data = new_pixel_buffer->data();
-
-        img->width = (int) CVPixelBufferGetWidth(new_pixel_buffer->buf);
-        img->height = (int) CVPixelBufferGetHeight(new_pixel_buffer->buf);
-        img->row_pitch = (int) CVPixelBufferGetBytesPerRow(new_pixel_buffer->buf);
-        img->pixel_pitch = img->row_pitch / img->width;
-
-        old_data_retainer = nullptr;
+        set_sample_buffer(img, sampleBuffer);
 
         // returning false here stops capture backend
         return false;
       }];
 
+      if (!signal) {
+        return 1;
+      }
+
       dispatch_semaphore_wait(signal, DISPATCH_TIME_FOREVER);
 
       return 0;
@@ -143,11 +210,11 @@ namespace platf {
      * height --> the intended capture height
      */
     static void setResolution(void *display, int width, int height) {
-      [static_cast<AVVideo *>(display) setFrameWidth:width frameHeight:height];
+      [static_cast<id<VideoCapture>>(display) setFrameWidth:width frameHeight:height];
     }
 
     static void setPixelFormat(void *display, OSType pixelFormat) {
-      static_cast<AVVideo *>(display).pixelFormat = pixelFormat;
+      static_cast<id<VideoCapture>>(display).pixelFormat = pixelFormat;
     }
   };
 
@@ -177,7 +244,16 @@ namespace platf {
     }
     BOOST_LOG(info) << "Configuring selected display ("sv << display->display_id << ") to stream"sv;
 
-    display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    // ScreenCaptureKit has less latency and drops the frames in which nothing changed
+    if ([SCVideo isSupported]) {
+      display->av_capture = [[SCVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+      display->screen_capture_kit = display->av_capture != nil;
+    }
+
+    if (!display->av_capture) {
+      display->av_capture = [[AVVideo alloc] initWithDisplay:display->display_id frameRate:config.framerate];
+    }
+    BOOST_LOG(info) << "Capturing with "sv << (display->screen_capture_kit ? "ScreenCaptureKit"sv : "AVCaptureScreenInput"sv);
 
     if (!display->av_capture) {
       BOOST_LOG(error) << "Video setup failed."sv;
@@ -215,4 +291,9 @@ namespace platf {
     // We don't track GPU state, so we will always reenumerate. Fortunately, it is fast on macOS.
     return true;
   }
+
+  std::string gpu_fingerprint() {
+    // Probing is fast enough on macOS that its results aren't kept
+    return {};
+  }
 }  // namespace platf
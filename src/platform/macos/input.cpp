@@ -521,6 +521,13 @@ const KeyCodeMap kKeyCodesMap[] = {
     // Unimplemented
   }
 
+  void begin_input_batch(input_t &input) {
+    // Events are posted as they're created
+  }
+
+  void end_input_batch(input_t &input) {
+  }
+
   input_t input() {
     input_t result {new macos_input_t()};
 
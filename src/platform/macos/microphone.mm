@@ -5,6 +5,7 @@
 // local includes
 #include "src/config.h"
 #include "src/logging.h"
+#include "src/metrics.h"
 #include "src/platform/common.h"
 #include "src/platform/macos/av_audio.h"
 
@@ -14,28 +15,23 @@ namespace platf {
   struct av_mic_t: public mic_t {
     AVAudio *av_audio_capture {};
 
+    // Exports the counters of the ring while the microphone is open
+    std::shared_ptr<void> overruns;
+    std::shared_ptr<void> underruns;
+
     ~av_mic_t() override {
+      // The probes read the ring, which goes away with the capture
+      overruns.reset();
+      underruns.reset();
       [av_audio_capture release];
     }
 
     capture_e sample(std::vector<float> &sample_in) override {
-      auto sample_size = sample_in.size();
-
-      uint32_t length = 0;
-      void *byteSampleBuffer = TPCircularBufferTail(&av_audio_capture->audioSampleBuffer, &length);
-
-      while (length < sample_size * sizeof(float)) {
-        [av_audio_capture.samplesArrivedSignal wait];
-        byteSampleBuffer = TPCircularBufferTail(&av_audio_capture->audioSampleBuffer, &length);
+      // A stalled device shouldn't keep the capture thread from noticing the end of the stream
+      if (!av_audio_capture->audioSampleBuffer->read(sample_in.data(), sample_in.size(), 500ms)) {
+        return capture_e::timeout;
       }
 
-      const float *sampleBuffer = (float *) byteSampleBuffer;
-      std::vector<float> vectorBuffer(sampleBuffer, sampleBuffer + sample_size);
-
-      std::copy_n(std::begin(vectorBuffer), sample_size, std::begin(sample_in));
-
-      TPCircularBufferConsume(&av_audio_capture->audioSampleBuffer, sample_size * sizeof(float));
-
       return capture_e::ok;
     }
   };
@@ -75,6 +71,14 @@ namespace platf {
         return nullptr;
       }
 
+      auto ring = mic->av_audio_capture->audioSampleBuffer.get();
+      mic->overruns = metrics::counter_probe("sunshine_audio_capture_overruns_total", "Blocks of captured audio dropped because the capture thread fell behind", {{"backend", "avfoundation"}}, [ring]() {
+        return (double) ring->overruns();
+      });
+      mic->underruns = metrics::counter_probe("sunshine_audio_capture_underruns_total", "Reads of captured audio that timed out waiting for samples", {{"backend", "avfoundation"}}, [ring]() {
+        return (double) ring->underruns();
+      });
+
       return mic;
     }
 
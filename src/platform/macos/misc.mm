@@ -17,6 +17,7 @@
 #include <dlfcn.h>
 #include <Foundation/Foundation.h>
 #include <mach-o/dyld.h>
+#include <net/if.h>
 #include <net/if_dl.h>
 #include <pwd.h>
 
@@ -170,6 +171,26 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    auto ifaddrs = get_ifaddrs();
+
+    for (auto pos = ifaddrs.get(); pos != nullptr; pos = pos->ifa_next) {
+      if (pos->ifa_addr && address == from_sockaddr(pos->ifa_addr)) {
+        // The link statistics are attached to the AF_LINK entry of the interface
+        for (auto link = ifaddrs.get(); link != nullptr; link = link->ifa_next) {
+          if (link->ifa_addr && link->ifa_data && link->ifa_addr->sa_family == AF_LINK && !strcmp(link->ifa_name, pos->ifa_name)) {
+            return ((struct if_data *) link->ifa_data)->ifi_baudrate;
+          }
+        }
+
+        break;
+      }
+    }
+
+    BOOST_LOG(debug) << "Unable to find link speed for "sv << address;
+    return 0;
+  }
+
   bp::child run_command(bool elevated, bool interactive, const std::string &cmd, boost::filesystem::path &working_dir, const bp::environment &env, FILE *file, std::error_code &ec, bp::group *group) {
     // clang-format off
     if (!group) {
@@ -214,6 +235,28 @@ namespace platf {
     // Unimplemented
   }
 
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    // macOS doesn't allow pinning threads to CPUs
+    return false;
+  }
+
+  std::vector<int> numa_node_cpus(int node) {
+    return {};
+  }
+
+  std::vector<int> gpu_local_cpus() {
+    return {};
+  }
+
+  std::uint8_t *alloc_frame_data(std::size_t size) {
+    // Superpages aren't available to user space on Apple silicon, nor is NUMA
+    return new (std::nothrow) std::uint8_t[size];
+  }
+
+  void free_frame_data(std::uint8_t *data, std::size_t size) {
+    delete[] data;
+  }
+
   void streaming_will_start() {
     // Nothing to do
   }
@@ -271,6 +314,11 @@ namespace platf {
     return waitpid(-((pid_t) native_handle), nullptr, WNOHANG) >= 0;
   }
 
+  std::unique_ptr<deinit_t> watch_process_exit(std::uintptr_t process_handle, std::uintptr_t group_handle, bool wait_all, std::function<void()> on_exit) {
+    // Not implemented yet, the app is polled instead
+    return nullptr;
+  }
+
   struct sockaddr_in to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     struct sockaddr_in saddr_v4 = {};
 
@@ -301,23 +349,43 @@ namespace platf {
     return false;
   }
 
+  int recv_batch(std::uintptr_t native_socket, recv_datagram_t *datagrams, size_t count, size_t buffer_size) {
+    // Fall back to unbatched receive calls
+    return -1;
+  }
+
+  bool enable_tx_timestamps(std::uintptr_t native_socket) {
+    // Transmit timestamps are not available on macOS
+    return false;
+  }
+
+  bool enable_tx_launch_time(std::uintptr_t native_socket) {
+    // Launch times are not available on macOS
+    return false;
+  }
+
+  void read_tx_timestamps(std::uintptr_t native_socket, const std::function<void(std::uint32_t, std::chrono::steady_clock::time_point)> &callback) {
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
 
-    // Convert the target address into a sockaddr
+    // Convert the target address into a sockaddr, connected sockets already know it
     struct sockaddr_in taddr_v4 = {};
     struct sockaddr_in6 taddr_v6 = {};
-    if (send_info.target_address.is_v6()) {
-      taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+    if (!send_info.connected) {
+      if (send_info.target_address.is_v6()) {
+        taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v6;
-      msg.msg_namelen = sizeof(taddr_v6);
-    } else {
-      taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+        msg.msg_name = (struct sockaddr *) &taddr_v6;
+        msg.msg_namelen = sizeof(taddr_v6);
+      } else {
+        taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v4;
-      msg.msg_namelen = sizeof(taddr_v4);
+        msg.msg_name = (struct sockaddr *) &taddr_v4;
+        msg.msg_namelen = sizeof(taddr_v4);
+      }
     }
 
     union {
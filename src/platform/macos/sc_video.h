@@ -0,0 +1,39 @@
+/**
+ * @file src/platform/macos/sc_video.h
+ * @brief Declarations for video capture with ScreenCaptureKit on macOS.
+ */
+#pragma once
+
+// platform includes
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// local includes
+#import "av_video.h"
+
+/**
+ * Captures a display with ScreenCaptureKit, available from macOS 12.3.
+ * Frames arrive as IOSurface backed pixel buffers, and frames in which nothing changed are dropped.
+ */
+@interface SCVideo: NSObject <SCStreamOutput, SCStreamDelegate, VideoCapture>
+
+@property (nonatomic, assign) CGDirectDisplayID displayID;
+@property (nonatomic, assign) CMTime minFrameDuration;
+@property (nonatomic, assign) OSType pixelFormat;
+@property (nonatomic, assign) int frameWidth;
+@property (nonatomic, assign) int frameHeight;
+
+// Set when a stream is stopped by the system rather than by its callback, e.g. when the display is removed
+@property (atomic, assign) BOOL streamFailed;
+
+@property (nonatomic, assign) SCContentFilter *filter;
+@property (nonatomic, assign) NSMapTable<SCStream *, FrameCallbackBlock> *captureCallbacks;
+@property (nonatomic, assign) NSMapTable<SCStream *, dispatch_semaphore_t> *captureSignals;
+
++ (BOOL)isSupported;
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate;
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight;
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback;
+
+@end
@@ -0,0 +1,163 @@
+/**
+ * @file src/platform/macos/sc_video.m
+ * @brief Definitions for video capture with ScreenCaptureKit on macOS.
+ */
+// local includes
+#import "sc_video.h"
+
+@implementation SCVideo
+
++ (BOOL)isSupported {
+  // ScreenCaptureKit is weakly linked, check for it rather than relying on @available
+  return [[NSProcessInfo processInfo] isOperatingSystemAtLeastVersion:((NSOperatingSystemVersion) {12, 3, 0})] &&
+         NSClassFromString(@"SCStream") != nil;
+}
+
+- (id)initWithDisplay:(CGDirectDisplayID)displayID frameRate:(int)frameRate {
+  self = [super init];
+
+  CGDisplayModeRef mode = CGDisplayCopyDisplayMode(displayID);
+
+  self.displayID = displayID;
+  self.pixelFormat = kCVPixelFormatType_32BGRA;
+  self.frameWidth = (int) CGDisplayModeGetPixelWidth(mode);
+  self.frameHeight = (int) CGDisplayModeGetPixelHeight(mode);
+  self.minFrameDuration = CMTimeMake(1, frameRate);
+  self.captureCallbacks = [[NSMapTable alloc] init];
+  self.captureSignals = [[NSMapTable alloc] init];
+
+  CFRelease(mode);
+
+  __block SCDisplay *display = nil;
+  dispatch_semaphore_t contentReady = dispatch_semaphore_create(0);
+  [SCShareableContent getShareableContentWithCompletionHandler:^(SCShareableContent *content, NSError *error) {
+    for (SCDisplay *candidate in content.displays) {
+      if (candidate.displayID == displayID) {
+        display = [candidate retain];
+        break;
+      }
+    }
+    dispatch_semaphore_signal(contentReady);
+  }];
+  dispatch_semaphore_wait(contentReady, DISPATCH_TIME_FOREVER);
+  dispatch_release(contentReady);
+
+  if (display == nil) {
+    [self release];
+    return nil;
+  }
+
+  self.filter = [[SCContentFilter alloc] initWithDisplay:display excludingWindows:@[]];
+  [display release];
+
+  return self;
+}
+
+- (void)dealloc {
+  [self.filter release];
+  [self.captureCallbacks release];
+  [self.captureSignals release];
+  [super dealloc];
+}
+
+- (void)setFrameWidth:(int)frameWidth frameHeight:(int)frameHeight {
+  self.frameWidth = frameWidth;
+  self.frameHeight = frameHeight;
+}
+
+- (dispatch_semaphore_t)capture:(FrameCallbackBlock)frameCallback {
+  @synchronized(self) {
+    SCStreamConfiguration *config = [[SCStreamConfiguration alloc] init];
+    config.width = self.frameWidth;
+    config.height = self.frameHeight;
+    config.minimumFrameInterval = self.minFrameDuration;
+    config.pixelFormat = self.pixelFormat;
+    config.showsCursor = YES;
+
+    SCStream *stream = [[SCStream alloc] initWithFilter:self.filter configuration:config delegate:self];
+    [config release];
+
+    dispatch_queue_attr_t qos = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INITIATED, DISPATCH_QUEUE_PRIORITY_HIGH);
+    dispatch_queue_t recordingQueue = dispatch_queue_create("videoCaptureQueue", qos);
+
+    NSError *error = nil;
+    if (![stream addStreamOutput:self type:SCStreamOutputTypeScreen sampleHandlerQueue:recordingQueue error:&error]) {
+      [stream release];
+      return nil;
+    }
+
+    dispatch_semaphore_t signal = dispatch_semaphore_create(0);
+
+    [self.captureCallbacks setObject:frameCallback forKey:stream];
+    [self.captureSignals setObject:signal forKey:stream];
+
+    [stream startCaptureWithCompletionHandler:^(NSError *error) {
+      if (error != nil) {
+        [self stopStream:stream failed:YES];
+      }
+    }];
+
+    return signal;
+  }
+}
+
+- (void)stopStream:(SCStream *)stream failed:(BOOL)failed {
+  @synchronized(self) {
+    dispatch_semaphore_t signal = [self.captureSignals objectForKey:stream];
+    if (signal == nil) {
+      // Already stopped
+      return;
+    }
+
+    if (failed) {
+      self.streamFailed = YES;
+    }
+
+    [self.captureCallbacks removeObjectForKey:stream];
+    dispatch_semaphore_signal(signal);
+    [self.captureSignals removeObjectForKey:stream];
+  }
+
+  if (failed) {
+    [stream release];
+  } else {
+    [stream stopCaptureWithCompletionHandler:^(NSError *error) {
+      [stream release];
+    }];
+  }
+}
+
+- (void)stream:(SCStream *)stream
+  didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer
+                 ofType:(SCStreamOutputType)type {
+  if (type != SCStreamOutputTypeScreen) {
+    return;
+  }
+
+  // Frames in which nothing changed carry no image
+  CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+  if (attachments == nil || CFArrayGetCount(attachments) == 0) {
+    return;
+  }
+
+  NSDictionary *info = (NSDictionary *) CFArrayGetValueAtIndex(attachments, 0);
+  NSNumber *status = info[SCStreamFrameInfoStatus];
+  if (status == nil || status.integerValue != SCFrameStatusComplete) {
+    return;
+  }
+
+  FrameCallbackBlock callback;
+  @synchronized(self) {
+    callback = [self.captureCallbacks objectForKey:stream];
+  }
+
+  if (callback != nil && !callback(sampleBuffer)) {
+    [self stopStream:stream failed:NO];
+  }
+}
+
+- (void)stream:(SCStream *)stream didStopWithError:(NSError *)error {
+  [self stopStream:stream failed:YES];
+}
+
+@end
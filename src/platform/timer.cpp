@@ -0,0 +1,88 @@
+/**
+ * @file src/platform/timer.cpp
+ * @brief Definitions for the hybrid sleeping and spinning timer.
+ */
+// standard includes
+#include <algorithm>
+#include <thread>
+
+#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_AMD64) || defined(__i386__) || defined(_M_IX86)
+  #include <immintrin.h>
+  #define TIMER_PAUSE() _mm_pause()
+#elif defined(_M_ARM64)
+  #include <intrin.h>
+  #define TIMER_PAUSE() __yield()
+#elif defined(__aarch64__) || defined(__arm__)
+  #define TIMER_PAUSE() asm volatile("yield")
+#else
+  #define TIMER_PAUSE() std::this_thread::yield()
+#endif
+
+// local includes
+#include "common.h"
+
+using namespace std::literals;
+
+namespace platf {
+  spin_calibration_t::spin_calibration_t(int spin_budget_percent):
+      _spin_budget_percent {std::clamp(spin_budget_percent, 0, 100)},
+      _margin {INITIAL_MARGIN} {
+  }
+
+  std::chrono::nanoseconds spin_calibration_t::sleep_duration(std::chrono::nanoseconds duration) const {
+    auto spin = std::min(_margin, duration * _spin_budget_percent / 100);
+    return std::max(duration - spin, 0ns);
+  }
+
+  void spin_calibration_t::record(std::chrono::nanoseconds overshoot) {
+    overshoot = std::clamp(overshoot, MIN_MARGIN, MAX_MARGIN);
+
+    if (overshoot > _margin) {
+      _margin = overshoot;
+    } else {
+      _margin -= (_margin - overshoot) / DECAY_DIVISOR;
+    }
+  }
+
+  std::chrono::nanoseconds spin_calibration_t::margin() const {
+    return _margin;
+  }
+
+  /**
+   * @brief Sleeps on the platform timer until the calibrated margin before the deadline,
+   *        then spins with pause instructions until the deadline.
+   */
+  class hybrid_timer_t: public high_precision_timer {
+  public:
+    explicit hybrid_timer_t(int spin_budget_percent):
+        _timer {create_high_precision_timer()},
+        _calibration {spin_budget_percent} {
+    }
+
+    void sleep_for(const std::chrono::nanoseconds &duration) override {
+      auto start = std::chrono::steady_clock::now();
+      auto deadline = start + duration;
+
+      if (auto sleep = _calibration.sleep_duration(duration); sleep > 0ns) {
+        _timer->sleep_for(sleep);
+        _calibration.record(std::chrono::steady_clock::now() - (start + sleep));
+      }
+
+      while (std::chrono::steady_clock::now() < deadline) {
+        TIMER_PAUSE();
+      }
+    }
+
+    operator bool() override {
+      return _timer && *_timer;
+    }
+
+  private:
+    std::unique_ptr<high_precision_timer> _timer;
+    spin_calibration_t _calibration;
+  };
+
+  std::unique_ptr<high_precision_timer> create_hybrid_timer(int spin_budget_percent) {
+    return std::make_unique<hybrid_timer_t>(spin_budget_percent);
+  }
+}  // namespace platf
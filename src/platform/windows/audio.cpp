@@ -4,6 +4,9 @@
  */
 #define INITGUID
 
+// standard includes
+#include <bit>
+
 // platform includes
 #include <audioclient.h>
 #include <avrt.h>
@@ -215,6 +218,7 @@ namespace platf::audio {
   using device_t = util::safe_ptr<IMMDevice, Release<IMMDevice>>;
   using collection_t = util::safe_ptr<IMMDeviceCollection, Release<IMMDeviceCollection>>;
   using audio_client_t = util::safe_ptr<IAudioClient, Release<IAudioClient>>;
+  using audio_client3_t = util::safe_ptr<IAudioClient3, Release<IAudioClient3>>;
   using audio_capture_t = util::safe_ptr<IAudioCaptureClient, Release<IAudioCaptureClient>>;
   using wave_format_t = util::safe_ptr<WAVEFORMATEX, co_task_free<WAVEFORMATEX>>;
   using wstring_t = util::safe_ptr<WCHAR, co_task_free<WCHAR>>;
@@ -274,7 +278,7 @@ namespace platf::audio {
     },
   };
 
-  audio_client_t make_audio_client(device_t &device, const format_t &format) {
+  audio_client_t activate_audio_client(device_t &device) {
     audio_client_t audio_client;
     auto status = device->Activate(
       IID_IAudioClient,
@@ -289,6 +293,154 @@ namespace platf::audio {
       return nullptr;
     }
 
+    return audio_client;
+  }
+
+  /**
+   * @brief Initialize a loopback stream with the smallest period the audio engine supports.
+   * @details This requires IAudioClient3 and a capture format the engine mixes in, since the
+   *          low latency streams can't convert the format.
+   * @return `true` if the stream was initialized, otherwise the client is left untouched.
+   */
+  bool initialize_low_latency(audio_client_t &audio_client, WAVEFORMATEXTENSIBLE &capture_waveformat) {
+    audio_client3_t audio_client3;
+    if (FAILED(audio_client->QueryInterface(__uuidof(IAudioClient3), (void **) &audio_client3))) {
+      return false;
+    }
+
+    wave_format_t closest_waveformat;
+    if (audio_client->IsFormatSupported(AUDCLNT_SHAREMODE_SHARED, (LPWAVEFORMATEX) &capture_waveformat, &closest_waveformat) != S_OK) {
+      BOOST_LOG(debug) << "Audio capture format needs conversion, using the default period"sv;
+      return false;
+    }
+
+    UINT32 default_period;
+    UINT32 fundamental_period;
+    UINT32 min_period;
+    UINT32 max_period;
+    auto status = audio_client3->GetSharedModeEnginePeriod((LPWAVEFORMATEX) &capture_waveformat, &default_period, &fundamental_period, &min_period, &max_period);
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't get the periods of the audio engine: [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    status = audio_client3->InitializeSharedAudioStream(
+      AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+      min_period,
+      (LPWAVEFORMATEX) &capture_waveformat,
+      nullptr
+    );
+    if (FAILED(status)) {
+      BOOST_LOG(debug) << "Couldn't initialize low latency audio stream: [0x"sv << util::hex(status).to_string_view() << ']';
+      return false;
+    }
+
+    BOOST_LOG(info) << "Audio capture period is "sv << min_period << " frames, down from "sv << default_period;
+
+    return true;
+  }
+
+  /**
+   * @brief How the captured samples are turned into the samples of the stream.
+   */
+  struct capture_format_t {
+    platf::audio_sample_format_e sample_format;  ///< The format of the captured samples
+    int channels;  ///< The channels of a captured frame
+    int block_align;  ///< The bytes of a captured frame
+    std::vector<float> mix_matrix;  ///< From the captured channels to the stream's, empty if they're only copied
+  };
+
+  /**
+   * @brief Get the format of the samples of a mix format that can be captured as is.
+   * @return The format, or `std::nullopt` if the audio engine has to convert it.
+   */
+  std::optional<platf::audio_sample_format_e> native_sample_format(const WAVEFORMATEXTENSIBLE &waveformat) {
+    if (waveformat.Format.nSamplesPerSec != SAMPLE_RATE ||
+        waveformat.Format.nChannels > platf::MAX_AUDIO_CHANNELS ||
+        std::popcount(waveformat.dwChannelMask) != waveformat.Format.nChannels ||
+        (waveformat.dwChannelMask & waveformat_mask_stereo) != waveformat_mask_stereo) {
+      return std::nullopt;
+    }
+
+    if (waveformat.SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT && waveformat.Format.wBitsPerSample == 32) {
+      return platf::audio_sample_format_e::f32;
+    }
+
+    if (waveformat.SubFormat == KSDATAFORMAT_SUBTYPE_PCM) {
+      switch (waveformat.Format.wBitsPerSample) {
+        case 32:
+          // The valid bits of 24-bit samples in 32 are the high ones
+          return platf::audio_sample_format_e::s32;
+        case 24:
+          return platf::audio_sample_format_e::s24;
+        case 16:
+          return platf::audio_sample_format_e::s16;
+      }
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Initialize a loopback stream in the format the audio engine mixes in.
+   * @details The samples are then converted and mixed into the stream's layout by the capture in one pass,
+   *          instead of by the audio engine before it.
+   * @return `true` if the stream was initialized.
+   */
+  bool initialize_native(audio_client_t &audio_client, device_t &device, const format_t &format, const WAVEFORMATEXTENSIBLE &mixer_waveformat, capture_format_t &capture_format) {
+    auto sample_format = native_sample_format(mixer_waveformat);
+    if (!sample_format) {
+      BOOST_LOG(debug) << "Audio mixer format "sv << logging::bracket(waveformat_to_pretty_string(mixer_waveformat)) << " needs conversion by the audio engine"sv;
+      return false;
+    }
+
+    auto capture_waveformat = mixer_waveformat;
+    if (!initialize_low_latency(audio_client, capture_waveformat)) {
+      // A failed attempt may leave the client in an unknown state
+      audio_client = activate_audio_client(device);
+      if (!audio_client) {
+        return false;
+      }
+
+      auto status = audio_client->Initialize(
+        AUDCLNT_SHAREMODE_SHARED,
+        AUDCLNT_STREAMFLAGS_LOOPBACK | AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+        0,
+        0,
+        (LPWAVEFORMATEX) &capture_waveformat,
+        nullptr
+      );
+      if (FAILED(status)) {
+        BOOST_LOG(debug) << "Couldn't initialize audio client in the mixer format: [0x"sv << util::hex(status).to_string_view() << ']';
+
+        audio_client = activate_audio_client(device);
+        return false;
+      }
+    }
+
+    capture_format = capture_format_t {
+      *sample_format,
+      capture_waveformat.Format.nChannels,
+      capture_waveformat.Format.nBlockAlign,
+      platf::audio_mix_matrix(capture_waveformat.dwChannelMask, format.capture_waveformat_channel_mask),
+    };
+
+    BOOST_LOG(info) << "Audio capture format is "sv << logging::bracket(waveformat_to_pretty_string(capture_waveformat));
+    if (!capture_format.mix_matrix.empty()) {
+      BOOST_LOG(info) << "Captured audio is mixed into ["sv << format.name << ']';
+    }
+
+    return true;
+  }
+
+  audio_client_t make_audio_client(device_t &device, const format_t &format, capture_format_t &capture_format) {
+    auto audio_client = activate_audio_client(device);
+    if (!audio_client) {
+      return nullptr;
+    }
+
+    HRESULT status;
+
     WAVEFORMATEXTENSIBLE capture_waveformat =
       create_waveformat(sample_format_e::f32, format.channel_count, format.capture_waveformat_channel_mask);
 
@@ -300,17 +452,45 @@ namespace platf::audio {
         return nullptr;
       }
 
-      // Prefer the native channel layout of captured audio device when channel counts match
-      if (mixer_waveformat->nChannels == format.channel_count &&
-          mixer_waveformat->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
-          mixer_waveformat->cbSize >= 22) {
-        auto waveformatext_pointer = reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(mixer_waveformat.get());
-        capture_waveformat.dwChannelMask = waveformatext_pointer->dwChannelMask;
-      }
-
       BOOST_LOG(info) << "Audio mixer format is "sv << mixer_waveformat->wBitsPerSample << "-bit, "sv
                       << mixer_waveformat->nSamplesPerSec << " Hz, "sv
                       << ((mixer_waveformat->nSamplesPerSec != 48000) ? "will be resampled to 48000 by Windows"sv : "no resampling needed"sv);
+
+      if (mixer_waveformat->wFormatTag == WAVE_FORMAT_EXTENSIBLE && mixer_waveformat->cbSize >= 22) {
+        auto waveformatext_pointer = reinterpret_cast<const WAVEFORMATEXTENSIBLE *>(mixer_waveformat.get());
+
+        // Capture what the audio engine mixed without another pass through it
+        if (initialize_native(audio_client, device, format, *waveformatext_pointer, capture_format)) {
+          return audio_client;
+        }
+        if (!audio_client) {
+          return nullptr;
+        }
+
+        // Prefer the native channel layout of captured audio device when channel counts match
+        if (mixer_waveformat->nChannels == format.channel_count) {
+          capture_waveformat.dwChannelMask = waveformatext_pointer->dwChannelMask;
+        }
+      }
+    }
+
+    capture_format = capture_format_t {
+      platf::audio_sample_format_e::f32,
+      format.channel_count,
+      capture_waveformat.Format.nBlockAlign,
+      {},
+    };
+
+    if (initialize_low_latency(audio_client, capture_waveformat)) {
+      BOOST_LOG(info) << "Audio capture format is "sv << logging::bracket(waveformat_to_pretty_string(capture_waveformat));
+
+      return audio_client;
+    }
+
+    // A failed attempt may leave the client in an unknown state
+    audio_client = activate_audio_client(device);
+    if (!audio_client) {
+      return nullptr;
     }
 
     status = audio_client->Initialize(
@@ -422,26 +602,66 @@ namespace platf::audio {
     std::atomic_bool default_render_device_changed_flag;
   };
 
+  /**
+   * @brief Translate a position of the audio engine's clock to a steady_clock time point.
+   * @param qpc_position The QueryPerformanceCounter() value in 100 ns units, as IAudioCaptureClient::GetBuffer() reports it.
+   * @return The time point.
+   */
+  std::chrono::steady_clock::time_point qpc_position_to_time(UINT64 qpc_position) {
+    static const auto frequency = []() {
+      LARGE_INTEGER frequency;
+      QueryPerformanceFrequency(&frequency);
+      return frequency.QuadPart;
+    }();
+
+    // Split to keep the counter of a long running system from overflowing
+    auto counter = qpc_counter();
+    auto now = std::chrono::nanoseconds(counter / frequency * std::nano::den + counter % frequency * std::nano::den / frequency);
+
+    return std::chrono::steady_clock::now() - (now - std::chrono::nanoseconds(qpc_position * 100));
+  }
+
   class mic_wasapi_t: public mic_t {
   public:
     capture_e sample(std::vector<float> &sample_out) override {
       auto sample_size = sample_out.size();
 
-      // Refill the sample buffer if needed
-      while (sample_buf_pos - std::begin(sample_buf) < sample_size) {
+      // Register the thread that samples, the mic may have been created on another one
+      if (!mmcss_registered) {
+        mmcss_registered = true;
+
+        DWORD task_index = 0;
+        mmcss_task_handle = AvSetMmThreadCharacteristics("Pro Audio", &task_index);
+        if (!mmcss_task_handle) {
+          BOOST_LOG(error) << "Couldn't associate audio capture thread with Pro Audio MMCSS task [0x" << util::hex(GetLastError()).to_string_view() << ']';
+        }
+      }
+
+      // The samples left over from the last packets go first
+      auto buffered = std::min<std::size_t>(sample_buf_pos - std::begin(sample_buf), sample_size);
+      std::copy_n(std::begin(sample_buf), buffered, std::begin(sample_out));
+      std::move(&sample_buf[buffered], sample_buf_pos, std::begin(sample_buf));
+      sample_buf_pos -= buffered;
+
+      last_frame_timestamp.reset();
+      if (buffered) {
+        last_frame_timestamp = sample_buf_timestamp;
+        sample_buf_timestamp += frames_duration(buffered / channels);
+      }
+
+      // The rest is converted straight into the output, what doesn't fit is kept for the next call
+      out_pos = sample_out.data() + buffered;
+      out_end = sample_out.data() + sample_size;
+      while (out_pos < out_end) {
         auto capture_result = _fill_buffer();
         if (capture_result != capture_e::ok) {
+          // Keep what was captured so far, nothing was left over since it was all converted into the output
+          sample_buf_pos = std::copy(sample_out.data(), out_pos, std::begin(sample_buf));
+          sample_buf_timestamp = last_frame_timestamp.value_or(std::chrono::steady_clock::now());
           return capture_result;
         }
       }
 
-      // Fill the output buffer with samples
-      std::copy_n(std::begin(sample_buf), sample_size, std::begin(sample_out));
-
-      // Move any excess samples to the front of the buffer
-      std::move(&sample_buf[sample_size], sample_buf_pos, std::begin(sample_buf));
-      sample_buf_pos -= sample_size;
-
       return capture_e::ok;
     }
 
@@ -489,7 +709,7 @@ namespace platf::audio {
         }
 
         BOOST_LOG(debug) << "Trying audio format ["sv << format.name << ']';
-        audio_client = make_audio_client(device, format);
+        audio_client = make_audio_client(device, format, capture_format);
 
         if (audio_client) {
           BOOST_LOG(debug) << "Found audio format ["sv << format.name << ']';
@@ -533,14 +753,6 @@ namespace platf::audio {
         return -1;
       }
 
-      {
-        DWORD task_index = 0;
-        mmcss_task_handle = AvSetMmThreadCharacteristics("Pro Audio", &task_index);
-        if (!mmcss_task_handle) {
-          BOOST_LOG(error) << "Couldn't associate audio capture thread with Pro Audio MMCSS task [0x" << util::hex(GetLastError()).to_string_view() << ']';
-        }
-      }
-
       status = audio_client->Start();
       if (FAILED(status)) {
         BOOST_LOG(error) << "Couldn't start recording [0x"sv << util::hex(status).to_string_view() << ']';
@@ -551,6 +763,10 @@ namespace platf::audio {
       return 0;
     }
 
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp() override {
+      return last_frame_timestamp;
+    }
+
     ~mic_wasapi_t() override {
       if (device_enum) {
         device_enum->UnregisterEndpointNotificationCallback(&endpt_notification);
@@ -566,19 +782,25 @@ namespace platf::audio {
     }
 
   private:
-    capture_e _fill_buffer() {
-      HRESULT status;
+    std::chrono::nanoseconds frames_duration(std::size_t frames) {
+      return std::chrono::nanoseconds(frames * std::nano::den / SAMPLE_RATE);
+    }
+
+    /**
+     * @brief Convert captured frames to the stream's format and layout.
+     */
+    void convert_frames(const BYTE *src, float *dst, std::uint32_t frames, bool silent) {
+      if (silent) {
+        std::fill_n(dst, frames * channels, 0.0f);
+        return;
+      }
 
-      // Total number of samples
-      struct sample_aligned_t {
-        std::uint32_t uninitialized;
-        float *samples;
-      } sample_aligned;
+      auto &mix_matrix = capture_format.mix_matrix;
+      platf::remap_audio_frames(capture_format.sample_format, src, capture_format.channels, dst, channels, mix_matrix.empty() ? nullptr : mix_matrix.data(), (int) frames);
+    }
 
-      // number of samples / number of channels
-      struct block_aligned_t {
-        std::uint32_t audio_sample_size;
-      } block_aligned;
+    capture_e _fill_buffer() {
+      HRESULT status;
 
       // Check if the default audio device has changed
       if (endpt_notification.check_default_render_device_changed()) {
@@ -608,13 +830,16 @@ namespace platf::audio {
         SUCCEEDED(status) && packet_size > 0;
         status = audio_capture->GetNextPacketSize(&packet_size)
       ) {
+        BYTE *samples;
+        std::uint32_t frames;
         DWORD buffer_flags;
+        UINT64 qpc_position;
         status = audio_capture->GetBuffer(
-          (BYTE **) &sample_aligned.samples,
-          &block_aligned.audio_sample_size,
+          &samples,
+          &frames,
           &buffer_flags,
           nullptr,
-          nullptr
+          &qpc_position
         );
 
         switch (status) {
@@ -631,22 +856,31 @@ namespace platf::audio {
           BOOST_LOG(debug) << "Audio capture signaled buffer discontinuity";
         }
 
-        sample_aligned.uninitialized = std::end(sample_buf) - sample_buf_pos;
-        auto n = std::min(sample_aligned.uninitialized, block_aligned.audio_sample_size * channels);
+        // Into the output first, then into the sample buffer for the next call
+        auto out_frames = std::min<std::uint32_t>(frames, (out_end - out_pos) / channels);
+        auto buffer_frames = std::min<std::uint32_t>(frames - out_frames, (std::end(sample_buf) - sample_buf_pos) / channels);
 
-        if (n < block_aligned.audio_sample_size * channels) {
+        if (out_frames + buffer_frames < frames) {
           BOOST_LOG(warning) << "Audio capture buffer overflow";
         }
 
-        if (buffer_flags & AUDCLNT_BUFFERFLAGS_SILENT) {
-          std::fill_n(sample_buf_pos, n, 0);
-        } else {
-          std::copy_n(sample_aligned.samples, n, sample_buf_pos);
+        // When the audio engine recorded the first frame of the packet
+        auto captured = buffer_flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR ? std::chrono::steady_clock::now() : qpc_position_to_time(qpc_position);
+        if (out_frames && !last_frame_timestamp) {
+          last_frame_timestamp = captured;
+        }
+        if (buffer_frames && sample_buf_pos == std::begin(sample_buf)) {
+          sample_buf_timestamp = captured + frames_duration(out_frames);
         }
 
-        sample_buf_pos += n;
+        bool silent = buffer_flags & AUDCLNT_BUFFERFLAGS_SILENT;
+        convert_frames(samples, out_pos, out_frames, silent);
+        convert_frames(samples + out_frames * capture_format.block_align, sample_buf_pos, buffer_frames, silent);
 
-        audio_capture->ReleaseBuffer(block_aligned.audio_sample_size);
+        out_pos += out_frames * channels;
+        sample_buf_pos += buffer_frames * channels;
+
+        audio_capture->ReleaseBuffer(frames);
       }
 
       if (status == AUDCLNT_E_DEVICE_INVALIDATED) {
@@ -673,10 +907,21 @@ namespace platf::audio {
 
     REFERENCE_TIME default_latency_ms;
 
+    capture_format_t capture_format;
+
     util::buffer_t<float> sample_buf;
     float *sample_buf_pos;
     int channels;
 
+    // Where the frames being captured are converted to, in the output of sample()
+    float *out_pos;
+    float *out_end;
+
+    // When the first samples of the frame sample() returned last, and of the sample buffer, were captured
+    std::optional<std::chrono::steady_clock::time_point> last_frame_timestamp;
+    std::chrono::steady_clock::time_point sample_buf_timestamp;
+
+    bool mmcss_registered = false;
     HANDLE mmcss_task_handle = NULL;
   };
 
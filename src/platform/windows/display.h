@@ -4,6 +4,9 @@
  */
 #pragma once
 
+// standard includes
+#include <deque>
+
 // platform includes
 #include <d3d11.h>
 #include <d3d11_4.h>
@@ -61,6 +64,7 @@ namespace platf::dxgi {
   using depth_stencil_state_t = util::safe_ptr<ID3D11DepthStencilState, Release<ID3D11DepthStencilState>>;
   using depth_stencil_view_t = util::safe_ptr<ID3D11DepthStencilView, Release<ID3D11DepthStencilView>>;
   using keyed_mutex_t = util::safe_ptr<IDXGIKeyedMutex, Release<IDXGIKeyedMutex>>;
+  using query_t = util::safe_ptr<ID3D11Query, Release<ID3D11Query>>;
 
   namespace video {
     using device_t = util::safe_ptr<ID3D11VideoDevice, Release<ID3D11VideoDevice>>;
@@ -81,6 +85,14 @@ namespace platf::dxgi {
     bool visible;
   };
 
+  /**
+   * @brief Convert a pointer shape from the duplication API to a shape sent to the client.
+   * @param img_data The pointer shape.
+   * @param shape_info The info of the pointer shape.
+   * @return The shape, or `nullptr` if it's invalid.
+   */
+  std::shared_ptr<const platf::cursor_shape_t> make_cursor_shape(const util::buffer_t<std::uint8_t> &img_data, const DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info);
+
   class gpu_cursor_t {
   public:
     gpu_cursor_t():
@@ -177,7 +189,7 @@ namespace platf::dxgi {
     DXGI_FORMAT capture_format;
     D3D_FEATURE_LEVEL feature_level;
 
-    std::unique_ptr<high_precision_timer> timer = create_high_precision_timer();
+    std::unique_ptr<high_precision_timer> timer = create_hybrid_timer();
 
     typedef enum _D3DKMT_SCHEDULINGPRIORITYCLASS {
       D3DKMT_SCHEDULINGPRIORITYCLASS_IDLE,  ///< Idle priority class
@@ -228,8 +240,82 @@ namespace platf::dxgi {
     typedef NTSTATUS(WINAPI *PD3DKMTQueryAdapterInfo)(D3DKMT_QUERYADAPTERINFO *);
     typedef NTSTATUS(WINAPI *PD3DKMTCloseAdapter)(D3DKMT_CLOSEADAPTER *);
 
-    virtual bool is_hdr() override;
-    virtual bool get_hdr_metadata(SS_HDR_METADATA &metadata) override;
+    /**
+     * @brief Adapts the GPU scheduling priority class of the process while it captures.
+     * @details Streaming starts at the high class. The class is raised while the conversion of the
+     *          frames waits too long for the GPU, up to the ceiling, and lowered again when the frame
+     *          rate of the desktop drops by more than a tenth after raising it, or once the conversion
+     *          has been fast for a while. The displays capturing at once share it, and the class goes
+     *          back to normal when the last of them is destroyed.
+     */
+    class gpu_priority_t {
+    public:
+      /// The time the latency and the frame rate are averaged over before adapting the class
+      static constexpr std::chrono::seconds WINDOW {2};
+
+      /// The time a class the frame rate dropped at isn't raised to again
+      static constexpr std::chrono::seconds HOLD {30};
+
+      /// The share of the frame interval above which the conversion latency raises the class
+      static constexpr double RAISE_LATENCY = 0.25;
+
+      /// The share of the frame interval below which the conversion latency counts as fast
+      static constexpr double CALM_LATENCY = 0.0625;
+
+      /// The number of windows the conversion has to be fast in before the class is lowered
+      static constexpr int CALM_WINDOWS = 5;
+
+      /// The share of the frame rate the desktop may lose after raising the class before it's lowered again
+      static constexpr int MAX_FRAME_RATE_DROP_PERCENT = 10;
+
+      gpu_priority_t(PD3DKMTSetProcessSchedulingPriorityClass set_priority, D3DKMT_SCHEDULINGPRIORITYCLASS ceiling);
+      ~gpu_priority_t();
+
+      /**
+       * @brief Get the controller shared by the displays capturing at once, creating it if there is none.
+       * @param set_priority The function setting the class.
+       * @param ceiling The highest class that may be used.
+       * @return The controller.
+       */
+      static std::shared_ptr<gpu_priority_t> acquire(PD3DKMTSetProcessSchedulingPriorityClass set_priority, D3DKMT_SCHEDULINGPRIORITYCLASS ceiling);
+
+      /**
+       * @brief Record the time the GPU took to convert a frame, from its submission to its completion.
+       * @param latency The latency.
+       * @param frame_interval The interval between the frames of the stream.
+       */
+      void report_convert_latency(std::chrono::nanoseconds latency, std::chrono::nanoseconds frame_interval);
+
+      /**
+       * @brief Record frames presented to the desktop.
+       * @param frames The number of frames presented since the last report.
+       */
+      void report_presents(int frames);
+
+    private:
+      void set(D3DKMT_SCHEDULINGPRIORITYCLASS priority);
+      void adapt(std::chrono::steady_clock::time_point now);
+
+      std::mutex _lock;
+      PD3DKMTSetProcessSchedulingPriorityClass _set_priority;
+      D3DKMT_SCHEDULINGPRIORITYCLASS _ceiling;
+      D3DKMT_SCHEDULINGPRIORITYCLASS _priority;
+
+      std::chrono::steady_clock::time_point _window_start;
+      double _latency_sum = 0;
+      int _latency_samples = 0;
+      std::int64_t _presents = 0;
+      int _calm_windows = 0;
+
+      // The frame rate before the class was last raised, until the next window has been measured
+      std::optional<double> _raised_from_frame_rate;
+
+      // The class the frame rate dropped at, and until when it isn't raised to again
+      D3DKMT_SCHEDULINGPRIORITYCLASS _held = D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME;
+      std::chrono::steady_clock::time_point _hold_until;
+    };
+
+    std::shared_ptr<gpu_priority_t> gpu_priority;
 
     const char *dxgi_format_to_string(DXGI_FORMAT format);
     const char *colorspace_to_string(DXGI_COLOR_SPACE_TYPE type);
@@ -240,9 +326,22 @@ namespace platf::dxgi {
       return (capture_format == DXGI_FORMAT_R16G16B16A16_FLOAT) ? 8 : 4;
     }
 
+    hdr_state_t query_hdr_state() override;
+
     virtual capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) = 0;
     virtual capture_e release_snapshot() = 0;
     virtual int complete_img(img_t *img, bool dummy) = 0;
+
+    /**
+     * @brief Get the regions of the captured image the user works in.
+     * @details The foreground window unless it covers the whole display, and the cursor when it's blended in.
+     * @param cursor_blended Whether the image has the cursor blended onto it.
+     * @return The regions, none for rotated displays.
+     */
+    std::vector<platf::damage_rect_t> focus_regions(bool cursor_blended);
+
+    // The cursor as last reported by the duplication API, attached to the images it's left out of
+    platf::cursor_state_t cursor_state {};
   };
 
   /**
@@ -294,7 +393,18 @@ namespace platf::dxgi {
     capture_e reset(dup_t::pointer dup_p = dup_t::pointer());
     capture_e release_frame();
 
+    /**
+     * @brief Get the regions of the desktop that changed with the acquired frame.
+     * @param frame_info The info of the acquired frame.
+     * @return The changed regions, or `std::nullopt` if they're not known.
+     */
+    std::optional<std::vector<platf::damage_rect_t>> damage(const DXGI_OUTDUPL_FRAME_INFO &frame_info);
+
     ~duplication_t();
+
+  private:
+    // Reused for the move and dirty rects of each frame
+    std::vector<std::uint8_t> metadata;
   };
 
   /**
@@ -302,12 +412,19 @@ namespace platf::dxgi {
    */
   class display_ddup_ram_t: public display_ram_t {
   public:
+    capture_backend_t capture_backend() const override {
+      return {"ddx"sv, true};
+    }
+
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
 
     duplication_t dup;
     cursor_t cursor;
+
+    // Whether the last image was the desktop without a cursor blended onto it
+    bool last_output_plain {};
   };
 
   /**
@@ -315,6 +432,10 @@ namespace platf::dxgi {
    */
   class display_ddup_vram_t: public display_vram_t {
   public:
+    capture_backend_t capture_backend() const override {
+      return {"ddx"sv, true};
+    }
+
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
@@ -335,6 +456,12 @@ namespace platf::dxgi {
     texture2d_t old_surface_delayed_destruction;
     std::chrono::steady_clock::time_point old_surface_timestamp;
     std::variant<std::monostate, texture2d_t, std::shared_ptr<platf::img_t>> last_frame_variant;
+
+    // Whether the last image held a desktop frame, rather than a dummy
+    bool last_output_desktop {};
+
+    // Where the cursor was blended onto the last image, so moving it only damages its old and new places
+    std::optional<platf::damage_rect_t> last_cursor_rect;
   };
 
   /**
@@ -345,7 +472,10 @@ namespace platf::dxgi {
     winrt::Windows::Graphics::Capture::GraphicsCaptureItem item {nullptr};
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool frame_pool {nullptr};
     winrt::Windows::Graphics::Capture::GraphicsCaptureSession capture_session {nullptr};
-    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame produced_frame {nullptr}, consumed_frame {nullptr};
+    // The frames waiting for the capture thread, the oldest first
+    std::deque<winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame> produced_frames;
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame consumed_frame {nullptr};
+    int pool_size;
     SRWLOCK frame_lock = SRWLOCK_INIT;
     CONDITION_VARIABLE frame_present_cv;
 
@@ -368,6 +498,10 @@ namespace platf::dxgi {
     wgc_capture_t dup;
 
   public:
+    capture_backend_t capture_backend() const override {
+      return {"wgc"sv, true};
+    }
+
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
@@ -380,6 +514,10 @@ namespace platf::dxgi {
     wgc_capture_t dup;
 
   public:
+    capture_backend_t capture_backend() const override {
+      return {"wgc"sv, true};
+    }
+
     int init(const ::video::config_t &config, const std::string &display_name);
     capture_e snapshot(const pull_free_image_cb_t &pull_free_image_cb, std::shared_ptr<platf::img_t> &img_out, std::chrono::milliseconds timeout, bool cursor_visible) override;
     capture_e release_snapshot() override;
@@ -4,6 +4,9 @@
  */
 // standard includes
 #include <cmath>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
 
 // platform includes
@@ -158,6 +161,47 @@ namespace platf::dxgi {
     }
   }
 
+  std::optional<std::vector<platf::damage_rect_t>> duplication_t::damage(const DXGI_OUTDUPL_FRAME_INFO &frame_info) {
+    if (!frame_info.TotalMetadataBufferSize) {
+      return std::nullopt;
+    }
+
+    if (metadata.size() < frame_info.TotalMetadataBufferSize) {
+      metadata.resize(frame_info.TotalMetadataBufferSize);
+    }
+
+    std::vector<platf::damage_rect_t> rects;
+    auto add_rect = [&rects](const RECT &rect) {
+      rects.emplace_back(platf::damage_rect_t {rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top});
+    };
+
+    // Moved regions only change where they're moved to
+    UINT size = 0;
+    auto status = dup->GetFrameMoveRects(metadata.size(), (DXGI_OUTDUPL_MOVE_RECT *) metadata.data(), &size);
+    if (FAILED(status)) {
+      BOOST_LOG(verbose) << "Couldn't get frame move rects [0x"sv << util::hex(status).to_string_view() << ']';
+      return std::nullopt;
+    }
+
+    auto move_rects = (DXGI_OUTDUPL_MOVE_RECT *) metadata.data();
+    for (UINT x = 0; x < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); ++x) {
+      add_rect(move_rects[x].DestinationRect);
+    }
+
+    status = dup->GetFrameDirtyRects(metadata.size(), (RECT *) metadata.data(), &size);
+    if (FAILED(status)) {
+      BOOST_LOG(verbose) << "Couldn't get frame dirty rects [0x"sv << util::hex(status).to_string_view() << ']';
+      return std::nullopt;
+    }
+
+    auto dirty_rects = (RECT *) metadata.data();
+    for (UINT x = 0; x < size / sizeof(RECT); ++x) {
+      add_rect(dirty_rects[x]);
+    }
+
+    return rects;
+  }
+
   capture_e duplication_t::reset(dup_t::pointer dup_p) {
     auto capture_status = release_frame();
 
@@ -240,6 +284,7 @@ namespace platf::dxgi {
 
       platf::capture_e status = capture_e::ok;
       std::shared_ptr<img_t> img_out;
+      auto snapshot_begin = std::chrono::steady_clock::now();
 
       // Try to continue frame pacing group, snapshot() is called with zero timeout after waiting for client frame interval
       if (frame_pacing_group_start) {
@@ -260,6 +305,7 @@ namespace platf::dxgi {
           sleep_overshoot_logger.first_point(sleep_target);
           sleep_overshoot_logger.second_point_now_and_log();
 
+          snapshot_begin = std::chrono::steady_clock::now();
           status = snapshot(pull_free_image_cb, img_out, 0ms, *cursor);
 
           if (status == capture_e::ok && img_out) {
@@ -273,6 +319,7 @@ namespace platf::dxgi {
 
       // Start new frame pacing group if necessary, snapshot() is called with non-zero timeout
       if (status == capture_e::timeout || (status == capture_e::ok && !frame_pacing_group_start)) {
+        snapshot_begin = std::chrono::steady_clock::now();
         status = snapshot(pull_free_image_cb, img_out, 200ms, *cursor);
 
         if (status == capture_e::ok && img_out) {
@@ -306,6 +353,9 @@ namespace platf::dxgi {
         }
       }
 
+      // Only the last snapshot counts, the one continuing a frame pacing group is retried when it times out
+      capture_stats().snapshot(status, snapshot_begin, img_out.get());
+
       switch (status) {
         case platf::capture_e::reinit:
         case platf::capture_e::error:
@@ -317,6 +367,9 @@ namespace platf::dxgi {
           }
           break;
         case platf::capture_e::ok:
+          if (img_out && config::video.roi_qp_delta > 0) {
+            img_out->focus = focus_regions(!img_out->cursor);
+          }
           if (!push_captured_image_cb(std::move(img_out), true)) {
             return capture_e::ok;
           }
@@ -335,6 +388,161 @@ namespace platf::dxgi {
     return capture_e::ok;
   }
 
+  namespace {
+    std::mutex gpu_priority_lock;
+    std::weak_ptr<display_base_t::gpu_priority_t> shared_gpu_priority;
+
+    std::string_view priority_name(display_base_t::D3DKMT_SCHEDULINGPRIORITYCLASS priority) {
+      switch (priority) {
+        case display_base_t::D3DKMT_SCHEDULINGPRIORITYCLASS_REALTIME:
+          return "realtime"sv;
+        case display_base_t::D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH:
+          return "high"sv;
+        case display_base_t::D3DKMT_SCHEDULINGPRIORITYCLASS_ABOVE_NORMAL:
+          return "above normal"sv;
+        default:
+          return "normal"sv;
+      }
+    }
+  }  // namespace
+
+  display_base_t::gpu_priority_t::gpu_priority_t(PD3DKMTSetProcessSchedulingPriorityClass set_priority, D3DKMT_SCHEDULINGPRIORITYCLASS ceiling):
+      _set_priority {set_priority},
+      _ceiling {ceiling},
+      _priority {D3DKMT_SCHEDULINGPRIORITYCLASS_NORMAL},
+      _window_start {std::chrono::steady_clock::now()} {
+    set(std::min(ceiling, D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH));
+  }
+
+  display_base_t::gpu_priority_t::~gpu_priority_t() {
+    set(D3DKMT_SCHEDULINGPRIORITYCLASS_NORMAL);
+  }
+
+  std::shared_ptr<display_base_t::gpu_priority_t> display_base_t::gpu_priority_t::acquire(PD3DKMTSetProcessSchedulingPriorityClass set_priority, D3DKMT_SCHEDULINGPRIORITYCLASS ceiling) {
+    std::lock_guard lg {gpu_priority_lock};
+
+    auto gpu_priority = shared_gpu_priority.lock();
+    if (!gpu_priority) {
+      gpu_priority = std::make_shared<gpu_priority_t>(set_priority, ceiling);
+      shared_gpu_priority = gpu_priority;
+    }
+
+    return gpu_priority;
+  }
+
+  void display_base_t::gpu_priority_t::report_convert_latency(std::chrono::nanoseconds latency, std::chrono::nanoseconds frame_interval) {
+    std::lock_guard lg {_lock};
+
+    _latency_sum += (double) latency.count() / frame_interval.count();
+    ++_latency_samples;
+    adapt(std::chrono::steady_clock::now());
+  }
+
+  void display_base_t::gpu_priority_t::report_presents(int frames) {
+    std::lock_guard lg {_lock};
+
+    _presents += frames;
+    adapt(std::chrono::steady_clock::now());
+  }
+
+  void display_base_t::gpu_priority_t::set(D3DKMT_SCHEDULINGPRIORITYCLASS priority) {
+    if (priority == _priority) {
+      return;
+    }
+
+    if (FAILED(_set_priority(GetCurrentProcess(), priority))) {
+      BOOST_LOG(warning) << "Failed to adjust GPU priority. Please run application as administrator for optimal performance.";
+      return;
+    }
+
+    BOOST_LOG(debug) << "Using "sv << priority_name(priority) << " GPU priority"sv;
+    _priority = priority;
+  }
+
+  void display_base_t::gpu_priority_t::adapt(std::chrono::steady_clock::time_point now) {
+    auto elapsed = now - _window_start;
+    if (elapsed < WINDOW) {
+      return;
+    }
+
+    auto frame_rate = (double) _presents * std::chrono::nanoseconds(1s).count() / std::chrono::nanoseconds(elapsed).count();
+    auto latency = _latency_samples ? _latency_sum / _latency_samples : 0.0;
+    auto measured = _latency_samples > 0;
+    auto raised_from_frame_rate = std::exchange(_raised_from_frame_rate, std::nullopt);
+
+    _window_start = now;
+    _latency_sum = 0;
+    _latency_samples = 0;
+    _presents = 0;
+
+    // The game suffers from the class it was raised to
+    if (raised_from_frame_rate && frame_rate * 100 < *raised_from_frame_rate * (100 - MAX_FRAME_RATE_DROP_PERCENT)) {
+      BOOST_LOG(info) << "Desktop frame rate dropped from "sv << *raised_from_frame_rate << " to "sv << frame_rate << " fps at "sv << priority_name(_priority) << " GPU priority, backing off"sv;
+
+      _held = _priority;
+      _hold_until = now + HOLD;
+      set((D3DKMT_SCHEDULINGPRIORITYCLASS) (_priority - 1));
+      return;
+    }
+
+    if (!measured) {
+      return;
+    }
+
+    if (latency > RAISE_LATENCY) {
+      _calm_windows = 0;
+
+      auto next = (D3DKMT_SCHEDULINGPRIORITYCLASS) (_priority + 1);
+      if (next > _ceiling || (next >= _held && now < _hold_until)) {
+        return;
+      }
+
+      set(next);
+      if (_priority == next) {
+        _raised_from_frame_rate = frame_rate;
+      }
+    } else if (latency < CALM_LATENCY && ++_calm_windows >= CALM_WINDOWS) {
+      _calm_windows = 0;
+
+      if (_priority > D3DKMT_SCHEDULINGPRIORITYCLASS_ABOVE_NORMAL) {
+        set((D3DKMT_SCHEDULINGPRIORITYCLASS) (_priority - 1));
+      }
+    } else if (latency >= CALM_LATENCY) {
+      _calm_windows = 0;
+    }
+  }
+
+  std::vector<platf::damage_rect_t> display_base_t::focus_regions(bool cursor_blended) {
+    std::vector<platf::damage_rect_t> regions;
+
+    // The images aren't rotated, unlike the desktop coordinates
+    if (display_rotation != DXGI_MODE_ROTATION_UNSPECIFIED && display_rotation != DXGI_MODE_ROTATION_IDENTITY) {
+      return regions;
+    }
+
+    // The window is placed in desktop coordinates, the offset starts at the virtual screen
+    auto left = offset_x + GetSystemMetrics(SM_XVIRTUALSCREEN);
+    auto top = offset_y + GetSystemMetrics(SM_YVIRTUALSCREEN);
+
+    RECT window_rect;
+    auto window = GetForegroundWindow();
+    if (window && !IsIconic(window) && SUCCEEDED(DwmGetWindowAttribute(window, DWMWA_EXTENDED_FRAME_BOUNDS, &window_rect, sizeof(window_rect)))) {
+      platf::damage_rect_t rect {(int) window_rect.left - left, (int) window_rect.top - top, (int) (window_rect.right - window_rect.left), (int) (window_rect.bottom - window_rect.top)};
+
+      // A fullscreen window would lower the QP of the whole frame
+      const bool covers_display = rect.x <= 0 && rect.y <= 0 && rect.x + rect.width >= width && rect.y + rect.height >= height;
+      if (!covers_display) {
+        regions.emplace_back(rect);
+      }
+    }
+
+    if (cursor_blended && cursor_state.visible && cursor_state.shape) {
+      regions.push_back({cursor_state.x, cursor_state.y, cursor_state.shape->width, cursor_state.shape->height});
+    }
+
+    return regions;
+  }
+
   /**
    * @brief Tests to determine if the Desktop Duplication API can capture the given output.
    * @details When testing for enumeration only, we avoid resyncing the thread desktop.
@@ -667,10 +875,8 @@ namespace platf::dxgi {
             }
           }
           BOOST_LOG(info) << "Active GPU has HAGS " << (hags_enabled ? "enabled" : "disabled");
-          BOOST_LOG(info) << "Using " << (priority == D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH ? "high" : "realtime") << " GPU priority";
-          if (FAILED(d3dkmt_set_process_priority(GetCurrentProcess(), priority))) {
-            BOOST_LOG(warning) << "Failed to adjust GPU priority. Please run application as administrator for optimal performance.";
-          }
+          BOOST_LOG(info) << "Using up to " << (priority == D3DKMT_SCHEDULINGPRIORITYCLASS_HIGH ? "high" : "realtime") << " GPU priority";
+          gpu_priority = gpu_priority_t::acquire(d3dkmt_set_process_priority, priority);
         } else {
           BOOST_LOG(error) << "Couldn't load D3DKMTSetProcessSchedulingPriorityClass function from gdi32.dll to adjust GPU priority";
         }
@@ -729,37 +935,29 @@ namespace platf::dxgi {
       return -1;
     }
 
+    // IsCurrent() turns false when the HDR state changes, so it's only queried again by the next display
+    refresh_hdr_state();
+
     return 0;
   }
 
-  bool display_base_t::is_hdr() {
+  hdr_state_t display_base_t::query_hdr_state() {
     dxgi::output6_t output6 {};
+    hdr_state_t state {};
 
     auto status = output->QueryInterface(IID_IDXGIOutput6, (void **) &output6);
     if (FAILED(status)) {
       BOOST_LOG(warning) << "Failed to query IDXGIOutput6 from the output"sv;
-      return false;
+      return state;
     }
 
     DXGI_OUTPUT_DESC1 desc1;
     output6->GetDesc1(&desc1);
 
-    return desc1.ColorSpace == DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020;
-  }
-
-  bool display_base_t::get_hdr_metadata(SS_HDR_METADATA &metadata) {
-    dxgi::output6_t output6 {};
-
-    std::memset(&metadata, 0, sizeof(metadata));
+    state.enabled = desc1.ColorSpace == DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020;
+    state.has_metadata = true;
 
-    auto status = output->QueryInterface(IID_IDXGIOutput6, (void **) &output6);
-    if (FAILED(status)) {
-      BOOST_LOG(warning) << "Failed to query IDXGIOutput6 from the output"sv;
-      return false;
-    }
-
-    DXGI_OUTPUT_DESC1 desc1;
-    output6->GetDesc1(&desc1);
+    auto &metadata = state.metadata;
 
     // The primaries reported here seem to correspond to scRGB (Rec. 709)
     // which we then convert to Rec 2020 in our scRGB FP16 -> PQ shader
@@ -797,7 +995,7 @@ namespace platf::dxgi {
 
     metadata.maxFullFrameLuminance = desc1.MaxFullFrameLuminance;
 
-    return true;
+    return state;
   }
 
   const char *format_str[] = {
@@ -981,41 +1179,182 @@ namespace platf::dxgi {
 }  // namespace platf::dxgi
 
 namespace platf {
-  /**
-   * Pick a display adapter and capture method.
-   * @param hwdevice_type enables possible use of hardware encoder
-   */
-  std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
-    if (config::video.capture == "ddx" || config::video.capture.empty()) {
+  namespace {
+    /**
+     * @brief Create and initialize a display captured by a backend.
+     * @tparam vram_t The display capturing into video memory.
+     * @tparam ram_t The display capturing into system memory.
+     * @return The display, or nullptr if the backend can't capture it.
+     */
+    template<class vram_t, class ram_t>
+    std::shared_ptr<dxgi::display_base_t> make_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+      std::shared_ptr<dxgi::display_base_t> disp;
       if (hwdevice_type == mem_type_e::dxgi) {
-        auto disp = std::make_shared<dxgi::display_ddup_vram_t>();
-
-        if (!disp->init(config, display_name)) {
-          return disp;
-        }
+        disp = std::make_shared<vram_t>();
       } else if (hwdevice_type == mem_type_e::system) {
-        auto disp = std::make_shared<dxgi::display_ddup_ram_t>();
+        disp = std::make_shared<ram_t>();
+      } else {
+        return nullptr;
+      }
+
+      if (disp->init(config, display_name)) {
+        return nullptr;
+      }
+
+      return disp;
+    }
+
+    std::shared_ptr<dxgi::display_base_t> make_ddup_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+      return make_display<dxgi::display_ddup_vram_t, dxgi::display_ddup_ram_t>(hwdevice_type, display_name, config);
+    }
+
+    std::shared_ptr<dxgi::display_base_t> make_wgc_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+      return make_display<dxgi::display_wgc_vram_t, dxgi::display_wgc_ram_t>(hwdevice_type, display_name, config);
+    }
+
+    constexpr auto CALIBRATION_DURATION = 500ms;
+    constexpr std::uint64_t CALIBRATION_MIN_FRAMES = 10;
+
+    // An idle desktop presents too few frames to compare the backends, so that is only remembered for a while
+    constexpr auto INCONCLUSIVE_CALIBRATION_LIFETIME = 1min;
+
+    /**
+     * @brief The backend calibrated for a display mode.
+     */
+    struct calibration_t {
+      bool wgc;  ///< Windows.Graphics.Capture was faster than Desktop Duplication
+      std::optional<std::chrono::steady_clock::time_point> expiry;  ///< When an inconclusive calibration is retried
+    };
 
-        if (!disp->init(config, display_name)) {
-          return disp;
+    std::mutex calibration_lock;
+    std::map<std::string, calibration_t> calibrations;
+
+    /**
+     * @brief Describe what the speed of the backends depends on, a change of any of it calibrates them again.
+     */
+    std::string display_mode_key(const dxgi::display_base_t &disp, mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+      std::stringstream key;
+      key << display_name << ' ' << disp.width << 'x' << disp.height << '@' << disp.display_refresh_rate_rounded
+          << (disp.is_hdr() ? " hdr"sv : " sdr"sv) << (hwdevice_type == mem_type_e::dxgi ? " vram "sv : " ram "sv) << config.framerate << "fps"sv;
+      return key.str();
+    }
+
+    /**
+     * @brief Capture a display for a moment to count how fast its backend is.
+     * @return The counts of the snapshots.
+     */
+    capture_stats_t::totals_t calibrate(dxgi::display_base_t &disp) {
+      std::vector<std::shared_ptr<img_t>> imgs(2);
+      auto deadline = std::chrono::steady_clock::now() + CALIBRATION_DURATION;
+
+      auto pull_free_image_callback = [&](std::shared_ptr<img_t> &img_out) -> bool {
+        for (auto &img : imgs) {
+          if (!img) {
+            img = disp.alloc_img();
+          }
+          if (img && img.use_count() == 1) {
+            img_out = img;
+            return true;
+          }
         }
+
+        return false;
+      };
+
+      auto push_captured_image_callback = [&](std::shared_ptr<img_t> &&, bool) -> bool {
+        return std::chrono::steady_clock::now() < deadline;
+      };
+
+      bool cursor = false;
+      auto status = disp.capture(push_captured_image_callback, pull_free_image_callback, &cursor);
+      if (status != capture_e::ok) {
+        BOOST_LOG(warning) << "Calibration of "sv << disp.capture_backend().name << " capture ended early"sv;
       }
+
+      return disp.capture_stats().totals();
     }
 
-    if (config::video.capture == "wgc" || config::video.capture.empty()) {
-      if (hwdevice_type == mem_type_e::dxgi) {
-        auto disp = std::make_shared<dxgi::display_wgc_vram_t>();
+    /**
+     * @brief Capture the display with the backend that was the fastest for its mode, calibrating them first if needed.
+     * @return The display, or nullptr if neither backend can capture it.
+     */
+    std::shared_ptr<display_t> calibrated_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+      // Desktop Duplication is initialized first to learn the display mode
+      auto ddup = make_ddup_display(hwdevice_type, display_name, config);
+      if (!ddup) {
+        return make_wgc_display(hwdevice_type, display_name, config);
+      }
 
-        if (!disp->init(config, display_name)) {
-          return disp;
+      auto key = display_mode_key(*ddup, hwdevice_type, display_name, config);
+
+      std::lock_guard lg {calibration_lock};
+      auto it = calibrations.find(key);
+      if (it != std::end(calibrations) && it->second.expiry && *it->second.expiry < std::chrono::steady_clock::now()) {
+        calibrations.erase(it);
+        it = std::end(calibrations);
+      }
+
+      if (it == std::end(calibrations)) {
+        BOOST_LOG(info) << "Calibrating the capture backends for ["sv << key << ']';
+
+        std::vector<capture_stats_t::totals_t> candidates {calibrate(*ddup)};
+        ddup.reset();
+
+        if (auto wgc = make_wgc_display(hwdevice_type, display_name, config)) {
+          candidates.emplace_back(calibrate(*wgc));
+        }
+
+        for (std::size_t x = 0; x < candidates.size(); ++x) {
+          BOOST_LOG(info) << (x ? "wgc"sv : "ddx"sv) << ": "sv << candidates[x].frames << " frames, "sv
+                          << candidates[x].frame_cost() * 1000 << "ms per frame"sv;
+        }
+
+        calibration_t calibration {false};
+        if (auto fastest = fastest_capture(candidates, CALIBRATION_MIN_FRAMES)) {
+          calibration.wgc = *fastest == 1;
+        } else {
+          BOOST_LOG(info) << "Too few frames were presented to compare the capture backends, using the default"sv;
+          calibration.expiry = std::chrono::steady_clock::now() + INCONCLUSIVE_CALIBRATION_LIFETIME;
         }
-      } else if (hwdevice_type == mem_type_e::system) {
-        auto disp = std::make_shared<dxgi::display_wgc_ram_t>();
 
-        if (!disp->init(config, display_name)) {
-          return disp;
+        it = calibrations.emplace(key, calibration).first;
+        BOOST_LOG(info) << "Capturing ["sv << key << "] with "sv << (calibration.wgc ? "wgc"sv : "ddx"sv);
+      }
+
+      if (it->second.wgc) {
+        if (auto wgc = make_wgc_display(hwdevice_type, display_name, config)) {
+          return wgc;
         }
       }
+
+      // The calibration left the display of the other backend uninitialized
+      if (!ddup) {
+        ddup = make_ddup_display(hwdevice_type, display_name, config);
+      }
+
+      return ddup;
+    }
+  }  // namespace
+
+  /**
+   * Pick a display adapter and capture method.
+   * @param hwdevice_type enables possible use of hardware encoder
+   */
+  std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (config::video.capture == "auto") {
+      return calibrated_display(hwdevice_type, display_name, config);
+    }
+
+    if (config::video.capture == "ddx" || config::video.capture.empty()) {
+      if (auto disp = make_ddup_display(hwdevice_type, display_name, config)) {
+        return disp;
+      }
+    }
+
+    if (config::video.capture == "wgc" || config::video.capture.empty()) {
+      if (auto disp = make_wgc_display(hwdevice_type, display_name, config)) {
+        return disp;
+      }
     }
 
     // ddx and wgc failed
@@ -1117,4 +1456,45 @@ namespace platf {
       return false;
     }
   }
+
+  std::string gpu_fingerprint() {
+    dxgi::factory1_t factory;
+    auto status = CreateDXGIFactory1(IID_IDXGIFactory1, (void **) &factory);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Failed to create DXGIFactory1 [0x"sv << util::hex(status).to_string_view() << ']';
+      return {};
+    }
+
+    std::stringstream fingerprint;
+
+    dxgi::adapter_t::pointer adapter_p;
+    for (int x = 0; factory->EnumAdapters1(x, &adapter_p) != DXGI_ERROR_NOT_FOUND; ++x) {
+      dxgi::adapter_t adapter {adapter_p};
+
+      DXGI_ADAPTER_DESC1 adapter_desc;
+      adapter->GetDesc1(&adapter_desc);
+
+      // The version of the user mode driver
+      LARGE_INTEGER driver_version {};
+      adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driver_version);
+
+      fingerprint << to_utf8(adapter_desc.Description)
+                  << " 0x"sv << util::hex(adapter_desc.VendorId).to_string_view()
+                  << ":0x"sv << util::hex(adapter_desc.DeviceId).to_string_view()
+                  << " luid "sv << adapter_desc.AdapterLuid.HighPart << ':' << adapter_desc.AdapterLuid.LowPart
+                  << " driver "sv << driver_version.QuadPart << std::endl;
+
+      dxgi::output_t::pointer output_p;
+      for (int y = 0; adapter->EnumOutputs(y, &output_p) != DXGI_ERROR_NOT_FOUND; ++y) {
+        dxgi::output_t output {output_p};
+
+        DXGI_OUTPUT_DESC desc;
+        output->GetDesc(&desc);
+
+        fingerprint << "  "sv << to_utf8(desc.DeviceName) << (desc.AttachedToDesktop ? " attached"sv : ""sv) << std::endl;
+      }
+    }
+
+    return fingerprint.str();
+  }
 }  // namespace platf
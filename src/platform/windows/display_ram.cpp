@@ -14,9 +14,12 @@ namespace platf {
 namespace platf::dxgi {
   struct img_t: public ::platf::img_t {
     ~img_t() override {
-      delete[] data;
+      free_frame_data(data, data_size);
       data = nullptr;
     }
+
+    // The size data was allocated with, the pitch may change before it's reallocated
+    std::size_t data_size = 0;
   };
 
   void blend_cursor_monochrome(const cursor_t &cursor, img_t &img) {
@@ -81,21 +84,6 @@ namespace platf::dxgi {
     }
   }
 
-  void apply_color_alpha(int *img_pixel_p, int cursor_pixel) {
-    auto colors_out = (std::uint8_t *) &cursor_pixel;
-    auto colors_in = (std::uint8_t *) img_pixel_p;
-
-    // TODO: When use of IDXGIOutput5 is implemented, support different color formats
-    auto alpha = colors_out[3];
-    if (alpha == 255) {
-      *img_pixel_p = cursor_pixel;
-    } else {
-      colors_in[0] = colors_out[0] + (colors_in[0] * (255 - alpha) + 255 / 2) / 255;
-      colors_in[1] = colors_out[1] + (colors_in[1] * (255 - alpha) + 255 / 2) / 255;
-      colors_in[2] = colors_out[2] + (colors_in[2] * (255 - alpha) + 255 / 2) / 255;
-    }
-  }
-
   void apply_color_masked(int *img_pixel_p, int cursor_pixel) {
     // TODO: When use of IDXGIOutput5 is implemented, support different color formats
     auto alpha = ((std::uint8_t *) &cursor_pixel)[3];
@@ -141,12 +129,13 @@ namespace platf::dxgi {
       auto cursor_end = &cursor_begin[delta_width];
 
       auto img_pixel_p = &img_data[(i + img_skip_y) * (img.row_pitch / img.pixel_pitch) + img_skip_x];
+      if (!masked) {
+        blend_cursor_row((std::uint32_t *) img_pixel_p, (const std::uint32_t *) cursor_begin, delta_width);
+        continue;
+      }
+
       std::for_each(cursor_begin, cursor_end, [&](int cursor_pixel) {
-        if (masked) {
-          apply_color_masked(img_pixel_p, cursor_pixel);
-        } else {
-          apply_color_alpha(img_pixel_p, cursor_pixel);
-        }
+        apply_color_masked(img_pixel_p, cursor_pixel);
         ++img_pixel_p;
       });
     }
@@ -180,6 +169,10 @@ namespace platf::dxgi {
       return capture_status;
     }
 
+    if (gpu_priority) {
+      gpu_priority->report_presents(frame_info.AccumulatedFrames);
+    }
+
     const bool mouse_update_flag = frame_info.LastMouseUpdateTime.QuadPart != 0 || frame_info.PointerShapeBufferSize > 0;
     const bool frame_update_flag = frame_info.AccumulatedFrames != 0 || frame_info.LastPresentTime.QuadPart != 0;
     const bool update_flag = mouse_update_flag || frame_update_flag;
@@ -206,12 +199,20 @@ namespace platf::dxgi {
 
         return capture_e::error;
       }
+
+      util::buffer_t<std::uint8_t> shape_data {img_data.size()};
+      std::copy(std::begin(img_data), std::end(img_data), std::begin(shape_data));
+      cursor_state.shape = make_cursor_shape(shape_data, cursor.shape_info);
     }
 
     if (frame_info.LastMouseUpdateTime.QuadPart) {
       cursor.x = frame_info.PointerPosition.Position.x;
       cursor.y = frame_info.PointerPosition.Position.y;
       cursor.visible = frame_info.PointerPosition.Visible;
+
+      cursor_state.x = cursor.x;
+      cursor_state.y = cursor.y;
+      cursor_state.visible = cursor.visible;
     }
 
     if (frame_update_flag) {
@@ -304,12 +305,30 @@ namespace platf::dxgi {
       img_info.pData = nullptr;
     }
 
-    if (cursor_visible && cursor.visible) {
+    const bool blend_cursor_flag = cursor_visible && cursor.visible;
+    if (blend_cursor_flag) {
       blend_cursor(cursor, *img);
     }
 
     if (img) {
       img->frame_timestamp = frame_timestamp;
+
+      // Without a cursor on either image, only the desktop tells what changed
+      const bool output_plain = capture_format != DXGI_FORMAT_UNKNOWN && !blend_cursor_flag;
+      if (!output_plain || !last_output_plain) {
+        img->damage.reset();
+      } else if (frame_update_flag) {
+        img->damage = dup.damage(frame_info);
+      } else {
+        img->damage.emplace();
+      }
+      last_output_plain = output_plain;
+
+      if (!cursor_visible && cursor_state.shape) {
+        img->cursor = cursor_state;
+      } else {
+        img->cursor.reset();
+      }
     }
 
     return capture_e::ok;
@@ -343,15 +362,21 @@ namespace platf::dxgi {
       img->row_pitch = img->pixel_pitch * img->width;
     }
 
+    auto ram_img = (img_t *) img;
+
     // Reallocate the image buffer if the pitch changes
     if (!dummy && img->row_pitch != img_info.RowPitch) {
       img->row_pitch = img_info.RowPitch;
-      delete img->data;
+      free_frame_data(img->data, ram_img->data_size);
       img->data = nullptr;
     }
 
     if (!img->data) {
-      img->data = new std::uint8_t[img->row_pitch * height];
+      ram_img->data_size = img->row_pitch * height;
+      img->data = alloc_frame_data(ram_img->data_size);
+      if (!img->data) {
+        return -1;
+      }
     }
 
     return 0;
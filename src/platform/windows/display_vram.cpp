@@ -3,7 +3,11 @@
  * @brief Definitions for handling video ram.
  */
 // standard includes
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 // platform includes
 #include <d3dcompiler.h>
@@ -29,6 +33,37 @@ extern "C" {
 #include "src/nvenc/nvenc_utils.h"
 #include "src/video.h"
 
+#ifdef SUNSHINE_PRECOMPILED_SHADERS
+  // generated includes
+  #include "shaders/directx/convert_yuv420_packed_uv_type0_ps.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0_ps_linear.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0_ps_perceptual_quantizer.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0_vs.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0s_ps.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0s_ps_linear.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0s_ps_perceptual_quantizer.h"
+  #include "shaders/directx/convert_yuv420_packed_uv_type0s_vs.h"
+  #include "shaders/directx/convert_yuv420_planar_y_ps.h"
+  #include "shaders/directx/convert_yuv420_planar_y_ps_linear.h"
+  #include "shaders/directx/convert_yuv420_planar_y_ps_perceptual_quantizer.h"
+  #include "shaders/directx/convert_yuv420_planar_y_vs.h"
+  #include "shaders/directx/convert_yuv444_packed_ayuv_ps.h"
+  #include "shaders/directx/convert_yuv444_packed_ayuv_ps_linear.h"
+  #include "shaders/directx/convert_yuv444_packed_vs.h"
+  #include "shaders/directx/convert_yuv444_packed_y410_ps.h"
+  #include "shaders/directx/convert_yuv444_packed_y410_ps_linear.h"
+  #include "shaders/directx/convert_yuv444_packed_y410_ps_perceptual_quantizer.h"
+  #include "shaders/directx/convert_yuv444_planar_ps.h"
+  #include "shaders/directx/convert_yuv444_planar_ps_linear.h"
+  #include "shaders/directx/convert_yuv444_planar_ps_perceptual_quantizer.h"
+  #include "shaders/directx/convert_yuv444_planar_vs.h"
+  #include "shaders/directx/cursor_ps.h"
+  #include "shaders/directx/cursor_ps_normalize_white.h"
+  #include "shaders/directx/cursor_vs.h"
+  #include "shaders/directx/scale_ps.h"
+  #include "shaders/directx/scale_vs.h"
+#endif
+
 #if !defined(SUNSHINE_SHADERS_DIR)  // for testing this needs to be defined in cmake as we don't do an install
   #define SUNSHINE_SHADERS_DIR SUNSHINE_ASSETS_DIR "/shaders/directx"
 #endif
@@ -127,6 +162,8 @@ namespace platf::dxgi {
   blob_t cursor_ps_hlsl;
   blob_t cursor_ps_normalize_white_hlsl;
   blob_t cursor_vs_hlsl;
+  blob_t scale_ps_hlsl;
+  blob_t scale_vs_hlsl;
 
   struct img_d3d_t: public platf::img_t {
     // These objects are owned by the display_t's ID3D11Device
@@ -349,6 +386,39 @@ namespace platf::dxgi {
     return cursor_img;
   }
 
+  std::shared_ptr<const platf::cursor_shape_t> make_cursor_shape(const util::buffer_t<std::uint8_t> &img_data, const DXGI_OUTDUPL_POINTER_SHAPE_INFO &shape_info) {
+    static std::atomic<std::uint32_t> next_serial;
+
+    auto alpha_cursor_img = make_cursor_alpha_image(img_data, shape_info);
+    auto xor_cursor_img = make_cursor_xor_image(img_data, shape_info);
+
+    auto height = shape_info.Type == DXGI_OUTDUPL_POINTER_SHAPE_TYPE_MONOCHROME ? shape_info.Height / 2 : shape_info.Height;
+    if (alpha_cursor_img.size() < (std::size_t) shape_info.Width * height * 4) {
+      return nullptr;
+    }
+
+    auto shape = std::make_shared<platf::cursor_shape_t>();
+    shape->serial = ++next_serial;
+    shape->width = shape_info.Width;
+    shape->height = height;
+    shape->hot_x = shape_info.HotSpot.x;
+    shape->hot_y = shape_info.HotSpot.y;
+    shape->pixels.assign(std::begin(alpha_cursor_img), std::begin(alpha_cursor_img) + shape_info.Width * height * 4);
+
+    // The client can't invert what's under the cursor, so XOR-blended pixels are drawn opaque instead
+    if (xor_cursor_img.size() == alpha_cursor_img.size()) {
+      auto pixels = (std::uint32_t *) shape->pixels.data();
+      auto xor_pixels = (const std::uint32_t *) std::begin(xor_cursor_img);
+      for (std::size_t x = 0; x < shape->pixels.size() / 4; ++x) {
+        if (xor_pixels[x]) {
+          pixels[x] = 0xFF000000 | xor_pixels[x];
+        }
+      }
+    }
+
+    return shape;
+  }
+
   blob_t compile_shader(LPCSTR file, LPCSTR entrypoint, LPCSTR shader_model) {
     blob_t::pointer msg_p = nullptr;
     blob_t::pointer compiled_p;
@@ -375,6 +445,21 @@ namespace platf::dxgi {
     return blob_t {compiled_p};
   }
 
+  /**
+   * @brief Wrap bytecode compiled at build time in a blob, like the ones compiled at runtime.
+   */
+  blob_t make_shader_blob(const BYTE *bytecode, std::size_t size) {
+    blob_t::pointer blob_p;
+    auto status = D3DCreateBlob(size, &blob_p);
+    if (FAILED(status)) {
+      BOOST_LOG(error) << "Couldn't create shader blob [0x"sv << util::hex(status).to_string_view() << ']';
+      return nullptr;
+    }
+
+    std::memcpy(blob_p->GetBufferPointer(), bytecode, size);
+    return blob_t {blob_p};
+  }
+
   blob_t compile_pixel_shader(LPCSTR file) {
     return compile_shader(file, "main_ps", "ps_5_0");
   }
@@ -404,6 +489,8 @@ namespace platf::dxgi {
           return -1;
         }
 
+        auto convert_begin = std::chrono::steady_clock::now();
+
         // Acquire encoder mutex to synchronize with capture code
         auto status = img_ctx.encoder_mutex->AcquireSync(0, INFINITE);
         if (status != S_OK) {
@@ -411,7 +498,7 @@ namespace platf::dxgi {
           return -1;
         }
 
-        auto draw = [&](auto &input, auto &y_or_yuv_viewports, auto &uv_viewport) {
+        auto draw = [&](auto &input, auto &y_or_yuv_viewports, auto &uv_viewport, const platf::damage_rect_t *damage_rect = nullptr) {
           device_ctx->PSSetShaderResources(0, 1, &input);
 
           // Draw Y/YUV
@@ -421,6 +508,13 @@ namespace platf::dxgi {
           auto viewport_count = (format == DXGI_FORMAT_R16_UINT) ? 3 : 1;
           assert(viewport_count <= y_or_yuv_viewports.size());
           device_ctx->RSSetViewports(viewport_count, y_or_yuv_viewports.data());
+          if (damage_rect) {
+            std::array<D3D11_RECT, 3> scissor_rects;
+            for (int x = 0; x < viewport_count; ++x) {
+              scissor_rects[x] = scissor_rect(y_or_yuv_viewports[x], *damage_rect);
+            }
+            device_ctx->RSSetScissorRects(viewport_count, scissor_rects.data());
+          }
           device_ctx->Draw(3 * viewport_count, 0);  // vertex shader will spread vertices across viewports
 
           // Draw UV if needed
@@ -430,10 +524,20 @@ namespace platf::dxgi {
             device_ctx->VSSetShader(convert_UV_vs.get(), nullptr, 0);
             device_ctx->PSSetShader(img.format == DXGI_FORMAT_R16G16B16A16_FLOAT ? convert_UV_fp16_ps.get() : convert_UV_ps.get(), nullptr, 0);
             device_ctx->RSSetViewports(1, &uv_viewport);
+            if (damage_rect) {
+              auto uv_scissor_rect = scissor_rect(uv_viewport, *damage_rect);
+              device_ctx->RSSetScissorRects(1, &uv_scissor_rect);
+            }
             device_ctx->Draw(3, 0);
           }
         };
 
+        // With a scale filter, the conversion reads the image scaled to the output texel for texel
+        if (scale_vs) {
+          scale(img_ctx.encoder_input_res);
+        }
+        auto &input = scale_vs ? scale_res[1] : img_ctx.encoder_input_res;
+
         // Clear render target view(s) once so that the aspect ratio mismatch "bars" appear black
         if (!rtvs_cleared) {
           auto black = create_black_texture_for_rtv_clear();
@@ -443,19 +547,116 @@ namespace platf::dxgi {
           rtvs_cleared = true;
         }
 
-        // Draw captured frame
-        draw(img_ctx.encoder_input_res, out_Y_or_YUV_viewports, out_UV_viewport);
+        // The output holds the image captured before this one, only the damage needs converting again
+        const bool chained = last_capture_sequence && img.capture_sequence == last_capture_sequence + 1;
+        if (chained && img.damage && damage_convertible(*img.damage)) {
+          device_ctx->RSSetState(scissor_state.get());
+          for (auto &damage_rect : *img.damage) {
+            draw(input, out_Y_or_YUV_viewports, out_UV_viewport, &damage_rect);
+          }
+          device_ctx->RSSetState(nullptr);
+        } else {
+          // Draw captured frame
+          draw(input, out_Y_or_YUV_viewports, out_UV_viewport);
+        }
+        last_capture_sequence = img.capture_sequence;
 
         // Release encoder mutex to allow capture code to reuse this image
         img_ctx.encoder_mutex->ReleaseSync(0);
 
+        // Wait for the conversion of some of the frames to measure how long it's queued behind other work on the GPU
+        if (display->gpu_priority && convert_done && ++converts % GPU_LATENCY_SAMPLE_INTERVAL == 0) {
+          device_ctx->End(convert_done.get());
+          device_ctx->Flush();
+
+          BOOL done;
+          while (device_ctx->GetData(convert_done.get(), &done, sizeof(done), 0) == S_FALSE) {
+            std::this_thread::yield();
+          }
+
+          display->gpu_priority->report_convert_latency(std::chrono::steady_clock::now() - convert_begin, std::chrono::nanoseconds(1s) / std::max(display->client_frame_rate, 1));
+        }
+
         ID3D11ShaderResourceView *emptyShaderResourceView = nullptr;
         device_ctx->PSSetShaderResources(0, 1, &emptyShaderResourceView);
+      } else {
+        last_capture_sequence = 0;
       }
 
       return 0;
     }
 
+    /**
+     * @brief Scale the captured image to the output, the width in a pass, then the height.
+     * @param input The captured image.
+     */
+    void scale(shader_res_t &input) {
+      device_ctx->VSSetShader(scale_vs.get(), nullptr, 0);
+      device_ctx->PSSetShader(scale_ps.get(), nullptr, 0);
+
+      for (int x = 0; x < 2; ++x) {
+        // The height pass reads the result of the width pass
+        device_ctx->OMSetRenderTargets(1, &scale_rtvs[x], nullptr);
+        device_ctx->PSSetShaderResources(0, 1, x ? &scale_res[0] : &input);
+        device_ctx->PSSetConstantBuffers(1, 1, &scale_params[x]);
+        device_ctx->RSSetViewports(1, &scale_viewports[x]);
+        device_ctx->Draw(3, 0);
+      }
+
+      // The scaled image can't be read while it's still bound as a render target
+      device_ctx->OMSetRenderTargets(0, nullptr, nullptr);
+    }
+
+    /**
+     * @brief Check whether converting only the damage of an image is worth it.
+     * @param damage The regions of the image that changed.
+     * @return `true` if they cover less than half of the image in a few rects.
+     */
+    bool damage_convertible(const std::vector<platf::damage_rect_t> &damage) const {
+      // The scale passes render the whole image anyway
+      if (scale_vs) {
+        return false;
+      }
+
+      // The damage of rotated displays isn't rotated like the image
+      if (display->display_rotation != DXGI_MODE_ROTATION_UNSPECIFIED && display->display_rotation != DXGI_MODE_ROTATION_IDENTITY) {
+        return false;
+      }
+
+      if (damage.size() > MAX_DAMAGE_DRAWS) {
+        return false;
+      }
+
+      std::int64_t area = 0;
+      for (auto &damage_rect : damage) {
+        area += (std::int64_t) damage_rect.width * damage_rect.height;
+      }
+
+      return area * 2 <= (std::int64_t) display->width * display->height;
+    }
+
+    /**
+     * @brief Get the pixels of a viewport a damaged region of the captured image is drawn to.
+     * @param viewport The viewport the captured image is drawn to.
+     * @param damage_rect The damaged region of the captured image.
+     * @return The pixels, including those the filters of the scaling and chroma subsampling reach.
+     */
+    D3D11_RECT scissor_rect(const D3D11_VIEWPORT &viewport, const platf::damage_rect_t &damage_rect) const {
+      auto scale_x = viewport.Width / display->width;
+      auto scale_y = viewport.Height / display->height;
+
+      // Bilinear sampling reaches a captured pixel further, which covers a scaled pixel more
+      auto margin_x = std::ceil(scale_x) + 1.0f;
+      auto margin_y = std::ceil(scale_y) + 1.0f;
+
+      return D3D11_RECT {
+        (LONG) std::max(std::floor(viewport.TopLeftX + damage_rect.x * scale_x - margin_x), std::floor(viewport.TopLeftX)),
+        (LONG) std::max(std::floor(viewport.TopLeftY + damage_rect.y * scale_y - margin_y), std::floor(viewport.TopLeftY)),
+        (LONG) std::min(std::ceil(viewport.TopLeftX + (damage_rect.x + damage_rect.width) * scale_x + margin_x), std::ceil(viewport.TopLeftX + viewport.Width)),
+        (LONG) std::min(std::ceil(viewport.TopLeftY + (damage_rect.y + damage_rect.height) * scale_y + margin_y), std::ceil(viewport.TopLeftY + viewport.Height)),
+      };
+    }
+
     void apply_colorspace(const ::video::sunshine_colorspace_t &colorspace) {
       auto color_vectors = ::video::color_vectors_from_colorspace(colorspace);
 
@@ -479,12 +680,16 @@ namespace platf::dxgi {
       device_ctx->VSSetConstantBuffers(3, 1, &color_matrix);
       device_ctx->PSSetConstantBuffers(0, 1, &color_matrix);
       this->color_matrix = std::move(color_matrix);
+
+      // The whole output is converted again with the new matrix
+      last_capture_sequence = 0;
     }
 
     int init_output(ID3D11Texture2D *frame_texture, int width, int height) {
       // The underlying frame pool owns the texture, so we must reference it for ourselves
       frame_texture->AddRef();
       output_texture.reset(frame_texture);
+      last_capture_sequence = 0;
 
       HRESULT status = S_OK;
 
@@ -499,7 +704,24 @@ namespace platf::dxgi {
     return -1; \
   }
 
-      const bool downscaling = display->width > width || display->height > height;
+      auto out_width = width;
+      auto out_height = height;
+
+      float in_width = display->width;
+      float in_height = display->height;
+
+      // Ensure aspect ratio is maintained
+      auto scalar = std::fminf(out_width / in_width, out_height / in_height);
+      auto out_width_f = in_width * scalar;
+      auto out_height_f = in_height * scalar;
+
+      // result is always positive
+      auto offsetX = (out_width - out_width_f) / 2;
+      auto offsetY = (out_height - out_height_f) / 2;
+
+      // With a scale filter, the image is scaled in passes of its own before the conversion
+      const bool scale_passes = config::video.scaling_filter != config::video_t::scaling_filter_e::bilinear && scalar != 1.0f;
+      const bool downscaling = !scale_passes && (display->width > width || display->height > height);
 
       switch (format) {
         case DXGI_FORMAT_NV12:
@@ -580,23 +802,71 @@ namespace platf::dxgi {
           return -1;
       }
 
-#undef create_vertex_shader_helper
-#undef create_pixel_shader_helper
+      scale_vs.reset();
+      if (scale_passes) {
+        create_vertex_shader_helper(scale_vs_hlsl, scale_vs);
+        create_pixel_shader_helper(scale_ps_hlsl, scale_ps);
+
+        // The passes scale the image before it's rotated by the conversion
+        const bool rotated = display->display_rotation == DXGI_MODE_ROTATION_ROTATE90 || display->display_rotation == DXGI_MODE_ROTATION_ROTATE270;
+        auto scaled_width = (UINT) std::lround(rotated ? out_height_f : out_width_f);
+        auto scaled_height = (UINT) std::lround(rotated ? out_width_f : out_height_f);
+
+        UINT heights[] {(UINT) display->height_before_rotation, scaled_height};
+        float ratios[] {display->width_before_rotation / (float) scaled_width, display->height_before_rotation / (float) scaled_height};
+
+        for (int x = 0; x < 2; ++x) {
+          // Half floats hold the scRGB images of HDR displays as well as the others
+          D3D11_TEXTURE2D_DESC texture_desc {};
+          texture_desc.Width = scaled_width;
+          texture_desc.Height = heights[x];
+          texture_desc.MipLevels = 1;
+          texture_desc.ArraySize = 1;
+          texture_desc.SampleDesc.Count = 1;
+          texture_desc.Usage = D3D11_USAGE_DEFAULT;
+          texture_desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+          texture_desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+          status = device->CreateTexture2D(&texture_desc, nullptr, &scale_textures[x]);
+          if (FAILED(status)) {
+            BOOST_LOG(error) << "Failed to create scale texture: " << util::log_hex(status);
+            return -1;
+          }
 
-      auto out_width = width;
-      auto out_height = height;
+          status = device->CreateRenderTargetView(scale_textures[x].get(), nullptr, &scale_rtvs[x]);
+          if (FAILED(status)) {
+            BOOST_LOG(error) << "Failed to create scale render target view: " << util::log_hex(status);
+            return -1;
+          }
 
-      float in_width = display->width;
-      float in_height = display->height;
+          status = device->CreateShaderResourceView(scale_textures[x].get(), nullptr, &scale_res[x]);
+          if (FAILED(status)) {
+            BOOST_LOG(error) << "Failed to create scale shader resource view: " << util::log_hex(status);
+            return -1;
+          }
 
-      // Ensure aspect ratio is maintained
-      auto scalar = std::fminf(out_width / in_width, out_height / in_height);
-      auto out_width_f = in_width * scalar;
-      auto out_height_f = in_height * scalar;
+          struct {
+            int32_t axis;
+            float ratio;
+            int32_t filter;
+            int32_t padding;
+          } scale_params_in {x, ratios[x], config::video.scaling_filter == config::video_t::scaling_filter_e::bicubic ? 1 : 2};  // aligned to 16-byte
+
+          scale_params[x] = make_buffer(device.get(), scale_params_in);
+          if (!scale_params[x]) {
+            BOOST_LOG(error) << "Failed to create scale pixel constant buffer";
+            return -1;
+          }
 
-      // result is always positive
-      auto offsetX = (out_width - out_width_f) / 2;
-      auto offsetY = (out_height - out_height_f) / 2;
+          scale_viewports[x] = {0, 0, (float) scaled_width, (float) heights[x], 0.0f, 1.0f};
+        }
+
+        BOOST_LOG(info) << "Scaling "sv << display->width << 'x' << display->height << " to "sv << out_width_f << 'x' << out_height_f
+                        << " with the "sv << (config::video.scaling_filter == config::video_t::scaling_filter_e::bicubic ? "bicubic"sv : "Lanczos"sv) << " filter"sv;
+      }
+
+#undef create_vertex_shader_helper
+#undef create_pixel_shader_helper
 
       out_Y_or_YUV_viewports[0] = {offsetX, offsetY, out_width_f, out_height_f, 0.0f, 1.0f};  // Y plane
       out_Y_or_YUV_viewports[1] = out_Y_or_YUV_viewports[0];  // U plane
@@ -800,6 +1070,11 @@ namespace platf::dxgi {
         return -1;
       }
 
+      D3D11_QUERY_DESC query_desc {D3D11_QUERY_EVENT, 0};
+      if (FAILED(device->CreateQuery(&query_desc, &convert_done))) {
+        BOOST_LOG(warning) << "Failed to create GPU event query, GPU priority won't adapt to the conversion latency"sv;
+      }
+
       D3D11_SAMPLER_DESC sampler_desc {};
       sampler_desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
       sampler_desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
@@ -815,6 +1090,19 @@ namespace platf::dxgi {
         return -1;
       }
 
+      // Limits the conversion to the damage of the captured images
+      D3D11_RASTERIZER_DESC raster_desc {};
+      raster_desc.FillMode = D3D11_FILL_SOLID;
+      raster_desc.CullMode = D3D11_CULL_NONE;
+      raster_desc.DepthClipEnable = TRUE;
+      raster_desc.ScissorEnable = TRUE;
+
+      status = device->CreateRasterizerState(&raster_desc, &scissor_state);
+      if (FAILED(status)) {
+        BOOST_LOG(error) << "Failed to create scissor rasterizer state [0x"sv << util::hex(status).to_string_view() << ']';
+        return -1;
+      }
+
       device_ctx->OMSetBlendState(blend_disable.get(), nullptr, 0xFFFFFFFFu);
       device_ctx->PSSetSamplers(0, 1, &sampler_linear);
       device_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -933,6 +1221,18 @@ namespace platf::dxgi {
     render_target_t out_UV_rtv;
     bool rtvs_cleared = false;
 
+    // The capture sequence of the image the output holds, 0 if it must be converted whole
+    std::uint64_t last_capture_sequence = 0;
+
+    // Damage of more rects is converted whole
+    static constexpr std::size_t MAX_DAMAGE_DRAWS = 16;
+    raster_state_t scissor_state;
+
+    // Every this many frames, the conversion is waited for to measure its latency
+    static constexpr std::uint64_t GPU_LATENCY_SAMPLE_INTERVAL = 30;
+    query_t convert_done;
+    std::uint64_t converts = 0;
+
     // d3d_img_t::id -> encoder_img_ctx_t
     // These store the encoder textures for each img_t that passes through
     // convert(). We can't store them in the img_t itself because it is shared
@@ -949,6 +1249,15 @@ namespace platf::dxgi {
     ps_t convert_UV_ps;
     ps_t convert_UV_fp16_ps;
 
+    // Set when the image is scaled before its conversion, the width first, then the height
+    vs_t scale_vs;
+    ps_t scale_ps;
+    std::array<texture2d_t, 2> scale_textures;
+    std::array<render_target_t, 2> scale_rtvs;
+    std::array<shader_res_t, 2> scale_res;
+    std::array<buf_t, 2> scale_params;
+    std::array<D3D11_VIEWPORT, 2> scale_viewports;
+
     std::array<D3D11_VIEWPORT, 3> out_Y_or_YUV_viewports, out_Y_or_YUV_viewports_for_clear;
     D3D11_VIEWPORT out_UV_viewport, out_UV_viewport_for_clear;
 
@@ -1153,6 +1462,10 @@ namespace platf::dxgi {
       return capture_status;
     }
 
+    if (gpu_priority) {
+      gpu_priority->report_presents(frame_info.AccumulatedFrames);
+    }
+
     const bool mouse_update_flag = frame_info.LastMouseUpdateTime.QuadPart != 0 || frame_info.PointerShapeBufferSize > 0;
     const bool frame_update_flag = frame_info.LastPresentTime.QuadPart != 0;
     const bool update_flag = mouse_update_flag || frame_update_flag;
@@ -1180,6 +1493,8 @@ namespace platf::dxgi {
         return capture_e::error;
       }
 
+      cursor_state.shape = make_cursor_shape(img_data, shape_info);
+
       auto alpha_cursor_img = make_cursor_alpha_image(img_data, shape_info);
       auto xor_cursor_img = make_cursor_xor_image(img_data, shape_info);
 
@@ -1193,6 +1508,10 @@ namespace platf::dxgi {
       cursor_alpha.set_pos(frame_info.PointerPosition.Position.x, frame_info.PointerPosition.Position.y, width, height, display_rotation, frame_info.PointerPosition.Visible);
 
       cursor_xor.set_pos(frame_info.PointerPosition.Position.x, frame_info.PointerPosition.Position.y, width, height, display_rotation, frame_info.PointerPosition.Visible);
+
+      cursor_state.x = frame_info.PointerPosition.Position.x;
+      cursor_state.y = frame_info.PointerPosition.Position.y;
+      cursor_state.visible = frame_info.PointerPosition.Visible;
     }
 
     const bool blend_mouse_cursor_flag = (cursor_alpha.visible || cursor_xor.visible) && cursor_visible;
@@ -1545,6 +1864,53 @@ namespace platf::dxgi {
 
     if (img_out) {
       img_out->frame_timestamp = frame_timestamp;
+
+      // The area the cursor was blended onto, clipped to the desktop
+      std::optional<platf::damage_rect_t> cursor_rect;
+      if (out_frame_action == ofa::copy_last_surface_and_blend_cursor) {
+        for (auto cursor : {&cursor_alpha, &cursor_xor}) {
+          if (!cursor->texture.get()) {
+            continue;
+          }
+
+          auto left = std::max<LONG>(cursor->topleft_x, 0);
+          auto top = std::max<LONG>(cursor->topleft_y, 0);
+          auto right = std::min<LONG>(cursor->topleft_x + cursor->texture_width, width_before_rotation);
+          auto bottom = std::min<LONG>(cursor->topleft_y + cursor->texture_height, height_before_rotation);
+          if (right > left && bottom > top) {
+            cursor_rect = platf::damage_rect_t {(int) left, (int) top, (int) (right - left), (int) (bottom - top)};
+          }
+        }
+      }
+
+      // Consecutive images hold the same desktop with the cursor blended onto some of them.
+      // Moving the cursor over a still desktop only changes its old and new places, which is all the encoder converts again.
+      const bool output_desktop = out_frame_action != ofa::dummy_fallback;
+      if (!output_desktop || !last_output_desktop) {
+        img_out->damage.reset();
+      } else if (frame_update_flag) {
+        img_out->damage = dup.damage(frame_info);
+      } else {
+        img_out->damage.emplace();
+      }
+
+      if (img_out->damage) {
+        for (auto &rect : {last_cursor_rect, cursor_rect}) {
+          if (rect) {
+            img_out->damage->emplace_back(*rect);
+          }
+        }
+      }
+      last_output_desktop = output_desktop;
+      last_cursor_rect = cursor_rect;
+
+      // The shape isn't rotated, so the cursor of rotated displays is always blended in
+      const bool rotated = display_rotation != DXGI_MODE_ROTATION_UNSPECIFIED && display_rotation != DXGI_MODE_ROTATION_IDENTITY;
+      if (!cursor_visible && cursor_state.shape && !rotated) {
+        img_out->cursor = cursor_state;
+      } else {
+        img_out->cursor.reset();
+      }
     }
 
     return capture_e::ok;
@@ -1930,13 +2296,60 @@ namespace platf::dxgi {
   }
 
   int init() {
-    BOOST_LOG(info) << "Compiling shaders..."sv;
+    // Shaders may be compiled from another directory at runtime, to try changes to them without rebuilding
+    std::string shaders_dir;
+    if (auto dir = std::getenv("SUNSHINE_SHADERS_DIR")) {
+      shaders_dir = dir;
+    } else {
+#ifdef SUNSHINE_PRECOMPILED_SHADERS
+  #define load_shader_helper(x) \
+    if (!(x##_hlsl = make_shader_blob(x##_bytecode, sizeof(x##_bytecode)))) \
+      return -1;
+
+      load_shader_helper(convert_yuv420_packed_uv_type0_ps);
+      load_shader_helper(convert_yuv420_packed_uv_type0_ps_linear);
+      load_shader_helper(convert_yuv420_packed_uv_type0_ps_perceptual_quantizer);
+      load_shader_helper(convert_yuv420_packed_uv_type0_vs);
+      load_shader_helper(convert_yuv420_packed_uv_type0s_ps);
+      load_shader_helper(convert_yuv420_packed_uv_type0s_ps_linear);
+      load_shader_helper(convert_yuv420_packed_uv_type0s_ps_perceptual_quantizer);
+      load_shader_helper(convert_yuv420_packed_uv_type0s_vs);
+      load_shader_helper(convert_yuv420_planar_y_ps);
+      load_shader_helper(convert_yuv420_planar_y_ps_linear);
+      load_shader_helper(convert_yuv420_planar_y_ps_perceptual_quantizer);
+      load_shader_helper(convert_yuv420_planar_y_vs);
+      load_shader_helper(convert_yuv444_packed_ayuv_ps);
+      load_shader_helper(convert_yuv444_packed_ayuv_ps_linear);
+      load_shader_helper(convert_yuv444_packed_vs);
+      load_shader_helper(convert_yuv444_planar_ps);
+      load_shader_helper(convert_yuv444_planar_ps_linear);
+      load_shader_helper(convert_yuv444_planar_ps_perceptual_quantizer);
+      load_shader_helper(convert_yuv444_packed_y410_ps);
+      load_shader_helper(convert_yuv444_packed_y410_ps_linear);
+      load_shader_helper(convert_yuv444_packed_y410_ps_perceptual_quantizer);
+      load_shader_helper(convert_yuv444_planar_vs);
+      load_shader_helper(cursor_ps);
+      load_shader_helper(cursor_ps_normalize_white);
+      load_shader_helper(cursor_vs);
+      load_shader_helper(scale_ps);
+      load_shader_helper(scale_vs);
+
+  #undef load_shader_helper
+
+      BOOST_LOG(debug) << "Loaded precompiled shaders"sv;
+      return 0;
+#else
+      shaders_dir = SUNSHINE_SHADERS_DIR;
+#endif
+    }
+
+    BOOST_LOG(info) << "Compiling shaders from ["sv << shaders_dir << "]..."sv;
 
 #define compile_vertex_shader_helper(x) \
-  if (!(x##_hlsl = compile_vertex_shader(SUNSHINE_SHADERS_DIR "/" #x ".hlsl"))) \
+  if (!(x##_hlsl = compile_vertex_shader((shaders_dir + "/" #x ".hlsl").c_str()))) \
     return -1;
 #define compile_pixel_shader_helper(x) \
-  if (!(x##_hlsl = compile_pixel_shader(SUNSHINE_SHADERS_DIR "/" #x ".hlsl"))) \
+  if (!(x##_hlsl = compile_pixel_shader((shaders_dir + "/" #x ".hlsl").c_str()))) \
     return -1;
 
     compile_pixel_shader_helper(convert_yuv420_packed_uv_type0_ps);
@@ -1964,6 +2377,8 @@ namespace platf::dxgi {
     compile_pixel_shader_helper(cursor_ps);
     compile_pixel_shader_helper(cursor_ps_normalize_white);
     compile_vertex_shader_helper(cursor_vs);
+    compile_pixel_shader_helper(scale_ps);
+    compile_vertex_shader_helper(scale_vs);
 
     BOOST_LOG(info) << "Compiled shaders"sv;
 
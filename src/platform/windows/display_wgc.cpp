@@ -2,12 +2,16 @@
  * @file src/platform/windows/display_wgc.cpp
  * @brief Definitions for WinRT Windows.Graphics.Capture API
  */
+// standard includes
+#include <algorithm>
+
 // platform includes
 #include <dxgi1_2.h>
 
 // local includes
 #include "display.h"
 #include "misc.h"
+#include "src/config.h"
 #include "src/logging.h"
 
 // Gross hack to work around MINGW-packages#22160
@@ -69,6 +73,10 @@ namespace platf::dxgi {
     if (capture_session) {
       capture_session.Close();
     }
+    for (auto &frame : produced_frames) {
+      frame.Close();
+    }
+    produced_frames.clear();
     if (frame_pool) {
       frame_pool.Close();
     }
@@ -120,8 +128,10 @@ namespace platf::dxgi {
       display->capture_format = DXGI_FORMAT_B8G8R8A8_UNORM;
     }
 
+    pool_size = config::video.wgc_frame_pool_size;
+
     try {
-      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), 2, item.Size());
+      frame_pool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(uwp_device, static_cast<winrt::Windows::Graphics::DirectX::DirectXPixelFormat>(display->capture_format), pool_size, item.Size());
       capture_session = frame_pool.CreateCaptureSession(item);
       frame_pool.FrameArrived({this, &wgc_capture_t::on_frame_arrived});
     } catch (winrt::hresult_error &e) {
@@ -149,7 +159,8 @@ namespace platf::dxgi {
   /**
    * This function runs in a separate thread spawned by the frame pool and is a producer of frames.
    * To maintain parity with the original display interface, this frame will be consumed by the capture thread.
-   * Acquire a read-write lock, make the produced frame available to the capture thread, then wake the capture thread.
+   * Acquire a read-write lock, queue the produced frame for the capture thread, then wake the capture thread.
+   * One buffer of the pool is left for the frame the capture thread holds, older frames beyond that are dropped.
    */
   void wgc_capture_t::on_frame_arrived(winrt::Direct3D11CaptureFramePool const &sender, winrt::IInspectable const &) {
     winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame frame {nullptr};
@@ -161,19 +172,19 @@ namespace platf::dxgi {
     }
     if (frame != nullptr) {
       AcquireSRWLockExclusive(&frame_lock);
-      if (produced_frame) {
-        produced_frame.Close();
+      produced_frames.emplace_back(std::move(frame));
+      while (produced_frames.size() > (std::size_t) std::max(pool_size - 1, 1)) {
+        produced_frames.front().Close();
+        produced_frames.pop_front();
       }
-
-      produced_frame = frame;
       ReleaseSRWLockExclusive(&frame_lock);
       WakeConditionVariable(&frame_present_cv);
     }
   }
 
   /**
-   * @brief Get the next frame from the producer thread.
-   * If not available, the capture thread blocks until one is, or the wait times out.
+   * @brief Get the oldest frame queued by the producer thread.
+   * If none is queued, the capture thread blocks until one is, or the wait times out.
    * @param timeout how long to wait for the next frame
    * @param out a texture containing the frame just captured
    * @param out_time the timestamp of the frame just captured
@@ -183,7 +194,7 @@ namespace platf::dxgi {
     release_frame();
 
     AcquireSRWLockExclusive(&frame_lock);
-    if (produced_frame == nullptr && SleepConditionVariableSRW(&frame_present_cv, &frame_lock, timeout.count(), 0) == 0) {
+    if (produced_frames.empty() && SleepConditionVariableSRW(&frame_present_cv, &frame_lock, timeout.count(), 0) == 0) {
       ReleaseSRWLockExclusive(&frame_lock);
       if (GetLastError() == ERROR_TIMEOUT) {
         return capture_e::timeout;
@@ -191,9 +202,9 @@ namespace platf::dxgi {
         return capture_e::error;
       }
     }
-    if (produced_frame) {
-      consumed_frame = produced_frame;
-      produced_frame = nullptr;
+    if (!produced_frames.empty()) {
+      consumed_frame = std::move(produced_frames.front());
+      produced_frames.pop_front();
     }
     ReleaseSRWLockExclusive(&frame_lock);
     if (consumed_frame == nullptr) {  // spurious wakeup
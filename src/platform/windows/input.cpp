@@ -8,8 +8,12 @@
 #include <windows.h>
 
 // standard includes
+#include <bitset>
 #include <cmath>
+#include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 // lib includes
 #include <ViGEm/Client.h>
@@ -34,6 +38,21 @@ namespace platf {
 
   thread_local HDESK _lastKnownInputDesktop = nullptr;
 
+  /**
+   * @brief The input the calling thread holds back between `begin_input_batch()` and `end_input_batch()`.
+   */
+  struct input_batch_t {
+    bool active;
+
+    // Sent with a single SendInput() call
+    std::vector<INPUT> inputs;
+
+    // The gamepads with a report that isn't sent to ViGEm yet, only their final report is sent
+    std::bitset<MAX_GAMEPADS> pending_reports;
+  };
+
+  thread_local input_batch_t input_batch {};
+
   constexpr touch_port_t target_touch_port {
     0,
     0,
@@ -83,6 +102,9 @@ namespace platf {
 
     uint8_t client_relative_index;
 
+    // The state in the last report, an unchanged state isn't reported again
+    std::optional<gamepad_state_t> last_state;
+
     thread_pool_util::ThreadPool::task_id_t repeat_task {};
     std::chrono::steady_clock::time_point last_report_ts;
 
@@ -227,6 +249,7 @@ namespace platf {
 
       gamepad.client_relative_index = id.clientRelativeIndex;
       gamepad.last_report_ts = std::chrono::steady_clock::now();
+      gamepad.last_state.reset();
 
       // Establish a connect to the ViGEm driver if we don't have one yet
       if (!client) {
@@ -327,6 +350,8 @@ namespace platf {
      * @param smallMotor The small motor.
      */
     void rumble(target_t::pointer target, std::uint8_t largeMotor, std::uint8_t smallMotor) {
+      std::lock_guard lg {lock};
+
       for (int x = 0; x < gamepads.size(); ++x) {
         auto &gamepad = gamepads[x];
 
@@ -360,6 +385,8 @@ namespace platf {
      * @param b The red channel.
      */
     void set_rgb_led(target_t::pointer target, std::uint8_t r, std::uint8_t g, std::uint8_t b) {
+      std::lock_guard lg {lock};
+
       for (int x = 0; x < gamepads.size(); ++x) {
         auto &gamepad = gamepads[x];
 
@@ -399,6 +426,9 @@ namespace platf {
     std::vector<gamepad_context_t> gamepads;
 
     client_t client;
+
+    // The gamepads are updated by the input threads of the sessions, by input_pool and by the timers of task_pool
+    std::mutex lock;
   };
 
   void CALLBACK x360_notify(
@@ -413,7 +443,7 @@ namespace platf {
       << "largeMotor: "sv << (int) largeMotor << std::endl
       << "smallMotor: "sv << (int) smallMotor;
 
-    task_pool.push(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
+    input_pool.post(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
   }
 
   void CALLBACK ds4_notify(
@@ -431,8 +461,8 @@ namespace platf {
       << util::hex(led_color.Green).to_string_view() << ' '
       << util::hex(led_color.Blue).to_string_view() << std::endl;
 
-    task_pool.push(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
-    task_pool.push(&vigem_t::set_rgb_led, (vigem_t *) userdata, target, led_color.Red, led_color.Green, led_color.Blue);
+    input_pool.post(&vigem_t::rumble, (vigem_t *) userdata, target, largeMotor, smallMotor);
+    input_pool.post(&vigem_t::set_rgb_led, (vigem_t *) userdata, target, led_color.Red, led_color.Green, led_color.Blue);
   }
 
   struct input_raw_t {
@@ -467,12 +497,17 @@ namespace platf {
 
   /**
    * @brief Calls SendInput() and switches input desktops if required.
-   * @param i The `INPUT` struct to send.
+   * @param inputs The `INPUT` structs to send.
+   * @param count The number of elements in `inputs`.
    */
-  void send_input(INPUT &i) {
+  void send_input_now(INPUT *inputs, UINT count) {
   retry:
-    auto send = SendInput(1, &i, sizeof(INPUT));
-    if (send != 1) {
+    auto send = SendInput(count, inputs, sizeof(INPUT));
+    if (send != count) {
+      // Retry what wasn't sent
+      inputs += send;
+      count -= send;
+
       auto hDesk = syncThreadDesktop();
       if (_lastKnownInputDesktop != hDesk) {
         _lastKnownInputDesktop = hDesk;
@@ -482,6 +517,38 @@ namespace platf {
     }
   }
 
+  /**
+   * @brief Sends input to the OS, or adds it to the batch of the calling thread.
+   * @param inputs The `INPUT` structs to send.
+   * @param count The number of elements in `inputs`.
+   */
+  void send_input(INPUT *inputs, UINT count) {
+    if (input_batch.active) {
+      input_batch.inputs.insert(std::end(input_batch.inputs), inputs, inputs + count);
+      return;
+    }
+
+    send_input_now(inputs, count);
+  }
+
+  /**
+   * @brief Sends input to the OS, or adds it to the batch of the calling thread.
+   * @param i The `INPUT` struct to send.
+   */
+  void send_input(INPUT &i) {
+    send_input(&i, 1);
+  }
+
+  /**
+   * @brief Sends the input batched by the calling thread.
+   */
+  void flush_input_batch() {
+    if (!input_batch.inputs.empty()) {
+      send_input_now(input_batch.inputs.data(), (UINT) input_batch.inputs.size());
+      input_batch.inputs.clear();
+    }
+  }
+
   /**
    * @brief Calls InjectSyntheticPointerInput() and switches input desktops if required.
    * @details Must only be called if InjectSyntheticPointerInput() is available.
@@ -492,6 +559,9 @@ namespace platf {
    * @return true if input was successfully injected.
    */
   bool inject_synthetic_pointer_input(input_raw_t *input, HSYNTHETICPOINTERDEVICE device, const POINTER_TYPE_INFO *pointerInfo, UINT32 count) {
+    // Keep the order with the batched mouse and keyboard input
+    flush_input_batch();
+
   retry:
     if (!input->fnInjectSyntheticPointerInput(device, pointerInfo, count)) {
       auto hDesk = syncThreadDesktop();
@@ -1148,23 +1218,22 @@ namespace platf {
       return;
     }
 
-    // Send all key down events
-    for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE;
-      send_input(input);
-    }
+    std::vector<INPUT> inputs(chars * 2);
 
-    // Send all key up events
+    // All key down events, then all key up events
     for (int i = 0; i < chars; i++) {
-      INPUT input {};
-      input.type = INPUT_KEYBOARD;
-      input.ki.wScan = wide[i];
-      input.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
-      send_input(input);
+      auto &down = inputs[i];
+      down.type = INPUT_KEYBOARD;
+      down.ki.wScan = wide[i];
+      down.ki.dwFlags = KEYEVENTF_UNICODE;
+
+      auto &up = inputs[chars + i];
+      up.type = INPUT_KEYBOARD;
+      up.ki.wScan = wide[i];
+      up.ki.dwFlags = KEYEVENTF_UNICODE | KEYEVENTF_KEYUP;
     }
+
+    send_input(inputs.data(), (UINT) inputs.size());
   }
 
   int alloc_gamepad(input_t &input, const gamepad_id_t &id, const gamepad_arrival_t &metadata, feedback_queue_t feedback_queue) {
@@ -1218,6 +1287,7 @@ namespace platf {
       }
     }
 
+    std::lock_guard lg {raw->vigem->lock};
     return raw->vigem->alloc_gamepad_internal(id, feedback_queue, selectedGamepadType);
   }
 
@@ -1228,6 +1298,7 @@ namespace platf {
       return;
     }
 
+    std::lock_guard lg {raw->vigem->lock};
     raw->vigem->free_target(nr);
   }
 
@@ -1471,7 +1542,38 @@ namespace platf {
 
       // Repeat at least every 100ms to keep the 16-bit timestamp field from overflowing
       gamepad.last_report_ts = now;
-      gamepad.repeat_task = task_pool.pushDelayed(ds4_update_ts_and_send, 100ms, vigem, nr).task_id;
+      gamepad.repeat_task = task_pool.pushDelayed([vigem, nr]() {
+        std::lock_guard lg {vigem->lock};
+        ds4_update_ts_and_send(vigem, nr);
+      },
+                                                  100ms)
+                              .task_id;
+    }
+  }
+
+  /**
+   * @brief Sends the report of a gamepad to ViGEm, or marks it pending in the batch of the calling thread.
+   * @param vigem The global ViGEm context object.
+   * @param nr The global gamepad index.
+   */
+  void send_report(vigem_t *vigem, int nr) {
+    if (input_batch.active) {
+      input_batch.pending_reports[nr] = true;
+      return;
+    }
+
+    auto &gamepad = vigem->gamepads[nr];
+    if (!gamepad.gp) {
+      return;
+    }
+
+    if (vigem_target_get_type(gamepad.gp.get()) == Xbox360Wired) {
+      auto status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
+      if (!VIGEM_SUCCESS(status)) {
+        BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
+      }
+    } else {
+      ds4_update_ts_and_send(vigem, nr);
     }
   }
 
@@ -1489,23 +1591,27 @@ namespace platf {
       return;
     }
 
+    std::lock_guard lg {vigem->lock};
+
     auto &gamepad = vigem->gamepads[nr];
     if (!gamepad.gp) {
       return;
     }
 
-    VIGEM_ERROR status;
+    // Clients send the full state at a high rate even when the gamepad is idle.
+    // The DS4 timestamp is kept fresh by the repeat task, so nothing is lost by skipping the report.
+    if (gamepad.last_state == gamepad_state) {
+      return;
+    }
+    gamepad.last_state = gamepad_state;
 
     if (vigem_target_get_type(gamepad.gp.get()) == Xbox360Wired) {
       x360_update_state(gamepad, gamepad_state);
-      status = vigem_target_x360_update(vigem->client.get(), gamepad.gp.get(), gamepad.report.x360);
-      if (!VIGEM_SUCCESS(status)) {
-        BOOST_LOG(warning) << "Couldn't send gamepad input to ViGEm ["sv << util::hex(status).to_string_view() << ']';
-      }
     } else {
       ds4_update_state(gamepad, gamepad_state);
-      ds4_update_ts_and_send(vigem, nr);
     }
+
+    send_report(vigem, nr);
   }
 
   /**
@@ -1521,6 +1627,8 @@ namespace platf {
       return;
     }
 
+    std::lock_guard lg {vigem->lock};
+
     auto &gamepad = vigem->gamepads[touch.id.globalIndex];
     if (!gamepad.gp) {
       return;
@@ -1611,7 +1719,7 @@ namespace platf {
       }
     }
 
-    ds4_update_ts_and_send(vigem, touch.id.globalIndex);
+    send_report(vigem, touch.id.globalIndex);
   }
 
   /**
@@ -1627,6 +1735,8 @@ namespace platf {
       return;
     }
 
+    std::lock_guard lg {vigem->lock};
+
     auto &gamepad = vigem->gamepads[motion.id.globalIndex];
     if (!gamepad.gp) {
       return;
@@ -1638,7 +1748,7 @@ namespace platf {
     }
 
     ds4_update_motion(gamepad, motion.motionType, motion.x, motion.y, motion.z);
-    ds4_update_ts_and_send(vigem, motion.id.globalIndex);
+    send_report(vigem, motion.id.globalIndex);
   }
 
   /**
@@ -1654,6 +1764,8 @@ namespace platf {
       return;
     }
 
+    std::lock_guard lg {vigem->lock};
+
     auto &gamepad = vigem->gamepads[battery.id.globalIndex];
     if (!gamepad.gp) {
       return;
@@ -1711,7 +1823,29 @@ namespace platf {
       }
     }
 
-    ds4_update_ts_and_send(vigem, battery.id.globalIndex);
+    send_report(vigem, battery.id.globalIndex);
+  }
+
+  void begin_input_batch(input_t &input) {
+    input_batch.active = true;
+  }
+
+  void end_input_batch(input_t &input) {
+    input_batch.active = false;
+
+    flush_input_batch();
+
+    auto vigem = ((input_raw_t *) input.get())->vigem;
+    if (vigem && input_batch.pending_reports.any()) {
+      std::lock_guard lg {vigem->lock};
+
+      for (int nr = 0; nr < MAX_GAMEPADS; ++nr) {
+        if (input_batch.pending_reports[nr]) {
+          send_report(vigem, nr);
+        }
+      }
+    }
+    input_batch.pending_reports.reset();
   }
 
   void freeInput(void *p) {
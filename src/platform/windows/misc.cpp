@@ -9,6 +9,7 @@
 #include <iterator>
 #include <set>
 #include <sstream>
+#include <thread>
 
 // lib includes
 #include <boost/algorithm/string.hpp>
@@ -28,6 +29,7 @@
 #include <winuser.h>
 #include <wlanapi.h>
 #include <ws2tcpip.h>
+#include <mswsock.h>
 #include <wtsapi32.h>
 #include <sddl.h>
 // clang-format on
@@ -44,6 +46,7 @@
 #include "src/globals.h"
 #include "src/logging.h"
 #include "src/platform/common.h"
+#include "src/thread_affinity.h"
 #include "src/utility.h"
 
 // UDP_SEND_MSG_SIZE was added in the Windows 10 20H1 SDK
@@ -182,6 +185,25 @@ namespace platf {
     return "00:00:00:00:00:00"s;
   }
 
+  std::uint64_t get_link_speed(const std::string_view &address) {
+    adapteraddrs_t info = get_adapteraddrs();
+    for (auto adapter_pos = info.get(); adapter_pos != nullptr; adapter_pos = adapter_pos->Next) {
+      for (auto addr_pos = adapter_pos->FirstUnicastAddress; addr_pos != nullptr; addr_pos = addr_pos->Next) {
+        if (address == from_sockaddr(addr_pos->Address.lpSockaddr)) {
+          // The maximum value means the speed is unknown
+          if (adapter_pos->TransmitLinkSpeed == (ULONG64) -1) {
+            return 0;
+          }
+
+          return adapter_pos->TransmitLinkSpeed;
+        }
+      }
+    }
+
+    BOOST_LOG(debug) << "Unable to find link speed for "sv << address;
+    return 0;
+  }
+
   HDESK syncThreadDesktop() {
     auto hDesk = OpenInputDesktop(DF_ALLOWOTHERACCOUNTHOOK, FALSE, GENERIC_ALL);
     if (!hDesk) {
@@ -1048,6 +1070,161 @@ namespace platf {
     }
   }
 
+  bool set_thread_affinity(const std::vector<int> &cpus) {
+    // CPUs are numbered across the processor groups, but a thread is pinned within a single group.
+    // Use the group of the first CPU.
+    GROUP_AFFINITY affinity {};
+
+    WORD group_count = GetActiveProcessorGroupCount();
+    int first_cpu = 0;
+    for (WORD group = 0; group < group_count; ++group) {
+      int group_size = GetActiveProcessorCount(group);
+      if (cpus.front() >= first_cpu + group_size) {
+        first_cpu += group_size;
+        continue;
+      }
+
+      affinity.Group = group;
+      for (auto cpu : cpus) {
+        if (cpu >= first_cpu && cpu < first_cpu + group_size) {
+          affinity.Mask |= (KAFFINITY) 1 << (cpu - first_cpu);
+        }
+      }
+      break;
+    }
+
+    if (!affinity.Mask) {
+      BOOST_LOG(warning) << "Unable to set thread affinity: no such CPU "sv << cpus.front();
+      return false;
+    }
+
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr)) {
+      auto winerr = GetLastError();
+      BOOST_LOG(warning) << "Unable to set thread affinity: "sv << winerr;
+      return false;
+    }
+
+    return true;
+  }
+
+  std::vector<int> numa_node_cpus(int node) {
+    GROUP_AFFINITY affinity;
+    if (node < 0 || !GetNumaNodeProcessorMaskEx((USHORT) node, &affinity)) {
+      return {};
+    }
+
+    int first_cpu = 0;
+    for (WORD group = 0; group < affinity.Group; ++group) {
+      first_cpu += GetActiveProcessorCount(group);
+    }
+
+    std::vector<int> cpus;
+    for (int bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+      if (affinity.Mask & ((KAFFINITY) 1 << bit)) {
+        cpus.emplace_back(first_cpu + bit);
+      }
+    }
+
+    return cpus;
+  }
+
+  std::vector<int> gpu_local_cpus() {
+    // DXGI doesn't expose the NUMA node of an adapter, leave it to the scheduler
+    return {};
+  }
+
+  namespace {
+    /**
+     * @brief Get the NUMA node the encode threads are pinned to.
+     * @return The node, or `NUMA_NO_PREFERRED_NODE` if they aren't pinned.
+     */
+    DWORD encode_numa_node() {
+      auto cpus = thread_affinity::cpus(thread_affinity::role_e::encode);
+      if (cpus.empty()) {
+        return NUMA_NO_PREFERRED_NODE;
+      }
+
+      PROCESSOR_NUMBER processor {};
+      int first_cpu = 0;
+      for (WORD group = 0; group < GetActiveProcessorGroupCount(); ++group) {
+        int group_size = GetActiveProcessorCount(group);
+        if (cpus.front() < first_cpu + group_size) {
+          processor.Group = group;
+          processor.Number = (BYTE) (cpus.front() - first_cpu);
+          break;
+        }
+        first_cpu += group_size;
+      }
+
+      USHORT node;
+      if (!GetNumaProcessorNodeEx(&processor, &node) || node == 0xFFFF) {
+        return NUMA_NO_PREFERRED_NODE;
+      }
+
+      return node;
+    }
+
+    /**
+     * @brief Get the size of large pages if the process may allocate them.
+     * @details Large pages need SeLockMemoryPrivilege, which is only granted to accounts it is assigned to.
+     * @return The size, or 0 if they can't be used.
+     */
+    SIZE_T large_page_size() {
+      auto size = GetLargePageMinimum();
+      if (!size) {
+        return 0;
+      }
+
+      HANDLE token;
+      if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return 0;
+      }
+      auto close_token = util::fail_guard([token]() {
+        CloseHandle(token);
+      });
+
+      TOKEN_PRIVILEGES tp {};
+      tp.PrivilegeCount = 1;
+      tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+      if (!LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)) {
+        return 0;
+      }
+
+      // AdjustTokenPrivileges() succeeds without assigning privileges the account doesn't hold
+      if (!AdjustTokenPrivileges(token, false, &tp, 0, nullptr, nullptr) || GetLastError() != ERROR_SUCCESS) {
+        BOOST_LOG(debug) << "Not allowed to lock memory, capturing to regular pages"sv;
+        return 0;
+      }
+
+      return size;
+    }
+  }  // namespace
+
+  std::uint8_t *alloc_frame_data(std::size_t size) {
+    static const DWORD node = encode_numa_node();
+    static const SIZE_T large_page = large_page_size();
+
+    void *data = nullptr;
+    if (large_page) {
+      data = VirtualAllocExNuma(GetCurrentProcess(), nullptr, (size + large_page - 1) / large_page * large_page, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+    }
+
+    if (!data) {
+      data = VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+      if (!data) {
+        BOOST_LOG(error) << "Couldn't allocate "sv << size << " bytes for a frame: "sv << GetLastError();
+      }
+    }
+
+    return (std::uint8_t *) data;
+  }
+
+  void free_frame_data(std::uint8_t *data, std::size_t size) {
+    if (data) {
+      VirtualFree(data, 0, MEM_RELEASE);
+    }
+  }
+
   void streaming_will_start() {
     static std::once_flag load_wlanapi_once_flag;
     std::call_once(load_wlanapi_once_flag, []() {
@@ -1321,6 +1498,77 @@ namespace platf {
     return accounting_info.ActiveProcesses != 0;
   }
 
+  /**
+   * @brief Waits for the job of an app to report through a completion port that the app exited.
+   */
+  class process_watch_t: public deinit_t {
+  public:
+    process_watch_t(HANDLE port, HANDLE process, HANDLE job, bool wait_all, std::function<void()> on_exit):
+        port {port},
+        thread {&process_watch_t::run, this, process, job, wait_all, std::move(on_exit)} {
+    }
+
+    ~process_watch_t() override {
+      // The messages of the job use its handle as completion key, a null key stops the watch
+      PostQueuedCompletionStatus(port, 0, 0, nullptr);
+      thread.join();
+      CloseHandle(port);
+    }
+
+  private:
+    void run(HANDLE process, HANDLE job, bool wait_all, std::function<void()> on_exit) {
+      auto process_id = GetProcessId(process);
+
+      // The app may have exited before the job was associated with the port
+      bool exited = wait_all ? !process_group_running((std::uintptr_t) job) : WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+      while (!exited) {
+        DWORD message;
+        ULONG_PTR key;
+        LPOVERLAPPED overlapped;
+        if (!GetQueuedCompletionStatus(port, &message, &key, &overlapped, INFINITE)) {
+          BOOST_LOG(warning) << "Couldn't wait for the app to exit: "sv << GetLastError();
+          return;
+        }
+
+        if (!key) {
+          return;
+        }
+
+        if (wait_all) {
+          exited = message == JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO;
+        } else {
+          // The id of the process that exited is passed instead of an OVERLAPPED
+          exited = (message == JOB_OBJECT_MSG_EXIT_PROCESS || message == JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS) &&
+                   (DWORD) (ULONG_PTR) overlapped == process_id;
+        }
+      }
+
+      on_exit();
+    }
+
+    HANDLE port;
+    std::thread thread;
+  };
+
+  std::unique_ptr<deinit_t> watch_process_exit(std::uintptr_t process_handle, std::uintptr_t group_handle, bool wait_all, std::function<void()> on_exit) {
+    auto port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!port) {
+      BOOST_LOG(warning) << "Couldn't create a completion port: "sv << GetLastError();
+      return nullptr;
+    }
+
+    JOBOBJECT_ASSOCIATE_COMPLETION_PORT association {};
+    association.CompletionKey = (HANDLE) group_handle;
+    association.CompletionPort = port;
+    if (!SetInformationJobObject((HANDLE) group_handle, JobObjectAssociateCompletionPortInformation, &association, sizeof(association))) {
+      BOOST_LOG(debug) << "Couldn't associate the job of the app with a completion port, polling it instead: "sv << GetLastError();
+      CloseHandle(port);
+      return nullptr;
+    }
+
+    return std::make_unique<process_watch_t>(port, (HANDLE) process_handle, (HANDLE) group_handle, wait_all, std::move(on_exit));
+  }
+
   SOCKADDR_IN to_sockaddr(boost::asio::ip::address_v4 address, uint16_t port) {
     SOCKADDR_IN saddr_v4 = {};
 
@@ -1451,6 +1699,82 @@ namespace platf {
     return WSASendMsg((SOCKET) send_info.native_socket, &msg, 0, &bytes_sent, nullptr, nullptr) != SOCKET_ERROR;
   }
 
+  int recv_batch(std::uintptr_t native_socket, recv_datagram_t *datagrams, size_t count, size_t buffer_size) {
+    // WSARecvMsg() is only available through the extension function table
+    static LPFN_WSARECVMSG WSARecvMsg_fn = [native_socket]() -> LPFN_WSARECVMSG {
+      GUID guid = WSAID_WSARECVMSG;
+      LPFN_WSARECVMSG fn = nullptr;
+      DWORD bytes;
+      if (WSAIoctl((SOCKET) native_socket, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &fn, sizeof(fn), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+        BOOST_LOG(warning) << "Unable to find WSARecvMsg(): "sv << WSAGetLastError();
+        return nullptr;
+      }
+
+      return fn;
+    }();
+
+    if (!WSARecvMsg_fn) {
+      return -1;
+    }
+
+    // Winsock has no equivalent of recvmmsg(), so fill the ring of datagrams
+    // one by one until the socket has nothing left to read. The socket stays
+    // in blocking mode for the send path, so check for queued data first.
+    size_t received = 0;
+    while (received < count) {
+      u_long pending = 0;
+      if (ioctlsocket((SOCKET) native_socket, FIONREAD, &pending) == SOCKET_ERROR || !pending) {
+        break;
+      }
+
+      auto &datagram = datagrams[received];
+
+      WSABUF buf;
+      buf.buf = datagram.buffer;
+      buf.len = buffer_size;
+
+      WSAMSG msg = {};
+      msg.name = (PSOCKADDR) datagram.address.data();
+      msg.namelen = datagram.address.size();
+      msg.lpBuffers = &buf;
+      msg.dwBufferCount = 1;
+
+      DWORD bytes;
+      if (WSARecvMsg_fn((SOCKET) native_socket, &msg, &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+        auto winerr = WSAGetLastError();
+
+        // ICMP errors from earlier sends are reported here as well
+        if (winerr == WSAECONNRESET) {
+          continue;
+        }
+
+        if (winerr != WSAEWOULDBLOCK) {
+          BOOST_LOG(warning) << "WSARecvMsg() failed: "sv << winerr;
+        }
+        break;
+      }
+
+      datagram.size = bytes;
+      datagram.address_size = msg.namelen;
+      received++;
+    }
+
+    return received;
+  }
+
+  bool enable_tx_timestamps(std::uintptr_t native_socket) {
+    // Transmit timestamps are not available through Winsock
+    return false;
+  }
+
+  bool enable_tx_launch_time(std::uintptr_t native_socket) {
+    // Launch times are not available through Winsock
+    return false;
+  }
+
+  void read_tx_timestamps(std::uintptr_t native_socket, const std::function<void(std::uint32_t, std::chrono::steady_clock::time_point)> &callback) {
+  }
+
   bool send(send_info_t &send_info) {
     WSAMSG msg;
 
@@ -8,9 +8,13 @@
 #include <winsock2.h>
 #include <windows.h>
 // clang-format on
+#include <iphlpapi.h>
 #include <windns.h>
 #include <winerror.h>
 
+// standard includes
+#include <thread>
+
 // local includes
 #include "misc.h"
 #include "src/config.h"
@@ -103,87 +107,65 @@ namespace platf::publish {
     alarm->ring(pInstance);
   }
 
-  static int service(bool enable, PDNS_SERVICE_INSTANCE &existing_instance) {
-    auto alarm = safe::make_alarm<PDNS_SERVICE_INSTANCE>();
-
-    std::wstring domain {SERVICE_TYPE_DOMAIN.data(), SERVICE_TYPE_DOMAIN.size()};
-
-    auto hostname = platf::get_host_name();
-    auto name = from_utf8(net::mdns_instance_name(hostname) + '.') + domain;
-    auto host = from_utf8(hostname + ".local");
-
-    DNS_SERVICE_INSTANCE instance {};
-    instance.pszInstanceName = name.data();
-    instance.wPort = net::map_port(nvhttp::PORT_HTTP);
-    instance.pszHostName = host.data();
-
-    // Setting these values ensures Windows mDNS answers comply with RFC 1035.
-    // If these are unset, Windows will send a TXT record that has zero strings,
-    // which is illegal. Setting them to a single empty value causes Windows to
-    // send a single empty string for the TXT record, which is the correct thing
-    // to do when advertising a service without any TXT strings.
-    //
-    // Most clients aren't strictly checking TXT record compliance with RFC 1035,
-    // but Apple's mDNS resolver does and rejects the entire answer if an invalid
-    // TXT record is present.
-    PWCHAR keys[] = {nullptr};
-    PWCHAR values[] = {nullptr};
-    instance.dwPropertyCount = 1;
-    instance.keys = keys;
-    instance.values = values;
-
-    DNS_SERVICE_REGISTER_REQUEST req {};
-    req.Version = DNS_QUERY_REQUEST_VERSION1;
-    req.pQueryContext = alarm.get();
-    req.pServiceInstance = enable ? &instance : existing_instance;
-    req.pRegisterCompletionCallback = register_cb;
-
-    DNS_STATUS status {};
-
-    if (enable) {
-      status = _DnsServiceRegister(&req, nullptr);
-      if (status != DNS_REQUEST_PENDING) {
-        print_status("DnsServiceRegister()"sv, status);
-        return -1;
-      }
-    } else {
-      status = _DnsServiceDeRegister(&req, nullptr);
-      if (status != DNS_REQUEST_PENDING) {
-        print_status("DnsServiceDeRegister()"sv, status);
-        return -1;
-      }
-    }
-
-    alarm->wait();
-
-    auto registered_instance = alarm->status();
-    if (enable) {
-      // Store this instance for later deregistration
-      existing_instance = registered_instance;
-    } else if (registered_instance) {
-      // Deregistration was successful
-      _DnsServiceFreeInstance(registered_instance);
-      existing_instance = nullptr;
-    }
-
-    return registered_instance ? 0 : -1;
-  }
-
   class mdns_registration_t: public ::platf::deinit_t {
   public:
     mdns_registration_t():
         existing_instance(nullptr) {
-      if (service(true, existing_instance)) {
+      // The records are built once, to be registered again as is after network changes
+      std::wstring domain {SERVICE_TYPE_DOMAIN.data(), SERVICE_TYPE_DOMAIN.size()};
+
+      auto hostname = platf::get_host_name();
+      name = from_utf8(net::mdns_instance_name(hostname) + '.') + domain;
+      host = from_utf8(hostname + ".local");
+
+      instance.pszInstanceName = name.data();
+      instance.wPort = net::map_port(nvhttp::PORT_HTTP);
+      instance.pszHostName = host.data();
+
+      // Setting these values ensures Windows mDNS answers comply with RFC 1035.
+      // If these are unset, Windows will send a TXT record that has zero strings,
+      // which is illegal. Setting them to a single empty value causes Windows to
+      // send a single empty string for the TXT record, which is the correct thing
+      // to do when advertising a service without any TXT strings.
+      //
+      // Most clients aren't strictly checking TXT record compliance with RFC 1035,
+      // but Apple's mDNS resolver does and rejects the entire answer if an invalid
+      // TXT record is present.
+      instance.dwPropertyCount = 1;
+      instance.keys = keys;
+      instance.values = values;
+
+      if (service(true)) {
         BOOST_LOG(error) << "Unable to register Sunshine mDNS service"sv;
         return;
       }
 
       BOOST_LOG(info) << "Registered Sunshine mDNS service"sv;
+
+      // Registering again announces the service right away, including on the addresses that just came up
+      auto status = NotifyUnicastIpAddressChange(AF_UNSPEC, address_change_cb, this, FALSE, &address_notification);
+      if (status != NO_ERROR) {
+        BOOST_LOG(warning) << "Unable to watch for network changes, the mDNS service won't be announced again on them: "sv << status;
+        address_notification = nullptr;
+        return;
+      }
+
+      reannounce_thread = std::thread {&mdns_registration_t::reannounce, this};
     }
 
     ~mdns_registration_t() override {
+      if (address_notification) {
+        // Waits for the running callbacks to return
+        CancelMibChangeNotify2(address_notification);
+      }
+
+      address_changes.stop();
+      if (reannounce_thread.joinable()) {
+        reannounce_thread.join();
+      }
+
       if (existing_instance) {
-        if (service(false, existing_instance)) {
+        if (service(false)) {
           BOOST_LOG(error) << "Unable to unregister Sunshine mDNS service"sv;
           return;
         }
@@ -193,7 +175,85 @@ namespace platf::publish {
     }
 
   private:
+    static VOID NETIOAPI_API_ address_change_cb(PVOID context, PMIB_UNICASTIPADDRESS_ROW, MIB_NOTIFICATION_TYPE type) {
+      if (type == MibAddInstance || type == MibParameterNotification) {
+        ((mdns_registration_t *) context)->address_changes.raise(true);
+      }
+    }
+
+    void reannounce() {
+      while (address_changes.pop()) {
+        // The addresses of an interface coming up change in bursts, wait for them to settle
+        while (address_changes.pop(1s)) {}
+
+        if (!address_changes.running()) {
+          break;
+        }
+
+        if (existing_instance && service(false)) {
+          BOOST_LOG(warning) << "Unable to unregister Sunshine mDNS service after a network change"sv;
+        }
+
+        if (service(true)) {
+          BOOST_LOG(error) << "Unable to register Sunshine mDNS service after a network change"sv;
+          continue;
+        }
+
+        BOOST_LOG(info) << "Announced Sunshine mDNS service again after a network change"sv;
+      }
+    }
+
+    int service(bool enable) {
+      auto alarm = safe::make_alarm<PDNS_SERVICE_INSTANCE>();
+
+      DNS_SERVICE_REGISTER_REQUEST req {};
+      req.Version = DNS_QUERY_REQUEST_VERSION1;
+      req.pQueryContext = alarm.get();
+      req.pServiceInstance = enable ? &instance : existing_instance;
+      req.pRegisterCompletionCallback = register_cb;
+
+      DNS_STATUS status {};
+
+      if (enable) {
+        status = _DnsServiceRegister(&req, nullptr);
+        if (status != DNS_REQUEST_PENDING) {
+          print_status("DnsServiceRegister()"sv, status);
+          return -1;
+        }
+      } else {
+        status = _DnsServiceDeRegister(&req, nullptr);
+        if (status != DNS_REQUEST_PENDING) {
+          print_status("DnsServiceDeRegister()"sv, status);
+          return -1;
+        }
+      }
+
+      alarm->wait();
+
+      auto registered_instance = alarm->status();
+      if (enable) {
+        // Store this instance for later deregistration
+        existing_instance = registered_instance;
+      } else if (registered_instance) {
+        // Deregistration was successful
+        _DnsServiceFreeInstance(registered_instance);
+        existing_instance = nullptr;
+      }
+
+      return registered_instance ? 0 : -1;
+    }
+
+    std::wstring name;
+    std::wstring host;
+    PWCHAR keys[1] {nullptr};
+    PWCHAR values[1] {nullptr};
+    DNS_SERVICE_INSTANCE instance {};
+
     PDNS_SERVICE_INSTANCE existing_instance;
+
+    HANDLE address_notification {nullptr};
+    safe::event_t<bool> address_changes;
+    std::thread reannounce_thread;
   };
 
   int load_funcs(HMODULE handle) {
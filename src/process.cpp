@@ -5,9 +5,13 @@
 #define BOOST_BIND_GLOBAL_PLACEHOLDERS
 
 // standard includes
+#include <atomic>
 #include <filesystem>
+#include <future>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 // lib includes
@@ -24,6 +28,7 @@
 #include "config.h"
 #include "crypto.h"
 #include "display_device.h"
+#include "globals.h"
 #include "logging.h"
 #include "platform/common.h"
 #include "process.h"
@@ -46,6 +51,34 @@ namespace proc {
 
   proc_t proc;
 
+  namespace {
+    std::atomic<std::uint64_t> apps_generation {0};
+
+    // Held while an app is launched or terminated, the app may be launched on another thread than the ones checking on it
+    std::recursive_mutex launch_lock;
+    std::atomic<int> launching_app_id {0};
+
+    /**
+     * @brief The hash of an app image, valid for as long as the file keeps its write time and size.
+     */
+    struct image_hash_t {
+      std::filesystem::file_time_type write_time;
+      std::uintmax_t size;
+      std::string hash;
+    };
+
+    // Every edit of the apps reparses all of them, only the images that changed are hashed again
+    std::mutex image_hashes_lock;
+    std::unordered_map<std::string, image_hash_t> image_hashes;
+
+    /**
+     * @brief Check if two consecutive prep commands run concurrently, which they do when they're in the same group.
+     */
+    bool same_prep_group(const cmd_t &a, const cmd_t &b) {
+      return !a.group.empty() && a.group == b.group;
+    }
+  }  // namespace
+
   class deinit_t: public platf::deinit_t {
   public:
     ~deinit_t() {
@@ -131,6 +164,13 @@ namespace proc {
   }
 
   int proc_t::execute(int app_id, std::shared_ptr<rtsp_stream::launch_session_t> launch_session) {
+    // Reset after the lock is released, so running() sees either the app being launched or the one started
+    auto launched = util::fail_guard([]() {
+      launching_app_id = 0;
+    });
+    std::lock_guard lg {launch_lock};
+    launching_app_id = app_id;
+
     // Ensure starting from a clean slate
     terminate();
 
@@ -193,36 +233,33 @@ namespace proc {
       terminate();
     });
 
-    for (; _app_prep_it != std::end(_app.prep_cmds); ++_app_prep_it) {
-      auto &cmd = *_app_prep_it;
+    while (_app_prep_it != std::end(_app.prep_cmds)) {
+      auto group_end = _app_prep_it + 1;
+      while (group_end != std::end(_app.prep_cmds) && same_prep_group(*_app_prep_it, *group_end)) {
+        ++group_end;
+      }
 
-      // Skip empty commands
-      if (cmd.do_cmd.empty()) {
-        continue;
+      std::vector<const cmd_t *> group;
+      for (auto it = _app_prep_it; it != group_end; ++it) {
+        group.push_back(&*it);
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.do_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Do Cmd: ["sv << cmd.do_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.do_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
+      auto succeeded = run_prep_cmds(group, false);
+      if (std::find(std::begin(succeeded), std::end(succeeded), false) == std::end(succeeded)) {
+        _app_prep_it = group_end;
+        continue;
+      }
 
-      if (ec) {
-        BOOST_LOG(error) << "Couldn't run ["sv << cmd.do_cmd << "]: System: "sv << ec.message();
-        // We don't want any prep commands failing launch of the desktop.
-        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
-        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
-        if (!(_app.cmd.empty() && ec == std::errc::permission_denied)) {
-          return -1;
+      // terminate() only undoes the groups before this one, so the commands of this group that succeeded are undone here
+      std::vector<const cmd_t *> undo;
+      for (std::size_t x = 0; x < group.size(); ++x) {
+        if (succeeded[x]) {
+          undo.push_back(group[x]);
         }
       }
+      run_prep_cmds(undo, true);
 
-      child.wait();
-      auto ret = child.exit_code();
-      if (ret != 0 && ec != std::errc::permission_denied) {
-        BOOST_LOG(error) << '[' << cmd.do_cmd << "] failed with code ["sv << ret << ']';
-        return -1;
-      }
+      return -1;
     }
 
     for (auto &cmd : _app.detached) {
@@ -251,6 +288,17 @@ namespace proc {
         BOOST_LOG(warning) << "Couldn't run ["sv << _app.cmd << "]: System: "sv << ec.message();
         return -1;
       }
+
+      auto app_exited = std::make_shared<std::atomic_bool>();
+      _exit_watch = platf::watch_process_exit((std::uintptr_t) _process.native_handle(), (std::uintptr_t) _process_group.native_handle(), _app.wait_all, [app_exited]() {
+        app_exited->store(true);
+
+        // Run the undo commands now rather than when the app is checked on next
+        background_pool.push([]() {
+          proc.running();
+        });
+      });
+      _app_exited = std::move(app_exited);
     }
 
     _app_launch_time = std::chrono::steady_clock::now();
@@ -260,7 +308,88 @@ namespace proc {
     return 0;
   }
 
+  std::vector<bool> proc_t::run_prep_cmds(const std::vector<const cmd_t *> &cmds, bool undo) {
+    auto run = [this, undo](const cmd_t &cmd) {
+      auto &command = undo ? cmd.undo_cmd : cmd.do_cmd;
+
+      // Skip empty commands
+      if (command.empty()) {
+        return true;
+      }
+
+      boost::filesystem::path working_dir = _app.working_dir.empty() ?
+                                              find_working_directory(command, _env) :
+                                              boost::filesystem::path(_app.working_dir);
+      BOOST_LOG(info) << (undo ? "Executing Undo Cmd: ["sv : "Executing Do Cmd: ["sv) << command << ']';
+
+      auto start = std::chrono::steady_clock::now();
+      std::error_code ec;
+      auto child = platf::run_command(cmd.elevated, true, command, working_dir, _env, _pipe.get(), ec, nullptr);
+
+      if (ec) {
+        if (undo) {
+          BOOST_LOG(warning) << "System: "sv << ec.message();
+          return false;
+        }
+
+        BOOST_LOG(error) << "Couldn't run ["sv << command << "]: System: "sv << ec.message();
+        // We don't want any prep commands failing launch of the desktop.
+        // This is to prevent the issue where users reboot their PC and need to log in with Sunshine.
+        // permission_denied is typically returned when the user impersonation fails, which can happen when user is not signed in yet.
+        return _app.cmd.empty() && ec == std::errc::permission_denied;
+      }
+
+      if (cmd.timeout > 0) {
+        // child::wait_for() is broken and deprecated like group::wait_for(), so we use a simple polling loop
+        auto deadline = start + std::chrono::seconds {cmd.timeout};
+        while (child.running(ec) && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::sleep_for(50ms);
+        }
+
+        if (child.running(ec)) {
+          BOOST_LOG(undo ? warning : error) << '[' << command << "] didn't finish within "sv << cmd.timeout << " seconds, terminating it"sv;
+          child.terminate(ec);
+          return false;
+        }
+      } else {
+        child.wait();
+      }
+
+      auto ret = child.exit_code();
+      BOOST_LOG(info) << '[' << command << "] finished in "sv << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms"sv;
+
+      if (ret != 0) {
+        BOOST_LOG(undo ? warning : error) << '[' << command << "] failed with code ["sv << ret << ']';
+        return false;
+      }
+
+      return true;
+    };
+
+    std::vector<bool> succeeded;
+    if (cmds.size() == 1) {
+      succeeded.push_back(run(*cmds[0]));
+      return succeeded;
+    }
+
+    std::vector<std::future<bool>> results;
+    for (auto cmd : cmds) {
+      results.emplace_back(std::async(std::launch::async, run, std::cref(*cmd)));
+    }
+    for (auto &result : results) {
+      succeeded.push_back(result.get());
+    }
+
+    return succeeded;
+  }
+
   int proc_t::running() {
+    std::unique_lock lk {launch_lock, std::try_to_lock};
+    if (!lk) {
+      // The app being launched counts as running
+      return launching_app_id;
+    }
+
 #ifndef _WIN32
     // On POSIX OSes, we must periodically wait for our children to avoid
     // them becoming zombies. This must be synchronized carefully with
@@ -273,6 +402,9 @@ namespace proc {
 
     if (placebo) {
       return _app_id;
+    } else if (_exit_watch && !_app_exited->load()) {
+      // The OS tells us once the app exited, so its processes don't need to be checked on
+      return _app_id;
     } else if (_app.wait_all && _process_group && platf::process_group_running((std::uintptr_t) _process_group.native_handle())) {
       // The app is still running if any process in the group is still running
       return _app_id;
@@ -297,35 +429,28 @@ namespace proc {
   }
 
   void proc_t::terminate() {
-    std::error_code ec;
+    std::lock_guard lg {launch_lock};
+
     placebo = false;
+    _exit_watch.reset();
     terminate_process_group(_process, _process_group, _app.exit_timeout);
     _process = boost::process::v1::child();
     _process_group = boost::process::v1::group();
 
-    for (; _app_prep_it != _app_prep_begin; --_app_prep_it) {
-      auto &cmd = *(_app_prep_it - 1);
-
-      if (cmd.undo_cmd.empty()) {
-        continue;
+    // The groups are undone in the reverse order they were run in
+    while (_app_prep_it != _app_prep_begin) {
+      auto group_begin = _app_prep_it - 1;
+      while (group_begin != _app_prep_begin && same_prep_group(*(group_begin - 1), *group_begin)) {
+        --group_begin;
       }
 
-      boost::filesystem::path working_dir = _app.working_dir.empty() ?
-                                              find_working_directory(cmd.undo_cmd, _env) :
-                                              boost::filesystem::path(_app.working_dir);
-      BOOST_LOG(info) << "Executing Undo Cmd: ["sv << cmd.undo_cmd << ']';
-      auto child = platf::run_command(cmd.elevated, true, cmd.undo_cmd, working_dir, _env, _pipe.get(), ec, nullptr);
-
-      if (ec) {
-        BOOST_LOG(warning) << "System: "sv << ec.message();
+      std::vector<const cmd_t *> group;
+      for (auto it = group_begin; it != _app_prep_it; ++it) {
+        group.push_back(&*it);
       }
 
-      child.wait();
-      auto ret = child.exit_code();
-
-      if (ret != 0) {
-        BOOST_LOG(warning) << "Return code ["sv << ret << ']';
-      }
+      run_prep_cmds(group, true);
+      _app_prep_it = group_begin;
     }
 
     _pipe.reset();
@@ -526,6 +651,31 @@ namespace proc {
     return ss.str();
   }
 
+  std::optional<std::string> calculate_image_sha256(const std::string &filename) {
+    std::error_code ec;
+    auto write_time = std::filesystem::last_write_time(filename, ec);
+    auto size = ec ? 0 : std::filesystem::file_size(filename, ec);
+    if (ec) {
+      return calculate_sha256(filename);
+    }
+
+    {
+      std::lock_guard lg {image_hashes_lock};
+      auto it = image_hashes.find(filename);
+      if (it != std::end(image_hashes) && it->second.write_time == write_time && it->second.size == size) {
+        return it->second.hash;
+      }
+    }
+
+    auto hash = calculate_sha256(filename);
+    if (hash) {
+      std::lock_guard lg {image_hashes_lock};
+      image_hashes.insert_or_assign(filename, image_hash_t {write_time, size, *hash});
+    }
+
+    return hash;
+  }
+
   uint32_t calculate_crc32(const std::string &input) {
     boost::crc_32_type result;
     result.process_bytes(input.data(), input.length());
@@ -538,7 +688,7 @@ namespace proc {
     to_hash.push_back(app_name);
     auto file_path = validate_app_image_path(app_image_path);
     if (file_path != DEFAULT_APP_IMAGE_PATH) {
-      auto file_hash = calculate_sha256(file_path);
+      auto file_hash = calculate_image_sha256(file_path);
       if (file_hash) {
         to_hash.push_back(file_hash.value());
       } else {
@@ -604,11 +754,13 @@ namespace proc {
             auto do_cmd = parse_env_val(this_env, prep_cmd.do_cmd);
             auto undo_cmd = parse_env_val(this_env, prep_cmd.undo_cmd);
 
-            prep_cmds.emplace_back(
+            auto &cmd = prep_cmds.emplace_back(
               std::move(do_cmd),
               std::move(undo_cmd),
               std::move(prep_cmd.elevated)
             );
+            cmd.group = prep_cmd.group;
+            cmd.timeout = prep_cmd.timeout;
           }
         }
 
@@ -620,12 +772,16 @@ namespace proc {
             auto do_cmd = prep_node.get_optional<std::string>("do"s);
             auto undo_cmd = prep_node.get_optional<std::string>("undo"s);
             auto elevated = prep_node.get_optional<bool>("elevated");
+            auto group = prep_node.get_optional<std::string>("group"s);
+            auto timeout = prep_node.get_optional<int>("timeout"s);
 
-            prep_cmds.emplace_back(
+            auto &cmd = prep_cmds.emplace_back(
               parse_env_val(this_env, do_cmd.value_or("")),
               parse_env_val(this_env, undo_cmd.value_or("")),
               std::move(elevated.value_or(false))
             );
+            cmd.group = group.value_or("");
+            cmd.timeout = timeout.value_or(0);
           }
         }
 
@@ -699,6 +855,11 @@ namespace proc {
 
     if (proc_opt) {
       proc = std::move(*proc_opt);
+      apps_generation.fetch_add(1, std::memory_order_release);
     }
   }
+
+  std::uint64_t apps_version() {
+    return apps_generation.load(std::memory_order_acquire);
+  }
 }  // namespace proc
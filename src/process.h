@@ -9,6 +9,8 @@
 #endif
 
 // standard includes
+#include <atomic>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 
@@ -96,6 +98,14 @@ namespace proc {
     void terminate();
 
   private:
+    /**
+     * @brief Run the do or undo commands of prep commands concurrently, and wait for all of them.
+     * @param cmds The prep commands.
+     * @param undo Run the undo commands instead of the do ones.
+     * @return Whether each command succeeded.
+     */
+    std::vector<bool> run_prep_cmds(const std::vector<const cmd_t *> &cmds, bool undo);
+
     int _app_id;
 
     boost::process::v1::environment _env;
@@ -109,6 +119,10 @@ namespace proc {
     boost::process::v1::child _process;
     boost::process::v1::group _process_group;
 
+    // Notified by the OS once the app exited, nullptr if the app must be polled instead
+    std::unique_ptr<platf::deinit_t> _exit_watch;
+    std::shared_ptr<std::atomic_bool> _app_exited;
+
     file_t _pipe;
     std::vector<cmd_t>::const_iterator _app_prep_it;
     std::vector<cmd_t>::const_iterator _app_prep_begin;
@@ -121,7 +135,29 @@ namespace proc {
   std::tuple<std::string, std::string> calculate_app_id(const std::string &app_name, std::string app_image_path, int index);
 
   std::string validate_app_image_path(std::string app_image_path);
+
+  /**
+   * @brief Calculate the SHA-256 of a file.
+   * @param filename The path of the file.
+   * @return The hash in hexadecimal, std::nullopt if it couldn't be calculated.
+   */
+  std::optional<std::string> calculate_sha256(const std::string &filename);
+
+  /**
+   * @brief Calculate the SHA-256 of an app image, reusing the last one while the file keeps its write time and size.
+   * @param filename The path of the image.
+   * @return The hash in hexadecimal, std::nullopt if it couldn't be calculated.
+   */
+  std::optional<std::string> calculate_image_sha256(const std::string &filename);
+
   void refresh(const std::string &file_name);
+
+  /**
+   * @brief Get the version of the list of apps.
+   * @return A number that changes every time the apps are refreshed.
+   */
+  std::uint64_t apps_version();
+
   std::optional<proc::proc_t> parse(const std::string &file_name);
 
   /**
@@ -13,6 +13,7 @@ extern "C" {
 #include <array>
 #include <cctype>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
@@ -432,9 +433,21 @@ namespace rtsp_stream {
       return 0;
     }
 
-    template<class T, class X>
-    void iterate(std::chrono::duration<T, X> timeout) {
-      io_context.run_one_for(timeout);
+    /**
+     * @brief Handle the connections until stop() is called.
+     * @details The handshakes of the clients are only handled here, the sessions that ended are cleared
+     *          from another thread so joining their threads doesn't hold up the clients being set up.
+     */
+    void run() {
+      io_context.run();
+    }
+
+    /**
+     * @brief Make run() return, the connections being read are dropped.
+     */
+    void stop() {
+      work_guard.reset();
+      io_context.stop();
     }
 
     void handle_msg(tcp::socket &sock, launch_session_t &session, msg_t &&req) {
@@ -503,6 +516,7 @@ namespace rtsp_stream {
       raised_timeout = now + config::stream.ping_timeout;
 
       launch_event.raise(std::move(launch_session));
+      wake();
     }
 
     /**
@@ -533,6 +547,33 @@ namespace rtsp_stream {
 
     safe::event_t<std::shared_ptr<launch_session_t>> launch_event;
 
+    /**
+     * @brief Check if there's nothing for clear() to do until a session is launched.
+     * @return `true` if no launch is pending and no session exists.
+     */
+    bool idle() {
+      if (launch_event.peek()) {
+        return false;
+      }
+
+      auto lg = _session_slots.lock();
+      return _session_slots->empty();
+    }
+
+    /**
+     * @brief Wake the thread waiting in wait_for_activity().
+     */
+    void wake() {
+      activity.raise(true);
+    }
+
+    /**
+     * @brief Wait for a session to be launched or inserted, or for wake() to be called.
+     */
+    void wait_for_activity() {
+      activity.pop();
+    }
+
     /**
      * @brief Clear launch sessions.
      * @param all If true, clear all sessions. Otherwise, only clear timed out and stopped sessions.
@@ -581,6 +622,7 @@ namespace rtsp_stream {
       auto lg = _session_slots.lock();
       _session_slots->emplace(session);
       BOOST_LOG(info) << "New streaming session started [active sessions: "sv << _session_slots->size() << ']';
+      wake();
     }
 
   private:
@@ -590,9 +632,14 @@ namespace rtsp_stream {
 
     std::chrono::steady_clock::time_point raised_timeout;
 
+    safe::event_t<bool> activity;
+
     boost::asio::io_context io_context;
     tcp::acceptor acceptor {io_context};
 
+    // run() keeps waiting for connections even when accepting failed
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard {io_context.get_executor()};
+
     std::shared_ptr<socket_t> next_socket;
   };
 
@@ -736,7 +783,11 @@ namespace rtsp_stream {
     std::stringstream ss;
 
     // Tell the client about our supported features
-    ss << "a=x-ss-general.featureFlags:" << (uint32_t) platf::get_capabilities() << std::endl;
+    auto capabilities = platf::get_capabilities();
+    if (config::video.cursor_out_of_band) {
+      capabilities |= platf::platform_caps::cursor_out_of_band;
+    }
+    ss << "a=x-ss-general.featureFlags:" << (uint32_t) capabilities << std::endl;
 
     // Always request new control stream encryption if the client supports it
     uint32_t encryption_flags_supported = SS_ENC_CONTROL_V2 | SS_ENC_AUDIO;
@@ -1085,6 +1136,24 @@ namespace rtsp_stream {
     auto seqn_str = std::to_string(req->sequenceNumber);
     option.content = const_cast<char *>(seqn_str.c_str());
 
+    // When the app is started while the client sets up its stream, the stream begins once it's started.
+    // The other connections wait meanwhile, but only one app can be launched at a time anyway.
+    if (session.app_started.valid()) {
+      if (session.app_started.wait_for(config::stream.ping_timeout) != std::future_status::ready) {
+        BOOST_LOG(error) << "The app didn't start within the ping timeout"sv;
+        respond(sock, session, &option, 503, "SERVICE UNAVAILABLE", req->sequenceNumber, {});
+
+        return;
+      }
+
+      if (auto err = session.app_started.get()) {
+        BOOST_LOG(error) << "Failed to start the app: "sv << err;
+        respond(sock, session, &option, 503, "SERVICE UNAVAILABLE", req->sequenceNumber, {});
+
+        return;
+      }
+    }
+
     respond(sock, session, &option, 200, "OK", req->sequenceNumber, {});
   }
 
@@ -1106,8 +1175,25 @@ namespace rtsp_stream {
       return;
     }
 
+    std::thread io_thread {[]() {
+      server.run();
+    }};
+
+    // Without any session, the loop below is parked instead of waking up to find nothing to clean up
+    std::thread shutdown_thread {[shutdown_event]() {
+      shutdown_event->view();
+      server.wake();
+    }};
+
     while (!shutdown_event->peek()) {
-      server.iterate(std::min(500ms, config::stream.ping_timeout));
+      if (server.idle()) {
+        server.wait_for_activity();
+        continue;
+      }
+
+      if (shutdown_event->view(std::min(500ms, config::stream.ping_timeout))) {
+        break;
+      }
 
       if (broadcast_shutdown_event->peek()) {
         server.clear();
@@ -1117,6 +1203,10 @@ namespace rtsp_stream {
       }
     }
 
+    server.stop();
+    io_thread.join();
+    shutdown_thread.join();
+
     server.clear();
   }
 
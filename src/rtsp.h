@@ -6,6 +6,7 @@
 
 // standard includes
 #include <atomic>
+#include <future>
 
 // local includes
 #include "crypto.h"
@@ -38,6 +39,9 @@ namespace rtsp_stream {
     std::optional<crypto::cipher::gcm_t> rtsp_cipher;
     std::string rtsp_url_scheme;
     uint32_t rtsp_iv_counter;
+
+    // The result of proc::proc_t::execute() when the app is started while the client sets up its stream, invalid otherwise
+    std::shared_future<int> app_started;
   };
 
   void launch_session_raise(std::shared_ptr<launch_session_t> launch_session);
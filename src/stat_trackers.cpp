@@ -2,6 +2,10 @@
  * @file src/stat_trackers.cpp
  * @brief Definitions for streaming statistic tracking.
  */
+// standard includes
+#include <algorithm>
+#include <cmath>
+
 // local includes
 #include "stat_trackers.h"
 
@@ -15,4 +19,135 @@ namespace stat_trackers {
     return boost::format("%1$.2f");
   }
 
+  namespace {
+    void store_if(std::atomic<double> &target, double value, bool (*better)(double, double)) {
+      auto current = target.load(std::memory_order_relaxed);
+      while (better(value, current) && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+  }  // namespace
+
+  std::size_t histogram_tracker::bucket_of(double value) {
+    int exponent;
+    auto mantissa = std::frexp(value, &exponent);
+
+    // frexp() returns a mantissa in [0.5, 1), each sub-bucket covers an equal part of it
+    auto octave = exponent - MIN_EXPONENT;
+    if (octave < 0) {
+      return 0;
+    }
+    if (octave >= EXPONENTS) {
+      return SUB_BUCKETS * EXPONENTS - 1;
+    }
+
+    auto sub_bucket = std::min((int) ((mantissa - 0.5) * 2 * SUB_BUCKETS), SUB_BUCKETS - 1);
+    return octave * SUB_BUCKETS + sub_bucket;
+  }
+
+  double histogram_tracker::value_of(std::size_t bucket) {
+    auto octave = (int) (bucket / SUB_BUCKETS);
+    auto sub_bucket = (int) (bucket % SUB_BUCKETS);
+
+    // The middle of the bucket
+    return std::ldexp(0.5 + (sub_bucket + 0.5) / (2 * SUB_BUCKETS), octave + MIN_EXPONENT);
+  }
+
+  void histogram_tracker::collect(double value) {
+    if (value > 0) {
+      _buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    } else {
+      _zero.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+
+    store_if(_min, value, [](double value, double current) {
+      return value < current;
+    });
+    store_if(_max, value, [](double value, double current) {
+      return value > current;
+    });
+  }
+
+  void histogram_tracker::merge(const histogram_tracker &other) {
+    _zero.fetch_add(other._zero.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (std::size_t x = 0; x < _buckets.size(); ++x) {
+      if (auto count = other._buckets[x].load(std::memory_order_relaxed)) {
+        _buckets[x].fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+
+    auto other_sum = other.sum();
+    auto sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + other_sum, std::memory_order_relaxed)) {}
+
+    store_if(_min, other.min(), [](double value, double current) {
+      return value < current;
+    });
+    store_if(_max, other.max(), [](double value, double current) {
+      return value > current;
+    });
+  }
+
+  std::uint64_t histogram_tracker::count() const {
+    auto total = _zero.load(std::memory_order_relaxed);
+    for (auto &bucket : _buckets) {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+
+    return total;
+  }
+
+  double histogram_tracker::percentile(double percent) const {
+    auto total = count();
+    if (!total) {
+      return 0;
+    }
+
+    // The rank of the value, counting from 1
+    auto rank = std::max<std::uint64_t>((std::uint64_t) std::ceil(std::clamp(percent, 0., 100.) / 100 * total), 1);
+
+    // The extremes are known exactly, though they may lag behind the buckets of another thread
+    auto lowest = min();
+    auto highest = max();
+    auto bounded = [&](double value) {
+      return lowest <= highest ? std::clamp(value, lowest, highest) : value;
+    };
+    if (lowest <= highest) {
+      if (rank == 1) {
+        return lowest;
+      }
+      if (rank == total) {
+        return highest;
+      }
+    }
+
+    // The values at or below zero are all counted as the lowest one
+    auto seen = _zero.load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return bounded(std::min(0., lowest));
+    }
+
+    for (std::size_t x = 0; x < _buckets.size(); ++x) {
+      seen += _buckets[x].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        return bounded(value_of(x));
+      }
+    }
+
+    // More values were collected while counting
+    return bounded(value_of(_buckets.size() - 1));
+  }
+
+  void histogram_tracker::reset() {
+    _zero.store(0, std::memory_order_relaxed);
+    for (auto &bucket : _buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+
+    _sum.store(0, std::memory_order_relaxed);
+    _min.store(std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+    _max.store(-std::numeric_limits<double>::infinity(), std::memory_order_relaxed);
+  }
+
 }  // namespace stat_trackers
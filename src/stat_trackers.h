@@ -5,7 +5,10 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <limits>
 
@@ -50,4 +53,72 @@ namespace stat_trackers {
     } data;
   };
 
+  /**
+   * @brief Tracks the distribution of values in a fixed set of log-linear buckets, like HdrHistogram.
+   * @details Each power of two is split in SUB_BUCKETS buckets of the same width, so a percentile is
+   *          within 1/64 of the value it stands for, from 2^-24 to 2^40. Collecting a value only
+   *          updates atomic counters, so it doesn't allocate, and several threads can collect into the
+   *          same tracker or be merged into one.
+   * @examples
+   * histogram_tracker tracker;
+   * tracker.collect(1.5);
+   * tracker.collect(20);
+   * auto p99 = tracker.percentile(99);
+   * @examples_end
+   */
+  class histogram_tracker {
+  public:
+    /// The buckets in each power of two
+    static constexpr int SUB_BUCKETS = 32;
+    /// The exponent of the lowest power of two, smaller positive values are counted in its first bucket
+    static constexpr int MIN_EXPONENT = -24;
+    /// The number of powers of two, larger values are counted in the last bucket
+    static constexpr int EXPONENTS = 64;
+
+    void collect(double value);
+
+    /**
+     * @brief Add the values of another tracker.
+     * @param other The tracker to add.
+     */
+    void merge(const histogram_tracker &other);
+
+    /**
+     * @brief Get the value below which a share of the values fall.
+     * @param percent The share, from 0 to 100.
+     * @return The value, or 0 if nothing was collected.
+     */
+    double percentile(double percent) const;
+
+    std::uint64_t count() const;
+
+    double sum() const {
+      return _sum.load(std::memory_order_relaxed);
+    }
+
+    double min() const {
+      return _min.load(std::memory_order_relaxed);
+    }
+
+    double max() const {
+      return _max.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Forget the values, it must not be done while another thread collects.
+     */
+    void reset();
+
+  private:
+    static std::size_t bucket_of(double value);
+    static double value_of(std::size_t bucket);
+
+    // The values at or below zero are counted apart
+    std::atomic<std::uint64_t> _zero {};
+    std::array<std::atomic<std::uint64_t>, SUB_BUCKETS * EXPONENTS> _buckets {};
+    std::atomic<double> _sum {};
+    std::atomic<double> _min {std::numeric_limits<double>::infinity()};
+    std::atomic<double> _max {-std::numeric_limits<double>::infinity()};
+  };
+
 }  // namespace stat_trackers
@@ -6,7 +6,10 @@
 // standard includes
 #include <fstream>
 #include <future>
+#include <limits>
+#include <mutex>
 #include <queue>
+#include <span>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -20,18 +23,28 @@ extern "C" {
 }
 
 // local includes
+#include "bitrate_control.h"
 #include "config.h"
 #include "display_device.h"
+#include "fec_policy.h"
+#include "frame_trace.h"
 #include "globals.h"
 #include "input.h"
+#include "input_capture.h"
 #include "logging.h"
+#include "metrics.h"
 #include "network.h"
+#include "packet_capture.h"
+#include "pacing.h"
 #include "platform/common.h"
 #include "process.h"
 #include "stream.h"
 #include "sync.h"
 #include "system_tray.h"
+#include "thread_affinity.h"
+#include "thread_pool.h"
 #include "thread_safe.h"
+#include "timeline.h"
 #include "utility.h"
 
 #define IDX_START_A 0
@@ -49,6 +62,8 @@ extern "C" {
 #define IDX_SET_MOTION_EVENT 13
 #define IDX_SET_RGB_LED 14
 #define IDX_SET_ADAPTIVE_TRIGGERS 15
+#define IDX_CURSOR_POSITION 16
+#define IDX_CURSOR_SHAPE 17
 
 static const short packetTypes[] = {
   0x0305,  // Start A
@@ -67,6 +82,8 @@ static const short packetTypes[] = {
   0x5501,  // Set motion event (Sunshine protocol extension)
   0x5502,  // Set RGB LED (Sunshine protocol extension)
   0x5503,  // Set Adaptive triggers (Sunshine protocol extension)
+  0x5504,  // Cursor position (Sunshine protocol extension)
+  0x5505,  // Cursor shape (Sunshine protocol extension)
 };
 
 namespace asio = boost::asio;
@@ -212,6 +229,37 @@ namespace stream {
     SS_HDR_METADATA metadata;
   };
 
+  // Sunshine protocol extension
+  struct control_cursor_position_t {
+    control_header_v2 header;
+
+    std::uint8_t visible;
+
+    // The top left corner of the shape in a captured image of the given size
+    std::int32_t x;
+    std::int32_t y;
+    std::uint16_t image_width;
+    std::uint16_t image_height;
+
+    std::uint32_t shape_serial;
+  };
+
+  // Sunshine protocol extension, a shape is sent in chunks of rows
+  struct control_cursor_shape_t {
+    control_header_v2 header;
+
+    std::uint32_t serial;
+    std::uint16_t width;
+    std::uint16_t height;
+    std::uint16_t hot_x;
+    std::uint16_t hot_y;
+
+    std::uint16_t first_row;
+    std::uint16_t rows;
+
+    // rows * width * 4 bytes of BGRA premultiplied by alpha follow
+  };
+
   typedef struct control_encrypted_t {
     std::uint16_t encryptedHeaderType;  // Always LE 0x0001
     std::uint16_t length;  // sizeof(seq) + 16 byte tag + secondary header and data
@@ -233,12 +281,30 @@ namespace stream {
 
 #pragma pack(pop)
 
+  // PKCS #7 always pads, a whole block is added to a plaintext that is a multiple of the block size
   constexpr std::size_t round_to_pkcs7_padded(std::size_t size) {
-    return ((size + 15) / 16) * 16;
+    return (size / 16 + 1) * 16;
   }
 
   constexpr std::size_t MAX_AUDIO_PACKET_SIZE = 1400;
 
+  // The largest legacy input message decrypted, the input messages are much smaller than this
+  constexpr std::size_t MAX_INPUT_DATA_SIZE = 1024;
+
+  // The most pixel bytes in a message of a cursor shape, wider shapes aren't sent
+  constexpr std::size_t MAX_CURSOR_SHAPE_CHUNK_SIZE = 4096;
+
+  // Expedited Forwarding, marks IDR and recovery frames above the rest of the video (CS5)
+  // and below the audio (CS6)
+  constexpr std::uint8_t PRIORITY_VIDEO_DSCP = 46;
+
+  // The send buffer of a session's own video socket holds this much of the stream at its bitrate
+  constexpr auto VIDEO_SEND_BUFFER_WINDOW = 100ms;
+  constexpr int MIN_VIDEO_SEND_BUFFER_SIZE = 256 * 1024;
+
+  // The transmit timestamp ids of each session's own video socket start this far apart
+  constexpr std::uint32_t TX_ID_BASE_STRIDE = 1 << 24;
+
   using audio_aes_t = std::array<char, round_to_pkcs7_padded(MAX_AUDIO_PACKET_SIZE)>;
 
   using av_session_id_t = std::variant<asio::ip::address, std::string>;  // IP address or SS-Ping-Payload from RTSP handshake
@@ -283,6 +349,12 @@ namespace stream {
     // Therefore, iterate is implemented further down the source file
     void iterate(std::chrono::milliseconds timeout);
 
+    /**
+     * @brief Handle a single event of the ENet host.
+     * @param event The event.
+     */
+    void dispatch(ENetEvent &event);
+
     /**
      * @brief Call the handler for a given control stream message.
      * @param type The message type.
@@ -337,6 +409,17 @@ namespace stream {
     udp::socket video_sock {io_context};
     udp::socket audio_sock {io_context};
 
+    // Whether the kernel reports when the last packet of each frame leaves the host
+    bool video_tx_timestamps = false;
+    frame_trace::tx_ids_t video_tx_ids;
+
+    // Whether the sessions may bind sockets of their own to the video port
+    bool video_reuse_port = false;
+    std::atomic<std::uint32_t> next_tx_id_base {TX_ID_BASE_STRIDE};
+
+    // Whether the video packets are held by the kernel until they're due instead of sleeping until then
+    bool video_launch_time = false;
+
     control_server_t control_server;
   };
 
@@ -349,14 +432,21 @@ namespace stream {
 
     std::thread audioThread;
     std::thread videoThread;
-
-    std::chrono::steady_clock::time_point pingTimeout;
+    std::thread videoSendThread;
 
     safe::shared_t<broadcast_ctx_t>::ptr_t broadcast_ref;
 
     boost::asio::ip::address localAddress;
 
-    struct {
+    // The zero of the session's media clock, the RTP timestamps of its audio and video count from it
+    std::chrono::steady_clock::time_point media_epoch;
+
+    // Pushed back by the control server on every event of the session, away from the fields read by the other threads
+    alignas(64) std::chrono::steady_clock::time_point pingTimeout;
+
+    // The video, audio and control states are each written by their own threads,
+    // so they start on their own cache lines
+    struct alignas(64) {
       std::string ping_payload;
 
       int lowseq;
@@ -367,11 +457,34 @@ namespace stream {
 
       safe::mail_raw_t::event_t<bool> idr_events;
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+      safe::mail_raw_t::event_t<int> bitrate_events;
+
+      // Both the control thread and the video send thread ask for frames to be invalidated
+      std::mutex invalidate_ref_frames_lock;
+
+      // The frames too late to be worth sending, only used by the thread sending the session's video
+      pacing::deadline_t deadline;
+
+      // Frames waiting for this session's own send thread
+      // nullptr when frames are sent from the shared video broadcast thread
+      std::shared_ptr<safe::spsc_queue_t<video::packet_t>> packets;
+
+      // The session's own socket connected to the client, used by its send thread if it could be opened
+      std::optional<udp::socket> sock;
+      std::unique_ptr<frame_trace::tx_ids_t> tx_ids;
+
+      // The controllers are fed the loss reports by the control thread, so they don't share
+      // a cache line with the sequence numbers and counters written by the video threads
+      alignas(64) pacing::pacer_t pacer;
+      fec_policy::controller_t fec;
+
+      // Only used when the bitrate adapts to congestion
+      bitrate_control::controller_t bitrate;
 
       std::unique_ptr<platf::deinit_t> qos;
     } video;
 
-    struct {
+    struct alignas(64) {
       crypto::cipher::cbc_t cipher;
       std::string ping_payload;
 
@@ -381,14 +494,20 @@ namespace stream {
       std::uint32_t timestamp;
       udp::endpoint peer;
 
+      // The shards of a FEC block are allocated together, each one starting on a new cache line
       util::buffer_t<char> shards;
-      util::buffer_t<uint8_t *> shards_p;
+      std::array<uint8_t *, RTPA_TOTAL_SHARDS> shards_p;
 
-      audio_fec_packet_t fec_packet;
+      // Headers built once for the session, only the sequence numbers and timestamps change
+      audio_packet_t packet;
+      std::array<audio_fec_packet_t, RTPA_FEC_SHARDS> fec_packets;
       std::unique_ptr<platf::deinit_t> qos;
+
+      // Estimates of the share of packets lost, for the audio encoder
+      safe::mail_raw_t::event_t<int> loss_events;
     } audio;
 
-    struct {
+    struct alignas(64) {
       crypto::cipher::gcm_t cipher;
       crypto::aes_t legacy_input_enc_iv;  // Only used when the client doesn't support full control stream encryption
       crypto::aes_t incoming_iv;
@@ -402,10 +521,34 @@ namespace stream {
 
       platf::feedback_queue_t feedback_queue;
       safe::mail_raw_t::event_t<video::hdr_info_t> hdr_queue;
+
+      // The display the video of the session is captured from
+      safe::mail_raw_t::event_t<std::string> capture_display_queue;
+      std::string capture_display;
+
+      // Only the latest feedback of each kind for each gamepad is sent, at most once per frame
+      std::map<std::pair<std::uint16_t, platf::gamepad_feedback_e>, platf::gamepad_feedback_msg_t> pending_feedback;
+      std::chrono::steady_clock::time_point next_feedback_flush;
+
+      // The last cursor sent when it's left out of the video
+      std::uint64_t cursor_sequence {};
+      bool cursor_visible {};
+      std::uint32_t cursor_shape_serial {};
     } control;
 
     std::uint32_t launch_session_id;
 
+    // Exported on /metrics with the launch session id as label, each series is updated by a single thread
+    struct {
+      std::shared_ptr<metrics::counter_t> video_frames;
+      std::shared_ptr<metrics::counter_t> video_bytes;
+      std::shared_ptr<metrics::counter_t> video_frames_lost;
+      std::shared_ptr<metrics::counter_t> video_frames_late;
+      std::shared_ptr<metrics::gauge_t> fec_percentage;
+      std::shared_ptr<metrics::gauge_t> pacing_rate;
+      std::shared_ptr<metrics::counter_t> audio_packets;
+    } metric_series;
+
     safe::mail_raw_t::event_t<bool> shutdown_event;
     safe::signal_t controlEnd;
 
@@ -525,6 +668,14 @@ namespace stream {
       BOOST_LOG(debug) << "Control local address ["sv << local_address << ']';
       BOOST_LOG(debug) << "Control peer address ["sv << peer_addr << ':' << peer_port << ']';
 
+      // Pace the video against the link the client is reached through, unless a rate is configured
+      auto pacing_rate = config::stream.pacing_rate;
+      if (auto it = config::stream.client_pacing_rates.find(peer_addr); it != std::end(config::stream.client_pacing_rates)) {
+        pacing_rate = it->second;
+      }
+      session_p->video.pacer.reset(platf::get_link_speed(local_address), (std::uint64_t) pacing_rate * 1000 * 1000);
+      BOOST_LOG(debug) << "Video pacing rate ["sv << session_p->video.pacer.ceiling() / 1000 / 1000 << " Mbps]"sv;
+
       // Insert this into the map for O(1) lookups in the future
       auto ptslg = _peer_to_session.lock();
       _peer_to_session->emplace(peer, session_p);
@@ -564,41 +715,50 @@ namespace stream {
     ENetEvent event;
     auto res = enet_host_service(_host.get(), &event, timeout.count());
 
-    if (res > 0) {
-      auto session = get_session(event.peer, event.data);
-      if (!session) {
-        BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
-        enet_peer_disconnect_now(event.peer, 0);
+    // A single receive can queue the events of many datagrams. Dispatch all of them
+    // before returning to the housekeeping of the control thread, so a burst of input
+    // isn't held up by a pass over every session for each message.
+    while (res > 0) {
+      dispatch(event);
 
-        return;
-      }
+      res = enet_host_check_events(_host.get(), &event);
+    }
+  }
+
+  void control_server_t::dispatch(ENetEvent &event) {
+    auto session = get_session(event.peer, event.data);
+    if (!session) {
+      BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
+      enet_peer_disconnect_now(event.peer, 0);
 
-      session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      return;
+    }
 
-      switch (event.type) {
-        case ENET_EVENT_TYPE_RECEIVE:
-          {
-            net::packet_t packet {event.packet};
+    session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
 
-            auto type = *(std::uint16_t *) packet->data;
-            std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+    switch (event.type) {
+      case ENET_EVENT_TYPE_RECEIVE:
+        {
+          net::packet_t packet {event.packet};
 
-            call(type, session, payload, false);
-          }
-          break;
-        case ENET_EVENT_TYPE_CONNECT:
-          BOOST_LOG(info) << "CLIENT CONNECTED"sv;
-          break;
-        case ENET_EVENT_TYPE_DISCONNECT:
-          BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
-          // No more clients to send video data to ^_^
-          if (session->state == session::state_e::RUNNING) {
-            session::stop(*session);
-          }
-          break;
-        case ENET_EVENT_TYPE_NONE:
-          break;
-      }
+          auto type = *(std::uint16_t *) packet->data;
+          std::string_view payload {(char *) packet->data + sizeof(type), packet->dataLength - sizeof(type)};
+
+          call(type, session, payload, false);
+        }
+        break;
+      case ENET_EVENT_TYPE_CONNECT:
+        BOOST_LOG(info) << "CLIENT CONNECTED"sv;
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        BOOST_LOG(info) << "CLIENT DISCONNECTED"sv;
+        // No more clients to send video data to ^_^
+        if (session->state == session::state_e::RUNNING) {
+          session::stop(*session);
+        }
+        break;
+      case ENET_EVENT_TYPE_NONE:
+        break;
     }
   }
 
@@ -607,25 +767,59 @@ namespace stream {
       reed_solomon_release(rs);
     }>;
 
+    // The most helper threads sharing the Reed-Solomon encoding of a single FEC block
+    constexpr std::size_t MAX_ENCODE_WORKERS = 3;
+
+    // Smaller blocks are encoded faster than they can be handed to other threads
+    constexpr std::size_t PARALLEL_ENCODE_MIN_BYTES = 256 * 1024;
+
+    // Each thread gets at least this many bytes of every shard to encode
+    constexpr std::size_t PARALLEL_ENCODE_MIN_COLUMNS = 256;
+
+    /**
+     * @brief An encoded FEC block.
+     * @details Each shard is sent as a header record followed by its payload. The record
+     *          holds the optional encryption prefix and the packet header, which are kept
+     *          apart from the payload so data shards can point straight into the encoded
+     *          frame. All pointers remain valid until the next prepare() on the context.
+     */
     struct fec_t {
       size_t data_shards;
       size_t nr_shards;
       size_t percentage;
 
-      size_t blocksize;
       size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
+      size_t headersize;
+      size_t blocksize;
+      char *headers;
+      uint8_t **shards_p;
+      char *ciphertext;
 
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
+      std::vector<platf::buffer_descriptor_t> &payload_buffers;
 
+      /**
+       * @brief Get the payload of a shard as it's sent.
+       */
       char *data(size_t el) {
-        return (char *) shards_p[el];
+        return ciphertext ? &ciphertext[el * blocksize] : (char *) shards_p[el];
       }
 
+      /**
+       * @brief Get the header record of a shard, starting with its prefix.
+       */
       char *prefix(size_t el) {
-        return prefixsize ? &headers[el * prefixsize] : nullptr;
+        return &headers[el * recordsize()];
+      }
+
+      /**
+       * @brief Get the packet header of a shard, which is protected by FEC.
+       */
+      char *header(size_t el) {
+        return prefix(el) + prefixsize;
+      }
+
+      size_t recordsize() const {
+        return prefixsize + headersize;
       }
 
       size_t size() const {
@@ -633,13 +827,197 @@ namespace stream {
       }
     };
 
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
-      auto payload_size = payload.size();
+    /**
+     * @brief Reusable storage for FEC encoding.
+     * @details The buffers only ever grow, so once the largest frame of a stream has
+     *          been sent, later FEC blocks are encoded without any heap allocation.
+     *          Building the Reed-Solomon matrix is expensive as well, so the most
+     *          recently used contexts are cached by their shard counts.
+     */
+    class context_t {
+    public:
+      // Enough to cover the spread of frame sizes of a typical stream
+      static constexpr std::size_t MAX_CACHED_RS = 32;
+
+      context_t() {
+        _rs_cache.reserve(MAX_CACHED_RS);
+        _payload_buffers.reserve(8);
+      }
+
+      /**
+       * @brief Get a Reed-Solomon context for the given shard counts.
+       * @param data_shards The number of data shards.
+       * @param parity_shards The number of parity shards.
+       * @return The cached context, or nullptr if it couldn't be created.
+       */
+      reed_solomon *rs(size_t data_shards, size_t parity_shards) {
+        auto it = std::find_if(std::begin(_rs_cache), std::end(_rs_cache), [&](const cached_rs_t &cached) {
+          return cached.data_shards == data_shards && cached.parity_shards == parity_shards;
+        });
+
+        if (it == std::end(_rs_cache)) {
+          rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+          if (!rs) {
+            return nullptr;
+          }
+
+          // Evict the least recently used context
+          if (_rs_cache.size() == MAX_CACHED_RS) {
+            _rs_cache.pop_back();
+          }
+
+          _rs_cache.push_back(cached_rs_t {data_shards, parity_shards, std::move(rs)});
+          it = std::prev(std::end(_rs_cache));
+        }
+
+        // Keep the most recently used context in front
+        std::rotate(std::begin(_rs_cache), it, std::next(it));
+
+        return _rs_cache.front().rs.get();
+      }
+
+      /**
+       * @brief Get storage for the given number of shards and headers.
+       * @param shard_bytes The bytes needed for copied data shards and parity shards.
+       * @param nr_shards The total number of shards.
+       * @param header_bytes The bytes needed for the header records of the shards.
+       * @param ciphertext_bytes The bytes needed for the encrypted payloads.
+       */
+      void reserve(size_t shard_bytes, size_t nr_shards, size_t header_bytes, size_t ciphertext_bytes) {
+        grow(_shards, shard_bytes);
+        // Room for the payload pointers, the header pointers and the pointers
+        // into the payloads for each encode worker
+        grow(_shards_p, nr_shards * (2 + MAX_ENCODE_WORKERS));
+        grow(_headers, header_bytes);
+        grow(_ciphertext, ciphertext_bytes);
+      }
+
+      char *shards() {
+        return _shards.begin();
+      }
+
+      uint8_t **shards_p() {
+        return _shards_p.begin();
+      }
+
+      char *headers() {
+        return _headers.begin();
+      }
+
+      char *ciphertext() {
+        return _ciphertext.begin();
+      }
+
+      std::vector<platf::buffer_descriptor_t> &payload_buffers() {
+        return _payload_buffers;
+      }
+
+    private:
+      template<class T>
+      static void grow(util::buffer_t<T> &buffer, size_t elements) {
+        if (buffer.size() < elements) {
+          buffer = util::buffer_t<T> {elements};
+        }
+      }
+
+      struct cached_rs_t {
+        size_t data_shards;
+        size_t parity_shards;
+        rs_t rs;
+      };
+
+      std::vector<cached_rs_t> _rs_cache;
+
+      util::buffer_t<char> _shards;
+      util::buffer_t<uint8_t *> _shards_p;
+      util::buffer_t<char> _headers;
+      util::buffer_t<char> _ciphertext;
+      std::vector<platf::buffer_descriptor_t> _payload_buffers;
+    };
+  }  // namespace fec
+
+  /**
+   * @brief Find the data of consecutive fixed-size slices of a payload split across buffers.
+   * @details Slices that lie within a single segment point straight into that segment.
+   *          Slices spanning a segment boundary and the final short slice are copied into
+   *          the scratch buffer instead, zero-padded to the full slice size. As each of them
+   *          contains a boundary or the end of the payload, at most one slice per segment
+   *          is copied.
+   * @param segments The payload, in order.
+   * @param slice_size The number of bytes in each slice.
+   * @param first_slice The index of the first slice to find.
+   * @param slice_count The number of slices to find.
+   * @param slices Receives a pointer to the data of each slice.
+   * @param scratch Storage for copied slices, with room for `segments.size()` slices.
+   * @return The number of slices copied into the scratch buffer.
+   */
+  size_t gather_slices(std::span<const std::string_view> segments, size_t slice_size, size_t first_slice, size_t slice_count, uint8_t **slices, uint8_t *scratch) {
+    size_t copied = 0;
+
+    auto segment = std::begin(segments);
+    size_t segment_start = 0;
+
+    for (size_t x = 0; x < slice_count; ++x) {
+      auto offset = (first_slice + x) * slice_size;
+
+      // Skip to the segment holding the start of this slice
+      while (segment != std::end(segments) && segment_start + segment->size() <= offset) {
+        segment_start += segment->size();
+        ++segment;
+      }
+
+      if (segment != std::end(segments) && offset + slice_size <= segment_start + segment->size()) {
+        slices[x] = (uint8_t *) segment->data() + (offset - segment_start);
+        continue;
+      }
+
+      auto dest = scratch + copied++ * slice_size;
+      slices[x] = dest;
+
+      // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
+      // and ends up compiling a horribly slow element-by-element copy loop, so we
+      // help it by using memcpy()/memset() directly.
+      size_t filled = 0;
+      auto next = segment;
+      auto next_start = segment_start;
+      for (; filled < slice_size && next != std::end(segments); ++next) {
+        auto copy_offset = offset + filled - next_start;
+        auto copy_len = std::min(slice_size - filled, next->size() - copy_offset);
+        if (copy_len) {
+          std::memcpy(dest + filled, next->data() + copy_offset, copy_len);
+        }
+
+        filled += copy_len;
+        next_start += next->size();
+      }
+
+      // Zero any additional space after the end of the payload
+      if (filled < slice_size) {
+        std::memset(dest + filled, 0, slice_size - filled);
+      }
+    }
 
-      auto pad = payload_size % blocksize != 0;
+    return copied;
+  }
 
-      auto aligned_data_shards = payload_size / blocksize;
-      auto data_shards = aligned_data_shards + (pad ? 1 : 0);
+  namespace fec {
+    /**
+     * @brief Lay out the shards of a FEC block over a payload split across buffers.
+     * @details The data shard payloads point into the payload itself wherever possible,
+     *          and the header records of all shards are zeroed. The caller fills in the
+     *          data shard headers before calling encode_headers().
+     * @param ctx The storage to use for the block.
+     * @param segments The payload of the whole frame, in order.
+     * @param first_shard The index of the first data shard of this block within the frame.
+     * @param data_shards The number of data shards in this block.
+     * @param blocksize The payload size of each shard.
+     * @param headersize The size of the packet header of each shard, which is protected by FEC.
+     * @param prefixsize The size of the encryption prefix before each header, or 0 if unencrypted.
+     * @param fecpercentage The requested percentage of parity shards.
+     * @param minparityshards The minimum number of parity shards.
+     * @return The block.
+     */
+    static fec_t prepare(context_t &ctx, std::span<const std::string_view> segments, size_t first_shard, size_t data_shards, size_t blocksize, size_t headersize, size_t prefixsize, size_t fecpercentage, size_t minparityshards) {
       auto parity_shards = (data_shards * fecpercentage + 99) / 100;
 
       // increase the FEC percentage for this frame if the parity shard minimum is not met
@@ -647,132 +1025,160 @@ namespace stream {
         parity_shards = minparityshards;
         fecpercentage = (100 * parity_shards) / data_shards;
 
-        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+        SUNSHINE_HOT_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
       }
 
       auto nr_shards = data_shards + parity_shards;
+      auto recordsize = prefixsize + headersize;
 
-      // If we need to store a zero-padded data shard, allocate that first to
-      // to keep the shards in order and reduce buffer fragmentation
-      auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
-
-      // Point into the payload buffer for all except the final padded data shard
-      auto next = std::begin(payload);
-      for (auto x = 0; x < aligned_data_shards; ++x) {
-        shards_p[x] = (uint8_t *) next;
-        next += blocksize;
-      }
-      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
-
-      // If the last data shard needs to be zero-padded, we must use the shards buffer
-      if (pad) {
-        shards_p[aligned_data_shards] = (uint8_t *) &shards[0];
-
-        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
-        // and ends up compiling a horribly slow element-by-element copy loop, so we
-        // help it by using memcpy()/memset() directly.
-        auto copy_len = std::min<size_t>(blocksize, std::end(payload) - next);
-        std::memcpy(shards_p[aligned_data_shards], next, copy_len);
-        if (copy_len < blocksize) {
-          // Zero any additional space after the end of the payload
-          std::memset(shards_p[aligned_data_shards] + copy_len, 0, blocksize - copy_len);
-        }
-      }
+      // Copied data shards come first to keep the shards in order
+      auto max_copied_shards = std::min(data_shards, segments.size());
+      ctx.reserve((max_copied_shards + parity_shards) * blocksize, nr_shards, nr_shards * recordsize, prefixsize ? nr_shards * blocksize : 0);
 
-      // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
+      auto shards = ctx.shards();
+      auto shards_p = ctx.shards_p();
+      std::memset(ctx.headers(), 0, nr_shards * recordsize);
 
-      if (fecpercentage != 0) {
-        // Point into our allocated buffer for the parity shards
-        for (auto x = 0; x < parity_shards; ++x) {
-          shards_p[data_shards + x] = (uint8_t *) &shards[(parity_shard_offset + x) * blocksize];
-        }
+      auto copied_shards = gather_slices(segments, blocksize, first_shard, data_shards, shards_p, (uint8_t *) shards);
 
-        // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+      // Point into our allocated buffer for the parity shards
+      for (auto x = 0; x < parity_shards; ++x) {
+        shards_p[data_shards + x] = (uint8_t *) &shards[(copied_shards + x) * blocksize];
+      }
+
+      auto &payload_buffers = ctx.payload_buffers();
+      payload_buffers.clear();
 
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+      char *ciphertext = nullptr;
+      if (prefixsize) {
+        // Encrypted payloads are written to a single buffer
+        ciphertext = ctx.ciphertext();
+        payload_buffers.emplace_back(ciphertext, nr_shards * blocksize);
+      } else {
+        // Describe the payloads, merging runs of shards that are contiguous in memory
+        for (auto x = 0; x < nr_shards; ++x) {
+          auto payload = (const char *) shards_p[x];
+          if (!payload_buffers.empty() && payload_buffers.back().buffer + payload_buffers.back().size == payload) {
+            payload_buffers.back().size += blocksize;
+          } else {
+            payload_buffers.emplace_back(payload, blocksize);
+          }
+        }
       }
 
       return {
         data_shards,
         nr_shards,
         fecpercentage,
-        blocksize,
         prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
+        headersize,
+        blocksize,
+        ctx.headers(),
+        shards_p,
+        ciphertext,
+        payload_buffers,
       };
     }
-  }  // namespace fec
 
-  /**
-   * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
-   * @param insert_size The number of bytes to insert.
-   * @param slice_size The number of bytes between insertions.
-   * @param data1 The first data buffer.
-   * @param data2 The second data buffer.
-   */
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2) {
-    auto data_size = data1.size() + data2.size();
-    auto pad = data_size % slice_size != 0;
-    auto elements = data_size / slice_size + (pad ? 1 : 0);
-
-    std::vector<uint8_t> result;
-    result.resize(elements * insert_size + data_size);
-
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
-    for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
-
-      // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
-      }
-
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
-
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
-      }
+    /**
+     * @brief Get the number of helper threads for encoding large FEC blocks.
+     * @return The number of threads, or 0 if there are no cores to spare.
+     */
+    static std::size_t encode_workers() {
+      static const std::size_t workers = std::min<std::size_t>(MAX_ENCODE_WORKERS, std::thread::hardware_concurrency() / 2);
+      return workers;
     }
 
-    return result;
-  }
+    /**
+     * @brief Get the threads shared by all senders for encoding large FEC blocks.
+     */
+    static thread_pool_util::ThreadPool &encode_pool() {
+      static thread_pool_util::ThreadPool pool {(int) encode_workers()};
+      return pool;
+    }
+
+    /**
+     * @brief Protect the packet headers of a block laid out by prepare().
+     * @details Reed-Solomon treats every byte offset of the shards independently, so the
+     *          headers and the payloads can be protected in two passes without ever
+     *          gathering them into contiguous shards. The header pass is cheap, and once it's
+     *          done the data shards are final and can be sent before the payload pass.
+     * @param ctx The storage the block was prepared with.
+     * @param shards The block.
+     */
+    static void encode_headers(context_t &ctx, fec_t &shards) {
+      if (shards.percentage == 0) {
+        return;
+      }
 
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+      // packets = parity_shards + data_shards
+      auto rs = ctx.rs(shards.data_shards, shards.nr_shards - shards.data_shards);
+      if (!rs) {
+        throw std::runtime_error("Couldn't create Reed-Solomon context");
+      }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+      auto headers_p = shards.shards_p + shards.nr_shards;
+      for (auto x = 0; x < shards.nr_shards; ++x) {
+        headers_p[x] = (uint8_t *) shards.header(x);
+      }
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+      reed_solomon_encode(rs, headers_p, shards.nr_shards, shards.headersize);
     }
 
-    return replaced;
-  }
+    /**
+     * @brief Compute the parity shard payloads of a block whose headers were protected.
+     * @param ctx The storage the block was prepared with.
+     * @param shards The block.
+     */
+    static void encode_payloads(context_t &ctx, fec_t &shards) {
+      if (shards.percentage == 0) {
+        return;
+      }
+
+      // Cached by encode_headers()
+      auto rs = ctx.rs(shards.data_shards, shards.nr_shards - shards.data_shards);
+      if (!rs) {
+        throw std::runtime_error("Couldn't create Reed-Solomon context");
+      }
+
+      auto headers_p = shards.shards_p + shards.nr_shards;
+
+      // Large blocks can be split into ranges of columns
+      // encoded by separate threads, with a bit-identical result.
+      auto workers = encode_workers();
+      std::size_t ranges = 1;
+      if (workers && shards.nr_shards * shards.blocksize >= PARALLEL_ENCODE_MIN_BYTES) {
+        ranges = std::min(workers + 1, shards.blocksize / PARALLEL_ENCODE_MIN_COLUMNS);
+      }
+
+      if (ranges <= 1) {
+        reed_solomon_encode(rs, shards.shards_p, shards.nr_shards, shards.blocksize);
+        return;
+      }
+
+      // Keep the ranges to whole cache lines
+      auto range_size = ((shards.blocksize / ranges + 63) / 64) * 64;
+      ranges = (shards.blocksize + range_size - 1) / range_size;
+
+      std::array<std::future<int>, MAX_ENCODE_WORKERS> results;
+      for (std::size_t range = 1; range < ranges; ++range) {
+        auto offset = range * range_size;
+        auto range_p = headers_p + range * shards.nr_shards;
+        for (auto x = 0; x < shards.nr_shards; ++x) {
+          range_p[x] = shards.shards_p[x] + offset;
+        }
+
+        results[range - 1] = encode_pool().push(reed_solomon_encode, rs, range_p, (int) shards.nr_shards, (int) std::min(range_size, shards.blocksize - offset));
+      }
+
+      // The first range is encoded on this thread
+      reed_solomon_encode(rs, shards.shards_p, shards.nr_shards, range_size);
+
+      for (std::size_t range = 1; range < ranges; ++range) {
+        results[range - 1].get();
+      }
+    }
+  }  // namespace fec
 
   /**
    * @brief Pass gamepad feedback data back to the client.
@@ -885,6 +1291,21 @@ namespace stream {
     return 0;
   }
 
+  /**
+   * @brief Ask the encoder to stop referencing a range of frames.
+   * @details The event holds a single range, the one the encoder didn't take yet is merged in rather than replaced.
+   * @param session The session.
+   * @param frames The first and last frames of the range.
+   */
+  void invalidate_ref_frames(session_t *session, std::pair<std::int64_t, std::int64_t> frames) {
+    std::lock_guard lg {session->video.invalidate_ref_frames_lock};
+
+    if (auto pending = session->video.invalidate_ref_frames_events->pop(0ms)) {
+      frames = video::merge_invalidated_frames(*pending, frames);
+    }
+    session->video.invalidate_ref_frames_events->raise(frames);
+  }
+
   int send_hdr_mode(session_t *session, video::hdr_info_t hdr_info) {
     if (!session->control.peer) {
       BOOST_LOG(warning) << "Couldn't send HDR mode, still waiting for PING from Moonlight"sv;
@@ -914,9 +1335,87 @@ namespace stream {
     return 0;
   }
 
+  int send_cursor_shape(session_t *session, const platf::cursor_shape_t &shape) {
+    auto row_size = (std::size_t) shape.width * 4;
+    if (!row_size || row_size > MAX_CURSOR_SHAPE_CHUNK_SIZE || shape.height > std::numeric_limits<std::uint16_t>::max()) {
+      BOOST_LOG(warning) << "Cursor shape of "sv << shape.width << 'x' << shape.height << " is too large to send"sv;
+      return -1;
+    }
+
+    auto rows_per_chunk = (int) (MAX_CURSOR_SHAPE_CHUNK_SIZE / row_size);
+    for (int first_row = 0; first_row < shape.height; first_row += rows_per_chunk) {
+      auto rows = std::min(rows_per_chunk, shape.height - first_row);
+
+      std::array<std::uint8_t, sizeof(control_cursor_shape_t) + MAX_CURSOR_SHAPE_CHUNK_SIZE> plaintext_buffer;
+      auto plaintext = (control_cursor_shape_t *) plaintext_buffer.data();
+      auto plaintext_size = sizeof(control_cursor_shape_t) + rows * row_size;
+
+      plaintext->header.type = packetTypes[IDX_CURSOR_SHAPE];
+      plaintext->header.payloadLength = plaintext_size - sizeof(control_header_v2);
+      plaintext->serial = shape.serial;
+      plaintext->width = shape.width;
+      plaintext->height = shape.height;
+      plaintext->hot_x = shape.hot_x;
+      plaintext->hot_y = shape.hot_y;
+      plaintext->first_row = first_row;
+      plaintext->rows = rows;
+      std::copy_n(shape.pixels.data() + first_row * row_size, rows * row_size, plaintext_buffer.data() + sizeof(control_cursor_shape_t));
+
+      std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext_buffer)) + crypto::cipher::tag_size>
+        encrypted_payload;
+
+      auto payload = encode_control(session, util::view(plaintext_buffer.data(), plaintext_buffer.data() + plaintext_size), encrypted_payload);
+      if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+        TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
+        BOOST_LOG(warning) << "Couldn't send cursor shape to ["sv << addr << ':' << port << ']';
+
+        return -1;
+      }
+    }
+
+    return 0;
+  }
+
+  int send_cursor(session_t *session, const video::cursor_t &cursor, bool visible) {
+    auto &shape = cursor.state.shape;
+    if (shape && shape->serial != session->control.cursor_shape_serial) {
+      if (send_cursor_shape(session, *shape)) {
+        return -1;
+      }
+
+      session->control.cursor_shape_serial = shape->serial;
+    }
+
+    control_cursor_position_t plaintext {};
+    plaintext.header.type = packetTypes[IDX_CURSOR_POSITION];
+    plaintext.header.payloadLength = sizeof(control_cursor_position_t) - sizeof(control_header_v2);
+
+    plaintext.visible = visible && shape;
+    plaintext.x = cursor.state.x;
+    plaintext.y = cursor.state.y;
+    plaintext.image_width = cursor.image_width;
+    plaintext.image_height = cursor.image_height;
+    plaintext.shape_serial = shape ? shape->serial : 0;
+
+    std::array<std::uint8_t, sizeof(control_encrypted_t) + crypto::cipher::round_to_pkcs7_padded(sizeof(plaintext)) + crypto::cipher::tag_size>
+      encrypted_payload;
+
+    auto payload = encode_control(session, util::view(plaintext), encrypted_payload);
+    if (session->broadcast_ref->control_server.send(payload, session->control.peer)) {
+      TUPLE_2D(port, addr, platf::from_sockaddr_ex((sockaddr *) &session->control.peer->address.address));
+      BOOST_LOG(warning) << "Couldn't send cursor position to ["sv << addr << ':' << port << ']';
+
+      return -1;
+    }
+
+    session->control.cursor_sequence = cursor.sequence;
+    session->control.cursor_visible = visible;
+    return 0;
+  }
+
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
+      SUNSHINE_HOT_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
     });
 
     server->map(packetTypes[IDX_START_A], [&](session_t *session, const std::string_view &payload) {
@@ -934,13 +1433,27 @@ namespace stream {
 
       auto lastGoodFrame = stats[3];
 
-      BOOST_LOG(verbose)
+      SUNSHINE_HOT_LOG(verbose)
         << "type [IDX_LOSS_STATS]"sv << std::endl
         << "---begin stats---" << std::endl
         << "loss count since last report [" << count << ']' << std::endl
         << "time in milli since last report [" << t.count() << ']' << std::endl
         << "last good frame [" << lastGoodFrame << ']' << std::endl
         << "---end stats---";
+
+      if (count > 0) {
+        session->metric_series.video_frames_lost->increment(count);
+      }
+
+      session->video.pacer.report_loss(count);
+      session->video.fec.report_loss(count);
+      session->video.bitrate.report_loss(count, std::chrono::steady_clock::now());
+
+      // Audio takes the same path, so the share of lost frames is a hint for the Opus encoder
+      if (t.count() > 0) {
+        auto expected_frames = std::max<std::int64_t>(t.count() * session->config.monitor.framerate / 1000, 1);
+        session->audio.loss_events->raise((int) std::clamp<std::int64_t>(count * 100 / expected_frames, 0, 100));
+      }
     });
 
     server->map(packetTypes[IDX_REQUEST_IDR_FRAME], [&](session_t *session, const std::string_view &payload) {
@@ -959,20 +1472,52 @@ namespace stream {
         << "firstFrame [" << firstFrame << ']' << std::endl
         << "lastFrame [" << lastFrame << ']';
 
-      session->video.invalidate_ref_frames_events->raise(std::make_pair(firstFrame, lastFrame));
+      session->video.fec.report_invalidation();
+      session->video.bitrate.report_invalidation(std::chrono::steady_clock::now());
+      invalidate_ref_frames(session, {firstFrame, lastFrame});
     });
 
+    // The messages are decrypted into buffers reused by every message, they're only accessed on this thread.
+    // They're allocated once for the longest messages, the length of encrypted ones being 16 bits, and
+    // the input messages are copied from them straight into the input queue of the session.
+    std::vector<uint8_t> input_plaintext(crypto::cipher::round_to_pkcs7_padded(MAX_INPUT_DATA_SIZE));
+    std::vector<uint8_t> encrypted_plaintext(crypto::cipher::round_to_pkcs7_padded(std::numeric_limits<std::uint16_t>::max()));
+
+    // The input messages are recorded as decrypted, to be replayed by `sunshine replay-input`
+    std::optional<input_capture::writer_t> input_recorder;
+    if (!config::input.input_capture.empty()) {
+      input_recorder.emplace(config::input.input_capture);
+      BOOST_LOG(warning) << "Recording the input messages to ["sv << config::input.input_capture << "], the file holds everything typed by the clients"sv;
+    }
+
+    auto passthrough = [&input_recorder](session_t *session, std::span<const std::uint8_t> message) {
+      if (input_recorder && *input_recorder) {
+        input_recorder->write(message, session->config.monitor.width, session->config.monitor.height, std::chrono::steady_clock::now());
+      }
+
+      input::passthrough(session->input, message);
+    };
+
     server->map(packetTypes[IDX_INPUT_DATA], [&](session_t *session, const std::string_view &payload) {
       BOOST_LOG(debug) << "type [IDX_INPUT_DATA]"sv;
 
+      if (payload.size() < sizeof(int32_t)) {
+        BOOST_LOG(warning) << "Control: Runt packet"sv;
+        return;
+      }
+
       auto tagged_cipher_length = util::endian::big(*(int32_t *) payload.data());
+      if (tagged_cipher_length < (int32_t) crypto::cipher::tag_size || (size_t) tagged_cipher_length > payload.size() - sizeof(tagged_cipher_length) ||
+          (size_t) tagged_cipher_length > crypto::cipher::tag_size + MAX_INPUT_DATA_SIZE) {
+        BOOST_LOG(warning) << "Control: Dropping input data of "sv << tagged_cipher_length << " bytes"sv;
+        return;
+      }
       std::string_view tagged_cipher {payload.data() + sizeof(tagged_cipher_length), (size_t) tagged_cipher_length};
 
-      std::vector<uint8_t> plaintext;
-
       auto &cipher = session->control.cipher;
       auto &iv = session->control.legacy_input_enc_iv;
-      if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+      auto plaintext_size = cipher.decrypt(tagged_cipher, input_plaintext.data(), &iv);
+      if (plaintext_size < 0) {
         // something went wrong :(
 
         BOOST_LOG(error) << "Failed to verify tag"sv;
@@ -985,11 +1530,11 @@ namespace stream {
         std::copy(payload.end() - 16, payload.end(), std::begin(iv));
       }
 
-      input::passthrough(session->input, std::move(plaintext));
+      passthrough(session, std::span {input_plaintext}.first((std::size_t) plaintext_size));
     });
 
-    server->map(packetTypes[IDX_ENCRYPTED], [server](session_t *session, const std::string_view &payload) {
-      BOOST_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
+    server->map(packetTypes[IDX_ENCRYPTED], [server, &encrypted_plaintext, &passthrough](session_t *session, const std::string_view &payload) {
+      SUNSHINE_HOT_LOG(verbose) << "type [IDX_ENCRYPTED]"sv;
 
       auto header = (control_encrypted_p) (payload.data() - 2);
 
@@ -1026,8 +1571,8 @@ namespace stream {
         iv[0] = (std::uint8_t) seq;
       }
 
-      std::vector<uint8_t> plaintext;
-      if (cipher.decrypt(tagged_cipher, plaintext, &iv)) {
+      auto plaintext_size = cipher.decrypt(tagged_cipher, encrypted_plaintext.data(), &iv);
+      if (plaintext_size < 0) {
         // something went wrong :(
 
         BOOST_LOG(error) << "Failed to verify tag"sv;
@@ -1035,6 +1580,7 @@ namespace stream {
         session::stop(*session);
         return;
       }
+      auto plaintext = std::span {encrypted_plaintext}.first((std::size_t) plaintext_size);
 
       auto type = *(std::uint16_t *) plaintext.data();
       std::string_view next_payload {(char *) plaintext.data() + 4, plaintext.size() - 4};
@@ -1047,8 +1593,7 @@ namespace stream {
 
       // IDX_INPUT_DATA callback will attempt to decrypt unencrypted data, therefore we need pass it directly
       if (type == packetTypes[IDX_INPUT_DATA]) {
-        plaintext.erase(std::begin(plaintext), std::begin(plaintext) + 4);
-        input::passthrough(session->input, std::move(plaintext));
+        passthrough(session, std::span {plaintext}.subspan(4));
       } else {
         server->call(type, session, next_payload, true);
       }
@@ -1056,6 +1601,8 @@ namespace stream {
 
     // This thread handles latency-sensitive control messages
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin(thread_affinity::role_e::control);
+    timeline::set_thread_name("control");
 
     // Check for both the full shutdown event and the shutdown event for this
     // broadcast to ensure we can inform connected clients of our graceful
@@ -1065,6 +1612,9 @@ namespace stream {
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
+      // Wake up in time for the next flush of coalesced gamepad feedback
+      auto service_timeout = 150ms;
+
       {
         auto lg = server->_sessions.lock();
 
@@ -1107,10 +1657,36 @@ namespace stream {
             has_session_awaiting_peer = true;
           } else {
             auto &feedback_queue = session->control.feedback_queue;
+            auto &pending_feedback = session->control.pending_feedback;
             while (feedback_queue->peek()) {
               auto feedback_msg = feedback_queue->pop();
 
-              send_feedback_msg(session, *feedback_msg);
+              // Games may update rumble, trigger and LED state every frame, each update supersedes the last
+              switch (feedback_msg->type) {
+                case platf::gamepad_feedback_e::rumble:
+                case platf::gamepad_feedback_e::rumble_triggers:
+                case platf::gamepad_feedback_e::set_rgb_led:
+                case platf::gamepad_feedback_e::set_adaptive_triggers:
+                  pending_feedback.insert_or_assign(std::make_pair(feedback_msg->id, feedback_msg->type), *feedback_msg);
+                  break;
+                default:
+                  send_feedback_msg(session, *feedback_msg);
+                  break;
+              }
+            }
+
+            if (!pending_feedback.empty()) {
+              auto &next_flush = session->control.next_feedback_flush;
+              if (now >= next_flush) {
+                for (auto &[key, feedback_msg] : pending_feedback) {
+                  send_feedback_msg(session, feedback_msg);
+                }
+                pending_feedback.clear();
+
+                next_flush = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(1s) / std::max(session->config.monitor.framerate, 1);
+              } else {
+                service_timeout = std::min(service_timeout, std::chrono::ceil<std::chrono::milliseconds>(next_flush - now));
+              }
             }
 
             auto &hdr_queue = session->control.hdr_queue;
@@ -1119,19 +1695,45 @@ namespace stream {
 
               send_hdr_mode(session, std::move(hdr_info));
             }
-          }
 
-          ++pos;
-        })
-      }
+            // The cursor left out of the video is sent on every change, checked at the frame rate
+            if (config::video.cursor_out_of_band) {
+              auto &capture_display_queue = session->control.capture_display_queue;
+              while (capture_display_queue->peek()) {
+                session->control.capture_display = *capture_display_queue->pop();
+              }
 
-      // Don't break until any pending sessions either expire or connect
-      if (proc::proc.running() == 0 && !has_session_awaiting_peer) {
+              if (auto cursor = video::latest_cursor(session->control.capture_display)) {
+                auto visible = cursor->state.visible && display_cursor;
+                if (cursor->sequence != session->control.cursor_sequence || visible != session->control.cursor_visible) {
+                  send_cursor(session, *cursor, visible);
+                }
+              }
+
+              auto frame_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(1s) / std::max(session->config.monitor.framerate, 1);
+              service_timeout = std::min(service_timeout, std::chrono::ceil<std::chrono::milliseconds>(frame_time));
+            }
+
+            if (config::stream.adaptive_bitrate && session->control.peer) {
+              auto &bitrate = session->video.bitrate;
+              bitrate.report_rtt(std::chrono::milliseconds {session->control.peer->roundTripTime}, now);
+              if (auto new_bitrate = bitrate.update(now)) {
+                session->video.bitrate_events->raise(*new_bitrate);
+              }
+            }
+          }
+
+          ++pos;
+        })
+      }
+
+      // Don't break until any pending sessions either expire or connect
+      if (proc::proc.running() == 0 && !has_session_awaiting_peer) {
         BOOST_LOG(info) << "Process terminated"sv;
         break;
       }
 
-      server->iterate(150ms);
+      server->iterate(service_timeout);
     }
 
     // Let all remaining connections know the server is shutting down
@@ -1179,10 +1781,23 @@ namespace stream {
 
     auto &io = ctx.io_context;
 
-    udp::endpoint peer;
+    // Pings are tiny, but leave room for other client feedback
+    constexpr std::size_t RECV_BUFFER_SIZE = 2048;
+    constexpr std::size_t RECV_BATCH_SIZE = 16;
+
+    struct recv_state_t {
+      std::vector<char> buffers;
+      std::array<platf::recv_datagram_t, RECV_BATCH_SIZE> datagrams;
+    } recv_state[2];
 
-    std::array<char, 2048> buf[2];
-    std::function<void(const boost::system::error_code, size_t)> recv_func[2];
+    for (auto &state : recv_state) {
+      state.buffers.resize(RECV_BUFFER_SIZE * RECV_BATCH_SIZE);
+      for (std::size_t x = 0; x < RECV_BATCH_SIZE; ++x) {
+        state.datagrams[x].buffer = &state.buffers[x * RECV_BUFFER_SIZE];
+      }
+    }
+
+    std::function<void(const boost::system::error_code)> recv_func[2];
 
     auto populate_peer_to_session = [&]() {
       while (message_queue_queue->peek()) {
@@ -1208,42 +1823,100 @@ namespace stream {
       }
     };
 
-    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
-      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec, size_t bytes) {
-        auto fg = util::fail_guard([&]() {
-          sock.async_receive_from(asio::buffer(buf[buf_elem]), peer, 0, recv_func[buf_elem]);
-        });
+    // Receive everything waiting on the socket, in a single system call where possible
+    auto receive_datagrams = [&](udp::socket &sock, recv_state_t &state) -> std::size_t {
+      auto received = platf::recv_batch((uintptr_t) sock.native_handle(), state.datagrams.data(), state.datagrams.size(), RECV_BUFFER_SIZE);
+      if (received >= 0) {
+        return received;
+      }
 
-        auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+      // Batched receive is not available, so receive each datagram individually
+      std::size_t count = 0;
+      for (; count < state.datagrams.size(); ++count) {
+        auto &datagram = state.datagrams[count];
 
-        populate_peer_to_session();
+        boost::system::error_code ec;
+        if (!sock.available(ec) || ec) {
+          break;
+        }
+
+        udp::endpoint peer;
+        auto bytes = sock.receive_from(asio::buffer(datagram.buffer, RECV_BUFFER_SIZE), peer, 0, ec);
 
         // No data, yet no error
         if (ec == boost::system::errc::connection_refused || ec == boost::system::errc::connection_reset) {
-          return;
+          continue;
         }
 
-        if (ec || !bytes) {
+        if (ec) {
           BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << ec.message();
+          break;
+        }
+
+        datagram.size = bytes;
+        datagram.address_size = peer.size();
+        std::memcpy(datagram.address.data(), peer.data(), peer.size());
+      }
+
+      return count;
+    };
+
+    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
+      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec) {
+        auto fg = util::fail_guard([&]() {
+          sock.async_wait(udp::socket::wait_read, recv_func[buf_elem]);
+        });
+
+        if (ec) {
+          BOOST_LOG(error) << "Couldn't wait for data from udp socket: "sv << ec.message();
+          return;
+        }
+
+        // Transmit timestamps are queued on the video socket and wake this thread as well
+        if (buf_elem == 0 && ctx.video_tx_timestamps) {
+          platf::read_tx_timestamps((uintptr_t) sock.native_handle(), frame_trace::tx_complete);
+        }
+
+        auto &state = recv_state[buf_elem];
+        auto count = receive_datagrams(sock, state);
+        if (!count) {
           return;
         }
 
-        if (bytes == 4) {
-          // For legacy PING packets, find the matching session by address.
-          auto it = peer_to_session.find(peer.address());
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+        // Pick up session changes once for the whole batch
+        populate_peer_to_session();
+
+        auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
+        for (std::size_t x = 0; x < count; ++x) {
+          auto &datagram = state.datagrams[x];
+          auto bytes = datagram.size;
+
+          udp::endpoint peer;
+          std::memcpy(peer.data(), datagram.address.data(), datagram.address_size);
+          peer.resize(datagram.address_size);
+
+          SUNSHINE_HOT_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+
+          if (!bytes) {
+            continue;
           }
-        } else if (bytes >= sizeof(SS_PING)) {
-          auto ping = (PSS_PING) buf[buf_elem].data();
-
-          // For new PING packets that include a client identifier, search by payload.
-          auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+
+          if (bytes == 4) {
+            // For legacy PING packets, find the matching session by address.
+            auto it = peer_to_session.find(peer.address());
+            if (it != std::end(peer_to_session)) {
+              BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+              it->second->raise(peer, std::string {datagram.buffer, bytes});
+            }
+          } else if (bytes >= sizeof(SS_PING)) {
+            auto ping = (PSS_PING) datagram.buffer;
+
+            // For new PING packets that include a client identifier, search by payload.
+            auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
+            if (it != std::end(peer_to_session)) {
+              BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+              it->second->raise(peer, std::string {datagram.buffer, bytes});
+            }
           }
         }
       };
@@ -1252,343 +1925,663 @@ namespace stream {
     recv_func_init(video_sock, 0, peer_to_video_session);
     recv_func_init(audio_sock, 1, peer_to_audio_session);
 
-    video_sock.async_receive_from(asio::buffer(buf[0]), peer, 0, recv_func[0]);
-    audio_sock.async_receive_from(asio::buffer(buf[1]), peer, 0, recv_func[1]);
+    video_sock.async_wait(udp::socket::wait_read, recv_func[0]);
+    audio_sock.async_wait(udp::socket::wait_read, recv_func[1]);
 
     while (!broadcast_shutdown_event->peek()) {
       io.run();
     }
   }
 
-  void videoBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
-    auto video_epoch = std::chrono::steady_clock::now();
+  /**
+   * @brief Per-sender state of the video send path.
+   * @details Pacing, the encryption batch, the timer and the network latency loggers
+   *          belong to the thread sending the frames. This lets several send threads
+   *          run side by side without sharing anything but the socket. Each sender also
+   *          has a helper thread building the FEC blocks of large frames ahead of time.
+   */
+  struct video_sender_t {
+    video_sender_t():
+        ratecontrol_next_frame_start {std::chrono::steady_clock::now()},
+        timer {platf::create_hybrid_timer()},
+        frame_processing_latency_logger {debug, "Frame processing latency", "ms"},
+        frame_send_batch_latency_logger {debug, "Network: each send_batch() latency"},
+        frame_fec_latency_logger {debug, "Network: each FEC block latency"},
+        frame_network_latency_logger {debug, "Network: frame's overall network latency"},
+        pacing_rate_logger {debug, "Network: video pacing rate", "Mbps"},
+        fec_percentage_logger {debug, "Network: FEC percentage", "%"},
+        helper {1} {
+      frame_processing_latency_logger.export_to(metrics::summary("sunshine_video_frame_processing_seconds", "Time from the capture of a frame to its packetization"), 1. / 1000);
+      frame_send_batch_latency_logger.export_to(metrics::summary("sunshine_video_send_batch_seconds", "Time to send each batch of video packets"));
+      frame_fec_latency_logger.export_to(metrics::summary("sunshine_video_fec_block_seconds", "Time to protect and encrypt each FEC block of a frame"));
+      frame_network_latency_logger.export_to(metrics::summary("sunshine_video_frame_send_seconds", "Time to packetize and send each frame"));
+      encode_latency = metrics::summary("sunshine_video_encode_seconds", "Time to encode each frame");
+      encoder_duration = metrics::summary("sunshine_video_encoder_frame_seconds", "Time the encoder spent on each frame, as it reports it");
+      encoded_frame_bytes = metrics::summary("sunshine_video_encoded_frame_bytes", "Size of each encoded frame");
+      frame_qp = metrics::summary("sunshine_video_frame_qp", "Average QP of each encoded frame, if the encoder reports it");
+      for (std::size_t x = 0; x < encoded_frames.size(); ++x) {
+        auto type = video::frame_type_name((video::frame_type_e) x);
+        encoded_frames[x] = metrics::counter("sunshine_video_encoded_frames_total", "Encoded frames by picture type", {{"type", std::string {type}}});
+      }
 
-    // Video traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+      helper.push([]() {
+        platf::adjust_thread_priority(platf::thread_priority_e::high);
+        thread_affinity::pin(thread_affinity::role_e::video_send);
+        timeline::set_thread_name("video_fec");
+      });
+    }
 
-    logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
+    std::chrono::steady_clock::time_point ratecontrol_next_frame_start;
 
-    logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
-    logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
-    logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
+    std::unique_ptr<platf::high_precision_timer> timer;
 
-    crypto::aes_t iv(12);
+    // One for the FEC block being sent and one for the block being built
+    std::array<fec::context_t, 2> fec;
 
-    auto timer = platf::create_high_precision_timer();
-    if (!timer || !*timer) {
-      BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
+    // Reused for encrypting each FEC block in a single call
+    std::vector<crypto::cipher::gcm_t::batch_entry_t> cipher_batch;
+
+    logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger;
+    logging::time_delta_periodic_logger frame_send_batch_latency_logger;
+    logging::time_delta_periodic_logger frame_fec_latency_logger;
+    logging::time_delta_periodic_logger frame_network_latency_logger;
+    logging::min_max_avg_periodic_logger<double> pacing_rate_logger;
+    logging::min_max_avg_periodic_logger<int> fec_percentage_logger;
+    std::shared_ptr<metrics::summary_t> encode_latency;
+    std::shared_ptr<metrics::summary_t> encoder_duration;
+    std::shared_ptr<metrics::summary_t> encoded_frame_bytes;
+    std::shared_ptr<metrics::summary_t> frame_qp;
+    std::array<std::shared_ptr<metrics::counter_t>, 5> encoded_frames;  // By video::frame_type_e
+
+    // Builds the next FEC block of a frame while the current one is paced out
+    thread_pool_util::ThreadPool helper;
+  };
+
+  /**
+   * @brief Packetize, protect, encrypt and send a single encoded frame.
+   * @param sender The state of the thread sending the frame.
+   * @param sock The video socket.
+   * @param packet The encoded frame.
+   */
+  void send_video_packet(video_sender_t &sender, udp::socket &sock, video::packet_t &packet) {
+    auto session = (session_t *) packet->channel_data;
+
+    // A frame past its deadline is dropped before any FEC or encryption is spent on it,
+    // the encoder is told to stop referencing it so the next frames can be sent again
+    std::optional<std::chrono::nanoseconds> age;
+    if (packet->frame_timestamp) {
+      age = std::chrono::steady_clock::now() - *packet->frame_timestamp;
+    }
+    if (!session->video.deadline.admit(packet->frame_index(), age, packet->is_idr(), packet->after_ref_frame_invalidation)) {
+      SUNSHINE_HOT_LOG(verbose) << "Dropped late frame ["sv << packet->frame_index() << ']';
+      session->metric_series.video_frames_late->increment();
+      invalidate_ref_frames(session, session->video.deadline.dropped_frames());
       return;
     }
 
-    auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
+    sender.frame_network_latency_logger.first_point_now();
+    timeline::scope_t scope {"send_frame", packet->frame_index()};
+    auto lowseq = session->video.lowseq;
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
-      }
+    std::string_view payload {(char *) packet->data(), packet->data_size()};
 
-      frame_network_latency_logger.first_point_now();
+    // The parameter sets were rewritten when the frame was encoded, only the start of the payload
+    // is sent from that copy and the rest is still sent from the encoder's buffer.
+    std::string_view replaced_head {(char *) packet->replaced_head.data(), packet->replaced_head.size()};
+    auto tail_offset = packet->replaced_size;
 
-      auto session = (session_t *) packet->channel_data;
-      auto lowseq = session->video.lowseq;
+    auto payload_size = replaced_head.size() + payload.size() - tail_offset;
 
-      std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+    video_short_frame_header_t frame_header = {};
+    frame_header.headerType = 0x01;  // Short header type
+    frame_header.frameType = packet->is_idr()                     ? 2 :
+                             packet->after_ref_frame_invalidation ? 5 :
+                                                                    1;
+    frame_header.lastPayloadLen = (payload_size + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+    if (frame_header.lastPayloadLen == 0) {
+      frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
+    }
 
-      // Apply replacements on the packet payload before performing any other operations.
-      // We need to know the final frame size to calculate the last packet size, and we
-      // must avoid matching replacements against the frame header or any other non-video
-      // part of the payload.
-      if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
+    if (packet->frame_timestamp) {
+      auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
+        const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
+      };
 
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
-        }
-      }
+      uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
+      frame_header.frame_processing_latency = latency;
+      sender.frame_processing_latency_logger.collect_and_log(latency / 10.);
+    } else {
+      frame_header.frame_processing_latency = 0;
+    }
 
-      video_short_frame_header_t frame_header = {};
-      frame_header.headerType = 0x01;  // Short header type
-      frame_header.frameType = packet->is_idr()                     ? 2 :
-                               packet->after_ref_frame_invalidation ? 5 :
-                                                                      1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
-      if (frame_header.lastPayloadLen == 0) {
-        frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
-      }
+    if (packet->convert_timestamp && packet->encode_timestamp) {
+      sender.encode_latency->observe(std::chrono::duration<double>(*packet->encode_timestamp - *packet->convert_timestamp).count());
+    }
+    if (packet->encode_duration) {
+      sender.encoder_duration->observe(std::chrono::duration<double>(*packet->encode_duration).count());
+    }
+    if (packet->qp) {
+      sender.frame_qp->observe(*packet->qp);
+    }
+    sender.encoded_frame_bytes->observe(packet->data_size());
+    sender.encoded_frames[(std::size_t) packet->frame_type]->increment();
+
+    auto fecPercentage = session->video.fec.percentage();
+    sender.fec_percentage_logger.collect_and_log(fecPercentage);
+    session->metric_series.fec_percentage->set(fecPercentage);
+
+    // The packet headers are kept apart from the payload, so each shard carries this much of the frame
+    auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
+    auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
+
+    // The frame as it's sent: the frame header, the replaced start of the payload and the untouched rest
+    const std::array<std::string_view, 3> frame_segments {
+      std::string_view {(char *) &frame_header, sizeof(frame_header)},
+      replaced_head,
+      payload.substr(tail_offset),
+    };
+    auto frame_shards = (sizeof(frame_header) + payload_size + (payload_blocksize - 1)) / payload_blocksize;
+
+    // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+    constexpr auto MAX_FEC_BLOCKS = 4;
+
+    // The max number of data shards per block is found by solving this system of equations for D:
+    // D = 255 - P
+    // P = D * F
+    // which results in the solution:
+    // D = 255 / (1 + F)
+    // multiplied by 100 since F is the percentage as an integer:
+    // D = (255 * 100) / (100 + F)
+    auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+
+    // Compute the number of FEC blocks needed for this frame using the max shards
+    auto fec_blocks_needed = (frame_shards + (max_data_shards_per_fec_block - 1)) / max_data_shards_per_fec_block;
+
+    // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
+    // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
+    if (fec_blocks_needed > MAX_FEC_BLOCKS) {
+      BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
+      fecPercentage = 0;
+      fec_blocks_needed = MAX_FEC_BLOCKS;
+    }
 
-      if (packet->frame_timestamp) {
-        auto duration_to_latency = [](const std::chrono::steady_clock::duration &duration) {
-          const auto duration_us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
-          return (uint16_t) std::clamp<decltype(duration_us)>((duration_us + 50) / 100, 0, std::numeric_limits<uint16_t>::max());
-        };
+    SUNSHINE_HOT_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
 
-        uint16_t latency = duration_to_latency(std::chrono::steady_clock::now() - *packet->frame_timestamp);
-        frame_header.frame_processing_latency = latency;
-        frame_processing_latency_logger.collect_and_log(latency / 10.);
-      } else {
-        frame_header.frame_processing_latency = 0;
-      }
+    // Spread the data shards evenly over the FEC blocks
+    auto shards_per_fec_block = (frame_shards + (fec_blocks_needed - 1)) / fec_blocks_needed;
 
-      auto fecPercentage = config::stream.fec_percentage;
+    // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
+    // the frame will be unrecoverable. Log an error for this case.
+    if (shards_per_fec_block >= 1024) {
+      BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << shards_per_fec_block << " packets)"sv;
+    }
 
-      // Insert space for packet headers
-      auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
-      auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
+    frame_trace::trace_t trace {};
+    trace.session_id = session->launch_session_id;
+    trace.frame_index = packet->frame_index();
+    trace.capture = packet->frame_timestamp;
+    trace.convert = packet->convert_timestamp;
+    trace.encode = packet->encode_timestamp;
+    trace.frame_bytes = packet->data_size();
+    trace.frame_type = video::frame_type_name(packet->frame_type);
+    trace.qp = packet->qp;
+    trace.encode_duration = packet->encode_duration;
+
+    // The session's own socket numbers its timestamped packets on its own
+    auto connected = session->video.sock.has_value();
+    auto tx_ids = connected ? session->video.tx_ids.get() : session->broadcast_ref->video_tx_timestamps ? &session->broadcast_ref->video_tx_ids : nullptr;
+    auto kernel_pacing = session->broadcast_ref->video_launch_time;
+
+    // RTP video timestamps use a 90 KHz clock on the session's media clock and the frame_timestamp from when the frame was captured
+    // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
+    bool frame_is_dupe = false;
+    if (!packet->frame_timestamp) {
+      packet->frame_timestamp = sender.ratecontrol_next_frame_start;
+      frame_is_dupe = true;
+    }
+    using rtp_tick = std::chrono::duration<int64_t, std::ratio<1, 90000>>;
+    auto timestamp = (uint32_t) std::chrono::round<rtp_tick>(*packet->frame_timestamp - session->media_epoch).count();
 
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
+    // Encrypt the shards [begin, end) of a block if video encryption is enabled
+    auto encrypt_shards = [&](fec::fec_t &shards, size_t begin, size_t end) {
+      if (!session->video.cipher || begin == end) {
+        return;
+      }
 
-      // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
+      timeline::scope_t scope {"encrypt", packet->frame_index()};
 
-      // The max number of data shards per block is found by solving this system of equations for D:
-      // D = 255 - P
-      // P = D * F
-      // which results in the solution:
-      // D = 255 / (1 + F)
-      // multiplied by 100 since F is the percentage as an integer:
-      // D = (255 * 100) / (100 + F)
-      auto max_data_shards_per_fec_block = (DATA_SHARDS_MAX * 100) / (100 + fecPercentage);
+      auto &batch = sender.cipher_batch;
+      batch.clear();
 
-      // Compute the number of FEC blocks needed for this frame using the block size and max shards
-      auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
-      auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+      for (auto x = begin; x < end; ++x) {
+        auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
 
-      // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
-      // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
-      if (fec_blocks_needed > MAX_FEC_BLOCKS) {
-        BOOST_LOG(warning) << "Skipping FEC for abnormally large encoded frame (needed "sv << fec_blocks_needed << " FEC blocks)"sv;
-        fecPercentage = 0;
-        fec_blocks_needed = MAX_FEC_BLOCKS;
+        // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+        // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
+        // high bytes is the "fixed" field. Because each client provides their own unique
+        // key, our values in the fixed field need only uniquely identify each independent
+        // use of the client's key with AES-GCM in our code.
+        //
+        // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
+        // to be sent to each client before the IV repeats.
+        std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), prefix->iv);
+        prefix->iv[11] = 'V';  // Video stream
+        session->video.gcm_iv_counter++;
+
+        prefix->frameNumber = packet->frame_index();
+
+        // Encrypt the header in place and the payload into the ciphertext buffer,
+        // leaving the encoder's buffer untouched
+        batch.push_back({
+          std::string_view {shards.header(x), shards.headersize},
+          std::string_view {(char *) shards.shards_p[x], shards.blocksize},
+          (uint8_t *) shards.header(x),
+          (uint8_t *) shards.data(x),
+          prefix->tag,
+          prefix->iv,
+        });
       }
 
-      std::array<std::string_view, MAX_FEC_BLOCKS> fec_blocks;
-      decltype(fec_blocks)::iterator
-        fec_blocks_begin = std::begin(fec_blocks),
-        fec_blocks_end = std::begin(fec_blocks) + fec_blocks_needed;
+      if (session->video.cipher->encrypt(batch.data(), batch.size(), sizeof(video_packet_enc_prefix_t::iv))) {
+        throw std::runtime_error("Couldn't encrypt video shards");
+      }
+    };
 
-      BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
+    // Build the data shards of a FEC block: fill in and protect the headers, then encrypt
+    // the data shards if needed. Their parity is only computed by build_parity(), so
+    // they can already be sent in the meantime.
+    // Blocks are built strictly in order, as each one continues the sequence numbers
+    // and IV counter where the previous block left off.
+    auto build_block = [&](int blockIndex, fec::context_t &ctx, int block_lowseq) {
+      timeline::scope_t scope {"fec_block", packet->frame_index()};
+      auto first_shard = blockIndex * shards_per_fec_block;
 
-      // Align individual FEC blocks to blocksize
-      auto unaligned_size = payload.size() / fec_blocks_needed;
-      auto aligned_size = ((unaligned_size + (blocksize - 1)) / blocksize) * blocksize;
+      // The last block must extend to the end of the frame
+      auto packets = blockIndex == fec_blocks_needed - 1 ? frame_shards - first_shard : shards_per_fec_block;
 
-      // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
-      // the frame will be unrecoverable. Log an error for this case.
-      if (aligned_size / blocksize >= 1024) {
-        BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << (aligned_size / blocksize) << " packets)"sv;
-      }
+      sender.frame_fec_latency_logger.first_point_now();
+      // If video encryption is enabled, we allocate space for the encryption header before each shard
+      auto shards = fec::prepare(ctx, frame_segments, first_shard, packets, payload_blocksize, sizeof(video_packet_raw_t), session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0, fecPercentage, session->config.minRequiredFecPackets);
 
-      // Split the data into aligned FEC blocks
-      for (int x = 0; x < fec_blocks_needed; ++x) {
-        if (x == fec_blocks_needed - 1) {
-          // The last block must extend to the end of the payload
-          fec_blocks[x] = payload.substr(x * aligned_size);
-        } else {
-          // Earlier blocks just extend to the next block offset
-          fec_blocks[x] = payload.substr(x * aligned_size, aligned_size);
+      for (int x = 0; x < packets; ++x) {
+        auto *inspect = (video_packet_raw_t *) shards.header(x);
+
+        inspect->packet.frameIndex = packet->frame_index();
+        inspect->packet.streamPacketIndex = ((uint32_t) block_lowseq + x) << 8;
+
+        // Match multiFecFlags with Moonlight
+        inspect->packet.multiFecFlags = 0x10;
+        inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+
+        inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
+        if (x == 0) {
+          inspect->packet.flags |= FLAG_SOF;
+        }
+        if (x == packets - 1) {
+          inspect->packet.flags |= FLAG_EOF;
         }
       }
 
-      try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
+      fec::encode_headers(ctx, shards);
 
-        // Send less than 64K in a single batch.
-        // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
-        // appear in "Other I/O" and begin waiting for interrupts.
-        // This gives inconsistent performance so we'd rather avoid it.
-        size_t send_batch_size = 64 * 1024 / blocksize;
-        // Also don't exceed 64 packets, which can happen when Moonlight requests
-        // unusually small packet size.
-        // Generic Segmentation Offload on Linux can't do more than 64.
-        send_batch_size = std::min<size_t>(64, send_batch_size);
+      // set FEC info now that we know for sure what our percentage will be for this frame
+      for (auto x = 0; x < shards.size(); ++x) {
+        auto *inspect = (video_packet_raw_t *) shards.header(x);
 
-        // Don't ignore the last ratecontrol group of the previous frame
-        auto ratecontrol_frame_start = std::max(ratecontrol_next_frame_start, std::chrono::steady_clock::now());
+        inspect->packet.fecInfo =
+          (x << 12 |
+           shards.data_shards << 22 |
+           shards.percentage << 4);
 
-        size_t ratecontrol_frame_packets_sent = 0;
-        size_t ratecontrol_group_packets_sent = 0;
+        inspect->rtp.header = 0x80 | FLAG_EXTENSION;
+        inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(block_lowseq + x);
+        inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
 
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
-          auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
+        inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+        inspect->packet.frameIndex = packet->frame_index();
+      }
 
-          for (int x = 0; x < packets; ++x) {
-            auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
+      // The payload pass reads the plaintext of the data shards, which encryption leaves
+      // untouched, so only their headers had to be protected first
+      encrypt_shards(shards, 0, shards.data_shards);
 
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
+      if (shards.size() == shards.data_shards) {
+        sender.frame_fec_latency_logger.second_point_now_and_log();
+      }
 
-            // Match multiFecFlags with Moonlight
-            inspect->packet.multiFecFlags = 0x10;
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+      return shards;
+    };
 
-            inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
-            if (x == 0) {
-              inspect->packet.flags |= FLAG_SOF;
-            }
-            if (x == packets - 1) {
-              inspect->packet.flags |= FLAG_EOF;
-            }
-          }
+    // Compute and encrypt the parity shards of a block returned by build_block()
+    auto build_parity = [&](fec::context_t &ctx, fec::fec_t &shards) {
+      timeline::scope_t scope {"fec_parity", packet->frame_index()};
+      fec::encode_payloads(ctx, shards);
+      sender.frame_fec_latency_logger.second_point_now_and_log();
 
-          frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
-          frame_fec_latency_logger.second_point_now_and_log();
-
-          auto peer_address = session->video.peer.address();
-          auto batch_info = platf::batched_send_info_t {
-            shards.headers.begin(),
-            shards.prefixsize,
-            shards.payload_buffers,
-            shards.blocksize,
-            0,
-            0,
-            (uintptr_t) sock.native_handle(),
-            peer_address,
-            session->video.peer.port(),
-            session->localAddress,
-          };
+      encrypt_shards(shards, shards.data_shards, shards.size());
+    };
+
+    // While the data shards of a block are paced out, its parity and then the next block
+    // are built on the sender's helper thread. Each of the two blocks in flight uses its
+    // own FEC context.
+    std::future<fec::fec_t> next_block;
+    auto wait_for_next_block = util::fail_guard([&]() {
+      if (next_block.valid()) {
+        next_block.wait();
+      }
+    });
 
-          size_t next_shard_to_send = 0;
+    // The client can't show anything until it receives IDR and recovery frames, they go out first
+    bool priority_frame = packet->is_idr() || packet->after_ref_frame_invalidation;
+    std::uint8_t dscp = priority_frame && session->config.videoQosType ? PRIORITY_VIDEO_DSCP : 0;
 
-          // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
-          // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
+    try {
+      // Follow the rate the pacer settled on for the link to this client
+      size_t ratecontrol_packets_in_1ms = session->video.pacer.packets_per_ms(blocksize, priority_frame);
+      sender.pacing_rate_logger.collect_and_log(session->video.pacer.rate() / 1000. / 1000.);
+      session->metric_series.pacing_rate->set(session->video.pacer.rate());
+
+      // Send less than 64K in a single batch.
+      // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
+      // appear in "Other I/O" and begin waiting for interrupts.
+      // This gives inconsistent performance so we'd rather avoid it.
+      size_t send_batch_size = 64 * 1024 / blocksize;
+      // Also don't exceed 64 packets, which can happen when Moonlight requests
+      // unusually small packet size.
+      // Generic Segmentation Offload on Linux can't do more than 64.
+      send_batch_size = std::min<size_t>(64, send_batch_size);
+
+      // Don't ignore the last ratecontrol group of the previous frame
+      auto ratecontrol_frame_start = std::max(sender.ratecontrol_next_frame_start, std::chrono::steady_clock::now());
+
+      size_t ratecontrol_frame_packets_sent = 0;
+      size_t ratecontrol_group_packets_sent = 0;
+
+      for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+        // The first block is built right away, there's nothing to overlap it with
+        auto shards = blockIndex == 0 ? build_block(0, sender.fec[0], lowseq) : next_block.get();
+        bool last_block = blockIndex + 1 == fec_blocks_needed;
+
+        // The parity is queued first, it's sent before anything of the next block
+        std::future<void> parity;
+        auto wait_for_parity = util::fail_guard([&]() {
+          if (parity.valid()) {
+            parity.wait();
           }
-          using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
-
-          // set FEC info now that we know for sure what our percentage will be for this frame
-          for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
-            }
+        });
+        if (shards.size() > shards.data_shards) {
+          parity = sender.helper.push(build_parity, std::ref(sender.fec[blockIndex % 2]), std::ref(shards));
+        } else if (last_block) {
+          trace.fec = std::chrono::steady_clock::now();
+        }
 
-            if (x - next_shard_to_send + 1 >= send_batch_size ||
-                x + 1 == shards.size()) {
-              // Do pacing within the frame.
-              // Also trigger pacing before the first send_batch() of the frame
-              // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
-                auto due = ratecontrol_frame_start +
-                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
-
-                auto now = std::chrono::steady_clock::now();
-                if (now < due) {
-                  timer->sleep_for(due - now);
-                }
+        if (!last_block) {
+          next_block = sender.helper.push(build_block, blockIndex + 1, std::ref(sender.fec[(blockIndex + 1) % 2]), lowseq + (int) shards.size());
+        }
 
-                ratecontrol_group_packets_sent = 0;
+        auto peer_address = session->video.peer.address();
+        auto batch_info = platf::batched_send_info_t {
+          shards.headers,
+          shards.recordsize(),
+          shards.payload_buffers,
+          shards.blocksize,
+          0,
+          0,
+          (uintptr_t) sock.native_handle(),
+          peer_address,
+          session->video.peer.port(),
+          session->localAddress,
+        };
+        batch_info.dscp = dscp;
+        batch_info.connected = connected;
+
+        size_t next_shard_to_send = 0;
+
+        for (auto x = 0; x < shards.size(); ++x) {
+          if (x - next_shard_to_send + 1 >= send_batch_size ||
+              x + 1 == shards.data_shards ||
+              x + 1 == shards.size()) {
+            // The data shards are out, the parity shards can't be sent until they're built
+            if (next_shard_to_send == shards.data_shards && parity.valid()) {
+              parity.get();
+
+              if (last_block) {
+                trace.fec = std::chrono::steady_clock::now();
               }
+            }
 
-              size_t current_batch_size = x - next_shard_to_send + 1;
-              batch_info.block_offset = next_shard_to_send;
-              batch_info.block_count = current_batch_size;
-
-              frame_send_batch_latency_logger.first_point_now();
-              // Use a batched send if it's supported on this platform
-              if (!platf::send_batch(batch_info)) {
-                // Batched send is not available, so send each packet individually
-                BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
-                for (auto y = 0; y < current_batch_size; y++) {
-                  auto send_info = platf::send_info_t {
-                    shards.prefix(next_shard_to_send + y),
-                    shards.prefixsize,
-                    shards.data(next_shard_to_send + y),
-                    shards.blocksize,
-                    (uintptr_t) sock.native_handle(),
-                    peer_address,
-                    session->video.peer.port(),
-                    session->localAddress,
-                  };
-
-                  platf::send(send_info);
-                }
+            // Do pacing within the frame.
+            // Also trigger pacing before the first send_batch() of the frame
+            // to account for the last send_batch() of the previous frame.
+            if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                ratecontrol_frame_packets_sent == 0) {
+              auto due = ratecontrol_frame_start +
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+
+              auto now = std::chrono::steady_clock::now();
+              if (now >= due) {
+                batch_info.launch_time = {};
+              } else if (kernel_pacing) {
+                // The kernel holds the packets until they're due, the whole frame is handed off without sleeping
+                batch_info.launch_time = due;
+              } else {
+                sender.timer->sleep_for(due - now);
               }
-              frame_send_batch_latency_logger.second_point_now_and_log();
 
-              ratecontrol_group_packets_sent += current_batch_size;
-              ratecontrol_frame_packets_sent += current_batch_size;
-              next_shard_to_send = x + 1;
+              ratecontrol_group_packets_sent = 0;
             }
+
+            size_t current_batch_size = x - next_shard_to_send + 1;
+
+            // The last packet of the frame is sent on its own when the kernel can timestamp it
+            bool timestamp_last = tx_ids && last_block && x + 1 == shards.size();
+            batch_info.block_offset = next_shard_to_send;
+            batch_info.block_count = current_batch_size - (timestamp_last ? 1 : 0);
+
+            sender.frame_send_batch_latency_logger.first_point_now();
+            timeline::scope_t batch_scope {"send_batch", packet->frame_index()};
+            // Use a batched send if it's supported on this platform
+            if (batch_info.block_count && !platf::send_batch(batch_info)) {
+              // Batched send is not available, so send each packet individually
+              SUNSHINE_HOT_LOG(verbose) << "Falling back to unbatched send"sv;
+              for (auto y = 0; y < batch_info.block_count; y++) {
+                auto send_info = platf::send_info_t {
+                  shards.prefix(next_shard_to_send + y),
+                  shards.recordsize(),
+                  shards.data(next_shard_to_send + y),
+                  shards.blocksize,
+                  (uintptr_t) sock.native_handle(),
+                  peer_address,
+                  session->video.peer.port(),
+                  session->localAddress,
+                };
+                send_info.dscp = dscp;
+                send_info.launch_time = batch_info.launch_time;
+                send_info.connected = connected;
+
+                platf::send(send_info);
+              }
+            }
+            if (timestamp_last) {
+              auto send_info = platf::send_info_t {
+                shards.prefix(x),
+                shards.recordsize(),
+                shards.data(x),
+                shards.blocksize,
+                (uintptr_t) sock.native_handle(),
+                peer_address,
+                session->video.peer.port(),
+                session->localAddress,
+              };
+              send_info.tx_timestamp = true;
+              send_info.dscp = dscp;
+              send_info.launch_time = batch_info.launch_time;
+              send_info.connected = connected;
+
+              trace.tx_id = tx_ids->send([&send_info]() {
+                return platf::send(send_info);
+              });
+            }
+            sender.frame_send_batch_latency_logger.second_point_now_and_log();
+            batch_scope.end();
+
+            // Refined by the kernel's transmit timestamp of the last packet if there is one
+            auto sent = std::chrono::steady_clock::now();
+            if (!trace.first_sent) {
+              trace.first_sent = sent;
+            }
+            trace.last_sent = sent;
+
+            ratecontrol_group_packets_sent += current_batch_size;
+            ratecontrol_frame_packets_sent += current_batch_size;
+            next_shard_to_send = x + 1;
           }
+        }
 
-          // remember this in case the next frame comes immediately
-          ratecontrol_next_frame_start = ratecontrol_frame_start +
-                                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+        // remember this in case the next frame comes immediately
+        sender.ratecontrol_next_frame_start = ratecontrol_frame_start +
+                                              std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                                ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
 
-          frame_network_latency_logger.second_point_now_and_log();
+        sender.frame_network_latency_logger.second_point_now_and_log();
+        session->metric_series.video_frames->increment();
+        session->metric_series.video_bytes->increment(payload.size());
 
-          BOOST_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
-                             << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
-                             << (frame_is_dupe ? " Dupe" : "")
-                             << (packet->is_idr() ? " Key" : "")
-                             << (packet->after_ref_frame_invalidation ? " RFI" : "");
+        SUNSHINE_HOT_LOG(verbose) << "Sent Frame seq ["sv << packet->frame_index() << "] pts ["sv << timestamp
+                           << "] shards ["sv << shards.size() << "/"sv << shards.percentage << "%]"sv
+                           << (frame_is_dupe ? " Dupe" : "")
+                           << (packet->is_idr() ? " Key" : "")
+                           << (packet->after_ref_frame_invalidation ? " RFI" : "");
 
-          ++blockIndex;
-          lowseq += shards.size();
-        });
+        lowseq += shards.size();
+      }
+
+      session->video.lowseq = lowseq;
+
+      frame_trace::record(trace);
+    } catch (const std::exception &e) {
+      BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
+      std::this_thread::sleep_for(100ms);
+    }
+  }
+
+  void videoBroadcastThread(udp::socket &sock) {
+    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
 
-        session->video.lowseq = lowseq;
-      } catch (const std::exception &e) {
-        BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
-        std::this_thread::sleep_for(100ms);
+    // Video traffic is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::video_send);
+    timeline::set_thread_name("video_send");
+
+    video_sender_t sender;
+    if (!sender.timer || !*sender.timer) {
+      BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
+      return;
+    }
+
+    // The packets are recorded as they're handed to the sessions, for replaying them in benchmarks
+    std::optional<packet_capture::writer_t> capture;
+    if (!config::video.packet_capture.empty()) {
+      capture.emplace(config::video.packet_capture);
+      BOOST_LOG(info) << "Recording the video packets to ["sv << config::video.packet_capture << ']';
+    }
+
+    // Every frame queued since the last wakeup is handled at once
+    std::vector<video::packet_t> pending;
+    while (packets->pop_all(pending)) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      for (auto &packet : pending) {
+        if (capture && *capture && !capture->write(*packet)) {
+          BOOST_LOG(error) << "Couldn't write to the packet capture file, recording stopped"sv;
+        }
+
+        // Sessions with their own send thread only need the frame handed over,
+        // so a large frame for one client never delays the frames of another.
+        auto session = (session_t *) packet->channel_data;
+        if (session->video.packets) {
+          if (!session->video.packets->raise(std::move(packet))) {
+            BOOST_LOG(debug) << "Video send thread is falling behind, dropped a frame"sv;
+          }
+          continue;
+        }
+
+        send_video_packet(sender, sock, packet);
       }
     }
 
     shutdown_event->raise(true);
   }
 
+  /**
+   * @brief Send the video frames of a single session.
+   * @param session The session to send frames for.
+   */
+  void videoSendThread(session_t *session) {
+    // Video traffic is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::video_send);
+    timeline::set_thread_name("video_send");
+
+    video_sender_t sender;
+    if (!sender.timer || !*sender.timer) {
+      BOOST_LOG(error) << "Failed to create timer, aborting video send thread";
+      session::stop(*session);
+      return;
+    }
+
+    auto &video = session->video;
+    auto &sock = video.sock ? *video.sock : session->broadcast_ref->video_sock;
+    while (auto packet = video.packets->pop()) {
+      send_video_packet(sender, sock, packet);
+
+      // Nothing waits on the session's own socket, its transmit timestamps are collected here
+      if (video.tx_ids) {
+        platf::read_tx_timestamps((uintptr_t) sock.native_handle(), [base = video.tx_ids->base()](std::uint32_t tx_id, std::chrono::steady_clock::time_point sent) {
+          frame_trace::tx_complete(base + tx_id, sent);
+        });
+      }
+    }
+  }
+
+  /**
+   * @brief Get the RTP timestamp of an audio packet on the session's media clock.
+   * @details Audio timestamps count milliseconds since the same epoch the video ones count 90 kHz ticks from.
+   *          They advance by the packet duration within a FEC block, whose packets the client expects evenly
+   *          spaced, and follow the capture clock at the start of a block once they drifted a packet from it.
+   *          They're only moved back by less than a packet, so they keep increasing.
+   * @param next The timestamp that follows the previous packet's.
+   * @param media_time When the first sample of the packet was captured, on the media clock.
+   * @param packet_duration The duration of a packet in milliseconds.
+   * @param block_start Whether the packet starts a FEC block.
+   * @return The timestamp of the packet.
+   */
+  std::uint32_t audio_timestamp(std::uint32_t next, std::chrono::nanoseconds media_time, int packet_duration, bool block_start) {
+    if (!block_start) {
+      return next;
+    }
+
+    auto captured = (std::uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(media_time).count();
+    auto drift = (std::int32_t) (captured - next);
+    if (drift >= packet_duration) {
+      return captured;
+    }
+    if (drift <= -packet_duration) {
+      return next - (packet_duration - 1);
+    }
+
+    return next;
+  }
+
   void audioBroadcastThread(udp::socket &sock) {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
     auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
 
-    audio_packet_t audio_packet;
     fec::rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
     crypto::aes_t iv(16);
 
@@ -1600,94 +2593,141 @@ namespace stream {
     const unsigned char parity[] = {0x77, 0x40, 0x38, 0x0e, 0xc7, 0xa7, 0x0d, 0x6c};
     memcpy(rs.get()->p, parity, sizeof(parity));
 
-    audio_packet.rtp.header = 0x80;
-    audio_packet.rtp.packetType = 97;
-    audio_packet.rtp.ssrc = 0;
+    // The parity shards of a FEC block are sent in a single batch
+    std::vector<platf::buffer_descriptor_t> fec_payload_buffers;
+    fec_payload_buffers.reserve(RTPA_FEC_SHARDS);
 
     // Audio traffic is sent on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::audio);
+
+    // Every packet queued since the last wakeup is handled at once
+    std::vector<audio::packet_t> pending;
+    bool running = true;
+    while (running && packets->pop_all(pending)) {
+      for (auto &packet : pending) {
+        if (shutdown_event->peek()) {
+          running = false;
+          break;
+        }
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
-      }
-
-      TUPLE_2D_REF(channel_data, packet_data, *packet);
-      auto session = (session_t *) channel_data;
-
-      auto sequenceNumber = session->audio.sequenceNumber;
-      auto timestamp = session->audio.timestamp;
+        TUPLE_2D_REF(channel_data, packet_data, packet);
+        auto session = (session_t *) channel_data;
 
-      *(std::uint32_t *) iv.data() = util::endian::big<std::uint32_t>(session->audio.avRiKeyId + sequenceNumber);
+        auto sequenceNumber = session->audio.sequenceNumber;
+        auto timestamp = audio_timestamp(session->audio.timestamp, packet_data.timestamp - session->media_epoch, session->config.audio.packetDuration, sequenceNumber % RTPA_DATA_SHARDS == 0);
 
-      auto &shards_p = session->audio.shards_p;
+        *(std::uint32_t *) iv.data() = util::endian::big<std::uint32_t>(session->audio.avRiKeyId + sequenceNumber);
 
-      auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
-      if (bytes < 0) {
-        BOOST_LOG(error) << "Couldn't encode audio packet"sv;
-        break;
-      }
+        auto &shards_p = session->audio.shards_p;
 
-      BOOST_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
+        auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
+        if (bytes < 0) {
+          BOOST_LOG(error) << "Couldn't encode audio packet"sv;
+          running = false;
+          break;
+        }
 
-      audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
-      audio_packet.rtp.timestamp = util::endian::big(timestamp);
+        SUNSHINE_HOT_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
 
-      session->audio.sequenceNumber++;
-      session->audio.timestamp += session->config.audio.packetDuration;
+        auto &audio_packet = session->audio.packet;
+        audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
+        audio_packet.rtp.timestamp = util::endian::big(timestamp);
 
-      auto peer_address = session->audio.peer.address();
-      try {
-        auto send_info = platf::send_info_t {
-          (const char *) &audio_packet,
-          sizeof(audio_packet),
-          (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
-          (size_t) bytes,
-          (uintptr_t) sock.native_handle(),
-          peer_address,
-          session->audio.peer.port(),
-          session->localAddress,
-        };
-        platf::send(send_info);
+        session->audio.sequenceNumber++;
+        session->audio.timestamp = timestamp + session->config.audio.packetDuration;
 
-        auto &fec_packet = session->audio.fec_packet;
-        // initialize the FEC header at the beginning of the FEC block
-        if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
-          fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
-          fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
-        }
+        auto peer_address = session->audio.peer.address();
+        try {
+          auto send_info = platf::send_info_t {
+            (const char *) &audio_packet,
+            sizeof(audio_packet),
+            (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
+            (size_t) bytes,
+            (uintptr_t) sock.native_handle(),
+            peer_address,
+            session->audio.peer.port(),
+            session->localAddress,
+          };
+          platf::send(send_info);
+          session->metric_series.audio_packets->increment();
+
+          auto &fec_packets = session->audio.fec_packets;
+          // initialize the FEC headers at the beginning of the FEC block
+          if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
+            for (auto &fec_packet : fec_packets) {
+              fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
+              fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+            }
+          }
 
-        // generate parity shards at the end of the FEC block
-        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
-          reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
+          // generate parity shards at the end of the FEC block
+          if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
+            reed_solomon_encode(rs.get(), shards_p.data(), RTPA_TOTAL_SHARDS, bytes);
 
-          for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
-            fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
-            fec_packet.fecHeader.fecShardIndex = x;
+            fec_payload_buffers.clear();
+            for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+              fec_packets[x].rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
+              fec_payload_buffers.emplace_back((const char *) shards_p[RTPA_DATA_SHARDS + x], (size_t) bytes);
+            }
 
-            auto send_info = platf::send_info_t {
-              (const char *) &fec_packet,
-              sizeof(fec_packet),
-              (const char *) shards_p[RTPA_DATA_SHARDS + x],
+            auto batch_info = platf::batched_send_info_t {
+              (const char *) fec_packets.data(),
+              sizeof(audio_fec_packet_t),
+              fec_payload_buffers,
               (size_t) bytes,
+              0,
+              RTPA_FEC_SHARDS,
               (uintptr_t) sock.native_handle(),
               peer_address,
               session->audio.peer.port(),
               session->localAddress,
             };
-            platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+
+            // Use a batched send if it's supported on this platform
+            if (!platf::send_batch(batch_info)) {
+              // Batched send is not available, so send each packet individually
+              for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+                auto send_info = platf::send_info_t {
+                  (const char *) &fec_packets[x],
+                  sizeof(audio_fec_packet_t),
+                  (const char *) shards_p[RTPA_DATA_SHARDS + x],
+                  (size_t) bytes,
+                  (uintptr_t) sock.native_handle(),
+                  peer_address,
+                  session->audio.peer.port(),
+                  session->localAddress,
+                };
+                platf::send(send_info);
+              }
+            }
+            SUNSHINE_HOT_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << "] ::  send..."sv;
           }
+        } catch (const std::exception &e) {
+          BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
+          std::this_thread::sleep_for(100ms);
         }
-      } catch (const std::exception &e) {
-        BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
-        std::this_thread::sleep_for(100ms);
       }
     }
 
     shutdown_event->raise(true);
   }
 
+  /**
+   * @brief Let other sockets bind the port a socket binds.
+   * @param sock The socket, before it's bound.
+   * @return `true` if the platform lets the port be shared this way.
+   */
+  bool set_reuse_port(udp::socket &sock) {
+#ifdef SO_REUSEPORT
+    int enable = 1;
+    return !setsockopt(sock.native_handle(), SOL_SOCKET, SO_REUSEPORT, (const char *) &enable, sizeof(enable));
+#else
+    // Windows has no way to let only the matching socket receive the datagrams of a shared port
+    return false;
+#endif
+  }
+
   int start_broadcast(broadcast_ctx_t &ctx) {
     auto address_family = net::af_from_enum_string(config::sunshine.address_family);
     auto protocol = address_family == net::IPV4 ? udp::v4() : udp::v6();
@@ -1716,6 +2756,9 @@ namespace stream {
       BOOST_LOG(error) << "Failed to set video socket send buffer size (SO_SENDBUF)";
     }
 
+    // The sessions sending from their own threads bind sockets of their own to the port
+    ctx.video_reuse_port = config::stream.per_session_video_send && set_reuse_port(ctx.video_sock);
+
     ctx.video_sock.bind(udp::endpoint(protocol, video_port), ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't bind Video server to port ["sv << video_port << "]: "sv << ec.message();
@@ -1723,6 +2766,11 @@ namespace stream {
       return -1;
     }
 
+    // Timestamp the last packet of each frame for the frame trace where the platform supports it
+    ctx.video_tx_timestamps = platf::enable_tx_timestamps((uintptr_t) ctx.video_sock.native_handle());
+
+    ctx.video_launch_time = config::stream.kernel_pacing && platf::enable_tx_launch_time((uintptr_t) ctx.video_sock.native_handle());
+
     ctx.audio_sock.open(protocol, ec);
     if (ec) {
       BOOST_LOG(fatal) << "Couldn't open socket for Audio server: "sv << ec.message();
@@ -1835,6 +2883,66 @@ namespace stream {
     return -1;
   }
 
+  /**
+   * @brief Open a video socket of the session's own, connected to its client.
+   * @details It shares the video port with the broadcast socket, so the client and the NATs on
+   *          the way see the packets coming from where they always did. Its send buffer only holds
+   *          the frames of this session, sized to its bitrate, so a client whose buffer fills up
+   *          doesn't hold back the others. Being connected, the kernel routes the packets once.
+   *          The broadcast socket is used if it can't be opened.
+   * @param session The session, after its client pinged the video port.
+   * @param ctx The broadcast context.
+   */
+  void open_session_video_socket(session_t *session, broadcast_ctx_t &ctx) {
+    boost::system::error_code ec;
+    auto local_endpoint = ctx.video_sock.local_endpoint(ec);
+    if (ec) {
+      return;
+    }
+
+    // Dual-stack sockets see IPv4 addresses mapped
+    auto local_address = session->localAddress;
+    if (local_endpoint.protocol() == udp::v6() && local_address.is_v4()) {
+      local_address = asio::ip::make_address_v6(asio::ip::v4_mapped, local_address.to_v4());
+    }
+
+    udp::socket sock {ctx.io_context};
+    sock.open(local_endpoint.protocol(), ec);
+    if (ec || !set_reuse_port(sock)) {
+      BOOST_LOG(warning) << "Couldn't open a video socket for the session, sending from the shared one"sv;
+      return;
+    }
+
+    auto bitrate_bytes_per_sec = (std::int64_t) session->config.monitor.bitrate * 1000 / 8;
+    auto send_buffer_size = std::max<std::int64_t>(MIN_VIDEO_SEND_BUFFER_SIZE, bitrate_bytes_per_sec * VIDEO_SEND_BUFFER_WINDOW / 1s);
+    sock.set_option(asio::socket_base::send_buffer_size((int) std::min<std::int64_t>(send_buffer_size, std::numeric_limits<int>::max())), ec);
+    if (ec) {
+      BOOST_LOG(warning) << "Failed to set the send buffer size of the session's video socket: "sv << ec.message();
+    }
+
+    sock.bind(udp::endpoint(local_address, local_endpoint.port()), ec);
+    if (!ec) {
+      sock.connect(session->video.peer, ec);
+    }
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't connect a video socket to "sv << session->video.peer.address() << ':' << session->video.peer.port() << ", sending from the shared one: "sv << ec.message();
+      return;
+    }
+
+    // Frames are handed off to the kernel at once, a socket that can't hold them back can't be used
+    if (ctx.video_launch_time && !platf::enable_tx_launch_time((uintptr_t) sock.native_handle())) {
+      BOOST_LOG(warning) << "Couldn't enable launch times on the session's video socket, sending from the shared one"sv;
+      return;
+    }
+
+    if (ctx.video_tx_timestamps && platf::enable_tx_timestamps((uintptr_t) sock.native_handle())) {
+      session->video.tx_ids = std::make_unique<frame_trace::tx_ids_t>(ctx.next_tx_id_base.fetch_add(TX_ID_BASE_STRIDE, std::memory_order_relaxed));
+    }
+
+    BOOST_LOG(debug) << "Sending video from a socket connected to the session, with a "sv << send_buffer_size / 1024 << " KiB send buffer"sv;
+    session->video.sock.emplace(std::move(sock));
+  }
+
   void videoThread(session_t *session) {
     auto fg = util::fail_guard([&]() {
       session::stop(*session);
@@ -1848,9 +2956,20 @@ namespace stream {
       return;
     }
 
+    if (session->video.packets && ref->video_reuse_port) {
+      open_session_video_socket(session, *ref);
+    }
+
     // Enable local prioritization and QoS tagging on video traffic if requested by the client
     auto address = session->video.peer.address();
-    session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+    auto &sock = session->video.sock ? *session->video.sock : ref->video_sock;
+    session->video.qos = platf::enable_socket_qos(sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
+
+    // A frame larger than the link delivers within a frame interval reaches the client late, the encoders are kept below it
+    if (auto framerate = session->config.monitor.framerate; framerate > 0) {
+      session->config.monitor.maxFrameSize = (int) std::min<std::uint64_t>(session->video.pacer.ceiling() / framerate, std::numeric_limits<int>::max());
+      BOOST_LOG(debug) << "Video frame size cap ["sv << session->config.monitor.maxFrameSize / 8 / 1024 << " KiB]"sv;
+    }
 
     BOOST_LOG(debug) << "Start capturing Video"sv;
     video::capture(session->mail, session->config.monitor, session);
@@ -1912,6 +3031,11 @@ namespace stream {
 
       BOOST_LOG(debug) << "Waiting for video to end..."sv;
       session.videoThread.join();
+      if (session.videoSendThread.joinable()) {
+        BOOST_LOG(debug) << "Waiting for video sender to end..."sv;
+        session.video.packets->stop();
+        session.videoSendThread.join();
+      }
       BOOST_LOG(debug) << "Waiting for audio to end..."sv;
       session.audioThread.join();
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
@@ -1943,7 +3067,7 @@ namespace stream {
     }
 
     int start(session_t &session, const std::string &addr_string) {
-      session.input = input::alloc(session.mail);
+      session.input = input::alloc(session.mail, session.config.monitor.framerate, session.launch_session_id);
 
       session.broadcast_ref = broadcast.ref();
       if (!session.broadcast_ref) {
@@ -1967,9 +3091,13 @@ namespace stream {
       session.audio.peer.port(0);
 
       session.pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
+      session.media_epoch = std::chrono::steady_clock::now();
 
       session.audioThread = std::thread {audioThread, &session};
       session.videoThread = std::thread {videoThread, &session};
+      if (session.video.packets) {
+        session.videoSendThread = std::thread {videoSendThread, &session};
+      }
 
       session.state.store(state_e::RUNNING, std::memory_order_relaxed);
 
@@ -1992,11 +3120,21 @@ namespace stream {
       session->shutdown_event = mail->event<bool>(mail::shutdown);
       session->launch_session_id = launch_session.id;
 
+      metrics::labels_t labels {{"session", std::to_string(launch_session.id)}};
+      session->metric_series.video_frames = metrics::counter("sunshine_video_frames_sent_total", "Video frames sent", labels);
+      session->metric_series.video_bytes = metrics::counter("sunshine_video_bytes_sent_total", "Bytes of encoded video sent, before FEC and headers", labels);
+      session->metric_series.video_frames_lost = metrics::counter("sunshine_video_frames_lost_total", "Video frames the client reported as lost", labels);
+      session->metric_series.video_frames_late = metrics::counter("sunshine_video_frames_late_total", "Video frames dropped because they were past their deadline", labels);
+      session->metric_series.fec_percentage = metrics::gauge("sunshine_video_fec_percentage", "Share of the video packets added for FEC", labels);
+      session->metric_series.pacing_rate = metrics::gauge("sunshine_video_pacing_rate_bits_per_second", "Rate the video is paced at", labels);
+      session->metric_series.audio_packets = metrics::counter("sunshine_audio_packets_sent_total", "Audio packets sent, without the FEC packets", labels);
+
       session->config = config;
 
       session->control.connect_data = launch_session.control_connect_data;
       session->control.feedback_queue = mail->queue<platf::gamepad_feedback_msg_t>(mail::gamepad_feedback);
       session->control.hdr_queue = mail->event<video::hdr_info_t>(mail::hdr);
+      session->control.capture_display_queue = mail->event<std::string>(mail::capture_display);
       session->control.legacy_input_enc_iv = launch_session.iv;
       session->control.cipher = crypto::cipher::gcm_t {
         launch_session.gcm_key,
@@ -2005,8 +3143,22 @@ namespace stream {
 
       session->video.idr_events = mail->event<bool>(mail::idr);
       session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+      session->video.bitrate_events = mail->event<int>(mail::bitrate);
+      session->audio.loss_events = mail->event<int>(mail::audio_loss);
+      session->video.bitrate.reset(config::video.max_bitrate > 0 ? std::min(config.monitor.bitrate, config::video.max_bitrate) : config.monitor.bitrate, std::chrono::steady_clock::now());
       session->video.lowseq = 0;
+      session->video.deadline.reset(config.monitor.framerate > 0 ? std::chrono::nanoseconds {std::chrono::seconds {config::stream.frame_deadline}} / config.monitor.framerate : 0ns);
+      if (config::stream.adaptive_fec) {
+        session->video.fec.reset(config::stream.fec_percentage, config::stream.min_fec_percentage, config::stream.max_fec_percentage);
+      } else {
+        session->video.fec.reset(config::stream.fec_percentage, config::stream.fec_percentage, config::stream.fec_percentage);
+      }
       session->video.ping_payload = launch_session.av_ping_payload;
+      if (config::stream.per_session_video_send) {
+        // The broadcast thread is the only producer and the session's send thread the only consumer.
+        // Spin briefly before sleeping, frames of a busy stream usually arrive within that window.
+        session->video.packets = std::make_shared<safe::spsc_queue_t<video::packet_t>>(30, 256);
+      }
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
         BOOST_LOG(info) << "Video encryption enabled"sv;
         session->video.cipher = crypto::cipher::gcm_t {
@@ -2016,27 +3168,36 @@ namespace stream {
         session->video.gcm_iv_counter = 0;
       }
 
-      constexpr auto max_block_size = crypto::cipher::round_to_pkcs7_padded(2048);
+      constexpr std::size_t cache_line = 64;
+      constexpr auto max_block_size = (crypto::cipher::round_to_pkcs7_padded(2048) + cache_line - 1) / cache_line * cache_line;
 
-      util::buffer_t<char> shards {RTPA_TOTAL_SHARDS * max_block_size};
-      util::buffer_t<uint8_t *> shards_p {RTPA_TOTAL_SHARDS};
+      // Audio FEC spans multiple audio packets,
+      // therefore its session specific
+      // The extra line leaves room to align the first shard, operator new[] only guarantees 16 bytes
+      session->audio.shards = util::buffer_t<char> {RTPA_TOTAL_SHARDS * max_block_size + cache_line};
 
+      auto first_shard = (std::uintptr_t) session->audio.shards.begin();
+      first_shard = (first_shard + cache_line - 1) / cache_line * cache_line;
       for (auto x = 0; x < RTPA_TOTAL_SHARDS; ++x) {
-        shards_p[x] = (uint8_t *) &shards[x * max_block_size];
+        session->audio.shards_p[x] = (uint8_t *) first_shard + x * max_block_size;
       }
 
-      // Audio FEC spans multiple audio packets,
-      // therefore its session specific
-      session->audio.shards = std::move(shards);
-      session->audio.shards_p = std::move(shards_p);
+      session->audio.packet.rtp.header = 0x80;
+      session->audio.packet.rtp.packetType = 97;
+      session->audio.packet.rtp.ssrc = 0;
 
-      session->audio.fec_packet.rtp.header = 0x80;
-      session->audio.fec_packet.rtp.packetType = 127;
-      session->audio.fec_packet.rtp.timestamp = 0;
-      session->audio.fec_packet.rtp.ssrc = 0;
+      for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+        auto &fec_packet = session->audio.fec_packets[x];
 
-      session->audio.fec_packet.fecHeader.payloadType = 97;
-      session->audio.fec_packet.fecHeader.ssrc = 0;
+        fec_packet.rtp.header = 0x80;
+        fec_packet.rtp.packetType = 127;
+        fec_packet.rtp.timestamp = 0;
+        fec_packet.rtp.ssrc = 0;
+
+        fec_packet.fecHeader.fecShardIndex = x;
+        fec_packet.fecHeader.payloadType = 97;
+        fec_packet.fecHeader.ssrc = 0;
+      }
 
       session->audio.cipher = crypto::cipher::cbc_t {
         launch_session.gcm_key,
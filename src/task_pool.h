@@ -5,13 +5,19 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -44,6 +50,117 @@ namespace task_pool_util {
     }
   };
 
+  /**
+   * @brief A task that holds its callable inline when it's small enough, and on the heap otherwise.
+   */
+  class inline_task_t {
+  public:
+    /// The largest callable stored inline
+    static constexpr std::size_t INLINE_SIZE = 6 * sizeof(void *);
+
+    inline_task_t() = default;
+
+    template<class Function>
+      requires(!std::is_same_v<std::decay_t<Function>, inline_task_t> && std::is_invocable_v<std::decay_t<Function> &>)
+    inline_task_t(Function &&f) {
+      using function_t = std::decay_t<Function>;
+
+      if constexpr (fits_inline<function_t>) {
+        new (_storage) function_t(std::forward<Function>(f));
+        _ops = &inline_ops<function_t>;
+      } else {
+        new (_storage) std::unique_ptr<function_t>(std::make_unique<function_t>(std::forward<Function>(f)));
+        _ops = &heap_ops<function_t>;
+      }
+    }
+
+    inline_task_t(inline_task_t &&other) noexcept:
+        _ops {other._ops} {
+      if (_ops) {
+        _ops->move(_storage, other._storage);
+        other._ops = nullptr;
+      }
+    }
+
+    inline_task_t &operator=(inline_task_t &&other) noexcept {
+      if (this != &other) {
+        reset();
+
+        _ops = other._ops;
+        if (_ops) {
+          _ops->move(_storage, other._storage);
+          other._ops = nullptr;
+        }
+      }
+
+      return *this;
+    }
+
+    ~inline_task_t() {
+      reset();
+    }
+
+    void run() {
+      _ops->run(_storage);
+    }
+
+    explicit operator bool() const {
+      return _ops != nullptr;
+    }
+
+  private:
+    struct ops_t {
+      void (*run)(void *storage);
+
+      // Move constructs into the first storage, and destroys the second
+      void (*move)(void *dest, void *src);
+      void (*destroy)(void *storage);
+    };
+
+    template<class T>
+    static constexpr bool fits_inline = sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<T>;
+
+    template<class T>
+    static void move_storage(void *dest, void *src) {
+      auto value = std::launder((T *) src);
+      new (dest) T(std::move(*value));
+      value->~T();
+    }
+
+    template<class T>
+    static void destroy_storage(void *storage) {
+      std::launder((T *) storage)->~T();
+    }
+
+    template<class T>
+    static constexpr ops_t inline_ops {
+      [](void *storage) {
+        (*std::launder((T *) storage))();
+      },
+      move_storage<T>,
+      destroy_storage<T>,
+    };
+
+    template<class T>
+    static constexpr ops_t heap_ops {
+      [](void *storage) {
+        (**std::launder((std::unique_ptr<T> *) storage))();
+      },
+      move_storage<std::unique_ptr<T>>,
+      destroy_storage<std::unique_ptr<T>>,
+    };
+
+    void reset() {
+      if (_ops) {
+        _ops->destroy(_storage);
+        _ops = nullptr;
+      }
+    }
+
+    alignas(std::max_align_t) std::byte _storage[INLINE_SIZE];
+    const ops_t *_ops {};
+  };
+
   class TaskPool {
   public:
     typedef std::unique_ptr<_ImplBase> __task;
@@ -64,8 +181,25 @@ namespace task_pool_util {
     };
 
   protected:
-    std::deque<__task> _tasks;
-    std::vector<std::pair<__time_point, __task>> _timer_tasks;
+    /**
+     * @brief A delayed task in the heap of timers.
+     */
+    struct timer_task_entry_t {
+      __time_point time_point;
+
+      // Tasks due at the same time run in the order they were pushed
+      std::uint64_t sequence;
+
+      __task task;
+    };
+
+    std::deque<inline_task_t> _tasks;
+
+    // A binary min-heap of the delayed tasks, indexed by their id so they can be found without a scan
+    std::vector<timer_task_entry_t> _timer_tasks;
+    std::unordered_map<task_id_t, std::size_t> _timer_index;
+    std::uint64_t _timer_sequence {};
+
     std::mutex _task_mutex;
 
   public:
@@ -73,48 +207,51 @@ namespace task_pool_util {
 
     TaskPool(TaskPool &&other) noexcept:
         _tasks {std::move(other._tasks)},
-        _timer_tasks {std::move(other._timer_tasks)} {
+        _timer_tasks {std::move(other._timer_tasks)},
+        _timer_index {std::move(other._timer_index)},
+        _timer_sequence {other._timer_sequence} {
     }
 
     TaskPool &operator=(TaskPool &&other) noexcept {
       std::swap(_tasks, other._tasks);
       std::swap(_timer_tasks, other._timer_tasks);
+      std::swap(_timer_index, other._timer_index);
+      std::swap(_timer_sequence, other._timer_sequence);
 
       return *this;
     }
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+      auto [task, future] = make_task(std::forward<Function>(newTask), std::forward<Args>(args)...);
 
-      using __return = std::invoke_result_t<Function, Args &&...>;
-      using task_t = std::packaged_task<__return()>;
-
-      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
-        return std::apply(task, std::move(tuple_args));
-      };
+      std::lock_guard<std::mutex> lg(_task_mutex);
+      _tasks.emplace_back(std::move(task));
 
-      task_t task(std::move(bind));
+      return std::move(future);
+    }
 
-      auto future = task.get_future();
+    /**
+     * @brief Push a task whose result isn't needed.
+     * @details Unlike push(), there is no future, and small tasks are stored without any allocation.
+     *          The task must not throw.
+     */
+    template<class Function, class... Args>
+    void post(Function &&newTask, Args &&...args) {
+      auto task = bind_task(std::forward<Function>(newTask), std::forward<Args>(args)...);
 
       std::lock_guard<std::mutex> lg(_task_mutex);
-      _tasks.emplace_back(toRunnable(std::move(task)));
-
-      return future;
+      _tasks.emplace_back(std::move(task));
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.cbegin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        if (std::get<0>(*it) < task.first) {
-          break;
-        }
-      }
+      auto pos = _timer_tasks.size();
+      _timer_index[task.second.get()] = pos;
+      _timer_tasks.push_back({task.first, _timer_sequence++, std::move(task.second)});
 
-      _timer_tasks.emplace(it, task.first, std::move(task.second));
+      sift_up(pos);
     }
 
     /**
@@ -134,11 +271,7 @@ namespace task_pool_util {
         time_point = std::chrono::steady_clock::now() + duration;
       }
 
-      auto bind = [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
-        return std::apply(task, std::move(tuple_args));
-      };
-
-      task_t task(std::move(bind));
+      task_t task(bind_task(std::forward<Function>(newTask), std::forward<Args>(args)...));
 
       auto future = task.get_future();
       auto runnable = toRunnable(std::move(task));
@@ -158,77 +291,48 @@ namespace task_pool_util {
     void delay(task_id_t task_id, std::chrono::duration<X, Y> duration) {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          std::get<0>(*it) = std::chrono::steady_clock::now() + duration;
-
-          break;
-        }
-      }
-
-      if (it == _timer_tasks.cend()) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
         return;
       }
 
-      // smaller time goes to the back
-      auto prev = it - 1;
-      while (it > _timer_tasks.cbegin()) {
-        if (std::get<0>(*it) > std::get<0>(*prev)) {
-          std::swap(*it, *prev);
-        }
+      auto pos = index->second;
+      _timer_tasks[pos].time_point = std::chrono::steady_clock::now() + duration;
 
-        --prev;
-        --it;
-      }
+      // The task was delayed, or brought forward
+      sift_down(sift_up(pos));
     }
 
     bool cancel(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto it = _timer_tasks.begin();
-      for (; it < _timer_tasks.cend(); ++it) {
-        const __task &task = std::get<1>(*it);
-
-        if (&*task == task_id) {
-          _timer_tasks.erase(it);
-
-          return true;
-        }
-      }
-
-      return false;
+      return remove_timer_task(task_id).has_value();
     }
 
     std::optional<std::pair<__time_point, __task>> pop(task_id_t task_id) {
       std::lock_guard lg(_task_mutex);
 
-      auto pos = std::find_if(std::begin(_timer_tasks), std::end(_timer_tasks), [&task_id](const auto &t) {
-        return t.second.get() == task_id;
-      });
-
-      if (pos == std::end(_timer_tasks)) {
+      auto entry = remove_timer_task(task_id);
+      if (!entry) {
         return std::nullopt;
       }
 
-      return std::move(*pos);
+      return std::pair {entry->time_point, std::move(entry->task)};
     }
 
-    std::optional<__task> pop() {
+    std::optional<inline_task_t> pop() {
       std::lock_guard lg(_task_mutex);
 
       if (!_tasks.empty()) {
-        __task task = std::move(_tasks.front());
+        inline_task_t task = std::move(_tasks.front());
         _tasks.pop_front();
         return task;
       }
 
-      if (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now()) {
-        __task task = std::move(std::get<1>(_timer_tasks.back()));
-        _timer_tasks.pop_back();
-        return task;
+      if (!_timer_tasks.empty() && _timer_tasks.front().time_point <= std::chrono::steady_clock::now()) {
+        return inline_task_t {[task = std::move(remove_timer_task(_timer_tasks.front().task.get())->task)]() {
+          task->run();
+        }};
       }
 
       return std::nullopt;
@@ -237,7 +341,7 @@ namespace task_pool_util {
     bool ready() {
       std::lock_guard<std::mutex> lg(_task_mutex);
 
-      return !_tasks.empty() || (!_timer_tasks.empty() && std::get<0>(_timer_tasks.back()) <= std::chrono::steady_clock::now());
+      return !_tasks.empty() || (!_timer_tasks.empty() && _timer_tasks.front().time_point <= std::chrono::steady_clock::now());
     }
 
     std::optional<__time_point> next() {
@@ -247,7 +351,33 @@ namespace task_pool_util {
         return std::nullopt;
       }
 
-      return std::get<0>(_timer_tasks.back());
+      return _timer_tasks.front().time_point;
+    }
+
+  protected:
+    template<class Function, class... Args>
+    static auto bind_task(Function &&newTask, Args &&...args) {
+      static_assert(std::is_invocable_v<Function, Args &&...>, "arguments don't match the function");
+
+      return [task = std::forward<Function>(newTask), tuple_args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        return std::apply(task, std::move(tuple_args));
+      };
+    }
+
+    /**
+     * @return The task to run, and the future of its result.
+     */
+    template<class Function, class... Args>
+    static auto make_task(Function &&newTask, Args &&...args) {
+      using __return = std::invoke_result_t<Function, Args &&...>;
+      using task_t = std::packaged_task<__return()>;
+
+      task_t task(bind_task(std::forward<Function>(newTask), std::forward<Args>(args)...));
+
+      auto future = task.get_future();
+
+      // The packaged task only holds a pointer to its state, it's stored inline
+      return std::pair {inline_task_t {std::move(task)}, std::move(future)};
     }
 
   private:
@@ -255,5 +385,81 @@ namespace task_pool_util {
     std::unique_ptr<_ImplBase> toRunnable(Function &&f) {
       return std::make_unique<_Impl<Function>>(std::forward<Function &&>(f));
     }
+
+    static bool before(const timer_task_entry_t &lhs, const timer_task_entry_t &rhs) {
+      return lhs.time_point < rhs.time_point || (lhs.time_point == rhs.time_point && lhs.sequence < rhs.sequence);
+    }
+
+    void swap_timer_tasks(std::size_t lhs, std::size_t rhs) {
+      std::swap(_timer_tasks[lhs], _timer_tasks[rhs]);
+      _timer_index[_timer_tasks[lhs].task.get()] = lhs;
+      _timer_index[_timer_tasks[rhs].task.get()] = rhs;
+    }
+
+    /**
+     * @return The position the task ends up in.
+     */
+    std::size_t sift_up(std::size_t pos) {
+      while (pos > 0) {
+        auto parent = (pos - 1) / 2;
+        if (!before(_timer_tasks[pos], _timer_tasks[parent])) {
+          break;
+        }
+
+        swap_timer_tasks(pos, parent);
+        pos = parent;
+      }
+
+      return pos;
+    }
+
+    void sift_down(std::size_t pos) {
+      while (true) {
+        auto first = pos;
+        for (auto child : {2 * pos + 1, 2 * pos + 2}) {
+          if (child < _timer_tasks.size() && before(_timer_tasks[child], _timer_tasks[first])) {
+            first = child;
+          }
+        }
+
+        if (first == pos) {
+          break;
+        }
+
+        swap_timer_tasks(pos, first);
+        pos = first;
+      }
+    }
+
+    /**
+     * @brief Remove a delayed task, the task mutex must be held.
+     * @param task_id The id of the task.
+     * @return The task, or `std::nullopt` if it isn't delayed.
+     */
+    std::optional<timer_task_entry_t> remove_timer_task(task_id_t task_id) {
+      auto index = _timer_index.find(task_id);
+      if (index == std::end(_timer_index)) {
+        return std::nullopt;
+      }
+
+      auto pos = index->second;
+      _timer_index.erase(index);
+
+      // Replace the task with the last one, then restore the heap around it
+      auto last = _timer_tasks.size() - 1;
+      if (pos != last) {
+        std::swap(_timer_tasks[pos], _timer_tasks[last]);
+        _timer_index[_timer_tasks[pos].task.get()] = pos;
+      }
+
+      auto entry = std::move(_timer_tasks.back());
+      _timer_tasks.pop_back();
+
+      if (pos < _timer_tasks.size()) {
+        sift_down(sift_up(pos));
+      }
+
+      return entry;
+    }
   };
 }  // namespace task_pool_util
@@ -0,0 +1,160 @@
+/**
+ * @file src/thread_affinity.cpp
+ * @brief Definitions for pinning the streaming threads to CPUs.
+ */
+// standard includes
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <sstream>
+#include <string>
+
+// local includes
+#include "config.h"
+#include "logging.h"
+#include "platform/common.h"
+#include "thread_affinity.h"
+
+using namespace std::literals;
+
+namespace thread_affinity {
+  namespace {
+    std::string_view trim(std::string_view view) {
+      while (!view.empty() && (view.front() == ' ' || view.front() == '[' || view.front() == '\n')) {
+        view.remove_prefix(1);
+      }
+      while (!view.empty() && (view.back() == ' ' || view.back() == ']' || view.back() == '\n')) {
+        view.remove_suffix(1);
+      }
+
+      return view;
+    }
+
+    std::optional<int> to_int(std::string_view view) {
+      int value;
+      auto [ptr, ec] = std::from_chars(view.data(), view.data() + view.size(), value);
+      if (ec != std::errc() || ptr != view.data() + view.size() || value < 0) {
+        return std::nullopt;
+      }
+
+      return value;
+    }
+  }  // namespace
+
+  std::vector<int> parse_cpus(std::string_view list, const std::function<std::vector<int>(int)> &node_cpus) {
+    std::vector<int> cpus;
+
+    list = trim(list);
+    while (!list.empty()) {
+      auto end = list.find(',');
+      auto entry = trim(list.substr(0, end));
+      list = end == std::string_view::npos ? std::string_view {} : list.substr(end + 1);
+
+      if (entry.empty()) {
+        continue;
+      }
+
+      if (entry.starts_with("node"sv)) {
+        auto node = to_int(entry.substr(4));
+        auto node_list = node ? node_cpus(*node) : std::vector<int> {};
+        if (node_list.empty()) {
+          BOOST_LOG(warning) << "Ignoring unknown NUMA node ["sv << entry << ']';
+        }
+        cpus.insert(std::end(cpus), std::begin(node_list), std::end(node_list));
+
+        continue;
+      }
+
+      auto dash = entry.find('-');
+      auto first = to_int(entry.substr(0, dash));
+      auto last = dash == std::string_view::npos ? first : to_int(entry.substr(dash + 1));
+      if (!first || !last || *first > *last) {
+        BOOST_LOG(warning) << "Ignoring invalid CPU ["sv << entry << ']';
+        continue;
+      }
+
+      for (auto cpu = *first; cpu <= *last; ++cpu) {
+        cpus.emplace_back(cpu);
+      }
+    }
+
+    std::sort(std::begin(cpus), std::end(cpus));
+    cpus.erase(std::unique(std::begin(cpus), std::end(cpus)), std::end(cpus));
+
+    return cpus;
+  }
+
+  std::vector<int> cpus(role_e role) {
+    if (!config::stream.thread_affinity) {
+      return {};
+    }
+
+    const std::string *list;
+    bool near_gpu = false;
+    switch (role) {
+      case role_e::capture:
+        list = &config::stream.capture_cpus;
+        near_gpu = true;
+        break;
+      case role_e::encode:
+        list = &config::stream.encode_cpus;
+        near_gpu = true;
+        break;
+      case role_e::video_send:
+        list = &config::stream.video_send_cpus;
+        near_gpu = true;
+        break;
+      case role_e::audio:
+        list = &config::stream.audio_cpus;
+        break;
+      case role_e::control:
+        list = &config::stream.control_cpus;
+        break;
+    }
+
+    if (!list->empty()) {
+      return parse_cpus(*list, platf::numa_node_cpus);
+    }
+    if (near_gpu) {
+      return platf::gpu_local_cpus();
+    }
+
+    return {};
+  }
+
+  void pin(role_e role) {
+    std::string_view name;
+    switch (role) {
+      case role_e::capture:
+        name = "capture"sv;
+        break;
+      case role_e::encode:
+        name = "encode"sv;
+        break;
+      case role_e::video_send:
+        name = "video send"sv;
+        break;
+      case role_e::audio:
+        name = "audio"sv;
+        break;
+      case role_e::control:
+        name = "control"sv;
+        break;
+    }
+
+    auto cpus = thread_affinity::cpus(role);
+    if (cpus.empty()) {
+      return;
+    }
+
+    if (!platf::set_thread_affinity(cpus)) {
+      return;
+    }
+
+    std::ostringstream cpu_list;
+    for (std::size_t x = 0; x < cpus.size(); ++x) {
+      cpu_list << (x ? ","sv : ""sv) << cpus[x];
+    }
+    BOOST_LOG(debug) << "Pinned "sv << name << " thread to CPUs ["sv << cpu_list.str() << ']';
+  }
+}  // namespace thread_affinity
@@ -0,0 +1,48 @@
+/**
+ * @file src/thread_affinity.h
+ * @brief Declarations for pinning the streaming threads to CPUs.
+ */
+#pragma once
+
+// standard includes
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace thread_affinity {
+  /**
+   * @brief The kinds of streaming threads that can be pinned to their own CPUs.
+   */
+  enum class role_e {
+    capture,  ///< Captures the display
+    encode,  ///< Encodes the video
+    video_send,  ///< Packetizes and sends the video
+    audio,  ///< Captures, encodes and sends the audio
+    control,  ///< Handles the control stream
+  };
+
+  /**
+   * @brief Parse a list of CPUs.
+   * @details The list holds CPU numbers, ranges of them such as `8-15`, and NUMA nodes such
+   *          as `node1` that stand for all of their CPUs, separated by commas.
+   * @param list The list, optionally in square brackets.
+   * @param node_cpus Get the CPUs of a NUMA node.
+   * @return The CPUs in ascending order, without duplicates.
+   */
+  std::vector<int> parse_cpus(std::string_view list, const std::function<std::vector<int>(int)> &node_cpus);
+
+  /**
+   * @brief Get the CPUs the threads of a kind are pinned to.
+   * @param role The kind of thread.
+   * @return The CPUs in ascending order, empty if the threads are left to the scheduler.
+   */
+  std::vector<int> cpus(role_e role);
+
+  /**
+   * @brief Pin the calling thread to the CPUs configured for its kind.
+   * @details Without configured CPUs, the capture, encode and video send threads are kept
+   *          on the CPUs closest to the GPU, the others are left to the scheduler.
+   * @param role The kind of the calling thread.
+   */
+  void pin(role_e role);
+}  // namespace thread_affinity
@@ -5,6 +5,9 @@
 #pragma once
 
 // standard includes
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
 #include <thread>
 
 // local includes
@@ -13,30 +16,48 @@
 namespace thread_pool_util {
   /**
    * Allow threads to execute unhindered while keeping full control over the threads.
+   *
+   * Every thread has its own queue of tasks, pushed to in turn, and takes tasks from the other queues
+   * when its own runs dry. The tasks pushed by a thread of the pool go to its own queue.
+   * The delayed tasks, and the ones pushed before the threads are started, are shared by all threads.
    */
   class ThreadPool: public task_pool_util::TaskPool {
   public:
     typedef TaskPool::__task __task;
 
   private:
+    /**
+     * @brief The tasks of one thread, which the other threads take from the back of.
+     */
+    struct worker_queue_t {
+      std::mutex lock;
+      std::deque<task_pool_util::inline_task_t> tasks;
+    };
+
     std::vector<std::thread> _thread;
+    std::vector<std::unique_ptr<worker_queue_t>> _queues;
+    std::atomic<std::size_t> _next_queue {};
+
+    // The number of threads waiting for tasks, pushing only wakes a thread up when there is one
+    std::atomic<int> _sleeping {};
 
     std::condition_variable _cv;
     std::mutex _lock;
 
     bool _continue;
 
+    // The pool and the index of the current thread, if it belongs to a pool
+    static inline thread_local ThreadPool *_current_pool {};
+    static inline thread_local std::size_t _current_worker {};
+
   public:
     ThreadPool():
         _continue {false} {
     }
 
     explicit ThreadPool(int threads):
-        _thread(threads),
-        _continue {true} {
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
-      }
+        _continue {false} {
+      start(threads);
     }
 
     ~ThreadPool() noexcept {
@@ -50,17 +71,36 @@ namespace thread_pool_util {
 
     template<class Function, class... Args>
     auto push(Function &&newTask, Args &&...args) {
-      std::lock_guard lg(_lock);
-      auto future = TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      if (_queues.empty()) {
+        std::lock_guard lg(_lock);
+        return TaskPool::push(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      }
 
-      _cv.notify_one();
-      return future;
+      auto [task, future] = make_task(std::forward<Function>(newTask), std::forward<Args>(args)...);
+      enqueue(std::move(task));
+
+      return std::move(future);
+    }
+
+    /**
+     * @brief Push a task whose result isn't needed, see TaskPool::post().
+     */
+    template<class Function, class... Args>
+    void post(Function &&newTask, Args &&...args) {
+      if (_queues.empty()) {
+        std::lock_guard lg(_lock);
+        TaskPool::post(std::forward<Function>(newTask), std::forward<Args>(args)...);
+        return;
+      }
+
+      enqueue(bind_task(std::forward<Function>(newTask), std::forward<Args>(args)...));
     }
 
     void pushDelayed(std::pair<__time_point, __task> &&task) {
       std::lock_guard lg(_lock);
 
       TaskPool::pushDelayed(std::move(task));
+      _cv.notify_all();
     }
 
     template<class Function, class X, class Y, class... Args>
@@ -76,10 +116,22 @@ namespace thread_pool_util {
     void start(int threads) {
       _continue = true;
 
+      _queues.resize(threads);
+      for (auto &queue : _queues) {
+        queue = std::make_unique<worker_queue_t>();
+      }
+
+      // The tasks pushed before the threads were started run first
+      if (!_queues.empty()) {
+        std::lock_guard lg(_task_mutex);
+        std::move(std::begin(_tasks), std::end(_tasks), std::back_inserter(_queues.front()->tasks));
+        _tasks.clear();
+      }
+
       _thread.resize(threads);
 
-      for (auto &t : _thread) {
-        t = std::thread(&ThreadPool::_main, this);
+      for (std::size_t x = 0; x < _thread.size(); ++x) {
+        _thread[x] = std::thread(&ThreadPool::_main, this, x);
       }
     }
 
@@ -96,33 +148,113 @@ namespace thread_pool_util {
       }
     }
 
+  private:
+    void enqueue(task_pool_util::inline_task_t &&task) {
+      auto &queue = *_queues[_current_pool == this ? _current_worker : _next_queue++ % _queues.size()];
+      {
+        std::lock_guard lg(queue.lock);
+        queue.tasks.emplace_back(std::move(task));
+      }
+
+      // Pairs with the increment of _sleeping by a thread before it looks for tasks, so either
+      // this sees it sleeping, or it sees this task
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_sleeping.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard lg(_lock);
+        _cv.notify_one();
+      }
+    }
+
+    std::optional<task_pool_util::inline_task_t> pop_front(worker_queue_t &queue) {
+      std::lock_guard lg(queue.lock);
+
+      if (queue.tasks.empty()) {
+        return std::nullopt;
+      }
+
+      auto task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return task;
+    }
+
+    std::optional<task_pool_util::inline_task_t> pop_back(worker_queue_t &queue) {
+      std::lock_guard lg(queue.lock);
+
+      if (queue.tasks.empty()) {
+        return std::nullopt;
+      }
+
+      auto task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      return task;
+    }
+
+    /**
+     * @brief Take the next task of a thread: its own first, then the shared ones, then the ones of the other threads.
+     * @param worker The index of the thread.
+     */
+    std::optional<task_pool_util::inline_task_t> pop_task(std::size_t worker) {
+      if (auto task = pop_front(*_queues[worker])) {
+        return task;
+      }
+
+      if (auto task = this->pop()) {
+        return task;
+      }
+
+      for (std::size_t x = 1; x < _queues.size(); ++x) {
+        if (auto task = pop_back(*_queues[(worker + x) % _queues.size()])) {
+          return task;
+        }
+      }
+
+      return std::nullopt;
+    }
+
+    bool has_tasks() {
+      if (ready()) {
+        return true;
+      }
+
+      for (auto &queue : _queues) {
+        std::lock_guard lg(queue->lock);
+        if (!queue->tasks.empty()) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
   public:
-    void _main() {
+    void _main(std::size_t worker) {
+      _current_pool = this;
+      _current_worker = worker;
+
       while (_continue) {
-        if (auto task = this->pop()) {
-          (*task)->run();
+        if (auto task = pop_task(worker)) {
+          task->run();
         } else {
           std::unique_lock uniq_lock(_lock);
 
-          if (ready()) {
+          ++_sleeping;
+          if (!_continue || has_tasks()) {
+            --_sleeping;
             continue;
           }
 
-          if (!_continue) {
-            break;
-          }
-
           if (auto tp = next()) {
             _cv.wait_until(uniq_lock, *tp);
           } else {
             _cv.wait(uniq_lock);
           }
+          --_sleeping;
         }
       }
 
       // Execute remaining tasks
-      while (auto task = this->pop()) {
-        (*task)->run();
+      while (auto task = pop_task(worker)) {
+        task->run();
       }
     }
   };
@@ -5,18 +5,30 @@
 #pragma once
 
 // standard includes
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <functional>
-#include <map>
 #include <mutex>
+#include <optional>
+#include <semaphore>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 // local includes
 #include "utility.h"
 
 namespace safe {
+  /**
+   * @brief A value raised by one thread for others to pop or view.
+   * @details peek() and running() are a single atomic load. pop() and view() without a timeout
+   *          wait on the state with a futex based atomic wait instead of the condition variable.
+   */
   template<class T>
   class event_t {
   public:
@@ -35,28 +47,35 @@ namespace safe {
         _status = status_t {std::forward<Args>(args)...};
       }
 
+      publish();
       _cv.notify_all();
+      _state.notify_all();
     }
 
     // pop and view should not be used interchangeably
     status_t pop() {
-      std::unique_lock ul {_lock};
-
-      if (!_continue) {
-        return util::false_v<status_t>;
-      }
-
-      while (!_status) {
-        _cv.wait(ul);
-
-        if (!_continue) {
-          return util::false_v<status_t>;
+      while (true) {
+        std::uint32_t state;
+        {
+          std::lock_guard lg {_lock};
+
+          if (!_continue) {
+            return util::false_v<status_t>;
+          }
+
+          if (_status) {
+            auto val = std::move(_status);
+            _status = util::false_v<status_t>;
+            publish();
+            return val;
+          }
+
+          state = _state.load(std::memory_order_relaxed);
         }
-      }
 
-      auto val = std::move(_status);
-      _status = util::false_v<status_t>;
-      return val;
+        // Returns once the event was raised, reset or stopped since the state was read
+        _state.wait(state, std::memory_order_acquire);
+      }
     }
 
     // pop and view should not be used interchangeably
@@ -76,26 +95,30 @@ namespace safe {
 
       auto val = std::move(_status);
       _status = util::false_v<status_t>;
+      publish();
       return val;
     }
 
     // pop and view should not be used interchangeably
     status_t view() {
-      std::unique_lock ul {_lock};
+      while (true) {
+        std::uint32_t state;
+        {
+          std::lock_guard lg {_lock};
 
-      if (!_continue) {
-        return util::false_v<status_t>;
-      }
+          if (!_continue) {
+            return util::false_v<status_t>;
+          }
 
-      while (!_status) {
-        _cv.wait(ul);
+          if (_status) {
+            return _status;
+          }
 
-        if (!_continue) {
-          return util::false_v<status_t>;
+          state = _state.load(std::memory_order_relaxed);
         }
-      }
 
-      return _status;
+        _state.wait(state, std::memory_order_acquire);
+      }
     }
 
     // pop and view should not be used interchangeably
@@ -117,33 +140,57 @@ namespace safe {
     }
 
     bool peek() {
-      return _continue && (bool) _status;
+      return (_state.load(std::memory_order_acquire) & (RUNNING | RAISED)) == (RUNNING | RAISED);
     }
 
     void stop() {
-      std::lock_guard lg {_lock};
+      {
+        std::lock_guard lg {_lock};
 
-      _continue = false;
+        _continue = false;
 
-      _cv.notify_all();
+        publish();
+        _cv.notify_all();
+      }
+      _state.notify_all();
     }
 
     void reset() {
-      std::lock_guard lg {_lock};
+      {
+        std::lock_guard lg {_lock};
 
-      _continue = true;
+        _continue = true;
 
-      _status = util::false_v<status_t>;
+        _status = util::false_v<status_t>;
+        publish();
+      }
+      _state.notify_all();
     }
 
     [[nodiscard]] bool running() const {
-      return _continue;
+      return _state.load(std::memory_order_acquire) & RUNNING;
     }
 
   private:
+    static constexpr std::uint32_t RUNNING = 1;
+    static constexpr std::uint32_t RAISED = 2;
+
+    // The state is counted from this bit up, so atomic waits see every change
+    static constexpr std::uint32_t CHANGE = 4;
+
+    /**
+     * @brief Mirror the state in _state for the lock-free readers, must be called with the lock held.
+     */
+    void publish() {
+      auto count = (_state.load(std::memory_order_relaxed) & ~(RUNNING | RAISED)) + CHANGE;
+      _state.store(count | (_continue ? RUNNING : 0) | (_status ? RAISED : 0), std::memory_order_release);
+    }
+
     bool _continue {true};
     status_t _status {util::false_v<status_t>};
 
+    std::atomic<std::uint32_t> _state {RUNNING};
+
     std::condition_variable _cv;
     std::mutex _lock;
   };
@@ -249,34 +296,84 @@ namespace safe {
     return std::make_shared<alarm_raw_t<T>>();
   }
 
+  /**
+   * @brief What a queue_t does with an element raised while it's full.
+   */
+  enum class overflow_e {
+    clear,  ///< Drop every queued element
+    drop_oldest,  ///< Drop the oldest queued element, with room for a single element only the latest one is kept
+    drop_newest,  ///< Drop the raised element
+    block,  ///< Wait until the consumer makes room
+  };
+
+  /**
+   * @brief The capacity of a queue_t and what it does when it's full.
+   */
+  struct queue_options_t {
+    std::uint32_t max_elements = 32;
+    overflow_e overflow = overflow_e::clear;
+  };
+
+  /**
+   * @brief The counters of a queue_t.
+   */
+  struct queue_stats_t {
+    queue_options_t options;
+    std::uint64_t dropped;  ///< The number of elements dropped because the queue was full
+    std::size_t size;  ///< The number of elements waiting in the queue
+  };
+
   template<class T>
   class queue_t {
   public:
     using status_t = util::optional_t<T>;
 
-    queue_t(std::uint32_t max_elements = 32):
-        _max_elements {max_elements} {
+    queue_t(std::uint32_t max_elements = 32, overflow_e overflow = overflow_e::clear):
+        _max_elements {max_elements},
+        _overflow {overflow} {
     }
 
     template<class... Args>
     void raise(Args &&...args) {
-      std::lock_guard ul {_lock};
+      std::unique_lock ul {_lock};
 
       if (!_continue) {
         return;
       }
 
-      if (_queue.size() == _max_elements) {
-        _queue.clear();
+      if (_queue.size() >= _max_elements) {
+        switch (_overflow) {
+          case overflow_e::clear:
+            _dropped += _queue.size();
+            _queue.clear();
+            break;
+          case overflow_e::drop_oldest:
+            ++_dropped;
+            _queue.erase(std::begin(_queue));
+            break;
+          case overflow_e::drop_newest:
+            ++_dropped;
+            return;
+          case overflow_e::block:
+            _space_cv.wait(ul, [this]() {
+              return !_continue || _queue.size() < _max_elements;
+            });
+
+            if (!_continue) {
+              return;
+            }
+            break;
+        }
       }
 
       _queue.emplace_back(std::forward<Args>(args)...);
+      _size.store(_queue.size(), std::memory_order_relaxed);
 
       _cv.notify_all();
     }
 
     bool peek() {
-      return _continue && !_queue.empty();
+      return _continue && _size.load(std::memory_order_relaxed);
     }
 
     template<class Rep, class Period>
@@ -293,10 +390,7 @@ namespace safe {
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
-
-      return val;
+      return pop_front();
     }
 
     status_t pop() {
@@ -314,10 +408,39 @@ namespace safe {
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
+      return pop_front();
+    }
 
-      return val;
+    /**
+     * @brief Wait for elements, then take all of them in a single critical section.
+     * @param out Replaced by the queued elements, its storage is reused by the queue.
+     * @return `false` if the queue was stopped.
+     */
+    bool pop_all(std::vector<T> &out) {
+      out.clear();
+
+      std::unique_lock ul {_lock};
+
+      while (_queue.empty()) {
+        if (!_continue) {
+          return false;
+        }
+
+        _cv.wait(ul);
+      }
+
+      if (!_continue) {
+        return false;
+      }
+
+      std::swap(out, _queue);
+      _size.store(0, std::memory_order_relaxed);
+
+      if (_overflow == overflow_e::block) {
+        _space_cv.notify_all();
+      }
+
+      return true;
     }
 
     std::vector<T> &unsafe() {
@@ -330,20 +453,394 @@ namespace safe {
       _continue = false;
 
       _cv.notify_all();
+      _space_cv.notify_all();
     }
 
     [[nodiscard]] bool running() const {
       return _continue;
     }
 
+    [[nodiscard]] queue_stats_t stats() const {
+      std::lock_guard lg {_lock};
+
+      return {{_max_elements, _overflow}, _dropped.load(std::memory_order_relaxed), _queue.size()};
+    }
+
   private:
-    bool _continue {true};
+    T pop_front() {
+      auto val = std::move(_queue.front());
+      _queue.erase(std::begin(_queue));
+      _size.store(_queue.size(), std::memory_order_relaxed);
+
+      if (_overflow == overflow_e::block) {
+        _space_cv.notify_one();
+      }
+
+      return val;
+    }
+
+    std::atomic_bool _continue {true};
     std::uint32_t _max_elements;
+    overflow_e _overflow;
+    std::atomic<std::uint64_t> _dropped {};
 
-    std::mutex _lock;
+    mutable std::mutex _lock;
     std::condition_variable _cv;
 
+    // Signaled when a blocking queue makes room
+    std::condition_variable _space_cv;
+
     std::vector<T> _queue;
+
+    // Mirrors the size of _queue, so peek() doesn't race with the threads holding the lock
+    std::atomic<std::size_t> _size {};
+  };
+
+  /**
+   * @brief Bounded lock-free queue for exactly one producer and one consumer thread.
+   * @details raise() and pop() only touch the ring and a pair of atomic indices.
+   *          The mutex is taken solely to park and wake a consumer that found the
+   *          queue empty, after spinning for `spin_count` attempts. When the queue
+   *          is full, raise() drops the new element, like queue_t it never blocks
+   *          the producer.
+   */
+  template<class T>
+  class spsc_queue_t {
+  public:
+    using status_t = util::optional_t<T>;
+
+    spsc_queue_t(std::uint32_t max_elements = 32, std::uint32_t spin_count = 0):
+        _spin_count {spin_count} {
+      // One slot is kept free to tell a full ring from an empty one
+      std::size_t size = 2;
+      while (size < (std::size_t) max_elements + 1) {
+        size <<= 1;
+      }
+
+      _ring.resize(size);
+      _mask = size - 1;
+    }
+
+    /**
+     * @brief Queue an element, called from the producer thread only.
+     * @return false if the element was dropped because the queue is full or stopped.
+     */
+    template<class... Args>
+    bool raise(Args &&...args) {
+      if (!_continue) {
+        return false;
+      }
+
+      auto tail = _tail.load(std::memory_order_relaxed);
+      auto next = (tail + 1) & _mask;
+      if (next == _head.load(std::memory_order_acquire)) {
+        return false;
+      }
+
+      _ring[tail] = T {std::forward<Args>(args)...};
+      _tail.store(next, std::memory_order_seq_cst);
+
+      // Pairs with the store to _parked in pop(), so a parked consumer can't miss the element
+      if (_parked.load(std::memory_order_seq_cst)) {
+        std::lock_guard lg {_lock};
+        _cv.notify_one();
+      }
+
+      return true;
+    }
+
+    bool peek() {
+      return _continue && _head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Take the oldest element, called from the consumer thread only.
+     * @details Spins briefly, then sleeps until an element arrives or the queue is stopped.
+     */
+    status_t pop() {
+      for (std::uint32_t x = 0; x < _spin_count; ++x) {
+        if (!_continue) {
+          return util::false_v<status_t>;
+        }
+
+        if (peek()) {
+          return take();
+        }
+
+        std::this_thread::yield();
+      }
+
+      std::unique_lock ul {_lock};
+      _parked.store(true, std::memory_order_seq_cst);
+      _cv.wait(ul, [this]() {
+        return !_continue || _head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_seq_cst);
+      });
+      _parked.store(false, std::memory_order_relaxed);
+
+      if (!_continue) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    /**
+     * @brief Take the oldest element if there is one, called from the consumer thread only.
+     */
+    status_t try_pop() {
+      if (!peek()) {
+        return util::false_v<status_t>;
+      }
+
+      return take();
+    }
+
+    void stop() {
+      std::lock_guard lg {_lock};
+
+      _continue = false;
+
+      _cv.notify_all();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue;
+    }
+
+  private:
+    status_t take() {
+      auto head = _head.load(std::memory_order_relaxed);
+
+      status_t val = std::move(_ring[head]);
+      _ring[head] = T {};
+      _head.store((head + 1) & _mask, std::memory_order_release);
+
+      return val;
+    }
+
+    std::atomic_bool _continue {true};
+    std::atomic_bool _parked {false};
+    std::uint32_t _spin_count;
+
+    std::vector<T> _ring;
+    std::size_t _mask;
+
+    // Written by the consumer and the producer respectively
+    alignas(64) std::atomic<std::size_t> _head {0};
+    alignas(64) std::atomic<std::size_t> _tail {0};
+
+    std::mutex _lock;
+    std::condition_variable _cv;
+  };
+
+  /**
+   * @brief Bounded lock-free ring of samples for exactly one producer and one consumer thread.
+   * @details Meant for real-time callbacks handing samples over to a capture thread: write()
+   *          never blocks nor allocates, a block that doesn't fit is dropped whole and counted
+   *          as an overrun. read() waits for a full block, a wait that times out is counted as
+   *          an underrun. Waking the consumer releases a semaphore, which doesn't take a lock.
+   */
+  template<class T>
+  class spsc_ring_t {
+  public:
+    explicit spsc_ring_t(std::size_t capacity) {
+      std::size_t size = 2;
+      while (size < capacity) {
+        size <<= 1;
+      }
+
+      _ring.resize(size);
+      _mask = size - 1;
+    }
+
+    /**
+     * @brief Append a block of elements, called from the producer thread only.
+     * @return false if the block was dropped because the ring is full or stopped.
+     */
+    bool write(const T *data, std::size_t count) {
+      if (!_continue) {
+        return false;
+      }
+
+      auto tail = _tail.load(std::memory_order_relaxed);
+      if (count > _ring.size() - (tail - _head.load(std::memory_order_acquire))) {
+        _overruns.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      auto begin = tail & _mask;
+      auto first = std::min(count, _ring.size() - begin);
+      std::copy_n(data, first, std::begin(_ring) + begin);
+      std::copy_n(data + first, count - first, std::begin(_ring));
+      _tail.store(tail + count, std::memory_order_release);
+
+      _written.release();
+
+      return true;
+    }
+
+    /**
+     * @brief Take the oldest block of elements, called from the consumer thread only.
+     * @param data Receives `count` elements.
+     * @param count The number of elements to take.
+     * @param timeout How long to wait for the elements to be written.
+     * @return false if the ring was stopped, or the elements didn't arrive in time.
+     */
+    bool read(T *data, std::size_t count, std::chrono::milliseconds timeout) {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+
+      auto head = _head.load(std::memory_order_relaxed);
+      while (_tail.load(std::memory_order_acquire) - head < count) {
+        if (!_continue) {
+          return false;
+        }
+
+        if (!_written.try_acquire_until(deadline)) {
+          _underruns.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+      }
+
+      // Writes signaled while the elements were already there would wake the next wait for nothing
+      while (_written.try_acquire()) {}
+
+      auto begin = head & _mask;
+      auto first = std::min(count, _ring.size() - begin);
+      std::copy_n(std::begin(_ring) + begin, first, data);
+      std::copy_n(std::begin(_ring), count - first, data + first);
+      _head.store(head + count, std::memory_order_release);
+
+      return true;
+    }
+
+    /**
+     * @brief Get the number of elements written and not read yet.
+     */
+    [[nodiscard]] std::size_t size() const {
+      return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] std::size_t capacity() const {
+      return _ring.size();
+    }
+
+    /**
+     * @brief Get the number of blocks dropped because the ring was full.
+     */
+    [[nodiscard]] std::uint64_t overruns() const {
+      return _overruns.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the number of reads that timed out waiting for elements.
+     */
+    [[nodiscard]] std::uint64_t underruns() const {
+      return _underruns.load(std::memory_order_relaxed);
+    }
+
+    void stop() {
+      _continue = false;
+      _written.release();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue;
+    }
+
+  private:
+    std::atomic_bool _continue {true};
+
+    std::vector<T> _ring;
+    std::size_t _mask;
+
+    // Positions since the start, written by the consumer and the producer respectively
+    alignas(64) std::atomic<std::size_t> _head {0};
+    alignas(64) std::atomic<std::size_t> _tail {0};
+
+    std::atomic<std::uint64_t> _overruns {};
+    std::atomic<std::uint64_t> _underruns {};
+
+    std::counting_semaphore<> _written {0};
+  };
+
+  /**
+   * @brief A small value published by rare writers and read by any thread without a lock.
+   * @details It's a sequence lock: load() copies the value and retries if a store() ran meanwhile,
+   *          so reading only costs a copy. Writers are serialized by a mutex, they should be rare
+   *          enough for readers to never retry in practice.
+   */
+  template<class T>
+  class snapshot_t {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+
+    using word_t = std::uint64_t;
+    static constexpr std::size_t WORDS = (sizeof(T) + sizeof(word_t) - 1) / sizeof(word_t);
+
+  public:
+    explicit snapshot_t(const T &value = T {}) {
+      write(value);
+    }
+
+    void store(const T &value) {
+      std::lock_guard lg {_write_lock};
+
+      // An odd sequence tells the readers a store is in progress
+      auto seq = _seq.load(std::memory_order_relaxed);
+      _seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      write(value);
+
+      _seq.store(seq + 2, std::memory_order_release);
+    }
+
+    [[nodiscard]] T load() const {
+      std::array<word_t, WORDS> words;
+
+      while (true) {
+        auto seq = _seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        for (std::size_t x = 0; x < WORDS; ++x) {
+          words[x] = _words[x].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_seq.load(std::memory_order_relaxed) == seq) {
+          break;
+        }
+      }
+
+      T value;
+      std::memcpy(&value, words.data(), sizeof(T));
+
+      return value;
+    }
+
+    /**
+     * @brief The number of stores so far, to tell whether the value changed without comparing it.
+     */
+    [[nodiscard]] std::uint64_t version() const {
+      return _seq.load(std::memory_order_acquire) / 2;
+    }
+
+  private:
+    void write(const T &value) {
+      std::array<word_t, WORDS> words {};
+      std::memcpy(words.data(), &value, sizeof(T));
+
+      for (std::size_t x = 0; x < WORDS; ++x) {
+        _words[x].store(words[x], std::memory_order_relaxed);
+      }
+    }
+
+    std::atomic<std::uint64_t> _seq {0};
+    std::array<std::atomic<word_t>, WORDS> _words;
+
+    std::mutex _write_lock;
   };
 
   template<class T>
@@ -411,12 +908,7 @@ namespace safe {
       }
 
       void release() {
-        std::lock_guard lg {owner->_lock};
-
-        if (!--owner->_count) {
-          owner->_destruct(*get());
-          (*this)->~element_type();
-        }
+        owner->unref();
 
         owner = nullptr;
       }
@@ -437,27 +929,59 @@ namespace safe {
     }
 
     [[nodiscard]] ptr_t ref() {
+      // While the object is alive, a reference is a single atomic increment
+      auto count = _count.load(std::memory_order_relaxed);
+      while (count) {
+        if (_count.compare_exchange_weak(count, count + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+          return ptr_t {this};
+        }
+      }
+
+      // The object is constructed and destructed under the lock, only the first reference waits for it
       std::lock_guard lg {_lock};
 
-      if (!_count) {
-        new (_object_buf.data()) element_type;
-        if (_construct(*reinterpret_cast<element_type *>(_object_buf.data()))) {
-          return ptr_t {nullptr};
-        }
+      if (_count.load(std::memory_order_relaxed)) {
+        _count.fetch_add(1, std::memory_order_relaxed);
+        return ptr_t {this};
       }
 
-      ++_count;
+      auto object = new (_object_buf.data()) element_type;
+      if (_construct(*object)) {
+        object->~element_type();
+        return ptr_t {nullptr};
+      }
+
+      _count.store(1, std::memory_order_release);
 
       return ptr_t {this};
     }
 
   private:
+    void unref() {
+      // Only dropping the last reference takes the lock
+      auto count = _count.load(std::memory_order_relaxed);
+      while (count > 1) {
+        if (_count.compare_exchange_weak(count, count - 1, std::memory_order_release, std::memory_order_relaxed)) {
+          return;
+        }
+      }
+
+      std::lock_guard lg {_lock};
+
+      // Another reference may have been taken while waiting for the lock
+      if (_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        auto object = reinterpret_cast<element_type *>(_object_buf.data());
+        _destruct(*object);
+        object->~element_type();
+      }
+    }
+
     construct_f _construct;
     destruct_f _destruct;
 
-    std::array<std::uint8_t, sizeof(element_type)> _object_buf;
+    alignas(element_type) std::array<std::uint8_t, sizeof(element_type)> _object_buf;
 
-    std::uint32_t _count;
+    std::atomic<std::uint32_t> _count {};
     std::mutex _lock;
   };
 
@@ -505,53 +1029,92 @@ namespace safe {
     template<class T>
     using queue_t = std::shared_ptr<post_t<queue_t<T>>>;
 
-    template<class T>
-    event_t<T> event(const std::string_view &id) {
-      std::lock_guard lg {mutex};
+    /// The most posts a mail holds, the ids of the posts are below it
+    static constexpr std::size_t MAX_POSTS = 16;
 
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<event_t<T>>(it->second);
-      }
+    using options_t = std::array<queue_options_t, MAX_POSTS>;
 
-      auto post = std::make_shared<typename event_t<T>::element_type>(shared_from_this());
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
+    mail_raw_t() = default;
 
-      return post;
+    /**
+     * @param queue_options The options of the queues, indexed by the id of their post.
+     */
+    explicit mail_raw_t(const options_t &queue_options):
+        _queue_options {queue_options} {
     }
 
     template<class T>
-    queue_t<T> queue(const std::string_view &id) {
-      std::lock_guard lg {mutex};
+    event_t<T> event(std::size_t id) {
+      return post<event_t<T>>(id);
+    }
 
-      auto it = id_to_post.find(id);
-      if (it != std::end(id_to_post)) {
-        return lock<queue_t<T>>(it->second);
-      }
+    template<class T>
+    queue_t<T> queue(std::size_t id) {
+      auto &options = _queue_options[id];
+      return post<queue_t<T>>(id, options.max_elements, options.overflow);
+    }
 
-      auto post = std::make_shared<typename queue_t<T>::element_type>(shared_from_this(), 32);
-      id_to_post.emplace(std::pair<std::string, std::weak_ptr<void>> {std::string {id}, post});
+    /**
+     * @brief Get the counters of a queue.
+     * @param id The id of the queue.
+     * @return The counters, or `std::nullopt` if the queue doesn't exist.
+     */
+    std::optional<queue_stats_t> queue_stats(std::size_t id) {
+      std::function<std::optional<queue_stats_t>()> stats;
+      {
+        std::lock_guard lg {mutex};
+        stats = _queue_stats[id];
+      }
 
-      return post;
+      return stats ? stats() : std::nullopt;
     }
 
+    /**
+     * @brief Forget the posts that were destroyed.
+     */
     void cleanup() {
       std::lock_guard lg {mutex};
 
-      for (auto it = std::begin(id_to_post); it != std::end(id_to_post); ++it) {
-        auto &weak = it->second;
+      for (std::size_t id = 0; id < MAX_POSTS; ++id) {
+        if (posts[id].expired()) {
+          posts[id].reset();
+          _queue_stats[id] = nullptr;
+        }
+      }
+    }
 
-        if (weak.expired()) {
-          id_to_post.erase(it);
+  private:
+    template<class P, class... Args>
+    P post(std::size_t id, Args &&...args) {
+      std::lock_guard lg {mutex};
 
-          return;
-        }
+      auto &weak = posts[id];
+      if (auto post = lock<P>(weak)) {
+        return post;
+      }
+
+      auto post = std::make_shared<typename P::element_type>(shared_from_this(), std::forward<Args>(args)...);
+      weak = post;
+
+      if constexpr (requires { post->stats(); }) {
+        _queue_stats[id] = [weak_post = std::weak_ptr {post}]() -> std::optional<queue_stats_t> {
+          if (auto post = weak_post.lock()) {
+            return post->stats();
+          }
+
+          return std::nullopt;
+        };
       }
+
+      return post;
     }
 
     std::mutex mutex;
 
-    std::map<std::string, std::weak_ptr<void>, std::less<>> id_to_post;
+    // Indexed by the id of the post
+    std::array<std::weak_ptr<void>, MAX_POSTS> posts;
+    std::array<std::function<std::optional<queue_stats_t>()>, MAX_POSTS> _queue_stats;
+    options_t _queue_options {};
   };
 
   inline void cleanup(mail_raw_t *mail) {
@@ -0,0 +1,217 @@
+/**
+ * @file src/timeline.cpp
+ * @brief Definitions for the timeline of the pipeline stages, in the Chrome trace event format.
+ */
+// standard includes
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "timeline.h"
+
+namespace timeline {
+  std::atomic<bool> recording {false};
+
+  namespace {
+    /// The rings of the threads that ended are dropped past this many rings
+    constexpr std::size_t MAX_RINGS = 64;
+
+    /**
+     * @brief An event, guarded by a sequence number so a reader can tell it was overwritten while read.
+     */
+    struct slot_t {
+      std::atomic<std::uint64_t> sequence {0};
+      std::atomic<const char *> name {nullptr};
+      std::atomic<std::int64_t> frame {0};
+      std::atomic<std::int64_t> begin_ns {0};
+      std::atomic<std::int64_t> end_ns {0};
+    };
+
+    /**
+     * @brief The events of a thread, written by that thread only.
+     */
+    struct ring_t {
+      std::uint32_t tid;
+      std::atomic<bool> finished {false};
+
+      std::mutex name_lock;
+      std::string name;
+
+      std::atomic<std::uint64_t> written {0};
+      std::array<slot_t, EVENTS_PER_THREAD> slots;
+    };
+
+    std::mutex rings_lock;
+    std::vector<std::shared_ptr<ring_t>> rings;
+    std::uint32_t next_tid = 1;
+
+    // Only the events after the start of the recording are dumped
+    std::atomic<std::int64_t> recording_start_ns {0};
+
+    /**
+     * @brief The ring of the calling thread, flagged when the thread ends.
+     */
+    struct thread_ring_t {
+      std::shared_ptr<ring_t> ring;
+      std::string name;
+
+      ~thread_ring_t() {
+        if (ring) {
+          ring->finished = true;
+        }
+      }
+    };
+
+    thread_local thread_ring_t thread_ring;
+
+    std::int64_t to_ns(time_point point) {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(point.time_since_epoch()).count();
+    }
+
+    ring_t &local_ring() {
+      if (thread_ring.ring) {
+        return *thread_ring.ring;
+      }
+
+      auto ring = std::make_shared<ring_t>();
+      ring->name = thread_ring.name;
+
+      {
+        std::lock_guard lg {rings_lock};
+
+        ring->tid = next_tid++;
+        if (rings.size() >= MAX_RINGS) {
+          std::erase_if(rings, [](const auto &ring) {
+            return ring->finished.load();
+          });
+        }
+        rings.emplace_back(ring);
+      }
+
+      thread_ring.ring = std::move(ring);
+      return *thread_ring.ring;
+    }
+  }  // namespace
+
+  void set_recording(bool enable) {
+    if (enable) {
+      recording_start_ns = to_ns(std::chrono::steady_clock::now());
+    }
+
+    recording.store(enable, std::memory_order_relaxed);
+  }
+
+  void set_thread_name(std::string_view name) {
+    thread_ring.name = name;
+
+    if (thread_ring.ring) {
+      std::lock_guard lg {thread_ring.ring->name_lock};
+      thread_ring.ring->name = name;
+    }
+  }
+
+  void record(const char *name, std::int64_t frame, time_point begin, time_point end) {
+    if (!is_recording()) {
+      return;
+    }
+
+    auto &ring = local_ring();
+
+    auto index = ring.written.load(std::memory_order_relaxed);
+    auto &slot = ring.slots[index % EVENTS_PER_THREAD];
+
+    // An odd sequence number tells the readers the slot is being written
+    slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.frame.store(frame, std::memory_order_relaxed);
+    slot.begin_ns.store(to_ns(begin), std::memory_order_relaxed);
+    slot.end_ns.store(to_ns(end), std::memory_order_relaxed);
+
+    slot.sequence.store(index * 2 + 2, std::memory_order_release);
+    ring.written.store(index + 1, std::memory_order_release);
+  }
+
+  std::string dump() {
+    std::vector<std::shared_ptr<ring_t>> live_rings;
+    {
+      std::lock_guard lg {rings_lock};
+      live_rings = rings;
+    }
+
+    auto start_ns = recording_start_ns.load();
+
+    nlohmann::json events = nlohmann::json::array();
+    events.push_back({
+      {"name", "process_name"},
+      {"ph", "M"},
+      {"pid", 1},
+      {"args", {{"name", "Sunshine"}}},
+    });
+
+    for (auto &ring : live_rings) {
+      std::string thread_name;
+      {
+        std::lock_guard lg {ring->name_lock};
+        thread_name = ring->name.empty() ? "thread " + std::to_string(ring->tid) : ring->name;
+      }
+
+      events.push_back({
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"pid", 1},
+        {"tid", ring->tid},
+        {"args", {{"name", thread_name}}},
+      });
+
+      auto written = ring->written.load(std::memory_order_acquire);
+      auto first = written > EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+      for (auto index = first; index < written; ++index) {
+        auto &slot = ring->slots[index % EVENTS_PER_THREAD];
+
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != index * 2 + 2) {
+          // Already overwritten by a newer event
+          continue;
+        }
+
+        auto name = slot.name.load(std::memory_order_relaxed);
+        auto frame = slot.frame.load(std::memory_order_relaxed);
+        auto begin_ns = slot.begin_ns.load(std::memory_order_relaxed);
+        auto end_ns = slot.end_ns.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence || begin_ns < start_ns) {
+          continue;
+        }
+
+        // Complete events, the begin and the duration in microseconds
+        nlohmann::json event {
+          {"name", name},
+          {"cat", "pipeline"},
+          {"ph", "X"},
+          {"pid", 1},
+          {"tid", ring->tid},
+          {"ts", begin_ns / 1000.},
+          {"dur", (end_ns - begin_ns) / 1000.},
+        };
+        if (frame != NO_FRAME) {
+          event["args"] = {{"frame", frame}};
+        }
+
+        events.push_back(std::move(event));
+      }
+    }
+
+    nlohmann::json trace;
+    trace["traceEvents"] = std::move(events);
+    trace["displayTimeUnit"] = "ms";
+    return trace.dump();
+  }
+}  // namespace timeline
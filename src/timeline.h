@@ -0,0 +1,116 @@
+/**
+ * @file src/timeline.h
+ * @brief Declarations for the timeline of the pipeline stages, in the Chrome trace event format.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace timeline {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  /// The number of most recent events kept for each thread
+  constexpr std::size_t EVENTS_PER_THREAD = 8192;
+
+  /// The id of an event that isn't about a frame
+  constexpr std::int64_t NO_FRAME = -1;
+
+  /**
+   * @brief Whether the events are recorded.
+   */
+  extern std::atomic<bool> recording;
+
+  /**
+   * @brief Start or stop recording the events.
+   * @details Starting drops the events of the previous recording.
+   * @param enable `true` to start recording.
+   */
+  void set_recording(bool enable);
+
+  /**
+   * @brief Check whether the events are recorded.
+   * @return `true` if they are.
+   */
+  inline bool is_recording() {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Name the calling thread in the timeline.
+   * @param name The name, like "video_send".
+   */
+  void set_thread_name(std::string_view name);
+
+  /**
+   * @brief Record a stage that ran on the calling thread.
+   * @details Only the thread itself writes to its ring, so this doesn't take any lock.
+   * @param name The name of the stage. It must outlive the recording, like a string literal.
+   * @param frame The index of the frame, or NO_FRAME.
+   * @param begin When the stage began.
+   * @param end When the stage ended.
+   */
+  void record(const char *name, std::int64_t frame, time_point begin, time_point end);
+
+  /**
+   * @brief Records the stage running from its construction to its destruction.
+   * @examples
+   * {
+   *   timeline::scope_t scope {"encode", frame_nr};
+   *   // ...
+   * }
+   * @examples_end
+   */
+  class scope_t {
+  public:
+    scope_t(const char *name, std::int64_t frame = NO_FRAME):
+        name {name},
+        frame {frame},
+        active {is_recording()} {
+      if (active) {
+        begin = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~scope_t() {
+      end();
+    }
+
+    scope_t(const scope_t &) = delete;
+    scope_t &operator=(const scope_t &) = delete;
+
+    /**
+     * @brief Set the frame once it's known.
+     * @param frame The index of the frame.
+     */
+    void set_frame(std::int64_t frame) {
+      this->frame = frame;
+    }
+
+    /**
+     * @brief End the stage before the scope does.
+     */
+    void end() {
+      if (active) {
+        record(name, frame, begin, std::chrono::steady_clock::now());
+        active = false;
+      }
+    }
+
+  private:
+    const char *name;
+    std::int64_t frame;
+    bool active;
+    time_point begin;
+  };
+
+  /**
+   * @brief Get the recorded events of all the threads.
+   * @return The events as a Chrome trace event JSON document, which Perfetto opens too.
+   */
+  std::string dump();
+}  // namespace timeline
@@ -3,9 +3,14 @@
  * @brief Definitions for UPnP port mapping.
  */
 // standard includes
+#include <filesystem>
+#include <future>
+#include <optional>
 #include <stddef.h>  // workaround for type_t error in miniupnpc 2.3.3, see https://github.com/miniupnp/miniupnp/commit/e263ab6f56c382e10fed31347ec68095d691a0e8
 
 // lib includes
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/upnpcommands.h>
 
@@ -22,6 +27,8 @@
 #include "utility.h"
 
 using namespace std::literals;
+namespace fs = std::filesystem;
+namespace pt = boost::property_tree;
 
 namespace upnp {
 
@@ -33,8 +40,82 @@ namespace upnp {
     } port;
 
     std::string description;
+
+    // The mapping is only checked again once its lease is about to expire
+    std::chrono::steady_clock::time_point verify_at {};
   };
 
+  /**
+   * @brief The IGD the ports are mapped on.
+   */
+  struct igd_t {
+    urls_t urls;
+    IGDdatas data;
+    std::string lan_addr;
+
+    // The IGD forgets its mappings when it reboots, which its uptime going back tells
+    unsigned int uptime;
+  };
+
+  /**
+   * @brief Where the IGD found last time is cached, to reach it again without discovering it.
+   */
+  fs::path igd_cache_path() {
+    return fs::path {config::nvhttp.file_state}.parent_path() / "upnp_cache.json";
+  }
+
+  /**
+   * @brief Reach the IGD found last time at its cached address.
+   * @return The IGD, or `std::nullopt` if it can't be reached there anymore.
+   */
+  std::optional<igd_t> load_cached_igd() {
+    auto path = igd_cache_path();
+    if (!fs::exists(path)) {
+      return std::nullopt;
+    }
+
+    std::string rootdesc_url;
+    std::string cached_lan_addr;
+    try {
+      pt::ptree tree;
+      pt::read_json(path.string(), tree);
+
+      rootdesc_url = tree.get<std::string>("rootdesc_url");
+      cached_lan_addr = tree.get<std::string>("lan_addr");
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << path << ": "sv << e.what();
+      return std::nullopt;
+    }
+
+    igd_t igd {};
+    std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+    if (UPNP_GetIGDFromUrl(rootdesc_url.c_str(), &igd.urls.el, &igd.data, lan_addr.data(), lan_addr.size()) != 1) {
+      BOOST_LOG(debug) << "Cached IGD isn't reachable anymore: "sv << rootdesc_url;
+      return std::nullopt;
+    }
+
+    igd.lan_addr = lan_addr.data();
+    if (igd.lan_addr != cached_lan_addr) {
+      BOOST_LOG(info) << "LAN address changed from "sv << cached_lan_addr << " to "sv << igd.lan_addr;
+    }
+
+    BOOST_LOG(debug) << "Reached the cached IGD device: "sv << rootdesc_url;
+    return igd;
+  }
+
+  void save_igd_cache(const igd_t &igd) {
+    pt::ptree tree;
+    tree.put("rootdesc_url"s, igd.urls->rootdescURL);
+    tree.put("lan_addr"s, igd.lan_addr);
+
+    auto path = igd_cache_path();
+    try {
+      pt::write_json(path.string(), tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't write "sv << path << ": "sv << e.what();
+    }
+  }
+
   static std::string_view status_string(int status) {
     switch (status) {
       case 0:
@@ -134,7 +215,8 @@ namespace upnp {
             auto shutdown_event = mail::man->event<bool>(mail::shutdown);
 
             for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
-              auto mapping = *it;
+              // Only the ports are read, the mapping threads update when the mappings are checked again
+              auto &mapping = *it;
               char uniqueId[8];
 
               // Open a pinhole for the LAN port, since there will be no WAN->LAN port mapping on IPv6
@@ -166,10 +248,10 @@ namespace upnp {
      * @param data IGDdatas from UPNP_GetValidIGD()
      * @param urls urls_t from UPNP_GetValidIGD()
      * @param lan_addr Local IP address to map to
-     * @param mapping Information about port to map
+     * @param mapping Information about port to map, when to check it again is updated
      * @return `true` on success.
      */
-    bool map_upnp_port(const IGDdatas &data, const urls_t &urls, const std::string &lan_addr, const mapping_t &mapping) {
+    bool map_upnp_port(const IGDdatas &data, const urls_t &urls, const std::string &lan_addr, mapping_t &mapping) {
       char intClient[16];
       char intPort[6];
       char desc[80];
@@ -198,13 +280,21 @@ namespace upnp {
       } else if (err == UPNPCOMMAND_SUCCESS) {
         // Some routers change the description, so we can't check that here
         if (!std::strcmp(intClient, lan_addr.c_str())) {
-          if (std::atoi(leaseDuration) == 0) {
+          auto remaining = std::chrono::seconds {std::atoi(leaseDuration)};
+          if (remaining.count() == 0) {
             BOOST_LOG(debug) << "Static mapping entry found for "sv << mapping.port.wan;
 
             // It's a static mapping, so we're done here
+            mapping.verify_at = std::chrono::steady_clock::now() + PORT_MAPPING_LIFETIME;
             return true;
-          } else {
+          } else if (remaining > 2 * REFRESH_INTERVAL) {
             BOOST_LOG(debug) << "Mapping entry found for "sv << mapping.port.wan << " ("sv << leaseDuration << " seconds remaining)"sv;
+
+            // The lease is renewed on the refresh before it expires
+            mapping.verify_at = std::chrono::steady_clock::now() + remaining - REFRESH_INTERVAL;
+            return true;
+          } else {
+            BOOST_LOG(debug) << "Renewing mapping entry for "sv << mapping.port.wan << " ("sv << leaseDuration << " seconds remaining)"sv;
           }
         } else {
           BOOST_LOG(warning) << "UPnP conflict detected with: "sv << intClient;
@@ -250,6 +340,7 @@ namespace upnp {
       if (err != UPNPCOMMAND_SUCCESS && !indefinite) {
         // This may be an old/broken IGD that doesn't like non-static mappings.
         BOOST_LOG(debug) << "Trying static mapping after failure: "sv << err;
+        indefinite = true;
         err = UPNP_AddPortMapping(
           urls->controlURL,
           data.first.servicetype,
@@ -269,6 +360,9 @@ namespace upnp {
       }
 
       BOOST_LOG(debug) << "Successfully mapped "sv << mapping.port.proto << ' ' << mapping.port.lan;
+
+      // Static mappings are checked as often as leased ones are renewed, in case the IGD forgot them
+      mapping.verify_at = std::chrono::steady_clock::now() + PORT_MAPPING_LIFETIME - (indefinite ? 0s : REFRESH_INTERVAL);
       return true;
     }
 
@@ -295,69 +389,147 @@ namespace upnp {
       }
     }
 
+    /**
+     * @brief Find the IGD, at the address it had last time if it's still there.
+     * @return The IGD, or `std::nullopt` if none was found.
+     */
+    std::optional<igd_t> find_igd() {
+      // Reaching the IGD at its cached address spares the multicast discovery and its timeout
+      if (auto igd = load_cached_igd()) {
+        return igd;
+      }
+
+      int err = 0;
+      device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
+      if (!device || err) {
+        BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
+        return std::nullopt;
+      }
+
+      for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
+        BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+      }
+
+      std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+
+      igd_t igd {};
+      auto status = upnp::UPNP_GetValidIGDStatus(device, &igd.urls, &igd.data, lan_addr);
+      if (status != 1 && status != 2) {
+        BOOST_LOG(error) << status_string(status);
+        return std::nullopt;
+      }
+
+      igd.lan_addr = lan_addr.data();
+
+      BOOST_LOG(debug) << "Found valid IGD device: "sv << igd.urls->rootdescURL;
+
+      save_igd_cache(igd);
+      return igd;
+    }
+
+    /**
+     * @brief Get the uptime of the IGD.
+     * @return The uptime in seconds, or `std::nullopt` if the IGD didn't answer.
+     */
+    static std::optional<unsigned int> igd_uptime(igd_t &igd) {
+      char status[64];
+      char last_error[64];
+      unsigned int uptime = 0;
+
+      auto err = UPNP_GetStatusInfo(igd.urls->controlURL, igd.data.first.servicetype, status, &uptime, last_error);
+      if (err != UPNPCOMMAND_SUCCESS) {
+        BOOST_LOG(debug) << "UPNP_GetStatusInfo() failed: "sv << err;
+        return std::nullopt;
+      }
+
+      return uptime;
+    }
+
     /**
      * @brief Maintains UPnP port forwarding rules
+     * @details The IGD is only discovered again when it stops answering, and each mapping is only
+     *          checked again when its lease is about to expire or the IGD rebooted since it was mapped.
      */
     void upnp_thread_proc() {
       auto shutdown_event = mail::man->event<bool>(mail::shutdown);
       bool mapped = false;
-      IGDdatas data;
-      urls_t mapped_urls;
+      std::optional<igd_t> igd;
       auto address_family = net::af_from_enum_string(config::sunshine.address_family);
 
+      // The pinholes are leased like the mappings
+      std::chrono::steady_clock::time_point pinholes_at {};
+
       // Refresh UPnP rules every few minutes. They can be lost if the router reboots,
       // WAN IP address changes, or various other conditions.
       do {
-        int err = 0;
-        device_t device {upnpDiscover(2000, nullptr, nullptr, 0, IPv4, 2, &err)};
-        if (!device || err) {
-          BOOST_LOG(warning) << "Couldn't discover any IPv4 UPNP devices"sv;
+        auto uptime = igd ? igd_uptime(*igd) : std::nullopt;
+        if (igd && !uptime) {
+          BOOST_LOG(info) << "UPnP IGD device stopped answering, looking for it again"sv;
+          igd.reset();
+        }
+
+        if (!igd) {
+          igd = find_igd();
+          if (!igd) {
+            mapped = false;
+            continue;
+          }
+
+          uptime = igd_uptime(*igd);
           mapped = false;
-          continue;
         }
 
-        for (auto dev = device.get(); dev != nullptr; dev = dev->pNext) {
-          BOOST_LOG(debug) << "Found device: "sv << dev->descURL;
+        // A rebooted IGD, or another one, doesn't have any of the mappings
+        if (!mapped || (uptime && *uptime < igd->uptime)) {
+          for (auto &mapping : mappings) {
+            mapping.verify_at = {};
+          }
+          pinholes_at = {};
         }
+        igd->uptime = uptime.value_or(0);
 
-        std::array<char, INET6_ADDRESS_STRLEN> lan_addr;
+        auto now = std::chrono::steady_clock::now();
 
-        urls_t urls;
-        auto status = upnp::UPNP_GetValidIGDStatus(device, &urls, &data, lan_addr);
-        if (status != 1 && status != 2) {
-          BOOST_LOG(error) << status_string(status);
-          mapped = false;
-          continue;
+        // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
+        std::future<bool> pinholes;
+        if (address_family == net::af_e::BOTH && now >= pinholes_at) {
+          pinholes = std::async(std::launch::async, &deinit_t::create_ipv6_pinholes, this);
+          pinholes_at = now + PORT_MAPPING_LIFETIME - REFRESH_INTERVAL;
         }
 
-        std::string lan_addr_str {lan_addr.data()};
+        // The mappings are independent requests, the IGD answers them at the same time
+        std::vector<std::future<bool>> mapped_ports;
+        for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
+          if (now < it->verify_at) {
+            continue;
+          }
 
-        BOOST_LOG(debug) << "Found valid IGD device: "sv << urls->rootdescURL;
+          mapped_ports.emplace_back(std::async(std::launch::async, [this, &igd, &mapping = *it]() {
+            return map_upnp_port(igd->data, igd->urls, igd->lan_addr, mapping);
+          }));
+        }
 
-        for (auto it = std::begin(mappings); it != std::end(mappings) && !shutdown_event->peek(); ++it) {
-          map_upnp_port(data, urls, lan_addr_str, *it);
+        bool all_mapped = true;
+        for (auto &future : mapped_ports) {
+          all_mapped = future.get() && all_mapped;
         }
 
-        if (!mapped) {
-          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << lan_addr_str << " via "sv << urls->rootdescURL;
+        if (!mapped && all_mapped) {
+          BOOST_LOG(info) << "Completed UPnP port mappings to "sv << igd->lan_addr << " via "sv << igd->urls->rootdescURL;
         }
 
-        // If we are listening on IPv6 and the IGD has an IPv6 firewall enabled, try to create IPv6 firewall pinholes
-        if (address_family == net::af_e::BOTH) {
-          if (create_ipv6_pinholes() && !mapped) {
-            // Only log the first time through
-            BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
-          }
+        if (pinholes.valid() && pinholes.get() && !mapped) {
+          // Only log the first time through
+          BOOST_LOG(info) << "Successfully opened IPv6 pinholes on the IGD"sv;
         }
 
         mapped = true;
-        mapped_urls = std::move(urls);
       } while (!shutdown_event->view(REFRESH_INTERVAL));
 
       if (mapped) {
         // Unmap ports upon termination
         BOOST_LOG(info) << "Unmapping UPNP ports..."sv;
-        unmap_all_upnp_ports(mapped_urls, data);
+        unmap_all_upnp_ports(igd->urls, igd->data);
       }
     }
 
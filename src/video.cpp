@@ -3,16 +3,28 @@
  * @brief Definitions for video.
  */
 // standard includes
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <bitset>
+#include <cmath>
+#include <filesystem>
+#include <future>
+#include <iomanip>
+#include <iostream>
 #include <list>
+#include <map>
 #include <thread>
 
 // lib includes
 #include <boost/pointer_cast.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
 
 extern "C" {
 #include <libavutil/imgutils.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/mastering_display_metadata.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
@@ -20,14 +32,22 @@ extern "C" {
 
 // local includes
 #include "cbs.h"
+#include "color_convert.h"
 #include "config.h"
+#include "crypto.h"
 #include "display_device.h"
+#include "file_handler.h"
 #include "globals.h"
+#include "image_pool.h"
 #include "input.h"
 #include "logging.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
+#include "stat_trackers.h"
 #include "sync.h"
+#include "thread_affinity.h"
+#include "thread_pool.h"
+#include "timeline.h"
 #include "video.h"
 
 #ifdef _WIN32
@@ -37,6 +57,8 @@ extern "C" {
 #endif
 
 using namespace std::literals;
+namespace fs = std::filesystem;
+namespace pt = boost::property_tree;
 
 namespace video {
 
@@ -123,9 +145,38 @@ namespace video {
   util::Either<avcodec_buffer_t, int> cuda_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
   util::Either<avcodec_buffer_t, int> vt_init_avcodec_hardware_input_buffer(platf::avcodec_encode_device_t *);
 
+  /**
+   * @brief Get the layout the color conversion of software encoding converts to.
+   * @param format The software format of the encoder.
+   * @return The layout, or `std::nullopt` if the format is left to swscale.
+   */
+  std::optional<color_convert::format_e> color_convert_format(AVPixelFormat format) {
+    switch (format) {
+      case AV_PIX_FMT_NV12:
+        return color_convert::format_e::nv12;
+      case AV_PIX_FMT_P010:
+        return color_convert::format_e::p010;
+      case AV_PIX_FMT_YUV420P:
+        return color_convert::format_e::yuv420p;
+      case AV_PIX_FMT_YUV420P10:
+        return color_convert::format_e::yuv420p10;
+      case AV_PIX_FMT_YUV444P:
+        return color_convert::format_e::yuv444p;
+      case AV_PIX_FMT_YUV444P10:
+        return color_convert::format_e::yuv444p10;
+      default:
+        return std::nullopt;
+    }
+  }
+
   class avcodec_software_encode_device_t: public platf::avcodec_encode_device_t {
   public:
     int convert(platf::img_t &img) override {
+      if (converter) {
+        converter->convert(img.data, img.row_pitch, sw_frame->data, sw_frame->linesize);
+        return transfer_frame();
+      }
+
       // If we need to add aspect ratio padding, we need to scale into an intermediate output buffer
       bool requires_padding = (sw_frame->width != sws_output_frame->width || sw_frame->height != sws_output_frame->height);
 
@@ -157,8 +208,14 @@ namespace video {
         }
       }
 
-      // If frame is not a software frame, it means we still need to transfer from main memory
-      // to vram memory
+      return transfer_frame();
+    }
+
+    /**
+     * If frame is not a software frame, it means we still need to transfer from main memory
+     * to vram memory
+     */
+    int transfer_frame() {
       if (frame->hw_frames_ctx) {
         auto status = av_hwframe_transfer_data(frame, sw_frame.get(), 0);
         if (status < 0) {
@@ -189,6 +246,13 @@ namespace video {
     }
 
     void apply_colorspace() override {
+      if (converter) {
+        auto converter_colorspace = colorspace;
+        converter_colorspace.bit_depth = converter->bit_depth();
+        converter->set_colorspace(*new_color_vectors_from_colorspace(converter_colorspace));
+        return;
+      }
+
       auto avcodec_colorspace = avcodec_colorspace_from_sunshine_colorspace(colorspace);
       sws_setColorspaceDetails(sws.get(), sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(avcodec_colorspace.software_format), avcodec_colorspace.range - 1, 0, 1 << 16, 1 << 16);
     }
@@ -241,6 +305,15 @@ namespace video {
       offsetW = (frame->width - out_width) / 2;
       offsetH = (frame->height - out_height) / 2;
 
+      // Images that don't need scaling are converted without swscale
+      auto converter_format = color_convert_format(format);
+      if (in_width == frame->width && in_height == frame->height && converter_format && color_convert::converter_t::supports(*converter_format, in_width, in_height)) {
+        converter = std::make_unique<color_convert::converter_t>(*converter_format, in_width, in_height, std::max(config::video.min_threads, 1));
+
+        BOOST_LOG(debug) << "Converting captured images with the "sv << color_convert::isa_name(color_convert::supported_isas().back()) << " color conversion"sv;
+        return 0;
+      }
+
       sws.reset(sws_alloc_context());
       if (!sws) {
         return -1;
@@ -282,6 +355,9 @@ namespace video {
     avcodec_frame_t sws_output_frame;
     sws_t sws;
 
+    // Replaces swscale when the image needs no scaling
+    std::unique_ptr<color_convert::converter_t> converter;
+
     // Offset of input image to output frame in pixels
     int offsetW;
     int offsetH;
@@ -327,8 +403,11 @@ namespace video {
       replacements = std::move(other.replacements);
       sps = std::move(other.sps);
       vps = std::move(other.vps);
+      packet_pool = std::move(other.packet_pool);
 
       inject = other.inject;
+      max_frame_size = other.max_frame_size;
+      framerate = other.framerate;
 
       return *this;
     }
@@ -357,8 +436,84 @@ namespace video {
     }
 
     void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) override {
-      BOOST_LOG(error) << "Encoder doesn't support reference frame invalidation";
-      request_idr_frame();
+      // libavcodec doesn't let the caller mark or pick the reference frames of AMF, QSV or VA-API,
+      // so the clients are told RFI isn't supported and the frames are only recovered with an IDR frame
+      BOOST_LOG(debug) << "Encoder doesn't support reference frame invalidation, recovering frames " << first_frame << "-" << last_frame;
+      request_recovery_frame();
+    }
+
+    bool set_bitrate(int bitrate) override {
+      // Only these pick up rate control changes between frames
+      static const std::array<std::string_view, 7> dynamic_bitrate_codecs {
+        "libx264"sv,
+        "h264_nvenc"sv,
+        "hevc_nvenc"sv,
+        "av1_nvenc"sv,
+        "h264_qsv"sv,
+        "hevc_qsv"sv,
+        "av1_qsv"sv,
+      };
+
+      auto ctx = avcodec_ctx.get();
+      if (!ctx || !ctx->rc_max_rate || std::find(std::begin(dynamic_bitrate_codecs), std::end(dynamic_bitrate_codecs), ctx->codec->name) == std::end(dynamic_bitrate_codecs)) {
+        return false;
+      }
+
+      std::int64_t new_rate = bitrate * 1000LL;
+
+      // Keep the buffer the same number of frames long, within what the link delivers in a frame interval
+      if (ctx->rc_buffer_size) {
+        ctx->rc_buffer_size = (int) (ctx->rc_buffer_size * new_rate / ctx->rc_max_rate);
+        if (framerate) {
+          ctx->rc_buffer_size = (int) cap_frame_size(ctx->rc_buffer_size, new_rate / framerate, max_frame_size);
+        }
+      }
+
+      // Encoders simulating CBR run just below the maximum
+      ctx->bit_rate = ctx->bit_rate < ctx->rc_max_rate ? new_rate - 1 : new_rate;
+      if (ctx->rc_min_rate) {
+        ctx->rc_min_rate = new_rate;
+      }
+      ctx->rc_max_rate = new_rate;
+
+      return true;
+    }
+
+    bool set_framerate(int framerate) override {
+      // The rate control of libavcodec encoders is set up for the frame rate they're opened with
+      return false;
+    }
+
+    void set_regions_of_interest(const std::vector<platf::damage_rect_t> &regions) override {
+      if (!device || !device->frame) {
+        return;
+      }
+
+      // The side data stays on the frame, so the repeated frames keep it too.
+      // libx264, libx265, QSV and VA-API read it, AMF and NVENC through libavcodec ignore it.
+      auto frame = device->frame;
+      av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+      if (regions.empty()) {
+        return;
+      }
+
+      auto side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, regions.size() * sizeof(AVRegionOfInterest));
+      if (!side_data) {
+        return;
+      }
+
+      auto rois = (AVRegionOfInterest *) side_data->data;
+      for (std::size_t x = 0; x < regions.size(); ++x) {
+        auto &region = regions[x];
+        rois[x].self_size = sizeof(AVRegionOfInterest);
+        rois[x].left = region.x;
+        rois[x].top = region.y;
+        rois[x].right = region.x + region.width;
+        rois[x].bottom = region.y + region.height;
+
+        // The offset is relative to the QP range, which is 0-51 for H.264 and HEVC
+        rois[x].qoffset = av_make_q(-config::video.roi_qp_delta, 51);
+      }
     }
 
     avcodec_ctx_t avcodec_ctx;
@@ -371,14 +526,39 @@ namespace video {
 
     // inject sps/vps data into idr pictures
     int inject;
+
+    // The largest frame in bits the link delivers within a frame interval, 0 for no cap
+    std::int64_t max_frame_size {};
+    int framerate {};
+
+    // Reused for the encoded frames, the packets return to it after they're sent
+    std::shared_ptr<av_packet_pool_t> packet_pool = std::make_shared<av_packet_pool_t>();
   };
 
   class nvenc_encode_session_t: public encode_session_t {
   public:
+    /**
+     * @brief A frame that was submitted to the encoder and is waiting to be retrieved.
+     */
+    struct submitted_frame_t {
+      int64_t frame_index;
+      void *channel_data;
+      std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+      std::optional<std::chrono::steady_clock::time_point> convert_timestamp;
+    };
+
     nvenc_encode_session_t(std::unique_ptr<platf::nvenc_encode_device_t> encode_device):
         device(std::move(encode_device)) {
     }
 
+    ~nvenc_encode_session_t() override {
+      // The frames are retrieved from the device, so it must outlive the thread
+      submitted_frames.stop();
+      if (retrieve_thread.joinable()) {
+        retrieve_thread.join();
+      }
+    }
+
     int convert(platf::img_t &img) override {
       if (!device) {
         return -1;
@@ -390,6 +570,12 @@ namespace video {
       force_idr = true;
     }
 
+    void request_recovery_frame() override {
+      if (force_idr || !device || !device->nvenc || !device->nvenc->start_intra_refresh()) {
+        force_idr = true;
+      }
+    }
+
     void request_normal_frame() override {
       force_idr = false;
     }
@@ -400,7 +586,29 @@ namespace video {
       }
 
       if (!device->nvenc->invalidate_ref_frames(first_frame, last_frame)) {
-        force_idr = true;
+        request_recovery_frame();
+      }
+    }
+
+    bool set_bitrate(int bitrate) override {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      return device->nvenc->set_bitrate(bitrate);
+    }
+
+    bool set_framerate(int framerate) override {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      return device->nvenc->set_framerate(framerate);
+    }
+
+    void set_regions_of_interest(const std::vector<platf::damage_rect_t> &regions) override {
+      if (device && device->nvenc) {
+        device->nvenc->set_regions_of_interest(regions);
       }
     }
 
@@ -409,11 +617,41 @@ namespace video {
         return {};
       }
 
-      auto result = device->nvenc->encode_frame(frame_index, force_idr);
+      auto result = device->nvenc->encode_frame(frame_index, force_idr, frame_buffers->acquire());
+      force_idr = false;
+      return result;
+    }
+
+    bool submit_frame(uint64_t frame_index) {
+      if (!device || !device->nvenc) {
+        return false;
+      }
+
+      auto result = device->nvenc->submit_frame(frame_index, force_idr);
       force_idr = false;
       return result;
     }
 
+    nvenc::nvenc_encoded_frame retrieve_frame() {
+      if (!device || !device->nvenc) {
+        return {};
+      }
+
+      return device->nvenc->retrieve_frame(frame_buffers->acquire());
+    }
+
+    bool can_pipeline() const {
+      return device && device->nvenc && device->nvenc->can_pipeline();
+    }
+
+    // Reused for the encoded frames, the packets return them after they're sent
+    std::shared_ptr<frame_buffer_pool_t> frame_buffers = std::make_shared<frame_buffer_pool_t>();
+
+    // Set while encoded frames are retrieved on a thread of their own
+    safe::queue_t<submitted_frame_t> submitted_frames {8};
+    std::thread retrieve_thread;
+    std::atomic_bool retrieve_failed {false};
+
   private:
     std::unique_ptr<platf::nvenc_encode_device_t> device;
     bool force_idr = false;
@@ -426,6 +664,9 @@ namespace video {
     safe::mail_raw_t::event_t<bool> idr_events;
     safe::mail_raw_t::event_t<hdr_info_t> hdr_events;
     safe::mail_raw_t::event_t<input::touch_port_t> touch_port_events;
+    safe::mail_raw_t::event_t<int> bitrate_events;
+    safe::mail_raw_t::event_t<int> switch_display_events;
+    safe::mail_raw_t::event_t<std::string> capture_display_events;
 
     config_t config;
     int frame_nr;
@@ -433,8 +674,23 @@ namespace video {
   };
 
   struct sync_session_t {
+    sync_session_t() = default;
+    sync_session_t(sync_session_t &&other) noexcept = default;
+
+    ~sync_session_t() {
+      // The encoder is destroyed on the thread it was opened and used from
+      if (worker && session) {
+        worker->push([this]() {
+          session.reset();
+        }).wait();
+      }
+    }
+
     sync_session_ctx_t *ctx;
     std::unique_ptr<encode_session_t> session;
+
+    // Converts and encodes the frames of this session when encoder_session_threads is enabled
+    std::unique_ptr<thread_pool_util::ThreadPool> worker;
   };
 
   using encode_session_ctx_queue_t = safe::queue_t<sync_session_ctx_t>;
@@ -452,6 +708,16 @@ namespace video {
     safe::signal_t reinit_event;
     const encoder_t *encoder_p;
     sync_util::sync_t<std::weak_ptr<platf::display_t>> display_wp;
+
+    // Raised while display_wp can be encoded from, so the sessions needn't poll for the end of a reinit
+    safe::signal_t display_ready_event;
+
+    // Raised by the sessions when they drop their references to the display during a reinit
+    safe::signal_t display_released_event;
+
+    // The display the thread captures, and the images it's captured into
+    std::string display_name;
+    image_pool::pool_t *capture_pool;
   };
 
   struct capture_thread_sync_ctx_t {
@@ -463,10 +729,322 @@ namespace video {
   int start_capture_async(capture_thread_async_ctx_t &ctx);
   void end_capture_async(capture_thread_async_ctx_t &ctx);
 
-  // Keep a reference counter to ensure the capture thread only runs when other threads have a reference to the capture thread
-  auto capture_thread_async = safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
+  /**
+   * @brief The capture of a display, shared by the sessions streaming it.
+   */
+  struct capture_display_t {
+    // Keep a reference counter to ensure the capture thread only runs when other threads have a reference to the capture thread
+    std::unique_ptr<safe::shared_t<capture_thread_async_ctx_t>> thread;
+
+    // Kept across the runs of the thread, so its statistics remain available
+    image_pool::pool_t capture_pool;
+  };
+
+  // Guards the displays, which are only ever added
+  std::mutex capture_displays_lock;
+
+  // Keyed by the name of the display and the memory type it's captured into,
+  // sessions on encoders of different device types capture the display separately
+  std::map<std::pair<std::string, platf::mem_type_e>, capture_display_t> capture_displays;
+
+  /**
+   * @brief Get the capture thread of a display.
+   * @param display_name The name of the display, see `capture_display_name()`.
+   * @param encoder The encoder of the session, the display is captured for its device type.
+   * @return The capture thread, started by its first reference.
+   */
+  safe::shared_t<capture_thread_async_ctx_t> &capture_thread_async(const std::string &display_name, const encoder_t &encoder) {
+    std::lock_guard lg {capture_displays_lock};
+
+    auto &capture_display = capture_displays[{display_name, encoder.platform_formats->dev_type}];
+    if (!capture_display.thread) {
+      auto capture_pool = &capture_display.capture_pool;
+      auto encoder_p = &encoder;
+      capture_display.thread = std::make_unique<safe::shared_t<capture_thread_async_ctx_t>>(
+        [display_name, encoder_p, capture_pool](capture_thread_async_ctx_t &ctx) {
+          ctx.encoder_p = encoder_p;
+          ctx.display_name = display_name;
+          ctx.capture_pool = capture_pool;
+          return start_capture_async(ctx);
+        },
+        end_capture_async
+      );
+    }
+
+    return *capture_display.thread;
+  }
+
   auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
 
+  /**
+   * @brief A session receiving the frames of an encoder it may share with other sessions.
+   */
+  struct shared_session_t {
+    safe::mail_raw_t::event_t<bool> idr_events;
+    safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+    safe::mail_raw_t::event_t<hdr_info_t> hdr_events;
+    safe::mail_raw_t::event_t<input::touch_port_t> touch_port_events;
+    void *channel_data;
+
+    // The next frame index of the session, continued from when it runs an encoder itself
+    int *frame_nr;
+
+    // The stream requested by the session
+    const config_t *config;
+
+    // Added to the frame index of the encoder to get the frame index of the session.
+    // Sessions joining a running encoder start with its next IDR frame, this is known from then on.
+    std::optional<int64_t> frame_offset;
+
+    // Set for the sessions at half the frame rate of the encoder, which only receive its base layer
+    bool base_layer_only;
+  };
+
+  /**
+   * @brief An encoder shared by the sessions requesting identical streams.
+   * @details The encoder runs on the thread of the session it was started for. The other
+   *          sessions wait on their own threads, and once that session ends, they start
+   *          or join another encoder.
+   */
+  struct shared_encoder_t {
+    config_t config;
+    std::string display_name;
+    shared_session_t *owner;
+    std::vector<shared_session_t *> sessions;
+    bool running;
+
+    // Set once the encoder produced a frame outside of its base layer
+    bool temporal_layers;
+
+    // The state of the display, for the sessions joining after the encoder started
+    std::optional<input::touch_port_t> touch_port;
+    std::optional<hdr_info_raw_t> hdr_info;
+  };
+
+  // Guards the shared encoders and the sessions of each
+  std::mutex shared_encoders_lock;
+  std::vector<std::shared_ptr<shared_encoder_t>> shared_encoders;
+
+  /**
+   * @brief Join the running encoder for a stream, or start a new one for it.
+   * @param session The session.
+   * @param config The stream requested by the session.
+   * @param display_name The display the session streams.
+   * @return The encoder, owned by the session if the session has to run it.
+   */
+  std::shared_ptr<shared_encoder_t> join_shared_encoder(shared_session_t &session, const config_t &config, const std::string &display_name) {
+    std::lock_guard lg {shared_encoders_lock};
+
+    for (auto &encoder : shared_encoders) {
+      if (encoder->display_name != display_name) {
+        continue;
+      }
+
+      // Sessions at half the frame rate of an encoder with temporal layers skip the upper one
+      auto base_layer_only = false;
+      if (encoder->config != config) {
+        auto full_rate = config;
+        full_rate.framerate *= 2;
+        if (!encoder->temporal_layers || encoder->config != full_rate) {
+          continue;
+        }
+
+        base_layer_only = true;
+      }
+
+      encoder->sessions.emplace_back(&session);
+      session.frame_offset.reset();
+      session.base_layer_only = base_layer_only;
+      session.idr_events->raise(true);
+
+      if (encoder->touch_port) {
+        session.touch_port_events->raise(*encoder->touch_port);
+      }
+      if (encoder->hdr_info) {
+        session.hdr_events->raise(std::make_unique<hdr_info_raw_t>(*encoder->hdr_info));
+      }
+
+      BOOST_LOG(info) << "Sharing the encoder of a stream with "sv << encoder->sessions.size() << " clients"sv;
+      return encoder;
+    }
+
+    session.frame_offset = 0;
+    session.base_layer_only = false;
+
+    auto encoder = std::make_shared<shared_encoder_t>(shared_encoder_t {config, display_name, &session, {&session}, true, false});
+    shared_encoders.emplace_back(encoder);
+
+    return encoder;
+  }
+
+  /**
+   * @brief Stop receiving the frames of an encoder, stopping the encoder if the session owns it.
+   * @param encoder The encoder.
+   * @param session The session.
+   */
+  void leave_shared_encoder(shared_encoder_t &encoder, shared_session_t &session) {
+    std::lock_guard lg {shared_encoders_lock};
+
+    std::erase(encoder.sessions, &session);
+
+    if (encoder.owner == &session) {
+      encoder.running = false;
+      std::erase_if(shared_encoders, [&encoder](const auto &shared_encoder) {
+        return shared_encoder.get() == &encoder;
+      });
+    }
+  }
+
+  /**
+   * @brief Receive the frames of the running encoder for a stream until the session has to run one.
+   * @param encoder The encoder the session joined, replaced by the one it joins next.
+   * @param session The session.
+   * @param shutdown_event The event ending the stream of the session.
+   * @param switch_display_event The event switching the display of the session, which leaves the encoder.
+   * @return `true` once the session owns the encoder or left it, `false` if the stream ended first.
+   */
+  bool follow_shared_encoder(std::shared_ptr<shared_encoder_t> &encoder, shared_session_t &session, safe::mail_raw_t::event_t<bool> &shutdown_event, safe::mail_raw_t::event_t<int> &switch_display_event) {
+    while (!shutdown_event->peek()) {
+      if (switch_display_event->peek()) {
+        leave_shared_encoder(*encoder, session);
+        encoder.reset();
+        return true;
+      }
+
+      bool running;
+      {
+        std::lock_guard lg {shared_encoders_lock};
+        if (encoder->owner == &session) {
+          return true;
+        }
+
+        running = encoder->running;
+      }
+
+      if (!running) {
+        leave_shared_encoder(*encoder, session);
+        encoder = join_shared_encoder(session, *session.config, encoder->display_name);
+        continue;
+      }
+
+      std::this_thread::sleep_for(20ms);
+    }
+
+    return false;
+  }
+
+  /**
+   * @brief Pass the state of the display to the sessions receiving the frames of an encoder.
+   * @param encoder The encoder.
+   * @param touch_port The touch port of the display.
+   * @param hdr_info The HDR state of the display.
+   */
+  void update_shared_display(shared_encoder_t &encoder, const input::touch_port_t &touch_port, const hdr_info_raw_t &hdr_info) {
+    std::lock_guard lg {shared_encoders_lock};
+
+    encoder.touch_port = touch_port;
+    encoder.hdr_info = hdr_info;
+
+    for (auto session : encoder.sessions) {
+      if (session != encoder.owner) {
+        session->touch_port_events->raise(touch_port);
+        session->hdr_events->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+      }
+    }
+  }
+
+  /**
+   * @brief Pass the requests of the other sessions receiving the frames of an encoder to the encoder.
+   * @param encoder The encoder.
+   * @param session The encode session of the encoder.
+   * @return `true` if one of the sessions requested an IDR frame or a recovery frame.
+   */
+  bool poll_shared_requests(shared_encoder_t &encoder, encode_session_t &session) {
+    std::lock_guard lg {shared_encoders_lock};
+
+    bool requested_idr_frame = false;
+    for (auto shared_session : encoder.sessions) {
+      if (shared_session == encoder.owner) {
+        continue;
+      }
+
+      auto &invalidate_ref_frames_events = shared_session->invalidate_ref_frames_events;
+      while (invalidate_ref_frames_events->peek()) {
+        if (auto frames = invalidate_ref_frames_events->pop(0ms); frames && shared_session->frame_offset) {
+          // The frames of the session skipping the upper layer don't map to those of the encoder by an offset
+          if (shared_session->base_layer_only) {
+            session.request_idr_frame();
+            requested_idr_frame = true;
+            continue;
+          }
+
+          auto offset = *shared_session->frame_offset;
+          session.invalidate_ref_frames(frames->first - offset, frames->second - offset);
+        }
+      }
+
+      if (shared_session->idr_events->peek()) {
+        // A session that just joined has nothing an intra refresh wave could start from
+        if (!shared_session->frame_offset) {
+          session.request_idr_frame();
+        }
+        requested_idr_frame = true;
+        shared_session->idr_events->pop();
+      }
+    }
+
+    return requested_idr_frame;
+  }
+
+  /**
+   * @brief Send a frame of an encoder to every session receiving its frames.
+   * @param encoder The encoder.
+   * @param packets The queue of frames to be sent.
+   * @param packet The frame.
+   */
+  void send_shared_packet(shared_encoder_t &encoder, safe::mail_raw_t::queue_t<packet_t> &packets, packet_t &&packet) {
+    std::shared_ptr<packet_raw_t> shared_packet = std::move(packet);
+
+    auto layer = 0;
+    if (config::video.temporal_layers) {
+      layer = temporal_layer({(const char *) shared_packet->data(), shared_packet->data_size()}, encoder.config.videoFormat);
+    }
+
+    std::lock_guard lg {shared_encoders_lock};
+    encoder.temporal_layers = encoder.temporal_layers || layer > 0;
+    for (auto session : encoder.sessions) {
+      if (!session->frame_offset) {
+        // The client can't decode anything before an IDR frame
+        if (!shared_packet->is_idr()) {
+          continue;
+        }
+
+        session->frame_offset = *session->frame_nr - shared_packet->frame_index();
+      }
+
+      // The frame indexes of the session stay consecutive, the client would take a skipped one for a lost frame
+      if (session->base_layer_only && layer > 0) {
+        --*session->frame_offset;
+        continue;
+      }
+
+      auto frame_index = shared_packet->frame_index() + *session->frame_offset;
+      if (session != encoder.owner) {
+        *session->frame_nr = std::max<int>(*session->frame_nr, frame_index + 1);
+      }
+
+      auto session_packet = std::make_unique<packet_raw_shared>(shared_packet, frame_index);
+      session_packet->replaced_head = shared_packet->replaced_head;
+      session_packet->replaced_size = shared_packet->replaced_size;
+      session_packet->channel_data = session->channel_data;
+      session_packet->after_ref_frame_invalidation = shared_packet->after_ref_frame_invalidation;
+      session_packet->frame_timestamp = shared_packet->frame_timestamp;
+      session_packet->convert_timestamp = shared_packet->convert_timestamp;
+      session_packet->encode_timestamp = shared_packet->encode_timestamp;
+      packets->raise(std::move(session_packet));
+    }
+  }
+
 #ifdef _WIN32
   encoder_t nvenc {
     "nvenc"sv,
@@ -521,8 +1099,13 @@ namespace video {
   #endif
       AV_PIX_FMT_NV12,
       AV_PIX_FMT_P010,
+  #ifdef _WIN32
       AV_PIX_FMT_NONE,
       AV_PIX_FMT_NONE,
+  #else
+      AV_PIX_FMT_YUV444P,
+      AV_PIX_FMT_YUV444P16,
+  #endif
   #ifdef _WIN32
       dxgi_init_avcodec_hardware_input_buffer
   #else
@@ -571,8 +1154,14 @@ namespace video {
         // HDR-specific options
         {"profile"s, (int) nv::profile_hevc_e::main_10},
       },
-      {},  // YUV444 SDR-specific options
-      {},  // YUV444 HDR-specific options
+      {
+        // YUV444 SDR-specific options
+        {"profile"s, (int) nv::profile_hevc_e::rext},
+      },
+      {
+        // YUV444 HDR-specific options
+        {"profile"s, (int) nv::profile_hevc_e::rext},
+      },
       {},  // Fallback options
       "hevc_nvenc"s,
     },
@@ -594,12 +1183,19 @@ namespace video {
         {"profile"s, (int) nv::profile_h264_e::high},
       },
       {},  // HDR-specific options
-      {},  // YUV444 SDR-specific options
+      {
+        // YUV444 SDR-specific options
+        {"profile"s, (int) nv::profile_h264_e::high_444p},
+      },
       {},  // YUV444 HDR-specific options
       {},  // Fallback options
       "h264_nvenc"s,
     },
+  #ifdef _WIN32
     PARALLEL_ENCODING
+  #else
+    PARALLEL_ENCODING | YUV444_SUPPORT
+  #endif
   };
 #endif
 
@@ -890,7 +1486,7 @@ namespace video {
     {
       // Common options
       {
-        {"async_depth"s, 1},
+        {"async_depth"s, &config::video.vaapi.async_depth},
         {"idr_interval"s, std::numeric_limits<int>::max()},
       },
       {},  // SDR-specific options
@@ -903,7 +1499,7 @@ namespace video {
     {
       // Common options
       {
-        {"async_depth"s, 1},
+        {"async_depth"s, &config::video.vaapi.async_depth},
         {"sei"s, 0},
         {"idr_interval"s, std::numeric_limits<int>::max()},
       },
@@ -917,7 +1513,7 @@ namespace video {
     {
       // Common options
       {
-        {"async_depth"s, 1},
+        {"async_depth"s, &config::video.vaapi.async_depth},
         {"sei"s, 0},
         {"idr_interval"s, std::numeric_limits<int>::max()},
       },
@@ -934,6 +1530,9 @@ namespace video {
 #endif
 
 #ifdef __APPLE__
+  // AV_CODEC_FLAG_LOW_DELAY makes FFmpeg create the session with VideoToolbox's
+  // low-latency rate control, which also encodes without frame delay. Encoders
+  // that reject it are retried without the flag.
   encoder_t videotoolbox {
     "videotoolbox"sv,
     std::make_unique<encoder_platform_formats_avcodec>(
@@ -953,6 +1552,7 @@ namespace video {
         {"require_sw"s, &config::video.vt.vt_require_sw},
         {"realtime"s, &config::video.vt.vt_realtime},
         {"prio_speed"s, 1},
+        {"power_efficient"s, 0},
         {"max_ref_frames"s, 1},
       },
       {},  // SDR-specific options
@@ -969,13 +1569,17 @@ namespace video {
         {"require_sw"s, &config::video.vt.vt_require_sw},
         {"realtime"s, &config::video.vt.vt_realtime},
         {"prio_speed"s, 1},
+        {"power_efficient"s, 0},
         {"max_ref_frames"s, 1},
       },
       {},  // SDR-specific options
       {},  // HDR-specific options
       {},  // YUV444 SDR-specific options
       {},  // YUV444 HDR-specific options
-      {},  // Fallback options
+      {
+        // Fallback options
+        {"flags"s, "-low_delay"},
+      },
       "hevc_videotoolbox"s,
     },
     {
@@ -985,6 +1589,7 @@ namespace video {
         {"require_sw"s, &config::video.vt.vt_require_sw},
         {"realtime"s, &config::video.vt.vt_realtime},
         {"prio_speed"s, 1},
+        {"power_efficient"s, 0},
         {"max_ref_frames"s, 1},
       },
       {},  // SDR-specific options
@@ -1019,11 +1624,50 @@ namespace video {
   };
 
   static encoder_t *chosen_encoder;
+
+  // Encoders streaming the codecs the chosen encoder can't, next to it
+  static std::vector<encoder_t *> secondary_encoders;
+
   int active_hevc_mode;
   int active_av1_mode;
   bool last_encoder_probe_supported_ref_frames_invalidation = false;
   std::array<bool, 3> last_encoder_probe_supported_yuv444_for_codec = {};
 
+  /**
+   * @brief Whether an encoder can stream a session.
+   * @param encoder The encoder.
+   * @param config The stream requested by the session.
+   * @return `true` if the encoder validated the codec, dynamic range and chroma sampling of the stream.
+   */
+  bool encoder_handles(const encoder_t &encoder, const config_t &config) {
+    const auto &codec = config.videoFormat == 0 ? encoder.h264 :
+                        config.videoFormat == 1 ? encoder.hevc :
+                                                  encoder.av1;
+
+    return codec[encoder_t::PASSED] &&
+           (!config.dynamicRange || codec[encoder_t::DYNAMIC_RANGE]) &&
+           (config.chromaSamplingType != 1 || codec[encoder_t::YUV444]);
+  }
+
+  /**
+   * @brief Get the encoder to stream a session with.
+   * @details Sessions stream on the chosen encoder, unless it can't stream what they requested and one of
+   *          the secondary encoders can. Those only exist when the chosen encoder runs in parallel.
+   * @param config The stream requested by the session.
+   * @return The encoder.
+   */
+  const encoder_t &session_encoder(const config_t &config) {
+    if (!encoder_handles(*chosen_encoder, config)) {
+      for (auto encoder : secondary_encoders) {
+        if (encoder_handles(*encoder, config)) {
+          return *encoder;
+        }
+      }
+    }
+
+    return *chosen_encoder;
+  }
+
   void reset_display(std::shared_ptr<platf::display_t> &disp, const platf::mem_type_e &type, const std::string &display_name, const config_t &config) {
     // We try this twice, in case we still get an error on reinitialization
     for (int x = 0; x < 2; ++x) {
@@ -1092,16 +1736,109 @@ namespace video {
     }
   }
 
+  /**
+   * @brief Get the name of a display to capture.
+   * @param dev_type The memory type the display is captured into.
+   * @param display_index The index of the display, or -1 for the configured output.
+   * @return The name of the display.
+   */
+  std::string capture_display_name(platf::mem_type_e dev_type, int display_index) {
+    std::vector<std::string> display_names;
+    int display_p = -1;
+    refresh_displays(dev_type, display_names, display_p);
+
+    if (display_index >= 0) {
+      display_p = std::clamp(display_index, 0, (int) display_names.size() - 1);
+    }
+
+    return display_names[display_p];
+  }
+
+  image_pool::stats_t capture_pool_stats() {
+    image_pool::stats_t total {};
+
+    std::lock_guard lg {capture_displays_lock};
+    for (auto &[key, capture_display] : capture_displays) {
+      auto stats = capture_display.capture_pool.stats();
+
+      total.allocated += stats.allocated;
+      total.in_use += stats.in_use;
+      total.limit += stats.allocated ? stats.limit : 0;
+      total.image_bytes = std::max(total.image_bytes, stats.image_bytes);
+    }
+
+    return total;
+  }
+
+  namespace {
+    // The cursor of the last image captured of each display, set by the capture threads
+    sync_util::sync_t<std::map<std::string, cursor_t>> captured_cursors;
+    std::uint64_t captured_cursor_sequence = 0;
+
+    // Handed to the capture backends in place of display_cursor when the cursor is sent separately
+    bool blend_no_cursor = false;
+
+    bool *capture_cursor_flag() {
+      return config::video.cursor_out_of_band ? &blend_no_cursor : &display_cursor;
+    }
+
+    void update_captured_cursor(const std::string &display_name, const platf::img_t &img) {
+      if (!config::video.cursor_out_of_band) {
+        return;
+      }
+
+      auto lg = captured_cursors.lock();
+      auto &cursors = captured_cursors.raw;
+
+      if (!img.cursor) {
+        cursors.erase(display_name);
+        return;
+      }
+
+      auto &state = *img.cursor;
+      if (auto it = cursors.find(display_name); it != cursors.end()) {
+        auto &cursor = it->second;
+        if (cursor.state.visible == state.visible && cursor.state.x == state.x && cursor.state.y == state.y && cursor.state.shape == state.shape &&
+            cursor.image_width == img.width && cursor.image_height == img.height) {
+          return;
+        }
+      }
+
+      cursors.insert_or_assign(display_name, cursor_t {
+        ++captured_cursor_sequence,
+        state,
+        img.width,
+        img.height,
+      });
+    }
+  }  // namespace
+
+  std::optional<cursor_t> latest_cursor(const std::string &display_name) {
+    auto lg = captured_cursors.lock();
+
+    auto it = captured_cursors->find(display_name);
+    if (it == captured_cursors->end()) {
+      return std::nullopt;
+    }
+
+    return it->second;
+  }
+
   void captureThread(
     std::shared_ptr<safe::queue_t<capture_ctx_t>> capture_ctx_queue,
     sync_util::sync_t<std::weak_ptr<platf::display_t>> &display_wp,
     safe::signal_t &reinit_event,
-    const encoder_t &encoder
+    safe::signal_t &display_ready_event,
+    safe::signal_t &display_released_event,
+    const encoder_t &encoder,
+    const std::string &display_name,
+    image_pool::pool_t &capture_pool
   ) {
     std::vector<capture_ctx_t> capture_ctxs;
 
     auto fg = util::fail_guard([&]() {
       capture_ctx_queue->stop();
+      display_ready_event.reset();
 
       // Stop all sessions listening to this thread
       for (auto &capture_ctx : capture_ctxs) {
@@ -1112,8 +1849,6 @@ namespace video {
       }
     });
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
-
     // Wait for the initial capture context or a request to stop the queue
     auto initial_capture_ctx = capture_ctx_queue->pop();
     if (!initial_capture_ctx) {
@@ -1126,116 +1861,75 @@ namespace video {
     std::vector<std::string> display_names;
     int display_p = -1;
     refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
+
+    // The sessions switch between the threads capturing each display, rather than the thread between displays
+    if (auto it = std::find(std::begin(display_names), std::end(display_names), display_name); it != std::end(display_names)) {
+      display_p = (int) std::distance(std::begin(display_names), it);
+    }
+
     auto disp = platf::display(encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
     if (!disp) {
       return;
     }
     display_wp = disp;
+    display_ready_event.raise(true);
+
+    // Images of the current display, sized for the sessions capturing it
+    auto reset_capture_pool = [&]() {
+      // HDR is captured in FP16
+      auto image_bytes = (std::size_t) disp->width * disp->height * (disp->is_hdr() ? 8 : 4);
+      auto budget_bytes = (std::size_t) config::video.capture_memory_budget * 1024 * 1024;
+      auto alloc = [&disp]() {
+        return disp->alloc_img();
+      };
 
-    constexpr auto capture_buffer_size = 12;
-    std::list<std::shared_ptr<platf::img_t>> imgs(capture_buffer_size);
-
-    std::vector<std::optional<std::chrono::steady_clock::time_point>> imgs_used_timestamps;
-    const std::chrono::seconds trim_timeot = 3s;
-    auto trim_imgs = [&]() {
-      // count allocated and used within current pool
-      size_t allocated_count = 0;
-      size_t used_count = 0;
-      for (const auto &img : imgs) {
-        if (img) {
-          allocated_count += 1;
-          if (img.use_count() > 1) {
-            used_count += 1;
-          }
-        }
-      }
-
-      // remember the timestamp of currently used count
-      const auto now = std::chrono::steady_clock::now();
-      if (imgs_used_timestamps.size() <= used_count) {
-        imgs_used_timestamps.resize(used_count + 1);
-      }
-      imgs_used_timestamps[used_count] = now;
-
-      // decide whether to trim allocated unused above the currently used count
-      // based on last used timestamp and universal timeout
-      size_t trim_target = used_count;
-      for (size_t i = used_count; i < imgs_used_timestamps.size(); i++) {
-        if (imgs_used_timestamps[i] && now - *imgs_used_timestamps[i] < trim_timeot) {
-          trim_target = i;
-        }
-      }
-
-      // trim allocated unused above the newly decided trim target
-      if (allocated_count > trim_target) {
-        size_t to_trim = allocated_count - trim_target;
-        // prioritize trimming least recently used
-        for (auto it = imgs.rbegin(); it != imgs.rend(); it++) {
-          auto &img = *it;
-          if (img && img.use_count() == 1) {
-            img.reset();
-            to_trim -= 1;
-            if (to_trim == 0) {
-              break;
-            }
-          }
-        }
-        // forget timestamps that no longer relevant
-        imgs_used_timestamps.resize(trim_target + 1);
-      }
+      capture_pool.reset(alloc, image_bytes, budget_bytes);
+      capture_pool.set_consumers(capture_ctxs.size());
     };
+    reset_capture_pool();
+    auto capture_pool_guard = util::fail_guard([&capture_pool]() {
+      capture_pool.clear();
+    });
 
     auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
       img_out.reset();
       while (capture_ctx_queue->running()) {
-        // pick first allocated but unused
-        for (auto it = imgs.begin(); it != imgs.end(); it++) {
-          if (*it && it->use_count() == 1) {
-            img_out = *it;
-            if (it != imgs.begin()) {
-              // move image to the front of the list to prioritize its reusal
-              imgs.erase(it);
-              imgs.push_front(img_out);
-            }
-            break;
-          }
-        }
-        // otherwise pick first unallocated
-        if (!img_out) {
-          for (auto it = imgs.begin(); it != imgs.end(); it++) {
-            if (!*it) {
-              // allocate image
-              *it = disp->alloc_img();
-              img_out = *it;
-              if (it != imgs.begin()) {
-                // move image to the front of the list to prioritize its reusal
-                imgs.erase(it);
-                imgs.push_front(img_out);
-              }
-              break;
-            }
-          }
-        }
+        // Free the images that went unused for a while
+        capture_pool.trim();
+
+        img_out = capture_pool.acquire();
         if (img_out) {
-          // trim allocated but unused portion of the pool based on timeouts
-          trim_imgs();
           img_out->frame_timestamp.reset();
+          img_out->damage.reset();
+          img_out->focus.clear();
           return true;
-        } else {
-          // sleep and retry if image pool is full
-          std::this_thread::sleep_for(1ms);
         }
+
+        // sleep and retry if image pool is full
+        std::this_thread::sleep_for(1ms);
       }
       return false;
     };
 
     // Capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
+    thread_affinity::pin(thread_affinity::role_e::capture);
+    timeline::set_thread_name("capture");
 
-    while (capture_ctx_queue->running()) {
-      bool artificial_reinit = false;
+    // Lets the encoders tell whether they missed an image, which the damage of the next one doesn't cover
+    std::uint64_t capture_sequence = 0;
 
+    while (capture_ctx_queue->running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img) {
+          img->capture_sequence = ++capture_sequence;
+          update_captured_cursor(display_name, *img);
+
+          if (img->frame_timestamp && timeline::is_recording()) {
+            timeline::record("capture", timeline::NO_FRAME, *img->frame_timestamp, std::chrono::steady_clock::now());
+          }
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1257,32 +1951,22 @@ namespace video {
         while (capture_ctx_queue->peek()) {
           capture_ctxs.emplace_back(std::move(*capture_ctx_queue->pop()));
         }
-
-        if (switch_display_event->peek()) {
-          artificial_reinit = true;
-          return false;
-        }
+        capture_pool.set_consumers(capture_ctxs.size());
 
         return true;
       };
 
-      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
-
-      if (artificial_reinit && status != platf::capture_e::error) {
-        status = platf::capture_e::reinit;
-
-        artificial_reinit = false;
-      }
+      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, capture_cursor_flag());
 
       switch (status) {
         case platf::capture_e::reinit:
           {
+            display_ready_event.reset();
+            display_released_event.reset();
             reinit_event.raise(true);
 
             // Some classes of images contain references to the display --> display won't delete unless img is deleted
-            for (auto &img : imgs) {
-              img.reset();
-            }
+            capture_pool.clear();
 
             // display_wp is modified in this thread only
             // Wait for the other shared_ptr's of display to be destroyed.
@@ -1305,7 +1989,8 @@ namespace video {
                 ++capture_ctx;
               });
 
-              std::this_thread::sleep_for(20ms);
+              // The sessions signal when they let go of the display, the timeout keeps draining their images
+              display_released_event.pop(20ms);
             }
 
             while (capture_ctx_queue->running()) {
@@ -1316,11 +2001,6 @@ namespace video {
               // Refresh display names since a display removal might have caused the reinitialization
               refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
 
-              // Process any pending display switch with the new list of displays
-              if (switch_display_event->peek()) {
-                display_p = std::clamp(*switch_display_event->pop(), 0, (int) display_names.size() - 1);
-              }
-
               // reset_display() will sleep between retries
               reset_display(disp, encoder.platform_formats->dev_type, display_names[display_p], capture_ctxs.front().config);
               if (disp) {
@@ -1332,6 +2012,8 @@ namespace video {
             }
 
             display_wp = disp;
+            reset_capture_pool();
+            display_ready_event.raise(true);
 
             reinit_event.reset();
             continue;
@@ -1348,6 +2030,172 @@ namespace video {
     }
   }
 
+  std::string_view frame_type_name(frame_type_e type) {
+    switch (type) {
+      case frame_type_e::idr:
+        return "idr"sv;
+      case frame_type_e::i:
+        return "i"sv;
+      case frame_type_e::p:
+        return "p"sv;
+      case frame_type_e::b:
+        return "b"sv;
+      case frame_type_e::unknown:
+        break;
+    }
+
+    return "unknown"sv;
+  }
+
+  void read_avcodec_frame_stats(const AVPacket *av_packet, packet_raw_t &packet) {
+    // B-frames are disabled, so the frames that aren't keyframes are P-frames unless told otherwise
+    packet.frame_type = (av_packet->flags & AV_PKT_FLAG_KEY) ? frame_type_e::idr : frame_type_e::p;
+
+    std::size_t stats_size = 0;
+    auto stats = av_packet_get_side_data(av_packet, AV_PKT_DATA_QUALITY_STATS, &stats_size);
+    if (!stats || stats_size < 5) {
+      return;
+    }
+
+    // The quality of the frame in lambda units, followed by its picture type
+    packet.qp = (int) (AV_RL32(stats) / FF_QP2LAMBDA);
+    if (packet.frame_type != frame_type_e::idr) {
+      switch (stats[4]) {
+        case AV_PICTURE_TYPE_I:
+          packet.frame_type = frame_type_e::i;
+          break;
+        case AV_PICTURE_TYPE_B:
+          packet.frame_type = frame_type_e::b;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  std::size_t rewrite_parameter_sets(std::string_view payload, const std::vector<packet_raw_t::replace_t> &replacements, bool hevc, std::vector<std::uint8_t> &head) {
+    head.clear();
+
+    // The bytes of the payload up to here are in head
+    std::size_t copied = 0;
+
+    std::size_t replaced = 0;
+    auto pos = payload.find("\0\0\1"sv);
+    while (pos != std::string_view::npos && pos + 3 < payload.size() && replaced < replacements.size()) {
+      auto nal_header = (std::uint8_t) payload[pos + 3];
+      auto slice = hevc ? ((nal_header >> 1) & 0x3F) < 32 : (nal_header & 0x1F) >= 1 && (nal_header & 0x1F) <= 5;
+      if (slice) {
+        break;
+      }
+
+      // A 4 byte start code is a zero byte followed by a 3 byte one
+      auto start = pos > copied && payload[pos - 1] == 0 ? pos - 1 : pos;
+
+      auto match = std::find_if(std::begin(replacements), std::end(replacements), [&](const packet_raw_t::replace_t &replacement) {
+        return payload.substr(start).starts_with(replacement.old) || payload.substr(pos).starts_with(replacement.old);
+      });
+      if (match != std::end(replacements)) {
+        if (!payload.substr(start).starts_with(match->old)) {
+          start = pos;
+        }
+
+        head.insert(std::end(head), std::begin(payload) + copied, std::begin(payload) + start);
+        head.insert(std::end(head), std::begin(match->_new), std::end(match->_new));
+        copied = start + match->old.size();
+        ++replaced;
+      }
+
+      pos = payload.find("\0\0\1"sv, std::max(copied, pos + 3));
+    }
+
+    return copied;
+  }
+
+  int temporal_layer(std::string_view payload, int videoFormat) {
+    if (videoFormat == 2) {
+      // The OBUs of the frame, each with its size
+      std::size_t pos = 0;
+      while (pos < payload.size()) {
+        auto header = (std::uint8_t) payload[pos];
+        auto type = (header >> 3) & 0xF;
+        auto extension = (header >> 2) & 1;
+        auto has_size = (header >> 1) & 1;
+
+        if (type == 3 || type == 6) {
+          // A frame header, or a frame with its header
+          return extension && pos + 1 < payload.size() ? ((std::uint8_t) payload[pos + 1] >> 5) & 7 : 0;
+        }
+        if (!has_size) {
+          return 0;
+        }
+
+        pos += 1 + extension;
+
+        std::uint64_t size = 0;
+        for (int shift = 0; pos < payload.size(); shift += 7) {
+          auto byte = (std::uint8_t) payload[pos++];
+          size |= (std::uint64_t) (byte & 0x7F) << shift;
+          if (!(byte & 0x80) || shift >= 56) {
+            break;
+          }
+        }
+        pos += size;
+      }
+
+      return 0;
+    }
+
+    auto pos = payload.find("\0\0\1"sv);
+    while (pos != std::string_view::npos && pos + 4 < payload.size()) {
+      auto nal_header = (std::uint8_t) payload[pos + 3];
+      if (videoFormat == 1) {
+        auto type = (nal_header >> 1) & 0x3F;
+        if (type < 32) {
+          // The even types up to RSVP_VCL_N14 aren't referenced by the pictures of their own sub-layer
+          auto temporal_id = ((std::uint8_t) payload[pos + 4] & 7) - 1;
+          return temporal_id > 0 ? temporal_id : (type <= 14 && type % 2 == 0);
+        }
+      } else {
+        auto type = nal_header & 0x1F;
+        if (type >= 1 && type <= 5) {
+          // A slice nothing refers to
+          return (nal_header & 0x60) == 0;
+        }
+      }
+
+      pos = payload.find("\0\0\1"sv, pos + 3);
+    }
+
+    return 0;
+  }
+
+  std::vector<platf::damage_rect_t> frame_regions_of_interest(const std::vector<platf::damage_rect_t> &regions, int img_width, int img_height, int frame_width, int frame_height, int margin) {
+    std::vector<platf::damage_rect_t> frame_regions;
+    if (img_width <= 0 || img_height <= 0) {
+      return frame_regions;
+    }
+
+    auto scale = std::min((double) frame_width / img_width, (double) frame_height / img_height);
+    auto offset_x = (frame_width - img_width * scale) / 2;
+    auto offset_y = (frame_height - img_height * scale) / 2;
+
+    for (auto &region : regions) {
+      if (region.width <= 0 || region.height <= 0) {
+        continue;
+      }
+
+      auto left = std::max((int) std::floor(offset_x + region.x * scale) - margin, 0);
+      auto top = std::max((int) std::floor(offset_y + region.y * scale) - margin, 0);
+      auto right = std::min((int) std::ceil(offset_x + (region.x + region.width) * scale) + margin, frame_width);
+      auto bottom = std::min((int) std::ceil(offset_y + (region.y + region.height) * scale) + margin, frame_height);
+      if (right > left && bottom > top) {
+        frame_regions.push_back({left, top, right - left, bottom - top});
+      }
+    }
+
+    return frame_regions;
+  }
+
   int encode_avcodec(int64_t frame_nr, avcodec_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
     auto &frame = session.device->frame;
     frame->pts = frame_nr;
@@ -1358,6 +2206,7 @@ namespace video {
     auto &vps = session.vps;
 
     // send the frame to the encoder
+    auto submitted = std::chrono::steady_clock::now();
     auto ret = avcodec_send_frame(ctx.get(), frame);
     if (ret < 0) {
       char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
@@ -1367,8 +2216,11 @@ namespace video {
     }
 
     while (ret >= 0) {
-      auto packet = std::make_unique<packet_raw_avcodec>();
+      auto packet = std::make_unique<packet_raw_avcodec>(session.packet_pool);
       auto av_packet = packet.get()->av_packet;
+      if (!av_packet) {
+        return -1;
+      }
 
       ret = avcodec_receive_packet(ctx.get(), av_packet);
       if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
@@ -1377,6 +2229,11 @@ namespace video {
         return ret;
       }
 
+      read_avcodec_frame_stats(av_packet, *packet);
+      if (av_packet->pts == frame_nr) {
+        packet->encode_duration = std::chrono::steady_clock::now() - submitted;
+      }
+
       if (av_packet->flags & AV_PKT_FLAG_KEY) {
         BOOST_LOG(debug) << "Frame "sv << frame_nr << ": IDR Keyframe (AV_FRAME_FLAG_KEY)"sv;
       }
@@ -1412,9 +2269,18 @@ namespace video {
 
       if (av_packet && av_packet->pts == frame_nr) {
         packet->frame_timestamp = frame_timestamp;
+        if (frame_timestamp) {
+          packet->convert_timestamp = session.convert_timestamp;
+        }
+      }
+      packet->encode_timestamp = std::chrono::steady_clock::now();
+
+      // Only the parameter sets are spliced, the sending thread doesn't have to look for them in the whole frame
+      if ((av_packet->flags & AV_PKT_FLAG_KEY) && !session.replacements.empty()) {
+        std::string_view payload {(char *) av_packet->data, (std::size_t) av_packet->size};
+        packet->replaced_size = rewrite_parameter_sets(payload, session.replacements, ctx->codec_id == AV_CODEC_ID_H265, packet->replaced_head);
       }
 
-      packet->replacements = &session.replacements;
       packet->channel_data = channel_data;
       packets->raise(std::move(packet));
     }
@@ -1422,27 +2288,117 @@ namespace video {
     return 0;
   }
 
+  void raise_nvenc_packet(nvenc_encode_session_t &session, nvenc::nvenc_encoded_frame &&encoded_frame, const nvenc_encode_session_t::submitted_frame_t &submitted, safe::mail_raw_t::queue_t<packet_t> &packets) {
+    if (submitted.frame_index != encoded_frame.frame_index) {
+      BOOST_LOG(error) << "NvENC frame index mismatch " << submitted.frame_index << " " << encoded_frame.frame_index;
+    }
+
+    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr, session.frame_buffers);
+    packet->channel_data = submitted.channel_data;
+    packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
+    packet->frame_type = encoded_frame.idr ? frame_type_e::idr : encoded_frame.intra ? frame_type_e::i : frame_type_e::p;
+    packet->qp = (int) encoded_frame.average_qp;
+    packet->encode_duration = encoded_frame.encode_duration;
+    packet->frame_timestamp = submitted.frame_timestamp;
+    if (submitted.frame_timestamp) {
+      packet->convert_timestamp = submitted.convert_timestamp;
+    }
+    packet->encode_timestamp = std::chrono::steady_clock::now();
+    packets->raise(std::move(packet));
+  }
+
+  /**
+   * @brief Retrieve the encoded frames of a session on a thread of their own.
+   * @details The encoding thread converts and submits the next frame meanwhile.
+   *          A frame is retrieved as soon as it's encoded, so this adds no latency.
+   * @param session The session.
+   * @param packets The queue the frames are raised on.
+   */
+  void start_nvenc_retrieve_thread(nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> packets) {
+    session.retrieve_thread = std::thread {[&session, packets]() mutable {
+      platf::adjust_thread_priority(platf::thread_priority_e::high);
+      thread_affinity::pin(thread_affinity::role_e::encode);
+
+      timeline::set_thread_name("encode_retrieve");
+
+      while (auto submitted = session.submitted_frames.pop()) {
+        timeline::scope_t scope {"retrieve", submitted->frame_index};
+        auto encoded_frame = session.retrieve_frame();
+        if (encoded_frame.data.empty()) {
+          BOOST_LOG(error) << "NvENC returned empty packet";
+          session.retrieve_failed = true;
+          return;
+        }
+
+        raise_nvenc_packet(session, std::move(encoded_frame), *submitted, packets);
+      }
+    }};
+  }
+
   int encode_nvenc(int64_t frame_nr, nvenc_encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    nvenc_encode_session_t::submitted_frame_t submitted {frame_nr, channel_data, frame_timestamp, session.convert_timestamp};
+
+    if (session.retrieve_thread.joinable()) {
+      if (session.retrieve_failed || !session.submit_frame(frame_nr)) {
+        return -1;
+      }
+
+      session.submitted_frames.raise(submitted);
+      return 0;
+    }
+
     auto encoded_frame = session.encode_frame(frame_nr);
     if (encoded_frame.data.empty()) {
       BOOST_LOG(error) << "NvENC returned empty packet";
       return -1;
     }
 
-    if (frame_nr != encoded_frame.frame_index) {
-      BOOST_LOG(error) << "NvENC frame index mismatch " << frame_nr << " " << encoded_frame.frame_index;
+    raise_nvenc_packet(session, std::move(encoded_frame), submitted, packets);
+
+    return 0;
+  }
+
+  bool encode_session_t::reconfigure(const config_t &config, const config_t &new_config) {
+    auto adapted_config = config;
+    adapted_config.bitrate = new_config.bitrate;
+    adapted_config.framerate = new_config.framerate;
+    if (adapted_config != new_config) {
+      return false;
+    }
+
+    // The bitrate budget per frame depends on the frame rate, so it goes first
+    if (config.framerate != new_config.framerate && !set_framerate(new_config.framerate)) {
+      return false;
     }
 
-    auto packet = std::make_unique<packet_raw_generic>(std::move(encoded_frame.data), encoded_frame.frame_index, encoded_frame.idr);
-    packet->channel_data = channel_data;
-    packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
-    packet->frame_timestamp = frame_timestamp;
-    packets->raise(std::move(packet));
+    if (config.bitrate != new_config.bitrate && !set_bitrate(new_config.bitrate)) {
+      // Leave the encoder as it was
+      if (config.framerate != new_config.framerate) {
+        set_framerate(config.framerate);
+      }
 
-    return 0;
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Apply a bitrate requested by the stream to a running encoder.
+   * @param session The encoder.
+   * @param bitrate The bitrate in Kbps.
+   */
+  void change_bitrate(encode_session_t &session, int bitrate) {
+    if (session.set_bitrate(bitrate)) {
+      BOOST_LOG(debug) << "Encoder bitrate changed to "sv << bitrate << " Kbps"sv;
+    } else {
+      BOOST_LOG(debug) << "Encoder can't change its bitrate while streaming"sv;
+    }
   }
 
   int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    timeline::scope_t scope {"encode", frame_nr};
+
     if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
       return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
     } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
@@ -1503,6 +2459,7 @@ namespace video {
     // fallback options, we may need to allow more retries
     // to try applying each set.
     avcodec_ctx_t ctx;
+    std::optional<software_tuning_t> server_tuning;
     for (int retries = 0; retries < 2; retries++) {
       ctx.reset(avcodec_alloc_context3(codec));
       ctx->width = config.width;
@@ -1625,10 +2582,23 @@ namespace video {
       } else /* software */ {
         ctx->pix_fmt = sw_fmt;
 
-        // Clients will request for the fewest slices per frame to get the
-        // most efficient encode, but we may want to provide more slices than
-        // requested to ensure we have enough parallelism for good performance.
-        ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+        if (config::video.sw.server_profile) {
+          auto encode_cpus = thread_affinity::cpus(thread_affinity::role_e::encode);
+          auto capture_cpus = thread_affinity::cpus(thread_affinity::role_e::capture);
+
+          // Without their own CPUs, the capture thread may run on any of the encoder's
+          bool shares_capture_cpus = encode_cpus.empty() || capture_cpus.empty() ||
+                                     std::find_first_of(std::begin(encode_cpus), std::end(encode_cpus), std::begin(capture_cpus), std::end(capture_cpus)) != std::end(encode_cpus);
+          auto cpus = encode_cpus.empty() ? (int) std::thread::hardware_concurrency() : (int) encode_cpus.size();
+
+          server_tuning = server_software_tuning(cpus, shares_capture_cpus, config.width, config.height, config.framerate, config.slicesPerFrame);
+          ctx->slices = server_tuning->slices;
+        } else {
+          // Clients will request for the fewest slices per frame to get the
+          // most efficient encode, but we may want to provide more slices than
+          // requested to ensure we have enough parallelism for good performance.
+          ctx->slices = std::max(config.slicesPerFrame, config::video.min_threads);
+        }
       }
 
       if (encoder.flags & SINGLE_SLICE_ONLY) {
@@ -1687,6 +2657,50 @@ namespace video {
         }
       }
 
+      // The server profile overrides the presets, and adds its thread count to the parameters of libx265 and libsvtav1
+      if (server_tuning) {
+        auto codec_name = std::string_view {codec->name};
+        if (codec_name == "libsvtav1"sv) {
+          av_dict_set_int(&options, "preset", server_tuning->svtav1_preset, 0);
+          av_dict_set(&options, "svtav1-params", (":lp="s + std::to_string(ctx->thread_count)).c_str(), AV_DICT_APPEND);
+        } else {
+          av_dict_set(&options, "preset", server_tuning->preset.data(), 0);
+          av_dict_set(&options, "tune", "zerolatency", 0);
+          if (codec_name == "libx265"sv) {
+            av_dict_set(&options, "x265-params", (":frame-threads=1:pools="s + std::to_string(ctx->thread_count)).c_str(), AV_DICT_APPEND);
+          }
+        }
+
+        BOOST_LOG(info) << "Software encoder server profile: "sv << ctx->slices << " slices, preset "sv
+                        << (codec_name == "libsvtav1"sv ? std::to_string(server_tuning->svtav1_preset) : std::string {server_tuning->preset});
+      }
+
+      // Tiles let the client decode parts of the frame in parallel, each encoder takes them its own way
+      if (auto tiles = tile_layout(config, config::video.tile_columns, config::video.tile_rows); tiles.columns * tiles.rows > 1) {
+        auto codec_name = std::string_view {codec->name};
+        if (codec_name == "av1_nvenc"sv) {
+          av_dict_set_int(&options, "tile-columns", tiles.columns, 0);
+          av_dict_set_int(&options, "tile-rows", tiles.rows, 0);
+        } else if (codec_name == "av1_qsv"sv || codec_name == "hevc_qsv"sv) {
+          av_dict_set_int(&options, "tile_cols", tiles.columns, 0);
+          av_dict_set_int(&options, "tile_rows", tiles.rows, 0);
+        } else if (codec_name == "av1_vaapi"sv || codec_name == "hevc_vaapi"sv) {
+          av_dict_set(&options, "tiles", (std::to_string(tiles.columns) + 'x' + std::to_string(tiles.rows)).c_str(), 0);
+        } else if (codec_name == "libsvtav1"sv) {
+          // SVT-AV1 takes the log2 of the counts
+          auto log2 = [](int count) {
+            return std::to_string(std::bit_width((unsigned) count) - 1);
+          };
+          av_dict_set(&options, "svtav1-params", (":tile-columns="s + log2(tiles.columns) + ":tile-rows="s + log2(tiles.rows)).c_str(), AV_DICT_APPEND);
+        } else {
+          tiles = {1, 1};
+        }
+
+        if (tiles.columns * tiles.rows > 1) {
+          BOOST_LOG(info) << "Splitting frames in "sv << tiles.columns << 'x' << tiles.rows << " tiles"sv;
+        }
+      }
+
       auto bitrate = ((config::video.max_bitrate > 0) ? std::min(config.bitrate, config::video.max_bitrate) : config.bitrate) * 1000;
       BOOST_LOG(info) << "Streaming bitrate is " << bitrate;
       ctx->rc_max_rate = bitrate;
@@ -1719,6 +2733,19 @@ namespace video {
           }
 #endif
         }
+
+        ctx->rc_buffer_size = (int) cap_frame_size(ctx->rc_buffer_size, bitrate / config.framerate, config.maxFrameSize);
+      }
+
+      // QSV and AMF bound single frames on top of their buffer
+      if (config.maxFrameSize > 0) {
+        auto codec_name = std::string_view {codec->name};
+        auto max_frame_size = std::max<std::int64_t>(config.maxFrameSize, bitrate / config.framerate);
+        if (codec_name.ends_with("_qsv"sv)) {
+          av_dict_set_int(&options, "max_frame_size", max_frame_size / 8, 0);
+        } else if (codec_name.ends_with("_amf"sv)) {
+          av_dict_set_int(&options, "max_au_size", max_frame_size, 0);
+        }
       }
 
       // Allow the encoding device a final opportunity to set/unset or override any options
@@ -1818,6 +2845,8 @@ namespace video {
       // 0 ==> don't inject, 1 ==> inject for h264, 2 ==> inject for hevc
       config.videoFormat <= 1 ? (1 - (int) video_format[encoder_t::VUI_PARAMETERS]) * (1 + config.videoFormat) : 0
     );
+    session->max_frame_size = config.maxFrameSize;
+    session->framerate = config.framerate;
 
     return session;
   }
@@ -1830,32 +2859,163 @@ namespace video {
     return std::make_unique<nvenc_encode_session_t>(std::move(encode_device));
   }
 
-  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
-    if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
-      auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
-      return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
-    } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
-      auto nvenc_encode_device = boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
-      return make_nvenc_encode_session(config, std::move(nvenc_encode_device));
+  std::int64_t cap_frame_size(std::int64_t buffer_size, std::int64_t frame_bits, std::int64_t max_frame_size) {
+    if (max_frame_size <= 0) {
+      return buffer_size;
+    }
+
+    // A link slower than the bitrate can't be helped by starving the rate control
+    return std::min(buffer_size, std::max(max_frame_size, frame_bits));
+  }
+
+  tile_layout_t tile_layout(const config_t &config, int tile_columns, int tile_rows) {
+    tile_layout_t layout {1, 1};
+    if (config.videoFormat == 0) {
+      return layout;
+    }
+
+    if (tile_columns > 0 || tile_rows > 0) {
+      layout = {std::max(tile_columns, 1), std::max(tile_rows, 1)};
+    } else if (config.videoFormat == 2 && config.slicesPerFrame > 1) {
+      // NVENC only supports tile counts that are powers of two, so we'll pick powers of two
+      // with bias to rows due to hopefully more similar macroblocks with a row vs a column.
+      layout.rows = (int) std::pow(2, std::ceil(std::log2(config.slicesPerFrame) / 2));
+      layout.columns = (int) std::pow(2, std::floor(std::log2(config.slicesPerFrame) / 2));
+    }
+
+    // HEVC tile columns are at least 256 luma samples wide, AV1 tiles and HEVC tile rows at least 64
+    auto min_column_width = config.videoFormat == 1 ? 256 : 64;
+    layout.columns = std::clamp(layout.columns, 1, std::clamp(config.width / min_column_width, 1, 64));
+    layout.rows = std::clamp(layout.rows, 1, std::clamp(config.height / 64, 1, 64));
+
+    return layout;
+  }
+
+  std::pair<std::int64_t, std::int64_t> merge_invalidated_frames(const std::pair<std::int64_t, std::int64_t> &a, const std::pair<std::int64_t, std::int64_t> &b) {
+    return {std::min(a.first, b.first), std::max(a.second, b.second)};
+  }
+
+  recovery_debouncer_t::recovery_debouncer_t(std::chrono::milliseconds window):
+      _window {window} {
+  }
+
+  bool recovery_debouncer_t::accept_recovery(std::chrono::steady_clock::time_point now) {
+    if (_last_recovery && now - *_last_recovery < _window) {
+      ++_ignored;
+      return false;
+    }
+
+    return true;
+  }
+
+  void recovery_debouncer_t::recovered(std::int64_t frame_nr, std::chrono::steady_clock::time_point now) {
+    _last_recovery = now;
+    _last_recovery_frame = frame_nr;
+  }
+
+  bool recovery_debouncer_t::needs_invalidation(const std::pair<std::int64_t, std::int64_t> &frames) {
+    if (_last_recovery_frame && frames.second < *_last_recovery_frame) {
+      ++_ignored;
+      return false;
+    }
+
+    return true;
+  }
+
+  software_tuning_t server_software_tuning(int cpus, bool shares_capture_cpus, int width, int height, int framerate, int min_slices) {
+    auto threads = cpus - (shares_capture_cpus ? 1 : 0);
+
+    // Slices much thinner than 64 rows cost more bitrate than the thread saves time
+    threads = std::min(threads, height / 64);
+    threads = std::max({threads, min_slices, 1});
+
+    auto pixels_per_thread = (std::int64_t) width * height * framerate / threads;
+    if (pixels_per_thread <= 1920LL * 1080 * 60 / 8) {
+      return {threads, "veryfast"sv, 10};
+    }
+    if (pixels_per_thread <= 1920LL * 1080 * 60 / 4) {
+      return {threads, "superfast"sv, 11};
+    }
+
+    return {threads, "ultrafast"sv, 12};
+  }
+
+  std::unique_ptr<encode_session_t> make_encode_session(platf::display_t *disp, const encoder_t &encoder, const config_t &config, int width, int height, std::unique_ptr<platf::encode_device_t> encode_device) {
+    if (dynamic_cast<platf::avcodec_encode_device_t *>(encode_device.get())) {
+      auto avcodec_encode_device = boost::dynamic_pointer_cast<platf::avcodec_encode_device_t>(std::move(encode_device));
+      return make_avcodec_encode_session(disp, encoder, config, width, height, std::move(avcodec_encode_device));
+    } else if (dynamic_cast<platf::nvenc_encode_device_t *>(encode_device.get())) {
+      auto nvenc_encode_device = boost::dynamic_pointer_cast<platf::nvenc_encode_device_t>(std::move(encode_device));
+      return make_nvenc_encode_session(config, std::move(nvenc_encode_device));
     }
 
     return nullptr;
   }
 
+  /**
+   * @brief Paces the encoder at the frame rate requested by the client.
+   * @details Ticks at a fixed period against a high precision timer. Ticks that are missed
+   *          because encoding took too long are dropped rather than encoded late.
+   */
+  class frame_pacer_t {
+  public:
+    explicit frame_pacer_t(int framerate):
+        _timer {platf::create_hybrid_timer()},
+        _period {std::chrono::nanoseconds(1s) / std::max(framerate, 1)},
+        _next_tick {std::chrono::steady_clock::now()} {
+    }
+
+    /**
+     * @return `true` if the platform timer is available.
+     */
+    explicit operator bool() const {
+      return _timer && *_timer;
+    }
+
+    /**
+     * @brief Sleep until the next frame is due.
+     */
+    void wait() {
+      auto now = std::chrono::steady_clock::now();
+      if (now < _next_tick) {
+        _timer->sleep_for(_next_tick - now);
+      } else if (auto missed = (now - _next_tick) / _period) {
+        dropped += missed;
+        _next_tick += missed * _period;
+      }
+
+      _next_tick += _period;
+      ++frames;
+    }
+
+    std::int64_t frames {};
+    std::int64_t dropped {};
+    std::int64_t duplicated {};
+
+  private:
+    std::unique_ptr<platf::high_precision_timer> _timer;
+    std::chrono::nanoseconds _period;
+    std::chrono::steady_clock::time_point _next_tick;
+  };
+
+  // The pixels of the frame around the cursor and the foreground window encoded at a lower QP with them
+  constexpr int ROI_MARGIN = 64;
+
   void encode_run(
     int &frame_nr,  // Store progress of the frame number
     safe::mail_t mail,
     img_event_t images,
     config_t config,
     std::shared_ptr<platf::display_t> disp,
-    std::unique_ptr<platf::encode_device_t> encode_device,
+    std::unique_ptr<encode_session_t> session,
     safe::signal_t &reinit_event,
     const encoder_t &encoder,
-    void *channel_data
+    void *channel_data,
+    shared_encoder_t *shared_encoder
   ) {
-    auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
-    if (!session) {
-      return;
+    // The frames of a shared encoder are passed on to its sessions right after they're encoded
+    if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(session.get()); nvenc_session && nvenc_session->can_pipeline() && !shared_encoder) {
+      start_nvenc_retrieve_thread(*nvenc_session, mail::man->queue<packet_t>(mail::video_packets));
     }
 
     // As a workaround for NVENC hangs and to generally speed up encoder reinit,
@@ -1879,10 +3039,107 @@ namespace video {
     std::chrono::duration<double, std::milli> minimum_frame_time {1000.0 / config.framerate};
     BOOST_LOG(info) << "Minimum frame time set to "sv << minimum_frame_time.count() << "ms, based on client-requested target framerate "sv << config.framerate << "."sv;
 
+    // Encode at the client's frame rate, regardless of when frames are captured
+    std::optional<frame_pacer_t> pacer;
+    if (config::video.encoder_pacing) {
+      pacer.emplace(config.framerate);
+      if (!*pacer) {
+        BOOST_LOG(warning) << "No high precision timer available, disabling encoder pacing"sv;
+        pacer.reset();
+      }
+    }
+
+    // While the image is unchanged, the previous one is only encoded again this often
+    std::optional<std::chrono::duration<double, std::milli>> repeat_frame_time;
+    if (config::video.minimum_fps > 0 && config::video.minimum_fps < config.framerate) {
+      repeat_frame_time = std::chrono::duration<double, std::milli> {1000.0 / config::video.minimum_fps};
+      BOOST_LOG(info) << "Unchanged frames repeated at "sv << config::video.minimum_fps << " fps"sv;
+    }
+    std::optional<std::chrono::steady_clock::time_point> last_encode;
+    std::int64_t skipped_frames = 0;
+
+    // A loss burst makes the client ask for recovery over and over, only the first request gets a recovery frame
+    recovery_debouncer_t recovery {std::chrono::milliseconds {config::video.idr_debounce}};
+
+    // Unchanged images aren't converted again, the encoder repeats the last one
+    std::uint64_t last_sequence = 0;
+    std::int64_t unchanged_images = 0;
+
+    // Whether the frame about to be encoded repeats the previous one
+    bool repeated_frame = false;
+
+    // The regions of the frame encoded at a lower QP, the encoder is only told when they change
+    std::vector<platf::damage_rect_t> regions_of_interest;
+    auto update_regions_of_interest = [&](const platf::img_t &img) {
+      auto regions = img.focus;
+      if (img.cursor && img.cursor->visible && img.cursor->shape) {
+        regions.push_back({img.cursor->x, img.cursor->y, img.cursor->shape->width, img.cursor->shape->height});
+      }
+
+      auto frame_regions = frame_regions_of_interest(regions, img.width, img.height, config.width, config.height, ROI_MARGIN);
+      if (frame_regions != regions_of_interest) {
+        session->set_regions_of_interest(frame_regions);
+        regions_of_interest = std::move(frame_regions);
+      }
+    };
+
+    auto convert = [&](platf::img_t &img) {
+      if (config::video.roi_qp_delta > 0) {
+        update_regions_of_interest(img);
+      }
+
+      auto unchanged = img.damage && img.damage->empty() && last_sequence && img.capture_sequence == last_sequence + 1;
+      last_sequence = img.capture_sequence;
+
+      if (unchanged) {
+        ++unchanged_images;
+        return 0;
+      }
+
+      repeated_frame = false;
+
+      timeline::scope_t scope {"convert", frame_nr};
+      auto convert_begin = std::chrono::steady_clock::now();
+      if (session->convert(img)) {
+        return -1;
+      }
+      session->convert_timestamp = std::chrono::steady_clock::now();
+      disp->capture_stats().converted(*session->convert_timestamp - convert_begin);
+
+      return 0;
+    };
+
+    auto stats_guard = util::fail_guard([&pacer, &unchanged_images, &skipped_frames, &recovery]() {
+      if (recovery.ignored()) {
+        BOOST_LOG(info) << "Ignored "sv << recovery.ignored() << " recovery requests following a recovery frame"sv;
+      }
+
+      if (unchanged_images) {
+        BOOST_LOG(debug) << "Repeated "sv << unchanged_images << " unchanged images without converting them"sv;
+      }
+
+      if (skipped_frames) {
+        BOOST_LOG(info) << "Skipped "sv << skipped_frames << " repeated frames of unchanged images"sv;
+      }
+
+      if (pacer) {
+        BOOST_LOG(info) << "Encoder pacing: "sv << pacer->frames << " frames, "sv << pacer->dropped << " dropped, "sv << pacer->duplicated << " duplicated"sv;
+      }
+    });
+
     auto shutdown_event = mail->event<bool>(mail::shutdown);
+    auto switch_display_event = mail->event<int>(mail::switch_display);
     auto packets = mail::man->queue<packet_t>(mail::video_packets);
     auto idr_events = mail->event<bool>(mail::idr);
     auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
+    // A shared encoder follows the bitrate of the session that owns it
+    auto bitrate_events = mail->event<int>(mail::bitrate);
+
+    // A shared encoder's frames are collected here before they're sent to each session
+    safe::mail_raw_t::queue_t<packet_t> shared_packets;
+    if (shared_encoder) {
+      shared_packets = std::make_shared<safe::mail_raw_t>()->queue<packet_t>(mail::video_packets);
+    }
 
     {
       // Load a dummy image into the AVFrame to ensure we have something to encode
@@ -1895,23 +3152,46 @@ namespace video {
       }
     }
 
+    // After a reinit, the client keeps showing the last frame it decoded until we encode one.
+    // Hold off on encoding the blank dummy image until the display captures, unless that takes too long.
+    std::optional<std::chrono::steady_clock::time_point> resume_deadline;
+    if (frame_nr > 1) {
+      resume_deadline = std::chrono::steady_clock::now() + 1s;
+    }
+
     while (true) {
+      if (pacer) {
+        pacer->wait();
+      }
+
       // Break out of the encoding loop if any of the following are true:
       // a) The stream is ending
       // b) Sunshine is quitting
       // c) The capture side is waiting to reinit and we've encoded at least one frame
+      // d) The session switches to another display
       //
       // If we have to reinit before we have received any captured frames, we will encode
       // the blank dummy frame just to let Moonlight know that we're alive.
-      if (shutdown_event->peek() || !images->running() || (reinit_event.peek() && frame_nr > 1)) {
+      if (shutdown_event->peek() || !images->running() || (reinit_event.peek() && frame_nr > 1) || switch_display_event->peek()) {
         break;
       }
 
       bool requested_idr_frame = false;
 
+      // The encoder invalidates the single range covering all those requested since the previous frame
+      std::optional<std::pair<std::int64_t, std::int64_t>> invalidated_frames;
       while (invalidate_ref_frames_events->peek()) {
         if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
-          session->invalidate_ref_frames(frames->first, frames->second);
+          invalidated_frames = invalidated_frames ? merge_invalidated_frames(*invalidated_frames, *frames) : *frames;
+        }
+      }
+      if (invalidated_frames && recovery.needs_invalidation(*invalidated_frames)) {
+        session->invalidate_ref_frames(invalidated_frames->first, invalidated_frames->second);
+      }
+
+      if (bitrate_events->peek()) {
+        if (auto bitrate = bitrate_events->pop(0ms)) {
+          change_bitrate(*session, *bitrate);
         }
       }
 
@@ -1920,17 +3200,39 @@ namespace video {
         idr_events->pop();
       }
 
+      if (shared_encoder && poll_shared_requests(*shared_encoder, *session)) {
+        requested_idr_frame = true;
+      }
+
+      if (requested_idr_frame && !recovery.accept_recovery(std::chrono::steady_clock::now())) {
+        requested_idr_frame = false;
+      }
+
       if (requested_idr_frame) {
-        session->request_idr_frame();
+        session->request_recovery_frame();
       }
 
       std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+      repeated_frame = true;
 
-      // Encode at a minimum FPS to avoid image quality issues with static content
-      if (!requested_idr_frame || images->peek()) {
+      if (pacer) {
+        // Encode the latest image, or the previous one again if nothing was captured since
+        if (auto img = images->pop(0ms)) {
+          frame_timestamp = img->frame_timestamp;
+          if (convert(*img)) {
+            BOOST_LOG(error) << "Could not convert image"sv;
+            return;
+          }
+        } else if (!images->running()) {
+          break;
+        } else if (!resume_deadline) {
+          ++pacer->duplicated;
+        }
+      } else if (resume_deadline || !requested_idr_frame || images->peek()) {
+        // Encode at a minimum FPS to avoid image quality issues with static content
         if (auto img = images->pop(minimum_frame_time)) {
           frame_timestamp = img->frame_timestamp;
-          if (session->convert(*img)) {
+          if (convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             return;
           }
@@ -1939,11 +3241,34 @@ namespace video {
         }
       }
 
-      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
+      if (resume_deadline) {
+        if (!frame_timestamp && std::chrono::steady_clock::now() < *resume_deadline) {
+          continue;
+        }
+        resume_deadline.reset();
+      }
+
+      // Don't spend encoder time and bandwidth on repeating the previous frame more often than asked for
+      auto now = std::chrono::steady_clock::now();
+      if (repeat_frame_time && repeated_frame && !requested_idr_frame && last_encode && now - *last_encode < *repeat_frame_time) {
+        ++skipped_frames;
+        continue;
+      }
+      last_encode = now;
+
+      if (requested_idr_frame) {
+        recovery.recovered(frame_nr, now);
+      }
+
+      if (encode(frame_nr++, *session, shared_encoder ? shared_packets : packets, channel_data, frame_timestamp)) {
         BOOST_LOG(error) << "Could not encode video packet"sv;
         return;
       }
 
+      while (shared_encoder && shared_packets->peek()) {
+        send_shared_packet(*shared_encoder, packets, shared_packets->pop());
+      }
+
       session->request_normal_frame();
     }
   }
@@ -2069,6 +3394,81 @@ namespace video {
     return encode_session;
   }
 
+  /**
+   * @brief Make a synced session, on a worker thread of its own if encoder_session_threads is enabled.
+   */
+  std::optional<sync_session_t> make_synced_session_worker(platf::display_t *disp, const encoder_t &encoder, platf::img_t &img, sync_session_ctx_t &ctx) {
+    if (!config::video.encoder_session_threads) {
+      return make_synced_session(disp, encoder, img, ctx);
+    }
+
+    auto worker = std::make_unique<thread_pool_util::ThreadPool>(1);
+    worker->push([]() {
+      platf::adjust_thread_priority(platf::thread_priority_e::high);
+      thread_affinity::pin(thread_affinity::role_e::encode);
+      timeline::set_thread_name("encode");
+    });
+
+    // Some drivers tie the encoder to the thread that opened it
+    auto synced_session = worker->push([&]() {
+      return make_synced_session(disp, encoder, img, ctx);
+    }).get();
+    if (synced_session) {
+      synced_session->worker = std::move(worker);
+    }
+
+    return synced_session;
+  }
+
+  /**
+   * @brief Update, convert and encode the current frame of a synced session.
+   * @param synced_session The session.
+   * @param disp The display the frame was captured from.
+   * @param img The captured image, or the previous one if nothing new was captured.
+   * @param frame_captured Whether the image is new.
+   */
+  void encode_synced_frame(sync_session_t &synced_session, platf::display_t *disp, const std::shared_ptr<platf::img_t> &img, bool frame_captured) {
+    auto ctx = synced_session.ctx;
+    auto &session = *synced_session.session;
+
+    if (ctx->idr_events->peek()) {
+      session.request_recovery_frame();
+      ctx->idr_events->pop();
+    }
+
+    if (ctx->bitrate_events->peek()) {
+      if (auto bitrate = ctx->bitrate_events->pop(0ms)) {
+        change_bitrate(session, *bitrate);
+      }
+    }
+
+    auto convert_begin = std::chrono::steady_clock::now();
+    if (frame_captured && session.convert(*img)) {
+      BOOST_LOG(error) << "Could not convert image"sv;
+      ctx->shutdown_event->raise(true);
+
+      return;
+    }
+    if (frame_captured) {
+      session.convert_timestamp = std::chrono::steady_clock::now();
+      disp->capture_stats().converted(*session.convert_timestamp - convert_begin);
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+    if (img) {
+      frame_timestamp = img->frame_timestamp;
+    }
+
+    if (encode(ctx->frame_nr++, session, ctx->packets, ctx->channel_data, frame_timestamp)) {
+      BOOST_LOG(error) << "Could not encode video packet"sv;
+      ctx->shutdown_event->raise(true);
+
+      return;
+    }
+
+    session.request_normal_frame();
+  }
+
   encode_e encode_run_sync(
     std::vector<std::unique_ptr<sync_session_ctx_t>> &synced_session_ctxs,
     encode_session_ctx_queue_t &encode_session_ctx_queue,
@@ -2079,7 +3479,16 @@ namespace video {
 
     std::shared_ptr<platf::display_t> disp;
 
-    auto switch_display_event = mail::man->event<int>(mail::switch_display);
+    // The sessions share the display, any of them can switch it
+    auto switch_display_requested = [&synced_session_ctxs]() {
+      for (auto &ctx : synced_session_ctxs) {
+        if (ctx->switch_display_events->peek()) {
+          return true;
+        }
+      }
+
+      return false;
+    };
 
     if (synced_session_ctxs.empty()) {
       auto ctx = encode_session_ctx_queue.pop();
@@ -2095,8 +3504,10 @@ namespace video {
       refresh_displays(encoder.platform_formats->dev_type, display_names, display_p);
 
       // Process any pending display switch with the new list of displays
-      if (switch_display_event->peek()) {
-        display_p = std::clamp(*switch_display_event->pop(), 0, (int) display_names.size() - 1);
+      for (auto &ctx : synced_session_ctxs) {
+        if (ctx->switch_display_events->peek()) {
+          display_p = std::clamp(*ctx->switch_display_events->pop(), 0, (int) display_names.size() - 1);
+        }
       }
 
       // reset_display() will sleep between retries
@@ -2115,19 +3526,26 @@ namespace video {
       return encode_e::error;
     }
 
-    std::vector<sync_session_t> synced_sessions;
+    // A list, so the sessions aren't moved when one of them ends
+    std::list<sync_session_t> synced_sessions;
     for (auto &ctx : synced_session_ctxs) {
-      auto synced_session = make_synced_session(disp.get(), encoder, *img, *ctx);
+      auto synced_session = make_synced_session_worker(disp.get(), encoder, *img, *ctx);
       if (!synced_session) {
         return encode_e::error;
       }
+      ctx->capture_display_events->raise(display_names[display_p]);
 
       synced_sessions.emplace_back(std::move(*synced_session));
     }
 
     auto ec = platf::capture_e::ok;
+    std::vector<std::future<void>> encodes;
     while (encode_session_ctx_queue.running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img) {
+          update_captured_cursor(display_names[display_p], *img);
+        }
+
         while (encode_session_ctx_queue.peek()) {
           auto encode_session_ctx = encode_session_ctx_queue.pop();
           if (!encode_session_ctx) {
@@ -2136,11 +3554,12 @@ namespace video {
 
           synced_session_ctxs.emplace_back(std::make_unique<sync_session_ctx_t>(std::move(*encode_session_ctx)));
 
-          auto encode_session = make_synced_session(disp.get(), encoder, *img, *synced_session_ctxs.back());
+          auto encode_session = make_synced_session_worker(disp.get(), encoder, *img, *synced_session_ctxs.back());
           if (!encode_session) {
             ec = platf::capture_e::error;
             return false;
           }
+          synced_session_ctxs.back()->capture_display_events->raise(display_names[display_p]);
 
           synced_sessions.emplace_back(std::move(*encode_session));
         }
@@ -2163,36 +3582,25 @@ namespace video {
             continue;
           }
 
-          if (ctx->idr_events->peek()) {
-            pos->session->request_idr_frame();
-            ctx->idr_events->pop();
-          }
-
-          if (frame_captured && pos->session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            ctx->shutdown_event->raise(true);
-
-            continue;
-          }
-
-          std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
-          if (img) {
-            frame_timestamp = img->frame_timestamp;
-          }
-
-          if (encode(ctx->frame_nr++, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
-            BOOST_LOG(error) << "Could not encode video packet"sv;
-            ctx->shutdown_event->raise(true);
+          ++pos;
+        })
 
-            continue;
+        // The sessions with a worker of their own convert and encode at the same time
+        encodes.clear();
+        for (auto &synced_session : synced_sessions) {
+          if (synced_session.worker) {
+            encodes.emplace_back(synced_session.worker->push(encode_synced_frame, std::ref(synced_session), disp.get(), std::cref(img), frame_captured));
+          } else {
+            encode_synced_frame(synced_session, disp.get(), img, frame_captured);
           }
+        }
 
-          pos->session->request_normal_frame();
-
-          ++pos;
-        })
+        // The image is captured into again once this returns
+        for (auto &encode : encodes) {
+          encode.wait();
+        }
 
-        if (switch_display_event->peek()) {
+        if (switch_display_requested()) {
           ec = platf::capture_e::reinit;
           return false;
         }
@@ -2206,7 +3614,7 @@ namespace video {
         return true;
       };
 
-      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, &display_cursor);
+      auto status = disp->capture(push_captured_image_callback, pull_free_image_callback, capture_cursor_flag());
       switch (status) {
         case platf::capture_e::reinit:
         case platf::capture_e::error:
@@ -2240,12 +3648,164 @@ namespace video {
       }
     });
 
-    // Encoding and capture takes place on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    // Encoding and capture takes place on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::capture);
+    timeline::set_thread_name("capture_encode");
+
+    std::vector<std::string> display_names;
+    int display_p = -1;
+    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {}
+  }
+
+  /**
+   * @brief An encode session built at launch for the stream expected to follow.
+   */
+  struct prewarmed_session_t {
+    config_t config;
+    std::shared_ptr<platf::display_t> display;
+    sunshine_colorspace_t colorspace;
+    std::unique_ptr<encode_session_t> session;
+  };
+
+  // The time a prewarmed session waits for its stream
+  constexpr auto PREWARM_TIMEOUT = 10s;
+
+  // The config of the last stream, which the next one most likely repeats
+  sync_util::sync_t<std::optional<config_t>> last_stream_config;
+
+  sync_util::sync_t<std::optional<prewarmed_session_t>> prewarmed_session;
+
+  void prewarm_run(config_t config) {
+    auto &encoder = session_encoder(config);
+
+    // Streams start on the configured output
+    auto ref = capture_thread_async(capture_display_name(encoder.platform_formats->dev_type, -1), encoder).ref();
+    if (!ref) {
+      return;
+    }
+
+    // The capture thread opens the display for its first context, the frames it captures for it are dropped
+    auto images = std::make_shared<img_event_t::element_type>();
+    auto images_guard = util::fail_guard([&]() {
+      images->stop();
+    });
+    ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
+
+    auto deadline = std::chrono::steady_clock::now() + PREWARM_TIMEOUT;
+
+    std::shared_ptr<platf::display_t> display;
+    while (!display && ref->capture_ctx_queue->running() && std::chrono::steady_clock::now() < deadline) {
+      {
+        auto lg = ref->display_wp.lock();
+        display = ref->display_wp->lock();
+      }
+
+      if (!display) {
+        std::this_thread::sleep_for(20ms);
+      }
+    }
+    if (!display) {
+      return;
+    }
+
+    auto encode_device = make_encode_device(*display, encoder, config);
+    if (!encode_device) {
+      return;
+    }
+    auto colorspace = encode_device->colorspace;
+
+    auto session = make_encode_session(display.get(), encoder, config, display->width, display->height, std::move(encode_device));
+    if (!session) {
+      return;
+    }
+
+    BOOST_LOG(info) << "Prewarmed encoder for "sv << config.width << 'x' << config.height << 'x' << config.framerate;
+
+    {
+      auto lg = prewarmed_session.lock();
+      *prewarmed_session = prewarmed_session_t {config, std::move(display), colorspace, std::move(session)};
+    }
+
+    // Keep the capture thread running until the stream takes the session over.
+    // The display can't be reinitialized while the session refers to it.
+    while (std::chrono::steady_clock::now() < deadline && !ref->reinit_event.peek()) {
+      {
+        auto lg = prewarmed_session.lock();
+        if (!prewarmed_session->has_value()) {
+          return;
+        }
+      }
+
+      std::this_thread::sleep_for(20ms);
+    }
+
+    std::optional<prewarmed_session_t> unused;
+    {
+      auto lg = prewarmed_session.lock();
+      unused = std::move(*prewarmed_session);
+      prewarmed_session->reset();
+    }
+
+    if (unused) {
+      BOOST_LOG(info) << "Prewarmed encoder went unused"sv;
+    }
+  }
+
+  /**
+   * @brief Take over the prewarmed session if it was built for this stream.
+   * @param display The display the stream captures.
+   * @param config The config of the stream.
+   * @return The session, or `std::nullopt` if one must be built.
+   */
+  std::optional<prewarmed_session_t> take_prewarmed_session(const std::shared_ptr<platf::display_t> &display, const config_t &config) {
+    std::optional<prewarmed_session_t> prewarmed;
+    {
+      auto lg = prewarmed_session.lock();
+      prewarmed = std::move(*prewarmed_session);
+      prewarmed_session->reset();
+    }
+
+    if (!prewarmed) {
+      return std::nullopt;
+    }
+
+    if (prewarmed->display != display || !prewarmed->session->reconfigure(prewarmed->config, config)) {
+      BOOST_LOG(info) << "Prewarmed encoder doesn't match the stream"sv;
+      return std::nullopt;
+    }
+
+    BOOST_LOG(info) << "Using the prewarmed encoder"sv;
+    return prewarmed;
+  }
+
+  void prewarm(int width, int height, int framerate, bool enable_hdr) {
+    if (!config::video.encoder_prewarm || !chosen_encoder || !(chosen_encoder->flags & PARALLEL_ENCODING)) {
+      return;
+    }
+
+    std::optional<config_t> config;
+    {
+      auto lg = last_stream_config.lock();
+      config = *last_stream_config;
+    }
+
+    // Clients don't announce the codec and bitrate until their stream starts
+    if (!config) {
+      BOOST_LOG(debug) << "Nothing to prewarm the encoder for before the first stream"sv;
+      return;
+    }
+
+    config->width = width;
+    config->height = height;
+    config->framerate = framerate;
+    if (!enable_hdr) {
+      config->dynamicRange = 0;
+    } else if (config->videoFormat > 0) {
+      config->dynamicRange = 1;
+    }
 
-    std::vector<std::string> display_names;
-    int display_p = -1;
-    while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {}
+    std::thread {prewarm_run, *config}.detach();
   }
 
   void capture_async(
@@ -2261,10 +3821,46 @@ namespace video {
       shutdown_event->raise(true);
     });
 
-    auto ref = capture_thread_async.ref();
+    auto switch_display_event = mail->event<int>(mail::switch_display);
+    auto capture_display_event = mail->event<std::string>(mail::capture_display);
+
+    // Sessions the chosen encoder can't stream run on one of the secondary encoders
+    auto &encoder = session_encoder(config);
+
+    // Streams start on the configured output, each can switch to another display on its own
+    auto display_name = capture_display_name(encoder.platform_formats->dev_type, -1);
+    auto ref = capture_thread_async(display_name, encoder).ref();
     if (!ref) {
       return;
     }
+    capture_display_event->raise(display_name);
+
+    int frame_nr = 1;
+
+    // Sessions requesting the same stream as a running encoder receive its frames,
+    // until they run the encoder themselves
+    std::shared_ptr<shared_encoder_t> shared_encoder;
+    shared_session_t shared_session {
+      mail->event<bool>(mail::idr),
+      mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames),
+      mail->event<hdr_info_t>(mail::hdr),
+      mail->event<input::touch_port_t>(mail::touch_port),
+      channel_data,
+      &frame_nr,
+      &config,
+    };
+    auto leave_guard = util::fail_guard([&]() {
+      if (shared_encoder) {
+        leave_shared_encoder(*shared_encoder, shared_session);
+      }
+    });
+
+    if (config::video.shared_encoding) {
+      shared_encoder = join_shared_encoder(shared_session, config, display_name);
+      if (!follow_shared_encoder(shared_encoder, shared_session, shutdown_event, switch_display_event)) {
+        return;
+      }
+    }
 
     ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
 
@@ -2272,50 +3868,94 @@ namespace video {
       return;
     }
 
-    int frame_nr = 1;
+    last_stream_config = config;
 
     auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
     auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
 
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
+    thread_affinity::pin(thread_affinity::role_e::encode);
+    timeline::set_thread_name("encode");
 
     while (!shutdown_event->peek() && images->running()) {
-      // Wait for the main capture event when the display is being reinitialized
-      if (ref->reinit_event.peek()) {
-        std::this_thread::sleep_for(20ms);
+      // Move over to the capture thread of the display the session switched to
+      if (switch_display_event->peek()) {
+        auto new_display_name = capture_display_name(encoder.platform_formats->dev_type, *switch_display_event->pop());
+        if (new_display_name == display_name) {
+          continue;
+        }
+
+        // The other sessions receiving the frames of the encoder stay on the display
+        if (shared_encoder) {
+          leave_shared_encoder(*shared_encoder, shared_session);
+          shared_encoder.reset();
+        }
+
+        images->stop();
+        images = std::make_shared<img_event_t::element_type>();
+
+        BOOST_LOG(info) << "Switching the stream to display ["sv << new_display_name << ']';
+        display_name = std::move(new_display_name);
+        ref = capture_thread_async(display_name, encoder).ref();
+        if (!ref) {
+          return;
+        }
+        ref->capture_ctx_queue->raise(capture_ctx_t {images, config});
+        capture_display_event->raise(display_name);
+
         continue;
       }
-      // Wait for the display to be ready
+
+      // Wait for the capture thread to finish reinitializing the display,
+      // the timeout keeps the session responsive to shutdown and display switches
+      if (!ref->display_ready_event.view(100ms)) {
+        continue;
+      }
+
       std::shared_ptr<platf::display_t> display;
       {
         auto lg = ref->display_wp.lock();
-        if (ref->display_wp->expired()) {
-          continue;
-        }
-
         display = ref->display_wp->lock();
       }
+      if (!display) {
+        continue;
+      }
 
-      auto &encoder = *chosen_encoder;
+      std::unique_ptr<encode_session_t> session;
+      sunshine_colorspace_t colorspace;
+      if (auto prewarmed = take_prewarmed_session(display, config)) {
+        session = std::move(prewarmed->session);
+        colorspace = prewarmed->colorspace;
+      } else {
+        auto encode_device = make_encode_device(*display, encoder, config);
+        if (!encode_device) {
+          return;
+        }
+        colorspace = encode_device->colorspace;
 
-      auto encode_device = make_encode_device(*display, encoder, config);
-      if (!encode_device) {
-        return;
+        session = make_encode_session(display.get(), encoder, config, display->width, display->height, std::move(encode_device));
+        if (!session) {
+          return;
+        }
       }
 
       // absolute mouse coordinates require that the dimensions of the screen are known
-      touch_port_event->raise(make_port(display.get(), config));
+      auto touch_port = make_port(display.get(), config);
+      touch_port_event->raise(touch_port);
 
       // Update client with our current HDR display state
       hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
-      if (colorspace_is_hdr(encode_device->colorspace)) {
+      if (colorspace_is_hdr(colorspace)) {
         if (display->get_hdr_metadata(hdr_info->metadata)) {
           hdr_info->enabled = true;
         } else {
           BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
         }
       }
+      if (shared_encoder) {
+        update_shared_display(*shared_encoder, touch_port, *hdr_info);
+      }
       hdr_event->raise(std::move(hdr_info));
 
       encode_run(
@@ -2324,11 +3964,16 @@ namespace video {
         images,
         config,
         display,
-        std::move(encode_device),
+        std::move(session),
         ref->reinit_event,
-        *ref->encoder_p,
-        channel_data
+        encoder,
+        channel_data,
+        shared_encoder.get()
       );
+
+      // Let the capture thread know it can reinitialize the display
+      display.reset();
+      ref->display_released_event.raise(true);
     }
   }
 
@@ -2352,6 +3997,9 @@ namespace video {
         std::move(idr_events),
         mail->event<hdr_info_t>(mail::hdr),
         mail->event<input::touch_port_t>(mail::touch_port),
+        mail->event<int>(mail::bitrate),
+        mail->event<int>(mail::switch_display),
+        mail->event<std::string>(mail::capture_display),
         config,
         1,
         channel_data,
@@ -2599,7 +4247,182 @@ namespace video {
     return true;
   }
 
+  /**
+   * @brief Get the key probe results are cached under.
+   * @param fingerprint The GPUs, drivers and displays of this system.
+   * @return The key, which changes along with anything that may change the probe results.
+   */
+  std::string encoder_cache_key(const std::string &fingerprint) {
+    auto config = file_handler::read_file(config::sunshine.config_file.c_str());
+
+    return util::hex(crypto::hash(PROJECT_VERSION + "\n"s + fingerprint + config)).to_string();
+  }
+
+  fs::path encoder_cache_path() {
+    return fs::path {config::nvhttp.file_state}.parent_path() / "encoder_cache.json";
+  }
+
+  /**
+   * @brief Restore the results of the last probe.
+   * @param key The key the results must have been cached under.
+   * @return `true` if the cached encoder was chosen again, `false` if a probe is needed.
+   */
+  bool load_encoder_cache(const std::string &key) {
+    auto path = encoder_cache_path();
+    if (!fs::exists(path)) {
+      return false;
+    }
+
+    try {
+      pt::ptree tree;
+      pt::read_json(path.string(), tree);
+
+      if (tree.get<std::string>("key") != key) {
+        BOOST_LOG(info) << "GPU, driver or configuration changed since the last encoder probe"sv;
+        return false;
+      }
+
+      auto name = tree.get<std::string>("encoder");
+      auto pos = std::find_if(std::begin(encoders), std::end(encoders), [&name](auto encoder) {
+        return encoder->name == name;
+      });
+      if (pos == std::end(encoders)) {
+        return false;
+      }
+
+      auto &encoder = **pos;
+      encoder.h264.capabilities = std::bitset<encoder_t::MAX_FLAGS> {tree.get<std::string>("h264")};
+      encoder.hevc.capabilities = std::bitset<encoder_t::MAX_FLAGS> {tree.get<std::string>("hevc")};
+      encoder.av1.capabilities = std::bitset<encoder_t::MAX_FLAGS> {tree.get<std::string>("av1")};
+      active_hevc_mode = tree.get<int>("hevc_mode");
+      active_av1_mode = tree.get<int>("av1_mode");
+
+      secondary_encoders.clear();
+      if (auto secondaries = tree.get_child_optional("secondary"s)) {
+        for (auto &[_, secondary] : *secondaries) {
+          auto name = secondary.get<std::string>("encoder");
+          auto pos = std::find_if(std::begin(encoders), std::end(encoders), [&name](auto encoder) {
+            return encoder->name == name;
+          });
+          if (pos == std::end(encoders)) {
+            return false;
+          }
+
+          (*pos)->h264.capabilities = std::bitset<encoder_t::MAX_FLAGS> {secondary.get<std::string>("h264")};
+          (*pos)->hevc.capabilities = std::bitset<encoder_t::MAX_FLAGS> {secondary.get<std::string>("hevc")};
+          (*pos)->av1.capabilities = std::bitset<encoder_t::MAX_FLAGS> {secondary.get<std::string>("av1")};
+          secondary_encoders.emplace_back(*pos);
+        }
+      }
+
+      chosen_encoder = &encoder;
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't read "sv << path << ": "sv << e.what();
+      return false;
+    }
+
+    BOOST_LOG(info) << "Using the cached results of the last encoder probe"sv;
+    return true;
+  }
+
+  /**
+   * @brief Cache the results of a probe for the next start.
+   * @param key The key to cache the results under.
+   */
+  void save_encoder_cache(const std::string &key) {
+    auto &encoder = *chosen_encoder;
+
+    pt::ptree tree;
+    tree.put("key"s, key);
+    tree.put("encoder"s, encoder.name);
+    tree.put("h264"s, encoder.h264.capabilities.to_string());
+    tree.put("hevc"s, encoder.hevc.capabilities.to_string());
+    tree.put("av1"s, encoder.av1.capabilities.to_string());
+    tree.put("hevc_mode"s, active_hevc_mode);
+    tree.put("av1_mode"s, active_av1_mode);
+
+    if (!secondary_encoders.empty()) {
+      pt::ptree secondaries;
+      for (auto secondary : secondary_encoders) {
+        pt::ptree child;
+        child.put("encoder"s, secondary->name);
+        child.put("h264"s, secondary->h264.capabilities.to_string());
+        child.put("hevc"s, secondary->hevc.capabilities.to_string());
+        child.put("av1"s, secondary->av1.capabilities.to_string());
+        secondaries.push_back(std::make_pair(""s, child));
+      }
+      tree.add_child("secondary"s, secondaries);
+    }
+
+    auto path = encoder_cache_path();
+    try {
+      pt::write_json(path.string(), tree);
+    } catch (std::exception &e) {
+      BOOST_LOG(warning) << "Couldn't write "sv << path << ": "sv << e.what();
+    }
+  }
+
+  // The fingerprint a live probe last succeeded with, results restored from the cache weren't validated on this run
+  static std::string validated_fingerprint;
+
+  // Checks the results restored from the cache in the background, every probe waits for it
+  static std::shared_future<void> encoder_cache_revalidation;
+
+  /**
+   * @brief Check that the cached results still describe the chosen encoder.
+   * @details Only the chosen and secondary encoders are validated, so this takes a fraction of a full probe.
+   *          If their capabilities changed, the cache is dropped and the next probe is a full one.
+   * @param fingerprint The fingerprint the results were restored for.
+   */
+  void revalidate_encoder_cache(std::string fingerprint) {
+    auto unchanged = [](encoder_t &encoder) {
+      auto h264 = encoder.h264.capabilities;
+      auto hevc = encoder.hevc.capabilities;
+      auto av1 = encoder.av1.capabilities;
+
+      return validate_encoder(encoder, false) &&
+             encoder.h264.capabilities == h264 && encoder.hevc.capabilities == hevc && encoder.av1.capabilities == av1;
+    };
+
+    if (unchanged(*chosen_encoder) && std::all_of(std::begin(secondary_encoders), std::end(secondary_encoders), [&](auto encoder) {
+          return unchanged(*encoder);
+        })) {
+      BOOST_LOG(info) << "Cached encoder probe results are up to date"sv;
+
+      validated_fingerprint = std::move(fingerprint);
+      return;
+    }
+
+    BOOST_LOG(warning) << "Cached encoder probe results are outdated, encoders will be probed again before streaming"sv;
+
+    std::error_code ec;
+    fs::remove(encoder_cache_path(), ec);
+
+    chosen_encoder = nullptr;
+    secondary_encoders.clear();
+  }
+
+  // Taken by each probe, the first one runs while the servers are already answering clients
+  static std::mutex probe_lock;
+
+  // Set once the first probe is done, whether it found an encoder or not
+  static std::atomic_bool probed;
+
+  bool encoders_ready() {
+    return probed.load(std::memory_order_acquire);
+  }
+
   int probe_encoders() {
+    std::lock_guard lg {probe_lock};
+    auto probed_guard = util::fail_guard([]() {
+      probed.store(true, std::memory_order_release);
+    });
+
+    // Results restored from the cache may not be relied upon until they're checked
+    if (encoder_cache_revalidation.valid()) {
+      encoder_cache_revalidation.wait();
+    }
+
     if (!allow_encoder_probing()) {
       // Error already logged
       return -1;
@@ -2607,17 +4430,28 @@ namespace video {
 
     auto encoder_list = encoders;
 
+    auto fingerprint = platf::gpu_fingerprint();
+
     // If we already have a good encoder, check to see if another probe is required
-    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) && !platf::needs_encoder_reenumeration()) {
+    if (chosen_encoder && !(chosen_encoder->flags & ALWAYS_REPROBE) &&
+        (!platf::needs_encoder_reenumeration() || (!fingerprint.empty() && fingerprint == validated_fingerprint))) {
       return 0;
     }
 
     // Restart encoder selection
     auto previous_encoder = chosen_encoder;
     chosen_encoder = nullptr;
+    secondary_encoders.clear();
     active_hevc_mode = config::video.hevc_mode;
     active_av1_mode = config::video.av1_mode;
     last_encoder_probe_supported_ref_frames_invalidation = false;
+    validated_fingerprint.clear();
+
+    // Without a fingerprint, there is no telling whether cached results are still valid
+    auto cache_key = fingerprint.empty() ? std::string {} : encoder_cache_key(fingerprint);
+
+    // Only the very first probe may be skipped, later ones happen because something changed
+    auto cached = !previous_encoder && !encoder_cache_revalidation.valid() && config::video.encoder_probe_cache && !cache_key.empty() && load_encoder_cache(cache_key);
 
     auto adjust_encoder_constraints = [&](encoder_t *encoder) {
       // If we can't satisfy both the encoder and codec requirement, prefer the encoder over codec support
@@ -2638,7 +4472,7 @@ namespace video {
       }
     };
 
-    if (!config::video.encoder.empty()) {
+    if (!cached && !config::video.encoder.empty()) {
       // If there is a specific encoder specified, use it if it passes validation
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
@@ -2665,7 +4499,39 @@ namespace video {
       }
     }
 
-    BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
+    if (!cached) {
+      BOOST_LOG(info) << "// Testing for available encoders, this may generate errors. You can safely ignore those errors. //"sv;
+    }
+
+    // The results of encoders validated ahead of the one being considered
+    std::map<encoder_t *, bool> validated;
+    auto validate = [&](decltype(encoder_list)::iterator pos) {
+      auto encoder = *pos;
+
+      if (!validated.contains(encoder)) {
+        // Each encoder opens its own display and device, so the next few can be validated along with this one
+        auto policy = config::video.encoder_probe_sessions > 1 ? std::launch::async : std::launch::deferred;
+
+        std::vector<std::pair<encoder_t *, std::future<bool>>> probes;
+        for (; pos != std::end(encoder_list) && probes.size() < (std::size_t) config::video.encoder_probe_sessions; ++pos) {
+          if (validated.contains(*pos)) {
+            continue;
+          }
+
+          // If we've used a previous encoder and it's not this one, we expect this encoder to
+          // fail to validate. It will use a slightly different order of checks to more quickly
+          // eliminate failing encoders.
+          auto expect_failure = previous_encoder && previous_encoder != *pos;
+          probes.emplace_back(*pos, std::async(policy, validate_encoder, std::ref(**pos), expect_failure));
+        }
+
+        for (auto &[probed, result] : probes) {
+          validated[probed] = result.get();
+        }
+      }
+
+      return validated[encoder];
+    };
 
     // If we haven't found an encoder yet, but we want one with specific codec support, search for that now.
     if (chosen_encoder == nullptr && (active_hevc_mode >= 2 || active_av1_mode >= 2)) {
@@ -2673,7 +4539,7 @@ namespace video {
         auto encoder = *pos;
 
         // Remove the encoder from the list entirely if it fails validation
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!validate(pos)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2707,10 +4573,7 @@ namespace video {
       KITTY_WHILE_LOOP(auto pos = std::begin(encoder_list), pos != std::end(encoder_list), {
         auto encoder = *pos;
 
-        // If we've used a previous encoder and it's not this one, we expect this encoder to
-        // fail to validate. It will use a slightly different order of checks to more quickly
-        // eliminate failing encoders.
-        if (!validate_encoder(*encoder, previous_encoder && previous_encoder != encoder)) {
+        if (!validate(pos)) {
           pos = encoder_list.erase(pos);
           continue;
         }
@@ -2734,19 +4597,62 @@ namespace video {
       return -1;
     }
 
-    BOOST_LOG(info);
-    BOOST_LOG(info) << "// Ignore any errors mentioned above, they are not relevant. //"sv;
-    BOOST_LOG(info);
+    if (!cached) {
+      BOOST_LOG(info);
+      BOOST_LOG(info) << "// Ignore any errors mentioned above, they are not relevant. //"sv;
+      BOOST_LOG(info);
+    }
 
     auto &encoder = *chosen_encoder;
 
+    // Sessions requesting a codec the chosen encoder can't stream run on another hardware encoder next to it.
+    // This needs both to run in parallel, and sticks to the encoder asked for if there is one.
+    auto missing = [&](int videoFormat) {
+      auto mode = videoFormat == 1 ? active_hevc_mode : active_av1_mode;
+      config_t config {};
+      config.videoFormat = videoFormat;
+
+      return mode != 1 && !encoder_handles(encoder, config) && std::none_of(std::begin(secondary_encoders), std::end(secondary_encoders), [&](auto secondary) {
+               return encoder_handles(*secondary, config);
+             });
+    };
+    if (!cached && config::video.encoder.empty() && (encoder.flags & PARALLEL_ENCODING)) {
+      for (auto pos = std::begin(encoder_list); pos != std::end(encoder_list) && (missing(1) || missing(2)); ++pos) {
+        auto secondary = *pos;
+        if (secondary == chosen_encoder || !(secondary->flags & PARALLEL_ENCODING) ||
+            secondary->platform_formats->dev_type == platf::mem_type_e::system) {
+          continue;
+        }
+
+        auto fills = [&](int videoFormat) {
+          config_t config {};
+          config.videoFormat = videoFormat;
+          return missing(videoFormat) && encoder_handles(*secondary, config);
+        };
+        if (validate(pos) && (fills(1) || fills(2))) {
+          BOOST_LOG(info) << "Encoder ["sv << secondary->name << "] streams the codecs ["sv << encoder.name << "] can't"sv;
+          secondary_encoders.emplace_back(secondary);
+        }
+      }
+    }
+
+    // The codecs and chroma samplings clients are told about, any of the encoders may stream them
+    auto any_encoder = [&](auto supports) {
+      return supports(encoder) || std::any_of(std::begin(secondary_encoders), std::end(secondary_encoders), [&](auto secondary) {
+               return supports(*secondary);
+             });
+    };
+
     last_encoder_probe_supported_ref_frames_invalidation = (encoder.flags & REF_FRAMES_INVALIDATION);
-    last_encoder_probe_supported_yuv444_for_codec[0] = encoder.h264[encoder_t::PASSED] &&
-                                                       encoder.h264[encoder_t::YUV444];
-    last_encoder_probe_supported_yuv444_for_codec[1] = encoder.hevc[encoder_t::PASSED] &&
-                                                       encoder.hevc[encoder_t::YUV444];
-    last_encoder_probe_supported_yuv444_for_codec[2] = encoder.av1[encoder_t::PASSED] &&
-                                                       encoder.av1[encoder_t::YUV444];
+    last_encoder_probe_supported_yuv444_for_codec[0] = any_encoder([](const encoder_t &candidate) {
+      return candidate.h264[encoder_t::PASSED] && candidate.h264[encoder_t::YUV444];
+    });
+    last_encoder_probe_supported_yuv444_for_codec[1] = any_encoder([](const encoder_t &candidate) {
+      return candidate.hevc[encoder_t::PASSED] && candidate.hevc[encoder_t::YUV444];
+    });
+    last_encoder_probe_supported_yuv444_for_codec[2] = any_encoder([](const encoder_t &candidate) {
+      return candidate.av1[encoder_t::PASSED] && candidate.av1[encoder_t::YUV444];
+    });
 
     BOOST_LOG(debug) << "------  h264 ------"sv;
     for (int x = 0; x < encoder_t::MAX_FLAGS; ++x) {
@@ -2779,13 +4685,296 @@ namespace video {
     }
 
     if (active_hevc_mode == 0) {
-      active_hevc_mode = encoder.hevc[encoder_t::PASSED] ? (encoder.hevc[encoder_t::DYNAMIC_RANGE] ? 3 : 2) : 1;
+      auto passed = any_encoder([](const encoder_t &candidate) {
+        return candidate.hevc[encoder_t::PASSED];
+      });
+      auto dynamic_range = any_encoder([](const encoder_t &candidate) {
+        return candidate.hevc[encoder_t::PASSED] && candidate.hevc[encoder_t::DYNAMIC_RANGE];
+      });
+      active_hevc_mode = passed ? (dynamic_range ? 3 : 2) : 1;
     }
 
     if (active_av1_mode == 0) {
-      active_av1_mode = encoder.av1[encoder_t::PASSED] ? (encoder.av1[encoder_t::DYNAMIC_RANGE] ? 3 : 2) : 1;
+      auto passed = any_encoder([](const encoder_t &candidate) {
+        return candidate.av1[encoder_t::PASSED];
+      });
+      auto dynamic_range = any_encoder([](const encoder_t &candidate) {
+        return candidate.av1[encoder_t::PASSED] && candidate.av1[encoder_t::DYNAMIC_RANGE];
+      });
+      active_av1_mode = passed ? (dynamic_range ? 3 : 2) : 1;
+    }
+
+    if (cached) {
+      // Answer clients right away and leave the check for the first stream to wait on
+      encoder_cache_revalidation = std::async(std::launch::async, revalidate_encoder_cache, fingerprint).share();
+    } else {
+      validated_fingerprint = fingerprint;
+
+      if (!(encoder.flags & ALWAYS_REPROBE) && !cache_key.empty()) {
+        save_encoder_cache(cache_key);
+      }
+    }
+
+    return 0;
+  }
+
+  namespace {
+    /// The images captured from the display, which the captured runs cycle through
+    constexpr std::size_t BENCHMARK_CAPTURED_IMAGES = 8;
+
+    /// How long to wait for the display to update while capturing the images
+    constexpr auto BENCHMARK_CAPTURE_TIMEOUT = 3s;
+
+    /// The frames of each run encoded before the latencies are tracked, while the encoder settles
+    constexpr int BENCHMARK_WARMUP_FRAMES = 10;
+
+    /// The resolutions and frame rates of the runs
+    constexpr std::array<std::array<int, 3>, 6> BENCHMARK_MODES {{
+      {1280, 720, 60},
+      {1920, 1080, 60},
+      {1920, 1080, 120},
+      {2560, 1440, 60},
+      {2560, 1440, 120},
+      {3840, 2160, 60},
+    }};
+
+    struct benchmark_content_t {
+      const char *name;
+      std::vector<std::shared_ptr<platf::img_t>> images;
+
+      // Every frame is an IDR frame, the worst case of a stream recovering from losses
+      bool keyframes;
+    };
+
+    struct benchmark_result_t {
+      std::string encoder;
+      std::string codec;
+      config_t config {};
+      const char *content {};
+
+      // The time to convert and encode each frame, in milliseconds
+      stat_trackers::histogram_tracker latency;
+
+      // The frames encoded back to back each second
+      double max_fps {};
+      double bitrate_kbps {};
+    };
+
+    /**
+     * @brief Capture a few images of the display, to be encoded as they would be streamed.
+     * @return The images, fewer of them if the display didn't update in time.
+     */
+    std::vector<std::shared_ptr<platf::img_t>> capture_benchmark_images(platf::display_t &disp) {
+      std::vector<std::shared_ptr<platf::img_t>> images;
+      std::shared_ptr<platf::img_t> spare;
+
+      auto deadline = std::chrono::steady_clock::now() + BENCHMARK_CAPTURE_TIMEOUT;
+      auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+        if (!spare) {
+          spare = disp.alloc_img();
+        }
+
+        img_out = spare;
+        return (bool) img_out;
+      };
+      auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img) {
+          // The images are cycled through, so each one is converted in full
+          img->damage.reset();
+          images.emplace_back(std::move(img));
+          spare.reset();
+        }
+
+        return images.size() < BENCHMARK_CAPTURED_IMAGES && std::chrono::steady_clock::now() < deadline;
+      };
+
+      disp.capture(push_captured_image_callback, pull_free_image_callback, capture_cursor_flag());
+
+      return images;
+    }
+
+    /**
+     * @brief Convert and encode the images of the content back to back.
+     * @param result Filled with the latencies and throughput of the encoder.
+     * @return `false` if the encoder couldn't encode this config.
+     */
+    bool benchmark_config(platf::display_t &disp, const encoder_t &encoder, const config_t &config, const benchmark_content_t &content, int frames, benchmark_result_t &result) {
+      auto encode_device = make_encode_device(disp, encoder, config);
+      if (!encode_device) {
+        return false;
+      }
+
+      auto session = make_encode_session(&disp, encoder, config, disp.width, disp.height, std::move(encode_device));
+      if (!session) {
+        return false;
+      }
+
+      result.encoder = encoder.name;
+      result.codec = encoder.codec_from_config(config).name;
+      result.config = config;
+      result.content = content.name;
+
+      auto packets = mail::man->queue<packet_t>(mail::video_packets);
+      std::uint64_t bytes = 0;
+      std::chrono::steady_clock::duration elapsed {};
+
+      for (int x = 0; x < BENCHMARK_WARMUP_FRAMES + frames; ++x) {
+        auto &img = *content.images[x % content.images.size()];
+
+        auto begin = std::chrono::steady_clock::now();
+        if (content.keyframes || x == 0) {
+          session->request_idr_frame();
+        }
+        if (session->convert(img) || encode(x + 1, *session, packets, nullptr, {})) {
+          BOOST_LOG(error) << "Encoder ["sv << encoder.name << "] failed to encode frame "sv << x + 1;
+          return false;
+        }
+
+        std::uint64_t frame_bytes = 0;
+        while (packets->peek()) {
+          frame_bytes += packets->pop()->data_size();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        if (x >= BENCHMARK_WARMUP_FRAMES) {
+          result.latency.collect(std::chrono::duration<double, std::milli>(end - begin).count());
+          elapsed += end - begin;
+          bytes += frame_bytes;
+        }
+      }
+
+      // Drop what the encoder still held when the session ends
+      session.reset();
+      while (packets->peek()) {
+        packets->pop();
+      }
+
+      auto seconds = std::chrono::duration<double>(elapsed).count();
+      result.max_fps = seconds > 0 ? frames / seconds : 0;
+      result.bitrate_kbps = bytes * 8.0 / 1000 * config.framerate / frames;
+
+      return true;
+    }
+
+    void print_benchmark_results(const std::list<benchmark_result_t> &results) {
+      auto two_digits = [](double value) {
+        return (stat_trackers::two_digits_after_decimal() % value).str();
+      };
+
+      std::cout
+        << std::endl
+        << "encoder     | codec             | mode         | content   | p50 ms | p95 ms | p99 ms | p99.9 ms | max ms | max fps | kbps    | sustained"sv << std::endl;
+
+      for (auto &result : results) {
+        auto &latency = result.latency;
+
+        // A frame taking longer than the frame interval delays the next one
+        auto sustained = result.max_fps >= result.config.framerate && latency.percentile(99) <= 1000.0 / result.config.framerate;
+
+        auto mode = std::to_string(result.config.width) + 'x' + std::to_string(result.config.height) + '@' + std::to_string(result.config.framerate);
+
+        std::cout
+          << std::left
+          << std::setw(11) << result.encoder << " | "sv
+          << std::setw(17) << result.codec << " | "sv
+          << std::setw(12) << mode << " | "sv
+          << std::setw(9) << result.content << " | "sv
+          << std::right
+          << std::setw(6) << two_digits(latency.percentile(50)) << " | "sv
+          << std::setw(6) << two_digits(latency.percentile(95)) << " | "sv
+          << std::setw(6) << two_digits(latency.percentile(99)) << " | "sv
+          << std::setw(8) << two_digits(latency.percentile(99.9)) << " | "sv
+          << std::setw(6) << two_digits(latency.max()) << " | "sv
+          << std::setw(7) << (int) result.max_fps << " | "sv
+          << std::setw(7) << (int) result.bitrate_kbps << " | "sv
+          << (sustained ? "yes"sv : "no"sv) << std::endl;
+      }
+
+      std::cout << std::endl;
+    }
+  }  // namespace
+
+  int benchmark_encoders(int frames) {
+    const auto output_name {display_device::map_output_name(config::video.output_name)};
+
+    active_hevc_mode = config::video.hevc_mode;
+    active_av1_mode = config::video.av1_mode;
+
+    // The trackers can't be moved, so the results stay where they're created
+    std::list<benchmark_result_t> results;
+    for (auto encoder : encoders) {
+      if (!config::video.encoder.empty() && encoder->name != config::video.encoder) {
+        continue;
+      }
+
+      // Tells which codecs the encoder supports
+      if (!validate_encoder(*encoder, false)) {
+        continue;
+      }
+
+      config_t display_config {1920, 1080, 60, 1000, 1, 0, 1, 0, 0, 0};
+
+      std::shared_ptr<platf::display_t> disp;
+      reset_display(disp, encoder->platform_formats->dev_type, output_name, display_config);
+      if (!disp) {
+        continue;
+      }
+
+      std::vector<benchmark_content_t> contents;
+      {
+        auto img = disp->alloc_img();
+        if (!img || disp->dummy_img(img.get())) {
+          continue;
+        }
+
+        contents.push_back({"still", {img}, false});
+        contents.push_back({"keyframes", {img}, true});
+      }
+
+      // Captured through the display of this encoder, since the images live on its device
+      auto captured = capture_benchmark_images(*disp);
+      if (captured.empty()) {
+        BOOST_LOG(warning) << "No image was captured for encoder ["sv << encoder->name << "], only the synthetic content is encoded"sv;
+      } else {
+        contents.push_back({"captured", std::move(captured), false});
+      }
+
+      for (int video_format = 0; video_format < 3; ++video_format) {
+        auto &codec = video_format == 0 ? encoder->h264 : video_format == 1 ? encoder->hevc : encoder->av1;
+        if (!codec[encoder_t::PASSED]) {
+          continue;
+        }
+
+        for (auto [width, height, framerate] : BENCHMARK_MODES) {
+          // About 0.1 bits per pixel, like the default bitrate for 1080p at 60 fps
+          auto bitrate = (int) ((std::int64_t) width * height * framerate / 10000);
+          config_t config {width, height, framerate, bitrate, 1, 0, 1, video_format, 0, 0};
+
+          if (!disp->is_codec_supported(codec.name, config)) {
+            continue;
+          }
+
+          for (auto &content : contents) {
+            BOOST_LOG(info) << "Benchmarking encoder ["sv << encoder->name << "] with "sv << codec.name << " at "sv
+                            << width << 'x' << height << '@' << framerate << " on "sv << content.name << " content"sv;
+
+            if (!benchmark_config(*disp, *encoder, config, content, frames, results.emplace_back())) {
+              BOOST_LOG(warning) << "Encoder ["sv << encoder->name << "] can't encode "sv << codec.name << " at "sv << width << 'x' << height << '@' << framerate;
+              results.pop_back();
+              break;
+            }
+          }
+        }
+      }
     }
 
+    if (results.empty()) {
+      BOOST_LOG(error) << "No encoder could be benchmarked"sv;
+      return -1;
+    }
+
+    print_benchmark_results(results);
+
     return 0;
   }
 
@@ -2877,8 +5066,9 @@ namespace video {
 #endif
 
   int start_capture_async(capture_thread_async_ctx_t &capture_thread_ctx) {
-    capture_thread_ctx.encoder_p = chosen_encoder;
     capture_thread_ctx.reinit_event.reset();
+    capture_thread_ctx.display_ready_event.reset();
+    capture_thread_ctx.display_released_event.reset();
 
     capture_thread_ctx.capture_ctx_queue = std::make_shared<safe::queue_t<capture_ctx_t>>(30);
 
@@ -2887,7 +5077,11 @@ namespace video {
       capture_thread_ctx.capture_ctx_queue,
       std::ref(capture_thread_ctx.display_wp),
       std::ref(capture_thread_ctx.reinit_event),
-      std::ref(*capture_thread_ctx.encoder_p)
+      std::ref(capture_thread_ctx.display_ready_event),
+      std::ref(capture_thread_ctx.display_released_event),
+      std::ref(*capture_thread_ctx.encoder_p),
+      std::cref(capture_thread_ctx.display_name),
+      std::ref(*capture_thread_ctx.capture_pool)
     };
 
     return 0;
@@ -4,7 +4,17 @@
  */
 #pragma once
 
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
 // local includes
+#include "image_pool.h"
 #include "input.h"
 #include "platform/common.h"
 #include "thread_safe.h"
@@ -42,6 +52,10 @@ namespace video {
     int chromaSamplingType;  // 0 - 4:2:0, 1 - 4:4:4
 
     int enableIntraRefresh;  // 0 - disabled, 1 - enabled
+
+    int maxFrameSize;  // Bits the link to the client delivers within a frame interval, the largest frame worth encoding, 0 for no cap
+
+    bool operator==(const config_t &) const = default;
   };
 
   platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
@@ -204,9 +218,52 @@ namespace video {
 
     virtual void request_idr_frame() = 0;
 
+    /**
+     * @brief Let the client recover from lost frames with the next ones.
+     * @details Encoders that can refresh the picture gradually do so when configured to,
+     *          the others encode an IDR frame.
+     */
+    virtual void request_recovery_frame() {
+      request_idr_frame();
+    }
+
     virtual void request_normal_frame() = 0;
 
     virtual void invalidate_ref_frames(int64_t first_frame, int64_t last_frame) = 0;
+
+    /**
+     * @brief Change the bitrate of the following frames.
+     * @param bitrate The bitrate in Kbps.
+     * @return `true` if the encoder took the new bitrate, `false` if it can't change it while running.
+     */
+    virtual bool set_bitrate(int bitrate) = 0;
+
+    /**
+     * @brief Change the frame rate of the following frames.
+     * @param framerate The frame rate the rate control budgets for.
+     * @return `true` if the encoder took the new frame rate, `false` if it can't change it while running.
+     */
+    virtual bool set_framerate(int framerate) = 0;
+
+    /**
+     * @brief Encode the regions the user works in at a lower QP than the rest of the following frames.
+     * @details Encoders that can't vary the QP across the frame ignore them.
+     * @param regions The regions in the coordinates of the encoded frame, none to encode the frame alike.
+     */
+    virtual void set_regions_of_interest(const std::vector<platf::damage_rect_t> &regions) {
+    }
+
+    /**
+     * @brief Adapt the running encoder to another stream config.
+     * @details Only the bitrate and the frame rate can change, anything else needs a new session.
+     * @param config The config the encoder runs with.
+     * @param new_config The config to adapt to.
+     * @return `true` if the encoder runs with `new_config` now, `false` if it needs to be opened again.
+     */
+    bool reconfigure(const config_t &config, const config_t &new_config);
+
+    // When the last captured image was converted for the encoder
+    std::optional<std::chrono::steady_clock::time_point> convert_timestamp;
   };
 
   // encoders
@@ -229,6 +286,24 @@ namespace video {
   extern encoder_t videotoolbox;
 #endif
 
+  /**
+   * @brief The kind of picture an encoder produced.
+   */
+  enum class frame_type_e {
+    unknown,  ///< The encoder didn't tell
+    idr,  ///< An IDR frame
+    i,  ///< An intra frame that isn't an IDR frame
+    p,  ///< A predicted frame
+    b,  ///< A bidirectionally predicted frame
+  };
+
+  /**
+   * @brief Get the name of a frame type, as exported in the metrics.
+   * @param type The frame type.
+   * @return The name, like "idr".
+   */
+  std::string_view frame_type_name(frame_type_e type);
+
   struct packet_raw_t {
     virtual ~packet_raw_t() = default;
 
@@ -252,19 +327,257 @@ namespace video {
       }
     };
 
-    std::vector<replace_t> *replacements = nullptr;
+    // The parameter sets rewritten at encode time, sent in place of the first replaced_size bytes of data()
+    std::vector<std::uint8_t> replaced_head;
+    std::size_t replaced_size = 0;
+
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+
+    // When the frame was converted and encoded, for the frame trace
+    std::optional<std::chrono::steady_clock::time_point> convert_timestamp;
+    std::optional<std::chrono::steady_clock::time_point> encode_timestamp;
+
+    // What the encoder reported about the frame
+    frame_type_e frame_type = frame_type_e::unknown;
+    std::optional<int> qp;  // The average QP of the frame
+    std::optional<std::chrono::steady_clock::duration> encode_duration;  // From handing the frame to the encoder to getting it back
+  };
+
+  /**
+   * @brief Recycles the packets that libavcodec encoders return frames in.
+   * @details The packets are unreferenced when returned, which hands their data back to the
+   *          buffer pool of the encoder, and kept for the next frames.
+   */
+  class av_packet_pool_t {
+  public:
+    /// The number of free packets kept, more are freed. This covers the frames queued for sending.
+    static constexpr std::size_t MAX_FREE_PACKETS = 8;
+
+    av_packet_pool_t() = default;
+    av_packet_pool_t(const av_packet_pool_t &) = delete;
+    av_packet_pool_t &operator=(const av_packet_pool_t &) = delete;
+
+    ~av_packet_pool_t() {
+      for (auto av_packet : _free) {
+        av_packet_free(&av_packet);
+      }
+    }
+
+    /**
+     * @brief Get an empty packet.
+     * @return The packet, or `nullptr` if it couldn't be allocated.
+     */
+    AVPacket *acquire() {
+      std::lock_guard lg {_lock};
+
+      if (_free.empty()) {
+        return av_packet_alloc();
+      }
+
+      auto av_packet = _free.back();
+      _free.pop_back();
+
+      return av_packet;
+    }
+
+    /**
+     * @brief Return a packet to the pool.
+     * @param av_packet The packet, which is unreferenced.
+     */
+    void release(AVPacket *av_packet) {
+      if (!av_packet) {
+        return;
+      }
+
+      av_packet_unref(av_packet);
+
+      std::lock_guard lg {_lock};
+      if (_free.size() < MAX_FREE_PACKETS) {
+        _free.emplace_back(av_packet);
+        return;
+      }
+
+      av_packet_free(&av_packet);
+    }
+
+  private:
+    std::mutex _lock;
+    std::vector<AVPacket *> _free;
   };
 
+  /**
+   * @brief Read what a libavcodec encoder reported about a frame in the side data of its packet.
+   * @param av_packet The packet of the frame.
+   * @param packet Gets the frame type, and the QP if the encoder exports its quality stats.
+   */
+  void read_avcodec_frame_stats(const AVPacket *av_packet, packet_raw_t &packet);
+
+  /**
+   * @brief Rewrite the parameter sets at the start of a keyframe.
+   * @details The parameter sets come before the first slice, so the NAL units after it aren't looked at.
+   * @param payload The keyframe, in Annex B format.
+   * @param replacements The parameter sets to replace, each with its start code.
+   * @param hevc `true` for HEVC, `false` for H.264.
+   * @param head Set to the rewritten start of the keyframe.
+   * @return The number of bytes at the start of the keyframe that `head` replaces, 0 if nothing was replaced.
+   */
+  std::size_t rewrite_parameter_sets(std::string_view payload, const std::vector<packet_raw_t::replace_t> &replacements, bool hevc, std::vector<std::uint8_t> &head);
+
+  /**
+   * @brief Get the temporal layer of a frame.
+   * @details Read from the first slice of H.264 and HEVC frames and from the first frame header of AV1 frames.
+   *          The H.264 frames no other frame refers to and the HEVC ones only the upper sub-layers refer to
+   *          are put in layer 1, since H.264 slices carry no temporal layer outside of SVC.
+   * @param payload The frame, in Annex B format for H.264 and HEVC and as a sequence of OBUs for AV1.
+   * @param videoFormat The codec, 0 - H.264, 1 - HEVC, 2 - AV1.
+   * @return 0 for the frames of the base layer, a higher layer for the frames a decoder of the base layer may skip.
+   */
+  int temporal_layer(std::string_view payload, int videoFormat);
+
+  /**
+   * @brief Map the regions the user works in from the captured image onto the encoded frame.
+   * @details The image is scaled to fit the frame keeping its aspect ratio and centered in it, as the converters do.
+   * @param regions The regions in the coordinates of the image.
+   * @param img_width The width of the image.
+   * @param img_height The height of the image.
+   * @param frame_width The width of the frame.
+   * @param frame_height The height of the frame.
+   * @param margin The pixels of the frame each region is grown by on every side, so the surroundings of the cursor are included.
+   * @return The regions clipped to the frame, those left empty are dropped.
+   */
+  std::vector<platf::damage_rect_t> frame_regions_of_interest(const std::vector<platf::damage_rect_t> &regions, int img_width, int img_height, int frame_width, int frame_height, int margin);
+
+  /**
+   * @brief The tuning of the software encoder with the server profile.
+   */
+  struct software_tuning_t {
+    int slices;  ///< Slices of each frame, each encoded on a thread of its own
+    std::string_view preset;  ///< Preset of libx264 and libx265
+    int svtav1_preset;  ///< Preset of libsvtav1
+  };
+
+  /**
+   * @brief Tune the software encoder of a server to the CPUs it may use and to the stream.
+   * @details Frame threading would add a frame of latency per thread, so the frames are split in slices instead.
+   *          The preset is picked by the pixels each thread encodes per second.
+   * @param cpus The number of CPUs the encoder may run on.
+   * @param shares_capture_cpus Whether the capture thread may run on them as well, one of them is left to it then.
+   * @param width The width of the frames.
+   * @param height The height of the frames.
+   * @param framerate The frame rate of the stream.
+   * @param min_slices The slices per frame the client asked for.
+   * @return The tuning.
+   */
+  software_tuning_t server_software_tuning(int cpus, bool shares_capture_cpus, int width, int height, int framerate, int min_slices);
+
+  /**
+   * @brief Merge two ranges of frames to invalidate into the smallest one covering both.
+   * @details The frames in between get invalidated as well, which only costs the encoder references it didn't need.
+   * @param a The first range, the first and last frames included.
+   * @param b The second range.
+   * @return The merged range.
+   */
+  std::pair<std::int64_t, std::int64_t> merge_invalidated_frames(const std::pair<std::int64_t, std::int64_t> &a, const std::pair<std::int64_t, std::int64_t> &b);
+
+  /**
+   * @brief Collapses the requests the client sends during a loss burst into a single recovery frame.
+   * @details The client asks again for every loss it notices until the recovery frame reaches it,
+   *          so the requests arriving shortly after one was encoded are about the frames it replaces.
+   */
+  class recovery_debouncer_t {
+  public:
+    /**
+     * @param window The time after a recovery frame during which the requests for another are ignored, 0 to honor them all.
+     */
+    explicit recovery_debouncer_t(std::chrono::milliseconds window);
+
+    /**
+     * @brief Check whether a request for a recovery frame should be honored.
+     * @param now The time of the request.
+     * @return `false` if a recovery frame was encoded within the window.
+     */
+    bool accept_recovery(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Record the encoding of a recovery frame.
+     * @param frame_nr The number of the frame.
+     * @param now The time it's encoded.
+     */
+    void recovered(std::int64_t frame_nr, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Check whether invalidating a range of frames is still needed.
+     * @param frames The range, the first and last frames included.
+     * @return `false` if all its frames precede the last recovery frame, nothing references them anymore.
+     */
+    bool needs_invalidation(const std::pair<std::int64_t, std::int64_t> &frames);
+
+    /**
+     * @brief Get the number of requests ignored so far.
+     */
+    std::uint64_t ignored() const {
+      return _ignored;
+    }
+
+  private:
+    std::chrono::milliseconds _window;
+    std::optional<std::chrono::steady_clock::time_point> _last_recovery;
+    std::optional<std::int64_t> _last_recovery_frame;
+    std::uint64_t _ignored {};
+  };
+
+  /**
+   * @brief Cap the rate control buffer, and so the largest frame, to what the link delivers within a frame interval.
+   * @details Past that size, an IDR or a scene change takes longer than a frame interval to reach the client.
+   * @param buffer_size The size of the buffer in bits the encoder would use.
+   * @param frame_bits The bits of an average frame at the bitrate of the stream, the buffer is never made smaller.
+   * @param max_frame_size The bits the link delivers within a frame interval, 0 for no cap.
+   * @return The size of the buffer in bits.
+   */
+  /**
+   * @brief Get the touch port of a display streamed at the resolution of a client.
+   * @param display The display.
+   * @param config The stream.
+   * @return The touch port, the client's stream letterboxed in the display.
+   */
+  input::touch_port_t make_port(platf::display_t *display, const config_t &config);
+
+  std::int64_t cap_frame_size(std::int64_t buffer_size, std::int64_t frame_bits, std::int64_t max_frame_size);
+
+  /**
+   * @brief The tiles HEVC and AV1 frames are split into, which the client's decoder can process in parallel.
+   */
+  struct tile_layout_t {
+    int columns;
+    int rows;
+  };
+
+  /**
+   * @brief Get the tiles to split the frames of a stream into.
+   * @details Without configured tiles, AV1 frames are split in as many tiles as the client asked for slices,
+   *          since AV1 has no slices. HEVC keeps the slices the client asked for and isn't split in tiles.
+   *          The tiles are kept within the sizes the codec allows for the resolution.
+   * @param config The stream.
+   * @param tile_columns The configured tile columns, 0 to pick them from the client's slices.
+   * @param tile_rows The configured tile rows, 0 to pick them from the client's slices.
+   * @return The layout, a single tile for H.264.
+   */
+  tile_layout_t tile_layout(const config_t &config, int tile_columns, int tile_rows);
+
   struct packet_raw_avcodec: packet_raw_t {
-    packet_raw_avcodec() {
-      av_packet = av_packet_alloc();
+    explicit packet_raw_avcodec(std::shared_ptr<av_packet_pool_t> pool = nullptr):
+        pool {std::move(pool)} {
+      av_packet = this->pool ? this->pool->acquire() : av_packet_alloc();
     }
 
     ~packet_raw_avcodec() {
-      av_packet_free(&this->av_packet);
+      if (pool) {
+        pool->release(av_packet);
+      } else {
+        av_packet_free(&this->av_packet);
+      }
     }
 
     bool is_idr() override {
@@ -284,13 +597,69 @@ namespace video {
     }
 
     AVPacket *av_packet;
+
+    // The pool the packet is returned to, if any
+    std::shared_ptr<av_packet_pool_t> pool;
+  };
+
+  /**
+   * @brief Recycles the buffers that encoded frames are copied into.
+   * @details A frame is copied out of the encoder into a buffer that already has the capacity
+   *          of an earlier frame, so no memory is allocated or faulted in while streaming.
+   *          The buffer is returned by the packet holding it once the frame was sent.
+   */
+  class frame_buffer_pool_t {
+  public:
+    /// The number of free buffers kept, more are freed. This covers the frames queued for sending.
+    static constexpr std::size_t MAX_FREE_BUFFERS = 8;
+
+    /**
+     * @brief Get an empty buffer.
+     * @return A buffer, keeping the capacity of the frame it held before if any.
+     */
+    std::vector<uint8_t> acquire() {
+      std::lock_guard lg {_lock};
+
+      if (_free.empty()) {
+        return {};
+      }
+
+      auto buffer = std::move(_free.back());
+      _free.pop_back();
+
+      return buffer;
+    }
+
+    /**
+     * @brief Return a buffer to the pool.
+     * @param buffer The buffer, which may be reused for another frame right away.
+     */
+    void release(std::vector<uint8_t> &&buffer) {
+      std::lock_guard lg {_lock};
+
+      if (_free.size() < MAX_FREE_BUFFERS && buffer.capacity()) {
+        buffer.clear();
+        _free.emplace_back(std::move(buffer));
+      }
+    }
+
+  private:
+    std::mutex _lock;
+    std::vector<std::vector<uint8_t>> _free;
   };
 
   struct packet_raw_generic: packet_raw_t {
-    packet_raw_generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr):
+    packet_raw_generic(std::vector<uint8_t> &&frame_data, int64_t frame_index, bool idr, std::shared_ptr<frame_buffer_pool_t> pool = nullptr):
         frame_data {std::move(frame_data)},
         index {frame_index},
-        idr {idr} {
+        idr {idr},
+        pool {std::move(pool)} {
+    }
+
+    ~packet_raw_generic() override {
+      if (pool) {
+        pool->release(std::move(frame_data));
+      }
     }
 
     bool is_idr() override {
@@ -312,6 +681,39 @@ namespace video {
     std::vector<uint8_t> frame_data;
     int64_t index;
     bool idr;
+
+    // The pool the frame data is returned to, if any
+    std::shared_ptr<frame_buffer_pool_t> pool;
+  };
+
+  /**
+   * @brief A frame of an encoder shared by several sessions, as it's sent to one of them.
+   * @details The encoded data is kept once for all the sessions, only the frame index is the session's own.
+   */
+  struct packet_raw_shared: packet_raw_t {
+    packet_raw_shared(std::shared_ptr<packet_raw_t> packet, int64_t frame_index):
+        packet {std::move(packet)},
+        index {frame_index} {
+    }
+
+    bool is_idr() override {
+      return packet->is_idr();
+    }
+
+    int64_t frame_index() override {
+      return index;
+    }
+
+    uint8_t *data() override {
+      return packet->data();
+    }
+
+    size_t data_size() override {
+      return packet->data_size();
+    }
+
+    std::shared_ptr<packet_raw_t> packet;
+    int64_t index;
   };
 
   using packet_t = std::unique_ptr<packet_raw_t>;
@@ -341,6 +743,45 @@ namespace video {
     void *channel_data
   );
 
+  /**
+   * @brief Build an encode session ahead of a stream that was just launched.
+   * @details The session repeats the settings of the last stream in the launched mode, and is
+   *          taken over by the stream if the settings it announces match. Otherwise, or if no
+   *          stream starts in time, it's discarded.
+   * @param width The width of the launched mode.
+   * @param height The height of the launched mode.
+   * @param framerate The frame rate of the launched mode.
+   * @param enable_hdr Whether the client asked for HDR.
+   */
+  void prewarm(int width, int height, int framerate, bool enable_hdr);
+
+  /**
+   * @brief Get the utilization of the images the displays are captured into.
+   * @return The utilization summed over the displays, with the largest image size, all zero while nothing is captured.
+   */
+  image_pool::stats_t capture_pool_stats();
+
+  /**
+   * @brief The cursor left out of the captured images when it's sent to the clients separately.
+   */
+  struct cursor_t {
+    // Changes with every update of the cursor
+    std::uint64_t sequence;
+
+    platf::cursor_state_t state;
+
+    // The size of the captured images the position is in
+    int image_width;
+    int image_height;
+  };
+
+  /**
+   * @brief Get the cursor left out of the captured images of a display.
+   * @param display_name The display, as raised on the `mail::capture_display` event of the session.
+   * @return The cursor, or `std::nullopt` if none was captured or it's blended into the images.
+   */
+  std::optional<cursor_t> latest_cursor(const std::string &display_name);
+
   bool validate_encoder(encoder_t &encoder, bool expect_failure);
 
   /**
@@ -348,8 +789,27 @@ namespace video {
    * This is called once at startup and each time a stream is launched to
    * ensure the best encoder is selected. Encoder availability can change
    * at runtime due to all sorts of things from driver updates to eGPUs.
+   * At startup, the results of the last probe may be restored from the cache.
+   * They are checked in the background, and the next probe waits for that check.
    *
    * @warning This is only safe to call when there is no client actively streaming.
    */
   int probe_encoders();
+
+  /**
+   * @brief Check whether the encoders were probed once.
+   * @details The first probe runs while the servers start, the supported codecs are unknown until it's done.
+   * @return `true` once the first probe is done.
+   */
+  bool encoders_ready();
+
+  /**
+   * @brief Measure how fast each available encoder encodes, then print the results to stdout.
+   * @details Each encoder is validated first, then encodes a synthetic image and images captured
+   *          from the display with each codec it supports, at a few resolutions and frame rates.
+   *          Only the configured encoder is measured if one is set.
+   * @param frames The number of frames encoded by each run, after a few to warm up.
+   * @return 0 if any encoder could be measured, -1 otherwise.
+   */
+  int benchmark_encoders(int frames);
 }  // namespace video
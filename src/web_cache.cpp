@@ -0,0 +1,202 @@
+/**
+ * @file src/web_cache.cpp
+ * @brief Definitions for the in-memory cache of the Web UI assets.
+ */
+// standard includes
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+// lib includes
+#include <boost/algorithm/string.hpp>
+
+// local includes
+#include "crypto.h"
+#include "logging.h"
+#include "utility.h"
+#include "web_cache.h"
+
+using namespace std::literals;
+
+namespace web_cache {
+  namespace fs = std::filesystem;
+
+  namespace {
+    std::string read_binary(const fs::path &path) {
+      std::ifstream in(path, std::ios::binary);
+      return std::string {(std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()};
+    }
+
+    /**
+     * @brief Read a file and its precompressed variants.
+     * @return nullptr if the file can't be read.
+     */
+    std::shared_ptr<const asset_t> read_asset(const fs::path &path) {
+      std::error_code ec;
+      auto asset = std::make_shared<asset_t>();
+
+      asset->write_time = fs::last_write_time(path, ec);
+      if (!ec) {
+        asset->size = fs::file_size(path, ec);
+      }
+      if (ec) {
+        return nullptr;
+      }
+
+      asset->identity = read_binary(path);
+      asset->etag = '"' + util::hex(crypto::hash(asset->identity)).to_string() + '"';
+
+      auto variant = path;
+      if (fs::exists(variant += ".br", ec)) {
+        asset->brotli = read_binary(variant);
+      }
+      variant = path;
+      if (fs::exists(variant += ".gz", ec)) {
+        asset->gzip = read_binary(variant);
+      }
+
+      return asset;
+    }
+
+    bool is_variant(const fs::path &path) {
+      auto extension = path.extension();
+      return extension == ".br" || extension == ".gz";
+    }
+  }  // namespace
+
+  const char *encoding_name(encoding_e encoding) {
+    switch (encoding) {
+      case encoding_e::gzip:
+        return "gzip";
+      case encoding_e::brotli:
+        return "br";
+      default:
+        return "identity";
+    }
+  }
+
+  const std::string &asset_t::body(encoding_e encoding) const {
+    switch (encoding) {
+      case encoding_e::gzip:
+        return gzip;
+      case encoding_e::brotli:
+        return brotli;
+      default:
+        return identity;
+    }
+  }
+
+  encoding_e asset_t::negotiate(std::string_view accept_encoding) const {
+    bool accepts_gzip = false;
+    bool accepts_brotli = false;
+
+    std::vector<std::string> codings;
+    boost::split(codings, accept_encoding, boost::is_any_of(","));
+    for (auto &coding : codings) {
+      std::vector<std::string> params;
+      boost::split(params, coding, boost::is_any_of(";"));
+
+      auto name = boost::trim_copy(params.front());
+      boost::to_lower(name);
+
+      // A quality of 0 means the coding is not acceptable
+      auto refused = std::any_of(std::begin(params) + 1, std::end(params), [](const std::string &param) {
+        auto value = boost::trim_copy(param);
+        return value.starts_with("q=") && std::strtod(value.c_str() + 2, nullptr) <= 0.0;
+      });
+      if (refused) {
+        continue;
+      }
+
+      accepts_gzip |= name == "gzip"sv;
+      accepts_brotli |= name == "br"sv;
+    }
+
+    if (accepts_brotli && !brotli.empty()) {
+      return encoding_e::brotli;
+    }
+    if (accepts_gzip && !gzip.empty()) {
+      return encoding_e::gzip;
+    }
+
+    return encoding_e::identity;
+  }
+
+  bool matches(std::string_view if_none_match, std::string_view etag) {
+    std::vector<std::string> tags;
+    boost::split(tags, if_none_match, boost::is_any_of(","));
+    for (auto &tag : tags) {
+      boost::trim(tag);
+
+      // The comparison is weak, so the tags validated by a proxy that compressed the asset still match
+      if (tag.starts_with("W/")) {
+        tag.erase(0, 2);
+      }
+
+      if (tag == "*"sv || tag == etag) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  cache_t::cache_t(fs::path root):
+      _root {std::move(root)} {
+  }
+
+  std::size_t cache_t::load() {
+    std::unordered_map<std::string, std::shared_ptr<const asset_t>> assets;
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator {_root, ec}; !ec && it != fs::recursive_directory_iterator {}; it.increment(ec)) {
+      if (!it->is_regular_file(ec) || is_variant(it->path())) {
+        continue;
+      }
+
+      if (auto asset = read_asset(it->path())) {
+        assets.emplace(it->path().lexically_relative(_root).generic_string(), std::move(asset));
+      }
+    }
+
+    if (ec) {
+      BOOST_LOG(warning) << "Couldn't read all of the Web UI assets in "sv << _root << ": "sv << ec.message();
+    }
+
+    std::lock_guard lg {_lock};
+    _assets = std::move(assets);
+
+    return _assets.size();
+  }
+
+  std::shared_ptr<const asset_t> cache_t::get(const fs::path &relative_path) {
+    auto key = relative_path.lexically_normal().generic_string();
+    auto path = _root / relative_path;
+
+    std::error_code ec;
+    auto write_time = fs::last_write_time(path, ec);
+    auto size = ec ? 0 : fs::file_size(path, ec);
+
+    std::lock_guard lg {_lock};
+
+    if (ec || !fs::is_regular_file(path, ec)) {
+      _assets.erase(key);
+      return nullptr;
+    }
+
+    auto it = _assets.find(key);
+    if (it != std::end(_assets) && it->second->write_time == write_time && it->second->size == size) {
+      return it->second;
+    }
+
+    // The file was added or changed since it was read
+    auto asset = read_asset(path);
+    if (asset) {
+      _assets.insert_or_assign(std::move(key), asset);
+    }
+
+    return asset;
+  }
+}  // namespace web_cache
@@ -0,0 +1,102 @@
+/**
+ * @file src/web_cache.h
+ * @brief Declarations for the in-memory cache of the Web UI assets.
+ */
+#pragma once
+
+// standard includes
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace web_cache {
+  /**
+   * @brief The encodings an asset may be sent with.
+   */
+  enum class encoding_e {
+    identity,  ///< Uncompressed
+    gzip,  ///< Precompressed with gzip, read from the file with the `.gz` extension appended
+    brotli  ///< Precompressed with brotli, read from the file with the `.br` extension appended
+  };
+
+  /**
+   * @brief Get the name of an encoding, as used in the Content-Encoding header.
+   * @param encoding The encoding.
+   * @return The name.
+   */
+  const char *encoding_name(encoding_e encoding);
+
+  /**
+   * @brief The contents of a file of the Web UI, with its precompressed variants.
+   */
+  struct asset_t {
+    /// A strong entity tag of the uncompressed contents, quoted as in the ETag header
+    std::string etag;
+
+    std::string identity;
+    /// Empty when the file has no such variant
+    std::string gzip;
+    /// Empty when the file has no such variant
+    std::string brotli;
+
+    std::filesystem::file_time_type write_time;
+    std::uintmax_t size;
+
+    /**
+     * @brief Get the body of the asset in an encoding.
+     * @param encoding The encoding, which the asset must have.
+     * @return The body.
+     */
+    const std::string &body(encoding_e encoding) const;
+
+    /**
+     * @brief Pick the encoding to send the asset with.
+     * @param accept_encoding The Accept-Encoding header of the request, empty if there is none.
+     * @return The smallest of the variants the client accepts, brotli before gzip.
+     */
+    encoding_e negotiate(std::string_view accept_encoding) const;
+  };
+
+  /**
+   * @brief Check if an If-None-Match header matches an entity tag.
+   * @param if_none_match The header.
+   * @param etag The quoted entity tag.
+   * @return `true` if the client already has the asset.
+   */
+  bool matches(std::string_view if_none_match, std::string_view etag);
+
+  /**
+   * @brief The files under a directory, read once and kept in memory.
+   * @details The write time and size of a file are checked when it's looked up,
+   *          so an updated directory is picked up without reading every file on every request.
+   */
+  class cache_t {
+  public:
+    /**
+     * @param root The directory the assets are read from.
+     */
+    explicit cache_t(std::filesystem::path root);
+
+    /**
+     * @brief Read all the files under the directory.
+     * @return The number of files read.
+     */
+    std::size_t load();
+
+    /**
+     * @brief Get an asset.
+     * @param relative_path The path of the file, relative to the directory.
+     * @return The asset, nullptr if the file doesn't exist.
+     */
+    std::shared_ptr<const asset_t> get(const std::filesystem::path &relative_path);
+
+  private:
+    std::filesystem::path _root;
+
+    std::mutex _lock;
+    std::unordered_map<std::string, std::shared_ptr<const asset_t>> _assets;
+  };
+}  // namespace web_cache
@@ -0,0 +1,70 @@
+#version 300 es
+
+#ifdef GL_ES
+precision highp float;
+precision highp int;
+#endif
+
+uniform highp sampler2D image;
+
+// 0 to scale the width of the image, 1 to scale its height
+uniform int axis;
+// Texels of the image per pixel of the target, along the axis
+uniform float ratio;
+// 1 for bicubic, 2 for Lanczos
+uniform int filter_type;
+
+layout(location = 0) out vec4 color;
+
+const float PI = 3.14159265359;
+
+float weight(float x) {
+  x = abs(x);
+
+  if (filter_type == 1) {
+    // Catmull-Rom
+    if (x < 1.0) {
+      return (1.5 * x - 2.5) * x * x + 1.0;
+    }
+    if (x < 2.0) {
+      return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    }
+    return 0.0;
+  }
+
+  // Lanczos with 3 lobes
+  if (x < 0.00001) {
+    return 1.0;
+  }
+  if (x < 3.0) {
+    float px = PI * x;
+    return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
+  }
+  return 0.0;
+}
+
+// One pass of a separable filter, the other axis is copied as is
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  ivec2 size = textureSize(image, 0);
+  int last = size[axis] - 1;
+
+  // When shrinking the image, the filter stretches to cover every texel of a pixel
+  float stretch = max(ratio, 1.0);
+  float radius = (filter_type == 1 ? 2.0 : 3.0) * stretch;
+  float center = (float(pixel[axis]) + 0.5) * ratio - 0.5;
+
+  vec4 sum = vec4(0.0);
+  float total = 0.0;
+  for (int x = int(ceil(center - radius)); x <= int(floor(center + radius)); ++x) {
+    float w = weight((float(x) - center) / stretch);
+
+    ivec2 texel = pixel;
+    texel[axis] = clamp(x, 0, last);
+
+    sum += w * texelFetch(image, texel, 0);
+    total += w;
+  }
+
+  color = sum / total;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+Texture2D image : register(t0);
+
+cbuffer scale_cbuffer : register(b1) {
+    int scale_axis;  // 0 to scale the width of the image, 1 to scale its height
+    float scale_ratio;  // Texels of the image per pixel of the target, along the axis
+    int scale_filter;  // 1 for bicubic, 2 for Lanczos
+};
+
+#include "include/base_vs_types.hlsl"
+
+static const float PI = 3.14159265359;
+
+float scale_weight(float x)
+{
+    x = abs(x);
+
+    if (scale_filter == 1) {
+        // Catmull-Rom
+        if (x < 1) {
+            return (1.5 * x - 2.5) * x * x + 1;
+        }
+        if (x < 2) {
+            return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+        }
+        return 0;
+    }
+
+    // Lanczos with 3 lobes
+    if (x < 0.00001) {
+        return 1;
+    }
+    if (x < 3) {
+        float px = PI * x;
+        return 3 * sin(px) * sin(px / 3) / (px * px);
+    }
+    return 0;
+}
+
+// One pass of a separable filter, the other axis is copied as is
+float4 main_ps(vertex_t input) : SV_Target
+{
+    int2 pixel = int2(input.viewpoint_pos.xy);
+
+    uint width, height;
+    image.GetDimensions(width, height);
+    int last = (scale_axis ? (int) height : (int) width) - 1;
+
+    // When shrinking the image, the filter stretches to cover every texel of a pixel
+    float stretch = max(scale_ratio, 1);
+    float radius = (scale_filter == 1 ? 2 : 3) * stretch;
+    float center = ((scale_axis ? pixel.y : pixel.x) + 0.5) * scale_ratio - 0.5;
+
+    float4 sum = 0;
+    float total = 0;
+
+    [loop]
+    for (int x = (int) ceil(center - radius); x <= (int) floor(center + radius); ++x) {
+        float w = scale_weight((x - center) / stretch);
+
+        int texel = clamp(x, 0, last);
+        sum += w * image.Load(int3(scale_axis ? int2(pixel.x, texel) : int2(texel, pixel.y), 0));
+        total += w;
+    }
+
+    return sum / total;
+}
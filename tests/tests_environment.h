@@ -7,7 +7,7 @@
 
 struct SunshineEnvironment: testing::Environment {
   void SetUp() override {
-    mail::man = std::make_shared<safe::mail_raw_t>();
+    mail::man = std::make_shared<safe::mail_raw_t>(mail::queue_options());
     deinit_log = logging::init(0, "test_sunshine.log");
   }
 
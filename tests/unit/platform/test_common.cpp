@@ -53,3 +53,155 @@ TEST(HostnameTests, TestAsioEquality) {
   // These should be equivalent on all platforms for ASCII hostnames
   ASSERT_EQ(platf::get_host_name(), boost::asio::ip::host_name());
 }
+
+TEST(BlendCursorRowTests, BlendTest) {
+  std::vector<std::uint32_t> pixels(37, 0x40C08020);
+  std::vector<std::uint32_t> cursor(37, 0x80402010);
+  cursor[0] = 0xFF102030;
+  cursor[1] = 0x00000000;
+
+  platf::blend_cursor_row(pixels.data(), cursor.data(), (int) pixels.size());
+
+  // Opaque pixels replace the image, transparent ones leave it as is
+  ASSERT_EQ(pixels[0], 0xFF102030);
+  ASSERT_EQ(pixels[1], 0x40C08020);
+
+  // Each color is the cursor's plus the image's scaled by the inverse of the cursor's alpha
+  for (std::size_t x = 2; x < pixels.size(); ++x) {
+    ASSERT_EQ(pixels[x], 0x40A06020);
+  }
+}
+
+TEST(AudioRemapTests, ConvertTest) {
+  std::vector<std::int16_t> s16 {16384, -32768, 0, 32767};
+  std::vector<float> samples(4);
+  platf::remap_audio_frames(platf::audio_sample_format_e::s16, (std::uint8_t *) s16.data(), 2, samples.data(), 2, nullptr, 2);
+  ASSERT_EQ(samples, (std::vector<float> {0.5f, -1.0f, 0.0f, 32767.0f / 32768.0f}));
+
+  // Packed little endian
+  std::vector<std::uint8_t> s24 {0x00, 0x00, 0xC0, 0x00, 0x00, 0x40};
+  platf::remap_audio_frames(platf::audio_sample_format_e::s24, s24.data(), 2, samples.data(), 2, nullptr, 1);
+  ASSERT_EQ(samples[0], -0.5f);
+  ASSERT_EQ(samples[1], 0.5f);
+}
+
+TEST(AudioRemapTests, MixMatrixTest) {
+  constexpr std::uint32_t stereo = 0x3;
+  constexpr std::uint32_t surround51_back = 0x3F;
+  constexpr std::uint32_t surround51_side = 0x60F;
+
+  // Channels that land on their own are only copied
+  ASSERT_TRUE(platf::audio_mix_matrix(stereo, stereo).empty());
+  ASSERT_TRUE(platf::audio_mix_matrix(surround51_side, surround51_back).empty());
+
+  // Stereo is played on the front speakers
+  auto upmix = platf::audio_mix_matrix(stereo, surround51_back);
+  ASSERT_EQ(upmix.size(), 12);
+  std::vector<float> frame {0.5f, -0.25f};
+  std::vector<float> samples(6);
+  platf::remap_audio_frames(platf::audio_sample_format_e::f32, (std::uint8_t *) frame.data(), 2, samples.data(), 6, upmix.data(), 1);
+  ASSERT_EQ(samples, (std::vector<float> {0.5f, -0.25f, 0.0f, 0.0f, 0.0f, 0.0f}));
+
+  // The center and back speakers are folded into the front ones, the low frequency is dropped
+  auto downmix = platf::audio_mix_matrix(surround51_back, stereo);
+  ASSERT_EQ(downmix.size(), 12);
+  ASSERT_NEAR(downmix[0], 0.414f, 0.001f);
+  ASSERT_EQ(downmix[1], 0.0f);
+  ASSERT_NEAR(downmix[2], 0.293f, 0.001f);
+  ASSERT_EQ(downmix[3], 0.0f);
+  ASSERT_NEAR(downmix[4], 0.293f, 0.001f);
+  ASSERT_EQ(downmix[5], 0.0f);
+
+  // Full scale on every speaker doesn't clip
+  std::vector<float> surround {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+  platf::remap_audio_frames(platf::audio_sample_format_e::f32, (std::uint8_t *) surround.data(), 6, samples.data(), 2, downmix.data(), 1);
+  ASSERT_NEAR(samples[0], 1.0f, 0.0001f);
+  ASSERT_NEAR(samples[1], 1.0f, 0.0001f);
+}
+
+TEST(CaptureStatsTests, SnapshotTest) {
+  platf::capture_stats_t stats {"test_backend", true};
+
+  struct img_t: platf::img_t {};
+  img_t img;
+  img.frame_timestamp = std::chrono::steady_clock::now() - std::chrono::milliseconds(5);
+
+  auto begin = std::chrono::steady_clock::now();
+  stats.snapshot(platf::capture_e::ok, begin, &img);
+
+  // An empty damage means the image didn't change
+  img.damage.emplace();
+  stats.snapshot(platf::capture_e::ok, begin, &img);
+
+  stats.snapshot(platf::capture_e::timeout, begin, nullptr);
+  stats.snapshot(platf::capture_e::error, begin, &img);
+  stats.converted(std::chrono::milliseconds(2));
+
+  auto text = metrics::render();
+  auto contains = [&text](std::string_view part) {
+    return text.find(part) != std::string::npos;
+  };
+  ASSERT_TRUE(contains("sunshine_capture_frames_total{backend=\"test_backend\"} 2\n"));
+  ASSERT_TRUE(contains("sunshine_capture_duplicate_frames_total{backend=\"test_backend\"} 1\n"));
+  ASSERT_TRUE(contains("sunshine_capture_timeouts_total{backend=\"test_backend\"} 1\n"));
+  ASSERT_TRUE(contains("sunshine_capture_snapshot_seconds_count{backend=\"test_backend\"} 2\n"));
+  ASSERT_TRUE(contains("sunshine_capture_convert_seconds_count{backend=\"test_backend\"} 1\n"));
+  ASSERT_TRUE(contains("sunshine_capture_present_to_capture_seconds_count{backend=\"test_backend\"} 2\n"));
+
+  // The totals only count this display
+  auto &totals = stats.totals();
+  ASSERT_EQ(totals.frames, 2);
+  ASSERT_EQ(totals.present_frames, 2);
+  ASSERT_GE(totals.present_to_capture_seconds, 0.01);
+  ASSERT_GE(totals.frame_cost(), 0.005);
+}
+
+TEST(CaptureStatsTests, FastestCaptureTest) {
+  auto totals = [](std::uint64_t frames, double snapshot_seconds, std::uint64_t present_frames, double present_to_capture_seconds) {
+    return platf::capture_stats_t::totals_t {frames, present_frames, snapshot_seconds, present_to_capture_seconds};
+  };
+
+  // The time from present to capture counts with the time to take the snapshot
+  ASSERT_EQ(platf::fastest_capture({totals(30, 0.03, 30, 0.3), totals(30, 0.06, 30, 0.09)}, 10), 1);
+  ASSERT_EQ(platf::fastest_capture({totals(30, 0.03, 30, 0.06), totals(30, 0.06, 30, 0.09)}, 10), 0);
+
+  // Backends that captured too few frames aren't compared
+  ASSERT_EQ(platf::fastest_capture({totals(30, 0.3, 0, 0), totals(5, 0.005, 5, 0.005)}, 10), 0);
+  ASSERT_EQ(platf::fastest_capture({totals(5, 0.03, 5, 0.03), totals(0, 0, 0, 0)}, 10), std::nullopt);
+  ASSERT_EQ(platf::fastest_capture({}, 10), std::nullopt);
+
+  ASSERT_EQ(totals(0, 0, 0, 0).frame_cost(), std::numeric_limits<double>::infinity());
+}
+
+TEST(SpinCalibrationTests, SleepDurationTest) {
+  platf::spin_calibration_t calibration {10};
+
+  // The margin is spun unless it's beyond the budget
+  ASSERT_EQ(calibration.sleep_duration(16ms), 16ms - platf::spin_calibration_t::INITIAL_MARGIN);
+  ASSERT_EQ(calibration.sleep_duration(2ms), 1800us);
+
+  platf::spin_calibration_t spin_only {100};
+  ASSERT_EQ(spin_only.sleep_duration(100us), 0ns);
+}
+
+TEST(SpinCalibrationTests, RecordTest) {
+  platf::spin_calibration_t calibration {10};
+
+  // Larger overshoot is adopted at once
+  calibration.record(1ms);
+  ASSERT_EQ(calibration.margin(), 1ms);
+
+  // Smaller overshoot is approached slowly
+  calibration.record(0ns);
+  ASSERT_LT(calibration.margin(), 1ms);
+  ASSERT_GT(calibration.margin(), 900us);
+
+  for (int x = 0; x < 1000; ++x) {
+    calibration.record(-1ms);
+  }
+  ASSERT_GE(calibration.margin(), platf::spin_calibration_t::MIN_MARGIN);
+  ASSERT_LT(calibration.margin(), platf::spin_calibration_t::MIN_MARGIN + 1us);
+
+  calibration.record(1s);
+  ASSERT_EQ(calibration.margin(), platf::spin_calibration_t::MAX_MARGIN);
+}
@@ -67,3 +67,26 @@ TEST_P(AudioTest, TestEncode) {
   timer.join();
   capture.join();
 }
+
+TEST(PacketPoolTests, RecycleTest) {
+  auto pool = std::make_shared<packet_pool_t>();
+
+  auto buffer = pool->acquire();
+  ASSERT_EQ(buffer.size(), packet_pool_t::PACKET_SIZE);
+  auto data = buffer.begin();
+
+  buffer.fake_resize(100);
+  {
+    packet_buffer_t packet {std::move(buffer), pool};
+
+    // Copies don't return their buffer to the pool
+    packet_buffer_t copy {packet};
+    ASSERT_EQ(copy.size(), 100);
+    ASSERT_FALSE(copy.pool);
+  }
+
+  // The buffer of the frame is reused at its full size
+  auto recycled = pool->acquire();
+  ASSERT_EQ(recycled.begin(), data);
+  ASSERT_EQ(recycled.size(), packet_pool_t::PACKET_SIZE);
+}
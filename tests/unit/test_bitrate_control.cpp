@@ -0,0 +1,75 @@
+/**
+ * @file tests/unit/test_bitrate_control.cpp
+ * @brief Test src/bitrate_control.*
+ */
+#include "../tests_common.h"
+
+#include <src/bitrate_control.h>
+
+using bitrate_control::controller_t;
+
+TEST(BitrateControlTests, CongestionTest) {
+  auto now = std::chrono::steady_clock::now();
+
+  controller_t controller;
+  controller.reset(10000, now);
+
+  // A little loss is left to FEC
+  controller.report_loss(controller_t::LOSS_THRESHOLD - 1, now);
+  ASSERT_FALSE(controller.update(now));
+
+  // The encoder is given time to settle before the first cut too
+  now += controller_t::HOLD_TIME;
+  controller.report_loss(controller_t::LOSS_THRESHOLD, now);
+  ASSERT_EQ(controller.update(now), 8000);
+
+  // Congestion while the encoder settles doesn't cut it again
+  controller.report_invalidation(now);
+  ASSERT_FALSE(controller.update(now));
+
+  now += controller_t::HOLD_TIME;
+  controller.report_invalidation(now);
+  ASSERT_EQ(controller.update(now), 6400);
+}
+
+TEST(BitrateControlTests, RttTest) {
+  auto now = std::chrono::steady_clock::now() + controller_t::HOLD_TIME;
+
+  controller_t controller;
+  controller.reset(10000, now - controller_t::HOLD_TIME);
+
+  controller.report_rtt(10ms, now);
+  controller.report_rtt(10ms + controller_t::RTT_THRESHOLD, now);
+  ASSERT_FALSE(controller.update(now));
+
+  controller.report_rtt(11ms + controller_t::RTT_THRESHOLD, now);
+  ASSERT_EQ(controller.update(now), 8000);
+}
+
+TEST(BitrateControlTests, RecoveryTest) {
+  auto now = std::chrono::steady_clock::now();
+
+  controller_t controller;
+  controller.reset(10000, now);
+
+  // Never cut below the minimum
+  for (int x = 0; x < 20; ++x) {
+    now += controller_t::HOLD_TIME;
+    controller.report_invalidation(now);
+    controller.update(now);
+  }
+  ASSERT_EQ(controller.bitrate(), 10000 * controller_t::MIN_PERCENT / 100);
+
+  // Raised step by step once the link is clean, up to the requested bitrate
+  now += controller_t::CLEAN_TIME - 1ms;
+  ASSERT_FALSE(controller.update(now));
+
+  now += 1ms;
+  ASSERT_EQ(controller.update(now), 3000);
+
+  for (int x = 0; x < 20; ++x) {
+    now += controller_t::CLEAN_TIME;
+    controller.update(now);
+  }
+  ASSERT_EQ(controller.bitrate(), 10000);
+}
@@ -0,0 +1,101 @@
+/**
+ * @file tests/unit/test_capture_latency.cpp
+ * @brief Test src/capture_latency.*
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <src/capture_latency.h>
+
+namespace {
+  constexpr int PATTERN_BITS = capture_latency::TIMESTAMP_BITS + capture_latency::COUNTER_BITS;
+
+  /**
+   * @brief A BGRA image with the pattern drawn like tools/capture_latency.html does.
+   */
+  struct pattern_img_t: platf::img_t {
+    pattern_img_t(std::int64_t timestamp_ms, std::uint32_t counter) {
+      width = PATTERN_BITS * capture_latency::CELL_SIZE + 64;
+      height = 4 * capture_latency::CELL_SIZE;
+      pixel_pitch = 4;
+      row_pitch = width * pixel_pitch;
+
+      buffer.assign(row_pitch * height, 0x80);
+      data = buffer.data();
+
+      auto bits = ((std::uint64_t) timestamp_ms << capture_latency::COUNTER_BITS) | counter;
+      for (int cell = 0; cell < PATTERN_BITS; ++cell) {
+        bool bit = (bits >> (PATTERN_BITS - 1 - cell)) & 1;
+        fill(cell, 0, bit ? 0xFF : 0x00);
+        fill(cell, 1, bit ? 0x00 : 0xFF);
+      }
+    }
+
+    void fill(int cell, int row, std::uint8_t value) {
+      for (int y = 0; y < capture_latency::CELL_SIZE; ++y) {
+        auto line = data + (row * capture_latency::CELL_SIZE + y) * row_pitch + cell * capture_latency::CELL_SIZE * pixel_pitch;
+        std::fill_n(line, capture_latency::CELL_SIZE * pixel_pitch, value);
+      }
+    }
+
+    std::vector<std::uint8_t> buffer;
+  };
+}  // namespace
+
+TEST(CaptureLatencyTests, DecodeTest) {
+  auto timestamp_ms = (std::int64_t) 1760000000123 % (1LL << capture_latency::TIMESTAMP_BITS);
+  pattern_img_t img {timestamp_ms, 0xBEEF};
+
+  auto pattern = capture_latency::decode(img);
+  ASSERT_TRUE(pattern);
+  ASSERT_EQ(pattern->timestamp_ms, timestamp_ms);
+  ASSERT_EQ(pattern->counter, 0xBEEF);
+}
+
+TEST(CaptureLatencyTests, TornTest) {
+  pattern_img_t img {1000, 1};
+
+  // A cell captured while it changed matches its complement
+  img.fill(10, 0, 0xFF);
+  img.fill(10, 1, 0xFF);
+  ASSERT_FALSE(capture_latency::decode(img));
+
+  // The display is too small for the pattern
+  pattern_img_t small {1000, 1};
+  small.width = PATTERN_BITS * capture_latency::CELL_SIZE - 1;
+  ASSERT_FALSE(capture_latency::decode(small));
+}
+
+TEST(CaptureLatencyTests, TrackerTest) {
+  capture_latency::tracker_t tracker;
+
+  constexpr std::uint32_t last_counter = (1 << capture_latency::COUNTER_BITS) - 2;
+  tracker.captured(capture_latency::pattern_t {1000, last_counter}, 1020);
+  tracker.captured(capture_latency::pattern_t {1000, last_counter}, 1036);
+
+  // The counter wraps around, the two frames in between weren't captured
+  tracker.captured(capture_latency::pattern_t {1050, 1}, 1060);
+  tracker.captured(std::nullopt, 1070);
+  tracker.captured(capture_latency::pattern_t {1066, 2}, 1090);
+  tracker.captured(capture_latency::pattern_t {1083, 3}, 1100);
+
+  ASSERT_EQ(tracker.frames, 6);
+  ASSERT_EQ(tracker.undecoded, 1);
+  ASSERT_EQ(tracker.duplicates, 1);
+  ASSERT_EQ(tracker.dropped, 2);
+
+  // The latency of a frame is counted when it's first captured
+  ASSERT_EQ(tracker.latency.count(), 4);
+  ASSERT_NEAR(tracker.latency.min(), 10, 0.5);
+  ASSERT_NEAR(tracker.latency.max(), 24, 0.5);
+}
+
+TEST(CaptureLatencyTests, TimestampWrapTest) {
+  capture_latency::tracker_t tracker;
+
+  // The pattern only holds the low bits of the time
+  auto range = 1LL << capture_latency::TIMESTAMP_BITS;
+  tracker.captured(capture_latency::pattern_t {range - 5, 1}, 3 * range + 12);
+
+  ASSERT_NEAR(tracker.latency.max(), 17, 0.5);
+}
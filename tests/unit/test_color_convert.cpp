@@ -0,0 +1,116 @@
+/**
+ * @file tests/unit/test_color_convert.cpp
+ * @brief Test src/color_convert.*
+ */
+#include "../tests_common.h"
+
+#include <random>
+#include <src/color_convert.h>
+#include <src/video_colorspace.h>
+
+using color_convert::converter_t;
+using color_convert::format_e;
+
+namespace {
+  struct image_t {
+    image_t(format_e format, int width, int height) {
+      auto bytes = format == format_e::nv12 || format == format_e::yuv420p || format == format_e::yuv444p ? 1 : 2;
+      auto chroma_width = format == format_e::yuv444p || format == format_e::yuv444p10 ? width : width / 2;
+      auto chroma_height = format == format_e::yuv444p || format == format_e::yuv444p10 ? height : height / 2;
+
+      linesizes[0] = width * bytes;
+      if (format == format_e::nv12 || format == format_e::p010) {
+        linesizes[1] = chroma_width * 2 * bytes;
+      } else {
+        linesizes[1] = chroma_width * bytes;
+        linesizes[2] = chroma_width * bytes;
+      }
+
+      for (int plane = 0; plane < 3; ++plane) {
+        buffers[plane].resize((std::size_t) linesizes[plane] * (plane ? chroma_height : height));
+        planes[plane] = buffers[plane].data();
+      }
+    }
+
+    std::vector<std::uint8_t> buffers[3];
+    std::uint8_t *planes[3] {};
+    int linesizes[3] {};
+  };
+
+  const video::color_t &color_vectors(format_e format) {
+    auto bit_depth = format == format_e::nv12 || format == format_e::yuv420p || format == format_e::yuv444p ? 8 : 10;
+    return *video::new_color_vectors_from_colorspace({video::colorspace_e::rec709, false, (unsigned) bit_depth});
+  }
+}  // namespace
+
+TEST(ColorConvertTests, SupportsTest) {
+  ASSERT_TRUE(converter_t::supports(format_e::nv12, 2560, 1440));
+  ASSERT_FALSE(converter_t::supports(format_e::nv12, 2561, 1440));
+  ASSERT_FALSE(converter_t::supports(format_e::p010, 2560, 1441));
+  ASSERT_TRUE(converter_t::supports(format_e::yuv444p, 2561, 1441));
+  ASSERT_FALSE(converter_t::supports(format_e::yuv444p, 0, 1440));
+}
+
+TEST(ColorConvertTests, ColorsTest) {
+  // A row of white and red blocks and a row of black blocks
+  std::vector<std::uint8_t> bgra(4 * 4 * 2);
+  for (int x = 0; x < 4; ++x) {
+    auto px = &bgra[x * 4];
+    px[0] = x < 2 ? 255 : 0;
+    px[1] = x < 2 ? 255 : 0;
+    px[2] = 255;
+  }
+  std::copy_n(bgra.begin(), 16, bgra.begin() + 16);
+
+  converter_t converter {format_e::nv12, 4, 2, 1};
+  converter.set_colorspace(color_vectors(format_e::nv12));
+
+  image_t image {format_e::nv12, 4, 2};
+  converter.convert(bgra.data(), 16, image.planes, image.linesizes);
+
+  // Rec. 709 in the limited range
+  ASSERT_EQ(image.buffers[0], (std::vector<std::uint8_t> {235, 235, 63, 63, 235, 235, 63, 63}));
+  ASSERT_EQ(image.buffers[1], (std::vector<std::uint8_t> {128, 128, 102, 240}));
+
+  converter_t converter_10 {format_e::p010, 4, 2, 1};
+  converter_10.set_colorspace(color_vectors(format_e::p010));
+
+  image_t image_10 {format_e::p010, 4, 2};
+  converter_10.convert(bgra.data(), 16, image_10.planes, image_10.linesizes);
+
+  auto y = (std::uint16_t *) image_10.planes[0];
+  ASSERT_EQ(y[0], 940 << 6);
+  ASSERT_EQ(y[2], 250 << 6);
+}
+
+TEST(ColorConvertTests, IsaTest) {
+  constexpr int width = 70;
+  constexpr int height = 140;
+
+  std::mt19937 rng {42};
+  std::vector<std::uint8_t> bgra(width * 4 * height);
+  for (auto &byte : bgra) {
+    byte = (std::uint8_t) rng();
+  }
+
+  for (auto format : {format_e::nv12, format_e::p010, format_e::yuv420p, format_e::yuv420p10, format_e::yuv444p, format_e::yuv444p10}) {
+    converter_t reference {format, width, height, 1, color_convert::isa_e::generic};
+    reference.set_colorspace(color_vectors(format));
+
+    image_t expected {format, width, height};
+    reference.convert(bgra.data(), width * 4, expected.planes, expected.linesizes);
+
+    // Every instruction set and split in bands produces the same image
+    for (auto isa : color_convert::supported_isas()) {
+      converter_t converter {format, width, height, 2, isa};
+      converter.set_colorspace(color_vectors(format));
+
+      image_t image {format, width, height};
+      converter.convert(bgra.data(), width * 4, image.planes, image.linesizes);
+
+      for (int plane = 0; plane < 3; ++plane) {
+        ASSERT_EQ(image.buffers[plane], expected.buffers[plane]) << color_convert::isa_name(isa) << " plane " << plane;
+      }
+    }
+  }
+}
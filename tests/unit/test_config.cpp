@@ -0,0 +1,67 @@
+/**
+ * @file tests/unit/test_config.cpp
+ * @brief Test src/config.*.
+ */
+#include "../tests_common.h"
+
+#include <fstream>
+
+#include <src/config.h>
+#include <src/file_handler.h>
+
+struct ConfigReloadTest: testing::Test {
+  void SetUp() override {
+    config_file = config::sunshine.config_file;
+    fec_percentage = config::stream.fec_percentage;
+    port = config::sunshine.port;
+
+    auto directory = platf::appdata() / "tests";
+    std::filesystem::create_directories(directory);
+    config::sunshine.config_file = (directory / "sunshine.conf").string();
+
+    // The options are parsed like at startup, which creates the apps file if it's missing
+    apps_file = platf::appdata() / "apps.json";
+    created_apps_file = !std::filesystem::exists(apps_file);
+    if (created_apps_file) {
+      std::ofstream {apps_file};
+    }
+  }
+
+  void TearDown() override {
+    file_handler::write_file(config::sunshine.config_file.c_str(), "");
+    config::reload();
+
+    std::filesystem::remove(config::sunshine.config_file);
+    if (created_apps_file) {
+      std::filesystem::remove(apps_file);
+    }
+
+    config::sunshine.config_file = config_file;
+    config::stream.fec_percentage = fec_percentage;
+    config::sunshine.port = port;
+  }
+
+  std::string config_file;
+  int fec_percentage;
+  std::uint16_t port;
+
+  std::filesystem::path apps_file;
+  bool created_apps_file;
+};
+
+TEST_F(ConfigReloadTest, LiveOptionsTest) {
+  file_handler::write_file(config::sunshine.config_file.c_str(), "fec_percentage = 30\nport = 48000\n");
+
+  // The options read at startup only apply after a restart
+  ASSERT_EQ(config::reload(), std::vector<std::string> {"port"});
+  ASSERT_EQ(config::stream.fec_percentage, 30);
+  ASSERT_EQ(config::sunshine.port, port);
+
+  // They're reported until the restart, the applied ones aren't
+  ASSERT_EQ(config::reload(), std::vector<std::string> {"port"});
+
+  // Removed options are reset to their default
+  file_handler::write_file(config::sunshine.config_file.c_str(), "");
+  ASSERT_TRUE(config::reload().empty());
+  ASSERT_EQ(config::stream.fec_percentage, 20);
+}
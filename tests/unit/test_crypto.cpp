@@ -0,0 +1,74 @@
+/**
+ * @file tests/unit/test_crypto.cpp
+ * @brief Test src/crypto.*.
+ */
+#include "../tests_common.h"
+
+#include <src/crypto.h>
+
+namespace {
+  crypto::aes_t iv_of(std::uint32_t value) {
+    crypto::aes_t iv(16);
+    *(std::uint32_t *) iv.data() = value;
+    return iv;
+  }
+}  // namespace
+
+TEST(CryptoCbcTest, ReusedContextTest) {
+  crypto::aes_t key(16);
+  for (std::size_t x = 0; x < key.size(); ++x) {
+    key[x] = (std::uint8_t) x;
+  }
+
+  crypto::cipher::cbc_t reused {key};
+
+  // Every message is encrypted as if by a cipher of its own
+  for (std::uint32_t sequence = 0; sequence < 8; ++sequence) {
+    std::string plaintext(1 + sequence * 37, (char) sequence);
+    std::vector<std::uint8_t> expected(crypto::cipher::round_to_pkcs7_padded(plaintext.size()));
+    std::vector<std::uint8_t> cipher(expected.size());
+
+    auto iv = iv_of(sequence);
+    crypto::cipher::cbc_t fresh {key};
+    ASSERT_EQ(fresh.encrypt(plaintext, expected.data(), &iv), (int) expected.size());
+
+    iv = iv_of(sequence);
+    ASSERT_EQ(reused.encrypt(plaintext, cipher.data(), &iv), (int) cipher.size());
+    ASSERT_EQ(cipher, expected);
+  }
+}
+
+TEST(CryptoGcmTest, DecryptIntoBufferTest) {
+  crypto::aes_t key(16);
+  for (std::size_t x = 0; x < key.size(); ++x) {
+    key[x] = (std::uint8_t) (x * 7);
+  }
+
+  crypto::cipher::gcm_t encrypter {key, false};
+  crypto::cipher::gcm_t decrypter {key, false};
+
+  // The buffer is reused for messages of any length, like the control stream does
+  std::vector<std::uint8_t> plaintext_buffer(crypto::cipher::round_to_pkcs7_padded(1024));
+  for (std::uint32_t sequence = 0; sequence < 8; ++sequence) {
+    std::string plaintext(1 + sequence * 37, (char) ('a' + sequence));
+    std::vector<std::uint8_t> tagged_cipher(crypto::cipher::round_to_pkcs7_padded(plaintext.size()) + crypto::cipher::tag_size);
+
+    auto iv = iv_of(sequence);
+    ASSERT_EQ(encrypter.encrypt(plaintext, tagged_cipher.data(), &iv), (int) plaintext.size());
+
+    iv = iv_of(sequence);
+    std::string_view tagged_cipher_view {(const char *) tagged_cipher.data(), crypto::cipher::tag_size + plaintext.size()};
+    auto plaintext_size = decrypter.decrypt(tagged_cipher_view, plaintext_buffer.data(), &iv);
+    ASSERT_EQ(plaintext_size, (int) plaintext.size());
+    ASSERT_EQ(std::string_view((const char *) plaintext_buffer.data(), plaintext_size), plaintext);
+
+    // A message that was tampered with doesn't verify
+    tagged_cipher[crypto::cipher::tag_size] ^= 1;
+    iv = iv_of(sequence);
+    ASSERT_EQ(decrypter.decrypt(tagged_cipher_view, plaintext_buffer.data(), &iv), -1);
+  }
+
+  // Too short to even hold the tag
+  auto iv = iv_of(0);
+  ASSERT_EQ(decrypter.decrypt(std::string_view {"short"}, plaintext_buffer.data(), &iv), -1);
+}
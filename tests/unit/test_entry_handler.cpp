@@ -16,3 +16,12 @@ TEST(EntryHandlerTests, LogPublisherDataTest) {
   ASSERT_TRUE(log_checker::line_starts_with("test_sunshine.log", "Info: Publisher Website: "));
   ASSERT_TRUE(log_checker::line_starts_with("test_sunshine.log", "Info: Get support: "));
 }
+
+TEST(EntryHandlerTests, BenchmarkEncodersInvalidFramesTest) {
+  // The number of frames is checked before any encoder is touched
+  for (auto frames : {"abc", "0", "-5", "10x"}) {
+    std::string arg {frames};
+    char *argv[] {arg.data()};
+    ASSERT_EQ(args::benchmark_encoders("sunshine", 1, argv), 1) << frames;
+  }
+}
@@ -0,0 +1,57 @@
+/**
+ * @file tests/unit/test_fec_policy.cpp
+ * @brief Test src/fec_policy.*
+ */
+#include "../tests_common.h"
+
+#include <src/fec_policy.h>
+
+TEST(FecPolicyTests, FixedTest) {
+  fec_policy::controller_t controller;
+  controller.reset(30, 30, 30);
+
+  // Without room between the bounds, the percentage never moves
+  controller.report_loss(5);
+  controller.report_invalidation();
+  ASSERT_EQ(controller.percentage(), 30);
+}
+
+TEST(FecPolicyTests, ClampTest) {
+  fec_policy::controller_t controller;
+  controller.reset(80, 10, 50);
+  ASSERT_EQ(controller.percentage(), 50);
+
+  controller.reset(5, 10, 50);
+  ASSERT_EQ(controller.percentage(), 10);
+}
+
+TEST(FecPolicyTests, LossFeedbackTest) {
+  fec_policy::controller_t controller;
+  controller.reset(20, 10, 50);
+
+  controller.report_loss(2);
+  ASSERT_EQ(controller.percentage(), 20 + fec_policy::controller_t::LOSS_INCREASE);
+
+  controller.report_invalidation();
+  ASSERT_EQ(controller.percentage(), 20 + fec_policy::controller_t::LOSS_INCREASE + fec_policy::controller_t::INVALIDATION_INCREASE);
+
+  // Never raised beyond the upper bound
+  for (int x = 0; x < 10; ++x) {
+    controller.report_loss(1);
+  }
+  ASSERT_EQ(controller.percentage(), 50);
+
+  // Lowered only after enough clean reports in a row
+  for (int x = 1; x < fec_policy::controller_t::CLEAN_REPORTS_BEFORE_DECREASE; ++x) {
+    controller.report_loss(0);
+  }
+  ASSERT_EQ(controller.percentage(), 50);
+  controller.report_loss(0);
+  ASSERT_EQ(controller.percentage(), 50 - fec_policy::controller_t::DECREASE);
+
+  // Never lowered below the lower bound
+  for (int x = 0; x < 100 * fec_policy::controller_t::CLEAN_REPORTS_BEFORE_DECREASE; ++x) {
+    controller.report_loss(0);
+  }
+  ASSERT_EQ(controller.percentage(), 10);
+}
@@ -93,3 +93,21 @@ TEST(FileHandlerTests, ReadMissingFileTest) {
   // read missing file
   EXPECT_EQ(file_handler::read_file("non-existing-file.txt"), "");
 }
+
+TEST(FileHandlerTests, WriteFileAtomicTest) {
+  const std::string fileName = "write_file_atomic_test.txt";
+
+  EXPECT_EQ(file_handler::write_file_atomic(fileName.c_str(), "first"), 0);
+  EXPECT_EQ(file_handler::read_file(fileName.c_str()), "first");
+
+  // An existing file is replaced, and the temporary file doesn't remain
+  EXPECT_EQ(file_handler::write_file_atomic(fileName.c_str(), "second"), 0);
+  EXPECT_EQ(file_handler::read_file(fileName.c_str()), "second");
+  EXPECT_FALSE(std::filesystem::exists(fileName + ".tmp"));
+
+  std::filesystem::remove(fileName);
+}
+
+TEST(FileHandlerTests, WriteFileAtomicMissingDirectoryTest) {
+  EXPECT_EQ(file_handler::write_file_atomic("missing-directory/write_file_atomic_test.txt", "contents"), -1);
+}
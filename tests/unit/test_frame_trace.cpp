@@ -0,0 +1,75 @@
+/**
+ * @file tests/unit/test_frame_trace.cpp
+ * @brief Test src/frame_trace.*
+ */
+#include "../tests_common.h"
+
+#include <src/frame_trace.h>
+
+namespace {
+  frame_trace::trace_t make_trace(std::int64_t frame_index, std::optional<std::uint32_t> tx_id = std::nullopt) {
+    frame_trace::trace_t trace {};
+    trace.session_id = 1;
+    trace.frame_index = frame_index;
+    trace.last_sent = std::chrono::steady_clock::now();
+    trace.tx_id = tx_id;
+    return trace;
+  }
+}  // namespace
+
+TEST(FrameTraceTests, RingTest) {
+  for (std::size_t x = 0; x < frame_trace::MAX_TRACES + 10; ++x) {
+    frame_trace::record(make_trace(x));
+  }
+
+  auto traces = frame_trace::snapshot();
+  ASSERT_EQ(traces.size(), frame_trace::MAX_TRACES);
+
+  // The oldest traces were replaced
+  ASSERT_EQ(traces.front().frame_index, 10);
+  ASSERT_EQ(traces.back().frame_index, frame_trace::MAX_TRACES + 9);
+}
+
+TEST(FrameTraceTests, TxCompleteTest) {
+  frame_trace::record(make_trace(1, 100));
+
+  auto sent = std::chrono::steady_clock::now() + 1s;
+  frame_trace::tx_complete(100, sent);
+
+  auto trace = frame_trace::snapshot().back();
+  ASSERT_TRUE(trace.tx_timestamp);
+  ASSERT_EQ(trace.last_sent, sent);
+}
+
+TEST(FrameTraceTests, EarlyTxCompleteTest) {
+  // The kernel may report the timestamp before the trace is recorded
+  auto sent = std::chrono::steady_clock::now() + 1s;
+  frame_trace::tx_complete(200, sent);
+  frame_trace::record(make_trace(2, 200));
+
+  auto trace = frame_trace::snapshot().back();
+  ASSERT_TRUE(trace.tx_timestamp);
+  ASSERT_EQ(trace.last_sent, sent);
+}
+
+TEST(FrameTraceTests, TxIdsTest) {
+  frame_trace::tx_ids_t tx_ids;
+
+  auto sent = []() {
+    return true;
+  };
+  auto failed = []() {
+    return false;
+  };
+
+  ASSERT_EQ(tx_ids.send(sent), 0);
+
+  // Failed sends don't take an id
+  ASSERT_FALSE(tx_ids.send(failed));
+  ASSERT_EQ(tx_ids.send(sent), 1);
+
+  // The ids of another socket start at its base
+  frame_trace::tx_ids_t other_tx_ids {1 << 24};
+  ASSERT_EQ(other_tx_ids.send(sent), 1 << 24);
+  ASSERT_EQ(other_tx_ids.base(), 1 << 24);
+}
@@ -71,3 +71,28 @@ INSTANTIATE_TEST_SUITE_P(
     std::make_tuple(URL_2, "hello-redirect.txt")
   )
 );
+
+using byte_range_t = std::optional<std::pair<std::uint64_t, std::uint64_t>>;
+
+struct ParseByteRangeTest: testing::TestWithParam<std::tuple<std::string, std::uint64_t, byte_range_t>> {};
+
+TEST_P(ParseByteRangeTest, Run) {
+  const auto &[input, size, expected] = GetParam();
+  ASSERT_EQ(http::parse_byte_range(input, size), expected);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  ParseByteRangeTests,
+  ParseByteRangeTest,
+  testing::Values(
+    std::make_tuple("bytes=0-499", 1000, byte_range_t {{0, 500}}),
+    std::make_tuple("bytes=500-", 1000, byte_range_t {{500, 500}}),
+    std::make_tuple("bytes=900-1999", 1000, byte_range_t {{900, 100}}),
+    std::make_tuple("bytes=-100", 1000, byte_range_t {{900, 100}}),
+    std::make_tuple("bytes=-2000", 1000, byte_range_t {{0, 1000}}),
+    std::make_tuple("bytes=1000-", 1000, byte_range_t {}),
+    std::make_tuple("bytes=500-400", 1000, byte_range_t {}),
+    std::make_tuple("bytes=0-1,5-9", 1000, byte_range_t {}),
+    std::make_tuple("items=0-10", 1000, byte_range_t {})
+  )
+);
@@ -0,0 +1,110 @@
+/**
+ * @file tests/unit/test_image_pool.cpp
+ * @brief Test src/image_pool.*
+ */
+#include "../tests_common.h"
+
+#include <src/image_pool.h>
+#include <src/platform/common.h>
+
+using image_pool::pool_t;
+
+namespace {
+  pool_t::alloc_t counting_alloc(int &allocations) {
+    return [&allocations]() {
+      ++allocations;
+      return std::make_shared<platf::img_t>();
+    };
+  }
+}  // namespace
+
+TEST(ImagePoolTests, ReuseTest) {
+  int allocations = 0;
+
+  pool_t pool;
+  pool.reset(counting_alloc(allocations), 1024, 0);
+
+  auto img = pool.acquire();
+  ASSERT_TRUE(img);
+  auto img_p = img.get();
+  ASSERT_EQ(pool.stats().in_use, 1);
+
+  // The image is back in the pool once dropped, and handed out again
+  img.reset();
+  ASSERT_EQ(pool.stats().in_use, 0);
+  ASSERT_EQ(pool.acquire().get(), img_p);
+  ASSERT_EQ(allocations, 1);
+  ASSERT_EQ(pool.stats().allocated, 1);
+}
+
+TEST(ImagePoolTests, LimitTest) {
+  int allocations = 0;
+
+  pool_t pool;
+  pool.reset(counting_alloc(allocations), 1024, 0);
+  pool.set_consumers(1);
+
+  std::vector<std::shared_ptr<platf::img_t>> imgs;
+  while (auto img = pool.acquire()) {
+    imgs.emplace_back(std::move(img));
+  }
+  ASSERT_EQ(imgs.size(), pool_t::BACKEND_IMAGES + pool_t::IMAGES_PER_CONSUMER);
+
+  // More consumers get more images, up to the maximum
+  pool.set_consumers(100);
+  while (auto img = pool.acquire()) {
+    imgs.emplace_back(std::move(img));
+  }
+  ASSERT_EQ(imgs.size(), pool_t::MAX_IMAGES);
+  ASSERT_EQ(pool.stats().limit, pool_t::MAX_IMAGES);
+}
+
+TEST(ImagePoolTests, BudgetTest) {
+  int allocations = 0;
+
+  pool_t pool;
+  pool.reset(counting_alloc(allocations), 1024, 4 * 1024);
+  pool.set_consumers(4);
+  ASSERT_EQ(pool.stats().limit, 4);
+
+  // A budget below what capturing needs is exceeded
+  pool.reset(counting_alloc(allocations), 1024, 1024);
+  ASSERT_EQ(pool.stats().limit, pool_t::BACKEND_IMAGES + 1);
+}
+
+TEST(ImagePoolTests, TrimTest) {
+  int allocations = 0;
+
+  pool_t pool;
+  pool.reset(counting_alloc(allocations), 1024, 0);
+
+  auto first = pool.acquire();
+  auto second = pool.acquire();
+  first.reset();
+  second.reset();
+
+  pool.trim(std::chrono::steady_clock::now());
+  ASSERT_EQ(pool.stats().allocated, 2);
+
+  pool.trim(std::chrono::steady_clock::now() + pool_t::TRIM_TIMEOUT);
+  ASSERT_EQ(pool.stats().allocated, 0);
+}
+
+TEST(ImagePoolTests, ResetTest) {
+  int allocations = 0;
+
+  pool_t pool;
+  pool.reset(counting_alloc(allocations), 1024, 0);
+
+  auto img = pool.acquire();
+  std::weak_ptr<platf::img_t> img_wp = img->weak_from_this();
+
+  // Images of the previous display are freed instead of returned
+  pool.reset(counting_alloc(allocations), 1024, 0);
+  img.reset();
+  ASSERT_TRUE(img_wp.expired());
+  ASSERT_EQ(pool.stats().allocated, 0);
+
+  pool.clear();
+  ASSERT_FALSE(pool.acquire());
+}
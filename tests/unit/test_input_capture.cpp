@@ -0,0 +1,87 @@
+/**
+ * @file tests/unit/test_input_capture.cpp
+ * @brief Test src/input_capture.*
+ */
+#include "../tests_common.h"
+
+#include <src/input_capture.h>
+#include <src/platform/common.h>
+
+namespace {
+  std::span<const std::uint8_t> as_message(std::string_view data) {
+    return {(const std::uint8_t *) data.data(), data.size()};
+  }
+}  // namespace
+
+struct InputCaptureTest: testing::Test {
+  void SetUp() override {
+    path = platf::appdata() / "tests" / "input.bin";
+    std::filesystem::create_directories(path.parent_path());
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(path);
+  }
+
+  std::filesystem::path path;
+};
+
+TEST_F(InputCaptureTest, RoundTripTest) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    input_capture::writer_t writer {path};
+    ASSERT_TRUE(writer);
+
+    ASSERT_TRUE(writer.write(as_message(std::string_view("\x00\x00\x00\x08move", 8)), 1920, 1080, start + 5ms));
+    ASSERT_TRUE(writer.write(as_message("key"), 2560, 1440, start + 21ms));
+    ASSERT_TRUE(writer.write({}, 2560, 1440, start + 21ms));
+  }
+
+  auto capture = input_capture::capture_t::load(path);
+  ASSERT_TRUE(capture);
+
+  auto &records = capture->records();
+  ASSERT_EQ(records.size(), 3);
+
+  // The timestamps count from the first message
+  ASSERT_EQ(records[0].timestamp, 0ns);
+  ASSERT_EQ(records[1].timestamp, 16ms);
+  ASSERT_EQ(records[2].timestamp, 16ms);
+
+  ASSERT_EQ(records[0].width, 1920);
+  ASSERT_EQ(records[0].height, 1080);
+  ASSERT_EQ(records[0].data, std::string_view("\x00\x00\x00\x08move", 8));
+
+  ASSERT_EQ(records[1].width, 2560);
+  ASSERT_EQ(records[1].height, 1440);
+  ASSERT_EQ(records[1].data, "key");
+
+  ASSERT_TRUE(records[2].data.empty());
+}
+
+TEST_F(InputCaptureTest, TruncatedTest) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    input_capture::writer_t writer {path};
+    ASSERT_TRUE(writer.write(as_message("first"), 1920, 1080, start));
+    ASSERT_TRUE(writer.write(as_message("second"), 1920, 1080, start));
+  }
+
+  // A recording cut short keeps its complete messages
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+  auto capture = input_capture::capture_t::load(path);
+  ASSERT_TRUE(capture);
+  ASSERT_EQ(capture->records().size(), 1);
+  ASSERT_EQ(capture->records()[0].data, "first");
+}
+
+TEST_F(InputCaptureTest, NotACaptureTest) {
+  {
+    std::ofstream out {path, std::ios::binary};
+    out << "not a capture file";
+  }
+
+  ASSERT_FALSE(input_capture::capture_t::load(path));
+  ASSERT_FALSE(input_capture::capture_t::load(path.parent_path() / "missing.bin"));
+}
@@ -0,0 +1,57 @@
+/**
+ * @file tests/unit/test_input_latency.cpp
+ * @brief Test src/input_latency.*
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <src/input_latency.h>
+
+using input_latency::histogram_t;
+
+TEST(InputLatencyTests, PercentileTest) {
+  histogram_t histogram;
+  ASSERT_EQ(histogram.percentile(50), 0);
+
+  for (std::uint32_t us = 1; us <= 1000; ++us) {
+    histogram.record(us);
+  }
+  ASSERT_EQ(histogram.count(), 1000);
+  ASSERT_EQ(histogram.max(), 1000);
+
+  // The percentiles are within the precision of the buckets
+  for (auto percentile : {50.0, 90.0, 99.0}) {
+    auto expected = percentile * 10;
+    auto value = histogram.percentile(percentile);
+    ASSERT_GE(value, expected);
+    ASSERT_LE(value, expected * 1.125);
+  }
+  ASSERT_EQ(histogram.percentile(100), 1000);
+}
+
+TEST(InputLatencyTests, LargeValuesTest) {
+  histogram_t histogram;
+  histogram.record(0);
+  histogram.record(UINT32_MAX);
+
+  ASSERT_EQ(histogram.percentile(0), 0);
+  ASSERT_EQ(histogram.percentile(100), UINT32_MAX);
+}
+
+TEST(InputLatencyTests, SessionsTest) {
+  auto session = input_latency::start_session(7);
+  session->record(input_latency::type_e::keyboard, 2ms);
+
+  auto sessions = input_latency::snapshot();
+  auto it = std::find_if(std::begin(sessions), std::end(sessions), [](auto &snapshot) {
+    return snapshot.session_id == 7;
+  });
+  ASSERT_NE(it, std::end(sessions));
+  ASSERT_EQ(it->histograms[(std::size_t) input_latency::type_e::keyboard].count(), 1);
+
+  // Sessions that ended aren't listed
+  session.reset();
+  for (auto &snapshot : input_latency::snapshot()) {
+    ASSERT_NE(snapshot.session_id, 7);
+  }
+}
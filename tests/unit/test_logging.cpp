@@ -44,3 +44,45 @@ TEST_P(LogLevelsTest, PutMessage) {
 
   ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
 }
+
+TEST(LoggingTest, HotLogTest) {
+  std::random_device rand_dev;
+  std::mt19937_64 rand_gen(rand_dev());
+  auto test_message = std::to_string(rand_gen()) + std::to_string(rand_gen());
+  SUNSHINE_HOT_LOG(verbose) << test_message;
+
+  ASSERT_TRUE(log_checker::line_contains(log_file, test_message));
+}
+
+TEST(LoggingTest, HotLogSkippedTest) {
+  auto previous_level = logging::min_level.exchange(logging::level::info);
+
+  // The record isn't even built when its level isn't logged
+  bool evaluated = false;
+  auto evaluate = [&evaluated]() {
+    evaluated = true;
+    return "evaluated";
+  };
+  SUNSHINE_HOT_LOG(debug) << evaluate();
+  ASSERT_FALSE(evaluated);
+
+  SUNSHINE_HOT_LOG(info) << evaluate();
+  ASSERT_TRUE(evaluated);
+
+  logging::min_level = previous_level;
+}
+
+TEST(LoggingTest, RecentLinesTest) {
+  std::random_device rand_dev;
+  std::mt19937_64 rand_gen(rand_dev());
+  auto test_message = std::to_string(rand_gen()) + std::to_string(rand_gen());
+  BOOST_LOG(info) << test_message;
+  logging::log_flush();
+
+  auto lines = logging::recent_log_lines();
+  ASSERT_FALSE(lines.empty());
+  ASSERT_NE(lines.back().text.find(test_message), std::string::npos);
+
+  // Only the lines after the given one are returned
+  ASSERT_TRUE(logging::recent_log_lines(lines.back().sequence).empty());
+}
@@ -0,0 +1,130 @@
+/**
+ * @file tests/unit/test_metrics.cpp
+ * @brief Test src/metrics.*.
+ */
+#include "../tests_common.h"
+
+#include <src/metrics.h>
+
+namespace {
+  bool contains(const std::string &text, std::string_view part) {
+    return text.find(part) != std::string::npos;
+  }
+}  // namespace
+
+TEST(MetricsTest, CounterTest) {
+  auto frames = metrics::counter("test_counter_frames_total", "Frames of the test", {{"session", "1"}});
+  frames->increment();
+  frames->increment(2);
+  ASSERT_EQ(frames->value(), 3);
+
+  // The same name and labels give the same series
+  ASSERT_EQ(metrics::counter("test_counter_frames_total", "Frames of the test", {{"session", "1"}}), frames);
+  ASSERT_NE(metrics::counter("test_counter_frames_total", "Frames of the test", {{"session", "2"}}), frames);
+
+  auto text = metrics::render();
+  ASSERT_TRUE(contains(text, "# HELP test_counter_frames_total Frames of the test\n"));
+  ASSERT_TRUE(contains(text, "# TYPE test_counter_frames_total counter\n"));
+  ASSERT_TRUE(contains(text, "test_counter_frames_total{session=\"1\"} 3\n"));
+}
+
+TEST(MetricsTest, ExpiredSeriesTest) {
+  auto gauge = metrics::gauge("test_expired_gauge", "Gauge of the test", {{"session", "\"quoted\"\n"}});
+  gauge->set(1.5);
+  ASSERT_TRUE(contains(metrics::render(), "test_expired_gauge{session=\"\\\"quoted\\\"\\n\"} 1.5\n"));
+
+  // The series of an ended session isn't exported anymore
+  gauge.reset();
+  ASSERT_FALSE(contains(metrics::render(), "test_expired_gauge"));
+}
+
+TEST(MetricsTest, HistogramTest) {
+  auto histogram = metrics::histogram("test_histogram_seconds", "Histogram of the test", metrics::exponential_buckets(0.001, 10, 3));
+  ASSERT_EQ(histogram->bounds(), (std::vector<double> {0.001, 0.01, 0.1}));
+
+  histogram->observe(0.001);
+  histogram->observe(0.05);
+  histogram->observe(0.05);
+  histogram->observe(2);
+  ASSERT_EQ(histogram->counts(), (std::vector<std::uint64_t> {1, 0, 2, 1}));
+  ASSERT_DOUBLE_EQ(histogram->sum(), 2.101);
+
+  // The buckets are cumulative
+  auto text = metrics::render();
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_bucket{le=\"0.001\"} 1\n"));
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_bucket{le=\"0.01\"} 1\n"));
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_bucket{le=\"0.1\"} 3\n"));
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_bucket{le=\"+Inf\"} 4\n"));
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_sum 2.101\n"));
+  ASSERT_TRUE(contains(text, "test_histogram_seconds_count 4\n"));
+}
+
+TEST(MetricsTest, ProbeTest) {
+  double depth = 3;
+  auto probe = metrics::gauge_probe("test_probe_depth", "Probe of the test", {{"queue", "video"}}, [&depth]() {
+    return depth;
+  });
+  ASSERT_TRUE(contains(metrics::render(), "test_probe_depth{queue=\"video\"} 3\n"));
+
+  depth = 0;
+  ASSERT_TRUE(contains(metrics::render(), "test_probe_depth{queue=\"video\"} 0\n"));
+}
+
+TEST(MetricsTest, SummaryTest) {
+  auto summary = metrics::summary("test_summary_seconds", "Summary of the test", {{"session", "1"}});
+  for (int x = 1; x <= 1000; ++x) {
+    summary->observe(x / 1000.);
+  }
+
+  auto text = metrics::render();
+  ASSERT_TRUE(contains(text, "# TYPE test_summary_seconds summary\n"));
+  ASSERT_TRUE(contains(text, "test_summary_seconds{session=\"1\",quantile=\"0.5\"} "));
+  ASSERT_TRUE(contains(text, "test_summary_seconds{session=\"1\",quantile=\"0.999\"} "));
+  ASSERT_TRUE(contains(text, "test_summary_seconds_sum{session=\"1\"} 500.5\n"));
+  ASSERT_TRUE(contains(text, "test_summary_seconds_count{session=\"1\"} 1000\n"));
+}
+
+TEST(MetricsTest, LoggerExportTest) {
+  // The values reach the summary even when the log level hides the logger
+  logging::time_delta_periodic_logger logger {verbose, "Test duration"};
+  auto summary = metrics::summary("test_logger_seconds", "Logger of the test");
+  logger.export_to(summary);
+
+  auto now = std::chrono::steady_clock::now();
+  logger.first_point(now);
+  logger.second_point_and_log(now + std::chrono::seconds(1));
+  ASSERT_EQ(summary->tracker().count(), 1);
+  ASSERT_DOUBLE_EQ(summary->tracker().sum(), 1);
+}
+
+TEST(MetricsTest, SnapshotTest) {
+  auto frames = metrics::counter("test_snapshot_frames_total", "Frames of the test", {{"session", "7"}});
+  frames->increment(5);
+  auto summary = metrics::summary("test_snapshot_seconds", "Summary of the test", {{"session", "7"}});
+  summary->observe(0.5);
+  summary->observe(1.5);
+
+  auto samples = metrics::snapshot();
+  auto find = [&](std::string_view name) {
+    return std::find_if(std::begin(samples), std::end(samples), [&](const metrics::sample_t &sample) {
+      return sample.name == name;
+    });
+  };
+
+  auto frames_sample = find("test_snapshot_frames_total");
+  ASSERT_NE(frames_sample, std::end(samples));
+  ASSERT_EQ(frames_sample->type, metrics::type_e::counter);
+  ASSERT_EQ(frames_sample->labels, (metrics::labels_t {{"session", "7"}}));
+  ASSERT_DOUBLE_EQ(frames_sample->value, 5);
+
+  auto summary_sample = find("test_snapshot_seconds");
+  ASSERT_NE(summary_sample, std::end(samples));
+  ASSERT_EQ(summary_sample->type, metrics::type_e::summary);
+  ASSERT_DOUBLE_EQ(summary_sample->value, 2);
+  ASSERT_EQ(summary_sample->count, 2);
+
+  // Like the rendering, the snapshot forgets the series of an ended session
+  frames.reset();
+  samples = metrics::snapshot();
+  ASSERT_EQ(find("test_snapshot_frames_total"), std::end(samples));
+}
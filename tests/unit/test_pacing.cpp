@@ -0,0 +1,117 @@
+/**
+ * @file tests/unit/test_pacing.cpp
+ * @brief Test src/pacing.*
+ */
+#include "../tests_common.h"
+
+#include <src/pacing.h>
+
+TEST(PacerTests, DefaultRateTest) {
+  pacing::pacer_t pacer;
+
+  // 80% of 1 Gbps
+  ASSERT_EQ(pacer.rate(), 800'000'000);
+  ASSERT_EQ(pacer.packets_per_ms(1024), 800'000'000 / 1000 / 8 / 1024);
+}
+
+TEST(PacerTests, LinkSpeedTest) {
+  pacing::pacer_t pacer;
+  pacer.reset(10'000'000'000, 0);
+  ASSERT_EQ(pacer.ceiling(), 8'000'000'000);
+  ASSERT_EQ(pacer.rate(), pacer.ceiling());
+}
+
+TEST(PacerTests, OverrideTest) {
+  pacing::pacer_t pacer;
+  pacer.reset(10'000'000'000, 50'000'000);
+  ASSERT_EQ(pacer.ceiling(), 50'000'000);
+  ASSERT_EQ(pacer.rate(), 50'000'000);
+}
+
+TEST(PacerTests, LossFeedbackTest) {
+  pacing::pacer_t pacer;
+  pacer.reset(0, 100'000'000);
+
+  pacer.report_loss(3);
+  ASSERT_EQ(pacer.rate(), 85'000'000);
+
+  // Recovers additively, but never beyond the ceiling
+  pacer.report_loss(0);
+  ASSERT_EQ(pacer.rate(), 87'000'000);
+  for (int x = 0; x < 100; ++x) {
+    pacer.report_loss(0);
+  }
+  ASSERT_EQ(pacer.rate(), 100'000'000);
+
+  // Never backs off below the floor
+  for (int x = 0; x < 100; ++x) {
+    pacer.report_loss(1);
+  }
+  ASSERT_EQ(pacer.rate(), 10'000'000);
+  ASSERT_GE(pacer.packets_per_ms(1'000'000), 1);
+}
+
+TEST(PacerTests, BurstTest) {
+  pacing::pacer_t pacer;
+  pacer.reset(0, 100'000'000);
+
+  // Frames sent at the burst rate go out faster than the others
+  ASSERT_EQ(pacer.packets_per_ms(1000), 100'000'000 / 1000 / 8 / 1000);
+  ASSERT_EQ(pacer.packets_per_ms(1000, true), 125'000'000 / 1000 / 8 / 1000);
+}
+
+TEST(DeadlineTests, DisabledTest) {
+  using namespace std::literals;
+
+  pacing::deadline_t deadline;
+  deadline.reset(0ns);
+  ASSERT_TRUE(deadline.admit(1, 1s, false, false));
+}
+
+TEST(DeadlineTests, DropUntilRecoveryTest) {
+  using namespace std::literals;
+
+  pacing::deadline_t deadline;
+  deadline.reset(33ms);
+
+  ASSERT_TRUE(deadline.admit(1, 10ms, false, false));
+  ASSERT_TRUE(deadline.admit(2, std::nullopt, false, false));
+
+  // The late frame and the ones referencing it are dropped, whatever their age
+  ASSERT_FALSE(deadline.admit(3, 50ms, false, false));
+  ASSERT_EQ(deadline.dropped_frames(), std::make_pair<std::int64_t, std::int64_t>(3, 3));
+  ASSERT_FALSE(deadline.admit(4, 5ms, false, false));
+  ASSERT_EQ(deadline.dropped_frames(), std::make_pair<std::int64_t, std::int64_t>(3, 4));
+
+  // The frame encoded after the invalidation is sent
+  ASSERT_TRUE(deadline.admit(5, 5ms, false, true));
+  ASSERT_TRUE(deadline.admit(6, 5ms, false, false));
+}
+
+TEST(DeadlineTests, IdrTest) {
+  using namespace std::literals;
+
+  pacing::deadline_t deadline;
+  deadline.reset(33ms);
+
+  // An IDR frame is never dropped, and ends the drops
+  ASSERT_TRUE(deadline.admit(1, 100ms, true, false));
+  ASSERT_FALSE(deadline.admit(2, 100ms, false, false));
+  ASSERT_TRUE(deadline.admit(3, 5ms, true, false));
+  ASSERT_TRUE(deadline.admit(4, 5ms, false, false));
+}
+
+TEST(DeadlineTests, DependentDropLimitTest) {
+  using namespace std::literals;
+
+  pacing::deadline_t deadline;
+  deadline.reset(33ms);
+
+  ASSERT_FALSE(deadline.admit(1, 50ms, false, false));
+  for (int x = 0; x < pacing::deadline_t::MAX_DEPENDENT_DROPS; ++x) {
+    ASSERT_FALSE(deadline.admit(2 + x, 5ms, false, false));
+  }
+
+  // The client recovers by itself once no recovery frame came
+  ASSERT_TRUE(deadline.admit(2 + pacing::deadline_t::MAX_DEPENDENT_DROPS, 5ms, false, false));
+}
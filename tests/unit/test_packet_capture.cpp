@@ -0,0 +1,144 @@
+/**
+ * @file tests/unit/test_packet_capture.cpp
+ * @brief Test src/packet_capture.*
+ */
+#include "../tests_common.h"
+
+#include <src/packet_capture.h>
+#include <src/platform/common.h>
+
+namespace {
+  video::packet_t make_packet(std::int64_t frame_index, bool idr, std::string_view data, std::chrono::steady_clock::time_point frame_timestamp) {
+    auto packet = std::make_unique<video::packet_raw_generic>(std::vector<uint8_t>(std::begin(data), std::end(data)), frame_index, idr);
+    packet->frame_timestamp = frame_timestamp;
+    packet->frame_type = idr ? video::frame_type_e::idr : video::frame_type_e::p;
+    return packet;
+  }
+}  // namespace
+
+struct PacketCaptureTest: testing::Test {
+  void SetUp() override {
+    path = platf::appdata() / "tests" / "packets.bin";
+    std::filesystem::create_directories(path.parent_path());
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(path);
+  }
+
+  std::filesystem::path path;
+};
+
+TEST_F(PacketCaptureTest, RoundTripTest) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    packet_capture::writer_t writer {path};
+    ASSERT_TRUE(writer);
+
+    auto keyframe = make_packet(1, true, "\x00\x00\x01spsslice", start + 10ms);
+    keyframe->replaced_head = {'n', 'e', 'w', 's', 'p', 's'};
+    keyframe->replaced_size = 6;
+    ASSERT_TRUE(writer.write(*keyframe));
+
+    auto frame = make_packet(2, false, "slice", start + 26ms);
+    frame->after_ref_frame_invalidation = true;
+    ASSERT_TRUE(writer.write(*frame));
+
+    video::packet_raw_generic untimed {{}, 3, false};
+    ASSERT_TRUE(writer.write(untimed));
+  }
+
+  auto capture = packet_capture::capture_t::load(path);
+  ASSERT_TRUE(capture);
+
+  auto &records = capture->records();
+  ASSERT_EQ(records.size(), 3);
+  ASSERT_EQ(capture->payload_bytes(), 18);
+
+  ASSERT_EQ(records[0].frame_index, 1);
+  ASSERT_TRUE(records[0].idr);
+  ASSERT_EQ(records[0].frame_type, video::frame_type_e::idr);
+  ASSERT_EQ(records[0].data, std::string_view("\x00\x00\x01spsslice", 13));
+  ASSERT_EQ(records[0].replaced_head, "newsps");
+  ASSERT_EQ(records[0].replaced_size, 6);
+
+  // The timestamps count from the first packet
+  ASSERT_EQ(records[0].frame_timestamp, 0ns);
+  ASSERT_EQ(records[1].frame_timestamp, 16ms);
+
+  ASSERT_FALSE(records[1].idr);
+  ASSERT_TRUE(records[1].after_ref_frame_invalidation);
+  ASSERT_EQ(records[1].data, "slice");
+
+  ASSERT_FALSE(records[2].frame_timestamp);
+  ASSERT_TRUE(records[2].data.empty());
+
+  auto packet = packet_capture::make_packet(records[0]);
+  ASSERT_TRUE(packet->is_idr());
+  ASSERT_EQ(packet->frame_index(), 1);
+  ASSERT_EQ(std::string_view((char *) packet->data(), packet->data_size()), records[0].data);
+  ASSERT_EQ(packet->replaced_size, 6);
+}
+
+TEST_F(PacketCaptureTest, TruncatedTest) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    packet_capture::writer_t writer {path};
+    ASSERT_TRUE(writer.write(*make_packet(1, true, "first", start)));
+    ASSERT_TRUE(writer.write(*make_packet(2, false, "second", start)));
+  }
+
+  // A recording cut short keeps its complete packets
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+
+  auto capture = packet_capture::capture_t::load(path);
+  ASSERT_TRUE(capture);
+  ASSERT_EQ(capture->records().size(), 1);
+  ASSERT_EQ(capture->records()[0].data, "first");
+}
+
+TEST_F(PacketCaptureTest, NotACaptureTest) {
+  {
+    std::ofstream out {path, std::ios::binary};
+    out << "not a capture file";
+  }
+
+  ASSERT_FALSE(packet_capture::capture_t::load(path));
+  ASSERT_FALSE(packet_capture::capture_t::load(path.parent_path() / "missing.bin"));
+}
+
+TEST_F(PacketCaptureTest, ReplayTest) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    packet_capture::writer_t writer {path};
+    for (int x = 0; x < 5; ++x) {
+      ASSERT_TRUE(writer.write(*make_packet(x, x == 0, "frame", start + x * 20ms)));
+    }
+  }
+
+  auto capture = packet_capture::capture_t::load(path);
+  ASSERT_TRUE(capture);
+
+  auto mail = std::make_shared<safe::mail_raw_t>();
+  auto packets = mail->queue<video::packet_t>(0);
+
+  // 80 ms of frames played 4 times as fast
+  int session;
+  auto replay_start = std::chrono::steady_clock::now();
+  ASSERT_EQ(packet_capture::replay(*capture, packets, 4, &session), 5);
+  ASSERT_GE(std::chrono::steady_clock::now() - replay_start, 20ms);
+
+  for (int x = 0; x < 5; ++x) {
+    auto packet = packets->pop();
+    ASSERT_TRUE(packet);
+    ASSERT_EQ(packet->frame_index(), x);
+    ASSERT_EQ(packet->channel_data, &session);
+    ASSERT_TRUE(packet->frame_timestamp);
+  }
+
+  // Without waiting between the packets
+  ASSERT_EQ(packet_capture::replay(*capture, packets, 0, &session), 5);
+
+  packets->stop();
+  ASSERT_EQ(packet_capture::replay(*capture, packets, 0, &session), 0);
+}
@@ -0,0 +1,56 @@
+/**
+ * @file tests/unit/test_process.cpp
+ * @brief Test src/process.*.
+ */
+#include "../tests_common.h"
+
+#include <fstream>
+#include <src/process.h>
+
+namespace {
+  void write(const std::filesystem::path &path, const std::string &contents) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary);
+    out << contents;
+  }
+}  // namespace
+
+struct ProcessImageTest: testing::Test {
+  void SetUp() override {
+    image = platf::appdata() / "tests" / "process" / "app.png";
+    std::filesystem::remove_all(image.parent_path());
+    write(image, "first image");
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(image.parent_path());
+  }
+
+  std::filesystem::path image;
+};
+
+TEST_F(ProcessImageTest, ImageHashTest) {
+  auto hash = proc::calculate_image_sha256(image.string());
+  ASSERT_TRUE(hash);
+  ASSERT_EQ(hash, proc::calculate_sha256(image.string()));
+  ASSERT_EQ(proc::calculate_image_sha256(image.string()), hash);
+
+  // The image is hashed again once it changed
+  write(image, "the second image");
+  auto updated = proc::calculate_image_sha256(image.string());
+  ASSERT_TRUE(updated);
+  ASSERT_NE(updated, hash);
+  ASSERT_EQ(updated, proc::calculate_sha256(image.string()));
+
+  std::filesystem::remove(image);
+  ASSERT_EQ(proc::calculate_image_sha256(image.string()), proc::calculate_sha256(image.string()));
+}
+
+TEST_F(ProcessImageTest, AppIdTest) {
+  auto [id, id_with_index] = proc::calculate_app_id("App", image.string(), 0);
+  ASSERT_NE(id, id_with_index);
+  ASSERT_EQ(std::get<0>(proc::calculate_app_id("App", image.string(), 0)), id);
+
+  write(image, "the second image");
+  ASSERT_NE(std::get<0>(proc::calculate_app_id("App", image.string(), 0)), id);
+}
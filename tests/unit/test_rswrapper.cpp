@@ -2,6 +2,8 @@
  * @file tests/unit/test_rswrapper.cpp
  * @brief Test src/rswrapper.*
  */
+#include <cstring>
+
 extern "C" {
 #include <src/rswrapper.h>
 }
@@ -34,3 +36,42 @@ TEST(ReedSolomonWrapperTests, EncodeTest) {
 
   reed_solomon_release(rs);
 }
+
+TEST(ReedSolomonWrapperTests, ColumnSplitEncodeTest) {
+  reed_solomon_init();
+
+  constexpr int dataShards = 4;
+  constexpr int fecShards = 2;
+  constexpr int shardSize = 128;
+  constexpr int splitOffset = 64;
+
+  auto rs = reed_solomon_new(dataShards, fecShards);
+  ASSERT_NE(rs, nullptr);
+
+  uint8_t shards[dataShards + fecShards][shardSize] = {};
+  for (int x = 0; x < dataShards; ++x) {
+    for (int y = 0; y < shardSize; ++y) {
+      shards[x][y] = (uint8_t) (x * 31 + y * 7);
+    }
+  }
+
+  uint8_t splitShards[dataShards + fecShards][shardSize] = {};
+  std::memcpy(splitShards, shards, sizeof(shards));
+
+  uint8_t *shardPtrs[dataShards + fecShards];
+  uint8_t *firstPtrs[dataShards + fecShards];
+  uint8_t *secondPtrs[dataShards + fecShards];
+  for (int x = 0; x < dataShards + fecShards; ++x) {
+    shardPtrs[x] = shards[x];
+    firstPtrs[x] = splitShards[x];
+    secondPtrs[x] = splitShards[x] + splitOffset;
+  }
+
+  // Encoding separate ranges of columns must match encoding the whole shards
+  ASSERT_EQ(reed_solomon_encode(rs, shardPtrs, dataShards + fecShards, shardSize), 0);
+  ASSERT_EQ(reed_solomon_encode(rs, firstPtrs, dataShards + fecShards, splitOffset), 0);
+  ASSERT_EQ(reed_solomon_encode(rs, secondPtrs, dataShards + fecShards, shardSize - splitOffset), 0);
+  ASSERT_EQ(std::memcmp(shards, splitShards, sizeof(shards)), 0);
+
+  reed_solomon_release(rs);
+}
@@ -0,0 +1,87 @@
+/**
+ * @file tests/unit/test_stat_trackers.cpp
+ * @brief Test src/stat_trackers.*.
+ */
+#include "../tests_common.h"
+
+#include <src/stat_trackers.h>
+#include <thread>
+
+TEST(HistogramTrackerTest, EmptyTest) {
+  stat_trackers::histogram_tracker tracker;
+  ASSERT_EQ(tracker.count(), 0);
+  ASSERT_EQ(tracker.percentile(50), 0);
+}
+
+TEST(HistogramTrackerTest, PercentileTest) {
+  stat_trackers::histogram_tracker tracker;
+  for (int x = 1; x <= 10000; ++x) {
+    tracker.collect(x / 10.);
+  }
+
+  ASSERT_EQ(tracker.count(), 10000);
+  ASSERT_DOUBLE_EQ(tracker.min(), 0.1);
+  ASSERT_DOUBLE_EQ(tracker.max(), 1000);
+
+  // Each percentile is within 1/64 of the exact value
+  for (auto [percent, exact] : {std::pair {50., 500.}, std::pair {95., 950.}, std::pair {99., 990.}, std::pair {99.9, 999.}}) {
+    ASSERT_NEAR(tracker.percentile(percent), exact, exact / 64) << percent;
+  }
+
+  // The extremes are exact
+  ASSERT_DOUBLE_EQ(tracker.percentile(0), 0.1);
+  ASSERT_DOUBLE_EQ(tracker.percentile(100), 1000);
+}
+
+TEST(HistogramTrackerTest, TailTest) {
+  // The mean hides a spike the 99.9th percentile shows
+  stat_trackers::histogram_tracker tracker;
+  for (int x = 0; x < 998; ++x) {
+    tracker.collect(2);
+  }
+  tracker.collect(50);
+  tracker.collect(50);
+
+  ASSERT_NEAR(tracker.percentile(99), 2, 2. / 64);
+  ASSERT_NEAR(tracker.percentile(99.9), 50, 50. / 64);
+}
+
+TEST(HistogramTrackerTest, ZeroTest) {
+  stat_trackers::histogram_tracker tracker;
+  tracker.collect(0);
+  tracker.collect(0);
+  tracker.collect(3);
+
+  ASSERT_EQ(tracker.percentile(50), 0);
+  ASSERT_DOUBLE_EQ(tracker.percentile(100), 3);
+}
+
+TEST(HistogramTrackerTest, MergeTest) {
+  std::array<stat_trackers::histogram_tracker, 2> trackers;
+
+  std::array<std::thread, 2> threads;
+  for (std::size_t x = 0; x < threads.size(); ++x) {
+    threads[x] = std::thread {[&tracker = trackers[x], x]() {
+      for (int y = 0; y < 1000; ++y) {
+        tracker.collect(x ? 100 : 1);
+      }
+    }};
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  stat_trackers::histogram_tracker merged;
+  merged.merge(trackers[0]);
+  merged.merge(trackers[1]);
+
+  ASSERT_EQ(merged.count(), 2000);
+  ASSERT_DOUBLE_EQ(merged.sum(), 101000);
+  ASSERT_DOUBLE_EQ(merged.min(), 1);
+  ASSERT_DOUBLE_EQ(merged.max(), 100);
+  ASSERT_NEAR(merged.percentile(25), 1, 1. / 64);
+  ASSERT_NEAR(merged.percentile(75), 100, 100. / 64);
+
+  merged.reset();
+  ASSERT_EQ(merged.count(), 0);
+}
@@ -3,37 +3,109 @@
  * @brief Test src/stream.*
  */
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string>
 #include <vector>
 
 namespace stream {
-  std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  size_t gather_slices(std::span<const std::string_view> segments, size_t slice_size, size_t first_slice, size_t slice_count, uint8_t **slices, uint8_t *scratch);
+  std::uint32_t audio_timestamp(std::uint32_t next, std::chrono::nanoseconds media_time, int packet_duration, bool block_start);
 }
 
 #include "../tests_common.h"
 
-TEST(ConcatAndInsertTests, ConcatNoInsertionTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(0, 2, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {'a', 'b', 'c', 'd', 'e'};
-  ASSERT_EQ(res, expected);
+static std::vector<std::string> slices_to_strings(uint8_t **slices, size_t count, size_t slice_size) {
+  std::vector<std::string> result;
+  for (size_t x = 0; x < count; ++x) {
+    result.emplace_back((char *) slices[x], slice_size);
+  }
+  return result;
 }
 
-TEST(ConcatAndInsertTests, ConcatLargeStrideTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, sizeof(b1) + sizeof(b2) + 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {0, 'a', 'b', 'c', 'd', 'e'};
-  ASSERT_EQ(res, expected);
+TEST(GatherSlicesTests, SingleAlignedSegmentTest) {
+  std::string data = "abcdef";
+  std::array<std::string_view, 1> segments {data};
+  uint8_t *slices[3];
+  uint8_t scratch[2];
+
+  auto copied = stream::gather_slices(segments, 2, 0, 3, slices, scratch);
+  ASSERT_EQ(copied, 0);
+  ASSERT_EQ(slices[0], (uint8_t *) data.data());
+  ASSERT_EQ(slices[1], (uint8_t *) data.data() + 2);
+  ASSERT_EQ(slices[2], (uint8_t *) data.data() + 4);
+}
+
+TEST(GatherSlicesTests, SpanningSegmentsTest) {
+  std::string header = "ab";
+  std::string empty;
+  std::string data = "cdefghi";
+  std::array<std::string_view, 3> segments {header, empty, data};
+  uint8_t *slices[3];
+  uint8_t scratch[3 * 3];
+
+  auto copied = stream::gather_slices(segments, 3, 0, 3, slices, scratch);
+  ASSERT_EQ(copied, 1);
+
+  // Only the slice spanning the boundary is copied
+  ASSERT_EQ(slices[0], scratch);
+  ASSERT_EQ(slices[1], (uint8_t *) data.data() + 1);
+  ASSERT_EQ(slices[2], (uint8_t *) data.data() + 4);
+
+  auto expected = std::vector<std::string> {"abc", "def", "ghi"};
+  ASSERT_EQ(slices_to_strings(slices, 3, 3), expected);
+}
+
+TEST(GatherSlicesTests, PaddedLastSliceTest) {
+  std::string header = "ab";
+  std::string data = "cdefg";
+  std::array<std::string_view, 2> segments {header, data};
+  uint8_t *slices[3];
+  uint8_t scratch[2 * 3];
+
+  auto copied = stream::gather_slices(segments, 3, 0, 3, slices, scratch);
+  ASSERT_EQ(copied, 2);
+
+  auto expected = std::vector<std::string> {"abc", "def", std::string {'g', 0, 0}};
+  ASSERT_EQ(slices_to_strings(slices, 3, 3), expected);
 }
 
-TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
-  char b1[] = {'a', 'b'};
-  char b2[] = {'c', 'd', 'e'};
-  auto res = stream::concat_and_insert(1, 1, std::string_view {b1, sizeof(b1)}, std::string_view {b2, sizeof(b2)});
-  auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
-  ASSERT_EQ(res, expected);
+TEST(GatherSlicesTests, SliceRangeTest) {
+  std::string header = "ab";
+  std::string data = "cdefghij";
+  std::array<std::string_view, 2> segments {header, data};
+  uint8_t *slices[2];
+  uint8_t scratch[2 * 2];
+
+  // Only the slices after the first one, as for a later FEC block
+  auto copied = stream::gather_slices(segments, 2, 3, 2, slices, scratch);
+  ASSERT_EQ(copied, 0);
+  ASSERT_EQ(slices[0], (uint8_t *) data.data() + 4);
+  ASSERT_EQ(slices[1], (uint8_t *) data.data() + 6);
+}
+
+TEST(AudioTimestampTests, FollowCaptureClockTest) {
+  // The first packet starts at the time it was captured
+  ASSERT_EQ(stream::audio_timestamp(0, std::chrono::milliseconds(42), 5, true), 42);
+
+  // Within a FEC block, the packets are evenly spaced whenever they were captured
+  ASSERT_EQ(stream::audio_timestamp(47, std::chrono::milliseconds(60), 5, false), 47);
+
+  // Less than a packet of drift is left alone
+  ASSERT_EQ(stream::audio_timestamp(62, std::chrono::microseconds(65900), 5, true), 62);
+
+  // The capture clock running ahead is followed at once
+  ASSERT_EQ(stream::audio_timestamp(62, std::chrono::milliseconds(70), 5, true), 70);
+}
+
+TEST(AudioTimestampTests, SlowCaptureClockTest) {
+  // The capture clock running behind is followed by less than a packet at a time, so timestamps keep increasing
+  ASSERT_EQ(stream::audio_timestamp(100, std::chrono::milliseconds(80), 5, true), 96);
+  ASSERT_EQ(stream::audio_timestamp(100, std::chrono::milliseconds(96), 5, true), 100);
+
+  // The media clock wraps around
+  ASSERT_EQ(stream::audio_timestamp(0xFFFFFFFE, std::chrono::milliseconds(0x100000003), 5, true), 3);
 }
@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_task_pool.cpp
+ * @brief Test src/task_pool.h
+ */
+#include "../tests_common.h"
+
+#include <src/task_pool.h>
+
+using namespace std::literals;
+
+namespace {
+  void push_order(std::vector<int> &order, int x) {
+    order.push_back(x);
+  }
+
+  void run_ready(task_pool_util::TaskPool &pool) {
+    while (auto task = pool.pop()) {
+      task->run();
+    }
+  }
+}  // namespace
+
+TEST(TaskPoolTests, DelayedOrderTest) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  // Already due, in a shuffled order and with ties
+  for (auto [x, delay] : std::vector<std::pair<int, int>> {{3, -10}, {0, -40}, {4, -10}, {1, -30}, {2, -20}, {5, -10}}) {
+    pool.pushDelayed(push_order, std::chrono::milliseconds {delay}, std::ref(order), x);
+  }
+  pool.pushDelayed(push_order, 1h, std::ref(order), 6);
+
+  run_ready(pool);
+  ASSERT_EQ(order, (std::vector<int> {0, 1, 2, 3, 4, 5}));
+  ASSERT_FALSE(pool.ready());
+  ASSERT_TRUE(pool.next());
+}
+
+TEST(TaskPoolTests, CancelTest) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  std::vector<task_pool_util::TaskPool::task_id_t> ids;
+  for (int x = 0; x < 8; ++x) {
+    ids.push_back(pool.pushDelayed(push_order, std::chrono::milliseconds {x - 100}, std::ref(order), x).task_id);
+  }
+
+  ASSERT_TRUE(pool.cancel(ids[0]));
+  ASSERT_TRUE(pool.cancel(ids[5]));
+  ASSERT_TRUE(pool.cancel(ids[3]));
+  ASSERT_FALSE(pool.cancel(ids[3]));
+
+  run_ready(pool);
+  ASSERT_EQ(order, (std::vector<int> {1, 2, 4, 6, 7}));
+  ASSERT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, DelayTest) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  auto later = pool.pushDelayed(push_order, 1h, std::ref(order), 0).task_id;
+  auto sooner = pool.pushDelayed(push_order, -1ms, std::ref(order), 1).task_id;
+
+  // Bring the first task forward before the second, then push the second back
+  pool.delay(later, -10ms);
+  pool.delay(sooner, 1h);
+
+  run_ready(pool);
+  ASSERT_EQ(order, (std::vector<int> {0}));
+
+  auto task = pool.pop(sooner);
+  ASSERT_TRUE(task);
+  ASSERT_FALSE(pool.next());
+}
+
+TEST(TaskPoolTests, PostTest) {
+  task_pool_util::TaskPool pool;
+  std::vector<int> order;
+
+  // Small enough to be stored inline, and too large for it
+  std::array<char, 256> large {};
+  large[0] = 2;
+
+  pool.post(push_order, std::ref(order), 0);
+  pool.post([&order, ptr = std::make_unique<int>(1)]() {
+    order.push_back(*ptr);
+  });
+  pool.post([&order, large]() {
+    order.push_back(large[0]);
+  });
+  auto future = pool.push([&order]() {
+    order.push_back(3);
+    return 4;
+  });
+
+  run_ready(pool);
+  ASSERT_EQ(order, (std::vector<int> {0, 1, 2, 3}));
+  ASSERT_EQ(future.get(), 4);
+}
@@ -0,0 +1,35 @@
+/**
+ * @file tests/unit/test_thread_affinity.cpp
+ * @brief Test src/thread_affinity.*
+ */
+#include "../tests_common.h"
+
+#include <src/thread_affinity.h>
+
+namespace {
+  std::vector<int> node_cpus(int node) {
+    if (node == 1) {
+      return {8, 9, 10, 11};
+    }
+
+    return {};
+  }
+}  // namespace
+
+TEST(ThreadAffinityTests, ParseCpusTest) {
+  ASSERT_EQ(thread_affinity::parse_cpus("[3, 1, 2]", node_cpus), (std::vector<int> {1, 2, 3}));
+  ASSERT_EQ(thread_affinity::parse_cpus("0-3,16-17", node_cpus), (std::vector<int> {0, 1, 2, 3, 16, 17}));
+  ASSERT_TRUE(thread_affinity::parse_cpus("", node_cpus).empty());
+}
+
+TEST(ThreadAffinityTests, ParseNodesTest) {
+  // NUMA nodes stand for their CPUs and overlaps are merged
+  ASSERT_EQ(thread_affinity::parse_cpus("[node1,10-12]", node_cpus), (std::vector<int> {8, 9, 10, 11, 12}));
+
+  // Unknown nodes are skipped
+  ASSERT_EQ(thread_affinity::parse_cpus("node5,4", node_cpus), (std::vector<int> {4}));
+}
+
+TEST(ThreadAffinityTests, ParseInvalidTest) {
+  ASSERT_EQ(thread_affinity::parse_cpus("1,x,5-2,-1,7", node_cpus), (std::vector<int> {1, 7}));
+}
@@ -0,0 +1,62 @@
+/**
+ * @file tests/unit/test_thread_pool.cpp
+ * @brief Test src/thread_pool.h
+ */
+#include "../tests_common.h"
+
+#include <src/thread_pool.h>
+
+using namespace std::literals;
+
+TEST(ThreadPoolTests, RunAllTest) {
+  thread_pool_util::ThreadPool pool {4};
+
+  std::atomic<int> count {};
+  std::vector<std::future<void>> futures;
+  for (int x = 0; x < 10000; ++x) {
+    futures.emplace_back(pool.push([&count]() {
+      ++count;
+    }));
+  }
+
+  for (auto &future : futures) {
+    future.get();
+  }
+  ASSERT_EQ(count, 10000);
+
+  // A task of the pool can push more tasks
+  auto nested = pool.push([&pool]() {
+    return pool.push([]() {
+      return 5;
+    });
+  });
+  ASSERT_EQ(nested.get().get(), 5);
+
+  auto delayed = pool.pushDelayed([]() {
+    return 7;
+  },
+                                  10ms);
+  ASSERT_EQ(delayed.future.get(), 7);
+}
+
+TEST(ThreadPoolTests, OrderTest) {
+  thread_pool_util::ThreadPool pool;
+  std::vector<int> order;
+
+  // A single thread runs the tasks in the order they were pushed, including the ones from before it started
+  pool.push([&order]() {
+    order.push_back(0);
+  });
+  pool.start(1);
+  pool.push([&order]() {
+    order.push_back(1);
+  });
+  pool.push([&order]() {
+        order.push_back(2);
+      })
+    .get();
+  ASSERT_EQ(order, (std::vector<int> {0, 1, 2}));
+
+  pool.stop();
+  pool.join();
+}
@@ -0,0 +1,746 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.h
+ */
+#include "../tests_common.h"
+
+#include <algorithm>
+#include <numeric>
+#include <src/thread_safe.h>
+
+TEST(SpscQueueTests, OrderTest) {
+  safe::spsc_queue_t<std::unique_ptr<int>> queue {4};
+
+  for (int x = 0; x < 4; ++x) {
+    ASSERT_TRUE(queue.raise(std::make_unique<int>(x)));
+  }
+
+  for (int x = 0; x < 4; ++x) {
+    auto val = queue.pop();
+    ASSERT_TRUE(val);
+    ASSERT_EQ(*val, x);
+  }
+  ASSERT_FALSE(queue.peek());
+}
+
+TEST(SpscQueueTests, FullTest) {
+  safe::spsc_queue_t<std::unique_ptr<int>> queue {3};
+
+  // The ring holds at least the requested number of elements
+  int raised = 0;
+  while (queue.raise(std::make_unique<int>(raised))) {
+    ++raised;
+  }
+  ASSERT_GE(raised, 3);
+
+  // The element that didn't fit was dropped, the others are untouched
+  ASSERT_EQ(*queue.pop(), 0);
+  ASSERT_TRUE(queue.raise(std::make_unique<int>(raised)));
+}
+
+TEST(SpscQueueTests, TryPopTest) {
+  safe::spsc_queue_t<std::unique_ptr<int>> queue {4};
+
+  ASSERT_FALSE(queue.try_pop());
+
+  ASSERT_TRUE(queue.raise(std::make_unique<int>(1)));
+  auto val = queue.try_pop();
+  ASSERT_TRUE(val);
+  ASSERT_EQ(*val, 1);
+  ASSERT_FALSE(queue.try_pop());
+}
+
+TEST(SpscQueueTests, StopTest) {
+  safe::spsc_queue_t<std::unique_ptr<int>> queue {4, 16};
+
+  std::thread consumer {[&queue]() {
+    ASSERT_FALSE(queue.pop());
+  }};
+
+  std::this_thread::sleep_for(10ms);
+  queue.stop();
+  consumer.join();
+
+  ASSERT_FALSE(queue.running());
+  ASSERT_FALSE(queue.raise(std::make_unique<int>(0)));
+}
+
+TEST(SpscQueueTests, ThreadedTest) {
+  constexpr int count = 100000;
+  safe::spsc_queue_t<std::unique_ptr<int>> queue {8, 64};
+
+  std::thread producer {[&queue]() {
+    for (int x = 0; x < count; ++x) {
+      while (!queue.raise(std::make_unique<int>(x))) {
+        std::this_thread::yield();
+      }
+    }
+  }};
+
+  for (int x = 0; x < count; ++x) {
+    auto val = queue.pop();
+    ASSERT_TRUE(val);
+    ASSERT_EQ(*val, x);
+  }
+
+  producer.join();
+}
+
+TEST(SpscRingTests, WrapTest) {
+  safe::spsc_ring_t<float> ring {8};
+  ASSERT_EQ(ring.capacity(), 8);
+
+  std::vector<float> out(3);
+  for (int x = 0; x < 10; ++x) {
+    float block[3] {x * 3.f, x * 3.f + 1, x * 3.f + 2};
+    ASSERT_TRUE(ring.write(block, 3));
+
+    ASSERT_TRUE(ring.read(out.data(), 3, 0ms));
+    ASSERT_EQ(out, std::vector<float>(std::begin(block), std::end(block)));
+  }
+  ASSERT_EQ(ring.size(), 0);
+}
+
+TEST(SpscRingTests, OverrunTest) {
+  safe::spsc_ring_t<float> ring {8};
+
+  std::vector<float> block {1, 2, 3, 4, 5};
+  ASSERT_TRUE(ring.write(block.data(), block.size()));
+
+  // A block that doesn't fit is dropped whole
+  ASSERT_FALSE(ring.write(block.data(), block.size()));
+  ASSERT_EQ(ring.overruns(), 1);
+  ASSERT_EQ(ring.size(), 5);
+
+  std::vector<float> out(5);
+  ASSERT_TRUE(ring.read(out.data(), out.size(), 0ms));
+  ASSERT_EQ(out, block);
+}
+
+TEST(SpscRingTests, UnderrunTest) {
+  safe::spsc_ring_t<float> ring {8};
+
+  float block[2] {1, 2};
+  ASSERT_TRUE(ring.write(block, 2));
+
+  // A partial block is left in the ring for the next read
+  std::vector<float> out(4);
+  ASSERT_FALSE(ring.read(out.data(), out.size(), 10ms));
+  ASSERT_EQ(ring.underruns(), 1);
+  ASSERT_EQ(ring.size(), 2);
+
+  ASSERT_TRUE(ring.write(block, 2));
+  ASSERT_TRUE(ring.read(out.data(), out.size(), 0ms));
+  ASSERT_EQ(out, (std::vector<float> {1, 2, 1, 2}));
+}
+
+TEST(SpscRingTests, StopTest) {
+  safe::spsc_ring_t<float> ring {8};
+
+  std::thread consumer {[&ring]() {
+    float out[4];
+    ASSERT_FALSE(ring.read(out, 4, 10s));
+  }};
+
+  std::this_thread::sleep_for(10ms);
+  ring.stop();
+  consumer.join();
+
+  ASSERT_FALSE(ring.running());
+  ASSERT_EQ(ring.underruns(), 0);
+
+  float block[1] {};
+  ASSERT_FALSE(ring.write(block, 1));
+}
+
+TEST(SpscRingTests, ThreadedTest) {
+  constexpr int count = 100000;
+  safe::spsc_ring_t<int> ring {64};
+
+  std::thread producer {[&ring]() {
+    for (int x = 0; x < count; x += 4) {
+      int block[4] {x, x + 1, x + 2, x + 3};
+      while (!ring.write(block, 4)) {
+        std::this_thread::yield();
+      }
+    }
+  }};
+
+  // Reads don't line up with the writes
+  int out[5];
+  for (int x = 0; x + 5 <= count; x += 5) {
+    ASSERT_TRUE(ring.read(out, 5, 10s));
+    for (int y = 0; y < 5; ++y) {
+      ASSERT_EQ(out[y], x + y);
+    }
+  }
+
+  producer.join();
+  ASSERT_EQ(ring.underruns(), 0);
+}
+
+TEST(SnapshotTests, StoreTest) {
+  struct value_t {
+    bool flag;
+    std::uint16_t numbers[5];
+  };
+
+  safe::snapshot_t<value_t> snapshot;
+  ASSERT_FALSE(snapshot.load().flag);
+  ASSERT_EQ(snapshot.version(), 0);
+
+  snapshot.store({true, {1, 2, 3, 4, 5}});
+  auto value = snapshot.load();
+  ASSERT_TRUE(value.flag);
+  ASSERT_EQ(value.numbers[4], 5);
+  ASSERT_EQ(snapshot.version(), 1);
+}
+
+TEST(SnapshotTests, ThreadedTest) {
+  // Every field of a stored value is the same, a torn read would mix two of them
+  struct value_t {
+    std::uint32_t fields[9];
+  };
+
+  safe::snapshot_t<value_t> snapshot;
+  std::atomic_bool done {false};
+
+  std::thread writer {[&]() {
+    for (std::uint32_t x = 1; x <= 20000; ++x) {
+      value_t value;
+      std::fill(std::begin(value.fields), std::end(value.fields), x);
+      snapshot.store(value);
+    }
+    done = true;
+  }};
+
+  std::uint32_t last = 0;
+  while (!done) {
+    auto value = snapshot.load();
+    ASSERT_TRUE(std::all_of(std::begin(value.fields), std::end(value.fields), [&value](auto field) {
+      return field == value.fields[0];
+    }));
+    ASSERT_GE(value.fields[0], last);
+    last = value.fields[0];
+  }
+  writer.join();
+
+  ASSERT_EQ(snapshot.load().fields[8], 20000);
+}
+
+TEST(MailTests, PostTest) {
+  auto mail = std::make_shared<safe::mail_raw_t>();
+
+  // Every user of an id gets the same post while it's alive
+  auto event = mail->event<int>(0);
+  ASSERT_EQ(event, mail->event<int>(0));
+  ASSERT_NE(std::static_pointer_cast<void>(event), std::static_pointer_cast<void>(mail->queue<int>(1)));
+
+  event->raise(5);
+  ASSERT_EQ(mail->event<int>(0)->pop(), 5);
+
+  // A new post replaces the destroyed one
+  std::weak_ptr<void> weak = event;
+  event.reset();
+  ASSERT_TRUE(weak.expired());
+  ASSERT_TRUE(mail->event<int>(0));
+}
+
+TEST(QueueTests, OverflowTest) {
+  auto raise_all = [](safe::queue_t<int> &queue) {
+    for (int x = 0; x < 5; ++x) {
+      queue.raise(x);
+    }
+  };
+
+  auto drain = [](safe::queue_t<int> &queue) {
+    std::vector<int> values;
+    while (queue.peek()) {
+      values.push_back(*queue.pop());
+    }
+
+    return values;
+  };
+
+  safe::queue_t<int> clear {3, safe::overflow_e::clear};
+  raise_all(clear);
+  ASSERT_EQ(drain(clear), (std::vector<int> {3, 4}));
+  ASSERT_EQ(clear.stats().dropped, 3);
+
+  safe::queue_t<int> oldest {3, safe::overflow_e::drop_oldest};
+  raise_all(oldest);
+  ASSERT_EQ(drain(oldest), (std::vector<int> {2, 3, 4}));
+  ASSERT_EQ(oldest.stats().dropped, 2);
+
+  safe::queue_t<int> newest {3, safe::overflow_e::drop_newest};
+  raise_all(newest);
+  ASSERT_EQ(drain(newest), (std::vector<int> {0, 1, 2}));
+  ASSERT_EQ(newest.stats().dropped, 2);
+
+  // Only the latest element is kept
+  safe::queue_t<int> latest {1, safe::overflow_e::drop_oldest};
+  raise_all(latest);
+  ASSERT_EQ(drain(latest), (std::vector<int> {4}));
+}
+
+TEST(QueueTests, SizeTest) {
+  safe::queue_t<int> queue {4};
+  ASSERT_EQ(queue.stats().size, 0);
+
+  queue.raise(0);
+  queue.raise(1);
+  ASSERT_EQ(queue.stats().size, 2);
+
+  ASSERT_EQ(*queue.pop(), 0);
+  ASSERT_EQ(queue.stats().size, 1);
+}
+
+TEST(QueueTests, BlockTest) {
+  safe::queue_t<int> queue {2, safe::overflow_e::block};
+
+  std::thread producer {[&queue]() {
+    for (int x = 0; x < 100; ++x) {
+      queue.raise(x);
+    }
+  }};
+
+  // Nothing is dropped while the producer waits for room
+  for (int x = 0; x < 100; ++x) {
+    ASSERT_EQ(*queue.pop(), x);
+  }
+  producer.join();
+  ASSERT_EQ(queue.stats().dropped, 0);
+
+  // A stopped queue doesn't keep its producer waiting
+  queue.raise(0);
+  queue.raise(1);
+  std::thread blocked {[&queue]() {
+    queue.raise(2);
+  }};
+  queue.stop();
+  blocked.join();
+}
+
+TEST(MailTests, QueueOptionsTest) {
+  safe::mail_raw_t::options_t options {};
+  options[1] = {4, safe::overflow_e::drop_newest};
+  auto mail = std::make_shared<safe::mail_raw_t>(options);
+
+  ASSERT_FALSE(mail->queue_stats(1));
+
+  auto queue = mail->queue<int>(1);
+  for (int x = 0; x < 6; ++x) {
+    queue->raise(x);
+  }
+
+  auto stats = mail->queue_stats(1);
+  ASSERT_TRUE(stats);
+  ASSERT_EQ(stats->options.max_elements, 4);
+  ASSERT_EQ(stats->dropped, 2);
+
+  queue.reset();
+  ASSERT_FALSE(mail->queue_stats(1));
+}
+
+TEST(EventTests, PeekTest) {
+  safe::event_t<int> event;
+  ASSERT_TRUE(event.running());
+  ASSERT_FALSE(event.peek());
+
+  event.raise(1);
+  ASSERT_TRUE(event.peek());
+  ASSERT_EQ(*event.view(), 1);
+  ASSERT_TRUE(event.peek());
+  ASSERT_EQ(*event.pop(), 1);
+  ASSERT_FALSE(event.peek());
+
+  event.raise(2);
+  event.stop();
+  ASSERT_FALSE(event.running());
+  ASSERT_FALSE(event.peek());
+
+  event.reset();
+  ASSERT_TRUE(event.running());
+  ASSERT_FALSE(event.peek());
+}
+
+TEST(EventTests, WaitTest) {
+  safe::event_t<int> event;
+
+  std::thread producer {[&event]() {
+    for (int x = 0; x < 1000; ++x) {
+      while (event.peek()) {
+        std::this_thread::yield();
+      }
+      event.raise(x);
+    }
+  }};
+
+  for (int x = 0; x < 1000; ++x) {
+    ASSERT_EQ(*event.pop(), x);
+  }
+  producer.join();
+
+  // Stopping the event wakes its waiters up
+  std::thread waiter {[&event]() {
+    ASSERT_FALSE(event.pop());
+  }};
+  std::this_thread::sleep_for(10ms);
+  event.stop();
+  waiter.join();
+}
+
+TEST(QueueTests, PopAllTest) {
+  safe::queue_t<int> queue;
+  for (int x = 0; x < 3; ++x) {
+    queue.raise(x);
+  }
+
+  std::vector<int> values {7};
+  ASSERT_TRUE(queue.pop_all(values));
+  ASSERT_EQ(values, (std::vector<int> {0, 1, 2}));
+  ASSERT_FALSE(queue.peek());
+
+  // Waits for the next element
+  std::thread producer {[&queue]() {
+    std::this_thread::sleep_for(10ms);
+    queue.raise(3);
+  }};
+  ASSERT_TRUE(queue.pop_all(values));
+  ASSERT_EQ(values, (std::vector<int> {3}));
+  producer.join();
+
+  queue.stop();
+  ASSERT_FALSE(queue.pop_all(values));
+  ASSERT_TRUE(values.empty());
+}
+
+TEST(SharedTests, RefTest) {
+  struct object_t {
+    int value {};
+  };
+
+  int constructed = 0;
+  int destructed = 0;
+  bool fail = true;
+  auto shared = safe::make_shared<object_t>([&](object_t &object) {
+    if (fail) {
+      return -1;
+    }
+
+    ++constructed;
+    object.value = 5;
+    return 0;
+  }, [&](object_t &) {
+    ++destructed;
+  });
+
+  // A failed construction leaves nothing behind
+  ASSERT_FALSE(shared.ref());
+  fail = false;
+
+  {
+    auto ref = shared.ref();
+    ASSERT_TRUE(ref);
+    ASSERT_EQ(ref->value, 5);
+
+    auto copy = ref;
+    ASSERT_EQ(constructed, 1);
+  }
+  ASSERT_EQ(destructed, 1);
+
+  // References taken and dropped concurrently keep the object alive in between
+  auto ref = shared.ref();
+  std::vector<std::thread> threads;
+  for (int x = 0; x < 4; ++x) {
+    threads.emplace_back([&shared]() {
+      for (int y = 0; y < 10000; ++y) {
+        auto ref = shared.ref();
+        ASSERT_EQ(ref->value, 5);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(constructed, 2);
+
+  ref = {};
+  ASSERT_EQ(destructed, 2);
+}
+
+// The tests below race several threads on the same primitive, build the tests
+// with TESTS_SANITIZER=thread to have the data races reported as well
+
+TEST(QueueTests, ContentionTest) {
+  constexpr int producers = 4;
+  constexpr int consumers = 4;
+  constexpr int count = 10000;
+
+  safe::queue_t<int> queue {16, safe::overflow_e::block};
+
+  std::vector<std::vector<int>> received(consumers);
+  std::vector<std::thread> threads;
+  for (int x = 0; x < consumers; ++x) {
+    threads.emplace_back([&queue, &values = received[x]]() {
+      while (auto val = queue.pop()) {
+        values.push_back(*val);
+      }
+    });
+  }
+
+  std::vector<std::thread> producer_threads;
+  for (int x = 0; x < producers; ++x) {
+    producer_threads.emplace_back([&queue, x]() {
+      for (int y = 0; y < count; ++y) {
+        queue.raise(x * count + y);
+      }
+    });
+  }
+  for (auto &thread : producer_threads) {
+    thread.join();
+  }
+
+  // The consumers keep what they popped before the queue was stopped
+  while (queue.stats().size) {
+    std::this_thread::yield();
+  }
+  queue.stop();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Each consumer sees the elements of a producer in the order they were raised
+  for (auto &values : received) {
+    std::vector<int> last(producers, -1);
+    for (auto val : values) {
+      ASSERT_GT(val % count, last[val / count]);
+      last[val / count] = val % count;
+    }
+  }
+
+  // Every element is popped exactly once
+  std::vector<int> all;
+  for (auto &values : received) {
+    all.insert(std::end(all), std::begin(values), std::end(values));
+  }
+  std::sort(std::begin(all), std::end(all));
+
+  std::vector<int> expected(producers * count);
+  std::iota(std::begin(expected), std::end(expected), 0);
+  ASSERT_EQ(all, expected);
+  ASSERT_EQ(queue.stats().dropped, 0);
+}
+
+TEST(QueueTests, OverflowContentionTest) {
+  constexpr int producers = 4;
+  constexpr int count = 10000;
+
+  for (auto overflow : {safe::overflow_e::clear, safe::overflow_e::drop_oldest, safe::overflow_e::drop_newest}) {
+    safe::queue_t<int> queue {8, overflow};
+
+    std::uint64_t popped = 0;
+    std::thread consumer {[&queue, &popped]() {
+      std::vector<int> values;
+      while (queue.pop_all(values)) {
+        popped += values.size();
+      }
+    }};
+
+    std::vector<std::thread> threads;
+    for (int x = 0; x < producers; ++x) {
+      threads.emplace_back([&queue]() {
+        for (int y = 0; y < count; ++y) {
+          queue.raise(y);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    while (queue.stats().size) {
+      std::this_thread::yield();
+    }
+    queue.stop();
+    consumer.join();
+
+    // An element is either popped or counted as dropped, never lost
+    auto stats = queue.stats();
+    ASSERT_LE(stats.size, 8);
+    ASSERT_EQ(popped + stats.dropped, producers * count) << (int) overflow;
+  }
+}
+
+TEST(QueueTests, StopRaceTest) {
+  // Stopping wakes up every thread, whatever it's waiting for
+  for (int x = 0; x < 50; ++x) {
+    safe::queue_t<int> queue {2, safe::overflow_e::block};
+
+    std::vector<std::thread> threads;
+    for (int y = 0; y < 4; ++y) {
+      threads.emplace_back([&queue]() {
+        for (int z = 0; queue.running(); ++z) {
+          queue.raise(z);
+        }
+      });
+    }
+    threads.emplace_back([&queue]() {
+      while (queue.pop()) {}
+    });
+    threads.emplace_back([&queue]() {
+      while (queue.pop(1s)) {}
+    });
+    threads.emplace_back([&queue]() {
+      std::vector<int> values;
+      while (queue.pop_all(values)) {}
+    });
+
+    std::this_thread::sleep_for(1ms);
+    queue.stop();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    // Nothing is queued once it's stopped
+    auto size = queue.stats().size;
+    queue.raise(0);
+    ASSERT_EQ(queue.stats().size, size);
+    ASSERT_FALSE(queue.peek());
+  }
+}
+
+TEST(EventTests, ContentionTest) {
+  constexpr int consumers = 4;
+  constexpr int count = 10000;
+
+  safe::event_t<int> event;
+
+  std::vector<std::vector<int>> received(consumers);
+  std::vector<std::thread> threads;
+  for (int x = 0; x < consumers; ++x) {
+    threads.emplace_back([&event, &values = received[x]]() {
+      while (auto val = event.pop()) {
+        values.push_back(*val);
+      }
+    });
+  }
+
+  // A value is only raised once the previous one was popped, so none is overwritten
+  for (int x = 0; x < count; ++x) {
+    while (event.peek()) {
+      std::this_thread::yield();
+    }
+    event.raise(x);
+  }
+  while (event.peek()) {
+    std::this_thread::yield();
+  }
+  event.stop();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Only one of the waiters gets each value
+  std::vector<int> all;
+  for (auto &values : received) {
+    all.insert(std::end(all), std::begin(values), std::end(values));
+  }
+  std::sort(std::begin(all), std::end(all));
+
+  std::vector<int> expected(count);
+  std::iota(std::begin(expected), std::end(expected), 0);
+  ASSERT_EQ(all, expected);
+}
+
+TEST(EventTests, StopRaceTest) {
+  for (int x = 0; x < 50; ++x) {
+    safe::event_t<int> event;
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&event]() {
+      for (int y = 0; event.running(); ++y) {
+        event.raise(y);
+      }
+    });
+    threads.emplace_back([&event]() {
+      while (event.pop()) {}
+    });
+    threads.emplace_back([&event]() {
+      while (event.pop(1s)) {}
+    });
+    threads.emplace_back([&event]() {
+      while (event.view() && event.running()) {}
+    });
+
+    std::this_thread::sleep_for(1ms);
+    event.stop();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    event.raise(0);
+    ASSERT_FALSE(event.peek());
+  }
+}
+
+TEST(SpscQueueTests, StopRaceTest) {
+  for (int x = 0; x < 50; ++x) {
+    safe::spsc_queue_t<std::unique_ptr<int>> queue {4, 16};
+
+    std::thread producer {[&queue]() {
+      for (int y = 0; queue.running(); ++y) {
+        queue.raise(std::make_unique<int>(y));
+      }
+    }};
+
+    // The elements popped before the queue was stopped are still in order
+    std::thread consumer {[&queue]() {
+      int last = -1;
+      while (auto val = queue.pop()) {
+        ASSERT_GT(*val, last);
+        last = *val;
+      }
+    }};
+
+    std::this_thread::sleep_for(1ms);
+    queue.stop();
+    producer.join();
+    consumer.join();
+
+    ASSERT_FALSE(queue.raise(std::make_unique<int>(0)));
+  }
+}
+
+TEST(MailTests, ContentionTest) {
+  constexpr int threads_count = 8;
+
+  auto mail = std::make_shared<safe::mail_raw_t>();
+
+  // The threads asking for the same id at once all get the same post
+  std::vector<std::shared_ptr<void>> events(threads_count);
+  std::vector<std::shared_ptr<void>> queues(threads_count);
+  std::vector<std::thread> threads;
+  for (int x = 0; x < threads_count; ++x) {
+    threads.emplace_back([&, x]() {
+      auto event = mail->event<int>(0);
+      auto queue = mail->queue<int>(1);
+
+      queue->raise(x);
+      events[x] = std::move(event);
+      queues[x] = std::move(queue);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (int x = 1; x < threads_count; ++x) {
+    ASSERT_EQ(events[x], events[0]);
+    ASSERT_EQ(queues[x], queues[0]);
+  }
+
+  auto stats = mail->queue_stats(1);
+  ASSERT_TRUE(stats);
+  ASSERT_EQ(stats->size, threads_count);
+}
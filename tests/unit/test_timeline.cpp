@@ -0,0 +1,100 @@
+/**
+ * @file tests/unit/test_timeline.cpp
+ * @brief Test src/timeline.*.
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <src/timeline.h>
+#include <thread>
+
+namespace {
+  /**
+   * @brief Get the complete events of the dump with this name.
+   */
+  std::vector<nlohmann::json> events_named(const std::string &name) {
+    auto trace = nlohmann::json::parse(timeline::dump());
+
+    std::vector<nlohmann::json> events;
+    for (auto &event : trace["traceEvents"]) {
+      if (event["ph"] == "X" && event["name"] == name) {
+        events.push_back(event);
+      }
+    }
+
+    return events;
+  }
+}  // namespace
+
+TEST(TimelineTest, NotRecordingTest) {
+  timeline::set_recording(false);
+  {
+    timeline::scope_t scope {"test_not_recording", 1};
+  }
+
+  timeline::set_recording(true);
+  ASSERT_TRUE(events_named("test_not_recording").empty());
+  timeline::set_recording(false);
+}
+
+TEST(TimelineTest, ScopeTest) {
+  timeline::set_recording(true);
+  {
+    timeline::scope_t scope {"test_scope", 42};
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  timeline::set_recording(false);
+
+  auto events = events_named("test_scope");
+  ASSERT_EQ(events.size(), 1);
+  ASSERT_EQ(events[0]["args"]["frame"], 42);
+  ASSERT_GE(events[0]["dur"].get<double>(), 2000);
+}
+
+TEST(TimelineTest, ThreadTest) {
+  timeline::set_recording(true);
+
+  std::thread thread {[]() {
+    timeline::set_thread_name("test_thread");
+
+    auto now = std::chrono::steady_clock::now();
+    timeline::record("test_thread_event", timeline::NO_FRAME, now, now + std::chrono::microseconds(5));
+  }};
+  thread.join();
+
+  // The events of a thread outlive it
+  auto events = events_named("test_thread_event");
+  ASSERT_EQ(events.size(), 1);
+  ASSERT_FALSE(events[0].contains("args"));
+  ASSERT_DOUBLE_EQ(events[0]["dur"].get<double>(), 5);
+
+  auto trace = nlohmann::json::parse(timeline::dump());
+  bool named = false;
+  for (auto &event : trace["traceEvents"]) {
+    if (event["ph"] == "M" && event["name"] == "thread_name" && event["tid"] == events[0]["tid"]) {
+      named = event["args"]["name"] == "test_thread";
+    }
+  }
+  ASSERT_TRUE(named);
+
+  // A new recording drops the events of the previous one
+  timeline::set_recording(true);
+  ASSERT_TRUE(events_named("test_thread_event").empty());
+  timeline::set_recording(false);
+}
+
+TEST(TimelineTest, RingTest) {
+  timeline::set_recording(true);
+
+  auto now = std::chrono::steady_clock::now();
+  for (std::size_t x = 0; x < timeline::EVENTS_PER_THREAD + 10; ++x) {
+    timeline::record("test_ring", (std::int64_t) x, now, now);
+  }
+  timeline::set_recording(false);
+
+  // Only the most recent events are kept
+  auto events = events_named("test_ring");
+  ASSERT_EQ(events.size(), timeline::EVENTS_PER_THREAD);
+  ASSERT_EQ(events.front()["args"]["frame"], 10);
+  ASSERT_EQ(events.back()["args"]["frame"], timeline::EVENTS_PER_THREAD + 9);
+}
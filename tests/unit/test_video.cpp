@@ -6,6 +6,10 @@
 
 #include <src/video.h>
 
+extern "C" {
+#include <libavutil/intreadwrite.h>
+}
+
 struct EncoderTest: PlatformTestSuite, testing::WithParamInterface<video::encoder_t *> {
   void SetUp() override {
     auto &encoder = *GetParam();
@@ -48,3 +52,271 @@ INSTANTIATE_TEST_SUITE_P(
 TEST_P(EncoderTest, ValidateEncoder) {
   // todo:: test something besides fixture setup
 }
+
+TEST(FrameBufferPoolTests, ReuseTest) {
+  auto pool = std::make_shared<video::frame_buffer_pool_t>();
+  ASSERT_EQ(pool->acquire().capacity(), 0);
+
+  auto buffer = pool->acquire();
+  buffer.resize(1024);
+  auto data = buffer.data();
+
+  // The packet returns its frame data to the pool once it's gone
+  std::make_unique<video::packet_raw_generic>(std::move(buffer), 1, false, pool).reset();
+
+  auto reused = pool->acquire();
+  ASSERT_TRUE(reused.empty());
+  ASSERT_GE(reused.capacity(), 1024);
+  ASSERT_EQ(reused.data(), data);
+  ASSERT_EQ(pool->acquire().capacity(), 0);
+}
+
+TEST(AvPacketPoolTests, ReuseTest) {
+  auto pool = std::make_shared<video::av_packet_pool_t>();
+
+  auto packet = std::make_unique<video::packet_raw_avcodec>(pool);
+  auto av_packet = packet->av_packet;
+  ASSERT_NE(av_packet, nullptr);
+  ASSERT_EQ(av_new_packet(av_packet, 1024), 0);
+
+  // The packet is unreferenced and kept once it's gone
+  packet.reset();
+
+  packet = std::make_unique<video::packet_raw_avcodec>(pool);
+  ASSERT_EQ(packet->av_packet, av_packet);
+  ASSERT_EQ(packet->av_packet->buf, nullptr);
+  ASSERT_EQ(packet->av_packet->size, 0);
+}
+
+TEST(AvcodecFrameStatsTests, QualityStatsTest) {
+  video::packet_raw_avcodec packet;
+  ASSERT_EQ(av_new_packet(packet.av_packet, 16), 0);
+
+  // Without side data, only the frame type is known
+  video::read_avcodec_frame_stats(packet.av_packet, packet);
+  ASSERT_EQ(packet.frame_type, video::frame_type_e::p);
+  ASSERT_FALSE(packet.qp);
+
+  auto stats = av_packet_new_side_data(packet.av_packet, AV_PKT_DATA_QUALITY_STATS, 8);
+  ASSERT_NE(stats, nullptr);
+  AV_WL32(stats, 27 * FF_QP2LAMBDA);
+  stats[4] = AV_PICTURE_TYPE_B;
+
+  video::read_avcodec_frame_stats(packet.av_packet, packet);
+  ASSERT_EQ(packet.frame_type, video::frame_type_e::b);
+  ASSERT_EQ(packet.qp, 27);
+
+  // The keyframe flag wins over the picture type
+  packet.av_packet->flags |= AV_PKT_FLAG_KEY;
+  stats[4] = AV_PICTURE_TYPE_I;
+  video::read_avcodec_frame_stats(packet.av_packet, packet);
+  ASSERT_EQ(packet.frame_type, video::frame_type_e::idr);
+  ASSERT_EQ(video::frame_type_name(packet.frame_type), "idr");
+}
+
+TEST(RewriteParameterSetsTests, HevcTest) {
+  using namespace std::literals;
+
+  // VPS, SPS, PPS, then an IDR slice that happens to contain the bytes of the SPS
+  auto vps = "\0\0\0\1\x40\x01\xAA"sv;
+  auto sps = "\0\0\0\1\x42\x01\xBB"sv;
+  auto pps = "\0\0\0\1\x44\x01\xCC"sv;
+  auto slice = "\0\0\1\x26\x01\xDD\0\0\0\1\x42\x01\xBB"sv;
+  auto frame = std::string {vps} + std::string {sps} + std::string {pps} + std::string {slice};
+
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back(vps, "\0\0\0\1\x40\x01\xA0\xA1"sv);
+  replacements.emplace_back(sps, "\0\0\0\1\x42\x01\xB0\xB1\xB2"sv);
+
+  std::vector<std::uint8_t> head;
+  auto replaced = video::rewrite_parameter_sets(frame, replacements, true, head);
+
+  // Only the parameter sets are rewritten, the slice is left as is
+  ASSERT_EQ(replaced, vps.size() + sps.size());
+  auto rewritten = std::string {std::begin(head), std::end(head)} + frame.substr(replaced);
+  ASSERT_EQ(rewritten, "\0\0\0\1\x40\x01\xA0\xA1"s + "\0\0\0\1\x42\x01\xB0\xB1\xB2"s + std::string {pps} + std::string {slice});
+}
+
+TEST(RewriteParameterSetsTests, H264Test) {
+  using namespace std::literals;
+
+  // An access unit delimiter comes before the SPS
+  auto frame = "\0\0\0\1\x09\xF0\0\0\0\1\x67\x64\x00\0\0\1\x68\xEE\0\0\1\x65\x88"s;
+
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("\0\0\0\1\x67\x64\x00"sv, "\0\0\0\1\x67\x64\x01"sv);
+
+  std::vector<std::uint8_t> head;
+  auto replaced = video::rewrite_parameter_sets(frame, replacements, false, head);
+  ASSERT_EQ(std::string(std::begin(head), std::end(head)) + frame.substr(replaced), "\0\0\0\1\x09\xF0\0\0\0\1\x67\x64\x01\0\0\1\x68\xEE\0\0\1\x65\x88"s);
+
+  // Nothing is replaced when the parameter sets aren't before the first slice
+  auto slice_first = "\0\0\1\x65\x88\0\0\0\1\x67\x64\x00"s;
+  ASSERT_EQ(video::rewrite_parameter_sets(slice_first, replacements, false, head), 0);
+  ASSERT_TRUE(head.empty());
+}
+
+TEST(TemporalLayerTests, H264Test) {
+  using namespace std::literals;
+
+  // The SPS is referenced, only the slice counts
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x67\x64\0\0\1\x65\x88"sv, 0), 0);
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x67\x64\0\0\1\x41\x9A"sv, 0), 0);
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x09\xF0\0\0\1\x01\x9A"sv, 0), 1);
+}
+
+TEST(TemporalLayerTests, HevcTest) {
+  using namespace std::literals;
+
+  // TRAIL_R in the base layer, then in the second one
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x02\x01\xAA"sv, 1), 0);
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x02\x02\xAA"sv, 1), 1);
+
+  // TRAIL_N in the base layer isn't referenced by the pictures of the base layer
+  ASSERT_EQ(video::temporal_layer("\0\0\0\1\x46\x01\x50\0\0\1\x00\x01\xAA"sv, 1), 1);
+}
+
+TEST(TemporalLayerTests, Av1Test) {
+  using namespace std::literals;
+
+  // A temporal delimiter, then a frame with the extension naming its temporal layer
+  ASSERT_EQ(video::temporal_layer("\x12\x00\x36\x20\x01\xAA"sv, 2), 1);
+  ASSERT_EQ(video::temporal_layer("\x12\x00\x36\x00\x01\xAA"sv, 2), 0);
+
+  // Frames without the extension are in the base layer
+  ASSERT_EQ(video::temporal_layer("\x12\x00\x32\x01\xAA"sv, 2), 0);
+}
+
+TEST(RegionsOfInterestTests, ScaleTest) {
+  using regions_t = std::vector<platf::damage_rect_t>;
+
+  ASSERT_EQ(video::frame_regions_of_interest({{10, 20, 30, 40}}, 1920, 1080, 1920, 1080, 0), (regions_t {{10, 20, 30, 40}}));
+  ASSERT_EQ(video::frame_regions_of_interest({{100, 100, 200, 200}}, 3840, 2160, 1920, 1080, 0), (regions_t {{50, 50, 100, 100}}));
+
+  // The image is centered between the bars the converters add
+  ASSERT_EQ(video::frame_regions_of_interest({{0, 0, 100, 100}}, 1920, 1200, 1920, 1080, 0), (regions_t {{96, 0, 90, 90}}));
+}
+
+TEST(RegionsOfInterestTests, ClipTest) {
+  using regions_t = std::vector<platf::damage_rect_t>;
+
+  // The margin stops at the edges of the frame
+  ASSERT_EQ(video::frame_regions_of_interest({{0, 0, 10, 10}}, 100, 100, 100, 100, 16), (regions_t {{0, 0, 26, 26}}));
+
+  // Regions outside of the frame or without pixels are dropped
+  ASSERT_TRUE(video::frame_regions_of_interest({{200, 200, 10, 10}, {50, 50, 0, 10}}, 100, 100, 100, 100, 0).empty());
+}
+
+TEST(ServerSoftwareTuningTests, SlicesTest) {
+  // One CPU is left to the capture thread
+  ASSERT_EQ(video::server_software_tuning(16, true, 1920, 1080, 60, 1).slices, 15);
+  ASSERT_EQ(video::server_software_tuning(16, false, 1920, 1080, 60, 1).slices, 16);
+
+  // The slices aren't thinner than 64 rows
+  ASSERT_EQ(video::server_software_tuning(64, false, 1280, 720, 60, 1).slices, 11);
+
+  // The client gets at least the slices it asked for
+  ASSERT_EQ(video::server_software_tuning(2, true, 1920, 1080, 60, 4).slices, 4);
+  ASSERT_EQ(video::server_software_tuning(1, true, 1920, 1080, 60, 0).slices, 1);
+}
+
+TEST(ServerSoftwareTuningTests, PresetTest) {
+  using namespace std::literals;
+
+  auto tuning = video::server_software_tuning(16, false, 1920, 1080, 60, 1);
+  ASSERT_EQ(tuning.preset, "veryfast"sv);
+  ASSERT_EQ(tuning.svtav1_preset, 10);
+
+  tuning = video::server_software_tuning(4, false, 1920, 1080, 60, 1);
+  ASSERT_EQ(tuning.preset, "superfast"sv);
+  ASSERT_EQ(tuning.svtav1_preset, 11);
+
+  // 4K at 60 FPS on the same CPUs
+  tuning = video::server_software_tuning(4, false, 3840, 2160, 60, 1);
+  ASSERT_EQ(tuning.preset, "ultrafast"sv);
+  ASSERT_EQ(tuning.svtav1_preset, 12);
+}
+
+TEST(RecoveryDebouncerTests, MergeTest) {
+  ASSERT_EQ(video::merge_invalidated_frames({10, 12}, {11, 15}), std::make_pair<std::int64_t, std::int64_t>(10, 15));
+  // The frames between disjoint ranges are invalidated as well
+  ASSERT_EQ(video::merge_invalidated_frames({20, 21}, {10, 12}), std::make_pair<std::int64_t, std::int64_t>(10, 21));
+}
+
+TEST(RecoveryDebouncerTests, DebounceTest) {
+  using namespace std::literals;
+
+  video::recovery_debouncer_t recovery {100ms};
+  auto now = std::chrono::steady_clock::now();
+
+  ASSERT_TRUE(recovery.accept_recovery(now));
+  recovery.recovered(50, now);
+
+  // The requests of the burst are ignored until the window ends
+  ASSERT_FALSE(recovery.accept_recovery(now + 10ms));
+  ASSERT_FALSE(recovery.accept_recovery(now + 99ms));
+  ASSERT_TRUE(recovery.accept_recovery(now + 100ms));
+
+  // The frames preceding the recovery frame don't need invalidating anymore
+  ASSERT_FALSE(recovery.needs_invalidation({45, 49}));
+  ASSERT_TRUE(recovery.needs_invalidation({48, 50}));
+  ASSERT_EQ(recovery.ignored(), 3);
+}
+
+TEST(RecoveryDebouncerTests, DisabledTest) {
+  using namespace std::literals;
+
+  video::recovery_debouncer_t recovery {0ms};
+  auto now = std::chrono::steady_clock::now();
+
+  recovery.recovered(50, now);
+  ASSERT_TRUE(recovery.accept_recovery(now));
+  ASSERT_EQ(recovery.ignored(), 0);
+}
+
+TEST(TileLayoutTests, SlicesTest) {
+  auto config = [](int width, int videoFormat, int slicesPerFrame) {
+    return video::config_t {width, width * 9 / 16, 60, 20000, slicesPerFrame, 1, 0, videoFormat};
+  };
+  auto layout = [](const video::tile_layout_t &tiles) {
+    return std::make_pair(tiles.columns, tiles.rows);
+  };
+
+  // AV1 has no slices, the client's are tiles biased to rows
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 2, 1), 0, 0)), std::make_pair(1, 1));
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 2, 2), 0, 0)), std::make_pair(1, 2));
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 2, 4), 0, 0)), std::make_pair(2, 2));
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 2, 8), 0, 0)), std::make_pair(2, 4));
+
+  // HEVC keeps the slices, H.264 has no tiles
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 1, 4), 0, 0)), std::make_pair(1, 1));
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 0, 4), 4, 2)), std::make_pair(1, 1));
+}
+
+TEST(TileLayoutTests, ConfiguredTest) {
+  auto config = [](int width, int videoFormat) {
+    return video::config_t {width, width * 9 / 16, 60, 20000, 1, 1, 0, videoFormat};
+  };
+  auto layout = [](const video::tile_layout_t &tiles) {
+    return std::make_pair(tiles.columns, tiles.rows);
+  };
+
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 1), 4, 0), std::make_pair(4, 1));
+  ASSERT_EQ(layout(video::tile_layout(config(3840, 2), 0, 3)), std::make_pair(1, 3));
+
+  // HEVC tile columns are at least 256 pixels wide, AV1 tiles and HEVC tile rows 64
+  ASSERT_EQ(layout(video::tile_layout(config(1280, 1), 8, 64)), std::make_pair(5, 11));
+  ASSERT_EQ(layout(video::tile_layout(config(1280, 2), 64, 64)), std::make_pair(20, 11));
+}
+
+TEST(FrameSizeCapTests, CapTest) {
+  // 20 Mbps at 60 FPS with a buffer of 4 frames, over a link delivering 200 kbit per frame interval
+  ASSERT_EQ(video::cap_frame_size(4 * 333'333, 333'333, 200'000 * 2), 400'000);
+
+  // The buffer is never made smaller than an average frame
+  ASSERT_EQ(video::cap_frame_size(4 * 333'333, 333'333, 100'000), 333'333);
+
+  // Without a cap, or with a buffer already below it, the buffer is kept
+  ASSERT_EQ(video::cap_frame_size(333'333, 333'333, 0), 333'333);
+  ASSERT_EQ(video::cap_frame_size(333'333, 333'333, 10'000'000), 333'333);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file tests/unit/test_web_cache.cpp
+ * @brief Test src/web_cache.*.
+ */
+#include "../tests_common.h"
+
+#include <fstream>
+#include <src/web_cache.h>
+
+using web_cache::encoding_e;
+
+namespace {
+  void write(const std::filesystem::path &path, const std::string &contents) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path, std::ios::binary);
+    out << contents;
+  }
+}  // namespace
+
+struct WebCacheTest: testing::Test {
+  void SetUp() override {
+    root = platf::appdata() / "tests" / "web";
+    std::filesystem::remove_all(root);
+
+    write(root / "index.html", "<html></html>");
+    write(root / "assets" / "app.js", "console.log(1);");
+    write(root / "assets" / "app.js.gz", "gzipped");
+    write(root / "assets" / "app.js.br", "brotli");
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(root);
+  }
+
+  std::filesystem::path root;
+};
+
+TEST_F(WebCacheTest, LoadTest) {
+  web_cache::cache_t cache {root};
+
+  // The precompressed variants aren't assets of their own
+  ASSERT_EQ(cache.load(), 2);
+
+  auto asset = cache.get("assets/app.js");
+  ASSERT_TRUE(asset);
+  ASSERT_EQ(asset->identity, "console.log(1);");
+  ASSERT_EQ(asset->gzip, "gzipped");
+  ASSERT_EQ(asset->brotli, "brotli");
+  ASSERT_EQ(asset->etag.front(), '"');
+  ASSERT_EQ(asset->etag.back(), '"');
+
+  // Lookups of an unchanged file share its contents
+  ASSERT_EQ(cache.get("assets/app.js"), asset);
+
+  ASSERT_FALSE(cache.get("missing.html"));
+  ASSERT_FALSE(cache.get("assets"));
+}
+
+TEST_F(WebCacheTest, InvalidateTest) {
+  web_cache::cache_t cache {root};
+  cache.load();
+
+  auto asset = cache.get("index.html");
+  ASSERT_TRUE(asset);
+
+  write(root / "index.html", "<html><body></body></html>");
+  auto updated = cache.get("index.html");
+  ASSERT_TRUE(updated);
+  ASSERT_EQ(updated->identity, "<html><body></body></html>");
+  ASSERT_NE(updated->etag, asset->etag);
+
+  // Files added after the cache was loaded are read when they're first requested
+  write(root / "pin.html", "<html>pin</html>");
+  ASSERT_TRUE(cache.get("pin.html"));
+
+  std::filesystem::remove(root / "index.html");
+  ASSERT_FALSE(cache.get("index.html"));
+}
+
+TEST_F(WebCacheTest, NegotiateTest) {
+  web_cache::cache_t cache {root};
+  auto asset = cache.get("assets/app.js");
+  ASSERT_TRUE(asset);
+
+  ASSERT_EQ(asset->negotiate(""), encoding_e::identity);
+  ASSERT_EQ(asset->negotiate("gzip"), encoding_e::gzip);
+  ASSERT_EQ(asset->negotiate("gzip, deflate, br"), encoding_e::brotli);
+  ASSERT_EQ(asset->negotiate("GZIP, br;q=0"), encoding_e::gzip);
+  ASSERT_EQ(asset->negotiate("br;q=0, gzip;q=0.0"), encoding_e::identity);
+  ASSERT_EQ(asset->body(encoding_e::brotli), "brotli");
+
+  // Without a variant the asset is sent uncompressed
+  auto page = cache.get("index.html");
+  ASSERT_EQ(page->negotiate("gzip, br"), encoding_e::identity);
+}
+
+TEST(WebCacheTests, MatchesTest) {
+  ASSERT_TRUE(web_cache::matches(R"("abc")", R"("abc")"));
+  ASSERT_TRUE(web_cache::matches(R"("xyz", W/"abc")", R"("abc")"));
+  ASSERT_TRUE(web_cache::matches("*", R"("abc")"));
+  ASSERT_FALSE(web_cache::matches(R"("abcd")", R"("abc")"));
+  ASSERT_FALSE(web_cache::matches("", R"("abc")"));
+}
@@ -0,0 +1,690 @@
+/**
+ * @file tools/loadgen.cpp
+ * @brief A client without a display, to put a host under the load of many streaming sessions.
+ * @details The stream itself is received with moonlight-common-c, which reassembles and checks
+ *          the FEC blocks of the video and audio. It supports a single connection per process,
+ *          so every session is run by a worker process of its own.
+ */
+// standard includes
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <boost/endian/conversion.hpp>
+#include <boost/process/v1.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <curl/curl.h>
+
+extern "C" {
+#include <Limelight.h>
+}
+
+// local includes
+#include "src/crypto.h"
+#include "src/utility.h"
+
+using namespace std::literals;
+namespace bp = boost::process;
+namespace pt = boost::property_tree;
+
+namespace loadgen {
+  // All the sessions share the credentials, so they share the unique id as well
+  constexpr auto UNIQUE_ID = "5375E5B1E5D1053E"sv;
+  constexpr auto DEVICE_NAME = "sunshine-loadgen"sv;
+
+  struct options_t {
+    std::string host;
+    std::uint16_t port = 47989;
+    std::filesystem::path credentials = "loadgen";
+
+    int sessions = 1;
+    int appid = 0;
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int bitrate = 20000;
+    std::chrono::seconds duration {30};
+    int input_rate = 100;
+    std::chrono::milliseconds stagger {1000};
+    bool quit = false;
+    bool verbose = false;
+
+    // The index of the session run by a worker
+    int index = 0;
+
+    // The options as they were given, passed on to the workers
+    std::vector<std::string> args;
+  };
+
+  void print_help() {
+    std::cout
+      << "Usage:"sv << std::endl
+      << "  sunshine-loadgen pair <host> <pin> [options]"sv << std::endl
+      << "  sunshine-loadgen run <host> [options]"sv << std::endl
+      << std::endl
+      << "Pair once, entering the PIN in the Web UI of the host, then run any number of sessions."sv << std::endl
+      << "The host only streams to as many sessions at once as its channels setting allows."sv << std::endl
+      << std::endl
+      << "Options:"sv << std::endl
+      << "  --port <port>          The HTTP port of the host [47989]"sv << std::endl
+      << "  --credentials <dir>    Where the credentials of the pairing are kept [loadgen]"sv << std::endl
+      << "  --sessions <count>     The number of sessions [1]"sv << std::endl
+      << "  --app <id>             The app to stream, the first app of the host if 0 [0]"sv << std::endl
+      << "  --mode <WxHxFPS>       The video mode [1920x1080x60]"sv << std::endl
+      << "  --bitrate <kbps>       The video bitrate [20000]"sv << std::endl
+      << "  --duration <seconds>   How long each session streams [30]"sv << std::endl
+      << "  --input-rate <hz>      The mouse motion events sent per second of each session [100]"sv << std::endl
+      << "  --stagger <ms>         The delay between the start of two sessions [1000]"sv << std::endl
+      << "  --quit                 Quit the app once the sessions ended"sv << std::endl
+      << "  --verbose              Print the log of moonlight-common-c"sv << std::endl;
+  }
+
+  std::optional<options_t> parse_options(const std::string &host, std::vector<std::string> args) {
+    options_t options;
+    options.host = host;
+    options.args = args;
+
+    for (std::size_t x = 0; x < args.size(); ++x) {
+      auto &arg = args[x];
+      auto value = [&]() -> std::optional<std::string> {
+        if (x + 1 >= args.size()) {
+          return std::nullopt;
+        }
+        return args[++x];
+      };
+      auto number = [&]() -> std::optional<int> {
+        auto v = value();
+        if (!v) {
+          return std::nullopt;
+        }
+        try {
+          return std::stoi(*v);
+        } catch (std::exception &) {
+          return std::nullopt;
+        }
+      };
+
+      std::optional<int> n;
+      if (arg == "--quit"sv) {
+        options.quit = true;
+      } else if (arg == "--verbose"sv) {
+        options.verbose = true;
+      } else if (arg == "--credentials"sv) {
+        auto v = value();
+        if (!v) {
+          return std::nullopt;
+        }
+        options.credentials = *v;
+      } else if (arg == "--mode"sv) {
+        auto v = value();
+        if (!v || std::sscanf(v->c_str(), "%dx%dx%d", &options.width, &options.height, &options.fps) != 3) {
+          return std::nullopt;
+        }
+      } else if (!(n = number())) {
+        return std::nullopt;
+      } else if (arg == "--port"sv) {
+        options.port = (std::uint16_t) *n;
+      } else if (arg == "--sessions"sv) {
+        options.sessions = *n;
+      } else if (arg == "--app"sv) {
+        options.appid = *n;
+      } else if (arg == "--bitrate"sv) {
+        options.bitrate = *n;
+      } else if (arg == "--duration"sv) {
+        options.duration = std::chrono::seconds {*n};
+      } else if (arg == "--input-rate"sv) {
+        options.input_rate = *n;
+      } else if (arg == "--stagger"sv) {
+        options.stagger = std::chrono::milliseconds {*n};
+      } else if (arg == "--index"sv) {
+        options.index = *n;
+      } else {
+        return std::nullopt;
+      }
+    }
+
+    return options;
+  }
+
+  std::size_t append_body(char *data, std::size_t size, std::size_t count, void *body) {
+    ((std::string *) body)->append(data, size * count);
+    return size * count;
+  }
+
+  /**
+   * @brief Send a request to the host and parse its answer.
+   * @param options The options.
+   * @param https `true` to authenticate with the paired credentials.
+   * @param path The path and the query of the request.
+   * @return The answer, std::nullopt if the request failed.
+   */
+  std::optional<pt::ptree> request(const options_t &options, bool https, const std::string &path) {
+    std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl {curl_easy_init(), curl_easy_cleanup};
+    if (!curl) {
+      return std::nullopt;
+    }
+
+    // The HTTPS port is 5 below the HTTP port, as the host maps them
+    auto port = https ? options.port - 5 : options.port;
+    auto url = (https ? "https://"s : "http://"s) + options.host + ':' + std::to_string(port) + path;
+    auto cert = (options.credentials / "cert.pem").string();
+    auto key = (options.credentials / "key.pem").string();
+
+    std::string body;
+    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, append_body);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &body);
+    if (https) {
+      curl_easy_setopt(curl.get(), CURLOPT_SSLCERT, cert.c_str());
+      curl_easy_setopt(curl.get(), CURLOPT_SSLKEY, key.c_str());
+
+      // The certificate of the host is self-signed, a load test doesn't need to guard against impostors
+      curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, 0L);
+      curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+
+    if (auto status = curl_easy_perform(curl.get()); status != CURLE_OK) {
+      std::cerr << "Request to "sv << url << " failed: "sv << curl_easy_strerror(status) << std::endl;
+      return std::nullopt;
+    }
+
+    pt::ptree tree;
+    try {
+      std::istringstream in {body};
+      pt::read_xml(in, tree);
+    } catch (std::exception &e) {
+      std::cerr << "Couldn't parse the answer to "sv << path.substr(0, path.find('?')) << ": "sv << e.what() << std::endl;
+      return std::nullopt;
+    }
+
+    if (tree.get("root.<xmlattr>.status_code", 0) != 200) {
+      std::cerr << path.substr(0, path.find('?')) << " failed: "sv << tree.get("root.<xmlattr>.status_message", "unknown error"s) << std::endl;
+      return std::nullopt;
+    }
+
+    return tree;
+  }
+
+  std::string pair_path(const std::string &query) {
+    return "/pair?uniqueid="s + std::string {UNIQUE_ID} + "&devicename=" + std::string {DEVICE_NAME} + "&updateState=1&" + query;
+  }
+
+  bool write_file(const std::filesystem::path &path, const std::string &contents) {
+    std::ofstream out {path, std::ios::binary};
+    out << contents;
+    return (bool) out;
+  }
+
+  /**
+   * @brief Pair with the host, as a client would, and keep the credentials.
+   * @return 0 on success.
+   */
+  int pair(const options_t &options, const std::string &pin) {
+    auto creds = crypto::gen_creds("Sunshine Load Generator"sv, 2048);
+    auto client_cert = crypto::x509(creds.x509);
+
+    auto salt = crypto::rand(16);
+    std::array<std::uint8_t, 16> salt_bytes;
+    std::copy_n(std::begin(salt), salt_bytes.size(), std::begin(salt_bytes));
+    crypto::cipher::ecb_t cipher {crypto::gen_aes_key(salt_bytes, pin), false};
+
+    std::cout << "Enter the PIN "sv << pin << " in the Web UI of the host to pair"sv << std::endl;
+
+    // Answered once the PIN was entered
+    auto tree = request(options, false, pair_path("phrase=getservercert&salt="s + util::hex_vec(salt, true) + "&clientcert=" + util::hex_vec(creds.x509, true)));
+    if (!tree || tree->get("root.paired", 0) != 1) {
+      return 1;
+    }
+    auto server_pem = util::from_hex_vec(tree->get<std::string>("root.plaincert", ""), true);
+    auto server_cert = crypto::x509(server_pem);
+    if (!server_cert) {
+      std::cerr << "The host sent an invalid certificate"sv << std::endl;
+      return 1;
+    }
+
+    auto challenge = crypto::rand(16);
+    std::vector<std::uint8_t> encrypted;
+    cipher.encrypt(challenge, encrypted);
+    tree = request(options, false, pair_path("clientchallenge="s + util::hex_vec(encrypted, true)));
+    if (!tree) {
+      return 1;
+    }
+
+    // The hash proving the host knows the PIN, followed by the challenge of the host
+    std::vector<std::uint8_t> response;
+    cipher.decrypt(util::from_hex_vec(tree->get<std::string>("root.challengeresponse", ""), true), response);
+    if (response.size() < 48) {
+      std::cerr << "The host sent an invalid challenge response"sv << std::endl;
+      return 1;
+    }
+    std::string server_hash {response.begin(), response.begin() + 32};
+    std::string server_challenge {response.begin() + 32, response.begin() + 48};
+
+    auto client_secret = crypto::rand(16);
+    auto client_hash = crypto::hash(server_challenge + std::string {crypto::signature(client_cert)} + client_secret);
+    cipher.encrypt(std::string_view {(char *) client_hash.data(), client_hash.size()}, encrypted);
+    tree = request(options, false, pair_path("serverchallengeresp="s + util::hex_vec(encrypted, true)));
+    if (!tree) {
+      return 1;
+    }
+
+    auto pairing_secret = util::from_hex_vec(tree->get<std::string>("root.pairingsecret", ""), true);
+    if (pairing_secret.size() <= 16) {
+      std::cerr << "The host sent an invalid pairing secret"sv << std::endl;
+      return 1;
+    }
+    std::string_view server_secret {pairing_secret.data(), 16};
+    std::string_view server_sign {pairing_secret.data() + 16, pairing_secret.size() - 16};
+
+    auto expected_hash = crypto::hash(challenge + std::string {crypto::signature(server_cert)} + std::string {server_secret});
+    if (!crypto::verify256(server_cert, server_secret, server_sign) || server_hash != std::string_view {(char *) expected_hash.data(), expected_hash.size()}) {
+      std::cerr << "The host didn't prove it knows the PIN, was it mistyped?"sv << std::endl;
+      return 1;
+    }
+
+    auto client_sign = crypto::sign256(crypto::pkey(creds.pkey), client_secret);
+    tree = request(options, false, pair_path("clientpairingsecret="s + util::hex_vec(client_secret + std::string {client_sign.begin(), client_sign.end()}, true)));
+    if (!tree || tree->get("root.paired", 0) != 1) {
+      std::cerr << "The host refused the pairing"sv << std::endl;
+      return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.credentials, ec);
+    if (!write_file(options.credentials / "cert.pem", creds.x509) || !write_file(options.credentials / "key.pem", creds.pkey)) {
+      std::cerr << "Couldn't save the credentials to "sv << options.credentials << std::endl;
+      return 1;
+    }
+
+    if (!request(options, true, pair_path("phrase=pairchallenge"))) {
+      return 1;
+    }
+
+    std::cout << "Paired, the credentials were saved to "sv << options.credentials << std::endl;
+    return 0;
+  }
+
+  /**
+   * @brief What a session saw, collected by the callbacks of moonlight-common-c.
+   */
+  struct stats_t {
+    std::atomic<std::uint64_t> frames {};
+    std::atomic<std::uint64_t> lost_frames {};
+    std::atomic<std::uint64_t> audio_packets {};
+    std::atomic<std::uint64_t> lost_audio_packets {};
+    std::atomic<std::uint64_t> input_events {};
+    std::atomic<std::uint64_t> poor_status_updates {};
+    std::atomic<bool> terminated {};
+
+    std::mutex lock;
+    int fps = 60;
+    int last_frame_number = 0;
+    std::optional<std::chrono::steady_clock::time_point> last_frame;
+
+    // The RFC 3550 estimate of the variation of the time between two frames
+    double jitter_ms = 0;
+
+    double host_latency_ms = 0;
+    std::uint64_t host_latency_samples = 0;
+  };
+
+  // moonlight-common-c has a single connection per process, so do its callbacks
+  stats_t stats;
+  bool verbose = false;
+
+  int submit_decode_unit(PDECODE_UNIT decode_unit) {
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard lg {stats.lock};
+
+    // The frames that couldn't be recovered are skipped
+    if (stats.last_frame_number && decode_unit->frameNumber > stats.last_frame_number + 1) {
+      stats.lost_frames += decode_unit->frameNumber - stats.last_frame_number - 1;
+    }
+    stats.last_frame_number = decode_unit->frameNumber;
+
+    if (stats.last_frame) {
+      auto interval = std::chrono::duration<double, std::milli>(now - *stats.last_frame).count();
+      auto deviation = std::abs(interval - 1000.0 / stats.fps);
+      stats.jitter_ms += (deviation - stats.jitter_ms) / 16;
+    }
+    stats.last_frame = now;
+
+    // In tenths of a millisecond, 0 when the host doesn't report it
+    if (decode_unit->frameHostProcessingLatency) {
+      stats.host_latency_ms += decode_unit->frameHostProcessingLatency / 10.0;
+      ++stats.host_latency_samples;
+    }
+
+    ++stats.frames;
+    return DR_OK;
+  }
+
+  void decode_and_play_sample(char *sample_data, int sample_length) {
+    // Lost packets are passed on without data, for the decoder to conceal them
+    if (!sample_data || !sample_length) {
+      ++stats.lost_audio_packets;
+    } else {
+      ++stats.audio_packets;
+    }
+  }
+
+  void connection_status_update(int status) {
+    if (status == CONN_STATUS_POOR) {
+      ++stats.poor_status_updates;
+    }
+  }
+
+  void connection_terminated(int error_code) {
+    std::cerr << "The connection was terminated: "sv << error_code << std::endl;
+    stats.terminated = true;
+  }
+
+  void stage_failed(int stage, int error_code) {
+    std::cerr << "Starting the stream failed at "sv << LiGetStageName(stage) << ": "sv << error_code << std::endl;
+  }
+
+  void log_message(const char *format, ...) {
+    if (!verbose) {
+      return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+  }
+
+  /**
+   * @brief Run a single session and print what it saw.
+   * @return 0 on success.
+   */
+  int worker(const options_t &options) {
+    verbose = options.verbose;
+    stats.fps = options.fps;
+
+    auto uniqueid = "?uniqueid="s + std::string {UNIQUE_ID};
+    auto serverinfo = request(options, true, "/serverinfo"s + uniqueid);
+    if (!serverinfo) {
+      return 1;
+    }
+
+    auto appid = options.appid;
+    if (!appid) {
+      auto applist = request(options, true, "/applist"s + uniqueid);
+      if (!applist) {
+        return 1;
+      }
+      for (auto &[name, app] : applist->get_child("root")) {
+        if (name == "App"sv) {
+          appid = app.get("ID", 0);
+          break;
+        }
+      }
+    }
+
+    // An app that is already running is joined
+    auto rikey = crypto::rand(16);
+    auto rikeyid = (std::uint32_t) std::chrono::steady_clock::now().time_since_epoch().count() + options.index;
+    auto running = serverinfo->get("root.currentgame", 0) != 0;
+    auto launch = request(
+      options,
+      true,
+      (running ? "/resume"s : "/launch"s) + uniqueid +
+        "&appid=" + std::to_string(appid) +
+        "&mode=" + std::to_string(options.width) + 'x' + std::to_string(options.height) + 'x' + std::to_string(options.fps) +
+        "&additionalStates=1&sops=0&localAudioPlayMode=0&surroundAudioInfo=196610&corever=1" +
+        "&rikey=" + util::hex_vec(rikey, true) +
+        "&rikeyid=" + std::to_string((std::int32_t) rikeyid)
+    );
+    if (!launch) {
+      return 1;
+    }
+
+    auto app_version = serverinfo->get("root.appversion", ""s);
+    auto gfe_version = serverinfo->get("root.GfeVersion", ""s);
+    auto session_url = launch->get("root.sessionUrl0", ""s);
+
+    SERVER_INFORMATION server;
+    LiInitializeServerInformation(&server);
+    server.address = options.host.c_str();
+    server.serverInfoAppVersion = app_version.c_str();
+    server.serverInfoGfeVersion = gfe_version.c_str();
+    server.rtspSessionUrl = session_url.empty() ? nullptr : session_url.c_str();
+    server.serverCodecModeSupport = serverinfo->get("root.ServerCodecModeSupport", 0);
+
+    STREAM_CONFIGURATION config;
+    LiInitializeStreamConfiguration(&config);
+    config.width = options.width;
+    config.height = options.height;
+    config.fps = options.fps;
+    config.bitrate = options.bitrate;
+    config.packetSize = 1392;
+    config.streamingRemotely = STREAM_CFG_LOCAL;
+    config.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    config.supportedVideoFormats = VIDEO_FORMAT_H264;
+    config.encryptionFlags = ENCFLG_ALL;
+    std::memcpy(config.remoteInputAesKey, rikey.data(), sizeof(config.remoteInputAesKey));
+    std::memset(config.remoteInputAesIv, 0, sizeof(config.remoteInputAesIv));
+    auto rikeyid_be = boost::endian::native_to_big(rikeyid);
+    std::memcpy(config.remoteInputAesIv, &rikeyid_be, sizeof(rikeyid_be));
+
+    CONNECTION_LISTENER_CALLBACKS listener;
+    LiInitializeConnectionCallbacks(&listener);
+    listener.stageFailed = stage_failed;
+    listener.connectionTerminated = connection_terminated;
+    listener.connectionStatusUpdate = connection_status_update;
+    listener.logMessage = log_message;
+
+    // The frames and the audio are counted as they arrive, without being decoded
+    DECODER_RENDERER_CALLBACKS video;
+    LiInitializeVideoCallbacks(&video);
+    video.submitDecodeUnit = submit_decode_unit;
+    video.capabilities = CAPABILITY_DIRECT_SUBMIT;
+
+    AUDIO_RENDERER_CALLBACKS audio;
+    LiInitializeAudioCallbacks(&audio);
+    audio.decodeAndPlaySample = decode_and_play_sample;
+    audio.capabilities = CAPABILITY_DIRECT_SUBMIT;
+
+    if (LiStartConnection(&server, &config, &listener, &video, &audio, nullptr, 0, nullptr, 0)) {
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + options.duration;
+
+    // Synthetic input, the mouse moves back and forth so it stays in place
+    std::chrono::nanoseconds input_interval = options.input_rate > 0 ? std::chrono::nanoseconds {1s} / options.input_rate : options.duration;
+    auto next_input = start;
+    short direction = 1;
+    while (!stats.terminated && std::chrono::steady_clock::now() < end) {
+      if (options.input_rate > 0) {
+        LiSendMouseMoveEvent(direction, 0);
+        direction = -direction;
+        ++stats.input_events;
+      }
+
+      next_input += input_interval;
+      std::this_thread::sleep_until(std::min(next_input, end));
+    }
+
+    std::uint32_t rtt = 0;
+    std::uint32_t rtt_variance = 0;
+    LiGetEstimatedRttInfo(&rtt, &rtt_variance);
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LiStopConnection();
+
+    std::lock_guard lg {stats.lock};
+    std::printf(
+      "result session=%d seconds=%.1f frames=%llu lost_frames=%llu fps=%.1f jitter_ms=%.2f host_latency_ms=%.2f "
+      "audio_packets=%llu lost_audio_packets=%llu input_events=%llu rtt_ms=%u poor_status_updates=%llu\n",
+      options.index,
+      seconds,
+      (unsigned long long) stats.frames,
+      (unsigned long long) stats.lost_frames,
+      stats.frames / seconds,
+      stats.jitter_ms,
+      stats.host_latency_samples ? stats.host_latency_ms / stats.host_latency_samples : 0.0,
+      (unsigned long long) stats.audio_packets,
+      (unsigned long long) stats.lost_audio_packets,
+      (unsigned long long) stats.input_events,
+      rtt,
+      (unsigned long long) stats.poor_status_updates
+    );
+    std::fflush(stdout);
+
+    return stats.terminated ? 1 : 0;
+  }
+
+  /**
+   * @brief Start a worker for every session, then sum up what they saw.
+   * @return 0 if all the sessions succeeded.
+   */
+  int run(const std::string &self, const options_t &options) {
+    struct session_t {
+      bp::ipstream out;
+      bp::child child;
+      std::thread reader;
+      std::map<std::string, double> result;
+    };
+
+    std::mutex print_lock;
+    std::vector<std::unique_ptr<session_t>> sessions;
+    for (int x = 0; x < options.sessions; ++x) {
+      auto args = options.args;
+      args.insert(std::begin(args), {"worker"s, options.host, "--index"s, std::to_string(x)});
+
+      auto session = std::make_unique<session_t>();
+      session->child = bp::child(self, bp::args(args), bp::std_out > session->out);
+      session->reader = std::thread([&print_lock, session = session.get()]() {
+        std::string line;
+        while (std::getline(session->out, line)) {
+          {
+            std::lock_guard lg {print_lock};
+            std::cout << line << std::endl;
+          }
+
+          if (!line.starts_with("result "sv)) {
+            continue;
+          }
+
+          std::istringstream fields {line.substr(7)};
+          std::string field;
+          while (fields >> field) {
+            auto equals = field.find('=');
+            if (equals != std::string::npos) {
+              session->result[field.substr(0, equals)] = std::strtod(field.c_str() + equals + 1, nullptr);
+            }
+          }
+        }
+      });
+      sessions.emplace_back(std::move(session));
+
+      // The first session launches the app, the ones after it join
+      if (x + 1 < options.sessions) {
+        std::this_thread::sleep_for(options.stagger);
+      }
+    }
+
+    int failed = 0;
+    std::map<std::string, double> totals;
+    for (auto &session : sessions) {
+      session->child.wait();
+      session->reader.join();
+
+      if (session->child.exit_code() || session->result.empty()) {
+        ++failed;
+        continue;
+      }
+
+      for (auto &[key, value] : session->result) {
+        totals[key] += value;
+      }
+    }
+
+    auto succeeded = options.sessions - failed;
+    std::cout << "sessions="sv << succeeded << '/' << options.sessions;
+    if (succeeded) {
+      std::cout
+        << " frames="sv << (std::uint64_t) totals["frames"]
+        << " lost_frames="sv << (std::uint64_t) totals["lost_frames"]
+        << " mean_fps="sv << totals["fps"] / succeeded
+        << " mean_jitter_ms="sv << totals["jitter_ms"] / succeeded
+        << " mean_host_latency_ms="sv << totals["host_latency_ms"] / succeeded
+        << " audio_packets="sv << (std::uint64_t) totals["audio_packets"]
+        << " lost_audio_packets="sv << (std::uint64_t) totals["lost_audio_packets"];
+    }
+    std::cout << std::endl;
+
+    if (options.quit) {
+      request(options, true, "/cancel?uniqueid="s + std::string {UNIQUE_ID});
+    }
+
+    return failed ? 1 : 0;
+  }
+}  // namespace loadgen
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    loadgen::print_help();
+    return 2;
+  }
+
+  std::string command = argv[1];
+  std::string host = argv[2];
+
+  auto first_option = command == "pair"sv ? 4 : 3;
+  if (argc < first_option) {
+    loadgen::print_help();
+    return 2;
+  }
+
+  auto options = loadgen::parse_options(host, std::vector<std::string>(argv + first_option, argv + argc));
+  if (!options) {
+    loadgen::print_help();
+    return 2;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  auto fg = util::fail_guard([]() {
+    curl_global_cleanup();
+  });
+
+  if (command == "pair"sv) {
+    return loadgen::pair(*options, argv[3]);
+  }
+  if (command == "run"sv) {
+    // The workers are started from the same executable
+    std::string self = argv[0];
+    if (!std::filesystem::path {self}.has_parent_path()) {
+      self = bp::search_path(self).string();
+    }
+
+    return loadgen::run(self, *options);
+  }
+  if (command == "worker"sv) {
+    return loadgen::worker(*options);
+  }
+
+  loadgen::print_help();
+  return 2;
+}